@@ -164,6 +164,8 @@ extern const char* DefRightToolBar;
 
 #define TITLE_PREFIX_MAX 100 // velikost bufferu pro title prefix
 
+#define FINDINDEX_ROOTS_SIZE 2048 // size of the buffer for the roots of the Find content index
+
 typedef struct
 {
     int IconResID;
@@ -214,6 +216,19 @@ struct CConfiguration
         UseSalOpen,             // ma se pouzivat salopen.exe (jinak spousteni asociaci naprimo)
         NetwareFastDirMove,     // ma se na Novell Netware pouzivat fast-dir-move (rename adresaru)? (jinak prejmenovavame jen soubory, adresare se vytvari + stare prazdne mazou) (DUVOD: nekomu proste fast-dir-move na Novellu funguje a tak proste nechce cekat)
         UseAsyncCopyAlg,        // jen Win7+ (starsi OS: vzdy FALSE): ma se pouzivat asynchronni algoritmus kopirovani souboru na sitove disky?
+        CopySmallFilesConcurrently, // ma worker kopirovat male soubory soubezne v pomocnych threadech? (dialogy a progress zustavaji ve workeru)
+        VerifyCopiedFiles,      // ma se po kopirovani souboru cilovy soubor zpetne nacist a porovnat (CRC32) s daty zdroje?
+        CopyChangedBlocksOnly,  // ma se pri prepisu velkeho souboru zapsat jen zmenene bloky (cil se porovnava se zdrojem)?
+        ResumeInterruptedCopies, // ma se navazat prerusena kopie velkeho souboru (a pri cancelu nechat zkopirovanou cast cile)?
+        CopyDuringTreeAnalysis, // ma se pri dlouhe stavbe skriptu zacit kopirovat jeste pred jejim dokoncenim? (bez kontroly volneho mista na cili)
+        CopySparseFiles,        // maji se ridke soubory kopirovat jako ridke? (diry a nulove useky se nezapisuji)
+        MakeZeroRunsSparse,     // ma se i z velkych neridkych souboru udelat ridky cil, pokud obsahuji nulove useky? (jen pri CopySparseFiles)
+        QueueOperationsByDevice, // ma fronta Copy/Move operaci spoustet operace na nezavislych discich soubezne a operace na stejnem disku postupne?
+        DeleteAndChangeAttrsConcurrently, // ma worker mazat a menit atributy soubezne v pomocnych threadech? (dialogy a progress zustavaji ve workeru)
+        RecordCopyTelemetry,    // ma se u Copy/Move operaci merit doba jednotlivych fazi kopirovani a po dokonceni operace ji zapsat do TEMPu? (viz CCopyTelemetry)
+        ReadDirsProgressively,  // ma se velky nebo pomaly diskovy adresar zobrazovat po castech uz behem cteni? (cte ho pomocny thread, viz CFilesWindow::ReadDirectoryBatch)
+        CalcDirSizesConcurrently, // ma se velikost adresaru (Space, Calculate Directory Sizes) pocitat soubezne ve vice threadech? (viz CDirSizeCalculator)
+        CacheDirSizes,          // maji se spocitane velikosti adresaru pamatovat (i po restartu) a pouzit pro nezmenene adresare a v panelu? (viz CDirSizeCache)
         ReloadEnvVariables,     // mame pri zmene env promennych provadet regeneraci?
         QuickRenameSelectAll,   // Quick Rename/Pack ma vybrat vse (ne pouze jmeno) -- lide nadavali na foru po zavedeni noveho oznacovani
         EditNewSelectAll,       // EditNew ma vybrat vse (ne pouze jmeno) -- lide si vyzadali samostnou volbu, protoze nekdo zaklada vzdy .TXT (a vyhovuje mu ze prepise jen jmeno) a nekdo ruzne pripony a chce prepsat cely nazev
@@ -440,6 +455,10 @@ struct CConfiguration
     BOOL SearchFileContent;
     WINDOWPLACEMENT FindDialogWindowPlacement;
     int FindColNameWidth; // sirka sloupcu Name ve Find dialogu
+    int FindWorkerThreads; // number of threads listing directories (search by name) or searching file contents (0 = automatic, 1 = sequential search)
+    BOOL FindDupCompareBytes; // duplicates with the same content: confirm equal MD5 digests by comparing the files byte by byte
+    char FindIndexRoots[FINDINDEX_ROOTS_SIZE]; // directories with a content index for Find (separated by semicolons, empty = no index)
+    BOOL FindSearchArchives; // Find also searches the entries of ZIP, TAR and TAR.GZ archives (read in memory, without unpacking to disk)
 
     // Language
     char LoadedSLGName[MAX_PATH];    // xxxxx.slg, ktere se naloadilo pri startu Salamandera
@@ -0,0 +1,1293 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "copyeng.h" // defines COPYENGINE_IO_URING
+
+#ifndef _WIN32
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef COPYENGINE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif // COPYENGINE_IO_URING
+#endif // _WIN32
+
+#ifdef _WIN32
+
+//
+// ****************************************************************************
+// CCopyIoOverlapped
+//
+
+CCopyIoOverlapped::CCopyIoOverlapped(HANDLE* in, HANDLE* out, OVERLAPPED* overlapped)
+{
+    In = in;
+    Out = out;
+    Overlapped = overlapped;
+    memset(Writing, 0, sizeof(Writing));
+}
+
+OVERLAPPED*
+CCopyIoOverlapped::InitOverlapped(int block, const CQuadWord& offset)
+{
+    Overlapped[block].Internal = 0;
+    Overlapped[block].InternalHigh = 0;
+    Overlapped[block].Offset = offset.LoDWord;
+    Overlapped[block].OffsetHigh = offset.HiDWord;
+    // Overlapped[block].Pointer = 0;  // it's a union, Pointer overlaps with Offset and OffsetHigh
+    return &Overlapped[block];
+}
+
+BOOL CCopyIoOverlapped::StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+{
+    Writing[block] = FALSE;
+    if (!ReadFile(*In, buffer, size, NULL, InitOverlapped(block, offset)) &&
+        GetLastError() != ERROR_IO_PENDING)
+    {
+        *err = GetLastError();
+        if (*err != ERROR_HANDLE_EOF)
+            return FALSE;
+        // synchronously reported EOF, convert it to an asynchronously reported EOF
+        Overlapped[block].Internal = 0xC0000011 /* STATUS_END_OF_FILE */; // NTSTATUS code equivalent to system error code ERROR_HANDLE_EOF
+        Overlapped[block].InternalHigh = 0;
+        SetEvent(Overlapped[block].hEvent);
+    }
+    return TRUE;
+}
+
+BOOL CCopyIoOverlapped::StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+{
+    Writing[block] = TRUE;
+    if (!WriteFile(*Out, buffer, size, NULL, InitOverlapped(block, offset)) &&
+        GetLastError() != ERROR_IO_PENDING)
+    {
+        *err = GetLastError();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL CCopyIoOverlapped::GetResult(int block, DWORD* bytes, DWORD* err)
+{
+    if (GetOverlappedResult(Writing[block] ? *Out : *In, &Overlapped[block], bytes, TRUE))
+    {
+        *err = NO_ERROR;
+        return TRUE;
+    }
+    *err = GetLastError();
+    // when GetOverlappedResult() returns FALSE, it need not return bytes==0, so we clear it explicitly
+    *bytes = 0;
+    return FALSE;
+}
+
+void CCopyIoOverlapped::CancelAll()
+{
+    if (*In != NULL && !CancelIo(*In))
+    {
+        DWORD err = GetLastError();
+        TRACE_E("CCopyIoOverlapped::CancelAll(): CancelIo(IN) failed, error: " << err);
+    }
+    if (*Out != NULL && !CancelIo(*Out))
+    {
+        DWORD err = GetLastError();
+        TRACE_E("CCopyIoOverlapped::CancelAll(): CancelIo(OUT) failed, error: " << err);
+    }
+}
+
+//
+// ****************************************************************************
+// CCopyIoPositional
+//
+
+CCopyIoPositional::CCopyIoPositional(HANDLE* in, HANDLE* out)
+{
+    In = in;
+    Out = out;
+    memset(Bytes, 0, sizeof(Bytes));
+    memset(Error, 0, sizeof(Error));
+}
+
+BOOL CCopyIoPositional::StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+{
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = offset.LoDWord;
+    ov.OffsetHigh = offset.HiDWord;
+    Error[block] = NO_ERROR;
+    if (!ReadFile(*In, buffer, size, &Bytes[block], &ov))
+    {
+        Error[block] = GetLastError();
+        Bytes[block] = 0;
+    }
+    else
+    {
+        if (Bytes[block] == 0 && size > 0) // synchronous reads report EOF as success without data
+            Error[block] = ERROR_HANDLE_EOF;
+    }
+    return TRUE; // even an error is reported through GetResult, like from an asynchronous read
+}
+
+BOOL CCopyIoPositional::StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+{
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = offset.LoDWord;
+    ov.OffsetHigh = offset.HiDWord;
+    Error[block] = NO_ERROR;
+    if (!WriteFile(*Out, buffer, size, &Bytes[block], &ov))
+    {
+        Error[block] = GetLastError();
+        Bytes[block] = 0;
+    }
+    return TRUE;
+}
+
+BOOL CCopyIoPositional::GetResult(int block, DWORD* bytes, DWORD* err)
+{
+    *bytes = Bytes[block];
+    *err = Error[block];
+    return Error[block] == NO_ERROR;
+}
+
+#else // _WIN32
+
+DWORD CopyIoErrorFromErrno(int err)
+{
+    switch (err)
+    {
+    case ENOSPC:
+#ifdef EDQUOT
+    case EDQUOT:
+#endif
+        return ERROR_DISK_FULL;
+    case ECANCELED:
+        return ERROR_OPERATION_ABORTED;
+    case EACCES:
+    case EPERM:
+    case EROFS:
+        return ERROR_ACCESS_DENIED;
+    case ENOENT:
+        return ERROR_FILE_NOT_FOUND;
+    case ENOMEM:
+        return ERROR_NOT_ENOUGH_MEMORY;
+    default:
+        return ERROR_GEN_FAILURE;
+    }
+}
+
+//
+// ****************************************************************************
+// CCopyIoPositional
+//
+
+CCopyIoPositional::CCopyIoPositional(int* in, int* out)
+{
+    In = in;
+    Out = out;
+    memset(Bytes, 0, sizeof(Bytes));
+    memset(Error, 0, sizeof(Error));
+}
+
+BOOL CCopyIoPositional::StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* /*err*/)
+{
+    Bytes[block] = 0;
+    Error[block] = NO_ERROR;
+    while (Bytes[block] < size)
+    {
+        ssize_t res = pread(*In, (BYTE*)buffer + Bytes[block], size - Bytes[block], (off_t)(offset.Value + Bytes[block]));
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            Error[block] = CopyIoErrorFromErrno(errno);
+            Bytes[block] = 0;
+            break;
+        }
+        if (res == 0)
+            break; // end of file
+        Bytes[block] += (DWORD)res;
+    }
+    if (Error[block] == NO_ERROR && Bytes[block] == 0 && size > 0)
+        Error[block] = ERROR_HANDLE_EOF; // reported like from ReadFile
+    return TRUE; // even an error is reported through GetResult, like from an asynchronous read
+}
+
+BOOL CCopyIoPositional::StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* /*err*/)
+{
+    Bytes[block] = 0;
+    Error[block] = NO_ERROR;
+    while (Bytes[block] < size)
+    {
+        ssize_t res = pwrite(*Out, (const BYTE*)buffer + Bytes[block], size - Bytes[block], (off_t)(offset.Value + Bytes[block]));
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            Error[block] = CopyIoErrorFromErrno(errno);
+            Bytes[block] = 0;
+            break;
+        }
+        if (res == 0)
+            break; // nothing written, the engine reports ERROR_DISK_FULL
+        Bytes[block] += (DWORD)res;
+    }
+    return TRUE;
+}
+
+BOOL CCopyIoPositional::GetResult(int block, DWORD* bytes, DWORD* err)
+{
+    *bytes = Bytes[block];
+    *err = Error[block];
+    return Error[block] == NO_ERROR;
+}
+
+#ifdef COPYENGINE_IO_URING
+
+//
+// ****************************************************************************
+// CCopyIoUring
+//
+
+#define COPYIOURING_ENTRIES 128                  // operations of all blocks and their cancellations
+#define COPYIOURING_CANCEL 0x8000000000000000ULL // user data of a cancellation (the block is in the lower bits)
+
+CCopyIoUring::CCopyIoUring(int* in, int* out)
+{
+    In = in;
+    Out = out;
+    SqRing = CqRing = MAP_FAILED;
+    SqRingSize = CqRingSize = 0;
+    Sqes = (io_uring_sqe*)MAP_FAILED;
+    SqesSize = 0;
+    memset(Pending, 0, sizeof(Pending));
+    memset(Reading, 0, sizeof(Reading));
+    memset(Buffer, 0, sizeof(Buffer));
+    memset(Offset, 0, sizeof(Offset));
+    memset(Requested, 0, sizeof(Requested));
+    memset(Bytes, 0, sizeof(Bytes));
+    memset(Error, 0, sizeof(Error));
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    Ring = (int)syscall(__NR_io_uring_setup, COPYIOURING_ENTRIES, &params);
+    if (Ring < 0)
+    {
+        TRACE_I("CCopyIoUring: io_uring is not available, error: " << errno);
+        Ring = -1;
+        return;
+    }
+    SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    BOOL singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap && CqRingSize > SqRingSize)
+        SqRingSize = CqRingSize;
+    SqRing = mmap(NULL, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring, IORING_OFF_SQ_RING);
+    if (SqRing != MAP_FAILED)
+    {
+        CqRing = singleMap ? SqRing : mmap(NULL, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           Ring, IORING_OFF_CQ_RING);
+    }
+    if (CqRing != MAP_FAILED)
+    {
+        SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        Sqes = (io_uring_sqe*)mmap(NULL, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                   Ring, IORING_OFF_SQES);
+    }
+    if (Sqes == MAP_FAILED)
+    {
+        TRACE_E("CCopyIoUring: unable to map the rings, error: " << errno);
+        if (CqRing != MAP_FAILED && CqRing != SqRing)
+            munmap(CqRing, CqRingSize);
+        if (SqRing != MAP_FAILED)
+            munmap(SqRing, SqRingSize);
+        SqRing = CqRing = MAP_FAILED;
+        close(Ring);
+        Ring = -1;
+        return;
+    }
+    SqTail = (unsigned*)((BYTE*)SqRing + params.sq_off.tail);
+    SqMask = (unsigned*)((BYTE*)SqRing + params.sq_off.ring_mask);
+    SqArray = (unsigned*)((BYTE*)SqRing + params.sq_off.array);
+    CqHead = (unsigned*)((BYTE*)CqRing + params.cq_off.head);
+    CqTail = (unsigned*)((BYTE*)CqRing + params.cq_off.tail);
+    CqMask = (unsigned*)((BYTE*)CqRing + params.cq_off.ring_mask);
+    Cqes = (io_uring_cqe*)((BYTE*)CqRing + params.cq_off.cqes);
+}
+
+CCopyIoUring::~CCopyIoUring()
+{
+    if (Ring == -1)
+        return;
+    // the kernel must not touch the buffers of the caller after the backend is gone
+    CancelAll();
+    for (int i = 0; i < COPYENGINE_MAX_BLOCKS; i++)
+    {
+        while (Pending[i])
+            Reap(TRUE);
+    }
+    munmap(Sqes, SqesSize);
+    if (CqRing != SqRing)
+        munmap(CqRing, CqRingSize);
+    munmap(SqRing, SqRingSize);
+    close(Ring);
+}
+
+BOOL CCopyIoUring::Submit(BYTE opcode, int fd, unsigned __int64 addr, DWORD size, unsigned __int64 offset,
+                          unsigned __int64 userData, DWORD* err)
+{
+    // only this thread writes the tail, the kernel takes the entries in io_uring_enter
+    unsigned tail = *SqTail;
+    unsigned index = tail & *SqMask;
+    io_uring_sqe* sqe = &Sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    SqArray[index] = index;
+    __atomic_store_n(SqTail, tail + 1, __ATOMIC_RELEASE);
+    while (1)
+    {
+        int res = (int)syscall(__NR_io_uring_enter, Ring, 1, 0, 0, NULL, 0);
+        if (res == 1)
+            return TRUE;
+        if (res < 0 && errno == EINTR)
+            continue;
+        // the entry was not taken (io_uring_enter failed), it must not be submitted later
+        *err = res < 0 ? CopyIoErrorFromErrno(errno) : ERROR_GEN_FAILURE;
+        __atomic_store_n(SqTail, tail, __ATOMIC_RELEASE);
+        return FALSE;
+    }
+}
+
+BOOL CCopyIoUring::SubmitBlock(int block, DWORD* err)
+{
+    Pending[block] = TRUE;
+    if (Submit(Reading[block] ? IORING_OP_READ : IORING_OP_WRITE, Reading[block] ? *In : *Out,
+               (unsigned __int64)(uintptr_t)(Buffer[block] + Bytes[block]), Requested[block] - Bytes[block],
+               Offset[block] + Bytes[block], block, err))
+    {
+        return TRUE;
+    }
+    Pending[block] = FALSE;
+    return FALSE;
+}
+
+BOOL CCopyIoUring::StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+{
+    Reading[block] = TRUE;
+    Buffer[block] = (BYTE*)buffer;
+    Offset[block] = offset.Value;
+    Requested[block] = size;
+    Bytes[block] = 0;
+    Error[block] = NO_ERROR;
+    return SubmitBlock(block, err);
+}
+
+BOOL CCopyIoUring::StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+{
+    Reading[block] = FALSE;
+    Buffer[block] = (BYTE*)buffer;
+    Offset[block] = offset.Value;
+    Requested[block] = size;
+    Bytes[block] = 0;
+    Error[block] = NO_ERROR;
+    return SubmitBlock(block, err);
+}
+
+void CCopyIoUring::Reap(BOOL wait)
+{
+    if (wait)
+    {
+        while (syscall(__NR_io_uring_enter, Ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // the ring does not work, the waiting operations end with the error (GetResult would wait forever)
+            DWORD err = CopyIoErrorFromErrno(errno);
+            TRACE_E("CCopyIoUring::Reap(): io_uring_enter failed, error: " << errno);
+            for (int i = 0; i < COPYENGINE_MAX_BLOCKS; i++)
+            {
+                if (Pending[i])
+                {
+                    Pending[i] = FALSE;
+                    Bytes[i] = 0;
+                    Error[i] = err;
+                }
+            }
+            return;
+        }
+    }
+    unsigned head = *CqHead;
+    unsigned tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        io_uring_cqe* cqe = &Cqes[head & *CqMask];
+        head++;
+        if (cqe->user_data & COPYIOURING_CANCEL)
+            continue; // the result of a cancellation, the cancelled operation completes on its own
+        int block = (int)cqe->user_data;
+        if (cqe->res < 0)
+        {
+            Bytes[block] = 0;
+            Error[block] = CopyIoErrorFromErrno(-cqe->res);
+        }
+        else
+        {
+            Bytes[block] += (DWORD)cqe->res;
+            if (cqe->res > 0 && Bytes[block] < Requested[block])
+            { // a short transfer, the rest of the block is submitted again
+                DWORD err;
+                if (SubmitBlock(block, &err))
+                    continue;
+                Bytes[block] = 0;
+                Error[block] = err;
+            }
+            else
+            {
+                if (Reading[block] && Bytes[block] == 0 && Requested[block] > 0)
+                    Error[block] = ERROR_HANDLE_EOF; // reported like from ReadFile
+            }
+        }
+        Pending[block] = FALSE;
+    }
+    __atomic_store_n(CqHead, head, __ATOMIC_RELEASE);
+}
+
+BOOL CCopyIoUring::IsDone(int block)
+{
+    if (Pending[block])
+        Reap(FALSE);
+    return !Pending[block];
+}
+
+BOOL CCopyIoUring::GetResult(int block, DWORD* bytes, DWORD* err)
+{
+    while (Pending[block])
+        Reap(TRUE);
+    *bytes = Bytes[block];
+    *err = Error[block];
+    return Error[block] == NO_ERROR;
+}
+
+void CCopyIoUring::CancelAll()
+{
+    for (int i = 0; i < COPYENGINE_MAX_BLOCKS; i++)
+    {
+        DWORD err;
+        if (Pending[i] && !Submit(IORING_OP_ASYNC_CANCEL, -1, i, 0, 0, COPYIOURING_CANCEL | i, &err))
+            TRACE_E("CCopyIoUring::CancelAll(): unable to cancel the operation of block " << i << ", error: " << err);
+    }
+}
+
+#endif // COPYENGINE_IO_URING
+
+#endif // _WIN32
+
+//
+// ****************************************************************************
+// CCopyRanges
+//
+
+#ifdef _WIN32
+
+CCopyRangesAllocated::CCopyRangesAllocated(HANDLE* in, OVERLAPPED* overlapped)
+{
+    In = in;
+    Overlapped = overlapped;
+    RangesCount = -1;
+    RangeIndex = 0;
+    MoreRanges = FALSE;
+}
+
+BOOL CCopyRangesAllocated::Query(const CQuadWord& offset, const CQuadWord& fileSize, DWORD* err)
+{
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = offset.Value;
+    query.Length.QuadPart = (fileSize - offset).Value;
+    memset(Ranges, 0, sizeof(Ranges));
+    DWORD returned = 0;
+    BOOL ok;
+    if (Overlapped != NULL) // asynchronous source, wait for the result
+    {
+        Overlapped->Internal = 0;
+        Overlapped->InternalHigh = 0;
+        Overlapped->Offset = 0;
+        Overlapped->OffsetHigh = 0;
+        ok = (DeviceIoControl(*In, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), Ranges, sizeof(Ranges),
+                              NULL, Overlapped) ||
+              GetLastError() == ERROR_IO_PENDING) &&
+             GetOverlappedResult(*In, Overlapped, &returned, TRUE);
+    }
+    else
+    {
+        ok = DeviceIoControl(*In, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), Ranges, sizeof(Ranges),
+                             &returned, NULL);
+    }
+    RangeIndex = 0;
+    MoreRanges = FALSE;
+    if (ok)
+        RangesCount = returned / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+    else
+    {
+        *err = GetLastError();
+        if (*err != ERROR_MORE_DATA)
+        {
+            RangesCount = -1;
+            return FALSE;
+        }
+        RangesCount = COPYRANGES_QUERY; // the buffer is full, we ask again after its ranges
+        MoreRanges = TRUE;
+    }
+    *err = NO_ERROR;
+    return TRUE;
+}
+
+BOOL CCopyRangesAllocated::GetNextRange(const CQuadWord& offset, const CQuadWord& fileSize, CQuadWord* start,
+                                        CQuadWord* end, DWORD* err)
+{
+    *err = NO_ERROR;
+    while (offset < fileSize)
+    {
+        if (RangesCount == -1 || (RangeIndex == RangesCount && MoreRanges))
+        {
+            if (!Query(offset, fileSize, err))
+                return FALSE;
+        }
+        while (RangeIndex < RangesCount &&
+               (unsigned __int64)(Ranges[RangeIndex].FileOffset.QuadPart + Ranges[RangeIndex].Length.QuadPart) <= offset.Value)
+        {
+            RangeIndex++; // the range lies below 'offset', it is copied already
+        }
+        if (RangeIndex == RangesCount)
+        {
+            if (MoreRanges)
+                continue;
+            break; // no more ranges, a hole up to the end of the file
+        }
+        start->SetUI64(Ranges[RangeIndex].FileOffset.QuadPart);
+        end->SetUI64(Ranges[RangeIndex].FileOffset.QuadPart + Ranges[RangeIndex].Length.QuadPart);
+        if (*start < offset)
+            *start = offset;
+        if (*end > fileSize)
+            *end = fileSize;
+        if (*start >= *end)
+            break; // the range starts behind 'fileSize'
+        return TRUE;
+    }
+    return FALSE;
+}
+
+#else // _WIN32
+
+BOOL CCopyRangesSeek::GetNextRange(const CQuadWord& offset, const CQuadWord& fileSize, CQuadWord* start,
+                                   CQuadWord* end, DWORD* err)
+{
+    *err = NO_ERROR;
+    if (offset >= fileSize)
+        return FALSE;
+    off_t data = lseek(*In, (off_t)offset.Value, SEEK_DATA);
+    if (data == -1)
+    {
+        if (errno != ENXIO) // ENXIO = only a hole behind 'offset'
+            *err = CopyIoErrorFromErrno(errno);
+        return FALSE;
+    }
+    if ((unsigned __int64)data >= fileSize.Value)
+        return FALSE;
+    off_t hole = lseek(*In, data, SEEK_HOLE); // there is always a hole at the end of the file
+    if (hole == -1)
+    {
+        *err = CopyIoErrorFromErrno(errno);
+        return FALSE;
+    }
+    start->SetUI64((unsigned __int64)data);
+    end->SetUI64((unsigned __int64)hole);
+    if (*end > fileSize)
+        *end = fileSize;
+    return TRUE;
+}
+
+#endif // _WIN32
+
+BOOL IsZeroBlock(const char* buf, DWORD size)
+{
+    const DWORD_PTR* p = (const DWORD_PTR*)buf;
+    const DWORD_PTR* end = p + size / sizeof(DWORD_PTR);
+    while (p < end)
+    {
+        if (*p++ != 0)
+            return FALSE;
+    }
+    const char* c;
+    for (c = (const char*)end; c < buf + size; c++)
+    {
+        if (*c != 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+void CopyFindDataRun(const char* buf, DWORD size, DWORD pos, DWORD zeroBlock, DWORD* start, DWORD* end)
+{
+    DWORD s = pos;
+    while (s < size)
+    {
+        DWORD len = size - s < zeroBlock ? size - s : zeroBlock;
+        if (!IsZeroBlock(buf + s, len))
+            break;
+        s += len;
+    }
+    DWORD e = s;
+    while (e < size)
+    {
+        DWORD len = size - e < zeroBlock ? size - e : zeroBlock;
+        if (IsZeroBlock(buf + e, len))
+            break;
+        e += len;
+    }
+    *start = s;
+    *end = e;
+}
+
+//
+// ****************************************************************************
+// CCopyTuner
+//
+
+CCopyTuner::CCopyTuner(int minBlockSize, int maxBlockSize, int minQueueDepth, int maxQueueDepth,
+                       int blockSize, int queueDepth)
+{
+    MinBlockSize = minBlockSize;
+    MaxBlockSize = maxBlockSize;
+    MinQueueDepth = minQueueDepth;
+    MaxQueueDepth = maxQueueDepth;
+    BlockSize = blockSize < minBlockSize ? minBlockSize : (blockSize > maxBlockSize ? maxBlockSize : blockSize);
+    QueueDepth = queueDepth < minQueueDepth ? minQueueDepth : (queueDepth > maxQueueDepth ? maxQueueDepth : queueDepth);
+    Direction = BlockSize < MaxBlockSize ? 1 : -1;
+    BestBlockSize = BlockSize;
+    BestSpeed = 0;
+    FailedProbes = 0;
+    SettleWindows = 0;
+    StepPending = FALSE;
+    WindowStart = 0;
+    WindowBytes = 0;
+    WindowWrites = 0;
+    MinLatency = 0xFFFFFFFF;
+}
+
+void CCopyTuner::StartWindow()
+{
+    WindowStart = GetTime();
+    WindowBytes = 0;
+    WindowWrites = 0;
+}
+
+void CCopyTuner::AddSample(BOOL write, DWORD bytes, DWORD latency)
+{
+    if (write)
+    {
+        WindowBytes += bytes;
+        WindowWrites++;
+    }
+    if (latency < MinLatency)
+        MinLatency = latency;
+}
+
+BOOL CCopyTuner::StepBlockSize()
+{
+    if (Direction > 0 ? BlockSize >= MaxBlockSize : BlockSize <= MinBlockSize)
+        return FALSE;
+    BlockSize = Direction > 0 ? BlockSize * 2 : BlockSize / 2;
+    if (BlockSize > MaxBlockSize)
+        BlockSize = MaxBlockSize;
+    if (BlockSize < MinBlockSize)
+        BlockSize = MinBlockSize;
+    return TRUE;
+}
+
+BOOL CCopyTuner::Update()
+{
+    DWORD now = GetTime();
+    DWORD elapsed = now - WindowStart;
+    if (elapsed < COPYTUNER_WINDOW || WindowWrites < COPYTUNER_MIN_WRITES)
+        return FALSE; // too little data for a decision
+
+    int oldBlockSize = BlockSize;
+    int oldQueueDepth = QueueDepth;
+    unsigned __int64 speed = (WindowBytes * 1000) / elapsed;
+
+    if (StepPending)
+    { // the window measured a step of the block size (the queue depth was kept): keep the step
+        // only if it helped, otherwise return to the best size and try the opposite direction
+        StepPending = FALSE;
+        if (speed * 100 >= BestSpeed * COPYTUNER_GAIN)
+        {
+            BestSpeed = speed;
+            BestBlockSize = BlockSize;
+            FailedProbes = 0;
+            StepPending = StepBlockSize();
+        }
+        else
+        {
+            BlockSize = BestBlockSize;
+            if (++FailedProbes < 2)
+            {
+                Direction = -Direction;
+                StepPending = StepBlockSize();
+            }
+        }
+        if (!StepPending) // the best size is found, stay at it for a while
+            SettleWindows = COPYTUNER_SETTLE_WINDOWS;
+    }
+    else
+    {
+        // queue depth: enough reads in flight to cover the latency at the current speed, the
+        // minimal latency is used (the average grows with the depth itself, the requests wait
+        // in the queue); a quarter more gives the speed room to grow if the depth limits it
+        // and a growing depth is at least doubled (on a link with a long latency and a high
+        // bandwidth the speed grows with the depth, a quarter per window would take seconds)
+        int depth = QueueDepth;
+        CQuadWord measuredSpeed;
+        unsigned __int64 depthSpeed = GetMeasuredSpeed(&measuredSpeed) && measuredSpeed.Value > 0 ? measuredSpeed.Value : speed;
+        if (MinLatency != 0xFFFFFFFF)
+        {
+            unsigned __int64 reads = (depthSpeed * MinLatency / 1000 + BlockSize - 1) / BlockSize;
+            reads += reads / 4 + 1;
+            if (reads * 2 > (unsigned __int64)QueueDepth && reads < (unsigned __int64)QueueDepth)
+                reads = QueueDepth;
+            depth = reads * 2 > (unsigned __int64)MaxQueueDepth ? MaxQueueDepth : (int)reads * 2;
+            if (depth < MinQueueDepth)
+                depth = MinQueueDepth;
+        }
+
+        if (depth != QueueDepth) // the speeds of block sizes are comparable only with the same depth, probe later
+        {
+            QueueDepth = depth;
+            SettleWindows = 0;
+        }
+        else
+        {
+            if (SettleWindows > 0)
+                SettleWindows--;
+            else
+            { // the window measured the current block size, probe the next step (the link may have changed)
+                BestSpeed = speed;
+                BestBlockSize = BlockSize;
+                FailedProbes = 0;
+                StepPending = StepBlockSize();
+                if (!StepPending)
+                {
+                    Direction = -Direction;
+                    StepPending = StepBlockSize();
+                }
+                if (!StepPending)
+                    SettleWindows = COPYTUNER_SETTLE_WINDOWS; // only one block size is possible
+            }
+        }
+    }
+
+    WindowStart = now;
+    WindowBytes = 0;
+    WindowWrites = 0;
+    return BlockSize != oldBlockSize || QueueDepth != oldQueueDepth;
+}
+
+//
+// ****************************************************************************
+// CCopyEngine
+//
+
+CCopyEngine::CCopyEngine(CCopyIoBackend* io, void** buffers, int numOfBlocks, CQuadWord* fileSize, int* blockSize)
+{
+    if (numOfBlocks > COPYENGINE_MAX_BLOCKS)
+    {
+        TRACE_E("CCopyEngine::CCopyEngine(): too many blocks: " << numOfBlocks);
+        numOfBlocks = COPYENGINE_MAX_BLOCKS;
+    }
+    Io = io;
+    Buffers = buffers;
+    NumOfBlocks = numOfBlocks;
+    FileSize = fileSize;
+    BlockSize = blockSize;
+    ForceOp = fopNotUsed;
+    ReadingDone = FALSE;
+    CurTime = 0;
+    for (int i = 0; i < (int)_countof(BlockState); i++)
+    {
+        BlockState[i] = cbsFree;
+        BlockOffset[i].SetUI64(0);
+    }
+    memset(BlockDataLen, 0, sizeof(BlockDataLen));
+    memset(BlockTime, 0, sizeof(BlockTime));
+    FreeBlocks = numOfBlocks;
+    FreeBlockIndex = 0;
+    ReadingBlocks = 0;
+    WritingBlocks = 0;
+    ReadOffset.SetUI64(0);
+    WriteOffset.SetUI64(0);
+    Tuner = NULL;
+    QueueDepth = numOfBlocks;
+    memset(BlockStartTime, 0, sizeof(BlockStartTime));
+}
+
+void CCopyEngine::SetTuner(CCopyTuner* tuner)
+{
+    Tuner = tuner;
+    if (Tuner != NULL)
+    {
+        Tuner->StartWindow();
+        ApplyTuning();
+    }
+}
+
+void CCopyEngine::ApplyTuning()
+{
+    int depth = Tuner->GetQueueDepth();
+    if (depth > NumOfBlocks)
+        depth = NumOfBlocks;
+    depth = OnQueueDepthChange(depth);
+    QueueDepth = depth < 1 ? 1 : depth;
+}
+
+BOOL CCopyEngine::StartReading(int blkIndex, DWORD readSize, DWORD* err, BOOL testEOF)
+{
+#ifdef ASYNC_COPY_DEBUG_MSG
+    char sss[1000];
+    sprintf(sss, "ReadFile: %d 0x%08X 0x%08X", blkIndex, ReadOffset.LoDWord, readSize);
+    TRACE_I(sss);
+#endif // ASYNC_COPY_DEBUG_MSG
+
+    if (!Io->StartRead(blkIndex, Buffers[blkIndex], readSize, ReadOffset, err))
+        return FALSE; // a read error occurred, go handle it
+    // if the read completed synchronously (or from cache, which unfortunately I cannot detect),
+    // we must now write something, otherwise the write may lag = overall slowdown of the operation
+    BOOL opCompleted = Io->IsDone(blkIndex);
+    ForceOp = opCompleted ? fopWriting : fopNotUsed;
+
+#ifdef ASYNC_COPY_DEBUG_MSG
+    TRACE_I("ReadFile result: " << (opCompleted ? "DONE" : "ASYNC"));
+#endif // ASYNC_COPY_DEBUG_MSG
+
+    if (!OnOpStarted(opCompleted))
+    {
+        *err = ERROR_CANCELLED;
+        return FALSE; // cancel will be performed in error handling
+    }
+
+    BlockOffset[blkIndex] = ReadOffset;
+    BlockDataLen[blkIndex] = readSize;
+    if (Tuner != NULL)
+        BlockStartTime[blkIndex] = Tuner->GetTime();
+    if (!testEOF) // the block was in cbsFree state before calling this method
+    {
+        ReadOffset.Value += readSize;
+        BlockState[blkIndex] = cbsReading;
+    }
+    else
+        BlockState[blkIndex] = cbsTestingEOF;
+    BlockTime[blkIndex] = CurTime++;
+    FreeBlocks--;
+    ReadingBlocks++;
+    return TRUE;
+}
+
+BOOL CCopyEngine::StartWriting(int blkIndex, DWORD* err)
+{
+#ifdef ASYNC_COPY_DEBUG_MSG
+    char sss[1000];
+    sprintf(sss, "WriteFile: %d 0x%08X 0x%08X", blkIndex, WriteOffset.LoDWord, BlockDataLen[blkIndex]);
+    TRACE_I(sss);
+#endif // ASYNC_COPY_DEBUG_MSG
+
+    OnBlockWriting(Buffers[blkIndex], BlockDataLen[blkIndex], WriteOffset);
+    if (!Io->StartWrite(blkIndex, Buffers[blkIndex], BlockDataLen[blkIndex], WriteOffset, err))
+        return FALSE; // a write error occurred, go handle it
+    // if the write completed synchronously (or to cache, which unfortunately I cannot detect),
+    // we must now read something, otherwise reading may lag = overall slowdown of the operation
+    BOOL opCompleted = Io->IsDone(blkIndex);
+    ForceOp = !ReadingDone && opCompleted ? fopReading : fopNotUsed;
+
+#ifdef ASYNC_COPY_DEBUG_MSG
+    TRACE_I("WriteFile result: " << (opCompleted ? "DONE" : "ASYNC"));
+#endif // ASYNC_COPY_DEBUG_MSG
+
+    if (!OnOpStarted(opCompleted))
+    {
+        *err = ERROR_CANCELLED;
+        return FALSE; // cancel will be performed in error handling
+    }
+
+    WriteOffset.Value += BlockDataLen[blkIndex];
+    if (Tuner != NULL)
+        BlockStartTime[blkIndex] = Tuner->GetTime();
+    BlockState[blkIndex] = cbsWriting; // the block was in cbsRead state before calling this method
+    BlockTime[blkIndex] = CurTime++;
+    WritingBlocks++;
+    return TRUE;
+}
+
+int CCopyEngine::FindBlock(CCopy_BlkState state)
+{
+    for (int i = 0; i < NumOfBlocks; i++)
+        if (BlockState[i] == state)
+            return i;
+    TRACE_C("CCopyEngine::FindBlock(): unable to find block with required state (" << (int)state << ").");
+    return -1; // dead code, just for the compiler
+}
+
+void CCopyEngine::FreeBlock(int blkIndex)
+{
+    if (BlockState[blkIndex] == cbsReading || BlockState[blkIndex] == cbsTestingEOF)
+        ReadingBlocks--;
+    if (BlockState[blkIndex] == cbsWriting)
+        WritingBlocks--;
+    BlockState[blkIndex] = cbsFree;
+    FreeBlockIndex = blkIndex;
+    FreeBlocks++;
+}
+
+void CCopyEngine::DiscardBlocksBehindEOF(const CQuadWord& fileSize, int excludeIndex)
+{
+    for (int i = 0; i < NumOfBlocks; i++)
+    {
+        if (i == excludeIndex)
+            continue;
+        CCopy_BlkState st = BlockState[i];
+        if ((st == cbsRead || st == cbsReading) && BlockOffset[i] >= fileSize)
+        {
+            if (st == cbsRead) // discard data read behind the end of file, they make no sense
+                FreeBlock(i);
+            else
+            {
+                BlockState[i] = cbsDiscarded; // reading behind the end of file makes no sense; no reason to change BlockTime
+                ReadingBlocks--;
+            }
+        }
+    }
+}
+
+void CCopyEngine::CancelOpPhase2(int errBlkIndex)
+{
+    // WARNING: errBlkIndex == -1 for an error when starting an asynchronous read (has no assigned block)
+    //          or for an error when truncating the file after the main copy loop finished (has no assigned block)
+    //          or for Cancel in the progress dialog (has no assigned block)
+
+    DWORD bytes;
+    DWORD err;
+    for (int i = 0; i < NumOfBlocks; i++)
+    {
+        if (BlockState[i] > cbsInProgress)
+        { // GetResult should return the result immediately, because we called CancelOpPhase1()
+            if (Io->GetResult(i, &bytes, &err))
+            {
+                if (BlockState[i] == cbsReading && BlockDataLen[i] == bytes) // completely read -> change to cbsRead block
+                {
+                    BlockState[i] = cbsRead;
+                    ReadingBlocks--;
+                }
+                else
+                {
+                    if (BlockState[i] == cbsWriting && BlockDataLen[i] == bytes) // completely written -> change to cbsRead block (we may write again, so we don't discard the block now)
+                    {
+                        BlockState[i] = cbsRead;
+                        WritingBlocks--;
+                    }
+                }
+            }
+            else
+            {
+                if (i != errBlkIndex &&             // we report the error for this block, no point in reporting it to TRACE again
+                    err != ERROR_OPERATION_ABORTED) // this is not an error, it just reports it was interrupted (by CancelOpPhase1())
+                {                                   // let's print errors in other blocks, probably nothing important and we should just ignore them
+                    TRACE_I("CCopyEngine::CancelOpPhase2(): GetResult(" << (BlockState[i] == cbsWriting ? "OUT" : "IN") << ", " << i << ") returned error: " << err);
+                }
+            }
+            switch (BlockState[i])
+            {
+            case cbsReading:    // not completely read
+            case cbsTestingEOF: // unfinished EOF test
+            case cbsDiscarded:
+                FreeBlock(i);
+                break;
+
+            case cbsWriting:                      // unwritten block
+                if (WriteOffset > BlockOffset[i]) // possibly lower WriteOffset
+                    WriteOffset = BlockOffset[i];
+                BlockState[i] = cbsRead; // not completely written, but read yes -> change to cbsRead block (we may write again, so we don't discard the block now)
+                WritingBlocks--;
+                break;
+
+            default: // cbsRead: completely read or written above, kept for Retry
+                break;
+            }
+        }
+    }
+
+    ReadOffset = WriteOffset; // find how far we have contiguously read data from the offset where we need to start writing
+    for (int i = 0; i < NumOfBlocks; i++)
+    {
+        if (BlockState[i] == cbsRead && BlockOffset[i] == ReadOffset) // we have a read block continuing from ReadOffset
+        {
+            ReadOffset.Value += BlockDataLen[i];
+            i = -1; // and search again from the beginning (quadratic in the number of blocks, which are few)
+        }
+    }
+
+    // discard blocks that are already written or, on the contrary, are too far ahead (not continuous),
+    // so we rather let them be read again
+    for (int i = 0; i < NumOfBlocks; i++)
+        if (BlockState[i] == cbsRead && (BlockOffset[i] < WriteOffset || BlockOffset[i] > ReadOffset))
+            FreeBlock(i);
+}
+
+BOOL CCopyEngine::Run()
+{
+    DWORD err = NO_ERROR;
+    DWORD bytes = 0; // helper DWORD - how many bytes were read/written in the block
+    BOOL doCopy = TRUE;
+    while (doCopy)
+    {
+        if (ForceOp != fopWriting && NumOfBlocks - FreeBlocks < QueueDepth && !ReadingDone &&
+            ReadingBlocks < (QueueDepth + 1) / 2) // we will read concurrently into at most half of the blocks
+        {
+            DWORD blockSize = GetReadBlockSize();
+            DWORD toRead = ReadOffset + CQuadWord(blockSize, 0) <= *FileSize ? blockSize : (*FileSize - ReadOffset).LoDWord;
+            BOOL testEOF = toRead == 0;
+            if (!testEOF || ReadingBlocks == 0) // reading data or EOF test (EOF test is done only when all reads are completed)
+            {
+                if (BlockState[FreeBlockIndex] != cbsFree)
+                    FreeBlockIndex = FindBlock(cbsFree);
+                // EOF test = reading into the whole block, otherwise regular reading of 'toRead'
+                if (StartReading(FreeBlockIndex, testEOF ? blockSize : toRead, &err, testEOF))
+                    continue; // success (start of asynchronous read), try to start another read
+                else
+                { // error (start of asynchronous read)
+                    if (!OnReadError(-1, err))
+                        return FALSE; // cancel/skip(skip-all)/retry-complete
+                    continue;         // retry-resume
+                }
+            }
+        }
+        // reading is already started or not needed, let's check if something completed
+        BOOL shouldWait = TRUE; // TRUE = nothing more asynchronous to start, we must wait for some started operation to complete
+        BOOL retryCopy = FALSE; // TRUE = after an error Retry should be performed = start from the beginning of the "doCopy" loop
+        // two rounds are needed only in case of synchronous write (we want to mark it
+        // as completed immediately and not only after the next read, because of progress)
+        for (int afterWriting = 0; afterWriting < 2; afterWriting++)
+        {
+            for (int i = 0; i < NumOfBlocks; i++)
+            {
+                if (BlockState[i] > cbsInProgress && Io->IsDone(i))
+                {
+                    shouldWait = FALSE; // in the spirit of "keep it simple" (there are situations where it could stay TRUE, but we ignore them)
+                    switch (BlockState[i])
+                    {
+                    case cbsReading:    // reading the source file into the block - started (in progress)
+                    case cbsTestingEOF: // testing the end of the source file
+                    {
+                        BOOL testingEOF = BlockState[i] == cbsTestingEOF;
+
+#ifdef ASYNC_COPY_DEBUG_MSG
+                        TRACE_I("READ done: " << i);
+#endif // ASYNC_COPY_DEBUG_MSG
+
+                        BOOL res = Io->GetResult(i, &bytes, &err);
+                        if (testingEOF && res && bytes == 0)
+                        {
+                            res = FALSE; // according to MSDN, at EOF it should return FALSE and ERROR_HANDLE_EOF, so let's make sure (on Novell Netware 6.5 disk it returns TRUE)
+                            err = ERROR_HANDLE_EOF;
+                        }
+                        if (res || err == ERROR_HANDLE_EOF)
+                        {
+                            if (Tuner != NULL && res && bytes > 0)
+                                Tuner->AddSample(FALSE, bytes, Tuner->GetTime() - BlockStartTime[i]);
+                            OnBlockRead();
+                            if (!res) // EOF at the beginning of the block (only cbsReading: EOF may also be before this block, that will be resolved by finding EOF later in a block with lower offset)
+                            {
+                                bytes = 0;
+                                if (testingEOF)
+                                    ReadingDone = TRUE; // confirmed end of source file, we won't read anything more
+                                // we must not force fopWriting (we read nothing, we have nothing to write), unless it's an EOF test,
+                                // let the other asynchronous reads finish, then perform the EOF test, and then we will only write
+                                ForceOp = fopNotUsed;
+                            }
+                            if (bytes < BlockDataLen[i]) // the file is shorter than we expected -> set new file size
+                            {
+                                if (!testingEOF || bytes != 0)
+                                    ReadOffset = *FileSize = BlockOffset[i] + CQuadWord(bytes, 0);
+                                if (!testingEOF)
+                                    DiscardBlocksBehindEOF(*FileSize, i);
+                                if (bytes == 0) // EOF = no data, free the block
+                                {
+                                    FreeBlock(i);
+                                    if (testingEOF)
+                                        doCopy = !IsOperationDone(); // test whether we have finished copying with this
+                                }
+                                else
+                                    BlockDataLen[i] = bytes; // from now on we pretend we wanted to read exactly this much
+                            }
+                            else
+                            {
+                                if (testingEOF) // we were looking for EOF and a full block was read, the file probably grew drastically, find the new size
+                                {
+                                    ReadOffset = BlockOffset[i] + CQuadWord(bytes, 0);
+                                    GetNewFileSize(ReadOffset);
+                                }
+                            }
+                            if (BlockState[i] == cbsReading || BlockState[i] == cbsTestingEOF)
+                            {
+                                ReadingBlocks--;
+                                BlockState[i] = cbsRead;
+                            }
+                        }
+                        else // error
+                        {
+                            if (!OnReadError(i, err))
+                                return FALSE; // cancel/skip(skip-all)/retry-complete
+                            retryCopy = TRUE; // retry-resume
+                        }
+                        break;
+                    }
+
+                    case cbsWriting: // writing the block to the target file
+                    {
+#ifdef ASYNC_COPY_DEBUG_MSG
+                        TRACE_I("WRITE done: " << i);
+#endif // ASYNC_COPY_DEBUG_MSG
+
+                        BOOL res = Io->GetResult(i, &bytes, &err);
+                        if (!res || bytes != BlockDataLen[i]) // error
+                        {
+                            if (res) // written less than requested
+                                err = ERROR_DISK_FULL;
+                            CQuadWord maxWriteOffset = WriteOffset;
+                            if (!OnWriteError(i, err, maxWriteOffset))
+                                return FALSE; // cancel/skip(skip-all)/retry-complete
+                            retryCopy = TRUE; // retry-resume
+                            break;
+                        }
+
+                        if (Tuner != NULL)
+                        {
+                            Tuner->AddSample(TRUE, bytes, Tuner->GetTime() - BlockStartTime[i]);
+                            if (Tuner->Update())
+                                ApplyTuning();
+                        }
+
+                        if (!OnBlockWritten(bytes))
+                            return FALSE; // cancel
+
+                        // break; // the missing break here is intentional...
+                    }
+                    // fall through
+                    case cbsDiscarded: // reading the source file behind its end (should only return error: EOF)
+                    {
+                        FreeBlock(i);
+                        doCopy = !IsOperationDone();
+                        break;
+                    }
+
+                    default: // finished states are not tested (BlockState[i] > cbsInProgress)
+                        break;
+                    }
+                }
+                if (!doCopy || retryCopy)
+                    break;
+            }
+            if (!doCopy || retryCopy)
+                break;
+
+            // we have read data into blocks, let's check whether they could be written to the target file;
+            // we freed the written/discarded blocks (we'll read into them again at the start of the loop)
+            CQuadWord nextReadBlkOffset; // the lowest offset of a skipped cbsRead block
+            do
+            {
+                nextReadBlkOffset.SetUI64(0);
+                // we will write concurrently into at most half of the blocks
+                for (int i = 0; ForceOp != fopReading && i < NumOfBlocks && WritingBlocks < (QueueDepth + 1) / 2; i++)
+                {
+                    if (BlockState[i] == cbsRead)
+                    {
+                        if (WriteOffset == BlockOffset[i])
+                        {
+                            if (!StartWriting(i, &err))
+                            { // error (of asynchronous write)
+                                CQuadWord maxWriteOffset = WriteOffset + CQuadWord(BlockDataLen[i], 0);
+                                if (!OnWriteError(i, err, maxWriteOffset))
+                                    return FALSE; // cancel/skip(skip-all)/retry-complete
+                                retryCopy = TRUE; // retry-resume
+                                break;
+                            }
+                        }
+                        else
+                        {
+                            if (nextReadBlkOffset.Value == 0 || BlockOffset[i] < nextReadBlkOffset)
+                                nextReadBlkOffset = BlockOffset[i];
+                        }
+                    }
+                } // we have another cbsRead block and it continues from the written part of the target file -> keep writing
+            } while (!retryCopy && ForceOp != fopReading && nextReadBlkOffset.Value != 0 && nextReadBlkOffset == WriteOffset &&
+                     WritingBlocks < (QueueDepth + 1) / 2); // we will write concurrently into at most half of the blocks
+            if (retryCopy || ForceOp != fopReading)
+                break; // going for Retry or the write wasn't synchronous (i.e. done in ~0 ms) or we're only writing now, either way two rounds are pointless
+        }
+        if (!doCopy || retryCopy)
+            continue;
+
+        if (shouldWait) // another pass through the loop makes no sense, there's no hope of starting a new read or write, let's wait
+        {               // for the oldest asynchronous operation to complete
+            DWORD oldestBlockTime = 0;
+            int oldestBlockIndex = -1;
+            for (int i = 0; i < NumOfBlocks; i++)
+            {
+                if (BlockState[i] > cbsInProgress)
+                {
+                    DWORD ti = CurTime - BlockTime[i];
+                    if (oldestBlockTime < ti)
+                    {
+                        oldestBlockTime = ti;
+                        oldestBlockIndex = i;
+                    }
+                }
+            }
+            if (oldestBlockIndex == -1)
+            {
+                if (ForceOp == fopReading && NumOfBlocks - FreeBlocks >= QueueDepth)
+                { // the queue depth was lowered and the used blocks do not allow reading, write them first
+                    ForceOp = fopNotUsed;
+                    continue;
+                }
+                TRACE_C("CCopyEngine::Run(): unexpected situation: unable to find any block with operation in progress!");
+                return FALSE;
+            }
+
+#ifdef ASYNC_COPY_DEBUG_MSG
+            TRACE_I("wait: GetResult: " << oldestBlockIndex << (BlockState[oldestBlockIndex] == cbsWriting ? " WRITE" : " READ"));
+#endif // ASYNC_COPY_DEBUG_MSG
+
+            // here we wait for the oldest started asynchronous operation in progress to complete,
+            // the result is taken in the next pass through the loop
+            Io->GetResult(oldestBlockIndex, &bytes, &err);
+
+#ifdef ASYNC_COPY_DEBUG_MSG
+            char sss[1000];
+            sprintf(sss, "wait done: 0x%08X 0x%08X", BlockOffset[oldestBlockIndex].LoDWord, bytes);
+            TRACE_I(sss);
+#endif // ASYNC_COPY_DEBUG_MSG
+
+            if (!OnWaitDone())
+                return FALSE; // cancel
+        }
+    }
+    if (ReadOffset != WriteOffset)
+        TRACE_C("CCopyEngine::Run(): unexpected situation after copy: ReadOffset != WriteOffset");
+    return TRUE;
+}
@@ -0,0 +1,519 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The copy engine and the controller use only Windows types and CQuadWord (spl_com.h), the
+// files are accessed only through a backend (Windows: overlapped or positional ReadFile/
+// WriteFile, other systems: pread/pwrite or io_uring), so the engine can be built outside
+// of Salamander: tools/copybench measures it with various block sizes and queue depths
+// (the data for tuning ASYNC_COPY_BUF_SIZE* and ASYNC_COPY_BLOCKS), also on Linux. The copy
+// to a sparse file finds the allocated ranges of the source through CCopyRanges (tools/
+// sparsecheck checks that the holes are kept).
+
+// io_uring backend: only if the kernel headers have it (it is checked again when the ring is
+// created, the caller falls back to CCopyIoPositional); COPYENGINE_NO_IO_URING turns it off
+#if !defined(_WIN32) && defined(__linux__) && !defined(COPYENGINE_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define COPYENGINE_IO_URING
+#endif
+#endif
+
+#define COPYENGINE_MAX_BLOCKS 64 // upper limit for the number of blocks (queue depth) of the engine
+
+#define COPYRANGES_QUERY 64 // allocated ranges returned by one FSCTL_QUERY_ALLOCATED_RANGES of CCopyRangesAllocated
+
+#define COPYTUNER_WINDOW 500       // minimal length of a measuring window of CCopyTuner (in ms)
+#define COPYTUNER_MIN_WRITES 4     // minimal number of written blocks in a measuring window
+#define COPYTUNER_GAIN 105         // a step of the block size is kept if the speed grows at least to this percentage
+#define COPYTUNER_SETTLE_WINDOWS 8 // number of windows without probing after the best block size was found
+
+//*********************************************************************************
+//
+// CCopyIoBackend
+//
+// Executes reads from the source and writes to the target file for CCopyEngine.
+// Every operation is bound to a block (0 to number of blocks - 1); the engine
+// never starts a new operation in a block before it has taken the result of the
+// previous one (GetResult).
+//
+
+class CCopyIoBackend
+{
+public:
+    virtual ~CCopyIoBackend() {}
+
+    // starts reading 'size' bytes from 'offset' of the source file into 'buffer'; returns
+    // FALSE if the read could not be started ('err' is the error); end of file is not
+    // reported here, GetResult returns it as ERROR_HANDLE_EOF
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err) = 0;
+
+    // starts writing 'size' bytes from 'buffer' to 'offset' of the target file; returns FALSE
+    // if the write could not be started ('err' is the error)
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err) = 0;
+
+    // returns TRUE if the operation of block 'block' is finished (GetResult will not wait)
+    virtual BOOL IsDone(int block) = 0;
+
+    // waits for the operation of block 'block' to finish; returns TRUE on success ('bytes'
+    // is the number of transferred bytes), otherwise FALSE and the error in 'err'
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err) = 0;
+
+    // aborts all operations in progress (GetResult returns their result without waiting,
+    // mostly ERROR_OPERATION_ABORTED)
+    virtual void CancelAll() = 0;
+};
+
+#ifdef _WIN32
+
+//*********************************************************************************
+//
+// CCopyIoOverlapped
+//
+// Asynchronous backend: overlapped ReadFile/WriteFile on files opened with
+// FILE_FLAG_OVERLAPPED. The OVERLAPPED structures (one for every block, each with
+// its manual-reset event) belong to the caller. The handles are passed by pointer,
+// the caller may reopen the files (Retry after an error).
+//
+
+class CCopyIoOverlapped : public CCopyIoBackend
+{
+protected:
+    HANDLE* In;
+    HANDLE* Out;
+    OVERLAPPED* Overlapped;
+    BOOL Writing[COPYENGINE_MAX_BLOCKS]; // TRUE = the last operation of the block was a write (its handle is Out)
+
+public:
+    CCopyIoOverlapped(HANDLE* in, HANDLE* out, OVERLAPPED* overlapped);
+
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL IsDone(int block) { return HasOverlappedIoCompleted(&Overlapped[block]); }
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err);
+    virtual void CancelAll();
+
+protected:
+    OVERLAPPED* InitOverlapped(int block, const CQuadWord& offset);
+};
+
+//*********************************************************************************
+//
+// CCopyIoPositional
+//
+// Synchronous backend: every operation is done at once by a positional ReadFile/
+// WriteFile (an offset in OVERLAPPED on a file opened without FILE_FLAG_OVERLAPPED),
+// GetResult only returns the stored result. It is the baseline the asynchronous
+// backend is measured against.
+//
+
+class CCopyIoPositional : public CCopyIoBackend
+{
+protected:
+    HANDLE* In;
+    HANDLE* Out;
+    DWORD Bytes[COPYENGINE_MAX_BLOCKS]; // result of the last operation of the block: transferred bytes
+    DWORD Error[COPYENGINE_MAX_BLOCKS]; // result of the last operation of the block: NO_ERROR or the error
+
+public:
+    CCopyIoPositional(HANDLE* in, HANDLE* out);
+
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL IsDone(int block) { return TRUE; }
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err);
+    virtual void CancelAll() {}
+};
+
+#else // _WIN32
+
+//*********************************************************************************
+//
+// CCopyIoPositional
+//
+// Synchronous backend of other systems: every operation is done at once by pread/
+// pwrite (repeated until the whole block is transferred), GetResult only returns the
+// stored result; errno is converted to the Windows error codes the engine and its
+// callers distinguish (see CopyIoErrorFromErrno). The descriptors are passed by pointer
+// like the handles on Windows.
+//
+
+class CCopyIoPositional : public CCopyIoBackend
+{
+protected:
+    int* In;
+    int* Out;
+    DWORD Bytes[COPYENGINE_MAX_BLOCKS]; // result of the last operation of the block: transferred bytes
+    DWORD Error[COPYENGINE_MAX_BLOCKS]; // result of the last operation of the block: NO_ERROR or the error
+
+public:
+    CCopyIoPositional(int* in, int* out);
+
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL IsDone(int /*block*/) { return TRUE; }
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err);
+    virtual void CancelAll() {}
+};
+
+// converts 'err' (errno) to a Windows error code: ERROR_DISK_FULL, ERROR_OPERATION_ABORTED,
+// ERROR_ACCESS_DENIED, ERROR_FILE_NOT_FOUND, ERROR_NOT_ENOUGH_MEMORY or ERROR_GEN_FAILURE
+DWORD CopyIoErrorFromErrno(int err);
+
+#ifdef COPYENGINE_IO_URING
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+//*********************************************************************************
+//
+// CCopyIoUring
+//
+// Asynchronous backend of Linux: the reads and writes are submitted to an io_uring
+// (one submission per operation, the kernel executes them concurrently up to the queue
+// depth of the engine), the completions are collected when the engine asks about a
+// block. The ring is set up by the system calls directly (no liburing); if the kernel
+// does not allow it, IsGood returns FALSE and the caller uses CCopyIoPositional.
+//
+
+class CCopyIoUring : public CCopyIoBackend
+{
+protected:
+    int* In;
+    int* Out;
+    int Ring; // io_uring descriptor, -1 = not available
+
+    // shared rings (see io_uring_setup(2))
+    void* SqRing;
+    size_t SqRingSize;
+    void* CqRing; // == SqRing if the kernel maps both rings at once
+    size_t CqRingSize;
+    io_uring_sqe* Sqes;
+    size_t SqesSize;
+    unsigned* SqTail;
+    unsigned* SqMask;
+    unsigned* SqArray;
+    unsigned* CqHead;
+    unsigned* CqTail;
+    unsigned* CqMask;
+    io_uring_cqe* Cqes;
+
+    // the last operation of every block; a short transfer is continued by another submission
+    // (like ReadFile/WriteFile, the operation ends with the whole block, the end of file or an error)
+    BOOL Pending[COPYENGINE_MAX_BLOCKS];            // TRUE = the operation is not completed yet
+    BOOL Reading[COPYENGINE_MAX_BLOCKS];            // TRUE = it is a read
+    BYTE* Buffer[COPYENGINE_MAX_BLOCKS];            // its buffer
+    unsigned __int64 Offset[COPYENGINE_MAX_BLOCKS]; // its offset in the file
+    DWORD Requested[COPYENGINE_MAX_BLOCKS];         // its size
+    DWORD Bytes[COPYENGINE_MAX_BLOCKS];             // bytes transferred so far
+    DWORD Error[COPYENGINE_MAX_BLOCKS];             // result of the completed operation: NO_ERROR or the error
+
+public:
+    CCopyIoUring(int* in, int* out);
+    virtual ~CCopyIoUring();
+
+    BOOL IsGood() { return Ring != -1; }
+
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err);
+    virtual BOOL IsDone(int block);
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err);
+    virtual void CancelAll();
+
+protected:
+    // queues and submits one operation ('opcode' is IORING_OP_xxx, the completion carries 'userData');
+    // returns FALSE on error ('err')
+    BOOL Submit(BYTE opcode, int fd, unsigned __int64 addr, DWORD size, unsigned __int64 offset,
+                unsigned __int64 userData, DWORD* err);
+
+    // submits the rest of the operation of block 'block'; returns FALSE on error ('err')
+    BOOL SubmitBlock(int block, DWORD* err);
+
+    // takes all completions from the ring; if 'wait' is TRUE, waits for at least one
+    void Reap(BOOL wait);
+};
+
+#endif // COPYENGINE_IO_URING
+
+#endif // _WIN32
+
+//*********************************************************************************
+//
+// CCopyRanges
+//
+// Allocated ranges of the source of a copy to a sparse file: only they are read, the
+// holes between them are skipped and stay holes in the target (the runs of zeros read
+// from the allocated ranges are skipped too, see CopyFindDataRun). Backend of the
+// file system: CCopyRangesAllocated (FSCTL_QUERY_ALLOCATED_RANGES) on Windows,
+// CCopyRangesSeek (SEEK_DATA/SEEK_HOLE) on other systems.
+//
+
+class CCopyRanges
+{
+public:
+    virtual ~CCopyRanges() {}
+
+    // finds the allocated range of the source containing 'offset' or the first one behind it,
+    // only below 'fileSize'; returns TRUE with the range in 'start' (not below 'offset') and
+    // 'end'; FALSE with NO_ERROR in 'err' = no more data below 'fileSize' (a hole up to the end),
+    // FALSE with an error = the ranges are not known (the source has to be read whole)
+    virtual BOOL GetNextRange(const CQuadWord& offset, const CQuadWord& fileSize, CQuadWord* start,
+                              CQuadWord* end, DWORD* err) = 0;
+};
+
+#ifdef _WIN32
+
+class CCopyRangesAllocated : public CCopyRanges
+{
+protected:
+    HANDLE* In;
+    OVERLAPPED* Overlapped; // for a source opened with FILE_FLAG_OVERLAPPED (its event is manual-reset), NULL = synchronous source
+    FILE_ALLOCATED_RANGE_BUFFER Ranges[COPYRANGES_QUERY]; // result of the last query
+    int RangesCount;                                      // number of ranges in Ranges, -1 = not queried yet
+    int RangeIndex;                                       // first range of Ranges not lying below the last 'offset'
+    BOOL MoreRanges;                                      // TRUE = the last query did not return all ranges (ERROR_MORE_DATA)
+
+public:
+    CCopyRangesAllocated(HANDLE* in, OVERLAPPED* overlapped);
+
+    virtual BOOL GetNextRange(const CQuadWord& offset, const CQuadWord& fileSize, CQuadWord* start,
+                              CQuadWord* end, DWORD* err);
+
+protected:
+    // asks the file system for the ranges from 'offset' to 'fileSize'; FALSE = error in 'err'
+    BOOL Query(const CQuadWord& offset, const CQuadWord& fileSize, DWORD* err);
+};
+
+#else // _WIN32
+
+class CCopyRangesSeek : public CCopyRanges
+{
+protected:
+    int* In;
+
+public:
+    CCopyRangesSeek(int* in) { In = in; }
+
+    virtual BOOL GetNextRange(const CQuadWord& offset, const CQuadWord& fileSize, CQuadWord* start,
+                              CQuadWord* end, DWORD* err);
+};
+
+#endif // _WIN32
+
+// returns TRUE if block 'buf' of 'size' bytes contains only zeros
+BOOL IsZeroBlock(const char* buf, DWORD size);
+
+// finds the first run of non-zero blocks at 'pos' or behind it in 'buf' of 'size' bytes (the
+// blocks have 'zeroBlock' bytes, they are counted from 'pos'); returns it in 'start' and 'end',
+// 'start' == 'end' == 'size' if there are only zeros behind 'pos'
+void CopyFindDataRun(const char* buf, DWORD size, DWORD pos, DWORD zeroBlock, DWORD* start, DWORD* end);
+
+//*********************************************************************************
+//
+// CCopyTuner
+//
+// Feedback controller of the block size and queue depth of CCopyEngine. The engine
+// reports every finished read and write (size and latency), the controller evaluates
+// them in measuring windows:
+//
+//   - block size: hill climbing in powers of two - a step is kept while the speed of
+//     the window grows, otherwise it is returned and the opposite direction is tried;
+//     when both directions fail, the size is kept for COPYTUNER_SETTLE_WINDOWS windows
+//     and probed again (the conditions of the link change); the queue depth does not
+//     change while a step is measured, otherwise the speeds would not be comparable
+//
+//   - queue depth: from the bandwidth-delay product, enough reads in flight to cover
+//     the minimal latency at the current speed plus a quarter for growth (the engine
+//     reads into at most half of the blocks, so the depth is twice that); the speed
+//     comes from GetMeasuredSpeed if the descendant has it (Salamander: the transfer
+//     speed meter of the operation), otherwise from the window
+//
+// The learned values stay in the object, one controller can be used for all files
+// copied between the same source and target (the next file starts where the last
+// one ended). The time comes from GetTime, a simulation can replace it.
+//
+
+class CCopyTuner
+{
+protected:
+    int MinBlockSize;  // limits of the block size (powers of two)
+    int MaxBlockSize;
+    int MinQueueDepth; // limits of the queue depth
+    int MaxQueueDepth;
+
+    int BlockSize;  // current block size
+    int QueueDepth; // current queue depth
+
+    // hill climbing of the block size
+    int Direction;              // +1 = probing bigger blocks, -1 = smaller blocks
+    int BestBlockSize;          // block size with the best speed found so far
+    unsigned __int64 BestSpeed; // speed measured with BestBlockSize (in bytes per second), 0 = unknown
+    int FailedProbes;           // number of directions which did not bring a higher speed
+    int SettleWindows;          // number of windows left before probing again
+    BOOL StepPending;           // TRUE = BlockSize was stepped from BestBlockSize, the next window decides
+
+    // measuring window
+    DWORD WindowStart;            // time the window started
+    unsigned __int64 WindowBytes; // bytes written in the window
+    DWORD WindowWrites;           // number of writes in the window
+
+    DWORD MinLatency; // minimal latency of a read or write seen so far (in ms), 0xFFFFFFFF = none
+
+public:
+    CCopyTuner(int minBlockSize, int maxBlockSize, int minQueueDepth, int maxQueueDepth,
+               int blockSize, int queueDepth);
+    virtual ~CCopyTuner() {}
+
+    int GetBlockSize() { return BlockSize; }
+    int GetQueueDepth() { return QueueDepth; }
+
+    // starts a new measuring window (called by the engine at the start of every copy)
+    void StartWindow();
+
+    // a read ('write' is FALSE) or a write of 'bytes' bytes finished after 'latency' ms
+    void AddSample(BOOL write, DWORD bytes, DWORD latency);
+
+    // evaluates the measuring window if it is long enough; returns TRUE if the block size
+    // or the queue depth changed
+    BOOL Update();
+
+    // current time in ms
+    virtual DWORD GetTime() { return GetTickCount(); }
+
+    // returns the current transfer speed measured outside of the controller (in bytes per
+    // second); FALSE = not available, the speed of the window is used
+    virtual BOOL GetMeasuredSpeed(CQuadWord* /*speed*/) { return FALSE; }
+
+protected:
+    BOOL StepBlockSize(); // moves BlockSize by one step in Direction; FALSE = at the limit
+};
+
+//*********************************************************************************
+//
+// CCopyEngine
+//
+// Block scheduler of the pipelined copy: keeps up to half of the blocks reading the
+// source ahead and up to half of them writing the target (the writes go strictly in
+// the order of offsets), waits for the oldest operation when nothing new can be
+// started, follows the source if it shrinks or grows during the copy and confirms
+// the end of the source by reading behind it. The I/O itself is done by a backend,
+// everything else (progress, suspend mode, error dialogs, Retry) by the descendant
+// through the virtual methods.
+//
+
+enum CCopy_BlkState
+{
+    cbsFree,       // the block is not used
+    cbsRead,       // reading of the source file into the block - finished (waiting for write)
+    cbsInProgress, // --- below are the states "waiting for completion of operation" (above are finished states)
+    cbsReading,    // reading of the source file into the block - started (in progress)
+    cbsTestingEOF, // testing the end of the source file
+    cbsWriting,    // writing the block to the target file
+    cbsDiscarded,  // reading the source file behind its end (should only return error: EOF)
+};
+
+enum CCopy_ForceOp
+{
+    fopNotUsed, // we can read or write, as convenient...
+    fopReading, // we must read
+    fopWriting  // we must write
+};
+
+class CCopyEngine
+{
+public:
+    CCopyIoBackend* Io;
+    void** Buffers;      // buffers of the blocks (each at least *BlockSize bytes long)
+    int NumOfBlocks;     // number of blocks (maximal queue depth), at most COPYENGINE_MAX_BLOCKS
+    CQuadWord* FileSize; // expected size of the source file, updated when the source shrinks or grows
+    int* BlockSize;      // size of the blocks read from the source, can be changed during the copy
+
+    CCopy_ForceOp ForceOp;                            // fopReading = we must read now, fopWriting = we must write now
+    BOOL ReadingDone;                                 // TRUE = the source file is completely read
+    CCopy_BlkState BlockState[COPYENGINE_MAX_BLOCKS]; // state of the blocks
+    DWORD BlockDataLen[COPYENGINE_MAX_BLOCKS];        // for each block: expected data (cbsReading + cbsTestingEOF), valid data (cbsWriting)
+    CQuadWord BlockOffset[COPYENGINE_MAX_BLOCKS];     // for each block: offset of the block in the source/target file
+    DWORD BlockTime[COPYENGINE_MAX_BLOCKS];           // for each block: "time" the last asynchronous operation in this block started
+    DWORD CurTime;                                    // "time" for 'BlockTime', we count on overflow (though it's probably unrealistic)
+    int FreeBlocks;                                   // current number of free blocks (cbsFree)
+    int FreeBlockIndex;                               // hint for the index of a free block (cbsFree), must be verified!
+    int ReadingBlocks;                                // current number of blocks being read into (cbsReading and cbsTestingEOF)
+    int WritingBlocks;                                // current number of blocks being written to the file (cbsWriting)
+    CQuadWord ReadOffset;                             // offset for reading the next block from the source file (previous ones are/were being read)
+    CQuadWord WriteOffset;                            // offset for writing the next block to the target file (previous ones are/were being written)
+
+    CCopyTuner* Tuner;                           // controller of the block size and queue depth, NULL = fixed values
+    int QueueDepth;                              // max. number of used blocks (the rest stays free), at most NumOfBlocks
+    DWORD BlockStartTime[COPYENGINE_MAX_BLOCKS]; // for each block: Tuner->GetTime() when the last operation started
+
+public:
+    CCopyEngine(CCopyIoBackend* io, void** buffers, int numOfBlocks, CQuadWord* fileSize, int* blockSize);
+    virtual ~CCopyEngine() {}
+
+    // copies the source file to the target file; returns TRUE when the whole source is
+    // written, FALSE when the copy was ended by one of the virtual methods below
+    BOOL Run();
+
+    BOOL IsOperationDone() { return ReadingDone && FreeBlocks == NumOfBlocks; }
+
+    // lets 'tuner' control the block size (at most *BlockSize) and the queue depth (at most
+    // NumOfBlocks); call before Run
+    void SetTuner(CCopyTuner* tuner);
+
+    // aborts the asynchronous operations in progress
+    void CancelOpPhase1() { Io->CancelAll(); }
+    // makes sure all asynchronous operations really finished and sets WriteOffset to the end
+    // of the contiguously written part of the target file
+    // WARNING: frees the unneeded blocks, only those with read data of the IN file which
+    //          also continue from WriteOffset remain (they are usable for Retry)
+    void CancelOpPhase2(int errBlkIndex);
+
+protected:
+    // error while reading block 'blkIndex' (-1 = error when starting a read, the block is not
+    // assigned); returns TRUE to continue the copy (Retry: the operations were cancelled by
+    // CancelOpPhase1+2 and the state was prepared for resuming), FALSE to end it
+    virtual BOOL OnReadError(int blkIndex, DWORD err) = 0;
+
+    // error while writing block 'blkIndex'; 'maxWriteOffset' is the end of the written part of
+    // the target file including the failed block; return value as in OnReadError
+    virtual BOOL OnWriteError(int blkIndex, DWORD err, const CQuadWord& maxWriteOffset) = 0;
+
+    // called after an operation was started; 'opCompleted' is TRUE if it finished at once
+    // (synchronously or from the cache); returns FALSE if the copy is cancelled (reported as
+    // ERROR_CANCELLED through OnReadError/OnWriteError)
+    virtual BOOL OnOpStarted(BOOL /*opCompleted*/) { return TRUE; }
+
+    // called after a read finished successfully (including a read which found the end of
+    // the source file)
+    virtual void OnBlockRead() {}
+
+    // called before the write of 'size' bytes of 'data' at 'offset' of the target file starts;
+    // blocks are written in the order of their offsets, a block can be written again after
+    // a retry (the descendant can checksum the copied data here)
+    virtual void OnBlockWriting(const void* /*data*/, DWORD /*size*/, const CQuadWord& /*offset*/) {}
+
+    // called after a block of 'bytes' bytes was written to the target file (progress, speed
+    // limit; *BlockSize can be changed here); returns FALSE to end the copy
+    virtual BOOL OnBlockWritten(DWORD /*bytes*/) { return TRUE; }
+
+    // called after waiting for the oldest operation; returns FALSE to end the copy
+    virtual BOOL OnWaitDone() { return TRUE; }
+
+    // the source file is larger than expected, sets *FileSize to its current size (at least
+    // 'minFileSize')
+    virtual void GetNewFileSize(const CQuadWord& minFileSize) { *FileSize = minFileSize; }
+
+    // the tuner sets the queue depth to 'queueDepth' blocks (at most NumOfBlocks); returns how many
+    // can be used (the descendant can allocate the buffers of the new blocks here), at least one
+    virtual int OnQueueDepthChange(int queueDepth) { return queueDepth; }
+
+    int GetReadBlockSize() { return Tuner != NULL && Tuner->GetBlockSize() < *BlockSize ? Tuner->GetBlockSize() : *BlockSize; }
+    void ApplyTuning();
+
+    BOOL StartReading(int blkIndex, DWORD readSize, DWORD* err, BOOL testEOF);
+    BOOL StartWriting(int blkIndex, DWORD* err);
+    int FindBlock(CCopy_BlkState state);
+    void FreeBlock(int blkIndex);
+    void DiscardBlocksBehindEOF(const CQuadWord& fileSize, int excludeIndex);
+};
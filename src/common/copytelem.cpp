@@ -0,0 +1,229 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "copytelem.h"
+
+//
+// ****************************************************************************
+// CCopyTelemetry
+//
+
+static const char* const CopyTelemetryPhaseNames[ctpCount] = {
+    "file", "open-source", "create-target", "data", "read", "write", "set-times",
+    "close", "verify", "set-attrs", "ads", "security", "stall"};
+
+static const char* const CopyTelemetryStallNames[] = {
+    "speed-limit", "paused", "queue", "user-dialog"};
+
+CCopyTelemetry::CCopyTelemetry()
+{
+    Records = NULL;
+    AddedRecords = 0;
+    memset(Summary, 0, sizeof(Summary));
+    Frequency = 1;
+    StartCounter = 0;
+}
+
+CCopyTelemetry::~CCopyTelemetry()
+{
+    if (Records != NULL)
+        free(Records);
+}
+
+BOOL CCopyTelemetry::Init()
+{
+    if (Records == NULL)
+        Records = (CCopyTelemetryRecord*)malloc(COPYTELEM_RECORDS * sizeof(CCopyTelemetryRecord));
+    if (Records == NULL)
+    {
+        TRACE_E("CCopyTelemetry::Init(): low memory!");
+        return FALSE;
+    }
+    AddedRecords = 0;
+    memset(Summary, 0, sizeof(Summary));
+    StartCounter = GetCounter(&Frequency);
+    return TRUE;
+}
+
+unsigned __int64 CCopyTelemetry::GetCounter(unsigned __int64* frequency)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    *frequency = freq.QuadPart;
+    return counter.QuadPart;
+#else  // _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *frequency = 1000000000;
+    return (unsigned __int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif // _WIN32
+}
+
+unsigned __int64 CCopyTelemetry::GetTime()
+{
+    unsigned __int64 frequency;
+    unsigned __int64 ticks = GetCounter(&frequency) - StartCounter;
+    // without overflow of 'ticks * 1000000' (a counter with 10 MHz would overflow after 21 days)
+    return (ticks / Frequency) * 1000000 + ((ticks % Frequency) * 1000000) / Frequency;
+}
+
+void CCopyTelemetry::Add(CCopyTelemetryPhase phase, unsigned __int64 start, unsigned __int64 bytes,
+                         DWORD err, WORD detail)
+{
+    DWORD lastErr = GetLastError(); // the caller typically evaluates the error of the phase after us
+    unsigned __int64 now = GetTime();
+    DWORD duration = now > start ? (now - start > 0xFFFFFFFF ? 0xFFFFFFFF : (DWORD)(now - start)) : 0;
+
+    DWORD index = (DWORD)(InterlockedIncrement64(&AddedRecords) - 1) & (COPYTELEM_RECORDS - 1);
+    CCopyTelemetryRecord* rec = &Records[index];
+    rec->Start = start;
+    rec->Bytes = bytes;
+    rec->Duration = duration;
+    rec->Error = err;
+    rec->ThreadID = GetCurrentThreadId();
+    rec->Phase = (WORD)phase;
+    rec->Detail = detail;
+
+    CCopyTelemetrySummary* sum = &Summary[phase];
+    InterlockedIncrement(&sum->Count);
+    InterlockedExchangeAdd64(&sum->TotalTime, duration);
+    if (bytes != 0)
+        InterlockedExchangeAdd64(&sum->Bytes, bytes);
+    LONG max = sum->MaxTime;
+    LONG dur = duration > 0x7FFFFFFF ? 0x7FFFFFFF : (LONG)duration;
+    while (dur > max)
+    {
+        LONG prev = InterlockedCompareExchange(&sum->MaxTime, dur, max);
+        if (prev == max)
+            break;
+        max = prev;
+    }
+    int bucket = 0;
+    while (bucket < COPYTELEM_BUCKETS - 1 && (duration >> bucket) != 0)
+        bucket++;
+    InterlockedIncrement(&sum->Histogram[bucket]);
+    SetLastError(lastErr);
+}
+
+// returns the upper bound (in us) of the duration of 'percent' % of phases of summary 'sum'
+static DWORD GetPercentileTime(const CCopyTelemetrySummary* sum, int percent)
+{
+    LONG limit = (LONG)(((LONGLONG)sum->Count * percent + 99) / 100);
+    LONG count = 0;
+    int i;
+    for (i = 0; i < COPYTELEM_BUCKETS; i++)
+    {
+        count += sum->Histogram[i];
+        if (count >= limit)
+            break;
+    }
+    return i >= COPYTELEM_BUCKETS - 1 ? sum->MaxTime : (DWORD)1 << i;
+}
+
+#ifdef _WIN32
+typedef HANDLE CTelemetryFile;
+#else  // _WIN32
+typedef FILE* CTelemetryFile;
+#endif // _WIN32
+
+// writes 'len' characters of 'text' to 'file'
+static BOOL WriteTelemetryText(CTelemetryFile file, const char* text, int len)
+{
+#ifdef _WIN32
+    DWORD written;
+    return WriteFile(file, text, len, &written, NULL) && written == (DWORD)len;
+#else  // _WIN32
+    return fwrite(text, 1, len, file) == (size_t)len;
+#endif // _WIN32
+}
+
+BOOL CCopyTelemetry::Dump(const char* fileName)
+{
+    if (Records == NULL)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+#ifdef _WIN32
+    HANDLE file = HANDLES_Q(CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                       FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+#else  // _WIN32
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL)
+        return FALSE; // errno is set
+#endif // _WIN32
+
+    unsigned __int64 added = (unsigned __int64)AddedRecords;
+    unsigned __int64 count = added < COPYTELEM_RECORDS ? added : COPYTELEM_RECORDS;
+    char line[300];
+    int len = sprintf(line, "Open Salamander copy telemetry: %llu ms, %llu records (%llu oldest overwritten)\r\n\r\n"
+                            "phase,count,total_ms,avg_us,max_us,p50_us,p99_us,bytes,MB_per_s\r\n",
+                      GetTime() / 1000, added, added - count);
+    BOOL ok = WriteTelemetryText(file, line, len);
+    int i;
+    for (i = 0; ok && i < ctpCount; i++)
+    {
+        CCopyTelemetrySummary* sum = &Summary[i];
+        if (sum->Count == 0)
+            continue;
+        len = sprintf(line, "%s,%d,%lld,%lld,%d,%u,%u,%lld,%.1f\r\n", CopyTelemetryPhaseNames[i],
+                      (int)sum->Count, sum->TotalTime / 1000, sum->TotalTime / sum->Count, (int)sum->MaxTime,
+                      GetPercentileTime(sum, 50), GetPercentileTime(sum, 99), sum->Bytes,
+                      sum->TotalTime > 0 ? (double)sum->Bytes / sum->TotalTime : 0.0); // bytes per us = MB per s
+        ok = WriteTelemetryText(file, line, len);
+    }
+
+    if (ok)
+    {
+        len = sprintf(line, "\r\nstart_us,duration_us,phase,detail,bytes,error,thread\r\n");
+        ok = WriteTelemetryText(file, line, len);
+    }
+    char buf[64 * 1024]; // the records are written in blocks, there can be many of them
+    int bufLen = 0;
+    unsigned __int64 r;
+    for (r = added - count; ok && r != added; r++)
+    {
+        CCopyTelemetryRecord* rec = &Records[r & (COPYTELEM_RECORDS - 1)];
+        const char* detail = "";
+        if (rec->Phase == ctpStall && rec->Detail < _countof(CopyTelemetryStallNames))
+            detail = CopyTelemetryStallNames[rec->Detail];
+        bufLen += sprintf(buf + bufLen, "%llu,%u,%s,%s,%llu,%u,%u\r\n", rec->Start, rec->Duration,
+                          rec->Phase < ctpCount ? CopyTelemetryPhaseNames[rec->Phase] : "?", detail,
+                          rec->Bytes, rec->Error, rec->ThreadID);
+        if (bufLen > (int)sizeof(buf) - 200) // one line is much shorter
+        {
+            ok = WriteTelemetryText(file, buf, bufLen);
+            bufLen = 0;
+        }
+    }
+    if (ok && bufLen > 0)
+        ok = WriteTelemetryText(file, buf, bufLen);
+
+    DWORD err = ok ? NO_ERROR : GetLastError();
+#ifdef _WIN32
+    if (!HANDLES(CloseHandle(file)) && ok)
+#else  // _WIN32
+    if (fclose(file) != 0 && ok)
+#endif // _WIN32
+    {
+        err = GetLastError();
+        ok = FALSE;
+    }
+    if (!ok)
+    {
+#ifdef _WIN32
+        DeleteFile(fileName);
+#else  // _WIN32
+        remove(fileName);
+#endif // _WIN32
+        SetLastError(err);
+    }
+    return ok;
+}
@@ -0,0 +1,106 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+#define COPYTELEM_RECORDS 65536 // records in the ring buffer (power of two), the oldest ones are overwritten
+#define COPYTELEM_BUCKETS 32    // buckets of the latency histogram: bucket i counts durations below 2^i us
+
+enum CCopyTelemetryPhase
+{
+    ctpFile,         // copy of one whole file, Bytes = size of the file
+    ctpOpenSource,   // opening of the source file
+    ctpCreateTarget, // creation of the target file (including compression and encryption)
+    ctpData,         // transfer of the data of one file, Bytes = transferred bytes
+    ctpRead,         // read of one block, Bytes = read bytes
+    ctpWrite,        // write of one block, Bytes = written bytes
+    ctpSetTimes,     // setting of the time of the target file
+    ctpClose,        // closing of the target file (the redirector flushes the data here)
+    ctpVerify,       // verification of the copied file
+    ctpSetAttrs,     // setting of the attributes of the target file
+    ctpADS,          // copying of the alternate data streams
+    ctpSecurity,     // copying of the NTFS permissions
+    ctpStall,        // the operation waited, Detail = CCopyTelemetryStall
+
+    ctpCount // number of phases
+};
+
+enum CCopyTelemetryStall
+{
+    ctsSpeedLimit, // braking because of the speed limit
+    ctsPaused,     // paused by the user
+    ctsQueue,      // waiting in the queue of Copy/Move operations
+    ctsUserDialog, // waiting for the answer of the user (error, overwrite, ...)
+};
+
+struct CCopyTelemetryRecord
+{
+    unsigned __int64 Start; // start of the phase in microseconds since the start of the operation
+    unsigned __int64 Bytes; // transferred bytes (depends on the phase, otherwise 0)
+    DWORD Duration;         // duration of the phase in microseconds
+    DWORD Error;            // NO_ERROR or the error which ended the phase
+    DWORD ThreadID;         // thread which did the phase (the worker or a helper thread)
+    WORD Phase;             // value from CCopyTelemetryPhase
+    WORD Detail;            // ctpStall: value from CCopyTelemetryStall
+};
+
+struct CCopyTelemetrySummary
+{
+    volatile LONG Count;
+    volatile LONG MaxTime;           // the longest phase in microseconds
+    volatile LONGLONG TotalTime;     // in microseconds
+    volatile LONGLONG Bytes;
+    volatile LONG Histogram[COPYTELEM_BUCKETS]; // see COPYTELEM_BUCKETS
+};
+
+//*********************************************************************************
+//
+// CCopyTelemetry
+//
+// Timings of the phases of a Copy/Move operation (see CCopyTelemetryPhase) for
+// finding out where a slow copy spends its time. Every phase is one fixed-size
+// record in a ring buffer (the newest COPYTELEM_RECORDS records are kept) and is
+// added to the summary of its phase (count, time, bytes, latency histogram), which
+// covers the whole operation. The phases of one file are the records of the same
+// thread lying inside its ctpFile record.
+//
+// Add() can be called from any thread at once and does not change GetLastError().
+// Every record gets its own slot (the slots are handed out by an atomic 64-bit
+// counter, so it cannot wrap around); a slot is reused only after COPYTELEM_RECORDS
+// newer records. Dump() is called when nobody adds records anymore (the records
+// being written could be incomplete). Builds also outside of Windows (see
+// tools/copybench).
+//
+
+class CCopyTelemetry
+{
+protected:
+    CCopyTelemetryRecord* Records;
+    volatile LONGLONG AddedRecords; // number of added records, the next one goes to AddedRecords % COPYTELEM_RECORDS
+    CCopyTelemetrySummary Summary[ctpCount];
+    unsigned __int64 Frequency;     // ticks of GetCounter() per second
+    unsigned __int64 StartCounter;  // GetCounter() at the start of the operation
+
+public:
+    CCopyTelemetry();
+    ~CCopyTelemetry();
+
+    // allocates the ring buffer and starts measuring; returns FALSE on low memory
+    BOOL Init();
+
+    // returns the time in microseconds since Init() (the start of a phase for Add())
+    unsigned __int64 GetTime();
+
+    // adds phase 'phase' which started at 'start' (from GetTime()) and ends now
+    void Add(CCopyTelemetryPhase phase, unsigned __int64 start, unsigned __int64 bytes,
+             DWORD err = NO_ERROR, WORD detail = 0);
+
+    // writes the summary and the records (the oldest first) as CSV to file 'fileName';
+    // returns FALSE on error (GetLastError() is set)
+    BOOL Dump(const char* fileName);
+
+protected:
+    // returns the high resolution counter and its frequency (ticks per second)
+    static unsigned __int64 GetCounter(unsigned __int64* frequency);
+};
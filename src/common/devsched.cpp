@@ -0,0 +1,169 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "devsched.h"
+
+//
+// ****************************************************************************
+// CDeviceScheduler
+//
+
+int CDeviceScheduler::GetDevice(const char* key, int limit)
+{
+    int i;
+    for (i = 0; i < Devices.Count; i++)
+    {
+        if (strcmp(Devices[i].Key, key) == 0)
+            return i;
+    }
+    CDevSchedDevice dev;
+    lstrcpyn(dev.Key, key, DEVSCHED_MAX_KEY);
+    dev.Limit = limit > 0 ? limit : 1;
+    dev.Claimed = 0;
+    Devices.Add(dev);
+    if (!Devices.IsGood())
+    {
+        Devices.ResetState();
+        return -1;
+    }
+    return Devices.Count - 1;
+}
+
+int CDeviceScheduler::FindJob(DWORD_PTR id)
+{
+    int i;
+    for (i = 0; i < Jobs.Count; i++)
+    {
+        if (Jobs[i].ID == id)
+            return i;
+    }
+    return -1;
+}
+
+BOOL CDeviceScheduler::AddJob(DWORD_PTR id, const int* devices, int devicesCount, BOOL startOnIdle)
+{
+    if (FindJob(id) != -1)
+    {
+        TRACE_E("CDeviceScheduler::AddJob(): this job has already been added!");
+        return FALSE;
+    }
+    CDevSchedJob job;
+    job.ID = id;
+    job.State = djsWaiting;
+    job.StartOnIdle = startOnIdle;
+    job.DevicesCount = 0;
+    int i;
+    for (i = 0; i < devicesCount; i++)
+    {
+        if (devices[i] < 0 || devices[i] >= Devices.Count)
+            continue; // unknown device (e.g. low memory in GetDevice), the job does not contend on it
+        int j;
+        for (j = 0; j < job.DevicesCount && job.Devices[j] != devices[i]; j++)
+            ;
+        if (j == job.DevicesCount && job.DevicesCount < DEVSCHED_MAX_JOB_DEVICES) // e.g. copy within one disk: the disk is used once
+            job.Devices[job.DevicesCount++] = devices[i];
+    }
+    Jobs.Add(job);
+    if (!Jobs.IsGood())
+    {
+        Jobs.ResetState();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL CDeviceScheduler::RemoveJob(DWORD_PTR id)
+{
+    int i = FindJob(id);
+    if (i == -1)
+        return FALSE;
+    Jobs.Delete(i);
+    if (!Jobs.IsGood())
+        Jobs.ResetState();
+    return TRUE;
+}
+
+BOOL CDeviceScheduler::SetJobState(DWORD_PTR id, CDevSchedJobState state)
+{
+    int i = FindJob(id);
+    if (i == -1)
+        return FALSE;
+    Jobs[i].State = state;
+    return TRUE;
+}
+
+BOOL CDeviceScheduler::MoveJobToEnd(DWORD_PTR id, BOOL startOnIdle)
+{
+    int i = FindJob(id);
+    if (i == -1)
+        return FALSE;
+    CDevSchedJob job = Jobs[i];
+    for (; i + 1 < Jobs.Count; i++)
+        Jobs[i] = Jobs[i + 1];
+    job.State = djsWaiting;
+    job.StartOnIdle = startOnIdle;
+    Jobs[i] = job;
+    return TRUE;
+}
+
+int CDeviceScheduler::GetJobState(DWORD_PTR id)
+{
+    int i = FindJob(id);
+    return i == -1 ? -1 : Jobs[i].State;
+}
+
+int CDeviceScheduler::Schedule(TDirectArray<DWORD_PTR>* started)
+{
+    // devices of running and paused jobs are taken
+    BOOL anyActive = FALSE;
+    int i;
+    for (i = 0; i < Devices.Count; i++)
+        Devices[i].Claimed = 0;
+    for (i = 0; i < Jobs.Count; i++)
+    {
+        CDevSchedJob* job = &Jobs[i];
+        if (job->State != djsWaiting)
+        {
+            anyActive = TRUE;
+            int j;
+            for (j = 0; j < job->DevicesCount; j++)
+                Devices[job->Devices[j]].Claimed++;
+        }
+    }
+
+    // waiting jobs start in the order of the queue, a job which cannot start reserves its
+    // devices so the jobs behind it do not overtake it there
+    int count = 0;
+    for (i = 0; i < Jobs.Count; i++)
+    {
+        CDevSchedJob* job = &Jobs[i];
+        if (job->State != djsWaiting)
+            continue;
+        BOOL canRun = !job->StartOnIdle || !anyActive;
+        int j;
+        for (j = 0; canRun && j < job->DevicesCount; j++)
+        {
+            CDevSchedDevice* dev = &Devices[job->Devices[j]];
+            if (dev->Claimed >= dev->Limit)
+                canRun = FALSE;
+        }
+        for (j = 0; j < job->DevicesCount; j++)
+            Devices[job->Devices[j]].Claimed++;
+        if (canRun)
+        {
+            job->State = djsRunning;
+            anyActive = TRUE;
+            if (started != NULL)
+            {
+                started->Add(job->ID);
+                if (!started->IsGood())
+                    started->ResetState(); // the job runs anyway, only the caller does not learn about it
+            }
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,92 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The device scheduler uses only Windows types and TDirectArray, so it can be built
+// outside of Salamander: tools/queuebench runs it against simulated devices and compares
+// the throughput with running everything at once and with running one job at a time.
+
+#define DEVSCHED_MAX_KEY 128         // max. length of a device key (including the terminating null)
+#define DEVSCHED_MAX_JOB_DEVICES 8   // max. number of devices of one job (the rest is ignored)
+#define DEVSCHED_LIMIT_HDD 1         // jobs running at once on a disk with seek penalty (rotating disk)
+#define DEVSCHED_LIMIT_SSD 4         // jobs running at once on a disk without seek penalty (SSD, NVMe)
+#define DEVSCHED_LIMIT_NETWORK 1     // jobs running at once on one network server
+#define DEVSCHED_LIMIT_UNKNOWN 1     // jobs running at once on a device of unknown kind
+
+enum CDevSchedJobState
+{
+    djsRunning, // the job runs
+    djsWaiting, // the job waits until its devices are free ("auto-paused")
+    djsPaused,  // the job was paused by the user (it keeps its devices)
+};
+
+struct CDevSchedDevice
+{
+    char Key[DEVSCHED_MAX_KEY]; // identification of the physical device ("disk3", "\\server", ...)
+    int Limit;                  // max. number of jobs using the device at once
+    int Claimed;                // only for Schedule(): jobs using or reserving the device
+};
+
+struct CDevSchedJob
+{
+    DWORD_PTR ID;
+    CDevSchedJobState State;
+    BOOL StartOnIdle; // the job may start only when no other job runs or is paused
+    int Devices[DEVSCHED_MAX_JOB_DEVICES];
+    int DevicesCount;
+};
+
+//*********************************************************************************
+//
+// CDeviceScheduler
+//
+// Queue of jobs (disk Copy/Move operations), each job touches a set of devices.
+// Jobs on independent devices run concurrently, jobs contending for a device run one
+// after another (or up to the device limit at once). The order of the queue is kept:
+// a waiting job reserves its devices, so later jobs cannot overtake it on them.
+// The object is not synchronized, the owner (COperationsQueue) locks it.
+//
+
+class CDeviceScheduler
+{
+protected:
+    TDirectArray<CDevSchedDevice> Devices; // known devices, never removed
+    TDirectArray<CDevSchedJob> Jobs;       // jobs in the order of the queue
+
+public:
+    CDeviceScheduler() : Devices(10, 10), Jobs(5, 10) {}
+
+    // returns the index of the device with key 'key', adds it with 'limit' if it is new;
+    // returns -1 on low memory
+    int GetDevice(const char* key, int limit);
+
+    // adds job 'id' touching 'devicesCount' devices 'devices' (indexes from GetDevice(),
+    // duplicates are allowed) to the end of the queue in state djsWaiting; returns FALSE
+    // on low memory or if the job already is in the queue
+    BOOL AddJob(DWORD_PTR id, const int* devices, int devicesCount, BOOL startOnIdle);
+
+    // removes job 'id' from the queue; returns FALSE if it is not there
+    BOOL RemoveJob(DWORD_PTR id);
+
+    // sets the state of job 'id'; returns FALSE if it is not there
+    BOOL SetJobState(DWORD_PTR id, CDevSchedJobState state);
+
+    // moves job 'id' to the end of the queue in state djsWaiting, with 'startOnIdle' it then
+    // waits until all other jobs end; returns FALSE if it is not there
+    BOOL MoveJobToEnd(DWORD_PTR id, BOOL startOnIdle);
+
+    // returns the state of job 'id' or -1 if it is not there
+    int GetJobState(DWORD_PTR id);
+
+    // switches the waiting jobs which can run now to djsRunning (in the order of the queue)
+    // and adds their IDs to 'started' (can be NULL); returns the number of started jobs
+    int Schedule(TDirectArray<DWORD_PTR>* started);
+
+    int GetJobsCount() { return Jobs.Count; }
+    DWORD_PTR GetJobID(int index) { return Jobs[index].ID; }
+
+protected:
+    int FindJob(DWORD_PTR id);
+};
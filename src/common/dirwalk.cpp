@@ -0,0 +1,424 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "dirwalk.h"
+
+int GetDirWalkerThreadCount(int configured)
+{
+    if (configured > 0)
+        return min(configured, DIRWALK_MAX_WORKERS);
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = 2 * (int)si.dwNumberOfProcessors;
+    if (count < 4)
+        count = 4;
+    if (count > 16)
+        count = 16;
+    return count;
+}
+
+//*********************************************************************************
+//
+// CDirWalkerWorker
+//
+
+struct CDirWalkerWorker
+{
+    CParallelDirWalker* Walker;
+    int Index;
+    HANDLE Thread; // NULL for worker 0 (runs in the thread calling Walk())
+
+    CRITICAL_SECTION QueueCS;  // guards Queue and QueueHead
+    TDirectArray<char*> Queue; // directories waiting to be listed (full paths with a trailing backslash)
+    int QueueHead;             // index of the first valid item in Queue (items before it were stolen)
+
+    char Path[MAX_PATH + 2]; // buffer for the listed directory (space for "*" and the terminator)
+
+    CDirWalkerWorker() : Queue(100, 500)
+    {
+        Walker = NULL;
+        Index = 0;
+        Thread = NULL;
+        QueueHead = 0;
+        Path[0] = 0;
+        HANDLES(InitializeCriticalSection(&QueueCS));
+    }
+    ~CDirWalkerWorker()
+    {
+        int i;
+        for (i = QueueHead; i < Queue.Count; i++)
+            free(Queue[i]);
+        HANDLES(DeleteCriticalSection(&QueueCS));
+    }
+};
+
+//*********************************************************************************
+//
+// worker thread
+//
+
+unsigned DirWalkerThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("DirWalkerThreadBody()");
+    SetThreadNameInVCAndTrace("DirWalker");
+    CDirWalkerWorker* worker = (CDirWalkerWorker*)param;
+    worker->Walker->WorkerBody(worker);
+    return 0;
+}
+
+unsigned DirWalkerThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return DirWalkerThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread DirWalker: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // harder exit (this call still performs some operations)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI DirWalkerThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return DirWalkerThreadEH(param);
+}
+
+//*********************************************************************************
+//
+// CParallelDirWalker
+//
+
+CParallelDirWalker::CParallelDirWalker(CDirWalkerCallback* callback, int workers, volatile BOOL* stop)
+{
+    Callback = callback;
+    Stop = stop;
+    PendingDirs = 0;
+    if (workers < 1)
+        workers = 1;
+    if (workers > DIRWALK_MAX_WORKERS)
+        workers = DIRWALK_MAX_WORKERS;
+    WorkersCount = workers;
+    Workers = new CDirWalkerWorker[workers];
+    if (Workers == NULL)
+        TRACE_E(LOW_MEMORY);
+    else
+    {
+        int i;
+        for (i = 0; i < workers; i++)
+        {
+            Workers[i].Walker = this;
+            Workers[i].Index = i;
+        }
+    }
+    WorkAvailable = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL));
+    WalkFinished = HANDLES(CreateEvent(NULL, TRUE, FALSE, NULL));
+    if (WorkAvailable == NULL || WalkFinished == NULL)
+        TRACE_E("CParallelDirWalker: unable to create events.");
+}
+
+CParallelDirWalker::~CParallelDirWalker()
+{
+    if (Workers != NULL)
+        delete[] Workers;
+    if (WorkAvailable != NULL)
+        HANDLES(CloseHandle(WorkAvailable));
+    if (WalkFinished != NULL)
+        HANDLES(CloseHandle(WalkFinished));
+}
+
+BOOL CParallelDirWalker::PushDirectory(CDirWalkerWorker* worker, char* path)
+{
+    InterlockedIncrement(&PendingDirs);
+    HANDLES(EnterCriticalSection(&worker->QueueCS));
+    worker->Queue.Add(path);
+    BOOL ok = worker->Queue.IsGood();
+    if (!ok)
+        worker->Queue.ResetState();
+    HANDLES(LeaveCriticalSection(&worker->QueueCS));
+    if (ok)
+        SetEvent(WorkAvailable);
+    else
+    {
+        // low memory: list the directory right away (deeper recursion, but nothing gets lost)
+        ListDirectory(worker, path);
+        free(path);
+        DirectoryDone();
+    }
+    return ok;
+}
+
+char* CParallelDirWalker::PopDirectory(CDirWalkerWorker* worker)
+{
+    char* path = NULL;
+
+    // our own queue: take the most recently found directory
+    HANDLES(EnterCriticalSection(&worker->QueueCS));
+    if (worker->Queue.Count > worker->QueueHead)
+    {
+        path = worker->Queue[worker->Queue.Count - 1];
+        worker->Queue.Detach(worker->Queue.Count - 1);
+        if (worker->Queue.Count == worker->QueueHead) // the queue is empty, reuse the space of stolen items
+        {
+            worker->Queue.DetachMembers();
+            worker->QueueHead = 0;
+        }
+    }
+    HANDLES(LeaveCriticalSection(&worker->QueueCS));
+    if (path != NULL)
+        return path;
+
+    // steal from the others: take the oldest directory (closest to the root = largest subtree)
+    int i;
+    for (i = 1; i < WorkersCount && path == NULL; i++)
+    {
+        CDirWalkerWorker* victim = &Workers[(worker->Index + i) % WorkersCount];
+        if (victim->Queue.Count <= victim->QueueHead) // unsynchronized peek, verified below
+            continue;
+        HANDLES(EnterCriticalSection(&victim->QueueCS));
+        if (victim->Queue.Count > victim->QueueHead)
+        {
+            path = victim->Queue[victim->QueueHead];
+            victim->Queue[victim->QueueHead] = NULL;
+            victim->QueueHead++;
+            if (victim->Queue.Count == victim->QueueHead)
+            {
+                victim->Queue.DetachMembers();
+                victim->QueueHead = 0;
+            }
+        }
+        HANDLES(LeaveCriticalSection(&victim->QueueCS));
+    }
+    return path;
+}
+
+void CParallelDirWalker::DirectoryDone()
+{
+    if (InterlockedDecrement(&PendingDirs) == 0)
+        SetEvent(WalkFinished);
+}
+
+void CParallelDirWalker::ListDirectory(CDirWalkerWorker* worker, const char* dir)
+{
+    SLOW_CALL_STACK_MESSAGE2("CParallelDirWalker::ListDirectory(%s)", dir);
+
+    char* path = worker->Path;
+    int len = (int)strlen(dir);
+    if (len >= MAX_PATH)
+    {
+        Callback->WalkError(worker->Index, dweNameTooLong, dir, ERROR_FILENAME_EXCED_RANGE);
+        return;
+    }
+    memcpy(path, dir, len + 1);
+
+    if (!Callback->EnterDirectory(worker->Index, path, len))
+        return;
+
+    if (len + 1 >= MAX_PATH)
+    {
+        Callback->WalkError(worker->Index, dweNameTooLong, path, ERROR_FILENAME_EXCED_RANGE);
+        Callback->LeaveDirectory(worker->Index, path, len, FALSE);
+        return;
+    }
+    path[len] = '*';
+    path[len + 1] = 0;
+
+    WIN32_FIND_DATA file;
+    HANDLE find = HANDLES_Q(FindFirstFile(path, &file));
+    path[len] = 0;
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        DWORD err = GetLastError();
+        BOOL empty = err == ERROR_FILE_NOT_FOUND || err == ERROR_NO_MORE_FILES;
+        if (!empty)
+            Callback->WalkError(worker->Index, dweOpenDir, path, err);
+        Callback->LeaveDirectory(worker->Index, path, len, empty);
+        return;
+    }
+
+    BOOL testFindNextErr = TRUE;
+    do
+    {
+        if (file.cFileName[0] == 0 ||
+            (file.cFileName[0] == '.' && (file.cFileName[1] == 0 || (file.cFileName[1] == '.' && file.cFileName[2] == 0))))
+        {
+            continue; // "." and ".."
+        }
+
+        int nameLen = (int)strlen(file.cFileName);
+        if (len + nameLen >= MAX_PATH)
+        {
+            char longName[2 * MAX_PATH];
+            memcpy(longName, path, len);
+            memcpy(longName + len, file.cFileName, nameLen + 1);
+            Callback->WalkError(worker->Index, dweNameTooLong, longName, ERROR_FILENAME_EXCED_RANGE);
+            continue;
+        }
+
+        if (Callback->FoundEntry(worker->Index, path, len, &file) &&
+            (file.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+        {
+            if (len + nameLen + 1 /* backslash */ < MAX_PATH)
+            {
+                char* subDir = (char*)malloc(len + nameLen + 2);
+                if (subDir != NULL)
+                {
+                    memcpy(subDir, path, len);
+                    memcpy(subDir + len, file.cFileName, nameLen);
+                    subDir[len + nameLen] = '\\';
+                    subDir[len + nameLen + 1] = 0;
+                    if (!PushDirectory(worker, subDir))
+                    {
+                        // the subdirectory has already been listed using our buffer (low memory),
+                        // restore the buffer and let the callback know which directory we are in again
+                        memcpy(path, dir, len + 1);
+                        Callback->EnterDirectory(worker->Index, path, len);
+                    }
+                }
+                else
+                    TRACE_E(LOW_MEMORY);
+            }
+            else
+            {
+                memcpy(path + len, file.cFileName, nameLen + 1);
+                Callback->WalkError(worker->Index, dweNameTooLong, path, ERROR_FILENAME_EXCED_RANGE);
+                path[len] = 0;
+            }
+        }
+
+        if (*Stop)
+        {
+            testFindNextErr = FALSE;
+            break;
+        }
+    } while (FindNextFile(find, &file));
+    DWORD err = GetLastError();
+    HANDLES(FindClose(find));
+
+    BOOL complete = testFindNextErr && err == ERROR_NO_MORE_FILES;
+    if (testFindNextErr && err != ERROR_NO_MORE_FILES)
+        Callback->WalkError(worker->Index, dweReadDir, path, err);
+    Callback->LeaveDirectory(worker->Index, path, len, complete);
+}
+
+void CParallelDirWalker::WorkerBody(CDirWalkerWorker* worker)
+{
+    HANDLE events[2];
+    events[0] = WalkFinished;
+    events[1] = WorkAvailable;
+    BOOL idle = FALSE;
+    while (!*Stop)
+    {
+        char* dir = PopDirectory(worker);
+        if (dir != NULL)
+        {
+            idle = FALSE;
+            ListDirectory(worker, dir);
+            free(dir);
+            DirectoryDone();
+            continue;
+        }
+
+        if (PendingDirs == 0)
+            break;
+        if (!idle)
+        {
+            Callback->WorkerIdle(worker->Index);
+            idle = TRUE;
+        }
+        // wait for work; the timeout covers wake-ups consumed by other workers and 'Stop'
+        if (WaitForMultipleObjects(2, events, FALSE, 50) == WAIT_OBJECT_0)
+            break;
+    }
+    Callback->WorkerIdle(worker->Index);
+}
+
+BOOL CParallelDirWalker::AddDirectory(int worker, const char* dir)
+{
+    int len = (int)strlen(dir);
+    char* path = (char*)malloc(len + 1);
+    if (path == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    memcpy(path, dir, len + 1);
+    return PushDirectory(&Workers[worker], path);
+}
+
+BOOL CParallelDirWalker::Walk(const char* root)
+{
+    return Walk(&root, 1);
+}
+
+BOOL CParallelDirWalker::Walk(const char* const* roots, int count)
+{
+    CALL_STACK_MESSAGE3("CParallelDirWalker::Walk(%s, %d)", count > 0 ? roots[0] : "", count);
+    if (!IsGood())
+        return FALSE;
+
+    ResetEvent(WalkFinished);
+    PendingDirs = 0;
+    BOOL allQueued = TRUE;
+    int r;
+    for (r = 0; r < count; r++)
+    {
+        int len = (int)strlen(roots[r]);
+        char* rootDir = (char*)malloc(len + 2);
+        if (rootDir == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            if (r == 0)
+                return FALSE;
+            allQueued = FALSE; // the roots queued so far are walked anyway (their workers must finish)
+            break;
+        }
+        memcpy(rootDir, roots[r], len + 1);
+        if (len == 0 || rootDir[len - 1] != '\\')
+        {
+            rootDir[len] = '\\';
+            rootDir[len + 1] = 0;
+        }
+        PushDirectory(&Workers[0], rootDir);
+    }
+    if (count == 0)
+        return TRUE;
+
+    int i;
+    for (i = 1; i < WorkersCount; i++)
+    {
+        DWORD threadID;
+        Workers[i].Thread = HANDLES(CreateThread(NULL, 0, DirWalkerThread, &Workers[i], 0, &threadID));
+        if (Workers[i].Thread == NULL)
+        {
+            TRACE_E("CParallelDirWalker::Walk(): unable to start worker thread."); // fewer workers will do it
+            break;
+        }
+        SetThreadPriority(Workers[i].Thread, GetThreadPriority(GetCurrentThread()));
+    }
+
+    WorkerBody(&Workers[0]);
+
+    for (i = 1; i < WorkersCount; i++)
+    {
+        if (Workers[i].Thread != NULL)
+        {
+            WaitForSingleObject(Workers[i].Thread, INFINITE);
+            HANDLES(CloseHandle(Workers[i].Thread));
+            Workers[i].Thread = NULL;
+        }
+    }
+    return allQueued;
+}
@@ -0,0 +1,128 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The walker uses only Windows API (threads, events, FindFirstFile), so it can be built outside
+// of Salamander: tools/dirbench walks synthetic trees with it (also on Linux, through a shim).
+
+#define DIRWALK_MAX_WORKERS 32 // upper limit for the number of threads walking one tree
+
+// returns the number of worker threads to use; 'configured' is the value from the configuration
+// (0 = automatic: derived from the number of processors, enumeration is mostly waiting for
+// the disk or network, so we use more threads than processors)
+int GetDirWalkerThreadCount(int configured);
+
+//*********************************************************************************
+//
+// CDirWalkerCallback
+//
+// Receives the results of CParallelDirWalker. All methods are called from worker
+// threads (several at once), so implementations must be thread-safe. 'worker' is
+// the index of the calling worker (0 to workers-1) and can be used to keep
+// per-worker data without locking.
+
+enum CDirWalkerErrorType
+{
+    dweOpenDir,     // FindFirstFile failed (the directory cannot be listed)
+    dweReadDir,     // FindNextFile failed (the listing is incomplete)
+    dweNameTooLong, // the full name of an entry exceeds MAX_PATH
+};
+
+class CDirWalkerCallback
+{
+public:
+    // called before the directory 'path' (full path with a trailing backslash, 'pathLen'
+    // is its length) is listed; returns FALSE if the directory should be skipped; on low
+    // memory a subdirectory is listed right away during the listing of its parent and then
+    // EnterDirectory is called for the parent once more (the return value is ignored)
+    virtual BOOL EnterDirectory(int /*worker*/, const char* /*path*/, int /*pathLen*/) { return TRUE; }
+
+    // called after the directory 'path' has been listed (only if EnterDirectory returned
+    // TRUE); 'complete' is FALSE if the listing is incomplete (an error was reported by
+    // WalkError or the walk was stopped)
+    virtual void LeaveDirectory(int /*worker*/, const char* /*path*/, int /*pathLen*/, BOOL /*complete*/) {}
+
+    // called for every entry of the listed directory except "." and ".."; 'path' is the
+    // listed directory (full path with a trailing backslash); returns TRUE if 'file' is
+    // a directory which should be walked as well
+    virtual BOOL FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file) = 0;
+
+    // reports an error; 'path' is the directory (dweOpenDir, dweReadDir) or the full
+    // name of the entry (dweNameTooLong); 'err' is the Windows error code
+    virtual void WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err) = 0;
+
+    // called when the worker has run out of work (it may get more later) and before
+    // it ends; used for flushing data collected by the worker
+    virtual void WorkerIdle(int /*worker*/) {}
+};
+
+//*********************************************************************************
+//
+// CParallelDirWalker
+//
+// Walks a directory tree on a pool of worker threads. Every worker owns a queue of
+// directories waiting to be listed: it takes directories from the tail of its own
+// queue (depth-first, the directory it has just found is likely still cached) and
+// when its queue is empty, it steals from the head of the other workers' queues
+// (those are the directories closest to the root, so the idle worker gets a large
+// subtree). Worker 0 runs in the thread calling Walk().
+
+struct CDirWalkerWorker;
+
+class CParallelDirWalker
+{
+protected:
+    CDirWalkerCallback* Callback;
+    volatile BOOL* Stop; // set from outside to TRUE to terminate the walk
+
+    CDirWalkerWorker* Workers;
+    int WorkersCount;
+
+    volatile LONG PendingDirs; // directories queued or being listed; zero = the walk is finished
+    HANDLE WorkAvailable;      // auto-reset event: a directory was queued
+    HANDLE WalkFinished;       // manual-reset event: PendingDirs dropped to zero
+
+public:
+    // 'workers' is the number of threads (including the calling one), 'stop' points
+    // to a variable polled by the workers (the walk ends as soon as it is TRUE)
+    CParallelDirWalker(CDirWalkerCallback* callback, int workers, volatile BOOL* stop);
+    ~CParallelDirWalker();
+
+    BOOL IsGood() { return Workers != NULL && WorkAvailable != NULL && WalkFinished != NULL; }
+
+    // walks directory 'root' (full path, trailing backslash is optional) including all
+    // subdirectories for which the callback requests it; returns after the whole tree
+    // has been processed or the walk has been stopped; returns FALSE if the walk could
+    // not be started at all (low memory)
+    BOOL Walk(const char* root);
+
+    // walks several directory trees at once ('roots' are full paths, 'count' is their number);
+    // returns FALSE also if not all roots could be queued (low memory)
+    BOOL Walk(const char* const* roots, int count);
+
+    // queues directory 'dir' (full path with a trailing backslash) for listing; called by
+    // the callback of 'worker' from EnterDirectory which returns FALSE (the callback knows
+    // the subdirectories without listing the directory); on low memory the directory is
+    // listed right away; returns FALSE on low memory (the directory is not walked)
+    BOOL AddDirectory(int worker, const char* dir);
+
+protected:
+    // adds directory 'path' (allocated, the queue takes ownership) to the queue of 'worker';
+    // on low memory the directory is listed right away (using worker->Path) and FALSE is returned
+    BOOL PushDirectory(CDirWalkerWorker* worker, char* path);
+
+    // takes a directory from the tail of the worker's own queue, or steals one from
+    // the head of another worker's queue; returns NULL if all queues are empty
+    char* PopDirectory(CDirWalkerWorker* worker);
+
+    // lists one directory (full path with a trailing backslash)
+    void ListDirectory(CDirWalkerWorker* worker, const char* dir);
+
+    void DirectoryDone();
+
+    void WorkerBody(CDirWalkerWorker* worker);
+
+    friend unsigned DirWalkerThreadBody(void* param);
+};
@@ -0,0 +1,164 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "liststore.h"
+#include "listdelta.h"
+
+//
+// ****************************************************************************
+// CListingDelta
+//
+
+CListingDelta::CListingDelta()
+{
+    NewToOld = NULL;
+    NewState = NULL;
+    OldToNew = NULL;
+    OldCount = 0;
+    NewCount = 0;
+    NewItems = 0;
+    ChangedItems = 0;
+    RemovedItems = 0;
+    Capacity = 0;
+    HashHeads = NULL;
+    HashNext = NULL;
+    HashSize = 0;
+}
+
+void CListingDelta::Release()
+{
+    if (NewToOld != NULL)
+        free(NewToOld); // the start of the common allocation of all arrays
+    NewToOld = NULL;
+    NewState = NULL;
+    OldToNew = NULL;
+    HashHeads = NULL;
+    HashNext = NULL;
+    HashSize = 0;
+    Capacity = 0;
+    OldCount = 0;
+    NewCount = 0;
+    NewItems = 0;
+    ChangedItems = 0;
+    RemovedItems = 0;
+}
+
+DWORD CListingDelta::HashName(const char* name, int len)
+{
+    // FNV-1a; see the class description for the folding of characters
+    DWORD hash = 2166136261u;
+    const unsigned char* s = (const unsigned char*)name;
+    const unsigned char* end = s + len;
+    while (s < end)
+    {
+        unsigned char c = *s++;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        else
+        {
+            if (c >= 0x80)
+                c = 0x80;
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+BOOL CListingDelta::Compute(const CListingColumns* oldItems, const CListingColumns* newItems,
+                            BOOL caseSensitive, CListingNameCompare cmpIgnCase)
+{
+    OldCount = oldItems->Count;
+    NewCount = newItems->Count;
+    NewItems = 0;
+    ChangedItems = 0;
+    RemovedItems = 0;
+
+    int hashSize = 16;
+    while (hashSize < 2 * OldCount)
+        hashSize <<= 1;
+    int capacity = OldCount > NewCount ? OldCount : NewCount;
+    if (capacity > Capacity || hashSize > HashSize)
+    {
+        if (capacity < Capacity)
+            capacity = Capacity;
+        if (hashSize < HashSize)
+            hashSize = HashSize;
+        Release();
+        OldCount = oldItems->Count;
+        NewCount = newItems->Count;
+        // all arrays in one allocation, ordered by the size of their items (alignment)
+        char* mem = (char*)malloc(capacity * (3 * sizeof(int) + sizeof(BYTE)) + hashSize * sizeof(int));
+        if (mem == NULL)
+        {
+            TRACE_E("Low memory");
+            return FALSE;
+        }
+        NewToOld = (int*)mem;
+        OldToNew = NewToOld + capacity;
+        HashNext = OldToNew + capacity;
+        HashHeads = HashNext + capacity;
+        NewState = (BYTE*)(HashHeads + hashSize);
+        Capacity = capacity;
+        HashSize = hashSize;
+    }
+
+    // chains of the old items; the items are added from the end, so each chain is in the
+    // order of the old listing
+    int i;
+    for (i = 0; i < HashSize; i++)
+        HashHeads[i] = -1;
+    for (i = OldCount - 1; i >= 0; i--)
+    {
+        int* head = HashHeads + (HashName(oldItems->Name[i], oldItems->NameLen[i]) & (HashSize - 1));
+        HashNext[i] = *head;
+        *head = i;
+        OldToNew[i] = -1;
+    }
+
+    for (i = 0; i < NewCount; i++)
+    {
+        const char* name = newItems->Name[i];
+        int len = newItems->NameLen[i];
+        int exact = -1;
+        int ignCase = -1;
+        int o;
+        for (o = HashHeads[HashName(name, len) & (HashSize - 1)]; o != -1; o = HashNext[o])
+        {
+            if (OldToNew[o] != -1 || oldItems->NameLen[o] != len)
+                continue; // already paired or surely a different name (the case of letters does not change the length)
+            if (memcmp(oldItems->Name[o], name, len) == 0)
+            {
+                exact = o;
+                break;
+            }
+            if (!caseSensitive && ignCase == -1 && cmpIgnCase(oldItems->Name[o], len, name, len) == 0)
+                ignCase = o;
+        }
+        o = exact != -1 ? exact : ignCase;
+        NewToOld[i] = o;
+        if (o == -1)
+        {
+            NewState[i] = ldsNew;
+            NewItems++;
+        }
+        else
+        {
+            OldToNew[o] = i;
+            if (exact != -1 && oldItems->Size[o] == newItems->Size[i] &&
+                oldItems->LastWrite[o] == newItems->LastWrite[i] && oldItems->Attr[o] == newItems->Attr[i])
+            {
+                NewState[i] = ldsSame;
+            }
+            else
+            {
+                NewState[i] = ldsChanged;
+                ChangedItems++;
+            }
+        }
+    }
+    RemovedItems = OldCount - (NewCount - NewItems);
+    return TRUE;
+}
@@ -0,0 +1,66 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The listing delta uses only Windows types and CListingColumns (liststore.h), so it can
+// be built outside of Salamander like the listing storage.
+
+enum CListingDeltaState
+{
+    ldsSame,    // the item is in both listings with the same name, size, time and attributes
+    ldsChanged, // the item is in both listings, its size, time, attributes or case of name differ
+    ldsNew,     // the item is only in the new listing
+};
+
+//*********************************************************************************
+//
+// CListingDelta
+//
+// Difference between two versions of one directory listing (before and after a refresh).
+// The items are paired by names through a hash table, so the order of both listings does
+// not matter (the old one is usually sorted as the user wants, the new one by name).
+// An exact match of the names is preferred, without 'caseSensitive' the names can also
+// differ in the case of letters (compared by 'cmpIgnCase', the hash ignores the case of
+// ASCII letters and all other characters are hashed as one value, so names which are equal
+// for 'cmpIgnCase' always meet in one chain of the table).
+// The memory stays allocated for the next refresh. The object is not synchronized.
+//
+
+class CListingDelta
+{
+public:
+    int* NewToOld;       // for each new item: index of its old item or -1 (ldsNew)
+    BYTE* NewState;      // for each new item: CListingDeltaState
+    int* OldToNew;       // for each old item: index of its new item or -1 (removed item)
+    int OldCount;        // number of old items
+    int NewCount;        // number of new items
+    int NewItems;        // number of new items in state ldsNew
+    int ChangedItems;    // number of new items in state ldsChanged
+    int RemovedItems;    // number of old items without a new item
+
+protected:
+    int Capacity;   // allocated items of NewToOld+NewState and OldToNew
+    int* HashHeads; // index of the first old item in each chain or -1
+    int* HashNext;  // for each old item: index of the next old item in its chain or -1
+    int HashSize;   // number of chains (power of two)
+
+public:
+    CListingDelta();
+    ~CListingDelta() { Release(); }
+
+    // compares the old listing 'oldItems' with the new listing 'newItems' (only Name,
+    // NameLen, Size, LastWrite and Attr are used); returns FALSE on low memory
+    BOOL Compute(const CListingColumns* oldItems, const CListingColumns* newItems,
+                 BOOL caseSensitive, CListingNameCompare cmpIgnCase);
+
+    // returns TRUE if both listings contain the same items
+    BOOL IsEmpty() { return NewItems == 0 && ChangedItems == 0 && RemovedItems == 0; }
+
+    // releases the memory of the delta
+    void Release();
+
+protected:
+    static DWORD HashName(const char* name, int len);
+};
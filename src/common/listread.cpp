@@ -0,0 +1,191 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "listread.h"
+
+//
+// ****************************************************************************
+// CListingReader
+//
+
+CListingReader::CListingReader(CListingReaderNotify notify, void* notifyParam)
+{
+    RefCount = 1;
+    Cancelled = 0;
+    Published = 0;
+    Finished = 0;
+    NotifyPending = 1; // the first BeginTake() allows the notifications
+    Error = NO_ERROR;
+    OpenFailed = FALSE;
+    Notify = notify;
+    NotifyParam = notifyParam;
+    Head.Next = NULL;
+    Head.Count = 0;
+    Head.Used = 0;
+    Last = &Head;
+    Filling = NULL;
+    FillingStart = 0;
+    Current = &Head;
+    CurrentIndex = 0;
+    CurrentOffset = 0;
+    Taken = 0;
+    LastTakeEnd = GetTickCount() - LISTREAD_MAX_TAKE_PERIOD;
+    TakePeriod = LISTREAD_MIN_TAKE_PERIOD;
+}
+
+CListingReader::~CListingReader()
+{
+    // both threads released the object, all batches can be released
+    CListingReadBatch* batch = Current != &Head ? Current : Head.Next;
+    while (batch != NULL)
+    {
+        CListingReadBatch* next = batch->Next;
+        free(batch);
+        batch = next;
+    }
+    if (Filling != NULL)
+        free(Filling);
+}
+
+void CListingReader::Release()
+{
+    if (InterlockedDecrement(&RefCount) == 0)
+        delete this;
+}
+
+// size of an item with its names in a batch (the items are aligned to 8 bytes)
+static int GetListingReadItemSize(int nameLen, int dosNameLen)
+{
+    return (int)((sizeof(CListingReadItem) + nameLen + 1 + dosNameLen + 1 + 7) & ~7);
+}
+
+BOOL CListingReader::Add(const char* name, int nameLen, const char* dosName, int dosNameLen, DWORD attr,
+                         unsigned __int64 size, DWORD lastWriteLow, DWORD lastWriteHigh, DWORD reparseTag)
+{
+    if (dosName == NULL)
+        dosNameLen = 0;
+    int itemSize = GetListingReadItemSize(nameLen, dosNameLen);
+    if (Filling != NULL && LISTREAD_BATCH_SIZE - Filling->Used < itemSize)
+        Publish(); // the item does not fit, the batch is full
+    if (Filling == NULL)
+    {
+        Filling = (CListingReadBatch*)malloc(sizeof(CListingReadBatch) + LISTREAD_BATCH_SIZE);
+        if (Filling == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            return FALSE;
+        }
+        Filling->Next = NULL;
+        Filling->Count = 0;
+        Filling->Used = 0;
+        FillingStart = GetTickCount();
+    }
+    CListingReadItem* item = (CListingReadItem*)((char*)(Filling + 1) + Filling->Used);
+    item->Size = size;
+    item->LastWriteLow = lastWriteLow;
+    item->LastWriteHigh = lastWriteHigh;
+    item->Attr = attr;
+    item->ReparseTag = reparseTag;
+    item->NameLen = (WORD)nameLen;
+    item->DosNameLen = (WORD)dosNameLen;
+    char* s = (char*)(item + 1);
+    memcpy(s, name, nameLen);
+    s[nameLen] = 0;
+    s += nameLen + 1;
+    if (dosNameLen > 0)
+        memcpy(s, dosName, dosNameLen);
+    s[dosNameLen] = 0;
+    Filling->Used += itemSize;
+    Filling->Count++;
+    if (GetTickCount() - FillingStart >= LISTREAD_PUBLISH_PERIOD)
+        Publish(); // a slow directory: the consumer gets what has been read so far
+    return TRUE;
+}
+
+void CListingReader::Publish()
+{
+    if (Filling != NULL)
+    {
+        Last->Next = Filling; // the consumer reads Next only after it sees the new value of Published
+        Last = Filling;
+        Filling = NULL;
+        InterlockedIncrement(&Published);
+    }
+    // the consumer is notified only once until it takes the items (see BeginTake())
+    if (Notify != NULL && !IsCancelled() && InterlockedExchange(&NotifyPending, 1) == 0)
+        Notify(NotifyParam);
+}
+
+void CListingReader::Finish(DWORD error, BOOL openFailed)
+{
+    Error = error;
+    OpenFailed = openFailed;
+    if (Filling != NULL)
+    {
+        Last->Next = Filling;
+        Last = Filling;
+        Filling = NULL;
+        InterlockedIncrement(&Published);
+    }
+    InterlockedExchange(&Finished, 1); // after Error, OpenFailed and Published
+    if (Notify != NULL && !IsCancelled() && InterlockedExchange(&NotifyPending, 1) == 0)
+        Notify(NotifyParam);
+}
+
+const CListingReadItem* CListingReader::GetNext()
+{
+    while (CurrentIndex >= Current->Count)
+    {
+        if (Taken == InterlockedCompareExchange(&Published, 0, 0))
+            return NULL; // the producer has not published more batches yet
+        CListingReadBatch* next = Current->Next;
+        if (Current != &Head)
+            free(Current); // the producer does not touch a batch after it published the next one
+        Current = next;
+        CurrentIndex = 0;
+        CurrentOffset = 0;
+        Taken++;
+    }
+    CListingReadItem* item = (CListingReadItem*)((char*)(Current + 1) + CurrentOffset);
+    CurrentOffset += GetListingReadItemSize(item->NameLen, item->DosNameLen);
+    CurrentIndex++;
+    return item;
+}
+
+BOOL CListingReader::IsFinished(DWORD* error, BOOL* openFailed)
+{
+    if (InterlockedCompareExchange(&Finished, 0, 0) == 0)
+        return FALSE;
+    if (CurrentIndex < Current->Count || Taken != InterlockedCompareExchange(&Published, 0, 0))
+        return FALSE; // the items of the last batches have not been taken yet
+    *error = Error;
+    *openFailed = OpenFailed;
+    return TRUE;
+}
+
+BOOL CListingReader::BeginTake(DWORD now, DWORD* wait)
+{
+    DWORD elapsed = now - LastTakeEnd;
+    if (elapsed < TakePeriod && InterlockedCompareExchange(&Finished, 0, 0) == 0)
+    {
+        *wait = TakePeriod - elapsed;
+        return FALSE;
+    }
+    *wait = 0;
+    // we allow the notification before taking, so a batch published during the taking is not missed
+    InterlockedExchange(&NotifyPending, 0);
+    return TRUE;
+}
+
+void CListingReader::EndTake(DWORD now, DWORD cost)
+{
+    LastTakeEnd = now;
+    TakePeriod = cost * LISTREAD_TAKE_COST_FACTOR;
+    if (TakePeriod < LISTREAD_MIN_TAKE_PERIOD)
+        TakePeriod = LISTREAD_MIN_TAKE_PERIOD;
+    if (TakePeriod > LISTREAD_MAX_TAKE_PERIOD)
+        TakePeriod = LISTREAD_MAX_TAKE_PERIOD;
+}
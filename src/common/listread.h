@@ -0,0 +1,142 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The listing reader uses only Windows types and Interlocked functions, so it can be built
+// outside of Salamander: tools/readbench lists large directory trees with it (also on Linux).
+
+#define LISTREAD_BATCH_SIZE 32768      // size of the data of one batch of items
+#define LISTREAD_FIRST_TAKE_PERIOD 500 // time (in ms) the consumer waits for the whole listing before it shows a part of it
+#define LISTREAD_PUBLISH_PERIOD 100    // max. time (in ms) the first item of a batch waits for the publication of the batch
+#define LISTREAD_MIN_TAKE_PERIOD 100   // min. time (in ms) between the end of taking the items and the next taking
+#define LISTREAD_MAX_TAKE_PERIOD 2000  // max. time (in ms) between the end of taking the items and the next taking
+#define LISTREAD_TAKE_COST_FACTOR 4    // the pause after taking the items is this multiple of the time of taking them
+
+// one read item of a batch, its name and DOS name follow it
+struct CListingReadItem
+{
+    unsigned __int64 Size;
+    DWORD LastWriteLow; // FILETIME of the last write
+    DWORD LastWriteHigh;
+    DWORD Attr;
+    DWORD ReparseTag; // WIN32_FIND_DATA::dwReserved0 (the tag of a reparse point)
+    WORD NameLen;
+    WORD DosNameLen; // 0 = the item has no DOS name
+
+    const char* GetName() const { return (const char*)(this + 1); }
+    const char* GetDosName() const { return GetName() + NameLen + 1; }
+};
+
+struct CListingReadBatch
+{
+    CListingReadBatch* Next; // next published batch (NULL = not published yet)
+    int Count;               // number of items in the batch
+    int Used;                // used bytes of the data of the batch
+    // the data of the batch follows (LISTREAD_BATCH_SIZE bytes)
+};
+
+// notification of the consumer that new items can be taken (called from the thread reading
+// the listing)
+typedef void (*CListingReaderNotify)(void* param);
+
+//*********************************************************************************
+//
+// CListingReader
+//
+// Items of one directory listing handed over from the thread reading the directory
+// (the producer) to the thread showing the listing (the consumer) in batches. The
+// producer fills a batch and publishes it when it is full or when its first item
+// waits for LISTREAD_PUBLISH_PERIOD ms, so the consumer gets the items of a slow
+// directory (network share) continuously and of a fast one in large pieces. Only
+// the producer writes the batch being filled and only the consumer walks and
+// releases the published batches, the batches are chained without locks.
+// The consumer is notified when a batch is published and it has taken everything
+// it was notified about; between two takings it pauses for a multiple of the time
+// of the last taking (merging the items into a large listing costs more than reading
+// them), so the consumer stays responsive even for a directory with many items.
+// The object is shared by both threads and released by the last of them (see Release()).
+//
+
+class CListingReader
+{
+protected:
+    volatile LONG RefCount;
+    volatile LONG Cancelled;     // the consumer does not want more items
+    volatile LONG Published;     // number of published batches
+    volatile LONG Finished;      // the producer published the last batch
+    volatile LONG NotifyPending; // the consumer was notified (or does not want notifications yet)
+    DWORD Error;                 // valid after Finished: NO_ERROR or the error of reading the listing
+    BOOL OpenFailed;             // valid after Finished: the listing could not be opened at all
+
+    CListingReaderNotify Notify;
+    void* NotifyParam;
+
+    CListingReadBatch Head; // the empty batch before the first published batch
+
+    // producer only
+    CListingReadBatch* Last;    // the last published batch
+    CListingReadBatch* Filling; // the batch being filled (NULL = none)
+    DWORD FillingStart;         // GetTickCount() of the first item of Filling
+
+    // consumer only
+    CListingReadBatch* Current; // the batch being taken
+    int CurrentIndex;           // index of the next item of Current
+    int CurrentOffset;          // offset of the next item of Current in its data
+    LONG Taken;                 // number of published batches the consumer moved to
+    DWORD LastTakeEnd;          // GetTickCount() of the end of the last taking
+    DWORD TakePeriod;           // pause after the last taking in ms
+
+public:
+    // the object starts with one reference (for the consumer); the consumer is not notified
+    // until its first BeginTake()
+    CListingReader(CListingReaderNotify notify, void* notifyParam);
+
+    void AddRef() { InterlockedIncrement(&RefCount); }
+
+    // releases a reference, the last one deletes the object
+    void Release();
+
+    // ***** producer *****
+
+    // adds an item to the listing; 'dosName' can be NULL; returns FALSE on low memory
+    BOOL Add(const char* name, int nameLen, const char* dosName, int dosNameLen, DWORD attr,
+             unsigned __int64 size, DWORD lastWriteLow, DWORD lastWriteHigh, DWORD reparseTag);
+
+    // publishes the rest of the items and ends the listing: 'error' is NO_ERROR or the error
+    // of reading, 'openFailed' is TRUE if the listing could not be opened at all
+    void Finish(DWORD error, BOOL openFailed);
+
+    // returns TRUE if the consumer does not want more items (the producer should finish)
+    BOOL IsCancelled() { return Cancelled != 0; }
+
+    // ***** consumer *****
+
+    // returns the next published item or NULL if there is none now; the item is valid until
+    // the next call
+    const CListingReadItem* GetNext();
+
+    // returns TRUE if the producer finished and all items were taken; returns its error in
+    // 'error' and 'openFailed' (see Finish())
+    BOOL IsFinished(DWORD* error, BOOL* openFailed);
+
+    // the consumer does not want more items, the producer finishes at its next item
+    void Cancel() { InterlockedExchange(&Cancelled, 1); }
+
+    // called before taking the items (GetNext() until NULL) at time 'now' (GetTickCount()):
+    // returns TRUE if they should be taken now (the next publication notifies the consumer
+    // again), FALSE if the consumer should pause for 'wait' ms first (the rest of the listing
+    // after the producer finished is taken without a pause)
+    BOOL BeginTake(DWORD now, DWORD* wait);
+
+    // called after taking the items (including their processing) which ended at time 'now'
+    // and took 'cost' ms; sets the pause before the next taking
+    void EndTake(DWORD now, DWORD cost);
+
+protected:
+    ~CListingReader();
+
+    // publishes Filling (producer only)
+    void Publish();
+};
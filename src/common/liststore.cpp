@@ -0,0 +1,663 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "liststore.h"
+
+#define LISTING_MIN_RUN_ITEMS 16384 // min. number of records of one independently sorted part
+
+//
+// ****************************************************************************
+// CNameArena
+//
+
+char* CNameArena::AllocInNewBlock(int size)
+{
+    // after Reset() the kept first block is empty, start filling it again
+    if (Current == NULL && First != NULL && First->Size >= size)
+    {
+        Current = First;
+        Current->Used = size;
+        return (char*)(Current + 1);
+    }
+    int blockSize = size > NAMEARENA_BLOCK_SIZE ? size : NAMEARENA_BLOCK_SIZE;
+    CNameArenaBlock* block = (CNameArenaBlock*)malloc(sizeof(CNameArenaBlock) + blockSize);
+    if (block == NULL)
+    {
+        TRACE_E("Low memory");
+        return NULL;
+    }
+    block->Next = NULL;
+    block->Size = blockSize;
+    block->Used = size;
+    if (Current != NULL)
+        Current->Next = block;
+    else
+    {
+        if (First != NULL) // the kept first block is too small for 'size', chain the new one behind it
+            First->Next = block;
+        else
+            First = block;
+    }
+    Current = block;
+    BlocksCount++;
+    return (char*)(block + 1);
+}
+
+void CNameArena::Reset()
+{
+    if (First == NULL)
+        return;
+    CNameArenaBlock* block = First->Next;
+    while (block != NULL)
+    {
+        CNameArenaBlock* next = block->Next;
+        free(block);
+        BlocksCount--;
+        block = next;
+    }
+    First->Next = NULL;
+    First->Used = 0;
+    Current = NULL;
+}
+
+void CNameArena::Release()
+{
+    Reset();
+    if (First != NULL)
+    {
+        free(First);
+        First = NULL;
+        BlocksCount = 0;
+    }
+}
+
+//
+// ****************************************************************************
+// CListingColumns
+//
+
+CListingColumns::CListingColumns()
+{
+    Size = NULL;
+    LastWrite = NULL;
+    Attr = NULL;
+    ExtOffset = NULL;
+    Name = NULL;
+    NameLen = NULL;
+    Order = NULL;
+    Count = 0;
+    Capacity = 0;
+    SortItems = NULL;
+    MergeItems = NULL;
+    MergeCapacity = 0;
+    SortKey = lskName;
+    NameKeyRules.LowerCase = NULL;
+    NameKeyRules.Numbers = FALSE;
+    NameKeyRules.Dots = FALSE;
+    SortRuns = 0;
+}
+
+BOOL CListingColumns::SetCount(int count)
+{
+    if (count > Capacity)
+    {
+        Release();
+        // all columns in one allocation, ordered by the size of their items (alignment)
+        char* mem = (char*)malloc(count * (sizeof(CListingSortItem) + 2 * sizeof(unsigned __int64) + sizeof(char*) +
+                                           sizeof(DWORD) + sizeof(int) + 2 * sizeof(WORD)));
+        if (mem == NULL)
+        {
+            TRACE_E("Low memory");
+            return FALSE;
+        }
+        SortItems = (CListingSortItem*)mem;
+        Size = (unsigned __int64*)(SortItems + count);
+        LastWrite = Size + count;
+        Name = (const char**)(LastWrite + count);
+        Attr = (DWORD*)(Name + count);
+        Order = (int*)(Attr + count);
+        ExtOffset = (WORD*)(Order + count);
+        NameLen = ExtOffset + count;
+        Capacity = count;
+    }
+    Count = count;
+    return TRUE;
+}
+
+void CListingColumns::Release()
+{
+    if (SortItems != NULL)
+        free(SortItems); // the start of the common allocation of all columns
+    SortItems = NULL;
+    Size = NULL;
+    LastWrite = NULL;
+    Attr = NULL;
+    ExtOffset = NULL;
+    Name = NULL;
+    NameLen = NULL;
+    Order = NULL;
+    Count = 0;
+    Capacity = 0;
+    if (MergeItems != NULL)
+        free(MergeItems);
+    MergeItems = NULL;
+    MergeCapacity = 0;
+    SortRuns = 0;
+}
+
+void CListingColumns::ListingNameKey(const char* name, int len, const CListingNameKeyRules* rules,
+                                     unsigned __int64* key, int words)
+{
+    int i;
+    for (i = 0; i < words; i++)
+        key[i] = 0;
+    if (rules == NULL || rules->LowerCase == NULL)
+        return; // all keys are equal, the names are always compared
+
+    // the name is encoded part by part (texts, numbers and dots like in StrCmpLogicalEx) into
+    // bytes compared from the first one, the lowest byte of the last word holds LISTING_KEY_COMPLETE;
+    // encoding ends when the bytes run out or a part cannot be encoded
+    unsigned char bytes[8 * LISTING_NAME_KEY_WORDS];
+    int size = 8 * words - 1;
+    int count = 0;
+    BOOL complete = FALSE;
+    const unsigned char* s = (const unsigned char*)name;
+    const unsigned char* end = s + len;
+    while (count < size)
+    {
+        if (s == end) // end of the name is less than any part (like the end of a shorter text)
+        {
+            bytes[count++] = 0;
+            complete = TRUE;
+            break;
+        }
+        if (rules->Numbers && *s >= '0' && *s <= '9')
+        {
+            // number: against a text or a dot the number compares by its first digit and all
+            // digits lie between the same characters, so one mark '0' is enough; two numbers
+            // compare by the count of significant digits and then by the digits
+            while (s < end && *s == '0')
+                s++;
+            const unsigned char* digits = s;
+            while (s < end && *s >= '0' && *s <= '9')
+                s++;
+            int digitsCount = (int)(s - digits);
+            bytes[count++] = '0';
+            if (count == size)
+                break;
+            bytes[count++] = (unsigned char)(digitsCount < 255 ? digitsCount : 255);
+            if (digitsCount >= 255)
+                break;
+            while (count < size && digits < s)
+                bytes[count++] = *digits++;
+            if (digits < s)
+                break; // not all digits fit
+            continue;
+        }
+        if (rules->Numbers && rules->Dots && *s == '.') // a dot is a part by itself
+        {
+            bytes[count++] = '.';
+            s++;
+            continue;
+        }
+
+        // text: compares as a whole (up to a number or a dot when they split the name), its end
+        // is marked by 0 (end of the name) or 1 (another part follows), both are less than any
+        // character like the end of a shorter text
+        const unsigned char* partEnd = end;
+        if (rules->Numbers)
+        {
+            partEnd = s;
+            while (partEnd < end && (*partEnd < '0' || *partEnd > '9') && (!rules->Dots || *partEnd != '.'))
+                partEnd++;
+        }
+        while (count < size && s < partEnd)
+        {
+            unsigned char c = rules->LowerCase[*s];
+            if (c < 2) // character colliding with the end marks: 1 and 0xFF (the text is longer than
+            {          // an ended one, shorter than one with a greater character), such names are compared
+                bytes[count++] = 1;
+                if (count < size)
+                    bytes[count++] = 0xFF;
+                break;
+            }
+            bytes[count++] = c;
+            s++;
+        }
+        if (s < partEnd || count == size)
+            break; // the text does not fit or cannot be encoded
+        if (partEnd < end)
+            bytes[count++] = 1;
+    }
+
+    for (i = 0; i < count; i++)
+        key[i / 8] |= (unsigned __int64)bytes[i] << (56 - 8 * (i % 8));
+    if (complete)
+        key[words - 1] |= LISTING_KEY_COMPLETE;
+}
+
+// the same order as the comparisons in sort.cpp (LessSizeNameExt, etc.)
+static BOOL ListingLess(const CListingSortParams* p, const CListingSortItem& i1, const CListingSortItem& i2)
+{
+    if (i1.Key != i2.Key)
+        return p->KeyReverse ? i1.Key > i2.Key : i1.Key < i2.Key;
+    if (!p->ExtKeys || (i1.Key & LISTING_KEY_COMPLETE))
+    {
+        int i;
+        for (i = 0; i < LISTING_NAME_KEY_WORDS; i++)
+        {
+            if (i1.NameKey[i] != i2.NameKey[i])
+                return p->NameReverse ? i1.NameKey[i] > i2.NameKey[i] : i1.NameKey[i] < i2.NameKey[i];
+        }
+    }
+    int res = p->Cmp(i1.Name, i1.NameLen, i1.ExtOffset, i2.Name, i2.NameLen, i2.ExtOffset);
+    return p->NameReverse ? res > 0 : res < 0;
+}
+
+static void SortItemsAux(const CListingSortParams* p, CListingSortItem* items, int left, int right)
+{
+
+LABEL_SortItemsAux:
+
+    int i = left, j = right;
+    CListingSortItem pivot = items[(i + j) / 2];
+
+    do
+    {
+        while (ListingLess(p, items[i], pivot) && i < right)
+            i++;
+        while (ListingLess(p, pivot, items[j]) && j > left)
+            j--;
+
+        if (i <= j)
+        {
+            CListingSortItem swap = items[i];
+            items[i] = items[j];
+            items[j] = swap;
+            i++;
+            j--;
+        }
+    } while (i <= j);
+
+    // recursion only into the smaller part (max. log(N) nesting), the other one through "goto"
+    if (left < j)
+    {
+        if (i < right)
+        {
+            if (j - left < right - i)
+            {
+                SortItemsAux(p, items, left, j);
+                left = i;
+                goto LABEL_SortItemsAux;
+            }
+            else
+            {
+                SortItemsAux(p, items, i, right);
+                right = j;
+                goto LABEL_SortItemsAux;
+            }
+        }
+        else
+        {
+            right = j;
+            goto LABEL_SortItemsAux;
+        }
+    }
+    else
+    {
+        if (i < right)
+        {
+            left = i;
+            goto LABEL_SortItemsAux;
+        }
+    }
+}
+
+// merges the sorted parts 'src'[left, middle) and 'src'[middle, right) into 'dst'[left, right),
+// from two equal records takes the one from the left part first
+static void MergeItemsAux(const CListingSortParams* p, const CListingSortItem* src, CListingSortItem* dst,
+                          int left, int middle, int right)
+{
+    int i = left, j = middle, k = left;
+    while (i < middle && j < right)
+    {
+        if (ListingLess(p, src[j], src[i]))
+            dst[k++] = src[j++];
+        else
+            dst[k++] = src[i++];
+    }
+    if (i < middle)
+        memcpy(dst + k, src + i, (middle - i) * sizeof(CListingSortItem));
+    if (j < right)
+        memcpy(dst + k, src + j, (right - j) * sizeof(CListingSortItem));
+}
+
+int CListingColumns::PrepareSort(CListingSortKey key, BOOL keyReverse, BOOL nameReverse, CListingItemCompare cmp,
+                                 const CListingNameKeyRules* rules, int runs)
+{
+    SortKey = key;
+    if (rules != NULL)
+        NameKeyRules = *rules;
+    else
+        NameKeyRules.LowerCase = NULL;
+    SortParams.KeyReverse = keyReverse;
+    SortParams.NameReverse = nameReverse;
+    SortParams.ExtKeys = key == lskExt;
+    SortParams.Cmp = cmp;
+
+    if (runs > Count / LISTING_MIN_RUN_ITEMS)
+        runs = Count / LISTING_MIN_RUN_ITEMS;
+    if (runs > LISTING_MAX_SORT_RUNS)
+        runs = LISTING_MAX_SORT_RUNS;
+    if (runs < 1)
+        runs = 1;
+    if (runs > 1 && MergeCapacity < Count)
+    {
+        if (MergeItems != NULL)
+            free(MergeItems);
+        MergeItems = (CListingSortItem*)malloc(Count * sizeof(CListingSortItem));
+        if (MergeItems == NULL)
+        {
+            TRACE_E("Low memory");
+            MergeCapacity = 0;
+            runs = 1; // without merging the listing is sorted as one part
+        }
+        else
+            MergeCapacity = Count;
+    }
+    SortRuns = runs;
+    int i;
+    for (i = 0; i <= runs; i++)
+        RunStart[i] = (int)((__int64)Count * i / runs);
+    return runs;
+}
+
+void CListingColumns::SortRun(int run)
+{
+    int left = RunStart[run];
+    int right = RunStart[run + 1];
+    // the keys are built here, so the parts sorted in parallel build them in parallel too
+    int i;
+    for (i = left; i < right; i++)
+    {
+        CListingSortItem* item = &SortItems[i];
+        const char* name = Name[i];
+        int len = NameLen[i];
+        int ext = ExtOffset[i];
+        switch (SortKey)
+        {
+        case lskSize:
+            item->Key = Size[i];
+            break;
+        case lskTime:
+            item->Key = LastWrite[i];
+            break;
+        case lskAttr:
+            item->Key = ListingAttrSortKey(Attr[i]);
+            break;
+        case lskName:
+            item->Key = 0;
+            break;
+        default: // lskExt: the extension, then the name without the extension (like LessExtName)
+        {
+            ListingNameKey(name + ext, len - ext, &NameKeyRules, &item->Key, 1);
+            if (ext < len) // the name has an extension, the dot before it is not compared
+                len = ext > 0 ? ext - 1 : 0;
+            break;
+        }
+        }
+        ListingNameKey(name, len, &NameKeyRules, item->NameKey, LISTING_NAME_KEY_WORDS);
+        item->Name = name;
+        item->NameLen = NameLen[i];
+        item->ExtOffset = (WORD)ext;
+        item->Index = i;
+    }
+    if (right - left > 1)
+        SortItemsAux(&SortParams, SortItems, left, right - 1);
+}
+
+void CListingColumns::FinishSort()
+{
+    // merging the neighbouring parts in pairs until one part remains
+    CListingSortItem* src = SortItems;
+    CListingSortItem* dst = MergeItems;
+    int starts[LISTING_MAX_SORT_RUNS + 1];
+    int runs = SortRuns;
+    int i;
+    for (i = 0; i <= runs; i++)
+        starts[i] = RunStart[i];
+    while (runs > 1)
+    {
+        int merged = 0;
+        int r;
+        for (r = 0; r < runs; r += 2)
+        {
+            if (r + 1 < runs)
+                MergeItemsAux(&SortParams, src, dst, starts[r], starts[r + 1], starts[r + 2]);
+            else // the last part has no pair
+                memcpy(dst + starts[r], src + starts[r], (starts[r + 1] - starts[r]) * sizeof(CListingSortItem));
+            starts[merged++] = starts[r];
+        }
+        starts[merged] = Count;
+        runs = merged;
+        CListingSortItem* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    for (i = 0; i < Count; i++)
+        Order[i] = src[i].Index;
+    SortRuns = 0;
+}
+
+//
+// ****************************************************************************
+// comparison of names
+//
+
+// compares strings of lengths 'l1' and 'l2' byte by byte (through 'lowerCase' if not NULL)
+static int ListingCmpBytes(const char* s1, int l1, const char* s2, int l2, const unsigned char* lowerCase)
+{
+    int l = l1 < l2 ? l1 : l2;
+    const unsigned char* b1 = (const unsigned char*)s1;
+    const unsigned char* b2 = (const unsigned char*)s2;
+    int res;
+    if (lowerCase != NULL)
+    {
+        while (l--)
+        {
+            res = (int)lowerCase[*b1++] - (int)lowerCase[*b2++];
+            if (res != 0)
+                return res < 0 ? -1 : 1;
+        }
+    }
+    else
+    {
+        while (l--)
+        {
+            res = (int)*b1++ - (int)*b2++;
+            if (res != 0)
+                return res < 0 ? -1 : 1;
+        }
+    }
+    if (l1 != l2)
+        return l1 < l2 ? -1 : 1;
+    return 0;
+}
+
+// compares strings like StrICmpEx ('ignoreCase') or StrCmpEx, with 'LowerCase' NULL like CompareString
+static int ListingCmpText(const char* s1, int l1, const char* s2, int l2, BOOL ignoreCase,
+                          const CListingNameKeyRules* rules)
+{
+#ifdef _WIN32
+    if (rules->LowerCase == NULL)
+        return CompareString(LOCALE_USER_DEFAULT, ignoreCase ? NORM_IGNORECASE : 0, s1, l1, s2, l2) - CSTR_EQUAL;
+#endif // _WIN32
+    return ListingCmpBytes(s1, l1, s2, l2, ignoreCase ? rules->LowerCase : NULL);
+}
+
+// since XP the system has StrCmpLogicalW, Explorer uses it for this comparison
+int ListingStrCmpLogical(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual,
+                         BOOL ignoreCase, const CListingNameKeyRules* rules)
+{
+    const char* strEnd1 = s1 + l1; // end of string 's1'
+    const char* beg1 = s1;         // beginning of the part (text or number)
+    const char* end1 = s1;         // end of the part (text or number)
+    const char* strEnd2 = s2 + l2; // end of string 's2'
+    const char* beg2 = s2;         // beginning of the part (text or number)
+    const char* end2 = s2;         // end of the part (text or number)
+    int suggestion = 0;            // "suggested" result (0 / -1 / 1 = none / s1<s2 / s1>s2) - e.g. "001" < "01"
+    BOOL findDots = rules->Dots;   // TRUE = the names are split also by dots (not only by numbers)
+
+    while (1)
+    {
+        const char* numBeg1 = NULL; // position of the first non-zero digit
+        BOOL isStr1 = (end1 >= strEnd1 || *end1 < '0' || *end1 > '9');
+        if (isStr1) // text (even empty) or dot
+        {
+            if (findDots && end1 < strEnd1 && *end1 == '.')
+                end1++; // dot: if we look for them, we take them one by one
+            else        // text (even empty)
+            {
+                while (end1 < strEnd1 && (*end1 < '0' || *end1 > '9') && (!findDots || *end1 != '.'))
+                    end1++;
+            }
+        }
+        else // number
+        {
+            while (end1 < strEnd1 && *end1 >= '0' && *end1 <= '9')
+            {
+                if (numBeg1 == NULL && *end1 != '0')
+                    numBeg1 = end1;
+                end1++;
+            }
+        }
+        const char* numBeg2 = NULL; // position of the first non-zero digit
+        BOOL isStr2 = (end2 >= strEnd2 || *end2 < '0' || *end2 > '9');
+        if (isStr2) // text (even empty) or dot
+        {
+            if (findDots && end2 < strEnd2 && *end2 == '.')
+                end2++; // dot: if we look for them, we take them one by one
+            else        // text (even empty)
+            {
+                while (end2 < strEnd2 && (*end2 < '0' || *end2 > '9') && (!findDots || *end2 != '.'))
+                    end2++;
+            }
+        }
+        else // number
+        {
+            while (end2 < strEnd2 && *end2 >= '0' && *end2 <= '9')
+            {
+                if (numBeg2 == NULL && *end2 != '0')
+                    numBeg2 = end2;
+                end2++;
+            }
+        }
+
+        if (isStr1 || isStr2) // comparison of texts, dots or a pair of a text, a dot or a number (all except two numbers compare as strings)
+        {
+            int ret = ListingCmpText(beg1, (int)(end1 - beg1), beg2, (int)(end2 - beg2), ignoreCase, rules);
+            if (ret != 0)
+            {
+                if (numericalyEqual != NULL)
+                    *numericalyEqual = FALSE;
+                return ret;
+            }
+        }
+        else // comparison of two numbers
+        {
+            int ret = 0;
+            if (numBeg1 == NULL)
+            {
+                if (numBeg2 != NULL) // the first number is zero, the second one is not
+                    ret = -1;        // "00" < "1"
+            }
+            else
+            {
+                if (numBeg2 == NULL) // the first number is not zero, the second one is
+                    ret = 1;         // "1" > "00"
+                else if (end1 - numBeg1 != end2 - numBeg2)
+                    ret = end1 - numBeg1 > end2 - numBeg2 ? 1 : -1; // "100" > "99"
+                else // the same number of digits, compare the values (the same as comparing the strings)
+                    ret = ListingCmpBytes(numBeg1, (int)(end1 - numBeg1), numBeg2, (int)(end2 - numBeg2), NULL);
+            }
+            if (ret != 0)
+            {
+                if (numericalyEqual != NULL)
+                    *numericalyEqual = FALSE;
+                return ret;
+            }
+            // equal values: if they differ in the number of leading zeros, it goes into the "suggested" result
+            if (suggestion == 0) // only the first "suggestion" matters
+            {
+                if (end1 - beg1 > end2 - beg2)
+                    suggestion = -1; // "0001" < "001"
+                else if (end1 - beg1 < end2 - beg2)
+                    suggestion = 1; // "001" > "0001"
+            }
+        }
+
+        if (end1 >= strEnd1 && end2 >= strEnd2)
+            break; // end of the comparison
+        beg1 = end1;
+        beg2 = end2;
+    }
+
+    if (numericalyEqual != NULL)
+        *numericalyEqual = TRUE; // s1 and s2 are equal or numerically equal
+    return suggestion;           // for equal or numerically equal strings we return the "suggested" result
+}
+
+int ListingStrCmp(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual,
+                  BOOL ignoreCase, const CListingNameKeyRules* rules)
+{
+    if (rules->Numbers)
+        return ListingStrCmpLogical(s1, l1, s2, l2, numericalyEqual, ignoreCase, rules);
+    int ret = ListingCmpText(s1, l1, s2, l2, ignoreCase, rules);
+    if (numericalyEqual != NULL)
+        *numericalyEqual = ret == 0;
+    return ret;
+}
+
+int ListingCmpNames(const char* name1, int len1, const char* name2, int len2, const CListingNameKeyRules* rules)
+{
+    int res = ListingStrCmp(name1, len1, name2, len2, NULL, TRUE, rules);
+    if (res != 0 || name1 == name2)
+        return res; // the same addresses must be equal
+    // equal names (archives or FS) - try whether they differ at least in the case of letters
+    return ListingStrCmp(name1, len1, name2, len2, NULL, FALSE, rules);
+}
+
+int ListingCmpExtName(const char* name1, int len1, const char* ext1, const char* name2, int len2,
+                      const char* ext2, const CListingNameKeyRules* rules)
+{
+    // first by Ext
+    BOOL numericalyEqual1;
+    int res1 = ListingStrCmp(ext1, len1 - (int)(ext1 - name1), ext2, len2 - (int)(ext2 - name2),
+                             &numericalyEqual1, TRUE, rules);
+    if (!numericalyEqual1)
+        return res1; // the extensions differ (they are neither equal nor numerically equal)
+    // equal by Ext, Name decides
+    BOOL numericalyEqual2;
+    int res2 = ListingStrCmp(name1, (*ext1 != 0) ? (int)(ext1 - 1 - name1) : len1,
+                             name2, (*ext2 != 0) ? (int)(ext2 - 1 - name2) : len2,
+                             &numericalyEqual2, TRUE, rules);
+    if (numericalyEqual2 && res1 != 0)
+        return res1; // the names are equal or numerically equal and the extensions only numerically equal (the extensions have priority)
+    if (res2 == 0 && name1 != name2) // equal names (archives or FS) - try whether they differ at least in the case of letters
+    {
+        res1 = ListingStrCmp(ext1, len1 - (int)(ext1 - name1), ext2, len2 - (int)(ext2 - name2),
+                             &numericalyEqual1, FALSE, rules);
+        if (!numericalyEqual1)
+            return res1; // the extensions differ (they are neither equal nor numerically equal)
+        // equal by Ext again, Name decides
+        res2 = ListingStrCmp(name1, (*ext1 != 0) ? (int)(ext1 - 1 - name1) : len1,
+                             name2, (*ext2 != 0) ? (int)(ext2 - 1 - name2) : len2,
+                             &numericalyEqual2, FALSE, rules);
+        if (numericalyEqual2 && res1 != 0)
+            return res1; // the names are equal or numerically equal and the extensions only numerically equal (the extensions have priority)
+    }
+    return res2;
+}
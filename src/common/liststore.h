@@ -0,0 +1,268 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The listing storage uses only Windows types and FILE_ATTRIBUTE_XXX constants, so it can be
+// built outside of Salamander: tools/listbench builds, sorts and releases a synthetic listing
+// of a large directory with it and with one allocation per name.
+
+#define LISTING_MAX_SORT_RUNS 8  // max. number of parts of a listing sorted independently (in parallel)
+#define LISTING_KEY_COMPLETE 1   // flag in the lowest byte of a name key: the key holds the whole name
+#define LISTING_NAME_KEY_WORDS 2 // size of the name key of a sorted item in 64-bit words
+
+#define NAMEARENA_BLOCK_SIZE 65536 // size of one block of CNameArena (a larger name gets its own block)
+
+struct CNameArenaBlock
+{
+    CNameArenaBlock* Next; // next block (the blocks are chained from the oldest one)
+    int Size;              // size of the block (without this header)
+    int Used;              // used bytes of the block
+    // the data of the block follows
+};
+
+//*********************************************************************************
+//
+// CNameArena
+//
+// Names of one panel listing (CFileData::Name and DosName) allocated in large blocks
+// instead of one heap allocation per name. A name cannot be released alone, all of
+// them are released at once by Reset() when the listing is released. The first block
+// is kept for the next listing, so rereading a small directory allocates nothing.
+// The object is not synchronized.
+//
+
+class CNameArena
+{
+protected:
+    CNameArenaBlock* First;   // the oldest block (kept by Reset())
+    CNameArenaBlock* Current; // the block being filled
+    int BlocksCount;          // number of allocated blocks (for statistics)
+
+public:
+    CNameArena()
+    {
+        First = NULL;
+        Current = NULL;
+        BlocksCount = 0;
+    }
+    ~CNameArena() { Release(); }
+
+    // returns 'size' bytes from the arena; returns NULL on low memory
+    char* Alloc(int size)
+    {
+        if (Current != NULL && Current->Size - Current->Used >= size)
+        {
+            char* ret = (char*)(Current + 1) + Current->Used;
+            Current->Used += size;
+            return ret;
+        }
+        return AllocInNewBlock(size);
+    }
+
+    // returns a copy of 'name' of length 'len' (terminated by null); returns NULL on low memory
+    char* AllocName(const char* name, int len)
+    {
+        char* ret = Alloc(len + 1);
+        if (ret != NULL)
+        {
+            memcpy(ret, name, len);
+            ret[len] = 0;
+        }
+        return ret;
+    }
+
+    // releases all names at once; the first block stays allocated for the next listing
+    void Reset();
+
+    // releases all names and all blocks
+    void Release();
+
+    int GetBlocksCount() { return BlocksCount; }
+
+protected:
+    char* AllocInNewBlock(int size);
+};
+
+//*********************************************************************************
+//
+// CListingColumns
+//
+// Sort-relevant fields of a listing (size, time of last write, attributes, offset of
+// the extension in the name) stored in contiguous columns, one item per index. The
+// sort copies the sorted column into small records (key, name key, index) and sorts
+// only them, so it walks small contiguous records instead of whole items of the
+// listing; the items are moved once, after the order is known.
+// The name key is built once per item from the first characters of the name (see
+// CListingNameKeyRules), two items with different name keys are ordered by them
+// without comparing the names; the names are compared only when the name keys are
+// equal. The records can be sorted in up to LISTING_MAX_SORT_RUNS parts independently
+// (by SortRun() called from more threads) and then merged by FinishSort().
+// The columns are refilled before every sort (the fields of the items can change
+// in the meantime, e.g. a calculated size of a directory); the memory stays allocated
+// for the next sort of the same listing. The object is not synchronized.
+//
+
+enum CListingSortKey
+{
+    lskSize, // Size, then name
+    lskTime, // LastWrite, then name
+    lskAttr, // attributes in the order of ListingAttrSortKey(), then name
+    lskName, // name only
+    lskExt,  // extension, then name (the comparison decides how, see CListingItemCompare)
+};
+
+// comparison of the names of two items (CFileData::Name and NameLen), returns -1, 0, 1 like strcmp
+typedef int (*CListingNameCompare)(const char* name1, int len1, const char* name2, int len2);
+
+// comparison of two items whose sort keys and name keys do not decide, gets the names
+// and the offsets of their extensions (CFileData::Ext - CFileData::Name); returns
+// -1, 0, 1 like strcmp
+typedef int (*CListingItemCompare)(const char* name1, int len1, int extOffset1,
+                                   const char* name2, int len2, int extOffset2);
+
+// how the names are compared, the name keys must give the same order:
+// names are compared case-insensitively through table 'LowerCase' (like StrICmpEx),
+// with 'Numbers' the digits in names are compared as numbers (like StrCmpLogicalEx)
+// and with 'Dots' (only with 'Numbers') the dots split the names into parts as well
+struct CListingNameKeyRules
+{
+    const unsigned char* LowerCase; // NULL = the names are compared another way (e.g. by CompareString), no name keys
+    BOOL Numbers;
+    BOOL Dots;
+};
+
+// comparisons of names by 'rules' (the comparisons of the panel, Salamander calls them with the
+// rules of its configuration from StrCmpLogicalEx, RegSetStrICmpEx, RegSetStrCmpEx, CmpNames and
+// CmpExtName in sort.cpp); 'LowerCase' NULL means CompareString with the user locale (only on
+// Windows); all return -1, 0, 1 like strcmp (CompareString also less or greater values)
+
+// compares texts by parts, the numbers by their values (see StrCmpLogicalEx); in 'numericalyEqual'
+// (if not NULL) returns TRUE if the strings are equal or numerically equal (e.g. "a01" and "a1")
+int ListingStrCmpLogical(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual,
+                         BOOL ignoreCase, const CListingNameKeyRules* rules);
+// the same as ListingStrCmpLogical with 'Numbers', otherwise compares the whole strings
+int ListingStrCmp(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual,
+                  BOOL ignoreCase, const CListingNameKeyRules* rules);
+// names of two items: case-insensitively, then case-sensitively (see CmpNames)
+int ListingCmpNames(const char* name1, int len1, const char* name2, int len2, const CListingNameKeyRules* rules);
+// names of two items: the extension first, then the name ('ext1' and 'ext2' are CFileData::Ext, see CmpExtName)
+int ListingCmpExtName(const char* name1, int len1, const char* ext1, const char* name2, int len2,
+                      const char* ext2, const CListingNameKeyRules* rules);
+
+struct CListingSortItem
+{
+    unsigned __int64 Key;                             // value of the sorted column (the extension key for lskExt)
+    unsigned __int64 NameKey[LISTING_NAME_KEY_WORDS]; // name key (of the name without the extension for lskExt)
+    const char* Name;                                 // name of the item (compared only if the keys are equal)
+    WORD NameLen;
+    WORD ExtOffset;
+    int Index; // index of the item
+};
+
+struct CListingSortParams
+{
+    BOOL KeyReverse;
+    BOOL NameReverse;
+    BOOL ExtKeys; // lskExt: the name keys decide only after equal and complete extension keys
+    CListingItemCompare Cmp;
+};
+
+class CListingColumns
+{
+public:
+    unsigned __int64* Size;
+    unsigned __int64* LastWrite; // FILETIME as a number (compares the same way as CompareFileTime)
+    DWORD* Attr;
+    WORD* ExtOffset; // offset of the extension in the name (CFileData::Ext - CFileData::Name)
+    const char** Name;
+    WORD* NameLen;
+    int* Order;      // only for Sort(): indexes of the items in the sorted order
+    int Count;
+
+protected:
+    int Capacity;
+    CListingSortItem* SortItems;             // only for Sort(): the records being sorted
+    CListingSortItem* MergeItems;            // only for Sort(): target of merging the sorted parts (NULL = not allocated yet)
+    int MergeCapacity;                       // number of records in MergeItems
+    CListingSortKey SortKey;                 // only for Sort(): the sorted column
+    CListingNameKeyRules NameKeyRules;       // only for Sort(): rules of building the name keys
+    CListingSortParams SortParams;           // only for Sort(): how the records are compared
+    int SortRuns;                            // only for Sort(): number of the independently sorted parts
+    int RunStart[LISTING_MAX_SORT_RUNS + 1]; // only for Sort(): the first record of every part (plus the end)
+
+public:
+    CListingColumns();
+    ~CListingColumns() { Release(); }
+
+    // prepares the columns for 'count' items (the values are not initialized); returns
+    // FALSE on low memory
+    BOOL SetCount(int count);
+
+    void Set(int index, const char* name, int nameLen, unsigned __int64 size, DWORD lastWriteLow,
+             DWORD lastWriteHigh, DWORD attr, int extOffset)
+    {
+        Name[index] = name;
+        NameLen[index] = (WORD)nameLen;
+        Size[index] = size;
+        LastWrite[index] = ((unsigned __int64)lastWriteHigh << 32) | lastWriteLow;
+        Attr[index] = attr;
+        ExtOffset[index] = (WORD)extOffset;
+    }
+
+    // fills Order with the indexes of the items sorted by column 'key' (descending with
+    // 'keyReverse'), items with the same key are sorted by their names (descending with
+    // 'nameReverse'): by the name keys built by 'rules' and by 'cmp' when the name keys
+    // are equal; for lskExt 'keyReverse' and 'nameReverse' must be equal
+    void Sort(CListingSortKey key, BOOL keyReverse, BOOL nameReverse, CListingItemCompare cmp,
+              const CListingNameKeyRules* rules)
+    {
+        PrepareSort(key, keyReverse, nameReverse, cmp, rules, 1);
+        SortRun(0);
+        FinishSort();
+    }
+
+    // the same as Sort() in steps: PrepareSort() builds the records and the keys and
+    // splits them into 'runs' parts (less on low memory or for a small listing), returns
+    // the number of the parts; SortRun() sorts one part, the parts can be sorted from
+    // different threads at once; FinishSort() merges the sorted parts and fills Order
+    int PrepareSort(CListingSortKey key, BOOL keyReverse, BOOL nameReverse, CListingItemCompare cmp,
+                    const CListingNameKeyRules* rules, int runs);
+    void SortRun(int run);
+    void FinishSort();
+
+    // releases the memory of the columns
+    void Release();
+
+    // attributes in the order used for sorting by attributes: alphabetically by their
+    // letters in the panel (like Explorer), only the displayed attributes count
+    static DWORD ListingAttrSortKey(DWORD attr)
+    {
+        DWORD key = 0;
+        if (attr & FILE_ATTRIBUTE_ARCHIVE)
+            key |= 0x00000001;
+        if (attr & FILE_ATTRIBUTE_COMPRESSED)
+            key |= 0x00000002;
+        if (attr & FILE_ATTRIBUTE_ENCRYPTED)
+            key |= 0x00000004;
+        if (attr & FILE_ATTRIBUTE_HIDDEN)
+            key |= 0x00000008;
+        if (attr & FILE_ATTRIBUTE_READONLY)
+            key |= 0x00000010;
+        if (attr & FILE_ATTRIBUTE_SYSTEM)
+            key |= 0x00000020;
+        if (attr & FILE_ATTRIBUTE_TEMPORARY)
+            key |= 0x00000040;
+        return key;
+    }
+
+    // builds the name key of 'name' of length 'len' into 'key' ('words' 64-bit words compared
+    // from the first one, max. LISTING_NAME_KEY_WORDS): if the keys of two names differ, the
+    // names compare the same way as the keys (by the rules 'rules'); if they are equal, the
+    // names must be compared; with LISTING_KEY_COMPLETE the key holds the whole name (two
+    // such equal keys mean names equal case-insensitively or, with 'Numbers', numerically
+    // equal like "a01" and "a1")
+    static void ListingNameKey(const char* name, int len, const CListingNameKeyRules* rules,
+                               unsigned __int64* key, int words);
+};
@@ -0,0 +1,409 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define LITSRCH_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "litsrch.h"
+
+#ifdef LITSRCH_SSE2
+
+// returns the index of the lowest set bit of 'mask' (must not be zero)
+inline int LowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanForward(&bit, mask);
+    return (int)bit;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+#endif // LITSRCH_SSE2
+
+BOOL IsSSE2Present()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return TRUE; // part of the x64 architecture
+#elif defined(LITSRCH_SSE2) && defined(_WIN32)
+    static int present = -1; // -1 = not tested yet
+    if (present == -1)
+        present = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1 : 0;
+    return present == 1;
+#elif defined(LITSRCH_SSE2) && defined(__SSE2__)
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+BOOL GetLiteralMatchingBytes(BYTE c, const BYTE* lowerCase, BYTE* bytes)
+{
+    if (lowerCase == NULL)
+    {
+        bytes[0] = bytes[1] = c;
+        return TRUE;
+    }
+    int count = 0;
+    int i;
+    for (i = 0; i < 256; i++)
+    {
+        if (lowerCase[i] == c)
+        {
+            if (count == 2)
+                return FALSE;
+            bytes[count++] = (BYTE)i;
+        }
+    }
+    if (count == 0) // 'c' is not a lower case form of any byte; rare, Boyer-Moore will handle it
+        return FALSE;
+    if (count == 1)
+        bytes[1] = bytes[0];
+    return TRUE;
+}
+
+int LiteralSearchSSE2(const char* text, int length, int start, const char* pattern, int patternLen,
+                      const BYTE* lowerCase, const BYTE* firstBytes, const BYTE* lastBytes)
+{
+    const BYTE* t = (const BYTE*)text;
+    const BYTE* p = (const BYTE*)pattern;
+    int last = length - patternLen; // last position where the pattern can start
+    int l1 = patternLen - 1;
+    int i = start;
+
+#ifdef LITSRCH_SSE2
+    const __m128i first0 = _mm_set1_epi8((char)firstBytes[0]);
+    const __m128i first1 = _mm_set1_epi8((char)firstBytes[1]);
+    const __m128i last0 = _mm_set1_epi8((char)lastBytes[0]);
+    const __m128i last1 = _mm_set1_epi8((char)lastBytes[1]);
+    while (i + 15 <= last) // both 16-byte loads are within the text
+    {
+        __m128i f = _mm_loadu_si128((const __m128i*)(t + i));
+        __m128i l = _mm_loadu_si128((const __m128i*)(t + i + l1));
+        __m128i eq = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(f, first0), _mm_cmpeq_epi8(f, first1)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(l, last0), _mm_cmpeq_epi8(l, last1)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        while (mask != 0)
+        {
+            int bit = LowestBit(mask);
+            const BYTE* s = t + i + bit;
+            int j = 1;
+            if (lowerCase == NULL)
+            {
+                while (j < l1 && s[j] == p[j])
+                    j++;
+            }
+            else
+            {
+                while (j < l1 && lowerCase[s[j]] == p[j])
+                    j++;
+            }
+            if (j >= l1)
+                return i + bit;
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#endif // LITSRCH_SSE2
+
+    // the rest (less than 16 positions) byte by byte
+    for (; i <= last; i++)
+    {
+        BYTE c = t[i];
+        BYTE e = t[i + l1];
+        if ((c == firstBytes[0] || c == firstBytes[1]) && (e == lastBytes[0] || e == lastBytes[1]))
+        {
+            int j = 1;
+            if (lowerCase == NULL)
+            {
+                while (j < l1 && t[i + j] == p[j])
+                    j++;
+            }
+            else
+            {
+                while (j < l1 && lowerCase[t[i + j]] == p[j])
+                    j++;
+            }
+            if (j >= l1)
+                return i;
+        }
+    }
+    return -1;
+}
+
+//
+// ****************************************************************************
+// CMultiLiteralSearch
+//
+
+CMultiLiteralSearch::CMultiLiteralSearch()
+{
+    Count = 0;
+    MinLength = 0;
+    MaxLength = 0;
+    LowerCase = NULL;
+    Shift = NULL;
+    Buckets = NULL;
+    FirstBytesCount = 0;
+    Prepared = FALSE;
+}
+
+CMultiLiteralSearch::~CMultiLiteralSearch()
+{
+    Clear();
+    if (Shift != NULL)
+        free(Shift);
+    if (Buckets != NULL)
+        free(Buckets);
+}
+
+void CMultiLiteralSearch::Clear()
+{
+    int i;
+    for (i = 0; i < Count; i++)
+        free(Patterns[i]);
+    Count = 0;
+    MinLength = 0;
+    MaxLength = 0;
+    Prepared = FALSE;
+}
+
+BOOL CMultiLiteralSearch::Add(const char* pattern, int length)
+{
+    if (length <= 0 || Count >= MULTISEARCH_MAX_PATTERNS)
+        return FALSE;
+    char* copy = (char*)malloc(length + 1);
+    if (copy == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    memcpy(copy, pattern, length);
+    copy[length] = 0; // for compatibility with ordinary strings
+    Patterns[Count] = copy;
+    Lengths[Count] = length;
+    Count++;
+    if (MinLength == 0 || length < MinLength)
+        MinLength = length;
+    if (length > MaxLength)
+        MaxLength = length;
+    Prepared = FALSE;
+    return TRUE;
+}
+
+BOOL CMultiLiteralSearch::Prepare(const BYTE* lowerCase)
+{
+    Prepared = FALSE;
+    if (Count == 0)
+        return FALSE;
+    LowerCase = lowerCase;
+    int i;
+    if (LowerCase != NULL)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            BYTE* p = (BYTE*)Patterns[i];
+            int j;
+            for (j = 0; j < Lengths[i]; j++)
+                p[j] = LowerCase[p[j]];
+        }
+    }
+
+    FirstBytesCount = 0;
+    if (MinLength == 1) // every position is tested, the patterns are divided by their first byte
+    {
+        memset(FirstBucket, -1, sizeof(FirstBucket));
+        for (i = Count - 1; i >= 0; i--) // going from the end, the buckets are in the order of adding
+        {
+            BYTE c = (BYTE)Patterns[i][0];
+            NextInBucket[i] = FirstBucket[c];
+            FirstBucket[c] = i;
+        }
+        // bytes of the text starting some pattern; SSE2 is used only if there are few of them
+        if (IsSSE2Present())
+        {
+            int c;
+            for (c = 0; c < 256; c++)
+            {
+                if (FirstBucket[LowerCase != NULL ? LowerCase[c] : c] != -1)
+                {
+                    if (FirstBytesCount == MULTISEARCH_MAX_SSE2_FIRST_BYTES)
+                    {
+                        FirstBytesCount = 0;
+                        break;
+                    }
+                    FirstBytes[FirstBytesCount++] = (BYTE)c;
+                }
+            }
+        }
+        Prepared = TRUE;
+        return TRUE;
+    }
+
+    if (Shift == NULL)
+        Shift = (BYTE*)malloc(65536);
+    if (Buckets == NULL)
+        Buckets = (signed char*)malloc(65536);
+    if (Shift == NULL || Buckets == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    // the window has the length of the shortest pattern (the shift must fit in a byte)
+    int window = MinLength < 256 ? MinLength : 256;
+    memset(Shift, window - 1, 65536);
+    memset(Buckets, -1, 65536);
+    for (i = Count - 1; i >= 0; i--) // going from the end, the buckets are in the order of adding
+    {
+        const BYTE* p = (const BYTE*)Patterns[i];
+        int q;
+        for (q = 1; q < window; q++) // q = index of the second byte of the pair in the beginning of the pattern
+        {
+            int block = p[q - 1] + 256 * p[q];
+            if (Shift[block] > window - 1 - q)
+                Shift[block] = (BYTE)(window - 1 - q);
+        }
+        int last = p[window - 2] + 256 * p[window - 1];
+        NextInBucket[i] = Buckets[last];
+        Buckets[last] = (signed char)i;
+    }
+    Prepared = TRUE;
+    return TRUE;
+}
+
+int CMultiLiteralSearch::Verify(const BYTE* text, int length, int i, int first) const
+{
+    int p;
+    for (p = first; p != -1; p = NextInBucket[p])
+    {
+        int len = Lengths[p];
+        if (i + len > length)
+            continue;
+        const BYTE* pattern = (const BYTE*)Patterns[p];
+        int j = 0;
+        if (LowerCase == NULL)
+        {
+            while (j < len && text[i + j] == pattern[j])
+                j++;
+        }
+        else
+        {
+            while (j < len && LowerCase[text[i + j]] == pattern[j])
+                j++;
+        }
+        if (j == len)
+            return p;
+    }
+    return -1;
+}
+
+int CMultiLiteralSearch::SearchForwardBytes(const BYTE* text, int length, int start, int* index) const
+{
+    int i = start;
+    int found;
+
+#ifdef LITSRCH_SSE2
+    if (FirstBytesCount > 0)
+    {
+        __m128i first[MULTISEARCH_MAX_SSE2_FIRST_BYTES];
+        int k;
+        for (k = 0; k < FirstBytesCount; k++)
+            first[k] = _mm_set1_epi8((char)FirstBytes[k]);
+        while (i + 16 <= length)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+            __m128i eq = _mm_cmpeq_epi8(v, first[0]);
+            for (k = 1; k < FirstBytesCount; k++)
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, first[k]));
+            unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+            while (mask != 0)
+            {
+                int pos = i + LowestBit(mask);
+                BYTE c = LowerCase != NULL ? LowerCase[text[pos]] : text[pos];
+                if ((found = Verify(text, length, pos, FirstBucket[c])) != -1)
+                {
+                    if (index != NULL)
+                        *index = found;
+                    return pos;
+                }
+                mask &= mask - 1;
+            }
+            i += 16;
+        }
+    }
+#endif // LITSRCH_SSE2
+
+    for (; i < length; i++)
+    {
+        BYTE c = LowerCase != NULL ? LowerCase[text[i]] : text[i];
+        if (FirstBucket[c] != -1 && (found = Verify(text, length, i, FirstBucket[c])) != -1)
+        {
+            if (index != NULL)
+                *index = found;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int CMultiLiteralSearch::SearchForward(const char* text, int length, int start, int* index) const
+{
+    if (!Prepared)
+        return -1;
+    const BYTE* t = (const BYTE*)text;
+    if (MinLength == 1)
+        return SearchForwardBytes(t, length, start, index);
+
+    int window = MinLength < 256 ? MinLength : 256;
+    int e = start + window - 1; // last byte of the window
+    if (LowerCase == NULL)
+    {
+        while (e < length)
+        {
+            int block = t[e - 1] + 256 * t[e];
+            int shift = Shift[block];
+            if (shift == 0)
+            {
+                int found = Verify(t, length, e - window + 1, Buckets[block]);
+                if (found != -1)
+                {
+                    if (index != NULL)
+                        *index = found;
+                    return e - window + 1;
+                }
+                shift = 1;
+            }
+            e += shift;
+        }
+    }
+    else
+    {
+        while (e < length)
+        {
+            int block = LowerCase[t[e - 1]] + 256 * LowerCase[t[e]];
+            int shift = Shift[block];
+            if (shift == 0)
+            {
+                int found = Verify(t, length, e - window + 1, Buckets[block]);
+                if (found != -1)
+                {
+                    if (index != NULL)
+                        *index = found;
+                    return e - window + 1;
+                }
+                shift = 1;
+            }
+            e += shift;
+        }
+    }
+    return -1;
+}
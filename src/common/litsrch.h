@@ -0,0 +1,95 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The vectorized literal search uses only Windows types, so it can be built outside of
+// Salamander: tools/searchbench measures it on large text and binary data (also on Linux).
+// 'lowerCase' is the table mapping the bytes of the text to the form of the pattern for
+// the case-insensitive search (LowerCase from str.h in Salamander), NULL = case-sensitive.
+
+#define MULTISEARCH_MAX_PATTERNS 64        // max. number of patterns searched in one pass
+#define MULTISEARCH_MAX_SSE2_FIRST_BYTES 4 // max. number of first bytes compared 16 positions at once
+
+// returns TRUE if the processor supports SSE2 (always on x64)
+BOOL IsSSE2Present();
+
+// fills 'bytes' with the bytes of the text matching the pattern byte 'c' (both cases of
+// a letter); returns FALSE if there are more than two of them or none
+BOOL GetLiteralMatchingBytes(BYTE c, const BYTE* lowerCase, BYTE* bytes);
+
+// returns the position of the first occurrence of 'pattern' ('patternLen' bytes, already in
+// the form given by 'lowerCase') at 'start' or later in 'text' ('length' bytes) or -1; the first
+// and the last byte of the pattern are compared at 16 positions at once (the text bytes matching
+// them are in 'firstBytes' and 'lastBytes', see GetLiteralMatchingBytes), only these candidates
+// are verified; must be called only if IsSSE2Present() returns TRUE
+int LiteralSearchSSE2(const char* text, int length, int start, const char* pattern, int patternLen,
+                      const BYTE* lowerCase, const BYTE* firstBytes, const BYTE* lastBytes);
+
+//*********************************************************************************
+//
+// CMultiLiteralSearch
+//
+// Searches for several patterns in one pass over the text (Wu-Manber): a window of
+// the length of the shortest pattern moves over the text and its last two bytes
+// say how far it can move without skipping an occurrence (the tables are built from
+// the beginnings of the patterns); when it cannot move, only the patterns whose
+// beginning ends with these two bytes are verified. If the shortest pattern has one
+// byte, every position is tested; if the patterns start with at most
+// MULTISEARCH_MAX_SSE2_FIRST_BYTES different bytes of the text, the first bytes are
+// compared at 16 positions at once then. Find uses it to skip the lines without any
+// literal when the regular expression is their alternation ("a|b|c", see
+// CRegularExpression::HasRequiredLiterals).
+//
+
+class CMultiLiteralSearch
+{
+protected:
+    char* Patterns[MULTISEARCH_MAX_PATTERNS]; // patterns in the form given by LowerCase (allocated)
+    int Lengths[MULTISEARCH_MAX_PATTERNS];
+    int NextInBucket[MULTISEARCH_MAX_PATTERNS]; // next pattern in the same bucket (-1 = none)
+    int Count;
+    int MinLength;
+    int MaxLength;
+
+    const BYTE* LowerCase; // see the comment at the top of the file
+    BYTE* Shift;           // 65536 shifts of the window by its last two bytes (first + 256 * second)
+    signed char* Buckets;  // 65536 first patterns whose beginning ends with the two bytes (-1 = none)
+    int FirstBucket[256];  // the first pattern starting with the byte (-1 = none); only if MinLength is 1
+    BYTE FirstBytes[MULTISEARCH_MAX_SSE2_FIRST_BYTES]; // bytes of the text starting some pattern (for SSE2)
+    int FirstBytesCount;                               // 0 = SSE2 is not used
+    BOOL Prepared;
+
+public:
+    CMultiLiteralSearch();
+    ~CMultiLiteralSearch();
+
+    // adds 'pattern' of 'length' bytes; returns FALSE on low memory, for an empty pattern and
+    // if MULTISEARCH_MAX_PATTERNS patterns have been added already
+    BOOL Add(const char* pattern, int length);
+
+    // removes all patterns
+    void Clear();
+
+    // prepares the search after all patterns have been added (the patterns are converted to
+    // the form given by 'lowerCase', so it is called once, Clear() starts over); 'lowerCase' is
+    // described at the top of the file; returns FALSE if there are no patterns or on low memory
+    BOOL Prepare(const BYTE* lowerCase);
+
+    int GetCount() const { return Count; }
+    int GetMaxLength() const { return MaxLength; } // a caller searching in slices overlaps them by this - 1 bytes
+
+    // returns the position of the first occurrence of any pattern at 'start' or later in 'text'
+    // ('length' bytes) or -1; in 'index' (if not NULL) returns the index of the found pattern (the
+    // first added one of those found at the position)
+    int SearchForward(const char* text, int length, int start, int* index) const;
+
+protected:
+    // verifies the patterns of the bucket starting with pattern 'first' at position 'i' of the
+    // text; returns the index of the first added one found there or -1
+    int Verify(const BYTE* text, int length, int i, int first) const;
+
+    // SearchForward for MinLength 1
+    int SearchForwardBytes(const BYTE* text, int length, int start, int* index) const;
+};
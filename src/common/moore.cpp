@@ -21,6 +21,7 @@
 
 #include "str.h"
 #include "moore.h"
+#include "litsrch.h"
 
 //
 // ****************************************************************************
@@ -30,6 +31,7 @@
 
 BOOL CSearchData::Initialize()
 {
+    UseSSE2 = FALSE;
     if (Pattern == NULL || Length == 0)
     {
         TRACE_E("Empty search pattern.");
@@ -111,12 +113,40 @@ BOOL CSearchData::Initialize()
 
     delete[] (f);
 
+    PrepareSSE2();
     return TRUE;
 }
 
+//
+// ****************************************************************************
+// PrepareSSE2
+//
+
+void CSearchData::PrepareSSE2()
+{
+    BOOL caseSensitive = (Flags & sfCaseSensitive) != 0;
+    UseSSE2 = (Flags & sfForward) != 0 && IsSSE2Present() &&
+              GetLiteralMatchingBytes(Pattern[0], caseSensitive ? NULL : LowerCase, FirstBytes) &&
+              GetLiteralMatchingBytes(Pattern[Length - 1], caseSensitive ? NULL : LowerCase, LastBytes);
+}
+
+//
+// ****************************************************************************
+// SearchForwardSSE2
+// same as SearchForward
+//
+
+int CSearchData::SearchForwardSSE2(const char* text, int length, int start)
+{
+    BOOL caseSensitive = (Flags & sfCaseSensitive) != 0;
+    return LiteralSearchSSE2(text, length, start, Pattern, Length, caseSensitive ? NULL : LowerCase,
+                             FirstBytes, LastBytes);
+}
+
 void CSearchData::SetFlags(WORD flags)
 {
     Flags = flags;
+    UseSSE2 = FALSE;
     if (Pattern == NULL)
         Pattern = (char*)malloc(Length + 1);
     if (Pattern == NULL)
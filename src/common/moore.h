@@ -23,6 +23,7 @@ public:
         Length = 0;
         Pattern = NULL;
         Flags = 0;
+        UseSSE2 = FALSE;
     }
 
     ~CSearchData()
@@ -43,6 +44,7 @@ public:
 
     int GetLength() const { return Length; }
     const char* GetPattern() const { return OriginalPattern; }
+    WORD GetFlags() const { return Flags; }
 
     BOOL IsGood() const { return OriginalPattern != NULL &&
                                  Pattern != NULL &&
@@ -60,6 +62,18 @@ protected:
     int Minimum(int a, int b) { return (a < b) ? a : b; }
     int Maximum(int a, int b) { return (a > b) ? a : b; }
 
+    // vectorized forward search: candidates are positions where the first and the last
+    // character of the pattern match (compared 16 positions at once), only those are
+    // verified; used when each of the two characters has at most two forms in the text
+    // (both cases of a letter), otherwise Boyer-Moore is used (see LiteralSearchSSE2 in litsrch.h,
+    // CMultiLiteralSearch there searches for several patterns in one pass)
+    BOOL UseSSE2;
+    BYTE FirstBytes[2]; // bytes of the text matching the first character of the pattern
+    BYTE LastBytes[2];  // bytes of the text matching the last character of the pattern
+
+    void PrepareSSE2(); // sets UseSSE2, FirstBytes and LastBytes; called from Initialize
+    int SearchForwardSSE2(const char* text, int length, int start);
+
     int* Fail1;            // fail pole pro akt. pismeno
     int* Fail2;            // fail pole pro vyskyt substringu zprava
     char* OriginalPattern; // puvodni vzorek ke hledani
@@ -83,6 +97,9 @@ private:
 
 int CSearchData::SearchForward(const char* text, int length, int start)
 {
+    if (UseSSE2)
+        return SearchForwardSSE2(text, length, start);
+
     int l1 = Length - 1;
     int i, j = l1 + start;
     if (Flags & sfCaseSensitive)
@@ -31,6 +31,7 @@
 #include <crtdbg.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <ostream>
 
 #if defined(_DEBUG) && defined(_MSC_VER) // without passing file+line to 'new' operator, list of memory leaks shows only 'crtdbg.h(552)'
@@ -41,6 +42,8 @@
 
 //#include "trace.h" aby to slo pripojit i k pluginum, stejne tu zatim zadny TRACE neni
 #include "str.h"
+#include "moore.h"
+#include "litsrch.h"
 #include "regexp.h"
 
 //*****************************************************************************
@@ -156,6 +159,13 @@ BOOL CRegularExpression::SetFlags(WORD flags)
 
     if (Expression != NULL)
         free(Expression);
+    if (VM != NULL) // allocated for the size of the previous expression
+    {
+        regvmfree(VM);
+        VM = NULL;
+    }
+    UseRequiredLiteral = FALSE;
+    UseRequiredAlternatives = FALSE;
     Expression = regcomp(pattern, LastErrorText);
 
     if (Expression != NULL && (Flags & sfForward) == 0)
@@ -177,6 +187,15 @@ BOOL CRegularExpression::SetFlags(WORD flags)
             LastError = LastErrorText = RegExpErrorText(reeLowMemory);
     }
 
+    if (Expression != NULL && (Flags & sfForward) && Expression->regmust != NULL &&
+        strpbrk(Expression->regmust, "\r\n") == NULL) // callers split the text into lines on these
+    {
+        RequiredLiteral.Set(Expression->regmust, Expression->regmlen, (WORD)(sfForward | (Flags & sfCaseSensitive)));
+        UseRequiredLiteral = RequiredLiteral.IsGood();
+    }
+    if (Expression != NULL && (Flags & sfForward) && !UseRequiredLiteral)
+        UseRequiredAlternatives = PrepareRequiredAlternatives(pattern);
+
     if ((Flags & sfCaseSensitive) == 0)
         free(pattern);
     return Expression != NULL && LastErrorText == NULL;
@@ -239,7 +258,7 @@ BOOL CRegularExpression::SetLine(const char* start, const char* end)
 
 int CRegularExpression::SearchForward(int start, int& foundLen)
 {
-    if (start <= LineLength && regexec(Expression, Line, start) == 1)
+    if (start <= LineLength && regexec(Expression, Line, start, &VM) == 1)
     {
         foundLen = (int)(Expression->endp[0] - Expression->startp[0]);
         return (int)(Expression->startp[0] - Line);
@@ -248,9 +267,16 @@ int CRegularExpression::SearchForward(int start, int& foundLen)
         return -1;
 }
 
+int CRegularExpression::FindRequiredLiteral(const char* text, int length)
+{
+    if (UseRequiredLiteral)
+        return RequiredLiteral.SearchForward(text, length, 0);
+    return RequiredAlternatives.SearchForward(text, length, 0, NULL);
+}
+
 int CRegularExpression::SearchBackward(int length, int& foundLen)
 {
-    if (length >= 0 && regexec(Expression, Line, LineLength - length) == 1)
+    if (length >= 0 && regexec(Expression, Line, LineLength - length, &VM) == 1)
     {
         foundLen = (int)(Expression->endp[0] - Expression->startp[0]);
         return (int)(LineLength - (Expression->endp[0] - Line));
@@ -307,7 +333,7 @@ int CRegularExpression::ReplaceForward(int start, char* pattern, BOOL global,
     BOOL ret = FALSE;
     char* output = buffer;
     int len;
-    while (start <= LineLength && regexec(Expression, Line, start) == 1 &&
+    while (start <= LineLength && regexec(Expression, Line, start, &VM) == 1 &&
            Expression->endp[0] - Expression->startp[0] > 0 /*zero sized match neberem*/)
     {
         //zkopirujeme nezmeny text, ktery predchazi match
@@ -507,12 +533,10 @@ void CRegularExpression::ReverseRegExp(char*& dstExpEnd, char* srcExp, char* src
  *
  * Regstart and reganch permit very fast decisions on suitable starting points
  * for a match, cutting down the work a lot.  Regmust permits fast rejection
- * of lines that cannot possibly match.  The regmust tests are costly enough
- * that regcomp() supplies a regmust only if the r.e. contains something
- * potentially expensive (at present, the only such thing detected is * or +
- * at the start of the r.e., which can involve a lot of backup).  Regmlen is
- * supplied because the test in regexec() needs it and regcomp() is computing
- * it anyway.
+ * of lines that cannot possibly match (and whole blocks of text, see
+ * CRegularExpression::FindRequiredLiteral).  Regmlen is supplied because the
+ * test in regexec() needs it and regcomp() is computing it anyway.
+ * Regsize is the size of the program (regexec allocates its work memory by it).
  */
 
 /*
@@ -711,6 +735,7 @@ regexp* regcomp(char* exp, const char*& lastErrorText)
     r->reganch = 0;
     r->regmust = NULL;
     r->regmlen = 0;
+    r->regsize = (int)regsize;
     scan = r->program + 1; /* First BRANCH. */
     if (OP(regnext(scan)) == END)
     { /* Only one top-level choice. */
@@ -723,14 +748,14 @@ regexp* regcomp(char* exp, const char*& lastErrorText)
             r->reganch++;
 
         /*
-     * If there's something expensive in the r.e., find the
-     * longest literal string that must appear and make it the
-     * regmust.  Resolve ties in favor of later strings, since
+     * Find the longest literal string that must appear and make
+     * it the regmust.  Resolve ties in favor of later strings, since
      * the regstart check works with the beginning of the r.e.
      * and avoiding duplication strengthens checking.  Not a
      * strong reason, but sufficient in the absence of others.
+     * (Originally only done for r.e. starting with * or +, now the
+     * callers use regmust to skip whole blocks of text.)
      */
-        if (flags & SPSTART)
         {
             longest = NULL;
             len = 0;
@@ -1157,371 +1182,379 @@ void regoptail(char* p, char* val)
 
 /*
  * regexec and friends
+ *
+ * regexec is not the original backtracking matcher (which needs exponential
+ * time for some expressions), it simulates the program as a nondeterministic
+ * automaton (Pike VM): all possible threads of the match advance together by
+ * one character of the string, so the time is linear in the length of the
+ * string.  Every state (node, or a character of an EXACTLY operand) is held by
+ * at most one thread per position.  The threads are kept in the order in which
+ * the backtracking matcher would try them, and the first thread which reaches
+ * END cuts off all threads behind it, so the result (the match and the
+ * subexpressions) is the same as the original one: the leftmost match,
+ * alternatives preferred from the first one, STAR and PLUS greedy.
  */
 
-/*
- * Global work variables for regexec().
- */
-char* reginput;   /* String-input pointer. */
-char* regbol;     /* Beginning of input, for ^ check. */
-char** regstartp; /* Pointer to startp array. */
-char** regendp;   /* Ditto for endp. */
-
-/*
- * Forwards.
- */
-int regtry(regexp* prog, char* string);
-int regmatch(char* prog);
-int regrepeat(char* p);
+typedef struct regthread
+{
+    char* pc;   /* Node to match (ANY, ANYOF, ANYBUT, EXACTLY or END). */
+    char* str;  /* EXACTLY: next character of the operand to match. */
+    char* loop; /* STAR or PLUS node if pc is its operand, else NULL. */
+} regthread;
 
-/*
- - regexec - match a regexp against a string
- */
-int regexec(regexp* prog, char* string, int offset)
+struct regvm
 {
-    __RegExpSection.Enter();
-    char* s;
+    int size;               /* Size of the program (= number of states). */
+    int* mark;              /* mark[state] == gen: state is in the list being built. */
+    int gen;                /* Generation of the list being built. */
+    regthread* threads[2];  /* Lists of threads (for the current and the next position). */
+    char** caps[2];         /* Subexpressions of the threads, 2 * NSUBEXP per thread. */
+    int count[2];           /* Number of threads in the lists. */
+    char* bol;              /* Beginning of input, for ^ check. */
+};
 
-    /* Check validity of program. */
-    if (UCHARAT(prog->program) != MAGIC)
-    {
-        __RegExpSection.Leave();
-        return (0);
-    }
+void regvmfree(regvm* vm)
+{
+    if (vm == NULL)
+        return;
+    free(vm->mark);
+    free(vm->threads[0]);
+    free(vm->threads[1]);
+    free(vm->caps[0]);
+    free(vm->caps[1]);
+    free(vm);
+}
 
-    /* If there is a "must appear" string, look for it. */
-    if (prog->regmust != NULL)
+regvm* regvmalloc(int size)
+{
+    regvm* vm = (regvm*)malloc(sizeof(regvm));
+    if (vm == NULL)
+        return (NULL);
+    vm->size = size;
+    vm->mark = (int*)calloc(size, sizeof(int));
+    vm->gen = 0;
+    vm->threads[0] = (regthread*)malloc(size * sizeof(regthread));
+    vm->threads[1] = (regthread*)malloc(size * sizeof(regthread));
+    vm->caps[0] = (char**)malloc(size * 2 * NSUBEXP * sizeof(char*));
+    vm->caps[1] = (char**)malloc(size * 2 * NSUBEXP * sizeof(char*));
+    vm->count[0] = vm->count[1] = 0;
+    vm->bol = NULL;
+    if (vm->mark == NULL || vm->threads[0] == NULL || vm->threads[1] == NULL ||
+        vm->caps[0] == NULL || vm->caps[1] == NULL)
     {
-        s = string + offset;
-        while ((s = strchr(s, prog->regmust[0])) != NULL)
-        {
-            if (strncmp(s, prog->regmust, prog->regmlen) == 0)
-                break; /* Found it. */
-            s++;
-        }
-        if (s == NULL) /* Not present. */
-        {
-            __RegExpSection.Leave();
-            return (0);
-        }
+        regvmfree(vm);
+        return (NULL);
     }
+    return (vm);
+}
 
-    /* Mark beginning of line for ^ . */
-    regbol = string;
-
-    /* Simplest case:  anchored match need be tried only once. */
-    if (prog->reganch)
+/*
+ - regnewlist - start building list l
+ */
+void regnewlist(regvm* vm, int l)
+{
+    vm->count[l] = 0;
+    if (++vm->gen == INT_MAX) /* Marks would overflow, start again. */
     {
-        if (regtry(prog, string + offset))
-        {
-            __RegExpSection.Leave();
-            return (1);
-        }
-        else
-        {
-            __RegExpSection.Leave();
-            return (0);
-        }
+        memset(vm->mark, 0, vm->size * sizeof(int));
+        vm->gen = 1;
     }
+}
 
-    /* Messy cases:  unanchored match. */
-    s = string + offset;
-    if (prog->regstart != '\0')
-        /* We know what char it must start with. */
-        while ((s = strchr(s, prog->regstart)) != NULL)
-        {
-            if (regtry(prog, s))
-            {
-                __RegExpSection.Leave();
-                return (1);
-            }
-            s++;
-        }
-    else
-        /* We don't -- general case. */
-        do
-        {
-            if (regtry(prog, s))
-            {
-                __RegExpSection.Leave();
-                return (1);
-            }
-        } while (*s++ != '\0');
-
-    /* Failure. */
-    __RegExpSection.Leave();
-    return (0);
+/*
+ - regvisit - mark state p of program prog; returns 0 if it already was in the list
+ */
+int regvisit(regvm* vm, regexp* prog, char* p)
+{
+    int state = (int)(p - prog->program);
+    if (vm->mark[state] == vm->gen)
+        return (0);
+    vm->mark[state] = vm->gen;
+    return (1);
 }
 
 /*
- - regtry - try match at specific point
+ - regthreadadd - append a thread waiting for a character to list l; state is
+ * the state of the thread, NULL if the caller has already marked it
  */
-int regtry(regexp* prog, char* string) /* 0 failure, 1 success */
+void regthreadadd(regvm* vm, regexp* prog, int l, char* state, char* pc, char* str, char* loop, char** caps)
 {
-    int i;
-    char** sp;
-    char** ep;
+    if (state != NULL && !regvisit(vm, prog, state))
+        return;
+    int i = vm->count[l]++;
+    regthread* t = &vm->threads[l][i];
+    t->pc = pc;
+    t->str = str;
+    t->loop = loop;
+    memcpy(vm->caps[l] + i * 2 * NSUBEXP, caps, 2 * NSUBEXP * sizeof(char*));
+}
 
-    reginput = string;
-    regstartp = prog->startp;
-    regendp = prog->endp;
+void regadd(regvm* vm, regexp* prog, int l, char* scan, char** caps, char* input);
 
-    sp = prog->startp;
-    ep = prog->endp;
-    for (i = NSUBEXP; i > 0; i--)
-    {
-        *sp++ = NULL;
-        *ep++ = NULL;
-    }
-    if (regmatch(prog->program + 1))
-    {
-        prog->startp[0] = string;
-        prog->endp[0] = reginput;
-        return (1);
-    }
-    else
-        return (0);
+/*
+ - regaddloop - add threads continuing after one repetition of STAR or PLUS
+ */
+void regaddloop(regvm* vm, regexp* prog, int l, char* loop, char** caps, char* input)
+{
+    regthreadadd(vm, prog, l, OPERAND(loop), OPERAND(loop),
+                 OP(OPERAND(loop)) == EXACTLY ? OPERAND(OPERAND(loop)) : NULL,
+                 loop, caps); /* Greedy: one more repetition first, */
+    regadd(vm, prog, l, regnext(loop), caps, input); /* then the rest. */
 }
 
 /*
- - regmatch - main matching routine
- *
- * Conceptually the strategy is simple:  check to see whether the current
- * node matches, call self recursively to see whether the rest matches,
- * and then act accordingly.  In practice we make some effort to avoid
- * recursion, in particular by going through "ordinary" nodes (that don't
- * need to know whether the rest of the match failed) by a loop instead of
- * by recursion.
+ - regadd - add threads for all states reachable from node scan without
+ * reading a character (in the order of priority) to list l
  */
-int regmatch(char* prog) /* 0 failure, 1 success */
+void regadd(regvm* vm, regexp* prog, int l, char* scan, char** caps, char* input)
 {
-    char* scan; /* Current node. */
-    char* next; /* Next node. */
+    char* next;
+    char* save;
+    int no;
 
-    scan = prog;
     while (scan != NULL)
     {
+        if (!regvisit(vm, prog, scan))
+            return;
         next = regnext(scan);
 
         switch (OP(scan))
         {
         case BOL:
-            if (reginput != regbol)
-                return (0);
+            if (input != vm->bol)
+                return;
             break;
         case EOL:
-            if (*reginput != '\0')
-                return (0);
+            if (*input != '\0')
+                return;
             break;
         case ANY:
-            if (*reginput == '\0')
-                return (0);
-            reginput++;
-            break;
-        case EXACTLY:
-        {
-            int len;
-            char* opnd;
-
-            opnd = OPERAND(scan);
-            /* Inline the first character, for speed. */
-            if (*opnd != *reginput)
-                return (0);
-            len = (int)strlen(opnd);
-            if (len > 1 && strncmp(opnd, reginput, len) != 0)
-                return (0);
-            reginput += len;
-        }
-        break;
         case ANYOF:
-            if (*reginput == '\0' || strchr(OPERAND(scan), *reginput) == NULL)
-                return (0);
-            reginput++;
-            break;
         case ANYBUT:
-            if (*reginput == '\0' || strchr(OPERAND(scan), *reginput) != NULL)
-                return (0);
-            reginput++;
-            break;
+            regthreadadd(vm, prog, l, NULL, scan, NULL, NULL, caps);
+            return;
+        case EXACTLY:
+            regthreadadd(vm, prog, l, NULL, scan, OPERAND(scan), NULL, caps);
+            return;
+        case END:
+            regthreadadd(vm, prog, l, NULL, scan, NULL, NULL, caps);
+            return;
         case NOTHING:
-            break;
         case BACK:
             break;
-        case OPEN + 1:
-        case OPEN + 2:
-        case OPEN + 3:
-        case OPEN + 4:
-        case OPEN + 5:
-        case OPEN + 6:
-        case OPEN + 7:
-        case OPEN + 8:
-        case OPEN + 9:
-        {
-            int no;
-            char* save;
-
-            no = OP(scan) - OPEN;
-            save = reginput;
-
-            if (regmatch(next))
-            {
-                /*
-             * Don't set startp if some later
-             * invocation of the same parentheses
-             * already has.
-             */
-                if (regstartp[no] == NULL)
-                    regstartp[no] = save;
-                return (1);
-            }
-            else
-                return (0);
-        }
-        case CLOSE + 1:
-        case CLOSE + 2:
-        case CLOSE + 3:
-        case CLOSE + 4:
-        case CLOSE + 5:
-        case CLOSE + 6:
-        case CLOSE + 7:
-        case CLOSE + 8:
-        case CLOSE + 9:
-        {
-            int no;
-            char* save;
-
-            no = OP(scan) - CLOSE;
-            save = reginput;
-
-            if (regmatch(next))
-            {
-                /*
-             * Don't set endp if some later
-             * invocation of the same parentheses
-             * already has.
-             */
-                if (regendp[no] == NULL)
-                    regendp[no] = save;
-                return (1);
-            }
-            else
-                return (0);
-        }
         case BRANCH:
-        {
-            char* save;
-
-            if (OP(next) != BRANCH)   /* No choice. */
-                next = OPERAND(scan); /* Avoid recursion. */
+            if (OP(next) != BRANCH) /* No choice. */
+                next = OPERAND(scan);
             else
             {
                 do
                 {
-                    save = reginput;
-                    if (regmatch(OPERAND(scan)))
-                        return (1);
-                    reginput = save;
+                    regadd(vm, prog, l, OPERAND(scan), caps, input);
                     scan = regnext(scan);
                 } while (scan != NULL && OP(scan) == BRANCH);
-                return (0);
-                /* NOTREACHED */
+                return;
             }
-        }
-        break;
+            break;
         case STAR:
+            regaddloop(vm, prog, l, scan, caps, input);
+            return;
         case PLUS:
-        {
-            char nextch;
-            int no;
-            char* save;
-            int min;
-
-            /*
-           * Lookahead to avoid useless match attempts
-           * when we know what character comes next.
-           */
-            nextch = '\0';
-            if (OP(next) == EXACTLY)
-                nextch = *OPERAND(next);
-            min = (OP(scan) == STAR) ? 0 : 1;
-            save = reginput;
-            no = regrepeat(OPERAND(scan));
-            while (no >= min)
-            {
-                /* If it could work, try it. */
-                if (nextch == '\0' || *reginput == nextch)
-                    if (regmatch(next))
-                        return (1);
-                /* Couldn't or didn't -- back up. */
-                no--;
-                reginput = save + no;
-            }
-            return (0);
-        }
-
-        case END:
-            return (1); /* Success! */
+            regthreadadd(vm, prog, l, OPERAND(scan), OPERAND(scan),
+                         OP(OPERAND(scan)) == EXACTLY ? OPERAND(OPERAND(scan)) : NULL, scan, caps);
+            return;
         default:
-            return (0); /* memory corruption */
+            if (OP(scan) > OPEN && OP(scan) < OPEN + NSUBEXP)
+                no = OP(scan) - OPEN;
+            else if (OP(scan) > CLOSE && OP(scan) < CLOSE + NSUBEXP)
+                no = NSUBEXP + OP(scan) - CLOSE;
+            else
+                return; /* memory corruption */
+            /* The last passage through the parentheses is the one which counts. */
+            save = caps[no];
+            caps[no] = input;
+            regadd(vm, prog, l, next, caps, input);
+            caps[no] = save;
+            return;
         }
 
         scan = next;
     }
-
-    /*
-   * We get here only if there's trouble -- normally "case END" is
-   * the terminating point.
-   */
-    //  regerror("corrupted pointers");
-    return (0);
 }
 
 /*
- - regrepeat - repeatedly match something simple, report how many
+ - regexec - match a regexp against a string
  */
-int regrepeat(char* p)
+int regexec(regexp* prog, char* string, int offset, regvm** pvm)
 {
-    int count = 0;
-    char* scan;
-    char* opnd;
+    char* s;
+    char* start;
+    regvm* vm;
+    regthread* t;
+    char** tcaps;
+    char* caps[2 * NSUBEXP];
+    int cur, nxt, i, ok, matched;
+
+    /* Check validity of program. */
+    if (UCHARAT(prog->program) != MAGIC)
+        return (0);
 
-    scan = reginput;
-    opnd = OPERAND(p);
-    switch (OP(p))
+    /* If there is a "must appear" string, look for it. */
+    if (prog->regmust != NULL)
     {
-    case ANY:
-        count = (int)strlen(scan);
-        scan += count;
-        break;
-    case EXACTLY:
-        while (*opnd == *scan)
+        s = string + offset;
+        while ((s = strchr(s, prog->regmust[0])) != NULL)
         {
-            count++;
-            scan++;
+            if (strncmp(s, prog->regmust, prog->regmlen) == 0)
+                break; /* Found it. */
+            s++;
         }
-        break;
-    case ANYOF:
-        while (*scan != '\0' && strchr(opnd, *scan) != NULL)
+        if (s == NULL) /* Not present. */
+            return (0);
+    }
+
+    vm = *pvm;
+    if (vm != NULL && vm->size != prog->regsize)
+    {
+        regvmfree(vm);
+        vm = *pvm = NULL;
+    }
+    if (vm == NULL)
+    {
+        vm = *pvm = regvmalloc(prog->regsize);
+        if (vm == NULL)
         {
-            count++;
-            scan++;
+            regerror(RegExpErrorText(reeLowMemory));
+            return (0);
         }
-        break;
-    case ANYBUT:
-        while (*scan != '\0' && strchr(opnd, *scan) == NULL)
+    }
+
+    /* Mark beginning of line for ^ . */
+    vm->bol = string;
+
+    for (i = 0; i < NSUBEXP; i++)
+    {
+        prog->startp[i] = NULL;
+        prog->endp[i] = NULL;
+    }
+
+    matched = 0;
+    start = string + offset;
+    s = start;
+    cur = 0;
+    regnewlist(vm, cur);
+    for (;;)
+    {
+        /* A new thread starting at s, with the lowest priority. */
+        if (!matched)
         {
-            count++;
-            scan++;
+            if (vm->count[cur] == 0)
+            {
+                if (prog->reganch && s != start)
+                    break; /* Anchored match need be tried only once. */
+                if (prog->regstart != '\0')
+                {
+                    /* We know what char it must start with. */
+                    s = strchr(s, prog->regstart);
+                    if (s == NULL)
+                        break;
+                }
+            }
+            if ((!prog->reganch || s == start) &&
+                (prog->regstart == '\0' || *s == prog->regstart))
+            {
+                memset(caps, 0, sizeof(caps));
+                caps[0] = s;
+                regadd(vm, prog, cur, prog->program + 1, caps, s);
+            }
         }
-        break;
-    default:       /* Oh dear.  Called inappropriately. */
-                   //    regerror("internal foulup");
-        count = 0; /* Best compromise. */
-        break;
+        if (vm->count[cur] == 0 && (matched || *s == '\0'))
+            break;
+
+        /* Advance all threads by the character at s. */
+        nxt = 1 - cur;
+        regnewlist(vm, nxt);
+        for (i = 0; i < vm->count[cur]; i++)
+        {
+            t = &vm->threads[cur][i];
+            tcaps = vm->caps[cur] + i * 2 * NSUBEXP;
+            if (OP(t->pc) == END)
+            {
+                /* Success; the threads behind this one have lower priority. */
+                matched = 1;
+                memcpy(prog->startp, tcaps, NSUBEXP * sizeof(char*));
+                memcpy(prog->endp, tcaps + NSUBEXP, NSUBEXP * sizeof(char*));
+                prog->endp[0] = s;
+                break;
+            }
+            if (*s == '\0')
+                continue;
+            switch (OP(t->pc))
+            {
+            case ANY:
+                ok = 1;
+                break;
+            case ANYOF:
+                ok = strchr(OPERAND(t->pc), *s) != NULL;
+                break;
+            case ANYBUT:
+                ok = strchr(OPERAND(t->pc), *s) == NULL;
+                break;
+            case EXACTLY:
+                ok = *t->str == *s;
+                break;
+            default:
+                ok = 0; /* memory corruption */
+                break;
+            }
+            if (!ok)
+                continue;
+            if (t->str != NULL && t->str[1] != '\0')
+                regthreadadd(vm, prog, nxt, t->str + 1, t->pc, t->str + 1, t->loop, tcaps);
+            else if (t->loop != NULL)
+                regaddloop(vm, prog, nxt, t->loop, tcaps, s + 1);
+            else
+                regadd(vm, prog, nxt, regnext(t->pc), tcaps, s + 1);
+        }
+        if (*s == '\0')
+            break;
+        cur = nxt;
+        s++;
     }
-    reginput = scan;
 
-    return (count);
+    return (matched);
+}
+
+BOOL CRegularExpression::PrepareRequiredAlternatives(const char* pattern)
+{
+    RequiredAlternatives.Clear();
+    if (strchr(pattern, '|') == NULL)
+        return FALSE; // not an alternation, regmust covers a single literal
+    const char* beg = pattern;
+    while (1)
+    {
+        const char* end = beg;
+        while (*end != 0 && *end != '|')
+        {
+            // a special character or a line end: the alternative is not a plain literal
+            if (strchr(META, *end) != NULL || *end == '\r' || *end == '\n')
+            {
+                RequiredAlternatives.Clear();
+                return FALSE;
+            }
+            end++;
+        }
+        // an empty alternative matches everywhere; more than MULTISEARCH_MAX_PATTERNS
+        // alternatives or low memory: the lines are left to the expression
+        if (!RequiredAlternatives.Add(beg, (int)(end - beg)))
+        {
+            RequiredAlternatives.Clear();
+            return FALSE;
+        }
+        if (*end == 0)
+            break;
+        beg = end + 1;
+    }
+    return RequiredAlternatives.Prepare((Flags & sfCaseSensitive) ? NULL : LowerCase);
 }
 
 /*
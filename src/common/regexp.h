@@ -26,11 +26,17 @@ typedef struct regexp
     char reganch;    /* Internal use only. */
     char* regmust;   /* Internal use only. */
     int regmlen;     /* Internal use only. */
+    int regsize;     /* Internal use only. */
     char program[1]; /* Unwarranted chumminess with compiler. */
 } regexp;
 
+// work memory of regexec (lists of threads of the automaton); every caller keeps
+// its own, so several expressions can be matched in different threads at once
+struct regvm;
+
 regexp* regcomp(char* exp, const char*& lastErrorText);
-int regexec(regexp* prog, char* string, int offset);
+int regexec(regexp* prog, char* string, int offset, regvm** vm);
+void regvmfree(regvm* vm);
 void regerror(const char* error);
 
 //*****************************************************************************
@@ -80,6 +86,13 @@ protected:
     const char* LastErrorText;
     char* OriginalPattern;
     regexp* Expression; // nakompilovany regularni vyraz
+    regvm* VM;          // work memory of regexec, allocated on first use
+    CSearchData RequiredLiteral; // literal each match must contain (see regmust); valid if UseRequiredLiteral is TRUE
+    BOOL UseRequiredLiteral;
+    // literals one of which each match contains (the expression is their alternation, e.g.
+    // "a|b|c", then regmust is unknown); valid if UseRequiredAlternatives is TRUE
+    CMultiLiteralSearch RequiredAlternatives;
+    BOOL UseRequiredAlternatives;
     WORD Flags;
 
     char* Line;                // buffer pro radek
@@ -91,6 +104,9 @@ public:
     CRegularExpression()
     {
         Expression = NULL;
+        VM = NULL;
+        UseRequiredLiteral = FALSE;
+        UseRequiredAlternatives = FALSE;
         OriginalPattern = NULL;
         Flags = sfCaseSensitive | sfForward;
         Line = NULL;
@@ -104,6 +120,8 @@ public:
     {
         if (Expression != NULL)
             free(Expression);
+        if (VM != NULL)
+            regvmfree(VM);
         if (OriginalPattern != NULL)
             free(OriginalPattern);
         if (Line != NULL)
@@ -112,6 +130,7 @@ public:
 
     BOOL IsGood() const { return OriginalPattern != NULL && Expression != NULL; }
     const char* GetPattern() const { return OriginalPattern; }
+    WORD GetFlags() const { return Flags; }
 
     const char* GetLastErrorText() const { return LastErrorText; }
     BOOL Set(const char* pattern, WORD flags); // vraci FALSE pri chybe (volat metodu GetLastErrorText)
@@ -122,6 +141,23 @@ public:
     int SearchForward(int start, int& foundLen);
     int SearchBackward(int length, int& foundLen);
 
+    // returns TRUE if every match contains a known literal (only for forward search);
+    // the literal never contains CR or LF, so a line without it cannot contain a match
+    BOOL HasRequiredLiteral() const { return UseRequiredLiteral; }
+    // returns TRUE if every match contains the required literal (see HasRequiredLiteral) or
+    // one of the literals of an alternation (the expression is e.g. "a|b|c", the literals
+    // are searched in one pass, see CMultiLiteralSearch); they never contain CR or LF
+    BOOL HasRequiredLiterals() const { return UseRequiredLiteral || UseRequiredAlternatives; }
+    // finds the literal or one of the literals (see HasRequiredLiterals) in 'text'; returns
+    // the offset of the first occurrence or -1 if 'text' does not contain any of them
+    int FindRequiredLiteral(const char* text, int length);
+    // returns the literal (see HasRequiredLiteral), in lower case if the search is case insensitive
+    const char* GetRequiredLiteral(int& length) const
+    {
+        length = RequiredLiteral.GetLength();
+        return RequiredLiteral.GetPattern();
+    }
+
     // nahradi promnene \1 ... \9 textem zachycenym odpovidajicima zavorkama
     // 'pattern' je vzor kterym se nahrazuje nalezeny match, 'buffer' buffer
     // pro vystup, 'bufSize' maximalni velikost textu vcetne ukoncovaciho NULL
@@ -139,6 +175,11 @@ public:
                        char* buffer, int bufSize);
 
 protected:
+    // if 'pattern' (already in lower case for the case insensitive search) is an alternation
+    // of at least two plain literals, prepares RequiredAlternatives for them; returns TRUE
+    // if RequiredAlternatives can be used
+    BOOL PrepareRequiredAlternatives(const char* pattern);
+
     // Obraci regularni vyraz - pro hledani od zadu
     // VYRAZ MUSI BYT SYNTAKTICKY SPRAVNY ! JINAK NEFUNGUJE SPRAVNE !
     // napr. "a)b(d)(" -> "((d)b)a" coz je chybne
@@ -0,0 +1,92 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "treebatch.h"
+
+//
+// ****************************************************************************
+// CTreeBatch
+//
+
+CTreeBatch::CTreeBatch()
+{
+    Items = NULL;
+    Count = 0;
+    Capacity = 0;
+    NextItem = 0;
+}
+
+CTreeBatch::~CTreeBatch()
+{
+    if (Items != NULL)
+        free(Items);
+}
+
+BOOL CTreeBatch::Init(int capacity)
+{
+    if (Items != NULL)
+        free(Items);
+    Items = (CTreeBatchItem*)malloc(capacity * sizeof(CTreeBatchItem));
+    Capacity = Items != NULL ? capacity : 0;
+    Reset();
+    return Items != NULL;
+}
+
+// returns TRUE if 'name' lies inside directory 'dir' (of length 'dirLen'), the names in
+// the script are built from the name of the directory, so simple comparison is enough
+static BOOL IsInsideDir(const char* name, const char* dir, int dirLen)
+{
+    return strncmp(name, dir, dirLen) == 0 &&
+           (name[dirLen] == '\\' || name[dirLen] == '/' ||
+            (dirLen > 0 && (dir[dirLen - 1] == '\\' || dir[dirLen - 1] == '/') && name[dirLen] != 0));
+}
+
+BOOL CTreeBatch::Add(const char* name, BOOL isDir)
+{
+    if (Count >= Capacity)
+        return FALSE;
+    CTreeBatchItem* item = &Items[Count];
+    item->Name = name;
+    item->IsDir = isDir;
+    item->State = tbsPending;
+    int from = Count;
+    if (isDir)
+    {
+        // the items inside the directory are just before it, the content of a subdirectory
+        // is skipped at once (it lies before the subdirectory)
+        int len = (int)strlen(name);
+        while (from > 0 && IsInsideDir(Items[from - 1].Name, name, len))
+        {
+            from--;
+            if (Items[from].IsDir)
+                from = Items[from].ChildrenFrom;
+        }
+    }
+    item->ChildrenFrom = from;
+    Count++;
+    return TRUE;
+}
+
+int CTreeBatch::TakeNext()
+{
+    LONG index = InterlockedIncrement(&NextItem) - 1;
+    return index < Count ? index : -1;
+}
+
+BOOL CTreeBatch::AreChildrenFinished(int index, BOOL* fallback)
+{
+    *fallback = FALSE;
+    int i;
+    for (i = Items[index].ChildrenFrom; i < index; i++)
+    {
+        LONG state = Items[i].State;
+        if (state == tbsPending)
+            return FALSE;
+        if (state == tbsFallback)
+            *fallback = TRUE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,83 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+// The batch uses only Windows types and Interlocked functions, so it can be built outside
+// of Salamander: tools/treebench deletes a synthetic directory tree with it.
+
+enum CTreeBatchItemState
+{
+    tbsPending,  // the item waits for a helper thread
+    tbsDone,     // a helper thread processed the item
+    tbsFallback, // the item is left to the caller (error, unfinished content of a directory, etc.)
+};
+
+struct CTreeBatchItem
+{
+    const char* Name;    // full name of the file or directory (owned by the caller)
+    BOOL IsDir;          // TRUE = directory, processed after all items inside it in the batch
+    int ChildrenFrom;    // directory only: index of the first item inside it (own index = none)
+    volatile LONG State; // value from CTreeBatchItemState
+};
+
+//*********************************************************************************
+//
+// CTreeBatch
+//
+// Items of a batch (a contiguous part of a script of Delete or Change Attributes)
+// processed by several helper threads at once. The script lists the content of
+// a directory before the directory itself ("children before parent"), so the items
+// inside a directory are the contiguous run of items just before it. Helper threads
+// take the items in the order of the batch; before processing a directory they wait
+// until all items inside it are finished, and if some of them was left to the caller,
+// the directory is left to the caller too (it cannot be deleted yet).
+//
+// Add() and Reset() are called only when no helper thread runs.
+//
+
+class CTreeBatch
+{
+protected:
+    CTreeBatchItem* Items;
+    int Count;
+    int Capacity;
+    volatile LONG NextItem; // index of the next item for the helper threads
+
+public:
+    CTreeBatch();
+    ~CTreeBatch();
+
+    // allocates room for 'capacity' items; returns FALSE on low memory
+    BOOL Init(int capacity);
+
+    // empties the batch
+    void Reset()
+    {
+        Count = 0;
+        NextItem = 0;
+    }
+
+    // adds an item to the end of the batch; returns FALSE if the batch is full
+    BOOL Add(const char* name, BOOL isDir);
+
+    int GetCount() { return Count; }
+    CTreeBatchItem* GetItem(int index) { return &Items[index]; }
+
+    // returns the index of the next item for a helper thread or -1 if all items are taken
+    int TakeNext();
+
+    // returns TRUE if all items inside directory 'index' are finished; in 'fallback'
+    // returns TRUE if some of them was left to the caller
+    BOOL AreChildrenFinished(int index, BOOL* fallback);
+
+    // marks item 'index' as finished: 'done' is TRUE if it was processed, FALSE if it is
+    // left to the caller
+    void Finish(int index, BOOL done)
+    {
+        InterlockedExchange(&Items[index].State, done ? tbsDone : tbsFallback);
+    }
+
+    BOOL IsFinished(int index) { return Items[index].State != tbsPending; }
+};
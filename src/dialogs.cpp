@@ -428,6 +428,9 @@ CProgressDialog::CProgressDialog(HWND parent, COperations* script, const char* c
     DoNotBeepOnClose = FALSE;
     IsInQueue = FALSE;
     AutoPaused = FALSE;
+    TelemetryPaused = FALSE;
+    TelemetryPausedInQueue = FALSE;
+    TelemetryPausedSince = 0;
     StatusPaused = FALSE;
     NextTimeLeftUpdateTime = GetTickCount();
     TimeLeftLastValue.SetUI64(0);
@@ -507,6 +510,23 @@ BOOL CProgressDialog::FlushCachedData()
     return changed;
 }
 
+void CProgressDialog::TelemetryPause(BOOL paused)
+{
+    if (Script == NULL || Script->Telemetry == NULL || TelemetryPaused == paused)
+        return;
+    if (paused)
+    {
+        TelemetryPausedSince = Script->GetTelemetryTime();
+        TelemetryPausedInQueue = AutoPaused;
+    }
+    else
+    {
+        Script->AddTelemetry(ctpStall, TelemetryPausedSince, 0, NO_ERROR,
+                             TelemetryPausedInQueue ? ctsQueue : ctsPaused);
+    }
+    TelemetryPaused = paused;
+}
+
 void CProgressDialog::SetDlgTitle(BOOL minimized)
 {
     char buf[200];
@@ -645,13 +665,18 @@ CProgressDialog::DialogProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
             EndDialog(HWindow, IDABORT); // k.o.
             break;
         }
+        if (Configuration.RecordCopyTelemetry && Script->IsCopyOrMoveOperation)
+            Script->StartTelemetry(); // musi byt pred zarazenim do fronty, jinak by se neobjevilo cekani ve fronte
         BOOL startPaused = FALSE;
-        if (Script->IsCopyOrMoveOperation && OperationsQueue.AddOperation(HWindow, Script->StartOnIdle, &startPaused))
+        if (Script->IsCopyOrMoveOperation &&
+            OperationsQueue.AddOperation(HWindow, Script->StartOnIdle, Script->DeviceSrcPath,
+                                         Script->DeviceTgtPath, &startPaused))
         {
             IsInQueue = TRUE;
             if (startPaused)
             {
                 AutoPaused = TRUE;
+                TelemetryPause(TRUE);
                 ResetEvent(WorkerNotSuspended);
                 ShowPause = FALSE;
                 SetDlgItemText(HWindow, IDB_PAUSERESUME, LoadStr(ShowPause ? IDS_PROGDLGPAUSE : IDS_PROGDLGRESUME));
@@ -759,6 +784,7 @@ CProgressDialog::DialogProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
         if (CancelWorker)
             return TRUE; // uz se ma terminovat, nema nic chtit
 
+        unsigned __int64 dialogStart = Script != NULL ? Script->GetTelemetryTime() : 0;
         BOOL canFlash = RunningInOwnThread;
         if (IsIconic(RunningInOwnThread ? HWindow : MainWindow->HWindow))
         {
@@ -909,6 +935,8 @@ CProgressDialog::DialogProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
 
         if (canFlash)
             FlashWindow(RunningInOwnThread ? HWindow : MainWindow->HWindow, FALSE);
+        if (Script != NULL) // worker stal, dokud user neodpovedel
+            Script->AddTelemetry(ctpStall, dialogStart, 0, NO_ERROR, ctsUserDialog);
         AcceptCommands = TRUE;
         return TRUE;
     }
@@ -1147,6 +1175,7 @@ MENU_TEMPLATE_ITEM ProgressDialogMenu2[] =
                 HWND activateOperDlg = NULL;
                 OperationsQueue.AutoPauseOperation(HWindow, &activateOperDlg);
                 AutoPaused = TRUE;
+                TelemetryPause(TRUE);
                 ShowPause = FALSE;
                 SetDlgItemText(HWindow, IDB_PAUSERESUME, LoadStr(IDS_PROGDLGRESUME));
                 PostMessage(HWindow, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(HWindow, IDB_MINIMIZE), TRUE);
@@ -1405,6 +1434,7 @@ MENU_TEMPLATE_ITEM ProgressDialogMenu2[] =
                         SetEvent(WorkerNotSuspended);
                     }
                     ShowPause = !ShowPause;
+                    TelemetryPause(!ShowPause);
                 }
                 if (IsInQueue)
                     OperationsQueue.SetPaused(HWindow, !ShowPause ? 2 /* manually paused */ : 0 /* running */);
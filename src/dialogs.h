@@ -318,6 +318,9 @@ protected:
     BOOL FlushCachedData(); // posle zmenena data staticum a progress baram; vraci TRUE pokud bylo co updatnout (neco bylo dirty)
 
     void SetDlgTitle(BOOL minimized);
+
+    // telemetrie kopirovani (Script->Telemetry): zacatek/konec pauzy (rucni nebo cekani ve fronte)
+    void TelemetryPause(BOOL paused);
     void SetWindowIcon();
 
 protected:
@@ -333,6 +336,9 @@ protected:
     BOOL ShowPause;               // tlacitko "pause" ma mit text: TRUE = pause, FALSE = resume
     BOOL IsInQueue;               // TRUE = operace je ve fronte (user si to pral + povedlo se ji tam pridat)
     BOOL AutoPaused;              // TRUE pokud je operace ve fronte a je kvuli tomu "paused"
+    BOOL TelemetryPaused;         // TRUE = v telemetrii bezi interval pauzy (od TelemetryPausedSince)
+    BOOL TelemetryPausedInQueue;  // TRUE = pauza je cekani ve fronte (AutoPaused), jinak rucni pauza
+    unsigned __int64 TelemetryPausedSince; // cas zacatku pauzy (viz COperations::GetTelemetryTime())
     BOOL StatusPaused;            // TRUE = operace je zastavena, napr. dotaz na Cancel operace (+ostatni dialogy)
     DWORD NextTimeLeftUpdateTime; // cas dalsiho povoleneho updatu time-left (caste updaty jsou u delsich casu na skodu)
     CQuadWord TimeLeftLastValue;  // posledni zobrazena hodnota time-left
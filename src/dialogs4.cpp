@@ -300,6 +300,19 @@ CConfiguration::CConfiguration()
     UseSalOpen = FALSE;
     NetwareFastDirMove = FALSE; // volime pomalejsi ale 100% funkcni rezim, fajnsmekri si to muzou prepnout
     UseAsyncCopyAlg = TRUE;
+    CopySmallFilesConcurrently = FALSE;
+    VerifyCopiedFiles = FALSE;
+    CopyChangedBlocksOnly = FALSE;
+    ResumeInterruptedCopies = FALSE;
+    CopyDuringTreeAnalysis = FALSE;
+    CopySparseFiles = FALSE;
+    MakeZeroRunsSparse = FALSE;
+    QueueOperationsByDevice = FALSE;
+    DeleteAndChangeAttrsConcurrently = FALSE;
+    RecordCopyTelemetry = FALSE;
+    ReadDirsProgressively = FALSE;
+    CalcDirSizesConcurrently = FALSE;
+    CacheDirSizes = FALSE;
     ReloadEnvVariables = TRUE;
     QuickRenameSelectAll = FALSE;
     EditNewSelectAll = TRUE;
@@ -516,6 +529,10 @@ CConfiguration::CConfiguration()
     FindDialogWindowPlacement.length = 0; // zatim neplatne
     // sirky sloupce Find dialogu
     FindColNameWidth = -1; // nechame nastavit podle okna
+    FindWorkerThreads = 0; // automatic, derived from the number of processors
+    FindDupCompareBytes = FALSE;
+    FindIndexRoots[0] = 0;
+    FindSearchArchives = FALSE;
 
     // Language
     LoadedSLGName[0] = 0;
@@ -0,0 +1,872 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "mainwnd.h"
+#include "dirwalk.h"
+#include "dirsize.h"
+
+CDirSizeCache DirSizeCache;
+
+#define DIRSIZE_MAGIC "SALDSZ01"        // beginning of the file with the stored cache
+#define DIRSIZE_BUFFER_SIZE (64 * 1024) // buffer for writing the cache
+
+int FindDirSizeEntry(TIndirectArray<CDirSizeEntry>* entries, const char* path, int pathLen, BOOL* found)
+{
+    int l = 0, r = entries->Count - 1;
+    while (l <= r)
+    {
+        int m = (l + r) / 2;
+        CDirSizeEntry* e = entries->At(m);
+        int res = StrICmpEx(path, pathLen, e->Path, e->PathLen);
+        if (res == 0)
+        {
+            *found = TRUE;
+            return m;
+        }
+        if (res < 0)
+            r = m - 1;
+        else
+            l = m + 1;
+    }
+    *found = FALSE;
+    return l;
+}
+
+// returns the index of the first entry after 'index' which is not in the subtree of
+// the entry 'index' (the subtree follows the directory in the sorted array)
+int SkipDirSizeSubtree(TIndirectArray<CDirSizeEntry>* entries, int index)
+{
+    CDirSizeEntry* dir = entries->At(index);
+    int l = index + 1, r = entries->Count - 1;
+    while (l <= r)
+    {
+        int m = (l + r) / 2;
+        CDirSizeEntry* e = entries->At(m);
+        if (e->PathLen > dir->PathLen && StrNICmp(e->Path, dir->Path, dir->PathLen) == 0)
+            l = m + 1; // in the subtree
+        else
+            r = m - 1;
+    }
+    return l;
+}
+
+int CompareDirSizeEntries(const void* elem1, const void* elem2)
+{
+    CDirSizeEntry* e1 = *(CDirSizeEntry**)elem1;
+    CDirSizeEntry* e2 = *(CDirSizeEntry**)elem2;
+    return StrICmpEx(e1->Path, e1->PathLen, e2->Path, e2->PathLen);
+}
+
+int CompareDirSizeRoots(const void* elem1, const void* elem2)
+{
+    return StrICmp(*(char**)elem1, *(char**)elem2);
+}
+
+//*********************************************************************************
+//
+// CDirSizeCache
+//
+
+CDirSizeCache::CDirSizeCache()
+{
+    HANDLES(InitializeCriticalSection(&CS));
+    Entries = NULL;
+    Dirty = FALSE;
+}
+
+CDirSizeCache::~CDirSizeCache()
+{
+    if (Entries != NULL)
+        delete Entries;
+    HANDLES(DeleteCriticalSection(&CS));
+}
+
+BOOL CDirSizeCache::GetFileName(char* name)
+{
+    if (SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, 0 /* SHGFP_TYPE_CURRENT */, name) != S_OK ||
+        !SalPathAppend(name, "Open Salamander\\Directory Sizes.dat", MAX_PATH))
+    {
+        TRACE_E("CDirSizeCache: unable to get the local application data directory.");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void CDirSizeCache::Load()
+{
+    CALL_STACK_MESSAGE1("CDirSizeCache::Load()");
+    Entries = new TIndirectArray<CDirSizeEntry>(1000, 5000);
+    if (Entries == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return;
+    }
+    char name[MAX_PATH];
+    if (!GetFileName(name))
+        return;
+    HANDLE hFile = HANDLES_Q(CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                        FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+        return; // the cache has not been stored yet
+    DWORD sizeHigh;
+    DWORD size = GetFileSize(hFile, &sizeHigh);
+    BYTE* data = NULL;
+    DWORD read;
+    if (size != INVALID_FILE_SIZE && sizeHigh == 0)
+    {
+        data = (BYTE*)malloc(size);
+        if (data == NULL)
+            TRACE_E(LOW_MEMORY);
+        else
+        {
+            if (!ReadFile(hFile, data, size, &read, NULL) || read != size)
+            {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    HANDLES(CloseHandle(hFile));
+    if (data == NULL)
+        return;
+
+    // header: magic and the number of directories
+    BYTE* p = data;
+    BYTE* end = data + size;
+    DWORD count = 0;
+    BOOL ok = end - p >= 8 + sizeof(DWORD) && memcmp(p, DIRSIZE_MAGIC, 8) == 0;
+    if (ok)
+    {
+        count = *(DWORD*)(p + 8);
+        p += 8 + sizeof(DWORD);
+    }
+    DWORD i;
+    for (i = 0; ok && i < count; i++)
+    {
+        // directory: path length, path, time, files size, files count, flags, totals
+        if ((DWORD)(end - p) < sizeof(WORD))
+        {
+            ok = FALSE;
+            break;
+        }
+        WORD pathLen = *(WORD*)p;
+        if (pathLen == 0 || pathLen >= MAX_PATH ||
+            (DWORD)(end - p) < sizeof(WORD) + pathLen + 10 * sizeof(DWORD))
+        {
+            ok = FALSE;
+            break;
+        }
+        p += sizeof(WORD);
+        CDirSizeEntry* entry = new CDirSizeEntry;
+        if (entry == NULL || (entry->Path = (char*)malloc(pathLen + 1)) == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            if (entry != NULL)
+                delete entry;
+            ok = FALSE;
+            break;
+        }
+        memcpy(entry->Path, p, pathLen);
+        entry->Path[pathLen] = 0;
+        entry->PathLen = pathLen;
+        p += pathLen;
+        DWORD* d = (DWORD*)p;
+        entry->LastWrite.dwLowDateTime = d[0];
+        entry->LastWrite.dwHighDateTime = d[1];
+        entry->FilesSize.Set(d[2], d[3]);
+        entry->FilesCount = d[4];
+        entry->Flags = d[5];
+        entry->Totals.Size.Set(d[6], d[7]);
+        entry->Totals.Files = d[8];
+        entry->Totals.Dirs = d[9];
+        p += 10 * sizeof(DWORD);
+        Entries->Add(entry);
+        if (!Entries->IsGood())
+        {
+            Entries->ResetState();
+            delete entry;
+            ok = FALSE;
+        }
+    }
+    free(data);
+
+    if (!ok || p != end)
+    {
+        TRACE_E("Directory sizes cache " << name << " is damaged, it is dropped.");
+        Entries->DestroyMembers();
+        Dirty = TRUE; // the damaged file gets replaced
+    }
+}
+
+// buffered writing of the cache file
+static void WriteDirSizeData(HANDLE file, BYTE* buffer, DWORD* used, const void* data, DWORD size, BOOL* error)
+{
+    while (!*error && size > 0)
+    {
+        DWORD part = min(size, DIRSIZE_BUFFER_SIZE - *used);
+        memcpy(buffer + *used, data, part);
+        *used += part;
+        data = (const BYTE*)data + part;
+        size -= part;
+        DWORD written;
+        if (*used == DIRSIZE_BUFFER_SIZE)
+        {
+            if (!WriteFile(file, buffer, *used, &written, NULL) || written != *used)
+                *error = TRUE;
+            *used = 0;
+        }
+    }
+}
+
+BOOL CDirSizeCache::Save()
+{
+    CALL_STACK_MESSAGE1("CDirSizeCache::Save()");
+    char name[MAX_PATH];
+    if (Entries == NULL || !GetFileName(name))
+        return FALSE;
+    char dir[MAX_PATH];
+    lstrcpyn(dir, name, MAX_PATH);
+    CutDirectory(dir);
+    CreateDirectory(dir, NULL); // if it fails (e.g. it already exists), we do not care...
+
+    char tmpName[MAX_PATH + 4];
+    sprintf(tmpName, "%s.tmp", name);
+    HANDLE hFile = HANDLES_Q(CreateFile(tmpName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                        FILE_ATTRIBUTE_NORMAL, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        DWORD err = GetLastError();
+        TRACE_E("Unable to create directory sizes cache " << tmpName << ": " << GetErrorText(err));
+        return FALSE;
+    }
+    BYTE* buffer = (BYTE*)malloc(DIRSIZE_BUFFER_SIZE);
+    BOOL error = buffer == NULL;
+    DWORD used = 0;
+    WriteDirSizeData(hFile, buffer, &used, DIRSIZE_MAGIC, 8, &error);
+    DWORD count = Entries->Count;
+    WriteDirSizeData(hFile, buffer, &used, &count, sizeof(count), &error);
+    int i;
+    for (i = 0; i < Entries->Count; i++)
+    {
+        CDirSizeEntry* entry = Entries->At(i);
+        WORD pathLen = (WORD)entry->PathLen;
+        WriteDirSizeData(hFile, buffer, &used, &pathLen, sizeof(pathLen), &error);
+        WriteDirSizeData(hFile, buffer, &used, entry->Path, pathLen, &error);
+        DWORD d[10];
+        d[0] = entry->LastWrite.dwLowDateTime;
+        d[1] = entry->LastWrite.dwHighDateTime;
+        d[2] = entry->FilesSize.LoDWord;
+        d[3] = entry->FilesSize.HiDWord;
+        d[4] = entry->FilesCount;
+        d[5] = entry->Flags;
+        d[6] = entry->Totals.Size.LoDWord;
+        d[7] = entry->Totals.Size.HiDWord;
+        d[8] = entry->Totals.Files;
+        d[9] = entry->Totals.Dirs;
+        WriteDirSizeData(hFile, buffer, &used, d, sizeof(d), &error);
+    }
+    DWORD written;
+    if (!error && used > 0 && (!WriteFile(hFile, buffer, used, &written, NULL) || written != used))
+        error = TRUE;
+    if (buffer != NULL)
+        free(buffer);
+    HANDLES(CloseHandle(hFile));
+    BOOL ok = !error && MoveFileEx(tmpName, name, MOVEFILE_REPLACE_EXISTING);
+    if (!ok)
+    {
+        DWORD err = GetLastError();
+        TRACE_E("Unable to store directory sizes cache " << name << ": " << GetErrorText(err));
+        DeleteFile(tmpName);
+    }
+    return ok;
+}
+
+BOOL CDirSizeCache::HasSubdirsOf(const char* path)
+{
+    char dir[MAX_PATH];
+    lstrcpyn(dir, path, MAX_PATH);
+    if (!SalPathAddBackslash(dir, MAX_PATH))
+        return FALSE;
+    int dirLen = (int)strlen(dir);
+
+    BOOL ret = FALSE;
+    HANDLES(EnterCriticalSection(&CS));
+    if (Entries == NULL)
+        Load();
+    if (Entries != NULL)
+    {
+        BOOL found;
+        int i = FindDirSizeEntry(Entries, dir, dirLen, &found);
+        if (found)
+            i++;
+        ret = i < Entries->Count && Entries->At(i)->PathLen > dirLen &&
+              StrNICmp(Entries->At(i)->Path, dir, dirLen) == 0;
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+    return ret;
+}
+
+// a recorded directory of a subtree whose time of the last write must be checked
+struct CDirSizeCheck
+{
+    char* Path;
+    FILETIME LastWrite;
+};
+
+BOOL CDirSizeCache::GetTotals(const char* path, const char* name, const FILETIME* lastWrite,
+                              CDirSizeTotals* totals)
+{
+    char dir[MAX_PATH];
+    lstrcpyn(dir, path, MAX_PATH);
+    if (!SalPathAppend(dir, name, MAX_PATH) || !SalPathAddBackslash(dir, MAX_PATH))
+        return FALSE;
+
+    BOOL ret = FALSE;
+    CDirSizeTotals cached;
+    cached.Clear();
+    TDirectArray<CDirSizeCheck> checks(50, 200);
+    HANDLES(EnterCriticalSection(&CS));
+    if (Entries == NULL)
+        Load();
+    if (Entries != NULL)
+    {
+        BOOL exists;
+        int i = FindDirSizeEntry(Entries, dir, (int)strlen(dir), &exists);
+        if (exists)
+        {
+            CDirSizeEntry* entry = Entries->At(i);
+            int end = SkipDirSizeSubtree(Entries, i);
+            if ((entry->Flags & DIRSIZE_INCOMPLETE) == 0 &&
+                (entry->LastWrite.dwLowDateTime != 0 || entry->LastWrite.dwHighDateTime != 0) &&
+                CompareFileTime(&entry->LastWrite, lastWrite) == 0 &&
+                end - i - 1 <= DIRSIZE_MAX_CHECKED_DIRS)
+            {
+                // the subtree is checked outside the critical section (the disk can be slow
+                // and the threads calculating sizes take over directories meanwhile)
+                cached = entry->Totals;
+                ret = TRUE;
+                for (i++; ret && i < end; i++)
+                {
+                    CDirSizeEntry* sub = Entries->At(i);
+                    CDirSizeCheck check;
+                    check.LastWrite = sub->LastWrite;
+                    check.Path = NULL;
+                    if ((sub->LastWrite.dwLowDateTime == 0 && sub->LastWrite.dwHighDateTime == 0) ||
+                        (check.Path = DupStr(sub->Path)) == NULL)
+                    {
+                        ret = FALSE; // the time is unknown (or low memory), the size is not shown
+                        break;
+                    }
+                    checks.Add(check);
+                    if (!checks.IsGood())
+                    {
+                        checks.ResetState();
+                        free(check.Path);
+                        ret = FALSE;
+                    }
+                }
+            }
+        }
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+
+    // the time of the last write of a directory changes only when an item is created, deleted
+    // or renamed directly in it, so every recorded directory of the subtree must be unchanged
+    int i;
+    for (i = 0; i < checks.Count; i++)
+    {
+        CDirSizeCheck* check = &checks[i];
+        WIN32_FILE_ATTRIBUTE_DATA attrs;
+        if (ret && (!GetFileAttributesEx(check->Path, GetFileExInfoStandard, &attrs) ||
+                    CompareFileTime(&attrs.ftLastWriteTime, &check->LastWrite) != 0))
+        {
+            ret = FALSE; // changed or deleted, the size must be calculated again
+        }
+        free(check->Path);
+    }
+    if (ret)
+        *totals = cached;
+    return ret;
+}
+
+CDirSizeEntry* CDirSizeCache::TakeOver(const char* path, int pathLen, const FILETIME* lastWrite,
+                                       TDirectArray<char*>* subdirs)
+{
+    CDirSizeEntry* copy = NULL;
+    HANDLES(EnterCriticalSection(&CS));
+    if (Entries == NULL)
+        Load();
+    BOOL found = FALSE;
+    int index = Entries != NULL ? FindDirSizeEntry(Entries, path, pathLen, &found) : 0;
+    CDirSizeEntry* entry = found ? Entries->At(index) : NULL;
+    if (entry != NULL && (entry->Flags & DIRSIZE_INCOMPLETE) == 0 &&
+        (entry->LastWrite.dwLowDateTime != 0 || entry->LastWrite.dwHighDateTime != 0) &&
+        CompareFileTime(&entry->LastWrite, lastWrite) == 0)
+    {
+        // subdirectories: the first directory of every subtree following the directory
+        BOOL ok = TRUE;
+        int i = index + 1;
+        while (ok && i < Entries->Count)
+        {
+            CDirSizeEntry* sub = Entries->At(i);
+            if (sub->PathLen <= pathLen || StrNICmp(sub->Path, path, pathLen) != 0)
+                break; // end of the subtree
+            const char* s = sub->Path + pathLen;
+            while (*s != '\\')
+                s++;
+            if (s + 1 != sub->Path + sub->PathLen)
+                ok = FALSE; // the subdirectory itself is not recorded, the directory must be listed
+            else
+            {
+                char* subPath = DupStr(sub->Path);
+                if (subPath == NULL)
+                    ok = FALSE;
+                else
+                {
+                    subdirs->Add(subPath);
+                    if (!subdirs->IsGood())
+                    {
+                        subdirs->ResetState();
+                        free(subPath);
+                        ok = FALSE;
+                    }
+                }
+            }
+            i = SkipDirSizeSubtree(Entries, i);
+        }
+        if (ok)
+        {
+            copy = new CDirSizeEntry;
+            if (copy != NULL && (copy->Path = DupStr(entry->Path)) != NULL)
+            {
+                copy->PathLen = entry->PathLen;
+                copy->LastWrite = entry->LastWrite;
+                copy->FilesSize = entry->FilesSize;
+                copy->FilesCount = entry->FilesCount;
+            }
+            else
+            {
+                TRACE_E(LOW_MEMORY);
+                if (copy != NULL)
+                    delete copy;
+                copy = NULL;
+            }
+        }
+        if (copy == NULL)
+        {
+            for (i = 0; i < subdirs->Count; i++)
+                free(subdirs->At(i));
+            subdirs->DetachMembers();
+        }
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+    return copy;
+}
+
+void CDirSizeCache::Replace(TDirectArray<char*>* roots, TIndirectArray<CDirSizeEntry>* entries)
+{
+    CALL_STACK_MESSAGE2("CDirSizeCache::Replace(, %d)", entries->Count);
+    if (roots->Count == 0)
+        return;
+
+    HANDLES(EnterCriticalSection(&CS));
+    if (Entries == NULL)
+        Load();
+    if (Entries != NULL)
+    {
+        // the recorded directories outside 'roots' are merged with 'entries'
+        TIndirectArray<CDirSizeEntry>* merged = new TIndirectArray<CDirSizeEntry>(Entries->Count + entries->Count + 1, 5000);
+        if (merged == NULL || !merged->IsGood())
+        {
+            TRACE_E(LOW_MEMORY);
+            if (merged != NULL)
+                delete merged;
+        }
+        else
+        {
+            int i = 0, j = 0;
+            while (i < Entries->Count || j < entries->Count)
+            {
+                CDirSizeEntry* old = i < Entries->Count ? Entries->At(i) : NULL;
+                if (old != NULL)
+                {
+                    // the greatest root not greater than the path (roots do not contain each other)
+                    int l = 0, r = roots->Count - 1;
+                    while (l <= r)
+                    {
+                        int m = (l + r) / 2;
+                        if (StrICmp(roots->At(m), old->Path) <= 0)
+                            l = m + 1;
+                        else
+                            r = m - 1;
+                    }
+                    if (r >= 0 && StrNICmp(old->Path, roots->At(r), (int)strlen(roots->At(r))) == 0)
+                    {
+                        delete old; // replaced by the new calculation
+                        Entries->At(i++) = NULL;
+                        continue;
+                    }
+                }
+                CDirSizeEntry* add = j < entries->Count ? entries->At(j) : NULL;
+                if (old != NULL && (add == NULL || CompareDirSizeEntries(&old, &add) < 0))
+                {
+                    merged->Add(old);
+                    Entries->At(i++) = NULL;
+                }
+                else
+                {
+                    merged->Add(add);
+                    entries->At(j++) = NULL;
+                }
+            }
+            Entries->DetachMembers();
+            delete Entries;
+            entries->DetachMembers();
+            Entries = merged;
+            Dirty = TRUE;
+        }
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+}
+
+void CDirSizeCache::Release()
+{
+    CALL_STACK_MESSAGE1("CDirSizeCache::Release()");
+    HANDLES(EnterCriticalSection(&CS));
+    if (Entries != NULL)
+    {
+        if (Dirty)
+            Save();
+        delete Entries;
+        Entries = NULL;
+    }
+    Dirty = FALSE;
+    HANDLES(LeaveCriticalSection(&CS));
+}
+
+//*********************************************************************************
+//
+// CDirSizeCalculator
+//
+
+struct CDirSizeWorkerData
+{
+    TIndirectArray<CDirSizeEntry> Found; // directories listed or taken over by the worker
+    TIndirectArray<CDirSizeEntry> Stack; // directories being listed (more than one only on low memory)
+    TDirectArray<char*> Subdirs;         // subdirectories of the directory taken over from the cache
+
+    CDirSizeWorkerData() : Found(500, 5000), Stack(5, 5), Subdirs(50, 200) {}
+};
+
+CDirSizeCalculator::CDirSizeCalculator(HWND parent, int workers, BOOL useCache)
+    : Roots(10, 50), RootTotals(10, 50), Entries(1000, 10000), Errors(5, 20)
+{
+    Parent = parent;
+    UseCache = useCache;
+    WorkersCount = max(1, min(workers, DIRWALK_MAX_WORKERS));
+    Workers = NULL; // allocated by Calculate() (the calculator is often created only in case it is needed)
+    Walker = NULL;
+    Stop = FALSE;
+    LowMemory = FALSE;
+    LastCancelTest = GetTickCount();
+    HANDLES(InitializeCriticalSection(&ErrorsCS));
+}
+
+CDirSizeCalculator::~CDirSizeCalculator()
+{
+    if (Workers != NULL)
+        delete[] Workers;
+    int i;
+    for (i = 0; i < Roots.Count; i++)
+        free(Roots[i]);
+    for (i = 0; i < Errors.Count; i++)
+        free(Errors[i].Path);
+    HANDLES(DeleteCriticalSection(&ErrorsCS));
+}
+
+BOOL CDirSizeCalculator::AddRoot(const char* path)
+{
+    char dir[MAX_PATH];
+    if ((int)strlen(path) >= MAX_PATH)
+        return FALSE;
+    strcpy(dir, path);
+    if (!SalPathAddBackslash(dir, MAX_PATH))
+        return FALSE;
+    char* root = DupStr(dir);
+    if (root == NULL)
+        return FALSE;
+    Roots.Add(root);
+    if (!Roots.IsGood())
+    {
+        Roots.ResetState();
+        free(root);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL CDirSizeCalculator::Calculate()
+{
+    CALL_STACK_MESSAGE2("CDirSizeCalculator::Calculate() %d", Roots.Count);
+    if (Workers == NULL)
+        Workers = new CDirSizeWorkerData[WorkersCount];
+    if (Workers == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    // sorted roots are needed by DirSizeCache.Replace()
+    qsort(Roots.GetData(), Roots.Count, sizeof(char*), CompareDirSizeRoots);
+    CParallelDirWalker walker(this, WorkersCount, &Stop);
+    if (!walker.IsGood())
+        return FALSE;
+    Walker = &walker;
+    LastCancelTest = GetTickCount();
+    BOOL ok = walker.Walk(Roots.GetData(), Roots.Count);
+    Walker = NULL;
+    if (!ok || Stop || LowMemory)
+        return FALSE;
+
+    // the directories collected by the workers are put together and sorted
+    int i;
+    for (i = 0; i < WorkersCount; i++)
+    {
+        TIndirectArray<CDirSizeEntry>* found = &Workers[i].Found;
+        if (found->Count == 0)
+            continue;
+        Entries.Add(found->GetData(), found->Count);
+        if (!Entries.IsGood())
+        {
+            Entries.ResetState();
+            TRACE_E(LOW_MEMORY);
+            return FALSE;
+        }
+        found->DetachMembers();
+    }
+    qsort(Entries.GetData(), Entries.Count, sizeof(CDirSizeEntry*), CompareDirSizeEntries);
+    SumTotals();
+
+    for (i = 0; i < Roots.Count; i++)
+    {
+        CDirSizeTotals totals;
+        totals.Clear();
+        BOOL found;
+        int index = FindDirSizeEntry(&Entries, Roots[i], (int)strlen(Roots[i]), &found);
+        if (found)
+            totals = Entries[index]->Totals;
+        RootTotals.Add(totals);
+        if (!RootTotals.IsGood())
+        {
+            RootTotals.ResetState();
+            return FALSE;
+        }
+    }
+
+    if (UseCache)
+        DirSizeCache.Replace(&Roots, &Entries);
+    Entries.DestroyMembers(); // not needed anymore (if the cache did not take them over)
+    return TRUE;
+}
+
+void CDirSizeCalculator::SumTotals()
+{
+    int i;
+    for (i = 0; i < Entries.Count; i++)
+    {
+        CDirSizeEntry* e = Entries[i];
+        e->Totals.Size = e->FilesSize;
+        e->Totals.Files = e->FilesCount;
+        e->Totals.Dirs = 1;
+    }
+    // the subtree of a directory follows it in the sorted array, so going from the end,
+    // the totals of every directory are complete before they are added to its parent
+    for (i = Entries.Count - 1; i >= 0; i--)
+    {
+        CDirSizeEntry* e = Entries[i];
+        int parentLen = e->PathLen - 1; // without the trailing backslash
+        while (parentLen > 0 && e->Path[parentLen - 1] != '\\')
+            parentLen--;
+        if (parentLen == 0)
+            continue;
+        BOOL found;
+        int parent = FindDirSizeEntry(&Entries, e->Path, parentLen, &found);
+        if (found)
+        {
+            CDirSizeEntry* p = Entries[parent];
+            p->Totals.Size += e->Totals.Size;
+            p->Totals.Files += e->Totals.Files;
+            p->Totals.Dirs += e->Totals.Dirs;
+            p->Flags |= e->Flags & DIRSIZE_INCOMPLETE;
+        }
+    }
+}
+
+BOOL CDirSizeCalculator::GetTotals(const char* path, const char* name, CDirSizeTotals* totals)
+{
+    char dir[MAX_PATH];
+    lstrcpyn(dir, path, MAX_PATH);
+    if (!SalPathAppend(dir, name, MAX_PATH) || !SalPathAddBackslash(dir, MAX_PATH))
+        return FALSE;
+    int i;
+    for (i = 0; i < Roots.Count && i < RootTotals.Count; i++)
+    {
+        if (StrICmp(Roots[i], dir) == 0)
+        {
+            *totals = RootTotals[i];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void CDirSizeCalculator::TestCancel()
+{
+    if (GetTickCount() - LastCancelTest <= BS_TIMEOUT)
+        return;
+    if (UserWantsToCancelSafeWaitWindow())
+    {
+        MSG msg; // discard the buffered ESC
+        while (PeekMessage(&msg, NULL, WM_KEYFIRST, WM_KEYLAST, PM_REMOVE))
+            ;
+        // the other workers go on calculating while the user is deciding
+        if (SalMessageBox(Parent, LoadStr(IDS_CANCELOPERATION), LoadStr(IDS_QUESTION),
+                          MB_YESNO | MB_ICONQUESTION) == IDYES)
+        {
+            Stop = TRUE;
+        }
+        UpdateWindow(MainWindow->HWindow);
+    }
+    LastCancelTest = GetTickCount();
+}
+
+BOOL CDirSizeCalculator::EnterDirectory(int worker, const char* path, int pathLen)
+{
+    CDirSizeWorkerData* data = &Workers[worker];
+    if (data->Stack.Count > 0)
+    {
+        CDirSizeEntry* top = data->Stack[data->Stack.Count - 1];
+        if (top->PathLen == pathLen && memcmp(top->Path, path, pathLen) == 0)
+            return TRUE; // the listing goes on after a subdirectory was listed right away (low memory)
+    }
+    if (worker == 0)
+        TestCancel();
+    if (Stop || LowMemory)
+        return FALSE;
+
+    FILETIME lastWrite;
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (GetFileAttributesEx(path, GetFileExInfoStandard, &attrs))
+        lastWrite = attrs.ftLastWriteTime;
+    else
+        lastWrite.dwLowDateTime = lastWrite.dwHighDateTime = 0; // the directory is not taken over from the cache
+
+    CDirSizeEntry* entry = NULL;
+    if (UseCache && (lastWrite.dwLowDateTime != 0 || lastWrite.dwHighDateTime != 0))
+        entry = DirSizeCache.TakeOver(path, pathLen, &lastWrite, &data->Subdirs);
+    if (entry != NULL) // the directory has not changed, only its subdirectories are walked
+    {
+        data->Found.Add(entry);
+        if (!data->Found.IsGood())
+        {
+            data->Found.ResetState();
+            delete entry;
+            LowMemory = TRUE;
+        }
+        int i;
+        for (i = 0; i < data->Subdirs.Count; i++)
+        {
+            if (!LowMemory && !Walker->AddDirectory(worker, data->Subdirs[i]))
+                LowMemory = TRUE;
+            free(data->Subdirs[i]);
+        }
+        data->Subdirs.DetachMembers();
+        return FALSE;
+    }
+
+    entry = new CDirSizeEntry;
+    if (entry == NULL || (entry->Path = (char*)malloc(pathLen + 1)) == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        if (entry != NULL)
+            delete entry;
+        LowMemory = TRUE;
+        return FALSE;
+    }
+    memcpy(entry->Path, path, pathLen + 1);
+    entry->PathLen = pathLen;
+    entry->LastWrite = lastWrite;
+    data->Stack.Add(entry);
+    if (!data->Stack.IsGood())
+    {
+        data->Stack.ResetState();
+        delete entry;
+        LowMemory = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL CDirSizeCalculator::FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file)
+{
+    if (worker == 0)
+        TestCancel();
+    if (file->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        return !Stop && !LowMemory; // links are followed like in BuildScriptDir()
+    CDirSizeWorkerData* data = &Workers[worker];
+    if (data->Stack.Count > 0)
+    {
+        CDirSizeEntry* top = data->Stack[data->Stack.Count - 1];
+        top->FilesSize += CQuadWord(file->nFileSizeLow, file->nFileSizeHigh);
+        top->FilesCount++;
+    }
+    return FALSE;
+}
+
+void CDirSizeCalculator::LeaveDirectory(int worker, const char* path, int pathLen, BOOL complete)
+{
+    CDirSizeWorkerData* data = &Workers[worker];
+    if (data->Stack.Count == 0)
+    {
+        TRACE_E("CDirSizeCalculator::LeaveDirectory(): unexpected call for " << path);
+        return;
+    }
+    CDirSizeEntry* entry = data->Stack[data->Stack.Count - 1];
+    data->Stack.Detach(data->Stack.Count - 1);
+    if (!complete)
+        entry->Flags |= DIRSIZE_INCOMPLETE;
+    data->Found.Add(entry);
+    if (!data->Found.IsGood())
+    {
+        data->Found.ResetState();
+        delete entry;
+        LowMemory = TRUE;
+    }
+}
+
+void CDirSizeCalculator::WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err)
+{
+    CDirSizeWorkerData* data = &Workers[worker];
+    if (type == dweNameTooLong && data->Stack.Count > 0) // the directory being listed misses a subdirectory
+        data->Stack[data->Stack.Count - 1]->Flags |= DIRSIZE_INCOMPLETE;
+
+    CDirSizeError error;
+    error.Path = DupStr(path);
+    error.Err = err;
+    if (error.Path == NULL)
+    {
+        LowMemory = TRUE;
+        return;
+    }
+    HANDLES(EnterCriticalSection(&ErrorsCS));
+    Errors.Add(error);
+    if (!Errors.IsGood())
+    {
+        Errors.ResetState();
+        free(error.Path);
+        LowMemory = TRUE;
+    }
+    HANDLES(LeaveCriticalSection(&ErrorsCS));
+}
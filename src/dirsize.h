@@ -0,0 +1,202 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+#define DIRSIZE_INCOMPLETE 0x0001 // the listing of the directory or of a directory in its subtree failed
+
+#define DIRSIZE_MAX_CHECKED_DIRS 1000 // max. number of directories checked before the panel shows a recorded size
+
+// totals of a directory subtree
+struct CDirSizeTotals
+{
+    CQuadWord Size; // sum of the sizes of the files
+    DWORD Files;    // number of the files
+    DWORD Dirs;     // number of the directories (including the directory itself)
+
+    void Clear()
+    {
+        Size.Set(0, 0);
+        Files = 0;
+        Dirs = 0;
+    }
+};
+
+//*********************************************************************************
+//
+// CDirSizeEntry
+//
+// One directory recorded in CDirSizeCache.
+//
+
+struct CDirSizeEntry
+{
+    char* Path; // full path with a trailing backslash
+    int PathLen;
+    FILETIME LastWrite;  // time of the last write of the directory when it was listed (zero = unknown)
+    CQuadWord FilesSize; // sum of the sizes of the files directly in the directory
+    DWORD FilesCount;    // number of the files directly in the directory
+    DWORD Flags;         // DIRSIZE_xxx
+    CDirSizeTotals Totals;
+
+    CDirSizeEntry()
+    {
+        Path = NULL;
+        PathLen = 0;
+        LastWrite.dwLowDateTime = LastWrite.dwHighDateTime = 0;
+        FilesSize.Set(0, 0);
+        FilesCount = 0;
+        Flags = 0;
+        Totals.Clear();
+    }
+    ~CDirSizeEntry()
+    {
+        if (Path != NULL)
+            free(Path);
+    }
+};
+
+//*********************************************************************************
+//
+// CDirSizeCache
+//
+// Persistent record of the directories whose sizes were calculated (Space in the panel,
+// Calculate Directory Sizes). For every directory it keeps the time of its last write,
+// the files directly in it and the totals of its subtree. A later calculation does not
+// list a directory whose time of the last write has not changed, it takes over its files
+// and lists (or takes over) only its subdirectories. The panel shows the recorded size of
+// a subdirectory only if the times of the last write of the subdirectory and of all recorded
+// directories in its subtree are the same as when it was calculated (a change deeper in the
+// tree does not change the time of the subdirectory); subtrees of more than
+// DIRSIZE_MAX_CHECKED_DIRS directories are not checked, their size is not shown.
+//
+// The time of the last write of a directory changes when an item is created, deleted or
+// renamed in it, not when a file in it is overwritten, so the size of a file changed in
+// place is not noticed until its directory changes (Configuration.CacheDirSizes turns the
+// cache off). The cache is stored in the local application data directory on exit.
+//
+
+class CDirSizeCache
+{
+protected:
+    CRITICAL_SECTION CS;                    // guards Entries (the threads calculating sizes read them)
+    TIndirectArray<CDirSizeEntry>* Entries; // recorded directories sorted by Path; NULL = not loaded yet
+    BOOL Dirty;                             // TRUE = Entries changed since they were loaded
+
+public:
+    CDirSizeCache();
+    ~CDirSizeCache();
+
+    // returns TRUE if some subdirectory of 'path' is recorded
+    BOOL HasSubdirsOf(const char* path);
+
+    // returns in 'totals' the totals of subdirectory 'name' of 'path' if it is recorded
+    // completely listed, its time of the last write is 'lastWrite' and the recorded directories
+    // of its subtree have not changed either (their times are read from the disk)
+    BOOL GetTotals(const char* path, const char* name, const FILETIME* lastWrite, CDirSizeTotals* totals);
+
+    // returns a copy of directory 'path' (full path with a trailing backslash, 'pathLen' is
+    // its length) if it is recorded completely listed with time of the last write 'lastWrite';
+    // the full paths of its subdirectories are added to 'subdirs' (allocated, the caller frees
+    // them); returns NULL if the directory must be listed
+    CDirSizeEntry* TakeOver(const char* path, int pathLen, const FILETIME* lastWrite,
+                            TDirectArray<char*>* subdirs);
+
+    // replaces the recorded subtrees of 'roots' (full paths with a trailing backslash sorted
+    // by StrICmp, none of them contains another one) by 'entries' (sorted by Path, with
+    // computed totals); the cache takes over the entries (they are detached from 'entries')
+    void Replace(TDirectArray<char*>* roots, TIndirectArray<CDirSizeEntry>* entries);
+
+    // stores the cache (if it changed) and releases it; called on exit
+    void Release();
+
+protected:
+    // loads the stored cache (Entries is an empty array if it does not exist or is damaged)
+    void Load();
+
+    // stores Entries (the previous file is replaced only if the new one is written completely)
+    BOOL Save();
+
+    // returns the name of the file with the stored cache
+    BOOL GetFileName(char* name);
+};
+
+extern CDirSizeCache DirSizeCache;
+
+// returns the index of 'path' (its length is 'pathLen') in 'entries' sorted by Path; if it is
+// not there, returns the index where it would be inserted and 'found' is FALSE
+int FindDirSizeEntry(TIndirectArray<CDirSizeEntry>* entries, const char* path, int pathLen, BOOL* found);
+
+//*********************************************************************************
+//
+// CDirSizeCalculator
+//
+// Calculates the sizes of directory subtrees on CParallelDirWalker: the directories
+// are listed concurrently, every worker collects the listed directories in its own
+// array and the totals of the subtrees are summed up after the walk. Directories
+// unchanged since the last calculation are taken over from DirSizeCache.
+//
+
+struct CDirSizeWorkerData;
+
+struct CDirSizeError
+{
+    char* Path; // directory which could not be listed
+    DWORD Err;  // Windows error code
+};
+
+class CDirSizeCalculator : public CDirWalkerCallback
+{
+protected:
+    HWND Parent; // parent of the message box asking whether to cancel the calculation
+    BOOL UseCache;
+    int WorkersCount;
+    CDirSizeWorkerData* Workers;
+    CParallelDirWalker* Walker; // valid only during Calculate()
+    volatile BOOL Stop;         // TRUE = the user cancelled the calculation
+    volatile BOOL LowMemory;
+    DWORD LastCancelTest; // GetTickCount() of the last test of ESC (only worker 0 = the main thread tests it)
+
+    TDirectArray<char*> Roots;               // calculated directories (full paths with a trailing backslash)
+    TDirectArray<CDirSizeTotals> RootTotals; // totals of Roots (valid after Calculate())
+    TIndirectArray<CDirSizeEntry> Entries;   // all walked directories sorted by Path (after Calculate())
+
+    CRITICAL_SECTION ErrorsCS; // guards Errors
+    TDirectArray<CDirSizeError> Errors;
+
+public:
+    // 'useCache' is TRUE if directories can be taken over from DirSizeCache and the result
+    // should be recorded there
+    CDirSizeCalculator(HWND parent, int workers, BOOL useCache);
+    ~CDirSizeCalculator();
+
+    // adds the directory 'path' (full path) to calculate; returns FALSE if the path is too long
+    // or on low memory
+    BOOL AddRoot(const char* path);
+
+    // walks all added directories; returns FALSE if the user cancelled the calculation
+    // or on low memory; the directories which could not be listed are in Errors
+    BOOL Calculate();
+
+    // returns the totals of the added directory 'name' in 'path'; FALSE = not calculated
+    BOOL GetTotals(const char* path, const char* name, CDirSizeTotals* totals);
+
+    // returns TRUE if the user cancelled the calculation
+    BOOL IsCancelled() { return Stop; }
+
+    int GetErrorsCount() { return Errors.Count; }
+    const CDirSizeError* GetError(int index) { return &Errors[index]; }
+
+    virtual BOOL EnterDirectory(int worker, const char* path, int pathLen);
+    virtual BOOL FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file);
+    virtual void LeaveDirectory(int worker, const char* path, int pathLen, BOOL complete);
+    virtual void WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err);
+
+protected:
+    // sums up the totals of the subtrees of Entries (sorted)
+    void SumTotals();
+
+    // asks the user whether to cancel the calculation if ESC was pressed
+    void TestCancel();
+};
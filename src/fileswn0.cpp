@@ -1635,6 +1635,17 @@ BOOL CFilesWindow::OnSysKeyDown(UINT uMsg, WPARAM wParam, LPARAM lParam, LRESULT
             return TRUE; // I don't want space
         }
 
+        case VK_ESCAPE: // stop reading the directory shown progressively (the part read so far stays in the panel)
+        {
+            if (ProgressiveListing != NULL && !shiftPressed && !controlPressed && !altPressed)
+            {
+                StopProgressiveListing();
+                *lResult = 0;
+                return TRUE;
+            }
+            break;
+        }
+
         case VK_INSERT: // selection / deselection of a listbox item + move to the next one
         {
         INSERT_KEY: // for jumping from Quick Search mode
@@ -2249,6 +2260,257 @@ BOOL AreTheSameFiles(DWORD validFileData, CPluginDataInterfaceEncapsulation* plu
     return FALSE;
 }
 
+// incremental refresh on disk is used only if at most 1/REFRESH_DELTA_MAX_PART of the items
+// is new or changed (otherwise a full synchronization of the listings is faster)
+#define REFRESH_DELTA_MAX_PART 4
+
+// fills the columns of 'arr' compared by CListingDelta; the size of directories is ignored
+// (a size calculated in the old listing is not in the new one unless DirSizeCache has it,
+// see ComputeListingDelta()); returns FALSE on low memory
+BOOL SetListingDeltaColumns(CFilesArray* arr, BOOL isDirs)
+{
+    CListingColumns* cols = &arr->Columns;
+    if (!cols->SetCount(arr->Count))
+        return FALSE;
+    int i;
+    for (i = 0; i < arr->Count; i++)
+    {
+        CFileData* f = &arr->At(i);
+        cols->Set(i, f->Name, f->NameLen, isDirs ? 0 : f->Size.Value, f->LastWrite.dwLowDateTime,
+                  f->LastWrite.dwHighDateTime, f->Attr, (int)(f->Ext - f->Name));
+    }
+    return TRUE;
+}
+
+// computes the delta of disk listings 'oldArr' and 'newArr'; items which differ only in the data
+// derived during reading (DOS name, hidden, shared, link, etc.) and directories whose size is only
+// in the new listing (taken from DirSizeCache) are also marked as changed; returns FALSE on low memory
+BOOL ComputeListingDelta(CListingDelta* delta, CFilesArray* oldArr, CFilesArray* newArr, BOOL isDirs,
+                         BOOL caseSensitive)
+{
+    if (!SetListingDeltaColumns(oldArr, isDirs) || !SetListingDeltaColumns(newArr, isDirs) ||
+        !delta->Compute(&oldArr->Columns, &newArr->Columns, caseSensitive, StrICmpEx))
+    {
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < newArr->Count; i++)
+    {
+        if (delta->NewState[i] == ldsSame)
+        {
+            const CFileData* f1 = &oldArr->At(delta->NewToOld[i]);
+            const CFileData* f2 = &newArr->At(i);
+            if (f1->Ext - f1->Name != f2->Ext - f2->Name ||
+                (f1->DosName != f2->DosName && (f1->DosName == NULL || f2->DosName == NULL ||
+                                                strcmp(f1->DosName, f2->DosName) != 0)) ||
+                f1->Hidden != f2->Hidden || f1->IsLink != f2->IsLink || f1->IsOffline != f2->IsOffline ||
+                f1->Shared != f2->Shared || f1->Archive != f2->Archive || f1->Association != f2->Association ||
+                (isDirs && !f1->SizeValid && f2->SizeValid))
+            {
+                delta->NewState[i] = ldsChanged;
+                delta->ChangedItems++;
+            }
+        }
+    }
+    return TRUE;
+}
+
+// returns TRUE if the changed item 'newData' paired with 'oldData' needs a copy of its name
+// in the old listing (the names differ in the case of letters), similarly for its DOS name
+BOOL DeltaNeedsName(const CFileData* newData, const CFileData* oldData)
+{
+    return oldData == NULL || memcmp(oldData->Name, newData->Name, newData->NameLen) != 0;
+}
+
+BOOL DeltaNeedsDosName(const CFileData* newData, const CFileData* oldData)
+{
+    return newData->DosName != NULL &&
+           (oldData == NULL || oldData->DosName == NULL || strcmp(oldData->DosName, newData->DosName) != 0);
+}
+
+// releases the names allocated in 'arr' for 'pending' items, 'pendingFrom' are their indexes
+// in the new listing 'newArr'
+void FreeDeltaNames(CFilesArray* arr, CFilesArray* newArr, CListingDelta* delta,
+                    CFilesArray* pending, TDirectArray<int>* pendingFrom)
+{
+    int i;
+    for (i = 0; i < pending->Count; i++)
+    {
+        int n = pendingFrom->At(i);
+        int o = delta->NewToOld[n];
+        const CFileData* oldData = o == -1 ? NULL : &arr->At(o);
+        CFileData* f = &pending->At(i);
+        if (DeltaNeedsName(&newArr->At(n), oldData))
+            arr->FreeName(f->Name);
+        if (DeltaNeedsDosName(&newArr->At(n), oldData))
+            arr->FreeName(f->DosName);
+    }
+}
+
+// applies 'delta' of the new listing 'newArr' against the old listing 'arr' to 'arr': the removed
+// items are dropped, the changed ones get the new data (and keep the selection, cut-to-clip flag,
+// icon-overlay and calculated size of directory) and are moved together with the new items to their
+// place in the order of 'sortType' and 'reverseSort' (in which 'arr' is sorted); the items of 'arr'
+// which did not change keep their place, so only the new and changed items are sorted; the up-dir
+// symbol ".." must be in both or none of the listings; returns FALSE on low memory ('arr' is not
+// changed); in 'removedSelected' returns the number of removed selected items
+BOOL ApplyListingDelta(CFilesArray* arr, CFilesArray* newArr, CListingDelta* delta, BOOL isDirs,
+                       CSortType sortType, BOOL reverseSort, int* removedSelected)
+{
+    *removedSelected = 0;
+    int first = (isDirs && arr->Count > 0 && arr->At(0).NameLen == 2 &&
+                 arr->At(0).Name[0] == '.' && arr->At(0).Name[1] == '.')
+                    ? 1
+                    : 0; // the up-dir symbol keeps its place
+
+    // the new and changed items prepared aside with names allocated in 'arr'
+    CFilesArray pending(delta->NewItems + delta->ChangedItems + 1, 800);
+    pending.SetDeleteData(FALSE);
+    TDirectArray<int> pendingFrom(delta->NewItems + delta->ChangedItems + 1, 800);
+    int i;
+    for (i = first; i < newArr->Count; i++)
+    {
+        if (delta->NewState[i] == ldsSame)
+            continue;
+        int o = delta->NewToOld[i];
+        const CFileData* oldData = o == -1 ? NULL : &arr->At(o);
+        const CFileData* newData = &newArr->At(i);
+        CFileData item = *newData;
+        if (DeltaNeedsName(newData, oldData))
+            item.Name = arr->AllocName(newData->Name, newData->NameLen);
+        else
+            item.Name = oldData->Name;
+        if (item.Name != NULL)
+        {
+            if (DeltaNeedsDosName(newData, oldData))
+            {
+                item.DosName = arr->AllocName(newData->DosName, (int)strlen(newData->DosName));
+                if (item.DosName == NULL && DeltaNeedsName(newData, oldData))
+                    arr->FreeName(item.Name);
+            }
+            else
+                item.DosName = newData->DosName == NULL ? NULL : oldData->DosName;
+        }
+        if (item.Name != NULL && (newData->DosName == NULL || item.DosName != NULL))
+        {
+            item.Ext = item.Name + (newData->Ext - newData->Name);
+            if (oldData != NULL) // the state of the item is kept
+            {
+                item.Selected = oldData->Selected;
+                item.CutToClip = oldData->CutToClip;
+                item.IconOverlayIndex = oldData->IconOverlayIndex;
+                if (isDirs)
+                {
+                    if (oldData->SizeValid) // otherwise the size from DirSizeCache (if any) is kept
+                    {
+                        item.SizeValid = 1;
+                        item.Size = oldData->Size;
+                    }
+                }
+            }
+            pending.Add(item);
+            if (pending.IsGood())
+            {
+                pendingFrom.Add(i);
+                if (pendingFrom.IsGood())
+                    continue;
+                pendingFrom.ResetState();
+                pending.Detach(pending.Count - 1);
+            }
+            else
+                pending.ResetState();
+            // we release the names of 'item' (not added)
+            if (DeltaNeedsName(newData, oldData))
+                arr->FreeName(item.Name);
+            if (DeltaNeedsDosName(newData, oldData))
+                arr->FreeName(item.DosName);
+        }
+        TRACE_E(LOW_MEMORY);
+        FreeDeltaNames(arr, newArr, delta, &pending, &pendingFrom);
+        return FALSE;
+    }
+
+    // room for the new items (the end of 'arr' is overwritten below)
+    int oldCount = arr->Count;
+    int count = oldCount - delta->RemovedItems + delta->NewItems;
+    if (count > oldCount)
+    {
+        arr->Add(pending.GetData(), count - oldCount);
+        if (!arr->IsGood())
+        {
+            arr->ResetState();
+            FreeDeltaNames(arr, newArr, delta, &pending, &pendingFrom);
+            return FALSE;
+        }
+    }
+
+    // we sort the new and changed items (the same comparison as in SortFilesAndDirectories)
+    CFilesArray empty(1, 1);
+    if (isDirs)
+        SortFilesAndDirectories(&empty, &pending, sortType, reverseSort, Configuration.SortDirsByName);
+    else
+        SortFilesAndDirectories(&pending, &empty, sortType, reverseSort, Configuration.SortDirsByName);
+    CLessFunction less = GetListingLessFunction(sortType, isDirs, &reverseSort);
+
+    // the up-dir symbol is updated at its place
+    if (first == 1 && delta->NewState[0] != ldsSame)
+    {
+        CFileData* upDir = &arr->At(0);
+        const CFileData* newUpDir = &newArr->At(0);
+        upDir->Size = newUpDir->Size;
+        upDir->Attr = newUpDir->Attr;
+        upDir->LastWrite = newUpDir->LastWrite;
+        upDir->Hidden = newUpDir->Hidden;
+    }
+
+    // the removed and changed items leave 'arr', the others keep their order
+    int last = first;
+    for (i = first; i < oldCount; i++)
+    {
+        CFileData* f = &arr->At(i);
+        int n = delta->OldToNew[i];
+        if (n == -1) // removed
+        {
+            if (f->Selected)
+                (*removedSelected)++;
+            arr->FreeName(f->Name);
+            if (f->DosName != NULL)
+                arr->FreeName(f->DosName);
+            continue;
+        }
+        if (delta->NewState[n] != ldsSame) // changed (its copy is in 'pending')
+        {
+            if (DeltaNeedsName(&newArr->At(n), f))
+                arr->FreeName(f->Name);
+            if (f->DosName != NULL && (newArr->At(n).DosName == NULL || DeltaNeedsDosName(&newArr->At(n), f)))
+                arr->FreeName(f->DosName);
+            continue;
+        }
+        if (last != i)
+            arr->At(last) = *f;
+        last++;
+    }
+
+    // we merge 'pending' into 'arr' from the end
+    int out = count - 1;
+    int j = pending.Count - 1;
+    i = last - 1;
+    while (j >= 0)
+    {
+        if (i >= first && less(pending[j], arr->At(i), reverseSort))
+            arr->At(out--) = arr->At(i--);
+        else
+            arr->At(out--) = pending[j--];
+    }
+    if (count < arr->Count)
+    {
+        arr->Detach(count, arr->Count - count);
+        if (!arr->IsGood())
+            arr->ResetState(); // only the array could not be shrinked, it is all right
+    }
+    return TRUE;
+}
+
 void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloadThumbnails, BOOL isInactiveRefresh)
 {
     CALL_STACK_MESSAGE1("CFilesWindow::RefreshDirectory()");
@@ -2334,6 +2596,18 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
     // Configuration.SortDetectNumbers from the last call to SortDirectory().
     // If the configuration has changed in the meantime, it is necessary to force the following
     // sorting, otherwise the subsequent synchronization of the two listings would not work.
+    //
+    // On disk, the delta of the new listing can be applied to the old listing instead (see
+    // ApplyListingDelta), it needs the old listing in the current sorting, so its sorting is
+    // postponed until the new listing is read (and is not needed at all if the delta is applied).
+    BOOL deltaRefresh = Is(ptDisk) && !forceReloadThumbnails && !PluginData.NotEmpty() &&
+                        Files->GetNamesInArena() && Dirs->GetNamesInArena() &&
+                        SortedWithRegSet == Configuration.SortUsesLocale &&
+                        SortedWithDetectNum == Configuration.SortDetectNumbers;
+    char deltaPath[MAX_PATH]; // the path of the old listing, the delta is applied only to the same path
+    deltaPath[0] = 0;
+    if (deltaRefresh)
+        lstrcpyn(deltaPath, GetPath(), MAX_PATH);
     BOOL changeSortType;
     BOOL sortDirectoryPostponed = FALSE;
     CSortType currentSortType;
@@ -2347,11 +2621,12 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
         // at the same time, we define the conditions for sorting the new listing, which will run from CommonRefresh
         ReverseSort = FALSE;
         SortType = stName;
-        if (!OnlyDetachFSListing)
+        if (!OnlyDetachFSListing && !deltaRefresh)
             SortDirectory(); // we sort the old listing
         else
         {
             // We will sort the FS listings later so that they can be drawn well in the panel in the meantime (so that the indices match).
+            // We will sort the disk listing later only if the delta can't be applied (see deltaRefresh).
             sortDirectoryPostponed = TRUE;
         }
     }
@@ -2584,11 +2859,12 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
     // return to the original path remembering mode
     MainWindow->CanAddToDirHistory = oldCanAddToDirHistory;
 
+    BOOL updatePanelDelivered = FALSE; // TRUE = the panel was painted empty while reading the new listing
     if (clearWMUpdatePanel)
     {
         // we'll clear the message queue of buffered WM_USER_UPDATEPANEL
         MSG msg2;
-        PeekMessage(&msg2, HWindow, WM_USER_UPDATEPANEL, WM_USER_UPDATEPANEL, PM_REMOVE);
+        updatePanelDelivered = !PeekMessage(&msg2, HWindow, WM_USER_UPDATEPANEL, WM_USER_UPDATEPANEL, PM_REMOVE);
     }
 
     if (!result || noChange) // refresh failed or is useless
@@ -2644,8 +2920,107 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
     if (OnlyDetachFSListing)
         TRACE_E("FATAL ERROR: New listing didn't use prealocated objects???");
 
-    // we perform the postponed sorting of the FS listing
-    if (sortDirectoryPostponed)
+    // on disk we compare the new listing with the old one: if nothing changed, the old listing
+    // stays in the panel untouched (no sorting, no layout and painting of the panel, the icons
+    // stay loaded); if only a small part changed, the delta is applied to the old listing (only
+    // the new and changed items are sorted, the others keep their selection, sizes, etc.)
+    BOOL deltaApplied = FALSE;     // TRUE = Files+Dirs are the old listing with the delta applied
+    BOOL deltaIconsToRead = FALSE; // TRUE = there are new or changed items, their icons must be read
+    CListingDelta dirsDelta;
+    CListingDelta filesDelta;
+    if (deltaRefresh && Is(ptDisk) && IsTheSamePath(deltaPath, GetPath()) &&
+        ValidFileData == oldValidFileData && !PluginData.NotEmpty() &&
+        (oldDirs->Count > 0 && strcmp(oldDirs->At(0).Name, "..") == 0) ==
+            (Dirs->Count > 0 && strcmp(Dirs->At(0).Name, "..") == 0) &&
+        ComputeListingDelta(&dirsDelta, oldDirs, Dirs, TRUE, IsCaseSensitive()) &&
+        ComputeListingDelta(&filesDelta, oldFiles, Files, FALSE, IsCaseSensitive()))
+    {
+        if (dirsDelta.IsEmpty() && filesDelta.IsEmpty())
+        {
+            if (UseSystemIcons || UseThumbnails)
+                SleepIconCacheThread(); // the icon-reader already works on the new listing
+            VisibleItemsArray.InvalidateArr();
+            VisibleItemsArraySurround.InvalidateArr();
+            delete Files;
+            delete Dirs;
+            Files = oldFiles;
+            Dirs = oldDirs;
+            if (oldIconCache != NULL)
+            {
+                delete IconCache;
+                IconCache = oldIconCache;
+            }
+            WaitBeforeReadingIcons = 0;
+            DontClearNextFocusName = FALSE;
+            CutToClipChanged = cutToClipChanged;
+            SelectedCount = oldSelectedCount;
+            if (changeSortType) // the old listing is still sorted as the user wants (see deltaRefresh)
+            {
+                ReverseSort = currentReverseSort;
+                SortType = currentSortType;
+            }
+            ListBox->SetItemsCount(Files->Count + Dirs->Count, xOffset, topIndex == -1 ? 0 : topIndex, FALSE);
+            if (UseSystemIcons || UseThumbnails)
+            {
+                if (oldIconCache != NULL && oldIconCacheValid && !oldInactWinOptimizedReading)
+                    IconCacheValid = TRUE; // all icons are loaded, we won't start the icon-reader (see the end of this method)
+                else
+                {
+                    if (isInactiveRefresh)
+                        InactWinOptimizedReading = TRUE;
+                    WakeupIconCacheThread();
+                }
+            }
+            if (updatePanelDelivered) // the panel is painted empty, we must restore it
+                RefreshListBox(xOffset, topIndex, focusIndex, FALSE, FALSE);
+            EndStopRefresh();
+            if (setWait)
+                SetCursor(oldCur);
+            return;
+        }
+
+        int count = Files->Count + Dirs->Count;
+        int removedDirsSelected, removedFilesSelected;
+        CSortType sortType = changeSortType ? currentSortType : SortType;
+        BOOL reverseSort = changeSortType ? currentReverseSort : ReverseSort;
+        if ((dirsDelta.NewItems + dirsDelta.ChangedItems + filesDelta.NewItems + filesDelta.ChangedItems) *
+                    REFRESH_DELTA_MAX_PART <=
+                count &&
+            // the names of removed and changed items stay in the arena until the next full reading,
+            // there may not be more of them than there are items
+            oldDirs->GetFreedNamesCount() + dirsDelta.RemovedItems + dirsDelta.ChangedItems <= oldDirs->Count &&
+            oldFiles->GetFreedNamesCount() + filesDelta.RemovedItems + filesDelta.ChangedItems <= oldFiles->Count)
+        {
+            if (UseSystemIcons || UseThumbnails)
+                SleepIconCacheThread(); // the icon-reader already works on the read listing
+            if (ApplyListingDelta(oldDirs, Dirs, &dirsDelta, TRUE, sortType, reverseSort, &removedDirsSelected) &&
+                ApplyListingDelta(oldFiles, Files, &filesDelta, FALSE, sortType, reverseSort, &removedFilesSelected))
+            {
+                // the old listing with the delta goes to the panel, the read listing will be released
+                // instead of it (it is needed until the focus of the new item is found below)
+                VisibleItemsArray.InvalidateArr();
+                VisibleItemsArraySurround.InvalidateArr();
+                CFilesArray* swap = Files;
+                Files = oldFiles;
+                oldFiles = swap;
+                swap = Dirs;
+                Dirs = oldDirs;
+                oldDirs = swap;
+                SelectedCount = oldSelectedCount - removedDirsSelected - removedFilesSelected;
+                deltaApplied = TRUE;
+                deltaIconsToRead = dirsDelta.NewItems + dirsDelta.ChangedItems + filesDelta.NewItems +
+                                       filesDelta.ChangedItems >
+                                   0;
+            }
+            // if only the directories were updated, the full synchronization follows (the old listing
+            // is still a listing of this directory with the state of its items)
+            if (UseSystemIcons || UseThumbnails)
+                WakeupIconCacheThread();
+        }
+    }
+
+    // we perform the postponed sorting of the FS listing (or the disk listing if the delta wasn't applied)
+    if (sortDirectoryPostponed && !deltaApplied)
     {
         if (ReverseSort || SortType != stName)
             TRACE_E("FATAL ERROR: Unexpected change of sort type!");
@@ -2687,7 +3062,9 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
                 {
                     if (!pluginFSIconsFromPlugin && !newPluginFSIconsFromPlugin)
                     { // neither the old nor the new listing has anything to do with FS with custom icons -> transferring old icons makes sense
-                        if (probablyUselessRefresh &&
+                        if (deltaApplied) // unchanged items keep their icons, the changed ones are marked as old below
+                            transferIconsAndThumbnailsAsNew = TRUE;
+                        else if (probablyUselessRefresh &&
                             Dirs->Count == oldDirs->Count && Files->Count == oldFiles->Count &&
                             ValidFileData == oldValidFileData)
                         {
@@ -2711,6 +3088,20 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
                         // we load the old versions of icons and thumbnails into it
                         IconCache->GetIconsAndThumbsFrom(oldIconCache, NULL, transferIconsAndThumbnailsAsNew,
                                                          forceReloadThumbnails);
+                        if (deltaApplied) // icons and thumbnails of the changed items must be read again (oldDirs+oldFiles is the read listing)
+                        {
+                            int k;
+                            for (k = 0; k < oldDirs->Count; k++)
+                            {
+                                if (dirsDelta.NewState[k] == ldsChanged)
+                                    IconCache->SetOldVersion(oldDirs->At(k).Name, oldDirs->At(k).NameLen);
+                            }
+                            for (k = 0; k < oldFiles->Count; k++)
+                            {
+                                if (filesDelta.NewState[k] == ldsChanged)
+                                    IconCache->SetOldVersion(oldFiles->At(k).Name, oldFiles->At(k).NameLen);
+                            }
+                        }
                     }
                 }
             }
@@ -2726,6 +3117,8 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
     // SetSel(FALSE, -1);  // new loaded, so the Selected flag is 0 everywhere; SelectedCount is also 0
     int oldCount = oldDirs->Count + oldFiles->Count;
     int count = Dirs->Count + Files->Count;
+    if (deltaApplied) // oldDirs+oldFiles is the read listing, the old one has got the delta
+        oldCount = count - (dirsDelta.NewItems + filesDelta.NewItems - dirsDelta.RemovedItems - filesDelta.RemovedItems);
     if (count != oldCount + 1 && focusFirstNewItem)
         focusFirstNewItem = FALSE; // one item wasn't added
 
@@ -2734,6 +3127,30 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
     BOOL caseSensitive = IsCaseSensitive();
 
     int firstNewItemIsDir = -1; // -1 (unknown), 0 (is file), 1 (is directory)
+    if (deltaApplied && focusFirstNewItem)
+    {
+        // the listing already has the state of the old items, we only look for the new item
+        // (oldDirs+oldFiles is the read listing sorted by name, like Dirs+Files below otherwise)
+        int k;
+        for (k = 0; k < oldDirs->Count && dirsDelta.NewState[k] != ldsNew; k++)
+            ;
+        if (k < oldDirs->Count)
+        {
+            strcpy(NextFocusName, oldDirs->At(k).Name);
+            firstNewItemIsDir = 1 /* is directory */;
+        }
+        else
+        {
+            for (k = 0; k < oldFiles->Count && filesDelta.NewState[k] != ldsNew; k++)
+                ;
+            if (k < oldFiles->Count && (oldFiles->At(k).Attr & FILE_ATTRIBUTE_TEMPORARY) == 0) // on disk, we ignore tmp files (they disappear immediately), see https://forum.altap.cz/viewtopic.php?t=2496
+            {
+                strcpy(NextFocusName, oldFiles->At(k).Name);
+                firstNewItemIsDir = 0 /* is file */;
+            }
+        }
+        focusFirstNewItem = FALSE;
+    }
     int i = 0;
     if (i < Dirs->Count) // we skip the ".." (up-dir symbol) in the new data
     {
@@ -2748,7 +3165,7 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
         if (oldData->NameLen == 2 && oldData->Name[0] == '.' && oldData->Name[1] == '.')
             j++;
     }
-    for (; j < oldDirs->Count; j++) // first directories
+    for (; !deltaApplied && j < oldDirs->Count; j++) // first directories
     {
         CFileData* oldData = &oldDirs->At(j);
         if (focusFirstNewItem || oldData->Selected || oldData->SizeValid || oldData->CutToClip ||
@@ -2796,9 +3213,11 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
                             // we transfer values from the old item to the new one
                             if (oldData->Selected)
                                 SetSel(TRUE, newData);
-                            newData->SizeValid = oldData->SizeValid;
-                            if (newData->SizeValid)
+                            if (oldData->SizeValid) // otherwise the size from DirSizeCache (if any) is kept
+                            {
+                                newData->SizeValid = 1;
                                 newData->Size = oldData->Size;
+                            }
                             newData->CutToClip = oldData->CutToClip;
                             newData->IconOverlayIndex = oldData->IconOverlayIndex;
                         }
@@ -2829,7 +3248,7 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
     }
 
     i = 0;
-    for (j = 0; j < oldFiles->Count; j++) // after directories also files
+    for (j = 0; !deltaApplied && j < oldFiles->Count; j++) // after directories also files
     {
         CFileData* oldData = &oldFiles->At(j);
         if (focusFirstNewItem || oldData->Selected || oldData->CutToClip ||
@@ -2922,16 +3341,18 @@ void CFilesWindow::RefreshDirectory(BOOL probablyUselessRefresh, BOOL forceReloa
             SleepIconCacheThread(); // the icon thread must be put to sleep before modifying Files/Dirs (if it's not already sleeping)
         ReverseSort = currentReverseSort;
         SortType = currentSortType;
-        SortDirectory();
+        if (!deltaApplied) // the old listing with the delta is already sorted this way
+            SortDirectory();
         if (!iconReaderIsSleeping && (UseSystemIcons || UseThumbnails))
             WakeupIconCacheThread();
     }
 
     if (iconCacheBackuped && (UseSystemIcons || UseThumbnails)) // wake-up after SortDirectory()
     {
-        if (!oldIconCacheValid ||             // if the icon reading didn't finish
-            oldInactWinOptimizedReading ||    // if only icons from the visible part of the panel were read
-            !transferIconsAndThumbnailsAsNew) // if the listing has changed
+        if (!oldIconCacheValid ||               // if the icon reading didn't finish
+            oldInactWinOptimizedReading ||      // if only icons from the visible part of the panel were read
+            !transferIconsAndThumbnailsAsNew || // if the listing has changed
+            deltaIconsToRead)                   // if there are new or changed items in the listing with the delta
         {
             WakeupIconCacheThread(); // we'll let it read all icons again (we'll show old versions in the meantime)
         }
@@ -91,7 +91,8 @@ void CFilesWindowAncestor::ReleaseListing()
     CALL_STACK_MESSAGE_NONE
 
         ((CFilesWindow*)this)
-            ->VisibleItemsArray.InvalidateArr();
+            ->StopProgressiveListing(); // the rest of the directory would be added to the released listing
+    ((CFilesWindow*)this)->VisibleItemsArray.InvalidateArr();
     ((CFilesWindow*)this)->VisibleItemsArraySurround.InvalidateArr();
     if (OnlyDetachFSListing)
     {
@@ -1400,6 +1401,10 @@ CFilesWindow::CFilesWindow(CMainWindow* parent)
     NeedRefreshAfterIconsReading = FALSE;
     RefreshAfterIconsReadingTime = 0;
 
+    ProgressiveListing = NULL;
+    NeedRefreshAfterListing = FALSE;
+    RefreshAfterListingTime = 0;
+
     PathHistory = new CPathHistory();
 
     DontDrawIndex = -1;
@@ -2391,6 +2396,10 @@ BOOL CFilesWindow::CommonRefresh(HWND parent, int suggestedTopIndex, const char*
         //TRACE_I("refresh listbox: begin");
         RefreshListBox(0, suggestedTopIndex, suggestedFocusIndex, TRUE, !isRefresh);
         //TRACE_I("refresh listbox: end");
+
+        // the item is probably in the part of the directory which is still being read
+        if (suggestedFocusName != NULL && suggestedFocusIndex == -1 && ProgressiveListing != NULL)
+            SetProgressiveListingFocus(suggestedFocusName);
     }
 
     DirectoryLine->InvalidateIfNeeded();
@@ -17,6 +17,8 @@
 #include "snooper.h"
 #include "zip.h"
 #include "shiconov.h"
+#include "dirwalk.h"
+#include "dirsize.h"
 
 //
 // ****************************************************************************
@@ -51,6 +53,647 @@ BOOL IsFilePlaceholder(WIN32_FIND_DATA const* findData)
            (findData->dwReserved0 == IO_REPARSE_TAG_FILE_PLACEHOLDER);
 }
 
+// state of reading a disk directory shared by ReadDirectory() and ReadDirectoryBatch()
+struct CDiskListingContext
+{
+    CListingReader* Reader; // items read by the thread reading the directory (NULL = none)
+    CIconSizeEnum IconSize; // icon size for IconCache
+    BOOL ReadThumbnails;    // TRUE = thumbnails of the files are loaded
+    // plugins which can load thumbnails (for optimization)
+    TIndirectArray<CPluginData> ThumbLoaderPlugins;
+    // the array for plugins which can load thumbnails for the current file
+    TIndirectArray<CPluginData> FoundThumbLoaderPlugins;
+    BOOL IsRootPath;
+    BOOL TestShares; // FALSE = network drive (we do not bother it with getting shares)
+#ifndef _WIN64
+    BOOL IsWindows64BitDir;
+    BOOL IsWin64RedirectedDir; // TRUE = a win64 redirected-dir is being added
+#endif                         // _WIN64
+    BOOL UpDir;                // ".." should be in the listing
+    BOOL UNCRootUpDir;         // ".." from the root of UNC path (leads to the Network plugin)
+    BOOL DirSizes;             // TRUE = DirSizeCache contains sizes of some subdirectories
+    char Path[MAX_PATH + 4];   // path of the directory with mask "*" (for FindFirstFile)
+    CFileData File;            // the added item, members which are not changed later are initialized
+    CIconData IconData;
+
+    // only for the progressive listing (after ReadDirectory() returned)
+    int ThrobberID;           // throbber in the directory line shown while the directory is read
+    BOOL TimerSet;            // TRUE = IDT_LISTINGBATCH is running (the next batch waits)
+    char FocusName[MAX_PATH]; // name of the item which should be focused when it is read ("" = none)
+    int FocusIndex;           // focus after the last batch (another focus = the user moved it)
+
+    CDiskListingContext() : ThumbLoaderPlugins(10, 10, dtNoDelete), FoundThumbLoaderPlugins(10, 10, dtNoDelete)
+    {
+        Reader = NULL;
+        DirSizes = FALSE;
+        ThrobberID = -1;
+        TimerSet = FALSE;
+        FocusName[0] = 0;
+        FocusIndex = -1;
+    }
+    ~CDiskListingContext()
+    {
+        if (Reader != NULL)
+        {
+            Reader->Cancel(); // the thread reading the directory finishes at its next item
+            Reader->Release();
+        }
+    }
+};
+
+// data of the thread reading a disk directory
+struct CListingReaderThreadData
+{
+    CListingReader* Reader;
+    char Path[MAX_PATH + 4]; // path of the directory with mask "*"
+};
+
+// reads directory 'path' (with mask "*") into 'reader' until the end of the listing or until
+// the panel cancels the reading
+void ReadListing(CListingReader* reader, const char* path)
+{
+    WIN32_FIND_DATA fileData;
+    HANDLE search = HANDLES_Q(FindFirstFile(path, &fileData));
+    if (search == INVALID_HANDLE_VALUE)
+    {
+        reader->Finish(GetLastError(), TRUE);
+        return;
+    }
+    DWORD err = NO_ERROR;
+    while (!reader->IsCancelled())
+    {
+        if (!reader->Add(fileData.cFileName, (int)strlen(fileData.cFileName),
+                         fileData.cAlternateFileName[0] != 0 ? fileData.cAlternateFileName : NULL,
+                         (int)strlen(fileData.cAlternateFileName), fileData.dwFileAttributes,
+                         CQuadWord(fileData.nFileSizeLow, fileData.nFileSizeHigh).Value,
+                         fileData.ftLastWriteTime.dwLowDateTime, fileData.ftLastWriteTime.dwHighDateTime,
+                         fileData.dwReserved0))
+        {
+            err = ERROR_NOT_ENOUGH_MEMORY;
+            break;
+        }
+        if (!FindNextFile(search, &fileData))
+        {
+            err = GetLastError();
+            if (err == ERROR_NO_MORE_FILES)
+                err = NO_ERROR;
+            break;
+        }
+    }
+    HANDLES(FindClose(search));
+    reader->Finish(err, FALSE);
+}
+
+unsigned ListingReaderThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("ListingReaderThreadBody()");
+    SetThreadNameInVCAndTrace("ListingReader");
+    CListingReaderThreadData* data = (CListingReaderThreadData*)param;
+    ReadListing(data->Reader, data->Path);
+    data->Reader->Release();
+    delete data;
+    return 0;
+}
+
+unsigned ListingReaderThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return ListingReaderThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread ListingReader: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // a harder exit (this one still calls something)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI ListingReaderThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return ListingReaderThreadEH(param);
+}
+
+// notification of the panel (its HWND is 'param') from the thread reading the directory
+void PostListingBatch(void* param)
+{
+    PostMessage((HWND)param, WM_USER_LISTINGBATCH, 0, 0);
+}
+
+// fills 'fileData' with the read item (only the members used by ReadDirectory)
+void ListingItemToFindData(const CListingReadItem* item, WIN32_FIND_DATA* fileData)
+{
+    fileData->dwFileAttributes = item->Attr;
+    fileData->nFileSizeLow = (DWORD)item->Size;
+    fileData->nFileSizeHigh = (DWORD)(item->Size >> 32);
+    fileData->ftLastWriteTime.dwLowDateTime = item->LastWriteLow;
+    fileData->ftLastWriteTime.dwHighDateTime = item->LastWriteHigh;
+    fileData->dwReserved0 = item->ReparseTag;
+    fileData->dwReserved1 = 0;
+    memcpy(fileData->cFileName, item->GetName(), item->NameLen + 1);
+    memcpy(fileData->cAlternateFileName, item->GetDosName(), item->DosNameLen + 1);
+}
+
+BOOL CFilesWindow::SkipDiskListingItem(CDiskListingContext* ctx, const WIN32_FIND_DATA* fileData)
+{
+    const char* st = fileData->cFileName;
+    int len = (int)strlen(st);
+    BOOL isDir = (fileData->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    BOOL isUpDir = (len == 2 && *st == '.' && *(st + 1) == '.');
+    //--- handling of "." and ".." and hidden/system files (file "." is not ignored, FLAME spyware uses these files, so let them be visible)
+    if (len == 0 || len == 1 && *st == '.' && isDir ||
+        ((ctx->IsRootPath || !isDir ||
+          CQuadWord(fileData->ftLastWriteTime.dwLowDateTime, // date on ".." is older or equal to 1.1.1980, we better read it later "properly"
+                    fileData->ftLastWriteTime.dwHighDateTime) <= CQuadWord(2148603904, 27846551)) &&
+         isUpDir))
+        return TRUE;
+
+    if (Configuration.NotHiddenSystemFiles &&
+        !IsFilePlaceholder(fileData) && // placeholder is hidden, but Explorer shows it normally, so we will show it normally too
+        (fileData->dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) &&
+        (len != 2 || *st != '.' || *(st + 1) != '.'))
+    { // skip hidden/system file/directory
+        if (isDir)
+            HiddenDirsCount++;
+        else
+            HiddenFilesCount++;
+        HiddenDirsFilesReason |= HIDDEN_REASON_ATTRIBUTE;
+        return TRUE;
+    }
+    //--- applying filter to files
+    if (FilterEnabled && !isDir)
+    {
+        const char* ext = fileData->cFileName + len;
+        while (--ext >= fileData->cFileName && *ext != '.')
+            ;
+        if (ext < fileData->cFileName)
+            ext = fileData->cFileName + len; // ".cvspass" in Windows is an extension ...
+        else
+            ext++;
+        if (!Filter.AgreeMasks(fileData->cFileName, ext))
+        {
+            HiddenFilesCount++;
+            HiddenDirsFilesReason |= HIDDEN_REASON_FILTER;
+            return TRUE;
+        }
+    }
+
+    //--- if the name is occupied in the array HiddenNames, we will discard it
+    if (HiddenNames.Contains(isDir, fileData->cFileName))
+    {
+        if (isDir)
+            HiddenDirsCount++;
+        else
+            HiddenFilesCount++;
+        HiddenDirsFilesReason |= HIDDEN_REASON_HIDECMD;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+BOOL CFilesWindow::AddDiskListingItem(CDiskListingContext* ctx, WIN32_FIND_DATA* fileData)
+{
+    CFileData& file = ctx->File;
+    CIconData& iconData = ctx->IconData;
+    char* st = fileData->cFileName;
+    int len = (int)strlen(st);
+    BOOL isUpDir = (len == 2 && *st == '.' && *(st + 1) == '.');
+    BOOL addtoIconCache;
+    const char* s = NULL;
+
+    //--- name
+    CFilesArray* targetArr; // the array the item goes to, its names are allocated in its arena
+    targetArr = (fileData->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? Dirs : Files; // this is ptDisk
+    file.Name = targetArr->AllocName(st, len); // allocation
+    if (file.Name == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    file.NameLen = len;
+    //--- extension
+    if (!Configuration.SortDirsByExt && (fileData->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) // this is ptDisk
+    {
+        file.Ext = file.Name + file.NameLen; // directories have no extension
+    }
+    else
+    {
+        s = st + len;
+        while (--s >= st && *s != '.')
+            ;
+        if (s >= st)
+            file.Ext = file.Name + (s - st + 1); // ".cvspass" in Windows is an extension ...
+                                                 //          if (s > st) file.Ext = file.Name + (s - st + 1);
+        else
+            file.Ext = file.Name + file.NameLen;
+    }
+    //--- others
+    file.Size = CQuadWord(fileData->nFileSizeLow, fileData->nFileSizeHigh);
+    file.Attr = fileData->dwFileAttributes;
+    file.LastWrite = fileData->ftLastWriteTime;
+    file.SizeValid = 0;
+    if (ctx->DirSizes && !isUpDir && (file.Attr & FILE_ATTRIBUTE_DIRECTORY)) // this is ptDisk
+    {                                                                         // size calculated earlier, the directory has not changed since
+        CDirSizeTotals totals;
+        if (DirSizeCache.GetTotals(GetPath(), st, &file.LastWrite, &totals))
+        {
+            file.Size = totals.Size;
+            file.SizeValid = 1;
+        }
+    }
+    // placeholder is hidden, but Explorer shows it normally, so we will show it normally too (without ghosted icon)
+    file.Hidden = (file.Attr & FILE_ATTRIBUTE_HIDDEN) && !IsFilePlaceholder(fileData) ? 1 : 0;
+
+    file.IsOffline = !isUpDir && (file.Attr & FILE_ATTRIBUTE_OFFLINE) ? 1 : 0;
+    if (ctx->TestShares && (file.Attr & FILE_ATTRIBUTE_DIRECTORY)) // this is ptDisk
+    {
+        file.Shared = Shares.Search(file.Name);
+    }
+    else
+        file.Shared = 0;
+
+    if (fileData->cAlternateFileName[0] != 0)
+    {
+        file.DosName = targetArr->AllocName(fileData->cAlternateFileName, (int)strlen(fileData->cAlternateFileName));
+        if (file.DosName == NULL)
+        {
+            targetArr->FreeName(file.Name);
+            TRACE_E(LOW_MEMORY);
+            return FALSE;
+        }
+    }
+    else
+        file.DosName = NULL;
+    if (file.Attr & FILE_ATTRIBUTE_DIRECTORY) // this is ptDisk
+    {
+        file.Association = 0;
+        file.Archive = 0;
+#ifndef _WIN64
+        file.IsLink = (ctx->IsWin64RedirectedDir || (fileData->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) || // CAUTION: pseudo-directory must have IsLink set, otherwise ContainsWin64RedirectedDir must be changed
+                       ctx->IsWindows64BitDir && file.NameLen == 8 && StrICmp(file.Name, "system32") == 0)
+                          ? 1
+                          : 0; // system32 directory in 32-bit Salamander is link to SysWOW64 + win64 redirected-dir + volume mount point or junction point = show directory with link overlay
+#else                          // _WIN64
+        file.IsLink = (fileData->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? 1 : 0; // volume mount point or junction point = show directory with link overlay
+#endif                         // _WIN64
+        if (isUpDir)
+        { // handling ".."
+            if (GetPath()[3] != 0 &&                                                          // except of root...
+                (Dirs->Count == 0 || Dirs->At(0).NameLen != 2 || strcmp(Dirs->At(0).Name, "..") != 0)) // ...and of ".." added when the progressive listing started
+            {
+                Dirs->Insert(0, file);
+            }
+            else
+            {
+                if (file.Name != NULL)
+                    Dirs->FreeName(file.Name);
+                if (file.DosName != NULL)
+                    Dirs->FreeName(file.DosName);
+            }
+            addtoIconCache = FALSE;
+        }
+        else
+        {
+            Dirs->Add(file);
+#ifndef _WIN64
+            addtoIconCache = ctx->IsWin64RedirectedDir ? FALSE : TRUE;
+#else  // _WIN64
+            addtoIconCache = TRUE;
+#endif // _WIN64
+        }
+        if (!Dirs->IsGood())
+        {
+            Dirs->ResetState();
+            return FALSE;
+        }
+    }
+    else
+    {
+        if (s >= st) // an extension exists
+        {
+            while (*++s != 0)
+                *st++ = LowerCase[*s];
+            *(DWORD*)st = 0;          // zeroes to the end
+            st = fileData->cFileName; // lowercase extension
+
+            if (fileData->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+                file.IsLink = 1; // if the file is reparse-point (maybe it's not possible at all) = show it with link overlay
+            else
+            {
+                file.IsLink = (*(DWORD*)st == *(DWORD*)"lnk" ||
+                               *(DWORD*)st == *(DWORD*)"pif" ||
+                               *(DWORD*)st == *(DWORD*)"url")
+                                  ? 1
+                                  : 0;
+            }
+
+            if (PackerFormatConfig.PackIsArchive(file.Name, file.NameLen)) // is it an archive which we can process?
+            {
+                file.Association = 1;
+                file.Archive = 1;
+                addtoIconCache = FALSE;
+            }
+            else
+            {
+                file.Association = Associations.IsAssociated(st, addtoIconCache, ctx->IconSize);
+                file.Archive = 0;
+                if (*(DWORD*)st == *(DWORD*)"scr" || // few exceptions
+                    *(DWORD*)st == *(DWORD*)"pif")
+                {
+                    addtoIconCache = TRUE;
+                }
+                else
+                {
+                    if (*(DWORD*)st == *(DWORD*)"lnk") // icons via link
+                    {
+                        strcpy(fileData->cFileName, file.Name);
+                        char* ext2 = strrchr(fileData->cFileName, '.');
+                        if (ext2 != NULL) // ".cvspass" in Windows is an extesion
+                                          //                  if (ext2 != NULL && ext2 != fileData->cFileName)
+                        {
+                            *ext2 = 0;
+                            if (PackerFormatConfig.PackIsArchive(fileData->cFileName)) // is it a link to archive which we can process?
+                            {
+                                file.Association = 1;
+                                file.Archive = 1;
+                                addtoIconCache = FALSE;
+                            }
+                        }
+                        addtoIconCache = TRUE;
+                    }
+                }
+            }
+        }
+        else
+        {
+            file.Association = 0;
+            file.Archive = 0;
+            file.IsLink = (fileData->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? 1 : 0; // if the file is reparse-point (maybe it's not possible at all) = show it with link overlay
+            addtoIconCache = FALSE;
+        }
+
+        Files->Add(file);
+        if (!Files->IsGood())
+        {
+            Files->ResetState();
+            return FALSE;
+        }
+    }
+
+    // at the file, we will check if it's necessary to load its thumbnail
+    if (ctx->ReadThumbnails &&                         // thumbnail should be loaded
+        (file.Attr & FILE_ATTRIBUTE_DIRECTORY) == 0 && // (it is ptDisk, so using FILE_ATTRIBUTE_DIRECTORY is o.k.)
+        file.Archive == 0)                             // archive icon is preferred before thumbnail
+    {
+        TIndirectArray<CPluginData>& thumbLoaderPlugins = ctx->ThumbLoaderPlugins;
+        TIndirectArray<CPluginData>& foundThumbLoaderPlugins = ctx->FoundThumbLoaderPlugins;
+        foundThumbLoaderPlugins.DestroyMembers();
+        int i;
+        for (i = 0; i < thumbLoaderPlugins.Count; i++)
+        {
+            CPluginData* p = thumbLoaderPlugins[i];
+            if (p->ThumbnailMasks.AgreeMasks(file.Name, file.Ext) &&
+                !p->ThumbnailMasksDisabled) // its unload/remove is not in progress
+            {
+                if (!p->GetLoaded()) // plugin needs to be loaded (possible change of mask for "thumbnail loader")
+                {
+                    //                RefreshListBox(0, -1, -1, FALSE, FALSE); // replaced with ListBox->SetItemsCound + WM_USER_UPDATEPANEL, because it was blinking e.g. when adding the first *.doc file to a directory with images (Eroiica is loaded (for thumbnail *.doc))
+
+                    // displaying "PictureView is not registered" dialog may occur -> in that case it's necessary
+                    // to refresh listbox (otherwise we don't do any refresh, so that it doesn't blink with the panel)
+                    // we protect listbox against errors caused by request for refresh (data is just being read from disk)
+                    ListBox->SetItemsCount(0, 0, 0, TRUE); // TRUE - we will disable setting scrollbar
+                    // If WM_USER_UPDATEPANEL is delivered, the panel will be redrawn and scrollbar will be set.
+                    // Message loop can deliver it when message box (or dialog) is created.
+                    // Otherwise the panel will behave as unchanged and the message will be removed from queue.
+                    PostMessage(HWindow, WM_USER_UPDATEPANEL, 0, 0);
+
+                    BOOL cont = FALSE;
+                    if (p->InitDLL(HWindow, FALSE, TRUE, FALSE) &&  // plugin loaded successfully
+                        p->ThumbnailMasks.GetMasksString()[0] != 0) // plugin is still "thumbnail loader"
+                    {
+                        if (!p->ThumbnailMasks.AgreeMasks(file.Name, file.Ext) || // it can't do thumbnail for this file anymore
+                            p->ThumbnailMasksDisabled)                            // its unload/remove is in progress
+                        {
+                            cont = TRUE;
+                        }
+                    }
+                    else // can't load -> we will remove it from the list of probed plugins (prevent from repeating error messages)
+                    {
+                        TRACE_I("Unable to use plugin " << p->Name << " as thumbnail loader.");
+                        thumbLoaderPlugins.Delete(i);
+                        ctx->ReadThumbnails = thumbLoaderPlugins.Count > 0;
+                        if (!thumbLoaderPlugins.IsGood())
+                            thumbLoaderPlugins.ResetState();
+                        else
+                            i--;
+                        cont = TRUE; // let's try our luck with another plugin
+                    }
+
+                    // cleanup message-queue from buffered WM_USER_UPDATEPANEL
+                    MSG msg2;
+                    PeekMessage(&msg2, HWindow, WM_USER_UPDATEPANEL, WM_USER_UPDATEPANEL, PM_REMOVE);
+
+                    if (cont)
+                        continue;
+                }
+
+                foundThumbLoaderPlugins.Add(p);
+            }
+        }
+        if (foundThumbLoaderPlugins.IsGood())
+        {
+            if (foundThumbLoaderPlugins.Count > 0)
+            {
+                int size = len + 4;
+                size -= (size & 0x3); // size % 4 (alignment per four bytes)
+                int nameSize = size;
+                size += sizeof(CQuadWord) + sizeof(FILETIME);
+                size += (foundThumbLoaderPlugins.Count + 1) * sizeof(void*); // space for pointers to plugin interfaces + NULL at the end
+                iconData.NameAndData = (char*)malloc(size);
+                if (iconData.NameAndData != NULL)
+                {
+                    memcpy(iconData.NameAndData, file.Name, len);
+                    memset(iconData.NameAndData + len, 0, nameSize - len); // end of name is zeroed
+                    // size is added + time of last write to file
+                    *(CQuadWord*)(iconData.NameAndData + nameSize) = file.Size;
+                    *(FILETIME*)(iconData.NameAndData + nameSize + sizeof(CQuadWord)) = file.LastWrite;
+                    // add list of pointers to encapsulation of plugin interfaces for getting thumbnails
+                    void** ifaces = (void**)(iconData.NameAndData + nameSize + sizeof(CQuadWord) + sizeof(FILETIME));
+                    int i2;
+                    for (i2 = 0; i2 < foundThumbLoaderPlugins.Count; i2++)
+                    {
+                        *ifaces++ = foundThumbLoaderPlugins[i2]->GetPluginInterfaceForThumbLoader();
+                    }
+                    *ifaces = NULL;      // the end of list of plugin interfaces
+                    iconData.SetFlag(4); // so far no unread thumbnail
+
+                    // we have to allocate space for thumbnail, because it can't be done in the thread
+                    iconData.SetIndex(IconCache->AllocThumbnail());
+
+                    if (iconData.GetIndex() != -1)
+                    {
+                        IconCache->Add(iconData);
+                        if (!IconCache->IsGood())
+                        {
+                            free(iconData.NameAndData);
+                            IconCache->ResetState();
+                        }
+                        else
+                            addtoIconCache = FALSE; // it's a thumbnail, it can't be an icon at the same time
+                    }
+                    else
+                        free(iconData.NameAndData);
+                }
+            }
+        }
+        else
+            foundThumbLoaderPlugins.ResetState();
+    }
+
+    // adding directory to IconCache -> we need to load icon
+    if (UseSystemIcons && addtoIconCache)
+    {
+        int size = len + 4;
+        size -= (size & 0x3); // size % 4 (alignment per four bytes)
+        iconData.NameAndData = (char*)malloc(size);
+        if (iconData.NameAndData != NULL)
+        {
+            memmove(iconData.NameAndData, file.Name, len);
+            memset(iconData.NameAndData + len, 0, size - len); // end of name is zeroed
+            iconData.SetFlag(0);                               // no not-loaded icon yet
+                                                               // need to allocate space for bitmaps, can't be done in thread
+            iconData.SetIndex(IconCache->AllocIcon(NULL, NULL));
+            if (iconData.GetIndex() != -1)
+            {
+                IconCache->Add(iconData);
+                if (!IconCache->IsGood())
+                {
+                    free(iconData.NameAndData);
+                    IconCache->ResetState();
+                }
+            }
+            else
+                free(iconData.NameAndData);
+        }
+    }
+    return TRUE;
+}
+
+BOOL CFilesWindow::AddDiskListingUpDir(CDiskListingContext* ctx)
+{
+    if (!ctx->UpDir || Dirs->Count > 0 && strcmp(Dirs->At(0).Name, "..") == 0)
+        return TRUE;
+    ctx->UpDir = FALSE;
+    WIN32_FIND_DATA fileData;
+    char path[MAX_PATH + 4];
+    strcpy(path, ctx->Path);
+    *(path + strlen(path) - 2) = 0; // it's not logical, but times ".." are from current directory
+    HANDLE search;
+    if (!ctx->UNCRootUpDir)
+        search = HANDLES_Q(FindFirstFile(path, &fileData));
+    else
+        search = INVALID_HANDLE_VALUE;
+    if (search == INVALID_HANDLE_VALUE)
+    {
+        fileData.dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY; // this is ptDisk
+        SYSTEMTIME ltNone;
+        ltNone.wYear = 1602;
+        ltNone.wMonth = 1;
+        ltNone.wDay = 1;
+        ltNone.wDayOfWeek = 2;
+        ltNone.wHour = 0;
+        ltNone.wMinute = 0;
+        ltNone.wSecond = 0;
+        ltNone.wMilliseconds = 0;
+        FILETIME ft;
+        SystemTimeToFileTime(&ltNone, &ft);
+        LocalFileTimeToFileTime(&ft, &fileData.ftCreationTime);
+        LocalFileTimeToFileTime(&ft, &fileData.ftLastAccessTime);
+        LocalFileTimeToFileTime(&ft, &fileData.ftLastWriteTime);
+
+        fileData.nFileSizeHigh = 0;
+        fileData.nFileSizeLow = 0;
+        fileData.dwReserved0 = fileData.dwReserved1 = 0;
+    }
+    else
+        HANDLES(FindClose(search));
+    fileData.dwFileAttributes |= FILE_ATTRIBUTE_DIRECTORY;      // this is ptDisk
+    fileData.dwFileAttributes &= ~FILE_ATTRIBUTE_REPARSE_POINT; // need to remove flag FILE_ATTRIBUTE_REPARSE_POINT, otherwise link overlay will be on ".."
+    strcpy(fileData.cFileName, "..");
+    fileData.cAlternateFileName[0] = 0;
+    return AddDiskListingItem(ctx, &fileData);
+}
+
+#ifndef _WIN64
+
+BOOL CFilesWindow::AddDiskListingRedirectedDirs(CDiskListingContext* ctx, BOOL* added)
+{
+    *added = FALSE;
+    WIN32_FIND_DATA fileData;
+    int foundWin64RedirectedDirs = 0;
+    BOOL dirWithSameNameExists;
+    while (foundWin64RedirectedDirs < 10 &&
+           AddWin64RedirectedDir(GetPath(), Dirs, &fileData, &foundWin64RedirectedDirs, &dirWithSameNameExists))
+    {
+        foundWin64RedirectedDirs++; // e.g. under system32 there can be 5, I've added some reserve to 10...
+        *added = TRUE;              // AddWin64RedirectedDir() could also remove a directory with the same name
+
+        if (Configuration.NotHiddenSystemFiles &&
+            (fileData.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)))
+        { // skip hidden directory
+            if (!dirWithSameNameExists)
+            {
+                HiddenDirsCount++;
+                HiddenDirsFilesReason |= HIDDEN_REASON_ATTRIBUTE;
+            }
+            continue;
+        }
+
+        //--- if the name is occupied in the array HiddenNames, we will discard it
+        if (HiddenNames.Contains(TRUE, fileData.cFileName))
+        {
+            if (!dirWithSameNameExists)
+            {
+                HiddenDirsCount++;
+                HiddenDirsFilesReason |= HIDDEN_REASON_HIDECMD;
+            }
+            continue;
+        }
+
+        ctx->IsWin64RedirectedDir = TRUE;
+        BOOL ret = AddDiskListingItem(ctx, &fileData);
+        ctx->IsWin64RedirectedDir = FALSE;
+        if (!ret)
+            return FALSE;
+    }
+    if (foundWin64RedirectedDirs >= 10)
+        TRACE_E("CFilesWindow::AddDiskListingRedirectedDirs(): foundWin64RedirectedDirs >= 10 (there are more redirected-dirs?)");
+    return TRUE;
+}
+
+#endif // _WIN64
+
+void CFilesWindow::ClearDiskListing()
+{
+    SetCurrentDirectoryToSystem();
+    Files->DestroyMembers();
+    Dirs->DestroyMembers();
+    Files->SetNamesInArena(FALSE); // the next listing need not be a disk one (see ReadDirectory)
+    Dirs->SetNamesInArena(FALSE);
+    VisibleItemsArray.InvalidateArr();
+    VisibleItemsArraySurround.InvalidateArr();
+    DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
+}
+
 BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
 {
     CALL_STACK_MESSAGE1("CFilesWindow::ReadDirectory()");
@@ -58,6 +701,7 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
     //  TRACE_I("ReadDirectory: begin");
 
     //  MainWindow->ReleaseMenuNew();  // in case of it's about this directory
+    StopProgressiveListing(); // the rest of the previous directory will not be read
     HiddenDirsFilesReason = 0;
     HiddenDirsCount = HiddenFilesCount = 0;
 
@@ -68,6 +712,8 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
     UseThumbnails = FALSE;
     Files->DestroyMembers();
     Dirs->DestroyMembers();
+    Files->SetNamesInArena(FALSE); // only the disk listing below uses the arena, archives and FS give their own names
+    Dirs->SetNamesInArena(FALSE);
     VisibleItemsArray.InvalidateArr();
     VisibleItemsArraySurround.InvalidateArr();
     SelectedCount = 0;
@@ -93,17 +739,19 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
 
     if (Is(ptDisk))
     {
+        CDiskListingContext* ctx = new CDiskListingContext;
+
         // setting icon size for IconCache
-        CIconSizeEnum iconSize = GetIconSizeForCurrentViewMode();
-        IconCache->SetIconSize(iconSize);
+        ctx->IconSize = GetIconSizeForCurrentViewMode();
+        IconCache->SetIconSize(ctx->IconSize);
 
-        BOOL readThumbnails = (GetViewMode() == vmThumbnails);
+        ctx->ReadThumbnails = (GetViewMode() == vmThumbnails);
 
         CALL_STACK_MESSAGE1("CFilesWindow::ReadDirectory::disk1");
         // choosing plugins which can load thumbnails (for optimization)
-        TIndirectArray<CPluginData> thumbLoaderPlugins(10, 10, dtNoDelete);
-        TIndirectArray<CPluginData> foundThumbLoaderPlugins(10, 10, dtNoDelete); // the array for plugins which can load thumbnails for the current file
-        if (readThumbnails)
+        TIndirectArray<CPluginData>& thumbLoaderPlugins = ctx->ThumbLoaderPlugins;
+        TIndirectArray<CPluginData>& foundThumbLoaderPlugins = ctx->FoundThumbLoaderPlugins; // the array for plugins which can load thumbnails for the current file
+        if (ctx->ReadThumbnails)
         {
             if (thumbLoaderPlugins.IsGood())
                 Plugins.AddThumbLoaderPlugins(thumbLoaderPlugins);
@@ -115,21 +763,24 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
                     thumbLoaderPlugins.ResetState();
                 if (!foundThumbLoaderPlugins.IsGood())
                     foundThumbLoaderPlugins.ResetState();
-                readThumbnails = FALSE;
+                ctx->ReadThumbnails = FALSE;
             }
         }
-        UseThumbnails = readThumbnails;
+        UseThumbnails = ctx->ReadThumbnails;
 
         SetCurrentDirectory(GetPath()); // so that it works better
 
 #ifndef _WIN64
-        BOOL isWindows64BitDir = Windows64Bit && WindowsDirectory[0] != 0 && IsTheSamePath(GetPath(), WindowsDirectory);
+        ctx->IsWindows64BitDir = Windows64Bit && WindowsDirectory[0] != 0 && IsTheSamePath(GetPath(), WindowsDirectory);
+        ctx->IsWin64RedirectedDir = FALSE;
 #endif // _WIN64
 
         RefreshDiskFreeSpace(FALSE);
 
         Files->SetDeleteData(TRUE);
         Dirs->SetDeleteData(TRUE);
+        Files->SetNamesInArena(TRUE); // names of a large directory would mean a huge number of small allocations
+        Dirs->SetNamesInArena(TRUE);
 
         if (WaitForESCReleaseBeforeTestingESC) // waiting for ESC release (so that listing is not interrupted
                                                // immediately - this ESC probably ended modal dialog/messagebox)
@@ -141,12 +792,12 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
         GetAsyncKeyState(VK_ESCAPE); // init GetAsyncKeyState - see help
 
         GetRootPath(fileName, GetPath());
-        BOOL isRootPath = (strlen(GetPath()) <= strlen(fileName));
+        ctx->IsRootPath = (strlen(GetPath()) <= strlen(fileName));
 
         //--- getting drive type (we will not bother network drives with getting shares)
         UINT drvType = MyGetDriveType(GetPath());
-        BOOL testShares = drvType != DRIVE_REMOTE;
-        if (testShares)
+        ctx->TestShares = drvType != DRIVE_REMOTE;
+        if (ctx->TestShares)
             Shares.PrepareSearch(GetPath());
         switch (drvType)
         {
@@ -189,6 +840,7 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
             *st++ = *s++;
         if (s == GetPath())
         {
+            delete ctx;
             SetCurrentDirectoryToSystem();
             DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
             //      TRACE_I("ReadDirectory: end");
@@ -197,7 +849,7 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
         if (*(st - 1) != '\\')
             *st++ = '\\';
         strcpy(st, "*");
-        char* fileNameEnd = st;
+        strcpy(ctx->Path, fileName);
         //--- preparing for reading icons
         if (UseSystemIcons)
         {
@@ -209,8 +861,8 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
             int i;
             for (i = 0; i < Associations.Count; i++)
             {
-                if (Associations[i].GetIndex(iconSize) == -3)
-                    Associations[i].SetIndex(-1, iconSize); // removing the flag "loaded icon"
+                if (Associations[i].GetIndex(ctx->IconSize) == -3)
+                    Associations[i].SetIndex(-1, ctx->IconSize); // removing the flag "loaded icon"
             }
         }
         else
@@ -224,13 +876,12 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
             }
         }
         //--- reading directory content
-        BOOL upDir;
-        BOOL UNCRootUpDir = FALSE;
+        ctx->UNCRootUpDir = FALSE;
         if (GetPath()[0] == '\\' && GetPath()[1] == '\\')
         {
             if (GetPath()[2] == '.' && GetPath()[3] == '\\' && GetPath()[4] != 0 && GetPath()[5] == ':') // "\\.\C:\" type path
             {
-                upDir = strlen(GetPath()) > 7;
+                ctx->UpDir = strlen(GetPath()) > 7;
             }
             else // UNC path
             {
@@ -241,37 +892,31 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
                     s2++;
                 while (*s2 != 0 && *s2 != '\\')
                     s2++;
-                upDir = (*s2 == '\\' && *(s2 + 1) != 0);
-                if (!upDir && Plugins.GetFirstNethoodPluginFSName())
+                ctx->UpDir = (*s2 == '\\' && *(s2 + 1) != 0);
+                if (!ctx->UpDir && Plugins.GetFirstNethoodPluginFSName())
                 {
-                    upDir = TRUE;
-                    UNCRootUpDir = TRUE;
+                    ctx->UpDir = TRUE;
+                    ctx->UNCRootUpDir = TRUE;
                 }
             }
         }
         else
-            upDir = strlen(GetPath()) > 3;
+            ctx->UpDir = strlen(GetPath()) > 3;
 
         CALL_STACK_MESSAGE1("CFilesWindow::ReadDirectory::disk2");
 
-        CIconData iconData;
-        iconData.FSFileData = NULL;
-        iconData.SetReadingDone(0); // just for the form
-        BOOL addtoIconCache;
-        CFileData file;
+        ctx->DirSizes = Configuration.CacheDirSizes && DirSizeCache.HasSubdirsOf(GetPath());
+
+        ctx->IconData.FSFileData = NULL;
+        ctx->IconData.SetReadingDone(0); // just for the form
+        CFileData& file = ctx->File;
         // inicialization of structure members which will not be changed later
         file.PluginData = -1; // -1 just like that, ignored
         file.Selected = 0;
-        file.SizeValid = 0;
         file.Dirty = 0; // unnecessary, just for the form
         file.CutToClip = 0;
         file.IconOverlayIndex = ICONOVERLAYINDEX_NOTUSED;
         file.IconOverlayDone = 0;
-        int len;
-#ifndef _WIN64
-        int foundWin64RedirectedDirs = 0;
-        BOOL isWin64RedirectedDir = FALSE;
-#endif // _WIN64
 
     _TRY_AGAIN:
 
@@ -289,669 +934,229 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
                                            // opened dialog the user switched to Salamander and back,
                                            // so that there was a refresh of the directory)
 
-        BOOL isUpDir = FALSE;
-        WIN32_FIND_DATA fileData;
-        HANDLE search;
-        search = HANDLES_Q(FindFirstFile(fileName, &fileData));
-        if (search == INVALID_HANDLE_VALUE)
+        // the directory is read by a helper thread, this thread takes the read items (they are
+        // handed over in batches, see CListingReader); if the reading takes longer, the part read
+        // so far is shown and the rest is added by ReadDirectoryBatch()
+        DWORD readStart = GetTickCount();
+        ctx->Reader = new CListingReader(PostListingBatch, HWindow);
+        CListingReaderThreadData* data = new CListingReaderThreadData;
+        data->Reader = ctx->Reader;
+        strcpy(data->Path, ctx->Path);
+        ctx->Reader->AddRef(); // for the thread reading the directory
+        DWORD threadID;
+        HANDLE thread = HANDLES(CreateThread(NULL, 0, ListingReaderThread, data, 0, &threadID));
+        if (thread == NULL)
         {
-            DWORD err = GetLastError();
-            DestroySafeWaitWindow();
-            if (err == ERROR_FILE_NOT_FOUND || err == ERROR_NO_MORE_FILES)
-            {
-                if (!upDir)
-                {
-                    StatusLine->SetText(LoadStr(IDS_NOFILESFOUND));
-                    SetCurrentDirectoryToSystem();
-                    DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
-                    if (UseSystemIcons || UseThumbnails) // even though we don't have any icons, we need to start loading them (just to set IconCacheValid = TRUE)
-                    {
-                        if (IconCache->Count > 1)
-                            IconCache->SortArray(0, IconCache->Count - 1, NULL);
-                        WakeupIconCacheThread(); // start loading icons
-                    }
-                    //          TRACE_I("ReadDirectory: end");
-                    return TRUE;
-                }
-            }
-            else
-            {
-                SetCurrentDirectoryToSystem();
-                RefreshListBox(0, -1, -1, FALSE, FALSE);
-                DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
-                DirectoryLine->InvalidateIfNeeded();
-                IdleRefreshStates = TRUE; // we will force checking of states of variables at the next Idle
-                StatusLine->SetText("");
-                UpdateWindow(HWindow);
-
-                BOOL showErr = TRUE;
-                if (err == ERROR_INVALID_PARAMETER || err == ERROR_NOT_READY)
-                {
-                    DWORD attrs = SalGetFileAttributes(GetPath());
-                    if (attrs != INVALID_FILE_ATTRIBUTES &&
-                        (attrs & FILE_ATTRIBUTE_DIRECTORY) &&
-                        (attrs & FILE_ATTRIBUTE_REPARSE_POINT))
-                    {
-                        showErr = FALSE;
-                        char drive[MAX_PATH];
-                        UINT drvType2;
-                        if (GetPath()[0] == '\\' && GetPath()[1] == '\\')
-                        {
-                            drvType2 = DRIVE_REMOTE;
-                            GetRootPath(drive, GetPath());
-                            drive[strlen(drive) - 1] = 0; // we don't want the last '\\'
-                        }
-                        else
-                        {
-                            drive[0] = GetPath()[0];
-                            drive[1] = 0;
-                            drvType2 = MyGetDriveType(GetPath());
-                        }
-                        if (drvType2 != DRIVE_REMOTE)
-                        {
-                            GetCurrentLocalReparsePoint(GetPath(), CheckPathRootWithRetryMsgBox);
-                            if (strlen(CheckPathRootWithRetryMsgBox) > 3)
-                            {
-                                lstrcpyn(drive, CheckPathRootWithRetryMsgBox, MAX_PATH);
-                                SalPathRemoveBackslash(drive);
-                            }
-                        }
-                        else
-                            GetRootPath(CheckPathRootWithRetryMsgBox, GetPath());
-                        sprintf(buf, LoadStr(IDS_NODISKINDRIVE), drive);
-                        int msgboxRes = (int)CDriveSelectErrDlg(parent, buf, GetPath()).Execute();
-                        CheckPathRootWithRetryMsgBox[0] = 0;
-                        UpdateWindow(MainWindow->HWindow);
-                        if (msgboxRes == IDRETRY)
-                            goto _TRY_AGAIN;
-                    }
-                }
-                if (isRefresh &&
-                    (err == ERROR_ACCESS_DENIED || err == ERROR_PATH_NOT_FOUND ||
-                     err == ERROR_BAD_PATHNAME || err == ERROR_FILE_NOT_FOUND))
-                { // when deleting a path shown in the panel, these errors are shown, which we don't want, we just silently shorten the path to the first existing one (unfortunately it's not caught earlier, because the path exists for some time after its deletion, something in Windows just didn't work out again)
-                    //          TRACE_I("ReadDirectory(): silently ignoring FindFirstFile failure: " << GetErrorText(err));
-                    showErr = FALSE;
-                }
-                if (showErr)
-                    SalMessageBox(parent, GetErrorText(err), LoadStr(IDS_ERRORTITLE), MB_OK | MB_ICONEXCLAMATION);
-                //        TRACE_I("ReadDirectory: end");
-                return FALSE;
-            }
+            TRACE_E("Unable to start ListingReader thread, reading directory in this thread.");
+            ReadListing(data->Reader, data->Path);
+            data->Reader->Release();
+            delete data;
         }
-        else
+
+        WIN32_FIND_DATA fileData;
+        BOOL progressive = FALSE; // TRUE = the rest of the directory is added by ReadDirectoryBatch()
+        BOOL testReadErr = TRUE;  // FALSE = the user interrupted reading, the error is not reported
+        BOOL lowMemory = FALSE;
+        DWORD err = NO_ERROR;
+        BOOL openFailed = FALSE;
+        while (1)
         {
-            BOOL testFindNextErr;
-            testFindNextErr = TRUE;
-            do
+            const CListingReadItem* item;
+            while (!lowMemory && (item = ctx->Reader->GetNext()) != NULL)
             {
                 NumberOfItemsInCurDir++;
+                ListingItemToFindData(item, &fileData);
+                if (!SkipDiskListingItem(ctx, &fileData) && !AddDiskListingItem(ctx, &fileData))
+                    lowMemory = TRUE;
+            }
+            if (lowMemory || ctx->Reader->IsFinished(&err, &openFailed))
+                break;
 
-                // test ESC - doesn't user want to interrupt reading?
-                if (GetTickCount() - lastEscCheckTime >= 200) // 5 times per second
-                {
-                    if (UserWantsToCancelSafeWaitWindow())
-                    {
-                        MSG msg; // remove buffered ESC
-                        while (PeekMessage(&msg, NULL, WM_KEYFIRST, WM_KEYLAST, PM_REMOVE))
-                            ;
-
-                        SetCurrentDirectoryToSystem();
-                        RefreshListBox(0, -1, -1, FALSE, FALSE);
-
-                        int resBut = SalMessageBox(parent, LoadStr(IDS_READDIRTERMINATED), LoadStr(IDS_QUESTION),
-                                                   MB_YESNOCANCEL | MB_ICONQUESTION);
-                        UpdateWindow(MainWindow->HWindow);
-
-                        WaitForESCRelease();
-                        WaitForESCReleaseBeforeTestingESC = FALSE; // another waiting makes no sense
-                        GetAsyncKeyState(VK_ESCAPE);               // new init GetAsyncKeyState - see help
-
-                        if (resBut == IDYES)
-                        {
-                            testFindNextErr = FALSE;
-                            break; // finish reading
-                        }
-                        else
-                        {
-                            if (resBut == IDNO)
-                            {
-                                if (GetMonitorChanges()) // need to suppress monitoring of changes (autorefresh)
-                                {
-                                    DetachDirectory((CFilesWindow*)this);
-                                    SetMonitorChanges(FALSE); // the changes won't be monitored anymore
-                                }
-
-                                SetSuppressAutoRefresh(TRUE);
-                            }
-                        }
-                    }
-                    lastEscCheckTime = GetTickCount();
-                }
-
-                st = fileData.cFileName;
-                len = (int)strlen(st);
-                BOOL isDir;
-                isDir = (fileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-                isUpDir = (len == 2 && *st == '.' && *(st + 1) == '.');
-                //--- handling of "." and ".." and hidden/system files (file "." is not ignored, FLAME spyware uses these files, so let them be visible)
-                if (len == 0 || len == 1 && *st == '.' && isDir ||
-                    ((isRootPath || !isDir ||
-                      CQuadWord(fileData.ftLastWriteTime.dwLowDateTime, // date on ".." is older or equal to 1.1.1980, we better read it later "properly"
-                                fileData.ftLastWriteTime.dwHighDateTime) <= CQuadWord(2148603904, 27846551)) &&
-                     isUpDir))
-                    continue;
-
-                if (Configuration.NotHiddenSystemFiles &&
-                    !IsFilePlaceholder(&fileData) && // placeholder is hidden, but Explorer shows it normally, so we will show it normally too
-                    (fileData.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) &&
-                    (len != 2 || *st != '.' || *(st + 1) != '.'))
-                { // skip hidden/system file/directory
-                    if (isDir)
-                        HiddenDirsCount++;
-                    else
-                        HiddenFilesCount++;
-                    HiddenDirsFilesReason |= HIDDEN_REASON_ATTRIBUTE;
-                    continue;
-                }
-                //--- applying filter to files
-                if (FilterEnabled && !isDir)
-                {
-                    const char* ext = fileData.cFileName + len;
-                    while (--ext >= fileData.cFileName && *ext != '.')
-                        ;
-                    if (ext < fileData.cFileName)
-                        ext = fileData.cFileName + len; // ".cvspass" in Windows is an extension ...
-                    else
-                        ext++;
-                    if (!Filter.AgreeMasks(fileData.cFileName, ext))
-                    {
-                        HiddenFilesCount++;
-                        HiddenDirsFilesReason |= HIDDEN_REASON_FILTER;
-                        continue;
-                    }
-                }
-
-                //--- if the name is occupied in the array HiddenNames, we will discard it
-                if (HiddenNames.Contains(isDir, fileData.cFileName))
-                {
-                    if (isDir)
-                        HiddenDirsCount++;
-                    else
-                        HiddenFilesCount++;
-                    HiddenDirsFilesReason |= HIDDEN_REASON_HIDECMD;
-                    continue;
-                }
-
-            ADD_ITEM: // to add ".."
-
-                //--- name
-                file.Name = (char*)malloc(len + 1); // allocation
-                if (file.Name == NULL)
-                {
-                    if (search != NULL)
-                    {
-                        DestroySafeWaitWindow();
-                        HANDLES(FindClose(search));
-                    }
-                    TRACE_E(LOW_MEMORY);
-                    SetCurrentDirectoryToSystem();
-                    Files->DestroyMembers();
-                    Dirs->DestroyMembers();
-                    VisibleItemsArray.InvalidateArr();
-                    VisibleItemsArraySurround.InvalidateArr();
-                    DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
-                    //          TRACE_I("ReadDirectory: end");
-                    return FALSE;
-                }
-                memmove(file.Name, st, len + 1); // copy of text
-                file.NameLen = len;
-                //--- extension
-                if (!Configuration.SortDirsByExt && (fileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) // this is ptDisk
-                {
-                    file.Ext = file.Name + file.NameLen; // directories have no extension
-                }
-                else
-                {
-                    s = st + len;
-                    while (--s >= st && *s != '.')
-                        ;
-                    if (s >= st)
-                        file.Ext = file.Name + (s - st + 1); // ".cvspass" in Windows is an extension ...
-                                                             //          if (s > st) file.Ext = file.Name + (s - st + 1);
-                    else
-                        file.Ext = file.Name + file.NameLen;
-                }
-                //--- others
-                file.Size = CQuadWord(fileData.nFileSizeLow, fileData.nFileSizeHigh);
-                file.Attr = fileData.dwFileAttributes;
-                file.LastWrite = fileData.ftLastWriteTime;
-                // placeholder is hidden, but Explorer shows it normally, so we will show it normally too (without ghosted icon)
-                file.Hidden = (file.Attr & FILE_ATTRIBUTE_HIDDEN) && !IsFilePlaceholder(&fileData) ? 1 : 0;
-
-                file.IsOffline = !isUpDir && (file.Attr & FILE_ATTRIBUTE_OFFLINE) ? 1 : 0;
-                if (testShares && (file.Attr & FILE_ATTRIBUTE_DIRECTORY)) // this is ptDisk
-                {
-                    file.Shared = Shares.Search(file.Name);
-                }
-                else
-                    file.Shared = 0;
-
-                if (fileData.cAlternateFileName[0] != 0)
-                {
-                    int l = (int)strlen(fileData.cAlternateFileName) + 1;
-                    file.DosName = (char*)malloc(l);
-                    if (file.DosName == NULL)
-                    {
-                        free(file.Name);
-                        if (search != NULL)
-                        {
-                            DestroySafeWaitWindow();
-                            HANDLES(FindClose(search));
-                        }
-                        TRACE_E(LOW_MEMORY);
-                        SetCurrentDirectoryToSystem();
-                        Files->DestroyMembers();
-                        Dirs->DestroyMembers();
-                        VisibleItemsArray.InvalidateArr();
-                        VisibleItemsArraySurround.InvalidateArr();
-                        DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
-                        //            TRACE_I("ReadDirectory: end");
-                        return FALSE;
-                    }
-                    memmove(file.DosName, fileData.cAlternateFileName, l);
-                }
-                else
-                    file.DosName = NULL;
-                if (file.Attr & FILE_ATTRIBUTE_DIRECTORY) // this is ptDisk
-                {
-                    file.Association = 0;
-                    file.Archive = 0;
-#ifndef _WIN64
-                    file.IsLink = (isWin64RedirectedDir || (fileData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) || // CAUTION: pseudo-directory must have IsLink set, otherwise ContainsWin64RedirectedDir must be changed
-                                   isWindows64BitDir && file.NameLen == 8 && StrICmp(file.Name, "system32") == 0)
-                                      ? 1
-                                      : 0; // system32 directory in 32-bit Salamander is link to SysWOW64 + win64 redirected-dir + volume mount point or junction point = show directory with link overlay
-#else                                      // _WIN64
-                    file.IsLink = (fileData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? 1 : 0; // volume mount point or junction point = show directory with link overlay
-#endif                                     // _WIN64
-                    if (len == 2 && *st == '.' && *(st + 1) == '.')
-                    { // handling ".."
-                        if (GetPath()[3] != 0)
-                            Dirs->Insert(0, file); // except of root...
-                        else
-                        {
-                            if (file.Name != NULL)
-                                free(file.Name);
-                            if (file.DosName != NULL)
-                                free(file.DosName);
-                        }
-                        addtoIconCache = FALSE;
-                    }
-                    else
-                    {
-                        Dirs->Add(file);
-#ifndef _WIN64
-                        addtoIconCache = isWin64RedirectedDir ? FALSE : TRUE;
-#else  // _WIN64
-                        addtoIconCache = TRUE;
-#endif // _WIN64
-                    }
-                    if (!Dirs->IsGood())
-                    {
-                        Dirs->ResetState();
-                        if (search != NULL)
-                        {
-                            DestroySafeWaitWindow();
-                            HANDLES(FindClose(search));
-                        }
-                        SetCurrentDirectoryToSystem();
-                        Files->DestroyMembers();
-                        Dirs->DestroyMembers();
-                        VisibleItemsArray.InvalidateArr();
-                        VisibleItemsArraySurround.InvalidateArr();
-                        DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
-                        //            TRACE_I("ReadDirectory: end");
-                        return FALSE;
-                    }
-                }
-                else
-                {
-                    if (s >= st) // an extension exists
-                    {
-                        while (*++s != 0)
-                            *st++ = LowerCase[*s];
-                        *(DWORD*)st = 0;         // zeroes to the end
-                        st = fileData.cFileName; // lowercase extension
-
-                        if (fileData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
-                            file.IsLink = 1; // if the file is reparse-point (maybe it's not possible at all) = show it with link overlay
-                        else
-                        {
-                            file.IsLink = (*(DWORD*)st == *(DWORD*)"lnk" ||
-                                           *(DWORD*)st == *(DWORD*)"pif" ||
-                                           *(DWORD*)st == *(DWORD*)"url")
-                                              ? 1
-                                              : 0;
-                        }
-
-                        if (PackerFormatConfig.PackIsArchive(file.Name, file.NameLen)) // is it an archive which we can process?
-                        {
-                            file.Association = 1;
-                            file.Archive = 1;
-                            addtoIconCache = FALSE;
-                        }
-                        else
-                        {
-                            file.Association = Associations.IsAssociated(st, addtoIconCache, iconSize);
-                            file.Archive = 0;
-                            if (*(DWORD*)st == *(DWORD*)"scr" || // few exceptions
-                                *(DWORD*)st == *(DWORD*)"pif")
-                            {
-                                addtoIconCache = TRUE;
-                            }
-                            else
-                            {
-                                if (*(DWORD*)st == *(DWORD*)"lnk") // icons via link
-                                {
-                                    strcpy(fileData.cFileName, file.Name);
-                                    char* ext2 = strrchr(fileData.cFileName, '.');
-                                    if (ext2 != NULL) // ".cvspass" in Windows is an extesion
-                                                      //                  if (ext2 != NULL && ext2 != fileData.cFileName)
-                                    {
-                                        *ext2 = 0;
-                                        if (PackerFormatConfig.PackIsArchive(fileData.cFileName)) // is it a link to archive which we can process?
-                                        {
-                                            file.Association = 1;
-                                            file.Archive = 1;
-                                            addtoIconCache = FALSE;
-                                        }
-                                    }
-                                    addtoIconCache = TRUE;
-                                }
-                            }
-                        }
-                    }
-                    else
-                    {
-                        file.Association = 0;
-                        file.Archive = 0;
-                        file.IsLink = (fileData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? 1 : 0; // if the file is reparse-point (maybe it's not possible at all) = show it with link overlay
-                        addtoIconCache = FALSE;
-                    }
-
-                    Files->Add(file);
-                    if (!Files->IsGood())
-                    {
-                        Files->ResetState();
-                        if (search != NULL)
-                        {
-                            DestroySafeWaitWindow();
-                            HANDLES(FindClose(search));
-                        }
-                        SetCurrentDirectoryToSystem();
-                        Files->DestroyMembers();
-                        Dirs->DestroyMembers();
-                        VisibleItemsArray.InvalidateArr();
-                        VisibleItemsArraySurround.InvalidateArr();
-                        DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
-                        //            TRACE_I("ReadDirectory: end");
-                        return FALSE;
-                    }
-                }
-
-                // at the file, we will check if it's necessary to load its thumbnail
-                if (readThumbnails &&                              // thumbnail should be loaded
-                    (file.Attr & FILE_ATTRIBUTE_DIRECTORY) == 0 && // (it is ptDisk, so using FILE_ATTRIBUTE_DIRECTORY is o.k.)
-                    file.Archive == 0)                             // archive icon is preferred before thumbnail
+            // test ESC - doesn't user want to interrupt reading?
+            if (GetTickCount() - lastEscCheckTime >= 200) // 5 times per second
+            {
+                if (UserWantsToCancelSafeWaitWindow())
                 {
-                    foundThumbLoaderPlugins.DestroyMembers();
-                    int i;
-                    for (i = 0; i < thumbLoaderPlugins.Count; i++)
-                    {
-                        CPluginData* p = thumbLoaderPlugins[i];
-                        if (p->ThumbnailMasks.AgreeMasks(file.Name, file.Ext) &&
-                            !p->ThumbnailMasksDisabled) // its unload/remove is not in progress
-                        {
-                            if (!p->GetLoaded()) // plugin needs to be loaded (possible change of mask for "thumbnail loader")
-                            {
-                                //                RefreshListBox(0, -1, -1, FALSE, FALSE); // replaced with ListBox->SetItemsCound + WM_USER_UPDATEPANEL, because it was blinking e.g. when adding the first *.doc file to a directory with images (Eroiica is loaded (for thumbnail *.doc))
-
-                                // displaying "PictureView is not registered" dialog may occur -> in that case it's necessary
-                                // to refresh listbox (otherwise we don't do any refresh, so that it doesn't blink with the panel)
-                                // we protect listbox against errors caused by request for refresh (data is just being read from disk)
-                                ListBox->SetItemsCount(0, 0, 0, TRUE); // TRUE - we will disable setting scrollbar
-                                // If WM_USER_UPDATEPANEL is delivered, the panel will be redrawn and scrollbar will be set.
-                                // Message loop can deliver it when message box (or dialog) is created.
-                                // Otherwise the panel will behave as unchanged and the message will be removed from queue.
-                                PostMessage(HWindow, WM_USER_UPDATEPANEL, 0, 0);
-
-                                BOOL cont = FALSE;
-                                if (p->InitDLL(HWindow, FALSE, TRUE, FALSE) &&  // plugin loaded successfully
-                                    p->ThumbnailMasks.GetMasksString()[0] != 0) // plugin is still "thumbnail loader"
-                                {
-                                    if (!p->ThumbnailMasks.AgreeMasks(file.Name, file.Ext) || // it can't do thumbnail for this file anymore
-                                        p->ThumbnailMasksDisabled)                            // its unload/remove is in progress
-                                    {
-                                        cont = TRUE;
-                                    }
-                                }
-                                else // can't load -> we will remove it from the list of probed plugins (prevent from repeating error messages)
-                                {
-                                    TRACE_I("Unable to use plugin " << p->Name << " as thumbnail loader.");
-                                    thumbLoaderPlugins.Delete(i);
-                                    readThumbnails = thumbLoaderPlugins.Count > 0;
-                                    if (!thumbLoaderPlugins.IsGood())
-                                        thumbLoaderPlugins.ResetState();
-                                    else
-                                        i--;
-                                    cont = TRUE; // let's try our luck with another plugin
-                                }
-
-                                // cleanup message-queue from buffered WM_USER_UPDATEPANEL
-                                MSG msg2;
-                                PeekMessage(&msg2, HWindow, WM_USER_UPDATEPANEL, WM_USER_UPDATEPANEL, PM_REMOVE);
-
-                                if (cont)
-                                    continue;
-                            }
-
-                            foundThumbLoaderPlugins.Add(p);
-                        }
-                    }
-                    if (foundThumbLoaderPlugins.IsGood())
-                    {
-                        if (foundThumbLoaderPlugins.Count > 0)
-                        {
-                            int size = len + 4;
-                            size -= (size & 0x3); // size % 4 (alignment per four bytes)
-                            int nameSize = size;
-                            size += sizeof(CQuadWord) + sizeof(FILETIME);
-                            size += (foundThumbLoaderPlugins.Count + 1) * sizeof(void*); // space for pointers to plugin interfaces + NULL at the end
-                            iconData.NameAndData = (char*)malloc(size);
-                            if (iconData.NameAndData != NULL)
-                            {
-                                memcpy(iconData.NameAndData, file.Name, len);
-                                memset(iconData.NameAndData + len, 0, nameSize - len); // end of name is zeroed
-                                // size is added + time of last write to file
-                                *(CQuadWord*)(iconData.NameAndData + nameSize) = file.Size;
-                                *(FILETIME*)(iconData.NameAndData + nameSize + sizeof(CQuadWord)) = file.LastWrite;
-                                // add list of pointers to encapsulation of plugin interfaces for getting thumbnails
-                                void** ifaces = (void**)(iconData.NameAndData + nameSize + sizeof(CQuadWord) + sizeof(FILETIME));
-                                int i2;
-                                for (i2 = 0; i2 < foundThumbLoaderPlugins.Count; i2++)
-                                {
-                                    *ifaces++ = foundThumbLoaderPlugins[i2]->GetPluginInterfaceForThumbLoader();
-                                }
-                                *ifaces = NULL;      // the end of list of plugin interfaces
-                                iconData.SetFlag(4); // so far no unread thumbnail
+                    MSG msg; // remove buffered ESC
+                    while (PeekMessage(&msg, NULL, WM_KEYFIRST, WM_KEYLAST, PM_REMOVE))
+                        ;
 
-                                // we have to allocate space for thumbnail, because it can't be done in the thread
-                                iconData.SetIndex(IconCache->AllocThumbnail());
+                    SetCurrentDirectoryToSystem();
+                    RefreshListBox(0, -1, -1, FALSE, FALSE);
 
-                                if (iconData.GetIndex() != -1)
-                                {
-                                    IconCache->Add(iconData);
-                                    if (!IconCache->IsGood())
-                                    {
-                                        free(iconData.NameAndData);
-                                        IconCache->ResetState();
-                                    }
-                                    else
-                                        addtoIconCache = FALSE; // it's a thumbnail, it can't be an icon at the same time
-                                }
-                                else
-                                    free(iconData.NameAndData);
-                            }
-                        }
+                    int resBut = SalMessageBox(parent, LoadStr(IDS_READDIRTERMINATED), LoadStr(IDS_QUESTION),
+                                               MB_YESNOCANCEL | MB_ICONQUESTION);
+                    UpdateWindow(MainWindow->HWindow);
+
+                    WaitForESCRelease();
+                    WaitForESCReleaseBeforeTestingESC = FALSE; // another waiting makes no sense
+                    GetAsyncKeyState(VK_ESCAPE);               // new init GetAsyncKeyState - see help
+
+                    if (resBut == IDYES)
+                    {
+                        testReadErr = FALSE;
+                        break; // finish reading
                     }
                     else
-                        foundThumbLoaderPlugins.ResetState();
-                }
-
-                // adding directory to IconCache -> we need to load icon
-                if (UseSystemIcons && addtoIconCache)
-                {
-                    int size = len + 4;
-                    size -= (size & 0x3); // size % 4 (alignment per four bytes)
-                    iconData.NameAndData = (char*)malloc(size);
-                    if (iconData.NameAndData != NULL)
                     {
-                        memmove(iconData.NameAndData, file.Name, len);
-                        memset(iconData.NameAndData + len, 0, size - len); // end of name is zeroed
-                        iconData.SetFlag(0);                               // no not-loaded icon yet
-                                                                           // need to allocate space for bitmaps, can't be done in thread
-                        iconData.SetIndex(IconCache->AllocIcon(NULL, NULL));
-                        if (iconData.GetIndex() != -1)
+                        if (resBut == IDNO)
                         {
-                            IconCache->Add(iconData);
-                            if (!IconCache->IsGood())
+                            if (GetMonitorChanges()) // need to suppress monitoring of changes (autorefresh)
                             {
-                                free(iconData.NameAndData);
-                                IconCache->ResetState();
+                                DetachDirectory((CFilesWindow*)this);
+                                SetMonitorChanges(FALSE); // the changes won't be monitored anymore
                             }
+
+                            SetSuppressAutoRefresh(TRUE);
                         }
-                        else
-                            free(iconData.NameAndData);
                     }
                 }
-                if (search == NULL)
-                {
-                    testFindNextErr = FALSE;
-#ifndef _WIN64
-                    isWin64RedirectedDir = FALSE;
-#endif                     // _WIN64
-                    break; // the second pass (adding ".." or win64 redirected-dir)
-                }
-            } while (FindNextFile(search, &fileData));
-            DWORD err = GetLastError();
-
-            if (search != NULL) // the first pass
-            {
-                DestroySafeWaitWindow();
-                HANDLES(FindClose(search));
+                lastEscCheckTime = GetTickCount();
             }
 
-            if (testFindNextErr && err != ERROR_NO_MORE_FILES)
+            // a large or slow directory: we will show the part read so far (not on refresh, the
+            // panel shows the old listing until the new one is read)
+            if (!isRefresh && Configuration.ReadDirsProgressively && Files->Count + Dirs->Count > 0 &&
+                GetTickCount() - readStart >= LISTREAD_FIRST_TAKE_PERIOD)
             {
-                SetCurrentDirectoryToSystem();
-                RefreshListBox(0, -1, -1, FALSE, FALSE);
-
-                sprintf(buf, LoadStr(IDS_CANNOTREADDIR), GetPath(), GetErrorText(err));
-                SalMessageBox(parent, buf, LoadStr(IDS_ERRORTITLE), MB_OK | MB_ICONEXCLAMATION);
+                progressive = TRUE;
+                break;
             }
+            WaitForSingleObject(thread, 20); // waiting for further items (or the end of the thread)
         }
-
-        if (upDir && (Dirs->Count == 0 || strcmp(Dirs->At(0).Name, "..") != 0))
+        if (thread != NULL)
+            HANDLES(CloseHandle(thread));
+        DestroySafeWaitWindow();
+        if (!progressive) // the thread reading the directory is not needed anymore
         {
-            upDir = FALSE;
-            *(fileNameEnd - 1) = 0; // it's not logical, but times ".." are from current directory
-            if (!UNCRootUpDir)
-                search = HANDLES_Q(FindFirstFile(fileName, &fileData));
-            else
-                search = INVALID_HANDLE_VALUE;
-            if (search == INVALID_HANDLE_VALUE)
-            {
-                fileData.dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY; // this is ptDisk
-                SYSTEMTIME ltNone;
-                ltNone.wYear = 1602;
-                ltNone.wMonth = 1;
-                ltNone.wDay = 1;
-                ltNone.wDayOfWeek = 2;
-                ltNone.wHour = 0;
-                ltNone.wMinute = 0;
-                ltNone.wSecond = 0;
-                ltNone.wMilliseconds = 0;
-                FILETIME ft;
-                SystemTimeToFileTime(&ltNone, &ft);
-                LocalFileTimeToFileTime(&ft, &fileData.ftCreationTime);
-                LocalFileTimeToFileTime(&ft, &fileData.ftLastAccessTime);
-                LocalFileTimeToFileTime(&ft, &fileData.ftLastWriteTime);
-
-                fileData.nFileSizeHigh = 0;
-                fileData.nFileSizeLow = 0;
-                fileData.dwReserved0 = fileData.dwReserved1 = 0;
-            }
-            else
-                HANDLES(FindClose(search));
-            search = NULL;                                              // the second/third pass
-            fileData.dwFileAttributes |= FILE_ATTRIBUTE_DIRECTORY;      // this is ptDisk
-            fileData.dwFileAttributes &= ~FILE_ATTRIBUTE_REPARSE_POINT; // need to remove flag FILE_ATTRIBUTE_REPARSE_POINT, otherwise link overlay will be on ".."
-            strcpy(fileData.cFileName, "..");
-            fileData.cAlternateFileName[0] = 0;
-            st = fileData.cFileName;
-            len = (int)strlen(st);
-            isUpDir = TRUE;
-            goto ADD_ITEM;
+            ctx->Reader->Cancel();
+            ctx->Reader->Release();
+            ctx->Reader = NULL;
         }
 
-#ifndef _WIN64
-
-    FIND_NEXT_WIN64_REDIRECTEDDIR:
-
-        BOOL dirWithSameNameExists;
-        if (foundWin64RedirectedDirs < 10 &&
-            AddWin64RedirectedDir(GetPath(), Dirs, &fileData, &foundWin64RedirectedDirs, &dirWithSameNameExists))
+        if (lowMemory)
         {
-            foundWin64RedirectedDirs++; // e.g. under system32 there can be 5, I've added some reserve to 10...
+            delete ctx;
+            ClearDiskListing();
+            //      TRACE_I("ReadDirectory: end");
+            return FALSE;
+        }
 
-            if (Configuration.NotHiddenSystemFiles &&
-                (fileData.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)))
-            { // skip hidden directory
-                if (!dirWithSameNameExists)
+        if (testReadErr && openFailed)
+        {
+            if (err == ERROR_FILE_NOT_FOUND || err == ERROR_NO_MORE_FILES)
+            {
+                if (!ctx->UpDir)
                 {
-                    HiddenDirsCount++;
-                    HiddenDirsFilesReason |= HIDDEN_REASON_ATTRIBUTE;
+                    delete ctx;
+                    StatusLine->SetText(LoadStr(IDS_NOFILESFOUND));
+                    SetCurrentDirectoryToSystem();
+                    DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
+                    if (UseSystemIcons || UseThumbnails) // even though we don't have any icons, we need to start loading them (just to set IconCacheValid = TRUE)
+                    {
+                        if (IconCache->Count > 1)
+                            IconCache->SortArray(0, IconCache->Count - 1, NULL);
+                        WakeupIconCacheThread(); // start loading icons
+                    }
+                    //          TRACE_I("ReadDirectory: end");
+                    return TRUE;
                 }
-                goto FIND_NEXT_WIN64_REDIRECTEDDIR;
             }
-
-            //--- if the name is occupied in the array HiddenNames, we will discard it
-            if (HiddenNames.Contains(TRUE, fileData.cFileName))
+            else
             {
-                if (!dirWithSameNameExists)
+                SetCurrentDirectoryToSystem();
+                RefreshListBox(0, -1, -1, FALSE, FALSE);
+                DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
+                DirectoryLine->InvalidateIfNeeded();
+                IdleRefreshStates = TRUE; // we will force checking of states of variables at the next Idle
+                StatusLine->SetText("");
+                UpdateWindow(HWindow);
+
+                BOOL showErr = TRUE;
+                if (err == ERROR_INVALID_PARAMETER || err == ERROR_NOT_READY)
                 {
-                    HiddenDirsCount++;
-                    HiddenDirsFilesReason |= HIDDEN_REASON_HIDECMD;
+                    DWORD attrs = SalGetFileAttributes(GetPath());
+                    if (attrs != INVALID_FILE_ATTRIBUTES &&
+                        (attrs & FILE_ATTRIBUTE_DIRECTORY) &&
+                        (attrs & FILE_ATTRIBUTE_REPARSE_POINT))
+                    {
+                        showErr = FALSE;
+                        char drive[MAX_PATH];
+                        UINT drvType2;
+                        if (GetPath()[0] == '\\' && GetPath()[1] == '\\')
+                        {
+                            drvType2 = DRIVE_REMOTE;
+                            GetRootPath(drive, GetPath());
+                            drive[strlen(drive) - 1] = 0; // we don't want the last '\\'
+                        }
+                        else
+                        {
+                            drive[0] = GetPath()[0];
+                            drive[1] = 0;
+                            drvType2 = MyGetDriveType(GetPath());
+                        }
+                        if (drvType2 != DRIVE_REMOTE)
+                        {
+                            GetCurrentLocalReparsePoint(GetPath(), CheckPathRootWithRetryMsgBox);
+                            if (strlen(CheckPathRootWithRetryMsgBox) > 3)
+                            {
+                                lstrcpyn(drive, CheckPathRootWithRetryMsgBox, MAX_PATH);
+                                SalPathRemoveBackslash(drive);
+                            }
+                        }
+                        else
+                            GetRootPath(CheckPathRootWithRetryMsgBox, GetPath());
+                        sprintf(buf, LoadStr(IDS_NODISKINDRIVE), drive);
+                        int msgboxRes = (int)CDriveSelectErrDlg(parent, buf, GetPath()).Execute();
+                        CheckPathRootWithRetryMsgBox[0] = 0;
+                        UpdateWindow(MainWindow->HWindow);
+                        if (msgboxRes == IDRETRY)
+                            goto _TRY_AGAIN;
+                    }
+                }
+                if (isRefresh &&
+                    (err == ERROR_ACCESS_DENIED || err == ERROR_PATH_NOT_FOUND ||
+                     err == ERROR_BAD_PATHNAME || err == ERROR_FILE_NOT_FOUND))
+                { // when deleting a path shown in the panel, these errors are shown, which we don't want, we just silently shorten the path to the first existing one (unfortunately it's not caught earlier, because the path exists for some time after its deletion, something in Windows just didn't work out again)
+                    //          TRACE_I("ReadDirectory(): silently ignoring FindFirstFile failure: " << GetErrorText(err));
+                    showErr = FALSE;
                 }
-                goto FIND_NEXT_WIN64_REDIRECTEDDIR;
+                delete ctx;
+                if (showErr)
+                    SalMessageBox(parent, GetErrorText(err), LoadStr(IDS_ERRORTITLE), MB_OK | MB_ICONEXCLAMATION);
+                //        TRACE_I("ReadDirectory: end");
+                return FALSE;
             }
+        }
+        else
+        {
+            if (testReadErr && err != NO_ERROR)
+            {
+                SetCurrentDirectoryToSystem();
+                RefreshListBox(0, -1, -1, FALSE, FALSE);
 
-            isWin64RedirectedDir = TRUE;
-            search = NULL; // the second/third pass...
-            st = fileData.cFileName;
-            len = (int)strlen(st);
-            isUpDir = FALSE;
-            goto ADD_ITEM;
+                sprintf(buf, LoadStr(IDS_CANNOTREADDIR), GetPath(), GetErrorText(err));
+                SalMessageBox(parent, buf, LoadStr(IDS_ERRORTITLE), MB_OK | MB_ICONEXCLAMATION);
+            }
         }
-        if (foundWin64RedirectedDirs >= 10)
-            TRACE_E("CFilesWindow::ReadDirectory(): foundWin64RedirectedDirs >= 10 (there are more redirected-dirs?)");
 
+        BOOL ok = AddDiskListingUpDir(ctx);
+#ifndef _WIN64
+        BOOL added;
+        if (ok && !progressive) // during the progressive listing they are added after the whole directory is read
+            ok = AddDiskListingRedirectedDirs(ctx, &added);
 #endif // _WIN64
+        if (!ok)
+        {
+            delete ctx;
+            ClearDiskListing();
+            //      TRACE_I("ReadDirectory: end");
+            return FALSE;
+        }
 
         SetCurrentDirectoryToSystem();
 
-        if (Files->Count + Dirs->Count == 0)
+        if (!progressive && Files->Count + Dirs->Count == 0)
             StatusLine->SetText(LoadStr(IDS_NOFILESFOUND));
 
         // sorting of Files and Dirs according to the current sorting method
@@ -963,6 +1168,18 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
                 IconCache->SortArray(0, IconCache->Count - 1, NULL);
             WakeupIconCacheThread(); // start loading icons
         }
+
+        if (progressive)
+        {
+            // the panel shows the part read so far, ReadDirectoryBatch() adds the rest
+            DirectoryLine->SetThrobber(TRUE);
+            DirectoryLine->SetThrobberTooltip(LoadStr(IDS_READINGDIRINBKGND));
+            ctx->ThrobberID = DirectoryLine->ChangeThrobberID();
+            ProgressiveListing = ctx;
+            PostMessage(HWindow, WM_USER_LISTINGBATCH, 0, 0);
+        }
+        else
+            delete ctx;
     }
     else
     {
@@ -1620,6 +1837,38 @@ BOOL CFilesWindow::ReadDirectory(HWND parent, BOOL isRefresh)
     return TRUE;
 }
 
+// sorts items 'left' to 'right' of 'arr' (directories for 'isDirs' TRUE) the same way as
+// SortFilesAndDirectories
+void SortListingRange(CFilesArray* arr, int left, int right, BOOL isDirs, CSortType sortType,
+                      BOOL reverseSort, BOOL sortDirsByName)
+{
+    if (right <= left) // if there's one item only, there's nothing to sort
+        return;
+    switch (sortType)
+    {
+    case stName:
+        SortNameExt(*arr, left, right, reverseSort);
+        break;
+    case stExtension:
+        SortExtName(*arr, left, right, reverseSort);
+        break;
+    case stTime:
+    {
+        if (isDirs && sortDirsByName)
+            SortNameExt(*arr, left, right, FALSE);
+        else
+            SortTimeNameExt(*arr, left, right, reverseSort);
+        break;
+    }
+    case stSize:
+        SortSizeNameExt(*arr, left, right, reverseSort);
+        break;
+    case stAttr:
+        SortAttrNameExt(*arr, left, right, reverseSort);
+        break;
+    }
+}
+
 // sorts array Dirs and Files independently on global variables
 void SortFilesAndDirectories(CFilesArray* files, CFilesArray* dirs, CSortType sortType, BOOL reverseSort, BOOL sortDirsByName)
 {
@@ -1632,54 +1881,9 @@ void SortFilesAndDirectories(CFilesArray* files, CFilesArray* dirs, CSortType so
         BOOL hasRoot = (dirs->At(0).NameLen == 2 && dirs->At(0).Name[0] == '.' &&
                         dirs->At(0).Name[1] == '.'); // root directory
         int firstIndex = hasRoot ? 1 : 0;
-        if (dirs->Count - firstIndex > 1) // if there's one item only, there's nothing to sort
-        {
-            switch (sortType)
-            {
-            case stName:
-                SortNameExt(*dirs, firstIndex, dirs->Count - 1, reverseSort);
-                break;
-            case stExtension:
-                SortExtName(*dirs, firstIndex, dirs->Count - 1, reverseSort);
-                break;
-            case stTime:
-            {
-                if (sortDirsByName)
-                    SortNameExt(*dirs, firstIndex, dirs->Count - 1, FALSE);
-                else
-                    SortTimeNameExt(*dirs, firstIndex, dirs->Count - 1, reverseSort);
-                break;
-            }
-            case stSize:
-                SortSizeNameExt(*dirs, firstIndex, dirs->Count - 1, reverseSort);
-                break;
-            case stAttr:
-                SortAttrNameExt(*dirs, firstIndex, dirs->Count - 1, reverseSort);
-                break;
-            }
-        }
-    }
-    if (files->Count > 1)
-    {
-        switch (sortType)
-        {
-        case stName:
-            SortNameExt(*files, 0, files->Count - 1, reverseSort);
-            break;
-        case stExtension:
-            SortExtName(*files, 0, files->Count - 1, reverseSort);
-            break;
-        case stTime:
-            SortTimeNameExt(*files, 0, files->Count - 1, reverseSort);
-            break;
-        case stSize:
-            SortSizeNameExt(*files, 0, files->Count - 1, reverseSort);
-            break;
-        case stAttr:
-            SortAttrNameExt(*files, 0, files->Count - 1, reverseSort);
-            break;
-        }
+        SortListingRange(dirs, firstIndex, dirs->Count - 1, TRUE, sortType, reverseSort, sortDirsByName);
     }
+    SortListingRange(files, 0, files->Count - 1, FALSE, sortType, reverseSort, sortDirsByName);
 }
 
 void CFilesWindow::SortDirectory(CFilesArray* files, CFilesArray* dirs)
@@ -1700,6 +1904,290 @@ void CFilesWindow::SortDirectory(CFilesArray* files, CFilesArray* dirs)
     VisibleItemsArraySurround.InvalidateArr();
 }
 
+CLessFunction GetListingLessFunction(CSortType sortType, BOOL isDirs, BOOL* reverseSort)
+{
+    // CAUTION: must correspond to SortFilesAndDirectories
+    switch (sortType)
+    {
+    case stName:
+        return LessNameExt;
+    case stExtension:
+        return LessExtName;
+    case stTime:
+    {
+        if (isDirs && Configuration.SortDirsByName)
+        {
+            *reverseSort = FALSE;
+            return LessNameExt;
+        }
+        return LessTimeNameExt;
+    }
+    case stAttr:
+        return LessAttrNameExt;
+    default:
+        return LessSizeNameExt;
+    }
+}
+
+// sorts the items of 'arr' from 'sortedCount' (the items added by the last batch of the progressive
+// listing) and merges them into the sorted items before them, the up-dir symbol ".." keeps its place;
+// 'indexes' ('count' of them, -1 = none) are indexes of items before 'sortedCount', they are updated
+// to the new places of the items (set to -1 if the items could not be followed)
+void MergeListingTail(CFilesArray* arr, int sortedCount, BOOL isDirs, CSortType sortType, BOOL reverseSort,
+                      int* indexes, int count)
+{
+    int first = (isDirs && arr->Count > 0 && arr->At(0).NameLen == 2 &&
+                 arr->At(0).Name[0] == '.' && arr->At(0).Name[1] == '.')
+                    ? 1
+                    : 0; // the up-dir symbol keeps its place
+    if (sortedCount < first)
+        sortedCount = first;
+    int tail = arr->Count - sortedCount;
+    if (tail <= 0)
+        return; // nothing new
+
+    // we sort the new items (the same comparison as in SortFilesAndDirectories)
+    SortListingRange(arr, sortedCount, arr->Count - 1, isDirs, sortType, reverseSort, Configuration.SortDirsByName);
+    if (sortedCount == first)
+        return; // there is nothing to merge with
+
+    CFileData* tailItems = (CFileData*)malloc(tail * sizeof(CFileData));
+    if (tailItems == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        SortListingRange(arr, first, arr->Count - 1, isDirs, sortType, reverseSort, Configuration.SortDirsByName);
+        int k;
+        for (k = 0; k < count; k++)
+            indexes[k] = -1;
+        return;
+    }
+    CFileData* data = arr->GetData();
+    memcpy(tailItems, data + sortedCount, tail * sizeof(CFileData));
+    CLessFunction less = GetListingLessFunction(sortType, isDirs, &reverseSort);
+
+    // we merge from the end, the new items go after the equal old ones
+    int out = arr->Count;
+    int i = sortedCount;
+    int j = tail;
+    while (j > 0)
+    {
+        if (i > first && less(tailItems[j - 1], data[i - 1], reverseSort))
+        {
+            i--;
+            out--;
+            data[out] = data[i];
+            int k;
+            for (k = 0; k < count; k++)
+            {
+                if (indexes[k] == i)
+                    indexes[k] = out;
+            }
+        }
+        else
+            data[--out] = tailItems[--j];
+    }
+    free(tailItems);
+}
+
+void CFilesWindow::ReadDirectoryBatch()
+{
+    CALL_STACK_MESSAGE1("CFilesWindow::ReadDirectoryBatch()");
+
+    CDiskListingContext* ctx = ProgressiveListing;
+    if (ctx == NULL)
+        return; // the listing was ended meanwhile (the message or the timer came late)
+    if (ctx->TimerSet)
+    {
+        KillTimer(HWindow, IDT_LISTINGBATCH);
+        ctx->TimerSet = FALSE;
+    }
+
+    DWORD wait;
+    if (SnooperSuspended || StopRefresh)
+        wait = LISTREAD_MIN_TAKE_PERIOD; // the data of the panel is being used, the listing cannot change now
+    else
+        ctx->Reader->BeginTake(GetTickCount(), &wait);
+    if (wait > 0) // the panel must stay responsive, the items are added later
+    {
+        if (SetTimer(HWindow, IDT_LISTINGBATCH, wait, NULL))
+            ctx->TimerSet = TRUE;
+        else
+            PostMessage(HWindow, WM_USER_LISTINGBATCH, 0, 0);
+        return;
+    }
+
+    DWORD start = GetTickCount();
+    SleepIconCacheThread(); // the items move, icons cannot be read meanwhile
+
+    int oldDirsCount = Dirs->Count;
+    int oldFilesCount = Files->Count;
+    int oldIconsCount = IconCache->Count;
+    if (FocusedIndex != ctx->FocusIndex)
+        ctx->FocusName[0] = 0; // the user moved the focus, it stays on the focused item
+
+    // we take the published items
+    WIN32_FIND_DATA fileData;
+    BOOL lowMemory = FALSE;
+    const CListingReadItem* item;
+    while (!lowMemory && (item = ctx->Reader->GetNext()) != NULL)
+    {
+        NumberOfItemsInCurDir++;
+        ListingItemToFindData(item, &fileData);
+        if (!SkipDiskListingItem(ctx, &fileData) && !AddDiskListingItem(ctx, &fileData))
+            lowMemory = TRUE;
+    }
+    DWORD err = NO_ERROR;
+    BOOL openFailed;
+    BOOL finished = !lowMemory && ctx->Reader->IsFinished(&err, &openFailed);
+    BOOL resortDirs = FALSE; // TRUE = Dirs changed in another way than by adding items
+#ifndef _WIN64
+    if (finished && !AddDiskListingRedirectedDirs(ctx, &resortDirs))
+        lowMemory = TRUE;
+#endif // _WIN64
+    if (lowMemory)
+    {
+        StopProgressiveListing();
+        ClearDiskListing();
+        RefreshListBox(0, -1, -1, FALSE, FALSE);
+        WakeupIconCacheThread();
+        return;
+    }
+
+    // the indexes of the focused and the top item in Dirs or Files (they follow the items)
+    int focus = FocusedIndex;
+    int top = ListBox->GetTopIndex();
+    int dirIndexes[2] = {-1, -1};
+    int fileIndexes[2] = {-1, -1};
+    if (focus >= 0 && focus < oldDirsCount)
+        dirIndexes[0] = focus;
+    else if (focus >= oldDirsCount && focus < oldDirsCount + oldFilesCount)
+        fileIndexes[0] = focus - oldDirsCount;
+    if (top >= 0 && top < oldDirsCount)
+        dirIndexes[1] = top;
+    else if (top >= oldDirsCount && top < oldDirsCount + oldFilesCount)
+        fileIndexes[1] = top - oldDirsCount;
+
+    if (resortDirs) // Dirs cannot be merged, we sort them again
+    {
+        CFilesArray empty(1, 1);
+        SortFilesAndDirectories(&empty, Dirs, SortType, ReverseSort, Configuration.SortDirsByName);
+        dirIndexes[0] = dirIndexes[1] = -1;
+    }
+    else
+        MergeListingTail(Dirs, oldDirsCount, TRUE, SortType, ReverseSort, dirIndexes, 2);
+    MergeListingTail(Files, oldFilesCount, FALSE, SortType, ReverseSort, fileIndexes, 2);
+    VisibleItemsArray.InvalidateArr();
+    VisibleItemsArraySurround.InvalidateArr();
+
+    // the focus stays on its item, the requested item gets the focus when it is read
+    int newFocus = -1;
+    if (dirIndexes[0] != -1)
+        newFocus = dirIndexes[0];
+    else if (fileIndexes[0] != -1)
+        newFocus = Dirs->Count + fileIndexes[0];
+    BOOL focusFound = FALSE;
+    if (ctx->FocusName[0] != 0)
+    {
+        int nameLen = (int)strlen(ctx->FocusName);
+        int found = -1;
+        int i;
+        for (i = 0; i < Dirs->Count + Files->Count; i++)
+        {
+            CFileData* f = i < Dirs->Count ? &Dirs->At(i) : &Files->At(i - Dirs->Count);
+            if (f->NameLen == nameLen && StrICmp(f->Name, ctx->FocusName) == 0)
+            {
+                found = i;
+                if (strcmp(f->Name, ctx->FocusName) == 0)
+                    break; // the exact match is preferred
+            }
+        }
+        if (found != -1)
+        {
+            newFocus = found;
+            focusFound = TRUE;
+            ctx->FocusName[0] = 0;
+        }
+    }
+    int newTop = -1;
+    if (GetViewMode() == vmDetailed && !focusFound)
+    {
+        if (dirIndexes[1] != -1)
+            newTop = dirIndexes[1];
+        else if (fileIndexes[1] != -1)
+            newTop = Dirs->Count + fileIndexes[1];
+    }
+
+    // icons of the new items
+    if ((UseSystemIcons || UseThumbnails) && IconCache->Count > oldIconsCount)
+    {
+        IconCacheValid = FALSE;
+        if (IconCache->Count > 1)
+            IconCache->SortArray(0, IconCache->Count - 1, NULL);
+    }
+    WakeupIconCacheThread();
+
+    if (QuickSearchMode)
+        HideCaret(ListBox->HWindow);
+    RefreshListBox(ListBox->GetXOffset(), newTop, newFocus, focusFound, FALSE);
+    if (QuickSearchMode)
+    {
+        SetQuickSearchCaretPos();
+        ShowCaret(ListBox->HWindow);
+    }
+    ctx->FocusIndex = FocusedIndex;
+    DirectoryLine->SetHidden(HiddenFilesCount, HiddenDirsCount);
+    IdleRefreshStates = TRUE; // we will force checking of states of variables at the next Idle
+
+    if (finished)
+    {
+        BOOL needRefresh = NeedRefreshAfterListing;
+        StopProgressiveListing();
+        if (err != NO_ERROR)
+        {
+            char buf[2 * MAX_PATH + 100];
+            sprintf(buf, LoadStr(IDS_CANNOTREADDIR), GetPath(), GetErrorText(err));
+            SalMessageBox(HWindow, buf, LoadStr(IDS_ERRORTITLE), MB_OK | MB_ICONEXCLAMATION);
+        }
+        if (Files->Count + Dirs->Count == 0)
+            StatusLine->SetText(LoadStr(IDS_NOFILESFOUND));
+        if (needRefresh) // a refresh came while the directory was being read
+        {
+            PostMessage(HWindow, WM_USER_REFRESH_DIR, FALSE, RefreshAfterListingTime);
+        }
+    }
+    else
+    {
+        DWORD end = GetTickCount();
+        ctx->Reader->EndTake(end, end - start);
+    }
+}
+
+void CFilesWindow::StopProgressiveListing()
+{
+    CALL_STACK_MESSAGE1("CFilesWindow::StopProgressiveListing()");
+
+    CDiskListingContext* ctx = ProgressiveListing;
+    if (ctx == NULL)
+        return;
+    ProgressiveListing = NULL;
+    NeedRefreshAfterListing = FALSE;
+    if (ctx->TimerSet)
+        KillTimer(HWindow, IDT_LISTINGBATCH);
+    if (DirectoryLine != NULL && DirectoryLine->IsThrobberVisible(ctx->ThrobberID))
+        DirectoryLine->SetThrobber(FALSE);
+    delete ctx; // the thread reading the directory finishes at its next item
+}
+
+void CFilesWindow::SetProgressiveListingFocus(const char* name)
+{
+    CDiskListingContext* ctx = ProgressiveListing;
+    if (ctx != NULL)
+    {
+        lstrcpyn(ctx->FocusName, name, MAX_PATH);
+        ctx->FocusIndex = FocusedIndex;
+    }
+}
+
 #ifndef _WIN64
 
 BOOL IsWin64RedirectedDirAux(const char* subDir, const char* redirectedDir, const char* redirectedDirLastComp,
@@ -16,6 +16,8 @@
 #include "pack.h"
 #include "shellib.h"
 #include "filesbox.h"
+#include "dirwalk.h"
+#include "dirsize.h"
 
 // helper variables for the dialogs in BuildScriptXXX()
 BOOL ConfirmADSLossAll = FALSE;
@@ -41,6 +43,22 @@ BOOL ErrGetFileSizeOfLnkTgtIgnAll = FALSE;
 // helper variables for tests attempting to interrupt script building
 DWORD LastTickCount;
 
+// script streaming (see COperations::EnableStreaming()): hands finished operations over to
+// the worker, starts the progress dialog once the build takes long enough; returns FALSE
+// if the script building must be interrupted (the worker has already ended - cancel/error)
+BOOL StreamScriptOps(COperations* script)
+{
+    if (script->IsStreamStarted())
+        return script->PublishStreamedOps();
+    if (script->IsStreamDue())
+    {
+        script->PublishStreamedOps();
+        if (!StartProgressDialog(script, script->GetStreamCaption(), NULL, NULL))
+            script->CancelStreaming(); // the script will be completed and started the standard way
+    }
+    return TRUE;
+}
+
 void CFilesWindow::Activate(BOOL shares)
 {
     CALL_STACK_MESSAGE_NONE
@@ -1026,6 +1044,8 @@ void CFilesWindow::DropCopyMove(BOOL copy, char* targetPath, CCopyMoveData* data
                 script->ShowStatus = TRUE;
             script->IsCopyOperation = copy;
             script->IsCopyOrMoveOperation = TRUE;
+            if (data->Count > 0 && data->At(0)->FileName != NULL)
+                script->SetDevicePaths(data->At(0)->FileName, targetPath); // the queue only needs the volume of the source
 
             char caption[50]; // otherwise the LoadStr buffer gets overwritten before being copied to the dialog's local buffer
             if (copy)
@@ -1324,6 +1344,18 @@ BOOL CFilesWindow::BuildScriptMain(COperations* script, CActionType type,
             }
         }
 
+        // only the sizes of directories are wanted (Space, Calculate Directory Sizes): all selected
+        // directories are calculated at once on a pool of threads, BuildScriptDir() lists only
+        // those which could not be calculated this way
+        CDirSizeCalculator sizeCalc(HWindow, GetDirWalkerThreadCount(0), Configuration.CacheDirSizes);
+        BOOL useSizeCalc = countSize && onlySize && subDirectories && filterCriteria == NULL &&
+                           Configuration.CalcDirSizesConcurrently;
+        if (useSizeCalc && !CalculateDirSizesConcurrently(&sizeCalc, sourcePath, selCount, selection, oneFile))
+        {
+            SetCurrentDirectoryToSystem();
+            return FALSE;
+        }
+
         int i = 0;
         do
         {
@@ -1334,6 +1366,11 @@ BOOL CFilesWindow::BuildScriptMain(COperations* script, CActionType type,
                 useDOSName = oneFile->DosName;
             }
             i++;
+            if (!StreamScriptOps(script))
+            {
+                SetCurrentDirectoryToSystem();
+                return FALSE;
+            }
             // oneFile points to the selected or caret item in the filebox
             if (oneFile->Attr & FILE_ATTRIBUTE_DIRECTORY) // jde o ptDisk
             {
@@ -1343,12 +1380,21 @@ BOOL CFilesWindow::BuildScriptMain(COperations* script, CActionType type,
                     {
                         oldTotalSize = script->TotalSize;
                     }
-                    if (!BuildScriptDir(script, type, sourcePath, sourceSupADS, targetPath,
-                                        targetPathState, targetSupADS, targetIsFAT32, mask,
-                                        useName, useDOSName, attrsData, NULL, oneFile->Attr,
-                                        chCaseData, TRUE, onlySize, fastDirectoryMove,
-                                        filterCriteria, NULL, &oneFile->LastWrite,
-                                        srcAndTgtPathsFlags))
+                    CDirSizeTotals totals;
+                    if (useSizeCalc && sizeCalc.GetTotals(sourcePath, oneFile->Name, &totals))
+                    { // OccupiedSpace and Sizes are needed only by the dialog with the results (not used here)
+                        script->TotalSize += totals.Size;
+                        script->TotalFileSize += totals.Size;
+                        script->CompressedSize += totals.Size;
+                        script->FilesCount += (int)totals.Files;
+                        script->DirsCount += (int)totals.Dirs;
+                    }
+                    else if (!BuildScriptDir(script, type, sourcePath, sourceSupADS, targetPath,
+                                             targetPathState, targetSupADS, targetIsFAT32, mask,
+                                             useName, useDOSName, attrsData, NULL, oneFile->Attr,
+                                             chCaseData, TRUE, onlySize, fastDirectoryMove,
+                                             filterCriteria, NULL, &oneFile->LastWrite,
+                                             srcAndTgtPathsFlags))
                     {
                         SetCurrentDirectoryToSystem();
                         return FALSE;
@@ -1426,9 +1472,68 @@ BOOL CFilesWindow::BuildScriptMain(COperations* script, CActionType type,
     }
 
     SetCurrentDirectoryToSystem();
-    int i;
-    for (i = 0; i < script->Count; i++)
-        script->TotalSize += script->At(i).Size;
+    if (!script->IsStreamStarted()) // streamed script: the worker already has the sizes of handed over operations, EndStreaming() adds the rest
+    {
+        int i;
+        for (i = 0; i < script->Count; i++)
+            script->TotalSize += script->At(i).Size;
+    }
+    return TRUE;
+}
+
+BOOL CFilesWindow::CalculateDirSizesConcurrently(CDirSizeCalculator* calc, char* sourcePath, int selCount,
+                                                 int* selection, CFileData* oneFile)
+{
+    CALL_STACK_MESSAGE3("CFilesWindow::CalculateDirSizesConcurrently(, %s, %d, ,)", sourcePath, selCount);
+    char path[MAX_PATH];
+    int i = 0;
+    do
+    {
+        CFileData* f = oneFile;
+        if (selCount > 1 || oneFile == NULL)
+            f = (selection[i] < Dirs->Count) ? &Dirs->At(selection[i]) : &Files->At(selection[i] - Dirs->Count);
+        i++;
+        // a directory which cannot be added (too long name, low memory) is calculated by BuildScriptDir()
+        if (f->Attr & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            lstrcpyn(path, sourcePath, MAX_PATH);
+            if (SalPathAppend(path, f->Name, MAX_PATH))
+                calc->AddRoot(path);
+        }
+    } while (i < selCount);
+
+    if (!calc->Calculate())
+    {
+        if (calc->IsCancelled())
+            return FALSE;
+        return TRUE; // low memory: the directories are calculated by BuildScriptDir()
+    }
+
+    char text[2 * MAX_PATH + 200];
+    for (i = 0; i < calc->GetErrorsCount(); i++)
+    {
+        if (ErrListDirSkipAll)
+            break;
+        const CDirSizeError* error = calc->GetError(i);
+        sprintf(text, LoadStr(IDS_CANNOTREADDIR), error->Path, GetErrorText(error->Err));
+        MSGBOXEX_PARAMS params;
+        memset(&params, 0, sizeof(params));
+        params.HParent = MainWindow->HWindow;
+        params.Flags = MB_YESNOCANCEL | MB_ICONEXCLAMATION | MSGBOXEX_DEFBUTTON3 | MSGBOXEX_SILENT;
+        params.Caption = LoadStr(IDS_ERRORTITLE);
+        params.Text = text;
+        char aliasBtnNames[200];
+        sprintf(aliasBtnNames, "%d\t%s\t%d\t%s",
+                DIALOG_YES, LoadStr(IDS_MSGBOXBTN_SKIP),
+                DIALOG_NO, LoadStr(IDS_MSGBOXBTN_SKIPALL));
+        params.AliasBtnNames = aliasBtnNames;
+        int msgRes = SalMessageBoxEx(&params);
+        if (msgRes != DIALOG_YES /* Skip */ && msgRes != DIALOG_NO /* Skip All */)
+            return FALSE;
+        if (msgRes == DIALOG_NO /* Skip All */)
+            ErrListDirSkipAll = TRUE;
+        UpdateWindow(MainWindow->HWindow);
+    }
     return TRUE;
 }
 
@@ -2188,6 +2293,8 @@ MENU_TEMPLATE_ITEM MsgBoxButtons[] =
                         if (res == IDYES)
                             goto BUILD_ERROR;
                     }
+                    if (!StreamScriptOps(script))
+                        goto BUILD_ERROR;
 
                     LastTickCount = GetTickCount();
                 }
@@ -2324,11 +2431,10 @@ MENU_TEMPLATE_ITEM MsgBoxButtons[] =
     // this rule does not apply (it's a link, not a real directory)
     if (!copyMoveDirIsLink && (type == atCopy || type == atMove) && filterCriteria != NULL &&
         filterCriteria->SkipEmptyDirs && createDirIndex >= 0 &&
-        createDirIndex == script->Count - 1)
+        createDirIndex == script->Count - 1 &&
+        !script->IsOpPublished(createDirIndex)) // the worker may already run a handed over op (see PublishStreamedOps)
     {
-        free(script->At(createDirIndex).SourceName);
-        free(script->At(createDirIndex).TargetName);
-        script->Delete(createDirIndex);
+        script->Delete(createDirIndex); // its names stay in the script's name store until the script is freed
         if (!script->IsGood())
             script->ResetState();
         // if this directory is being skipped, the parent directory cannot be deleted
@@ -2347,7 +2453,8 @@ MENU_TEMPLATE_ITEM MsgBoxButtons[] =
             op.OpFlags = 0;
             op.Size = CHATTRS_FILE_SIZE;
             op.SourceName = sourceDirTime != NULL ? (char*)(DWORD_PTR)sourceDirTime->dwLowDateTime : NULL;
-            op.TargetName = DupStr(script->At(createDirIndex).TargetName);
+            char createDirName[MAX_PATH];
+            op.TargetName = DupStr(script->GetTargetName(createDirIndex, createDirName));
             if (op.TargetName == NULL)
                 return FALSE;
             op.Attr = sourceDirTime != NULL ? sourceDirTime->dwHighDateTime : 0;
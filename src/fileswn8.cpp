@@ -981,6 +981,7 @@ void CFilesWindow::FilesAction(CActionType type, CFilesWindow* target, int count
                         script->ShowStatus = TRUE;
                         script->IsCopyOperation = TRUE;
                         script->IsCopyOrMoveOperation = TRUE;
+                        script->SetDevicePaths(GetPath(), path);
                         break;
                     }
 
@@ -991,6 +992,7 @@ void CFilesWindow::FilesAction(CActionType type, CFilesWindow* target, int count
                         script->ShowStatus = !sameRootPath || script->SameRootButDiffVolume;
                         script->IsCopyOperation = FALSE;
                         script->IsCopyOrMoveOperation = TRUE;
+                        script->SetDevicePaths(GetPath(), path);
                         caption = LoadStr(IDS_MOVE);
                         break;
                     }
@@ -1022,11 +1024,22 @@ void CFilesWindow::FilesAction(CActionType type, CFilesWindow* target, int count
                     char* auxTargetPath = NULL;
                     if (type == atCopy || type == atMove)
                         auxTargetPath = path;
+                    if (type == atCopy && Configuration.CopyDuringTreeAnalysis)
+                    { // copying may start before the script is complete, the free space check is skipped then
+                        script->SetWorkPath1(path, TRUE); // the worker may finish before we get back here
+                        script->EnableStreaming(caption);
+                    }
                     BOOL res2 = BuildScriptMain(script, type, auxTargetPath, mask, count, indexes,
                                                 f, NULL, &changeCaseData, countSizeMode != 0,
                                                 criteriaPtr);
                     // if there's nothing to do, don't show the progress dialog
                     BOOL emptyScript = script->Count == 0 && type != atCountSize;
+                    BOOL streamed = script->IsStreamStarted();
+                    if (streamed) // the operation is already running, hand the rest of the script over to the worker
+                    {
+                        script->EndStreaming(res2); // the worker frees the script, we must not touch it anymore
+                        script = NULL;
+                    }
 
                     // swapped to allow activation of the main window (must not be disabled), otherwise it switches to another app
                     EnableWindow(MainWindow->HWindow, TRUE);
@@ -1056,7 +1069,7 @@ void CFilesWindow::FilesAction(CActionType type, CFilesWindow* target, int count
                     SetCursor(oldCur);
 
                     BOOL cancel = FALSE;
-                    if (!emptyScript && res2 && (type == atCopy || type == atMove))
+                    if (!streamed && !emptyScript && res2 && (type == atCopy || type == atMove))
                     {
                         BOOL occupiedSpTooBig = script->OccupiedSpace != CQuadWord(0, 0) &&
                                                 script->BytesPerCluster != 0 && // we have disk information
@@ -1081,7 +1094,7 @@ void CFilesWindow::FilesAction(CActionType type, CFilesWindow* target, int count
                     if (!cancel)
                     {
                         // prepare refresh of directories that are not auto-refreshed
-                        if (!emptyScript && type != atCountSize)
+                        if (!streamed && !emptyScript && type != atCountSize)
                         {
                             if (type == atDelete || type == atChangeCase || type == atMove)
                             {
@@ -1100,7 +1113,7 @@ void CFilesWindow::FilesAction(CActionType type, CFilesWindow* target, int count
                             }
                         }
 
-                        if (!emptyScript &&
+                        if (!streamed && !emptyScript &&
                             (!res2 || type == atCountSize ||
                              !StartProgressDialog(script, caption, NULL, NULL)))
                         {
@@ -382,6 +382,15 @@ CFilesWindow::WindowProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
                         InactiveRefreshTimerSet = FALSE;
                         return 0;
                     }
+                    else
+                    {
+                        if (wParam == IDT_LISTINGBATCH)
+                        {
+                            KillTimer(HWindow, IDT_LISTINGBATCH); // pokud uz cteni skoncilo, jde jen o "zatoulany" WM_TIMER
+                            ReadDirectoryBatch();                // pridame dalsi nactene polozky adresare
+                            return 0;
+                        }
+                    }
                 }
             }
         }
@@ -557,7 +566,16 @@ CFilesWindow::WindowProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
         }
         else
         {
-            if (SnooperSuspended || StopRefresh)
+            if (ProgressiveListing != NULL)
+            { // zbytek adresare se jeste cte (refresh by cteni zrusil), refresh se postne az po jeho docteni (viz ReadDirectoryBatch)
+                NeedRefreshAfterListing = TRUE;
+                RefreshAfterListingTime = max(RefreshAfterListingTime, (int)lParam);
+                if ((uMsg == WM_USER_S_REFRESH_DIR || uMsg == WM_USER_SM_END_NOTIFY_DELAYED) && setWait)
+                {
+                    SetCursor(oldCur);
+                }
+            }
+            else if (SnooperSuspended || StopRefresh)
             { // uz je zapnuty suspend mode (pracuje se nad vnitrnimi daty -> nelze je refreshnout)
                 NeedRefreshAfterEndOfSM = TRUE;
                 RefreshAfterEndOfSMTime = max(RefreshAfterEndOfSMTime, (int)lParam);
@@ -668,6 +686,12 @@ CFilesWindow::WindowProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
         return 0;
     }
 
+    case WM_USER_LISTINGBATCH: // thread cteni adresare zverejnil dalsi nactene polozky
+    {
+        ReadDirectoryBatch();
+        return 0;
+    }
+
     case WM_USER_REFRESH_PLUGINFS:
     {
         if (SnooperSuspended || StopRefresh)
@@ -1057,6 +1081,7 @@ CFilesWindow::WindowProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
         EnumFileNamesRemoveSourceUID(HWindow);
 
         CancelUI(); // cancel QuickSearch and QuickEdit
+        StopProgressiveListing(); // zbytek adresare uz nacitat nebudeme
         LastRefreshTime = INT_MAX;
         BeginStopRefresh();
         DetachDirectory(this);
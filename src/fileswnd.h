@@ -163,6 +163,8 @@ class CSalamanderDirectory;
 struct IContextMenu2;
 class CPathHistory;
 class CFilesWindow;
+struct CDiskListingContext;
+class CDirSizeCalculator;
 class CMenuNew;
 class CMenuPopup;
 
@@ -814,6 +816,10 @@ public:
     BOOL NeedRefreshAfterIconsReading; // is a refresh needed after icon reading finishes?
     int RefreshAfterIconsReadingTime;  // "time" of the latest refresh that arrived while icons were being read
 
+    CDiskListingContext* ProgressiveListing; // disk directory whose rest is still being read in the background (NULL = none), see ReadDirectoryBatch()
+    BOOL NeedRefreshAfterListing;            // is a refresh needed after the progressive listing finishes?
+    int RefreshAfterListingTime;             // "time" of the latest refresh that arrived while the directory was being read
+
     CPathHistory* PathHistory; // browsing history for this panel (for the panel)
 
     DWORD HiddenDirsFilesReason; // bit field indicating the reason why files/directories are hidden (HIDDEN_REASON_xxx)
@@ -1319,6 +1325,11 @@ public:
                          BOOL onlySize, FILETIME* fileLastWriteTime, DWORD srcAndTgtPathsFlags);
     BOOL BuildScriptMain2(COperations* script, BOOL copy, char* targetDir,
                           CCopyMoveData* data);
+    // BuildScriptMain helper: calculates the sizes of the selected directories in 'sourcePath'
+    // on a pool of threads (see CDirSizeCalculator) and reports the directories which could not
+    // be listed; returns FALSE if the calculation was cancelled
+    BOOL CalculateDirSizesConcurrently(CDirSizeCalculator* calc, char* sourcePath, int selCount,
+                                       int* selection, CFileData* oneFile);
 
     virtual LRESULT WindowProc(UINT uMsg, WPARAM wParam, LPARAM lParam);
 
@@ -1327,9 +1338,41 @@ public:
     // error or out of memory). For ptZIPArchive and ptPluginFS it returns FALSE only when memory
     // runs out or if the path does not exist (checked before calling ReadDirectory, should not happen);
     // 'parent' is the parent of message boxes;
-    // if TRUE is returned, SortDirectory() is also called
+    // if TRUE is returned, SortDirectory() is also called;
+    // a large or slow disk directory (not on refresh) can be shown before it is read completely:
+    // after LISTREAD_FIRST_TAKE_PERIOD ms the sorted part read so far is returned and the rest
+    // is added by ReadDirectoryBatch() (see ProgressiveListing)
     BOOL ReadDirectory(HWND parent, BOOL isRefresh);
 
+    // adds the items published by the thread reading the disk directory to the sorted Files
+    // and Dirs and redraws the panel (keeps the top index and focus); called on WM_USER_LISTINGBATCH
+    // and IDT_LISTINGBATCH, when the listing is read completely it ends the progressive listing
+    void ReadDirectoryBatch();
+
+    // ends the progressive listing of the disk directory (if any), the part read so far stays
+    // in the panel
+    void StopProgressiveListing();
+
+    // the item 'name' should be focused when it is read (it is not in the part of the progressive
+    // listing read so far); the focus is not moved if the user moves it meanwhile
+    void SetProgressiveListingFocus(const char* name);
+
+    // helpers of ReadDirectory() and ReadDirectoryBatch() for a disk directory:
+    // returns TRUE if the read item should not be in the listing (counts the hidden items)
+    BOOL SkipDiskListingItem(CDiskListingContext* ctx, const WIN32_FIND_DATA* fileData);
+    // adds the read item to Files or Dirs (and its icon or thumbnail to IconCache); returns
+    // FALSE on low memory; CAUTION: the extension of a file in 'fileData' is changed
+    BOOL AddDiskListingItem(CDiskListingContext* ctx, WIN32_FIND_DATA* fileData);
+    // adds ".." if the path has it and it was not read; returns FALSE on low memory
+    BOOL AddDiskListingUpDir(CDiskListingContext* ctx);
+#ifndef _WIN64
+    // adds the win64 redirected-dirs of the path, 'added' returns TRUE if Dirs changed;
+    // returns FALSE on low memory
+    BOOL AddDiskListingRedirectedDirs(CDiskListingContext* ctx, BOOL* added);
+#endif // _WIN64
+    // releases the listing after an error of reading the disk directory
+    void ClearDiskListing();
+
     // sorts Files and Dirs using the current ordering method; because it reorders them,
     // icon loading for Files and Dirs must be paused during sorting (see SleepIconCacheThread())
     void SortDirectory(CFilesArray* files = NULL, CFilesArray* dirs = NULL);
@@ -7,6 +7,9 @@
 #include "cfgdlg.h"
 #include "find.h"
 #include "md5.h"
+#include "dirwalk.h"
+#include "findidx.h"
+#include "findarc.h"
 
 char* FindNamedHistory[FIND_NAMED_HISTORY_SIZE];
 char* FindLookInHistory[FIND_LOOKIN_HISTORY_SIZE];
@@ -109,6 +112,7 @@ void ClearFindHistory(BOOL dataOnly)
 void ReleaseFind()
 {
     ClearFindHistory(TRUE); // we only release data
+    FindIndex.Release();
     if (FindDialogContinue != NULL)
         HANDLES(CloseHandle(FindDialogContinue));
 }
@@ -664,12 +668,382 @@ BOOL CFindIgnore::Set(int index, BOOL enabled, const char* path)
 // 1) In the first phase, all files matching the Find criteria are added
 //    to the CDuplicateCandidates object using the Add method.
 // 2) Then the Examine() method is called which sorts the array using data->FindDupFlags criteria. If file contents
-//    are compared, MD5 digests are calculated for potentially identical files.
-//    Then, the array is sorted again and single files are removed so
-//    Only files that appear at least twice remain in the array.
+//    are compared, the files are examined in stages, each stage only reads files which
+//    still have a potential duplicate: first an MD5 of sampled blocks (beginning, middle
+//    and end of the file; small files are hashed whole), then a full MD5 of the remaining
+//    large files and optionally (Configuration.FindDupCompareBytes) a byte-for-byte
+//    comparison with the first file of the group. After each stage the array is sorted
+//    again and single files are removed so only files that appear at least twice remain.
 //    These get a Group variable so that sets can be distinguished in the result window.
 //
 
+#define DUPLICATES_BUFFER_SIZE (64 * 1024) // buffer size for reading files (MD5 calculation and comparison)
+#define DUPLICATES_SAMPLE_SIZE (64 * 1024) // size of one sampled block (three blocks are sampled)
+#define DUPLICATES_MAX_THREADS 8           // upper limit for the number of threads reading files
+
+// files up to this size are hashed whole already in the sampled stage
+#define DUPLICATES_SAMPLED_LIMIT CQuadWord(3 * DUPLICATES_SAMPLE_SIZE, 0)
+
+enum CDuplicateStage
+{
+    dsSampledMD5, // MD5 of the sampled blocks (the whole file if it is not larger than DUPLICATES_SAMPLED_LIMIT)
+    dsFullMD5,    // MD5 of the whole file
+    dsCompare,    // byte-for-byte comparison with CDuplicateJob::Reference
+};
+
+struct CDuplicateJob
+{
+    CFoundFilesData* File;      // examined file; NULL = the item is not examined in this stage
+    CFoundFilesData* Reference; // dsCompare: the file 'File' is compared with
+    BOOL Done;                  // TRUE = the file was examined successfully (and is equal to 'Reference')
+};
+
+//*********************************************************************************
+//
+// CDuplicateExaminer
+//
+// Runs one stage of CDuplicateCandidates::Examine() on a pool of threads (the calling
+// thread works as well). Reading many files at once hides the latency of seeking and
+// of the network, the threads take the jobs in the order of the array.
+//
+
+class CDuplicateExaminer
+{
+protected:
+    CGrepData* Data;
+    CDuplicateStage Stage;
+    CDuplicateJob* Jobs;
+    int JobsCount;
+    volatile LONG NextJob; // index of the next job to take
+
+    CRITICAL_SECTION CS; // guards the progress
+    CQuadWord ReadSize;  // number of bytes read so far in this stage
+    CQuadWord TotalSize; // number of bytes read in this stage
+    int Progress;        // value shown in the status bar (we do not update the same progress repeatedly)
+
+public:
+    CDuplicateExaminer(CGrepData* data, CDuplicateStage stage, CDuplicateJob* jobs, int count);
+    ~CDuplicateExaminer();
+
+    // examines all jobs using 'threads' threads; returns after all jobs are processed
+    // or the user has stopped the search
+    void Run(int threads);
+
+protected:
+    void WorkerBody();
+
+    // examines one job using 'buffer' (2 * DUPLICATES_BUFFER_SIZE bytes); returns TRUE on
+    // success; the digest is stored at (BYTE*)job->File->Group; returns FALSE on errors
+    // (they are reported to the log), if the files differ or the user has stopped the search
+    BOOL ExamineFile(CDuplicateJob* job, BYTE* buffer);
+
+    // opens file 'file' for reading; reports errors to the log; 'fullPath' receives the
+    // full name of the file (MAX_PATH characters)
+    HANDLE OpenFile(CFoundFilesData* file, char* fullPath);
+
+    // reads 'size' bytes (or less at the end of the file) to 'buffer'; reports errors to
+    // the log; returns FALSE on errors or if the user has stopped the search
+    BOOL ReadBlock(HANDLE hFile, const char* fullPath, BYTE* buffer, DWORD size, DWORD* read);
+
+    void AddProgress(DWORD read);
+
+    friend unsigned DuplicateExaminerThreadBody(void* param);
+};
+
+// returns the number of threads reading files while searching for duplicates
+int GetDuplicateExaminerCount(int configured)
+{
+    if (configured > 0)
+        return min(configured, DUPLICATES_MAX_THREADS);
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = (int)si.dwNumberOfProcessors;
+    if (count < 2)
+        count = 2; // reading is mostly waiting for the disk, even one processor manages two threads
+    if (count > 4)
+        count = 4; // more parallel reads would only make a classic disk seek
+    return count;
+}
+
+unsigned DuplicateExaminerThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("DuplicateExaminerThreadBody()");
+    SetThreadNameInVCAndTrace("FindDuplicates");
+    ((CDuplicateExaminer*)param)->WorkerBody();
+    return 0;
+}
+
+unsigned DuplicateExaminerThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return DuplicateExaminerThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread FindDuplicates: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // harder exit (this call still performs some operations)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI DuplicateExaminerThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return DuplicateExaminerThreadEH(param);
+}
+
+CDuplicateExaminer::CDuplicateExaminer(CGrepData* data, CDuplicateStage stage, CDuplicateJob* jobs, int count)
+{
+    Data = data;
+    Stage = stage;
+    Jobs = jobs;
+    JobsCount = count;
+    NextJob = 0;
+    HANDLES(InitializeCriticalSection(&CS));
+    ReadSize.Set(0, 0);
+    TotalSize.Set(0, 0);
+    Progress = -1;
+
+    // determine the number of bytes read in this stage for the progress
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        CFoundFilesData* file = jobs[i].File;
+        if (file != NULL)
+        {
+            if (stage == dsSampledMD5 && file->Size > DUPLICATES_SAMPLED_LIMIT)
+                TotalSize += DUPLICATES_SAMPLED_LIMIT;
+            else
+                TotalSize += file->Size;
+        }
+    }
+}
+
+CDuplicateExaminer::~CDuplicateExaminer()
+{
+    HANDLES(DeleteCriticalSection(&CS));
+}
+
+void CDuplicateExaminer::Run(int threads)
+{
+    CALL_STACK_MESSAGE3("CDuplicateExaminer::Run(%d, %d)", Stage, threads);
+    HANDLE threadHandles[DUPLICATES_MAX_THREADS];
+    int count = 0;
+    int i;
+    for (i = 1; i < threads && i < DUPLICATES_MAX_THREADS && i < JobsCount; i++)
+    {
+        DWORD threadID;
+        threadHandles[count] = HANDLES(CreateThread(NULL, 0, DuplicateExaminerThread, this, 0, &threadID));
+        if (threadHandles[count] == NULL)
+        {
+            TRACE_E("CDuplicateExaminer::Run(): unable to start thread.");
+            break; // the remaining threads do the work
+        }
+        SetThreadPriority(threadHandles[count], GetThreadPriority(GetCurrentThread()));
+        count++;
+    }
+
+    WorkerBody();
+
+    for (i = 0; i < count; i++)
+    {
+        WaitForSingleObject(threadHandles[i], INFINITE);
+        HANDLES(CloseHandle(threadHandles[i]));
+    }
+}
+
+void CDuplicateExaminer::WorkerBody()
+{
+    BYTE* buffer = (BYTE*)malloc(2 * DUPLICATES_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return; // the other threads do the work (jobs nobody takes are dropped like unreadable files)
+    }
+    while (!Data->StopSearch)
+    {
+        int index = InterlockedIncrement(&NextJob) - 1;
+        if (index >= JobsCount)
+            break;
+        CDuplicateJob* job = &Jobs[index];
+        if (job->File != NULL)
+            job->Done = ExamineFile(job, buffer);
+    }
+    free(buffer);
+}
+
+HANDLE CDuplicateExaminer::OpenFile(CFoundFilesData* file, char* fullPath)
+{
+    // build full path to the file
+    lstrcpyn(fullPath, file->Path, MAX_PATH);
+    SalPathAppend(fullPath, file->Name, MAX_PATH);
+
+    // open the file for reading with sequential access
+    HANDLE hFile = HANDLES_Q(CreateFile(fullPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        // error occured while opening the file
+        DWORD err = GetLastError();
+
+        char buf[MAX_PATH + 100];
+        sprintf(buf, LoadStr(IDS_ERROR_OPENING_FILE2), GetErrorText(err));
+        FIND_LOG_ITEM log;
+        log.Flags = FLI_ERROR;
+        log.Text = buf;
+        log.Path = fullPath;
+        SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+    }
+    return hFile;
+}
+
+BOOL CDuplicateExaminer::ReadBlock(HANDLE hFile, const char* fullPath, BYTE* buffer, DWORD size, DWORD* read)
+{
+    if (!ReadFile(hFile, buffer, size, read, NULL))
+    {
+        // error reading the file
+        DWORD err = GetLastError();
+
+        char buf[MAX_PATH + 100];
+        sprintf(buf, LoadStr(IDS_ERROR_READING_FILE2), GetErrorText(err));
+        FIND_LOG_ITEM log;
+        log.Flags = FLI_ERROR;
+        log.Text = buf;
+        log.Path = fullPath;
+        SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+        return FALSE;
+    }
+    // does the user want to stop the operation?
+    if (Data->StopSearch)
+        return FALSE;
+    AddProgress(*read);
+    return TRUE;
+}
+
+void CDuplicateExaminer::AddProgress(DWORD read)
+{
+    if (read == 0)
+        return;
+    HANDLES(EnterCriticalSection(&CS));
+    // compute and display progress (if the 'progress' value changed)
+    ReadSize += CQuadWord(read, 0);
+    int newProgress = ReadSize >= TotalSize ? (TotalSize.Value == 0 ? 0 : 100) : (int)((ReadSize * CQuadWord(100, 0)) / TotalSize).Value;
+    if (newProgress != Progress)
+    {
+        Progress = newProgress;
+        char buff[2];
+        buff[0] = (BYTE)newProgress; // pass the numeric value directly instead of a string
+        buff[1] = 0;
+        Data->SearchingText2->Set(buff); // update the total progress
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+}
+
+BOOL CDuplicateExaminer::ExamineFile(CDuplicateJob* job, BYTE* buffer)
+{
+    char fullPath[MAX_PATH];
+    HANDLE hFile = OpenFile(job->File, fullPath);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    Data->SearchingText->Set(fullPath); // set the current file
+
+    BOOL ret = TRUE;
+    DWORD read; // number of bytes that were actually read
+    if (Stage == dsCompare)
+    {
+        char refPath[MAX_PATH];
+        HANDLE hRef = OpenFile(job->Reference, refPath);
+        if (hRef == INVALID_HANDLE_VALUE)
+            ret = FALSE;
+        else
+        {
+            DWORD refRead;
+            while (TRUE)
+            {
+                if (!ReadBlock(hFile, fullPath, buffer, DUPLICATES_BUFFER_SIZE, &read) ||
+                    !ReadFile(hRef, buffer + DUPLICATES_BUFFER_SIZE, DUPLICATES_BUFFER_SIZE, &refRead, NULL))
+                {
+                    ret = FALSE; // an error of the reference file is reported when it is compared with other files
+                    break;
+                }
+                if (read != refRead || memcmp(buffer, buffer + DUPLICATES_BUFFER_SIZE, read) != 0)
+                {
+                    TRACE_I("Files with the same MD5 digest differ: " << fullPath << ", " << refPath);
+                    ret = FALSE;
+                    break;
+                }
+                // if fewer bytes were read than the buffer size, we are done
+                if (read != DUPLICATES_BUFFER_SIZE)
+                    break;
+            }
+            HANDLES(CloseHandle(hRef));
+        }
+    }
+    else
+    {
+        MD5 context;
+        if (Stage == dsSampledMD5 && job->File->Size > DUPLICATES_SAMPLED_LIMIT)
+        {
+            // beginning, middle and end of the file (the middle block is aligned to the block size)
+            CQuadWord offsets[3];
+            offsets[0].Set(0, 0);
+            offsets[1] = (job->File->Size / CQuadWord(2 * DUPLICATES_SAMPLE_SIZE, 0)) * CQuadWord(DUPLICATES_SAMPLE_SIZE, 0);
+            offsets[2] = job->File->Size - CQuadWord(DUPLICATES_SAMPLE_SIZE, 0);
+            int i;
+            for (i = 0; i < 3 && ret; i++)
+            {
+                LONG high = (LONG)offsets[i].HiDWord;
+                if (SetFilePointer(hFile, offsets[i].LoDWord, &high, FILE_BEGIN) == INVALID_SET_FILE_POINTER &&
+                        GetLastError() != NO_ERROR ||
+                    !ReadBlock(hFile, fullPath, buffer, DUPLICATES_SAMPLE_SIZE, &read))
+                {
+                    ret = FALSE;
+                }
+                else
+                    context.update(buffer, read);
+            }
+        }
+        else
+        {
+            while (TRUE)
+            {
+                // read a segment from a file 'file' into 'buffer'
+                if (!ReadBlock(hFile, fullPath, buffer, DUPLICATES_BUFFER_SIZE, &read))
+                {
+                    ret = FALSE;
+                    break;
+                }
+                // if anything was read, update the MD5
+                if (read > 0)
+                    context.update(buffer, read);
+                // if fewer bytes were read than the buffer size, we are done
+                if (read != DUPLICATES_BUFFER_SIZE)
+                    break;
+            }
+        }
+        if (ret)
+        {
+            context.finalize();
+            memcpy((BYTE*)job->File->Group, context.digest, MD5_DIGEST_SIZE);
+        }
+    }
+    HANDLES(CloseHandle(hFile));
+    return ret;
+}
+
+//*********************************************************************************
+//
+// CDuplicateCandidates
+//
+
 class CDuplicateCandidates : public TIndirectArray<CFoundFilesData>
 {
 public:
@@ -703,18 +1077,13 @@ protected:
     // Group values; groups are numbered increasingly (0, 1, 2, 3, 4, 5, ...)
     void SetGroupByDifferentFlag();
 
-    // compute MD5 from the file 'file'
-    // 'progress' is the numeric value shown in the status bar (optimized so we do not
-    // update the same porgress repeatedly)
-    // 'readSize' holds the number of bytes read so far across all files
-    // 'totalSize' is the total number of bytes of all files for which the MD5 digest
-    // will be determined
-    // the method returns TRUE, if the MD5 value was successfully read; the digest is stored at
-    // (BYTE*)data->Group
-    // the method returns FALSE on read errors or when the user aborts the operation
-    // (then, the variable data->StopSearch is set to TRUE)
-    BOOL GetMD5Digest(CGrepData* data, CFoundFilesData* file,
-                      int* progress, CQuadWord* readSize, const CQuadWord* totalSize);
+    // runs stage 'stage' of the content comparison (see CDuplicateExaminer) for the stored
+    // files; dsSampledMD5 examines all files larger than 0 bytes, dsFullMD5 only files
+    // larger than DUPLICATES_SAMPLED_LIMIT and dsCompare compares the files with the
+    // first file of their group (the array must be sorted with QuickSort); files which
+    // could not be examined (errors, the user has stopped the search) or differ from the
+    // first file of the group are removed; returns FALSE on low memory
+    BOOL ExamineContents(CGrepData* data, CDuplicateStage stage, BOOL byName);
 };
 
 int CDuplicateCandidates::CompareFunc(CFoundFilesData* f1, CFoundFilesData* f2,
@@ -750,7 +1119,7 @@ int CDuplicateCandidates::CompareFunc(CFoundFilesData* f1, CFoundFilesData* f2,
         // byName && !bySize
         res = RegSetStrICmp(f1->Name, f2->Name);
     }
-    if (byPath && res == 0)
+    if (byPath && res == 0 && f1->Path != f2->Path) // paths of items from one directory are interned
         res = RegSetStrICmp(f1->Path, f2->Path);
     return res;
 }
@@ -817,97 +1186,72 @@ LABEL_QuickSort:
     }
 }
 
-#define DUPLICATES_BUFFER_SIZE 16384 // buffer size for MD5 calculation
-
-BOOL CDuplicateCandidates::GetMD5Digest(CGrepData* data, CFoundFilesData* file,
-                                        int* progress, CQuadWord* readSize, const CQuadWord* totalSize)
+BOOL CDuplicateCandidates::ExamineContents(CGrepData* data, CDuplicateStage stage, BOOL byName)
 {
-    // build full path to the file
-    char fullPath[MAX_PATH];
-    lstrcpyn(fullPath, file->Path, MAX_PATH);
-    SalPathAppend(fullPath, file->Name, MAX_PATH);
-
-    data->SearchingText->Set(fullPath); // set the current file
-
-    // open the file for reading with sequential access
-    HANDLE hFile = HANDLES_Q(CreateFile(fullPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
-                                        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
-    if (hFile != INVALID_HANDLE_VALUE)
+    CDuplicateJob* jobs = (CDuplicateJob*)malloc(Count * sizeof(CDuplicateJob));
+    if (jobs == NULL)
     {
-        BYTE buffer[DUPLICATES_BUFFER_SIZE];
-        MD5 context;
-        DWORD read; // number of bytes that were actually read
-        while (TRUE)
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    CFoundFilesData* reference = NULL;
+    int i;
+    for (i = 0; i < Count; i++)
+    {
+        CFoundFilesData* file = At(i);
+        CDuplicateJob* job = &jobs[i];
+        job->File = NULL;
+        job->Reference = NULL;
+        job->Done = TRUE;
+        switch (stage)
         {
-            // read a segment from a file 'file' into 'buffer'
-            if (!ReadFile(hFile, buffer, DUPLICATES_BUFFER_SIZE, &read, NULL))
-            {
-                // error reading the file
-                DWORD err = GetLastError();
-                HANDLES(CloseHandle(hFile));
-
-                char buf[MAX_PATH + 100];
-                sprintf(buf, LoadStr(IDS_ERROR_READING_FILE2), GetErrorText(err));
-                FIND_LOG_ITEM log;
-                log.Flags = FLI_ERROR;
-                log.Text = buf;
-                log.Path = fullPath;
-                SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
-
-                return FALSE;
-            }
+        case dsSampledMD5:
+        {
+            if (file->Size > CQuadWord(0, 0))
+                job->File = file;
+            break;
+        }
 
-            // does the user want to stop the operation?
-            if (data->StopSearch)
-            {
-                HANDLES(CloseHandle(hFile));
-                return FALSE;
-            }
+        case dsFullMD5:
+        {
+            if (file->Size > DUPLICATES_SAMPLED_LIMIT)
+                job->File = file;
+            break;
+        }
 
-            // if anything was read, update the MD5
-            if (read > 0)
+        case dsCompare:
+        {
+            if (reference == NULL || CompareFunc(reference, file, byName, TRUE, TRUE, FALSE) != 0)
+                reference = file; // first file of the group
+            else
             {
-                context.update(buffer, read);
-
-                // compute and display progress (if the 'progress' value changed)
-                *readSize += CQuadWord(read, 0);
-                char buff[100];
-                int newProgress = *readSize >= *totalSize ? (totalSize->Value == 0 ? 0 : 100) : (int)((*readSize * CQuadWord(100, 0)) / *totalSize).Value;
-                if (newProgress != *progress)
+                if (file->Size > CQuadWord(0, 0))
                 {
-                    *progress = newProgress;
-                    buff[0] = (BYTE)newProgress; // pass the numeric value directly instead of a string
-                    buff[1] = 0;
-                    data->SearchingText2->Set(buff); // update the total progress
+                    job->File = file;
+                    job->Reference = reference;
                 }
             }
-
-            // if fewer bytes were read than the buffer size, we are done
-            if (read != DUPLICATES_BUFFER_SIZE)
-                break;
+            break;
         }
-        HANDLES(CloseHandle(hFile));
-
-        context.finalize();
-        memcpy((BYTE*)file->Group, context.digest, MD5_DIGEST_SIZE);
-
-        return TRUE;
+        }
+        if (job->File != NULL)
+            job->Done = FALSE;
     }
-    else
-    {
-        // error occured while opening the file
-        DWORD err = GetLastError();
 
-        char buf[MAX_PATH + 100];
-        sprintf(buf, LoadStr(IDS_ERROR_OPENING_FILE2), GetErrorText(err));
-        FIND_LOG_ITEM log;
-        log.Flags = FLI_ERROR;
-        log.Text = buf;
-        log.Path = fullPath;
-        SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+    CDuplicateExaminer examiner(data, stage, jobs, Count);
+    examiner.Run(GetDuplicateExaminerCount(Configuration.FindWorkerThreads));
 
-        return FALSE;
+    // remove the files which were not examined successfully (from the end, so the indexes of
+    // 'jobs' still correspond to the items); if the user has stopped the search after the
+    // sampled stage, the digests of large files are not final, so these files go as well
+    BOOL stopped = data->StopSearch;
+    for (i = Count - 1; i >= 0; i--)
+    {
+        if (!jobs[i].Done || stopped && stage == dsSampledMD5 && At(i)->Size > DUPLICATES_SAMPLED_LIMIT)
+            Delete(i);
     }
+    free(jobs);
+    return TRUE;
 }
 
 void CDuplicateCandidates::RemoveSingleFiles(BOOL byName, BOOL bySize, BOOL byMD5)
@@ -1065,46 +1409,33 @@ void CDuplicateCandidates::Examine(CGrepData* data)
                     file->Group = 0;
             }
 
-            // determine total file size for progress
-            CQuadWord totalSize(0, 0);
-            for (i = 0; i < Count; i++)
-                totalSize += At(i)->Size;
-
-            // retrieve the MD5 digest of files
-            CQuadWord readSize(0, 0);
-            int progress = -1;
-            for (i = Count - 1; i >= 0; i--)
+            // each stage reads only the files which still have a potential duplicate: files
+            // with different sampled blocks are never read whole; if the user stops the search,
+            // we show at least the duplicates that have been already found
+            CDuplicateStage stages[3] = {dsSampledMD5, dsFullMD5, dsCompare};
+            int stagesCount = Configuration.FindDupCompareBytes ? 3 : 2;
+            int s;
+            for (s = 0; s < stagesCount && Count > 0; s++)
             {
-                CFoundFilesData* file = At(i);
-                if (file->Size > CQuadWord(0, 0))
+                if (!ExamineContents(data, stages[s], byName))
                 {
-                    if (!GetMD5Digest(data, file, &progress, &readSize, &totalSize))
-                    {
-                        if (data->StopSearch)
-                        {
-                            // the user wants to stop searching
-                            // trim the unprocessed items
-                            int j;
-                            for (j = 0; j <= i; j++)
-                                Delete(0);
-                            break; // show at least the duplicates that have been already found
-                        }
-                        // an error occurred during reading the file but the user wants to continue
-                        // exclude the file from candidates
-                        Delete(i);
-                    }
+                    free(digest);
+                    return;
                 }
-            }
 
-            // search finished, preparing results
-            data->SearchingText->Set(LoadStr(IDS_FIND_DUPS_RESULTS));
+                // stage finished, preparing results
+                data->SearchingText->Set(LoadStr(IDS_FIND_DUPS_RESULTS));
 
-            // sort the files again
-            if (Count > 0)
-                QuickSort(0, Count - 1, byName, bySize, TRUE);
+                // sort the files again (comparing does not change the order)
+                if (stages[s] != dsCompare && Count > 0)
+                    QuickSort(0, Count - 1, byName, bySize, TRUE);
 
-            // remove items that occur only once
-            RemoveSingleFiles(byName, bySize, TRUE);
+                // remove items that occur only once
+                RemoveSingleFiles(byName, bySize, TRUE);
+
+                if (data->StopSearch)
+                    break;
+            }
         }
     }
 
@@ -1157,9 +1488,9 @@ void CSearchForData::Set(const char* dir, const char* masksGroup, BOOL includeSu
 // Search engine
 //
 
-#define SEARCH_SIZE 10000 // must be greater than the maximum string length
+#define SEARCH_SIZE (256 * 1024) // must be greater than the maximum string length; limits the time between StopSearch tests
 
-int SearchForward(CGrepData* data, char* txt, int size, int off)
+int SearchForward(CGrepData* data, CSearchData* searchData, char* txt, int size, int off)
 {
     if (size < 0)
         return -1;
@@ -1167,13 +1498,13 @@ int SearchForward(CGrepData* data, char* txt, int size, int off)
     int found;
     while (!data->StopSearch)
     {
-        if (curSize >= data->SearchData.GetLength())
-            found = data->SearchData.SearchForward(txt + curOff, curSize, 0); // find
+        if (curSize >= searchData->GetLength())
+            found = searchData->SearchForward(txt + curOff, curSize, 0); // find
         else
             break; // not found
         if (found == -1)
         {
-            curOff += curSize - data->SearchData.GetLength() + 1;
+            curOff += curSize - searchData->GetLength() + 1;
             curSize = min(SEARCH_SIZE, size - curOff);
         }
         else
@@ -1185,8 +1516,11 @@ int SearchForward(CGrepData* data, char* txt, int size, int off)
 //
 // ****************************************************************************
 
+// 'searchData' and 'regExp' are the patterns of the calling thread (they keep state while
+// searching, so every thread searching file contents must use its own copies)
 BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalSize,
-                        DWORD viewSize, const char* path, char* txt, CGrepData* data)
+                        DWORD viewSize, const char* path, char* txt, CGrepData* data,
+                        CSearchData* searchData, CRegularExpression* regExp)
 {
     __try
     {
@@ -1199,11 +1533,32 @@ BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalS
             BOOL EOL_CRLF = data->EOL_CRLF;
             beg = txt;
             totalEnd = txt + viewSize;
+            // every match contains the required literal of the expression or one of the literals
+            // of an alternation (if it has them), so the expression only has to be evaluated on
+            // lines containing the literal (the literals of "a|b|c" are searched in one pass)
+            BOOL useLiteral = regExp->HasRequiredLiterals();
+            char* literal = NULL; // next occurrence of the literal (totalEnd = none); NULL = not searched yet
 
             while (!data->StopSearch && beg < totalEnd)
             {
-                end = beg;
-                endLimit = beg + GREP_LINE_LEN;
+                if (useLiteral && (literal == NULL || literal < beg))
+                {
+                    int pos = regExp->FindRequiredLiteral(beg, (int)(totalEnd - beg));
+                    if (pos == -1) // the literal is not in the rest of the view
+                    {
+                        if (fileOffset + CQuadWord(viewSize, 0) >= totalSize) // the end of the file is in the view
+                        {
+                            beg = totalEnd; // no other line can match
+                            break;
+                        }
+                        literal = totalEnd; // the lines still have to be split (the last one may continue in the next view)
+                    }
+                    else
+                        literal = beg + pos;
+                }
+
+                end = beg;
+                endLimit = beg + GREP_LINE_LEN;
                 if (endLimit > totalEnd)
                     endLimit = totalEnd;
                 nextBeg = NULL;
@@ -1254,13 +1609,18 @@ BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalS
                 }
 
                 // line beg->end
-                if (data->RegExp.SetLine(beg, end))
+                if (useLiteral && literal >= end)
+                {
+                    beg = nextBeg; // the line does not contain the literal, it cannot match
+                    continue;
+                }
+                if (regExp->SetLine(beg, end))
                 {
                     int foundLen, start = 0;
 
                 GREP_REGEXP_NEXT:
 
-                    int found = data->RegExp.SearchForward(start, foundLen);
+                    int found = regExp->SearchForward(start, foundLen);
                     if (found != -1)
                     {
                         if (data->WholeWords)
@@ -1287,7 +1647,7 @@ BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalS
                 {
                     FIND_LOG_ITEM log;
                     log.Flags = FLI_ERROR;
-                    log.Text = data->RegExp.GetLastErrorText();
+                    log.Text = regExp->GetLastErrorText();
                     log.Path = NULL;
                     SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
                     return FALSE; // do not search this file further
@@ -1304,17 +1664,17 @@ BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalS
             int off = 0;
             while (1)
             {
-                off = SearchForward(data, txt, viewSize, off);
+                off = SearchForward(data, searchData, txt, viewSize, off);
                 if (off != -1)
                 {
                     if (data->WholeWords)
                     {
                         if ((fileOffset + CQuadWord(off, 0) == CQuadWord(0, 0) ||                                        // beginning of the file
                              off > 0 && txt[off - 1] != '_' && IsNotAlphaNorNum[txt[off - 1]]) &&                        // not at the start of the buffer and no letter or digit before the pattern
-                            (fileOffset + CQuadWord(off, 0) + CQuadWord(data->SearchData.GetLength(), 0) >= totalSize || // end of the file
-                             (DWORD)(off + data->SearchData.GetLength()) < viewSize &&                                   // not at the end of the buffer
-                                 txt[off + data->SearchData.GetLength()] != '_' &&
-                                 IsNotAlphaNorNum[txt[off + data->SearchData.GetLength()]])) // no letter or digit after the pattern
+                            (fileOffset + CQuadWord(off, 0) + CQuadWord(searchData->GetLength(), 0) >= totalSize || // end of the file
+                             (DWORD)(off + searchData->GetLength()) < viewSize &&                                   // not at the end of the buffer
+                                 txt[off + searchData->GetLength()] != '_' &&
+                                 IsNotAlphaNorNum[txt[off + searchData->GetLength()]])) // no letter or digit after the pattern
                         {
                             ok = TRUE; // found
                             break;
@@ -1333,9 +1693,9 @@ BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalS
             if (!ok && !data->StopSearch) // not found and not interrupted
             {
                 if (fileOffset + CQuadWord(viewSize, 0) < totalSize &&
-                    CQuadWord(data->SearchData.GetLength() + 1, 0) < CQuadWord(viewSize, 0))
+                    CQuadWord(searchData->GetLength() + 1, 0) < CQuadWord(viewSize, 0))
                 {
-                    fileOffset = fileOffset + CQuadWord(viewSize, 0) - CQuadWord(data->SearchData.GetLength() + 1, 0);
+                    fileOffset = fileOffset + CQuadWord(viewSize, 0) - CQuadWord(searchData->GetLength() + 1, 0);
                 }
                 else
                     fileOffset = totalSize; // the pattern cannot be in the file anymore
@@ -1356,7 +1716,8 @@ BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalS
     }
 }
 
-BOOL TestFileContent(DWORD sizeLow, DWORD sizeHigh, const char* path, CGrepData* data, BOOL isLink)
+BOOL TestFileContent(DWORD sizeLow, DWORD sizeHigh, const char* path, CGrepData* data, BOOL isLink,
+                     CSearchData* searchData, CRegularExpression* regExp)
 {
     CQuadWord totalSize(sizeLow, sizeHigh);
     CQuadWord fileOffset(0, 0);
@@ -1404,7 +1765,7 @@ BOOL TestFileContent(DWORD sizeLow, DWORD sizeHigh, const char* path, CGrepData*
                             // let the file view be examined
                             DWORD diff = (DWORD)(fileOffset - mapFileOffset).Value;
                             BOOL err2 = !TestFileContentAux(ok, fileOffset, totalSize, viewSize - diff,
-                                                            path, txt + diff, data);
+                                                            path, txt + diff, data, searchData, regExp);
                             HANDLES(UnmapViewOfFile(txt));
                             if (err2 || ok)
                                 break;
@@ -1419,98 +1780,737 @@ BOOL TestFileContent(DWORD sizeLow, DWORD sizeHigh, const char* path, CGrepData*
                     err = GetLastError();
             }
             else
-                getLinkFileSizeErr = TRUE;
-            HANDLES(CloseHandle(hFile));
+                getLinkFileSizeErr = TRUE;
+            HANDLES(CloseHandle(hFile));
+        }
+        else
+            err = GetLastError();
+
+        if (err != ERROR_SUCCESS || getLinkFileSizeErr)
+        {
+            char buf[MAX_PATH + 100];
+            sprintf(buf, LoadStr(getLinkFileSizeErr ? IDS_GETLINKTGTFILESIZEERROR : IDS_ERROR_OPENING_FILE2),
+                    GetErrorText(err));
+            FIND_LOG_ITEM log;
+            log.Flags = FLI_ERROR;
+            log.Text = buf;
+            log.Path = path;
+            SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+        }
+    }
+
+    return ok;
+}
+
+BOOL AddFoundItem(const char* path, const char* name, DWORD sizeLow, DWORD sizeHigh,
+                  DWORD attr, const FILETIME* lastWrite, BOOL isDir, CGrepData* data,
+                  CDuplicateCandidates* duplicateCandidates, BOOL inArchive)
+{
+    if (duplicateCandidates != NULL && isDir) // directories are irrelevant to us when searching for duplicates
+        return TRUE;
+
+    CFoundFilesData* foundData = new CFoundFilesData;
+    if (foundData != NULL)
+    {
+        BOOL good = foundData->Set(&data->FoundFilesListView->Strings, path, name,
+                                   CQuadWord(sizeLow, sizeHigh),
+                                   attr, lastWrite, isDir);
+        if (good)
+        {
+            foundData->InArchive = inArchive ? 1 : 0;
+            if (duplicateCandidates == NULL)
+            {
+                // duplicateCandidates == NULL, adding the item to data->FoundFilesListView
+                data->FoundFilesListView->Add(foundData);
+                if (!data->FoundFilesListView->IsGood())
+                {
+                    data->FoundFilesListView->ResetState();
+                    delete foundData;
+                    foundData = NULL;
+                }
+                else
+                {
+                    // request a listview redraw after every 100 added items
+                    // also after 0.5 seconds has passed since the last redraw
+                    // we also call update for each item when grepping
+                    if (data->FoundFilesListView->GetCount() >= data->FoundVisibleCount + 100 ||
+                        GetTickCount() - data->FoundVisibleTick >= 500
+                        /* || data->Grep*/) // a half-second update interval is enough even for grepping
+                    {
+                        SendMessage(data->HWindow, WM_USER_ADDFILE, 0, 0);
+                    }
+                    else
+                        data->NeedRefresh = TRUE; // we will redraw at latest after 0.5 second
+                }
+            }
+            else
+            {
+                // duplicateCandidates != NULL, adding the item to duplicateCandidates
+                duplicateCandidates->Add(foundData);
+                if (!duplicateCandidates->IsGood())
+                {
+                    duplicateCandidates->ResetState();
+                    delete foundData;
+                    foundData = NULL;
+                }
+            }
+        }
+        else
+        {
+            delete foundData;
+            foundData = NULL;
+        }
+    }
+    if (foundData == NULL)
+    {
+        FIND_LOG_ITEM log;
+        log.Flags = FLI_ERROR;
+        log.Text = LoadStr(IDS_CANTSHOWRESULTS);
+        log.Path = NULL;
+        SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+
+        data->StopSearch = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CGrepPipeline
+//
+// Content search split into stages: the grep thread walks the directories and submits
+// candidate files, reader threads prefetch small files into memory (the total size of
+// prefetched data is limited by GREP_PREFETCH_POOL) and matcher threads search them
+// (larger files are mapped and searched directly by the matcher). Results are handed
+// back in the grep thread in the order of submission, so the found files appear in
+// the same order as with the sequential search.
+//
+
+#define GREP_PIPELINE_WINDOW 256              // max. number of submitted files not handed back yet
+#define GREP_PIPELINE_READERS 4               // number of reader threads (more pending reads hide network latency)
+#define GREP_PIPELINE_MAX_MATCHERS 16         // upper limit for the number of matcher threads
+#define GREP_PREFETCH_FILE (1024 * 1024)      // larger files are not prefetched, the matcher maps them
+#define GREP_PREFETCH_POOL (32 * 1024 * 1024) // max. total size of prefetched data
+
+// returns the number of matcher threads; 1 means the pipeline should not be used
+int GetGrepMatcherCount(int configured)
+{
+    if (configured > 0)
+        return min(configured, GREP_PIPELINE_MAX_MATCHERS);
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = (int)si.dwNumberOfProcessors;
+    if (count < 2)
+        count = 2; // even on one processor one thread waits for the disk while the other one searches
+    if (count > 8)
+        count = 8;
+    return count;
+}
+
+struct CGrepJob
+{
+    char* Path;                  // full name of the file (allocated); NULL if the file is not tested
+    int NameOffset;              // offset of the file name in 'Path'
+    DWORD SizeLow, SizeHigh;     // file size (zero for links)
+    DWORD Attr;                  // file attributes
+    FILETIME LastWrite;          // time of the last write
+    BOOL IsLink;                 // the file is a link (the size must be obtained from the target)
+    BOOL IsDir;                  // the item is a directory (only items found without searching, see SubmitFound)
+    BOOL InArchive;              // the item is an entry of an archive (only items found without searching)
+    CFoundFilesData* RefineItem; // refine: the tested item (owned by the list view), otherwise NULL
+
+    char* Buffer;     // prefetched content of the file or NULL (the matcher maps the file)
+    DWORD BufferSize; // size of 'Buffer'
+
+    BOOL Found;     // TRUE = the file contains the searched text
+    BOOL Done;      // TRUE = the job was processed and can be handed back
+    CGrepJob* Next; // next job in the queue of the reader or matcher threads
+
+    CGrepJob()
+    {
+        Path = NULL;
+        NameOffset = 0;
+        SizeLow = SizeHigh = Attr = 0;
+        LastWrite.dwLowDateTime = LastWrite.dwHighDateTime = 0;
+        IsLink = FALSE;
+        IsDir = FALSE;
+        InArchive = FALSE;
+        RefineItem = NULL;
+        Buffer = NULL;
+        BufferSize = 0;
+        Found = FALSE;
+        Done = FALSE;
+        Next = NULL;
+    }
+    ~CGrepJob()
+    {
+        if (Path != NULL)
+            free(Path);
+        if (Buffer != NULL)
+            free(Buffer);
+    }
+};
+
+struct CGrepMatcher
+{
+    CGrepPipeline* Pipeline;
+    int Index;                  // -1 for reader threads
+    CSearchData SearchData;     // copy of CGrepData::SearchData owned by this thread
+    CRegularExpression RegExp;  // copy of CGrepData::RegExp owned by this thread
+};
+
+class CGrepPipeline
+{
+protected:
+    CGrepData* Data;
+
+    CRITICAL_SECTION CS;                    // guards the queues, the window and 'PoolUsed'
+    CGrepJob *ReadFirst, *ReadLast;         // files waiting for the readers
+    CGrepJob *MatchFirst, *MatchLast;       // files waiting for the matchers
+    CGrepJob* Window[GREP_PIPELINE_WINDOW]; // submitted jobs, index is the sequence number modulo GREP_PIPELINE_WINDOW
+    int NextSeq;                            // sequence number of the next submitted job
+    int NextOut;                            // sequence number of the next job to hand back
+    DWORD PoolUsed;                         // total size of prefetched data
+
+    HANDLE ReadSem;   // number of jobs in the readers' queue
+    HANDLE MatchSem;  // number of jobs in the matchers' queue
+    HANDLE JobDone;   // auto-reset event: a job was processed
+    HANDLE PoolFreed; // auto-reset event: prefetched data were released
+    HANDLE Quit;      // manual-reset event: the threads should end
+
+    CGrepMatcher* Matchers; // GREP_PIPELINE_READERS readers followed by the matchers
+    HANDLE* Threads;
+    int ThreadsCount;
+
+public:
+    CGrepPipeline(CGrepData* data);
+    ~CGrepPipeline();
+
+    // starts the threads; returns FALSE if the pipeline cannot be used (the files are
+    // then searched sequentially)
+    BOOL Start(int matchers);
+
+    // submits a file for searching; 'path' is the full name of the file, the name starts
+    // at 'nameOffset'; 'refineItem' is the tested item when refining; handed back items
+    // are added to the list view; can block while the pipeline is full
+    void Submit(const char* path, int nameOffset, DWORD sizeLow, DWORD sizeHigh, DWORD attr,
+                const FILETIME* lastWrite, BOOL isLink, CFoundFilesData* refineItem);
+
+    // submits an item already known to match (entries of archives, refined items tested
+    // without reading the file); it is not searched, only added to the list view when it is
+    // handed back in order; parameters as in Submit, see AddFoundItemInOrder
+    void SubmitFound(const char* path, int nameOffset, DWORD sizeLow, DWORD sizeHigh, DWORD attr,
+                     const FILETIME* lastWrite, BOOL isDir, BOOL inArchive);
+
+    // waits until all submitted files are searched and handed back (or the search is
+    // stopped) and ends the threads
+    void Finish();
+
+protected:
+    // allocates a job for 'path' after making room in the window; returns NULL if the search
+    // was stopped or on low memory (the search is stopped)
+    CGrepJob* CreateJob(const char* path);
+
+    // puts 'job' to the window, if 'search' is TRUE also to the readers' queue
+    void QueueJob(CGrepJob* job, BOOL search);
+
+    // hands back the processed jobs in the order of submission; if 'wait' is TRUE,
+    // waits until at least one job is handed back (or the search is stopped)
+    void HandBack(BOOL wait);
+
+    // adds the item of a handed back job to the found items
+    void AddResult(CGrepJob* job);
+
+    void StopThreads();
+
+    void ReaderBody(CGrepMatcher* reader);
+    void MatcherBody(CGrepMatcher* matcher);
+
+    // reads the whole content of the job's file into job->Buffer (if worthwhile)
+    void Prefetch(CGrepJob* job);
+
+    friend unsigned GrepPipelineThreadBody(void* param);
+};
+
+unsigned GrepPipelineThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("GrepPipelineThreadBody()");
+    CGrepMatcher* matcher = (CGrepMatcher*)param;
+    if (matcher->Index == -1)
+    {
+        SetThreadNameInVCAndTrace("GrepReader");
+        matcher->Pipeline->ReaderBody(matcher);
+    }
+    else
+    {
+        SetThreadNameInVCAndTrace("GrepMatcher");
+        matcher->Pipeline->MatcherBody(matcher);
+    }
+    return 0;
+}
+
+unsigned GrepPipelineThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return GrepPipelineThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread GrepPipeline: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // harder exit (this call still performs some operations)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI GrepPipelineThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return GrepPipelineThreadEH(param);
+}
+
+CGrepPipeline::CGrepPipeline(CGrepData* data)
+{
+    Data = data;
+    HANDLES(InitializeCriticalSection(&CS));
+    ReadFirst = ReadLast = NULL;
+    MatchFirst = MatchLast = NULL;
+    memset(Window, 0, sizeof(Window));
+    NextSeq = 0;
+    NextOut = 0;
+    PoolUsed = 0;
+    ReadSem = HANDLES(CreateSemaphore(NULL, 0, GREP_PIPELINE_WINDOW, NULL));
+    MatchSem = HANDLES(CreateSemaphore(NULL, 0, GREP_PIPELINE_WINDOW, NULL));
+    JobDone = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL));
+    PoolFreed = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL));
+    Quit = HANDLES(CreateEvent(NULL, TRUE, FALSE, NULL));
+    Matchers = NULL;
+    Threads = NULL;
+    ThreadsCount = 0;
+}
+
+CGrepPipeline::~CGrepPipeline()
+{
+    StopThreads();
+    int i;
+    for (i = 0; i < GREP_PIPELINE_WINDOW; i++)
+    {
+        if (Window[i] != NULL)
+            delete Window[i]; // the search was stopped, the job was not handed back
+    }
+    if (Matchers != NULL)
+        delete[] Matchers;
+    if (Threads != NULL)
+        delete[] Threads;
+    if (ReadSem != NULL)
+        HANDLES(CloseHandle(ReadSem));
+    if (MatchSem != NULL)
+        HANDLES(CloseHandle(MatchSem));
+    if (JobDone != NULL)
+        HANDLES(CloseHandle(JobDone));
+    if (PoolFreed != NULL)
+        HANDLES(CloseHandle(PoolFreed));
+    if (Quit != NULL)
+        HANDLES(CloseHandle(Quit));
+    HANDLES(DeleteCriticalSection(&CS));
+}
+
+BOOL CGrepPipeline::Start(int matchers)
+{
+    CALL_STACK_MESSAGE2("CGrepPipeline::Start(%d)", matchers);
+    if (ReadSem == NULL || MatchSem == NULL || JobDone == NULL || PoolFreed == NULL || Quit == NULL)
+    {
+        TRACE_E("CGrepPipeline::Start(): unable to create synchronization objects.");
+        return FALSE;
+    }
+
+    int count = GREP_PIPELINE_READERS + matchers;
+    Matchers = new CGrepMatcher[count];
+    Threads = new HANDLE[count];
+    if (Matchers == NULL || Threads == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+
+    // every matcher gets its own copy of the patterns (they keep state while searching)
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        CGrepMatcher* m = &Matchers[i];
+        m->Pipeline = this;
+        m->Index = i < GREP_PIPELINE_READERS ? -1 : i - GREP_PIPELINE_READERS;
+        if (m->Index == -1)
+            continue;
+        if (Data->Regular)
+        {
+            if (!m->RegExp.Set(Data->RegExp.GetPattern(), Data->RegExp.GetFlags()))
+                return FALSE;
+        }
+        else
+        {
+            m->SearchData.Set(Data->SearchData.GetPattern(), Data->SearchData.GetLength(),
+                              Data->SearchData.GetFlags());
+            if (!m->SearchData.IsGood())
+                return FALSE;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        DWORD threadID;
+        Threads[ThreadsCount] = HANDLES(CreateThread(NULL, 0, GrepPipelineThread, &Matchers[i], 0, &threadID));
+        if (Threads[ThreadsCount] == NULL)
+        {
+            TRACE_E("CGrepPipeline::Start(): unable to start thread.");
+            StopThreads();
+            return FALSE;
+        }
+        SetThreadPriority(Threads[ThreadsCount], GetThreadPriority(GetCurrentThread()));
+        ThreadsCount++;
+    }
+    return TRUE;
+}
+
+void CGrepPipeline::StopThreads()
+{
+    if (ThreadsCount > 0)
+    {
+        SetEvent(Quit);
+        int i;
+        for (i = 0; i < ThreadsCount; i++)
+        {
+            WaitForSingleObject(Threads[i], INFINITE);
+            HANDLES(CloseHandle(Threads[i]));
+        }
+        ThreadsCount = 0;
+    }
+}
+
+CGrepJob* CGrepPipeline::CreateJob(const char* path)
+{
+    // hand back what is done, wait if the window is full
+    HandBack(FALSE);
+    while (NextSeq - NextOut >= GREP_PIPELINE_WINDOW && !Data->StopSearch)
+        HandBack(TRUE);
+    if (Data->StopSearch)
+        return NULL;
+
+    CGrepJob* job = new CGrepJob;
+    if (job != NULL)
+    {
+        job->Path = DupStr(path);
+        if (job->Path == NULL)
+        {
+            delete job;
+            job = NULL;
+        }
+    }
+    if (job == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        FIND_LOG_ITEM log;
+        log.Flags = FLI_ERROR;
+        log.Text = LoadStr(IDS_CANTSHOWRESULTS);
+        log.Path = NULL;
+        SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+        Data->StopSearch = TRUE;
+    }
+    return job;
+}
+
+void CGrepPipeline::QueueJob(CGrepJob* job, BOOL search)
+{
+    HANDLES(EnterCriticalSection(&CS));
+    Window[NextSeq % GREP_PIPELINE_WINDOW] = job;
+    NextSeq++;
+    if (search)
+    {
+        if (ReadLast != NULL)
+            ReadLast->Next = job;
+        else
+            ReadFirst = job;
+        ReadLast = job;
+    }
+    else
+        job->Done = TRUE; // nothing to search, just keep the order
+    HANDLES(LeaveCriticalSection(&CS));
+
+    if (search)
+        ReleaseSemaphore(ReadSem, 1, NULL);
+}
+
+void CGrepPipeline::Submit(const char* path, int nameOffset, DWORD sizeLow, DWORD sizeHigh, DWORD attr,
+                           const FILETIME* lastWrite, BOOL isLink, CFoundFilesData* refineItem)
+{
+    CGrepJob* job = CreateJob(path);
+    if (job == NULL)
+        return;
+    job->NameOffset = nameOffset;
+    job->SizeLow = sizeLow;
+    job->SizeHigh = sizeHigh;
+    job->Attr = attr;
+    job->LastWrite = *lastWrite;
+    job->IsLink = isLink;
+    job->RefineItem = refineItem;
+    QueueJob(job, TRUE);
+}
+
+void CGrepPipeline::SubmitFound(const char* path, int nameOffset, DWORD sizeLow, DWORD sizeHigh, DWORD attr,
+                                const FILETIME* lastWrite, BOOL isDir, BOOL inArchive)
+{
+    CGrepJob* job = CreateJob(path);
+    if (job == NULL)
+        return;
+    job->NameOffset = nameOffset;
+    job->SizeLow = sizeLow;
+    job->SizeHigh = sizeHigh;
+    job->Attr = attr;
+    job->LastWrite = *lastWrite;
+    job->IsDir = isDir;
+    job->InArchive = inArchive;
+    job->Found = TRUE;
+    QueueJob(job, FALSE);
+}
+
+void CGrepPipeline::HandBack(BOOL wait)
+{
+    while (1)
+    {
+        BOOL handedBack = FALSE;
+        while (NextOut < NextSeq && !Data->StopSearch)
+        {
+            HANDLES(EnterCriticalSection(&CS));
+            CGrepJob* job = Window[NextOut % GREP_PIPELINE_WINDOW];
+            BOOL done = job->Done;
+            if (done)
+            {
+                Window[NextOut % GREP_PIPELINE_WINDOW] = NULL;
+                NextOut++;
+            }
+            HANDLES(LeaveCriticalSection(&CS));
+            if (!done)
+                break;
+
+            AddResult(job);
+            delete job;
+            handedBack = TRUE;
+        }
+        if (!wait || handedBack || NextOut == NextSeq || Data->StopSearch)
+            break;
+        WaitForSingleObject(JobDone, 100); // the timeout covers 'StopSearch'
+    }
+}
+
+void CGrepPipeline::AddResult(CGrepJob* job)
+{
+    CFoundFilesData* refineData = job->RefineItem;
+    if (refineData != NULL)
+    {
+        // if refine==1 (intersect) and the item matches, add it
+        // if refine==2 (subtract) and the item does not match, add it
+        if (Data->Refine == 1 && job->Found ||
+            Data->Refine == 2 && !job->Found)
+        {
+            AddFoundItem(refineData->Path, refineData->Name,
+                         refineData->Size.LoDWord, refineData->Size.HiDWord,
+                         refineData->Attr, &refineData->LastWrite,
+                         refineData->IsDir, Data, NULL, refineData->InArchive);
+        }
+    }
+    else
+    {
+        if (job->Found)
+        {
+            // the path is passed without a trailing backslash (except for roots)
+            char root[4];
+            const char* path = job->Path;
+            if (job->NameOffset > 3)
+                job->Path[job->NameOffset - 1] = 0;
+            else
+            {
+                lstrcpyn(root, job->Path, job->NameOffset + 1); // the name follows the root directly
+                path = root;
+            }
+            AddFoundItem(path, job->Path + job->NameOffset, job->SizeLow, job->SizeHigh, job->Attr,
+                         &job->LastWrite, job->IsDir, Data, NULL, job->InArchive);
         }
-        else
-            err = GetLastError();
+    }
+}
 
-        if (err != ERROR_SUCCESS || getLinkFileSizeErr)
+void CGrepPipeline::Prefetch(CGrepJob* job)
+{
+    if (job->IsLink || job->SizeHigh != 0 || job->SizeLow == 0 || job->SizeLow > GREP_PREFETCH_FILE)
+        return; // links (unknown size), empty and large files are left to the matcher
+
+    // wait for space in the pool of prefetched data; the matchers release it
+    while (1)
+    {
+        HANDLES(EnterCriticalSection(&CS));
+        BOOL ok = PoolUsed == 0 || PoolUsed + job->SizeLow <= GREP_PREFETCH_POOL;
+        if (ok)
+            PoolUsed += job->SizeLow;
+        HANDLES(LeaveCriticalSection(&CS));
+        if (ok)
+            break;
+        HANDLE events[2];
+        events[0] = Quit;
+        events[1] = PoolFreed;
+        if (WaitForMultipleObjects(2, events, FALSE, 50) == WAIT_OBJECT_0 || Data->StopSearch)
+            return;
+    }
+
+    char* buffer = (char*)malloc(job->SizeLow);
+    BOOL ok = FALSE;
+    DWORD read = 0;
+    if (buffer != NULL)
+    {
+        HANDLE hFile = HANDLES_Q(CreateFile(job->Path, GENERIC_READ,
+                                            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                            OPEN_EXISTING,
+                                            FILE_FLAG_SEQUENTIAL_SCAN,
+                                            NULL));
+        if (hFile != INVALID_HANDLE_VALUE)
         {
-            char buf[MAX_PATH + 100];
-            sprintf(buf, LoadStr(getLinkFileSizeErr ? IDS_GETLINKTGTFILESIZEERROR : IDS_ERROR_OPENING_FILE2),
-                    GetErrorText(err));
-            FIND_LOG_ITEM log;
-            log.Flags = FLI_ERROR;
-            log.Text = buf;
-            log.Path = path;
-            SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+            ok = ReadFile(hFile, buffer, job->SizeLow, &read, NULL);
+            HANDLES(CloseHandle(hFile));
         }
     }
-
-    return ok;
+    if (ok && read > 0)
+    {
+        job->Buffer = buffer;
+        job->BufferSize = read; // the file could have been shortened meanwhile
+    }
+    else
+    {
+        // errors are reported by the matcher, which opens the file again
+        if (buffer != NULL)
+            free(buffer);
+        HANDLES(EnterCriticalSection(&CS));
+        PoolUsed -= job->SizeLow;
+        HANDLES(LeaveCriticalSection(&CS));
+        SetEvent(PoolFreed);
+    }
 }
 
-BOOL AddFoundItem(const char* path, const char* name, DWORD sizeLow, DWORD sizeHigh,
-                  DWORD attr, const FILETIME* lastWrite, BOOL isDir, CGrepData* data,
-                  CDuplicateCandidates* duplicateCandidates)
+void CGrepPipeline::ReaderBody(CGrepMatcher* reader)
 {
-    if (duplicateCandidates != NULL && isDir) // directories are irrelevant to us when searching for duplicates
-        return TRUE;
+    HANDLE events[2];
+    events[0] = Quit;
+    events[1] = ReadSem;
+    while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        HANDLES(EnterCriticalSection(&CS));
+        CGrepJob* job = ReadFirst;
+        ReadFirst = job->Next;
+        if (ReadFirst == NULL)
+            ReadLast = NULL;
+        job->Next = NULL;
+        HANDLES(LeaveCriticalSection(&CS));
+
+        if (!Data->StopSearch)
+            Prefetch(job);
+
+        HANDLES(EnterCriticalSection(&CS));
+        if (MatchLast != NULL)
+            MatchLast->Next = job;
+        else
+            MatchFirst = job;
+        MatchLast = job;
+        HANDLES(LeaveCriticalSection(&CS));
+        ReleaseSemaphore(MatchSem, 1, NULL);
+    }
+}
 
-    CFoundFilesData* foundData = new CFoundFilesData;
-    if (foundData != NULL)
+void CGrepPipeline::MatcherBody(CGrepMatcher* matcher)
+{
+    HANDLE events[2];
+    events[0] = Quit;
+    events[1] = MatchSem;
+    while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
     {
-        BOOL good = foundData->Set(path, name,
-                                   CQuadWord(sizeLow, sizeHigh),
-                                   attr, lastWrite, isDir);
-        if (good)
+        HANDLES(EnterCriticalSection(&CS));
+        CGrepJob* job = MatchFirst;
+        MatchFirst = job->Next;
+        if (MatchFirst == NULL)
+            MatchLast = NULL;
+        job->Next = NULL;
+        HANDLES(LeaveCriticalSection(&CS));
+
+        BOOL found = FALSE;
+        if (!Data->StopSearch)
         {
-            if (duplicateCandidates == NULL)
+            if (job->Buffer != NULL)
             {
-                // duplicateCandidates == NULL, adding the item to data->FoundFilesListView
-                data->FoundFilesListView->Add(foundData);
-                if (!data->FoundFilesListView->IsGood())
-                {
-                    data->FoundFilesListView->ResetState();
-                    delete foundData;
-                    foundData = NULL;
-                }
-                else
-                {
-                    // request a listview redraw after every 100 added items
-                    // also after 0.5 seconds has passed since the last redraw
-                    // we also call update for each item when grepping
-                    if (data->FoundFilesListView->GetCount() >= data->FoundVisibleCount + 100 ||
-                        GetTickCount() - data->FoundVisibleTick >= 500
-                        /* || data->Grep*/) // a half-second update interval is enough even for grepping
-                    {
-                        SendMessage(data->HWindow, WM_USER_ADDFILE, 0, 0);
-                    }
-                    else
-                        data->NeedRefresh = TRUE; // we will redraw at latest after 0.5 second
-                }
+                Data->SearchingText->Set(job->Path); // set the current file
+                CQuadWord fileOffset(0, 0);
+                CQuadWord totalSize(job->BufferSize, 0);
+                TestFileContentAux(found, fileOffset, totalSize, job->BufferSize, job->Path,
+                                   job->Buffer, Data, &matcher->SearchData, &matcher->RegExp);
             }
             else
             {
-                // duplicateCandidates != NULL, adding the item to duplicateCandidates
-                duplicateCandidates->Add(foundData);
-                if (!duplicateCandidates->IsGood())
-                {
-                    duplicateCandidates->ResetState();
-                    delete foundData;
-                    foundData = NULL;
-                }
+                found = TestFileContent(job->SizeLow, job->SizeHigh, job->Path, Data, job->IsLink,
+                                        &matcher->SearchData, &matcher->RegExp);
             }
         }
-        else
+
+        DWORD released = 0;
+        if (job->Buffer != NULL)
         {
-            delete foundData;
-            foundData = NULL;
+            free(job->Buffer);
+            job->Buffer = NULL;
+            released = job->SizeLow;
         }
+
+        HANDLES(EnterCriticalSection(&CS));
+        PoolUsed -= released;
+        job->Found = found;
+        job->Done = TRUE;
+        HANDLES(LeaveCriticalSection(&CS));
+        if (released != 0)
+            SetEvent(PoolFreed);
+        SetEvent(JobDone);
     }
-    if (foundData == NULL)
-    {
-        FIND_LOG_ITEM log;
-        log.Flags = FLI_ERROR;
-        log.Text = LoadStr(IDS_CANTSHOWRESULTS);
-        log.Path = NULL;
-        SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+}
 
-        data->StopSearch = TRUE;
-        return FALSE;
+void CGrepPipeline::Finish()
+{
+    CALL_STACK_MESSAGE1("CGrepPipeline::Finish()");
+    while (NextOut < NextSeq && !Data->StopSearch)
+        HandBack(TRUE);
+    StopThreads();
+}
+
+BOOL AddFoundItemInOrder(const char* path, const char* name, DWORD sizeLow, DWORD sizeHigh,
+                         DWORD attr, const FILETIME* lastWrite, BOOL isDir, CGrepData* data,
+                         BOOL inArchive)
+{
+    if (data->GrepPipeline == NULL)
+        return AddFoundItem(path, name, sizeLow, sizeHigh, attr, lastWrite, isDir, data, NULL, inArchive);
+
+    // the pipeline keeps the full name, the path is cut off again when the item is handed back
+    char fullName[2 * MAX_PATH];
+    int pathLen = (int)strlen(path);
+    if (pathLen + 1 + (int)strlen(name) >= _countof(fullName))
+    {
+        TRACE_E("AddFoundItemInOrder(): too long name: " << path << "\\" << name);
+        return TRUE; // cannot happen, names of found items are shorter than MAX_PATH
     }
-    return TRUE;
+    strcpy(fullName, path);
+    if (pathLen > 0 && fullName[pathLen - 1] != '\\')
+        fullName[pathLen++] = '\\';
+    strcpy(fullName + pathLen, name);
+    data->GrepPipeline->SubmitFound(fullName, pathLen, sizeLow, sizeHigh, attr, lastWrite, isDir, inArchive);
+    return !data->StopSearch;
 }
 
 // 'dirStack' stores directories for late grepping. Otherwise,
@@ -1612,7 +2612,25 @@ void SearchDirectory(char (&path)[MAX_PATH], char* end, int startPathLen,
                                     // links: file.nFileSizeLow == 0 && file.nFileSizeHigh == 0, the file size
                                     // must be additionally obtained via SalGetFileSize()
                                     BOOL isLink = (file.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
-                                    ok = TestFileContent(file.nFileSizeLow, file.nFileSizeHigh, path, data, isLink);
+                                    if (data->IndexQuery != NULL && !isLink &&
+                                        FindIndex.CannotContain(data->IndexQuery, path, size, &file.ftLastWriteTime))
+                                    {
+                                        ok = FALSE; // according to the content index the file does not contain the text
+                                    }
+                                    else if (data->GrepPipeline != NULL)
+                                    {
+                                        // the file is searched by the pipeline threads, which also add it
+                                        // to the found items (in the order of submission)
+                                        data->GrepPipeline->Submit(path, (int)(end - path), file.nFileSizeLow,
+                                                                   file.nFileSizeHigh, file.dwFileAttributes,
+                                                                   &file.ftLastWriteTime, isLink, NULL);
+                                        ok = FALSE;
+                                    }
+                                    else
+                                    {
+                                        ok = TestFileContent(file.nFileSizeLow, file.nFileSizeHigh, path, data, isLink,
+                                                             &data->SearchData, &data->RegExp);
+                                    }
                                 }
                             }
                             else
@@ -1638,6 +2656,15 @@ void SearchDirectory(char (&path)[MAX_PATH], char* end, int startPathLen,
                             }
                         }
                     }
+
+                    // the entries of an archive are searched regardless of whether the archive
+                    // itself matches (the masks and criteria apply to the entries)
+                    if (!isDir && data->SearchArchives && IsSearchableArchive(file.cFileName))
+                    {
+                        strcpy_s(end, _countof(path) - (end - path), file.cFileName);
+                        SearchArchive(path, masksGroup, data);
+                        *end = 0;
+                    }
                 }
                 if (isDir && includeSubDirs && !ignoreDir) // directory + not "." or ".."
                 {
@@ -1787,6 +2814,244 @@ void SearchDirectory(char (&path)[MAX_PATH], char* end, int startPathLen,
     *end = 0;
 }
 
+//*********************************************************************************
+//
+// CFindDirWalkerCallback
+//
+// Connects CParallelDirWalker with the Find criteria. Used when searching by name only
+// (without grep) in subdirectories; found items are collected by each worker separately
+// and handed over to the list view (or to the duplicate candidates) in batches.
+//
+
+#define FIND_WALKER_BATCH_SIZE 100    // number of items a worker collects before handing them over
+#define FIND_WALKER_BATCH_TIMEOUT 250 // ms after which a partially filled batch is handed over anyway
+
+struct CFindWalkerWorkerData
+{
+    TIndirectArray<CFoundFilesData> Items; // found items not handed over yet
+    DWORD FirstItemTick;                   // GetTickCount() when the first item of the batch was found
+    char Dir[MAX_PATH];                    // currently listed directory in the form expected by AddFoundItem (without a trailing backslash, except for roots)
+    char Message[2 * MAX_PATH];            // buffer for log messages
+
+    CFindWalkerWorkerData() : Items(FIND_WALKER_BATCH_SIZE, FIND_WALKER_BATCH_SIZE)
+    {
+        FirstItemTick = 0;
+        Dir[0] = 0;
+        Message[0] = 0;
+    }
+};
+
+class CFindDirWalkerCallback : public CDirWalkerCallback
+{
+protected:
+    CGrepData* Data;
+    CMaskGroup* MasksGroup;
+    int StartPathLen;
+    CDuplicateCandidates* DuplicateCandidates;
+    CFindIgnore* IgnoreList;
+    CRITICAL_SECTION DuplicatesCS; // guards DuplicateCandidates
+
+    CFindWalkerWorkerData* Workers;
+
+public:
+    CFindDirWalkerCallback(CGrepData* data, CMaskGroup* masksGroup, int startPathLen,
+                           CDuplicateCandidates* duplicateCandidates, CFindIgnore* ignoreList,
+                           int workers);
+    ~CFindDirWalkerCallback();
+
+    BOOL IsGood() { return Workers != NULL; }
+
+    virtual BOOL EnterDirectory(int worker, const char* path, int pathLen);
+    virtual BOOL FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file);
+    virtual void WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err);
+    virtual void WorkerIdle(int worker) { Flush(worker); }
+
+protected:
+    // hands the batch of 'worker' over to the list view or to the duplicate candidates
+    void Flush(int worker);
+    // hands the batch of 'worker' over if it is full or FIND_WALKER_BATCH_TIMEOUT has passed since
+    // its first item was found; tested for every listed entry and directory, so a partial batch
+    // is not held back while a slow walk finds nothing else
+    void FlushIfDue(int worker);
+    void CannotShowResults();
+};
+
+CFindDirWalkerCallback::CFindDirWalkerCallback(CGrepData* data, CMaskGroup* masksGroup, int startPathLen,
+                                               CDuplicateCandidates* duplicateCandidates,
+                                               CFindIgnore* ignoreList, int workers)
+{
+    Data = data;
+    MasksGroup = masksGroup;
+    StartPathLen = startPathLen;
+    DuplicateCandidates = duplicateCandidates;
+    IgnoreList = ignoreList;
+    HANDLES(InitializeCriticalSection(&DuplicatesCS));
+    Workers = new CFindWalkerWorkerData[workers];
+    if (Workers == NULL)
+        TRACE_E(LOW_MEMORY);
+}
+
+CFindDirWalkerCallback::~CFindDirWalkerCallback()
+{
+    if (Workers != NULL)
+        delete[] Workers; // items not handed over (search stopped) are destroyed with the arrays
+    HANDLES(DeleteCriticalSection(&DuplicatesCS));
+}
+
+void CFindDirWalkerCallback::CannotShowResults()
+{
+    FIND_LOG_ITEM log;
+    log.Flags = FLI_ERROR;
+    log.Text = LoadStr(IDS_CANTSHOWRESULTS);
+    log.Path = NULL;
+    SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+
+    Data->StopSearch = TRUE;
+}
+
+void CFindDirWalkerCallback::Flush(int worker)
+{
+    CFindWalkerWorkerData* w = &Workers[worker];
+    if (w->Items.Count == 0)
+        return;
+
+    BOOL ok;
+    if (DuplicateCandidates != NULL)
+    {
+        HANDLES(EnterCriticalSection(&DuplicatesCS));
+        DuplicateCandidates->Add(w->Items.GetData(), w->Items.Count);
+        ok = DuplicateCandidates->IsGood();
+        if (!ok)
+            DuplicateCandidates->ResetState();
+        HANDLES(LeaveCriticalSection(&DuplicatesCS));
+    }
+    else
+        ok = Data->FoundFilesListView->AddBatch(w->Items.GetData(), w->Items.Count);
+
+    if (!ok)
+    {
+        w->Items.DestroyMembers();
+        CannotShowResults();
+        return;
+    }
+    w->Items.DetachMembers(); // the items are owned by the list view (or the candidates) now
+
+    if (DuplicateCandidates == NULL)
+    {
+        // same refresh rules as in AddFoundItem: every 100 items or after 0.5 second
+        if (Data->FoundFilesListView->GetCount() >= Data->FoundVisibleCount + 100 ||
+            GetTickCount() - Data->FoundVisibleTick >= 500)
+        {
+            SendMessage(Data->HWindow, WM_USER_ADDFILE, 0, 0);
+        }
+        else
+            Data->NeedRefresh = TRUE; // we will redraw at latest after 0.5 second
+    }
+}
+
+void CFindDirWalkerCallback::FlushIfDue(int worker)
+{
+    CFindWalkerWorkerData* w = &Workers[worker];
+    if (w->Items.Count > 0 && (w->Items.Count >= FIND_WALKER_BATCH_SIZE ||
+                               GetTickCount() - w->FirstItemTick >= FIND_WALKER_BATCH_TIMEOUT))
+    {
+        Flush(worker);
+    }
+}
+
+BOOL CFindDirWalkerCallback::EnterDirectory(int worker, const char* path, int pathLen)
+{
+    CFindWalkerWorkerData* w = &Workers[worker];
+    FlushIfDue(worker);
+
+    if (IgnoreList != NULL && IgnoreList->Contains(path, StartPathLen))
+    {
+        FIND_LOG_ITEM log;
+        log.Flags = FLI_INFO;
+        log.Text = LoadStr(IDS_FINDLOG_SKIP);
+        log.Path = path;
+        SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+        return FALSE;
+    }
+
+    memcpy(w->Dir, path, pathLen + 1);
+    if (pathLen > 3)
+        w->Dir[pathLen - 1] = 0;
+    Data->SearchingText->Set(w->Dir); // set the current path
+    return TRUE;
+}
+
+BOOL CFindDirWalkerCallback::FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file)
+{
+    CFindWalkerWorkerData* w = &Workers[worker];
+    BOOL isDir = (file->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+    // after finding an item without displaying it and once 0.5 s have passed since the last redraw,
+    // we request the listview to redraw
+    if (Data->NeedRefresh && GetTickCount() - Data->FoundVisibleTick >= 500)
+    {
+        Data->NeedRefresh = FALSE;
+        SendMessage(Data->HWindow, WM_USER_ADDFILE, 0, 0);
+    }
+
+    // test the criteria attributes, size, date and time, then the name
+    CQuadWord size(file->nFileSizeLow, file->nFileSizeHigh);
+    if ((DuplicateCandidates == NULL || !isDir) && // directories are irrelevant to us when searching for duplicates
+        Data->Criteria.Test(file->dwFileAttributes, &size, &file->ftLastWriteTime) &&
+        MasksGroup->AgreeMasks(file->cFileName, NULL))
+    {
+        CFoundFilesData* foundData = new CFoundFilesData;
+        if (foundData == NULL ||
+            !foundData->Set(&Data->FoundFilesListView->Strings, w->Dir, file->cFileName, size,
+                            file->dwFileAttributes, &file->ftLastWriteTime, isDir))
+        {
+            if (foundData != NULL)
+                delete foundData;
+            CannotShowResults();
+            return FALSE;
+        }
+        if (w->Items.Count == 0)
+            w->FirstItemTick = GetTickCount();
+        w->Items.Add(foundData);
+        if (!w->Items.IsGood())
+        {
+            w->Items.ResetState();
+            delete foundData;
+            CannotShowResults();
+            return FALSE;
+        }
+    }
+    FlushIfDue(worker);
+    return isDir;
+}
+
+void CFindDirWalkerCallback::WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err)
+{
+    CFindWalkerWorkerData* w = &Workers[worker];
+    FIND_LOG_ITEM log;
+    if (type == dweNameTooLong)
+    {
+        log.Flags = FLI_ERROR;
+        log.Text = LoadStr(IDS_TOOLONGNAME);
+        log.Path = path;
+    }
+    else
+    {
+        char dir[MAX_PATH];
+        lstrcpyn(dir, path, MAX_PATH);
+        int len = (int)strlen(dir);
+        if (len > 3 && dir[len - 1] == '\\')
+            dir[len - 1] = 0;
+        sprintf(w->Message, LoadStr(IDS_DIRERRORFORMAT), GetErrorText(err));
+        log.Flags = type == dweOpenDir ? FLI_ERROR | FLI_IGNORE : FLI_ERROR;
+        log.Text = w->Message;
+        log.Path = dir;
+        SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+        return;
+    }
+    SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+}
+
 void RefineData(CMaskGroup* masksGroup, CGrepData* data)
 {
     int refineCount = data->FoundFilesListView->GetDataForRefineCount();
@@ -1826,6 +3091,8 @@ void RefineData(CMaskGroup* masksGroup, CGrepData* data)
         {
             if (refineData->IsDir)
                 ok = FALSE; // a directory cannot be grepped
+            else if (refineData->InArchive)
+                ok = TestArchiveItemContent(refineData->Path, refineData->Name, data); // read from the archive in this thread
             else
             {
                 char fullPath[MAX_PATH];
@@ -1835,20 +3102,34 @@ void RefineData(CMaskGroup* masksGroup, CGrepData* data)
                 strcat(fullPath, refineData->Name);
                 // links: refineData->Size == 0, the file size must be additionally obtained via SalGetFileSize()
                 BOOL isLink = (refineData->Attr & FILE_ATTRIBUTE_REPARSE_POINT) != 0; // size == 0, the file size must be obtained via SalGetFileSize()
+                if (data->IndexQuery != NULL && !isLink &&
+                    FindIndex.CannotContain(data->IndexQuery, fullPath, refineData->Size, &refineData->LastWrite))
+                {
+                    ok = FALSE; // according to the content index the file does not contain the text
+                }
+                else if (data->GrepPipeline != NULL)
+                {
+                    // the file is searched by the pipeline threads, the item is handed back in order
+                    data->GrepPipeline->Submit(fullPath, (int)strlen(fullPath) - (int)strlen(refineData->Name),
+                                               refineData->Size.LoDWord, refineData->Size.HiDWord,
+                                               refineData->Attr, &refineData->LastWrite, isLink, refineData);
+                    continue;
+                }
                 ok = TestFileContent(refineData->Size.LoDWord, refineData->Size.HiDWord,
-                                     fullPath, data, isLink);
+                                     fullPath, data, isLink, &data->SearchData, &data->RegExp);
             }
         }
 
         // if refine==1 (intersect) and the item matches, add it
         // if refine==2 (subtract) and the item does not match, add it
+        // (the item must not overtake the items being searched by the pipeline)
         if (data->Refine == 1 && ok ||
             data->Refine == 2 && !ok)
         {
-            AddFoundItem(refineData->Path, refineData->Name,
-                         refineData->Size.LoDWord, refineData->Size.HiDWord,
-                         refineData->Attr, &refineData->LastWrite,
-                         refineData->IsDir, data, NULL);
+            AddFoundItemInOrder(refineData->Path, refineData->Name,
+                                refineData->Size.LoDWord, refineData->Size.HiDWord,
+                                refineData->Attr, &refineData->LastWrite,
+                                refineData->IsDir, data, refineData->InArchive);
         }
     }
 }
@@ -1863,6 +3144,62 @@ unsigned GrepThreadFBody(void* ptr)
     CGrepData* data = (CGrepData*)ptr;
     data->NeedRefresh = FALSE;
     data->Criteria.PrepareForTest();
+    // archives are not searched for duplicates (their entries cannot be opened as files)
+    data->SearchArchives = Configuration.FindSearchArchives && !data->FindDuplicates;
+
+    // content search runs in a pipeline (reading and searching files in other threads)
+    // unless it is switched off by the configuration
+    CGrepPipeline* pipeline = NULL;
+    data->GrepPipeline = NULL;
+    int matchers = GetGrepMatcherCount(Configuration.FindWorkerThreads);
+    if (data->Grep && !data->FindDuplicates && matchers > 1)
+    {
+        pipeline = new CGrepPipeline(data);
+        if (pipeline != NULL && pipeline->Start(matchers))
+            data->GrepPipeline = pipeline;
+        else
+        {
+            if (pipeline == NULL)
+                TRACE_E(LOW_MEMORY); // we will search sequentially
+            else
+            {
+                delete pipeline;
+                pipeline = NULL;
+            }
+        }
+    }
+
+    // the content index (if configured) excludes files which cannot contain the searched
+    // text; a regular expression can use it only if every match contains a known literal
+    CFindIndexQuery* indexQuery = NULL;
+    data->IndexQuery = NULL;
+    if (data->Grep && Configuration.FindIndexRoots[0] != 0)
+    {
+        const char* text = NULL;
+        int textLen = 0;
+        if (!data->Regular)
+        {
+            text = data->SearchData.GetPattern();
+            textLen = data->SearchData.GetLength();
+        }
+        else
+        {
+            if (data->RegExp.HasRequiredLiteral())
+                text = data->RegExp.GetRequiredLiteral(textLen);
+        }
+        if (text != NULL)
+        {
+            indexQuery = new CFindIndexQuery;
+            if (indexQuery == NULL)
+                TRACE_E(LOW_MEMORY); // we will search without the index
+            else
+            {
+                if (indexQuery->Set(text, textLen))
+                    data->IndexQuery = indexQuery;
+            }
+        }
+    }
+
     char path[MAX_PATH];
     char* end;
     if (data->Refine != 0)
@@ -1952,9 +3289,27 @@ unsigned GrepThreadFBody(void* ptr)
                     }
                 }
 
-                char message[2 * MAX_PATH];
-                SearchDirectory(path, end, (int)(end - path), mg, includeSubDirs, data, dirStack, 0,
-                                duplicateCandidates, ignoreList, message);
+                // searching by name only is bound by the latency of directory listing, so subtrees
+                // are listed in parallel; grep and searching inside archives keep the sequential
+                // walk (the order of found files)
+                BOOL walked = FALSE;
+                int workers = GetDirWalkerThreadCount(Configuration.FindWorkerThreads);
+                if (includeSubDirs && !data->Grep && !data->SearchArchives && workers > 1)
+                {
+                    CFindDirWalkerCallback callback(data, mg, (int)(end - path), duplicateCandidates,
+                                                    ignoreList, workers);
+                    if (callback.IsGood())
+                    {
+                        CParallelDirWalker walker(&callback, workers, &data->StopSearch);
+                        walked = walker.Walk(path);
+                    }
+                }
+                if (!walked)
+                {
+                    char message[2 * MAX_PATH];
+                    SearchDirectory(path, end, (int)(end - path), mg, includeSubDirs, data, dirStack, 0,
+                                    duplicateCandidates, ignoreList, message);
+                }
 
                 if (ignoreList != NULL)
                     delete ignoreList;
@@ -1973,6 +3328,17 @@ unsigned GrepThreadFBody(void* ptr)
         }
     }
 
+    if (pipeline != NULL)
+    {
+        pipeline->Finish(); // hand back the rest of the results
+        data->GrepPipeline = NULL;
+        delete pipeline;
+    }
+
+    data->IndexQuery = NULL;
+    if (indexQuery != NULL)
+        delete indexQuery;
+
     data->SearchStopped = data->StopSearch;
     SendMessage(data->HWindow, WM_USER_ADDFILE, 0, 0); // update the listview
     PostMessage(data->HWindow, WM_COMMAND, IDC_FIND_STOP, 0);
@@ -2190,6 +3556,8 @@ BOOL OpenFindDialog(HWND hCenterAgainst, const char* initPath)
 
     HCURSOR hOldCur = SetCursor(LoadCursor(NULL, IDC_WAIT));
 
+    FindIndex.StartUpdate(); // the user is going to search, bring the content index up to date
+
     CFindDialog* findDlg = new CFindDialog(hCenterAgainst, initPath);
     if (findDlg != NULL && findDlg->IsGood())
     {
@@ -60,6 +60,8 @@ DWORD WINAPI GrepThreadF(void* ptr); // body of the grep thread
 extern HACCEL FindDialogAccelTable;
 
 class CFoundFilesListView;
+class CGrepPipeline;
+class CFindIndexQuery;
 class CFindDialog;
 class CMenuPopup;
 class CMenuBar;
@@ -170,8 +172,37 @@ struct CGrepData
 
     CSearchingString* SearchingText;  // synchronized "Searching" text in the Find status bar
     CSearchingString* SearchingText2; // [optional] second text on the right; used for "Total: 35%"
+
+    CGrepPipeline* GrepPipeline; // [optional] threads searching file contents; NULL = files are searched in the grep thread
+    CFindIndexQuery* IndexQuery; // [optional] trigrams of the searched text for asking FindIndex; NULL = the index is not used
+    BOOL SearchArchives;         // search also the entries of archives (see findarc.h)
 };
 
+// search engine (find.cpp), shared with searching inside archives (findarc.cpp)
+
+class CDuplicateCandidates;
+
+// searches one view of a file ('txt', 'viewSize' bytes starting at 'fileOffset' of the file
+// of 'totalSize' bytes); sets 'ok' if the text was found, moves 'fileOffset' to the place
+// where the next view must start; returns FALSE if the file should not be searched further
+BOOL TestFileContentAux(BOOL& ok, CQuadWord& fileOffset, const CQuadWord& totalSize,
+                        DWORD viewSize, const char* path, char* txt, CGrepData* data,
+                        CSearchData* searchData, CRegularExpression* regExp);
+
+// adds an item to the found items (or to 'duplicateCandidates'); 'inArchive' is TRUE for
+// entries of archives; returns FALSE on low memory (the search is stopped)
+BOOL AddFoundItem(const char* path, const char* name, DWORD sizeLow, DWORD sizeHigh,
+                  DWORD attr, const FILETIME* lastWrite, BOOL isDir, CGrepData* data,
+                  CDuplicateCandidates* duplicateCandidates, BOOL inArchive = FALSE);
+
+// adds an item to the found items like AddFoundItem; while the grep pipeline searches
+// files (see CGrepData::GrepPipeline), the item is handed back by the pipeline after the
+// files submitted before it, so the found items keep the order of the walk; returns FALSE
+// on low memory (the search is stopped)
+BOOL AddFoundItemInOrder(const char* path, const char* name, DWORD sizeLow, DWORD sizeHigh,
+                         DWORD attr, const FILETIME* lastWrite, BOOL isDir, CGrepData* data,
+                         BOOL inArchive = FALSE);
+
 //*********************************************************************************
 //
 // CFindOptionsItem
@@ -493,10 +524,12 @@ struct CMD5Digest
     BYTE Digest[MD5_DIGEST_SIZE];
 };
 
+class CFoundFilesStrings;
+
 struct CFoundFilesData
 {
     char* Name;
-    char* Path;
+    char* Path; // items found in one directory share the path if they were set up via CFoundFilesStrings
     CQuadWord Size;
     DWORD Attr;
     FILETIME LastWrite;
@@ -514,6 +547,8 @@ struct CFoundFilesData
     unsigned Focused : 1;  // 0 - item is focused, 1 - item is not focused
     // 'Different' is used to distinguish file groups during duplicate search
     unsigned Different : 1; // 0 - item has standard white background, 1 - item uses a different one (for difference highlighting)
+    unsigned OwnStrings : 1; // 1 - Path and Name are allocated for this item, 0 - they are stored in CFoundFilesStrings
+    unsigned InArchive : 1;  // 1 - item is an entry of an archive, Path continues inside the archive (see findarc.h)
 
     CFoundFilesData()
     {
@@ -525,16 +560,45 @@ struct CFoundFilesData
         IsDir = 0;
         Selected = 0;
         Different = 0;
+        OwnStrings = 0;
+        InArchive = 0;
     }
     ~CFoundFilesData()
     {
-        if (Path != NULL)
-            free(Path);
-        if (Name != NULL)
-            free(Name);
+        if (OwnStrings)
+        {
+            if (Path != NULL)
+                free(Path);
+            if (Name != NULL)
+                free(Name);
+        }
     }
+
+    // the items are allocated in blocks (searches may return millions of them)
+#ifdef new // precomp.h redefines 'new' in the debug version (see also array.h)
+#define __FOUNDDATA_REDEF_NEW
+#undef new
+#endif
+    void* operator new(size_t size) throw(); // returns NULL on low memory
+    // 'new' of the debug version (passes the file and line for the list of memory leaks); the item
+    // is taken from the blocks as well
+    void* operator new(size_t size, int blockUse, const char* fileName, int line) throw()
+    {
+        return operator new(size);
+    }
+    void operator delete(void* ptr);
+    void operator delete(void* ptr, int blockUse, const char* fileName, int line) { operator delete(ptr); }
+#ifdef __FOUNDDATA_REDEF_NEW
+#define new new (_NORMAL_BLOCK, __FILE__, __LINE__)
+#undef __FOUNDDATA_REDEF_NEW
+#endif
+
     BOOL Set(const char* path, const char* name, const CQuadWord& size, DWORD attr,
              const FILETIME* lastWrite, BOOL isDir);
+    // like Set, but the path and the name are stored in 'strings'; items found in one
+    // directory share one copy of the path
+    BOOL Set(CFoundFilesStrings* strings, const char* path, const char* name, const CQuadWord& size,
+             DWORD attr, const FILETIME* lastWrite, BOOL isDir);
     // if 'i' refers to Name or Path, returns a pointer to the corresponding variable
     // otherwise fills the buffer 'text' (must be at least 50 characters long) with the appropriate value
     // and returns a pointer to 'text'
@@ -542,6 +606,46 @@ struct CFoundFilesData
     char* GetText(int i, char* text, int fileNameFormat);
 };
 
+//****************************************************************************
+//
+// CFoundFilesStrings
+//
+// Storage for names and paths of found items: the strings are allocated from large
+// blocks and paths are interned (all items found in one directory share one copy of
+// the path, so an equal path can also be recognized by comparing pointers). The
+// strings are released all at once by Clear(). Thread-safe (items are set up by
+// several searching threads at once).
+//
+
+class CFoundFilesStrings
+{
+protected:
+    CRITICAL_SECTION CS;
+    TDirectArray<char*> Blocks; // allocated blocks
+    char* Free;                 // unused rest of the last block
+    int FreeSize;
+    char** Paths;    // hash table of interned paths (open addressing), NULL = empty slot
+    int PathsSize;   // size of the table (a power of two)
+    int PathsCount;  // number of interned paths
+    char* LastPath;  // the path interned last (items come directory by directory)
+
+public:
+    CFoundFilesStrings();
+    ~CFoundFilesStrings();
+
+    // returns the interned copy of 'path' or NULL on low memory
+    char* AddPath(const char* path);
+    // returns a copy of 'name' or NULL on low memory
+    char* AddName(const char* name);
+
+    // releases all strings; no item may use them any longer
+    void Clear();
+
+protected:
+    char* Alloc(int size); // called inside CS
+    BOOL GrowPaths();      // called inside CS
+};
+
 class CFoundFilesListView : public CWindow
 {
 protected:
@@ -553,6 +657,10 @@ protected:
 public:
     int EnumFileNamesSourceUID; // UID of the source for name enumeration in viewers
 
+    // names and paths of the items in Data and DataForRefine (and of the items being
+    // found); released when both arrays are empty
+    CFoundFilesStrings Strings;
+
 public:
     CFoundFilesListView(HWND dlg, int ctrlID, CFindDialog* findDialog);
     ~CFoundFilesListView();
@@ -577,6 +685,9 @@ public:
     void DestroyMembers();
     int GetCount();
     int Add(CFoundFilesData* item);
+    // appends 'count' items at once (a single pass through the critical section);
+    // returns FALSE on low memory (the items are not added then)
+    BOOL AddBatch(CFoundFilesData* const* items, int count);
     void Delete(int index);
     BOOL IsGood();
     void ResetState();
@@ -765,6 +876,9 @@ public:
     void SetZeroOnDestroy(CFindDialog** zeroOnDestroy) { ZeroOnDestroy = zeroOnDestroy; }
 
     BOOL GetFocusedFile(char* buffer, int bufferLen, int* viewedIndex /* can be NULL */);
+    // returns TRUE if some selected item is an entry of an archive (see CFoundFilesData::InArchive);
+    // such items are not files on disk, so the commands working with files must not get them
+    BOOL SelectionHasArchiveItems();
     const char* GetName(int index);
     const char* GetPath(int index);
     void UpdateInternalViewerData();
@@ -0,0 +1,1299 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "cfgdlg.h"
+#include "find.h"
+#include "findarc.h"
+#include "zlib\zlib.h"
+
+#define ARCHIVE_INPUT_BUFFER (64 * 1024)       // buffer for reading the archive file
+#define ARCHIVE_SEARCH_BUFFER (256 * 1024)     // searched part of an entry; must be larger than GREP_LINE_LEN and the searched text
+#define ZIP_MAX_CENTRAL_DIR (64 * 1024 * 1024) // archives with a larger central directory are not searched
+#define TAR_MAX_PAX_HEADER (64 * 1024)         // larger extended headers are skipped
+
+enum CFindArchiveType
+{
+    fatNone,
+    fatZip,
+    fatTar,
+    fatTarGz,
+};
+
+CFindArchiveType GetFindArchiveType(const char* name)
+{
+    int len = (int)strlen(name);
+    if (len > 4 && StrICmp(name + len - 4, ".zip") == 0)
+        return fatZip;
+    if (len > 4 && StrICmp(name + len - 4, ".tar") == 0)
+        return fatTar;
+    if (len > 4 && StrICmp(name + len - 4, ".tgz") == 0 ||
+        len > 7 && StrICmp(name + len - 7, ".tar.gz") == 0)
+    {
+        return fatTarGz;
+    }
+    return fatNone;
+}
+
+BOOL IsSearchableArchive(const char* name)
+{
+    return GetFindArchiveType(name) != fatNone;
+}
+
+inline WORD GetLE16(const BYTE* p) { return (WORD)(p[0] | (p[1] << 8)); }
+inline DWORD GetLE32(const BYTE* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24); }
+inline unsigned __int64 GetLE64(const BYTE* p) { return GetLE32(p) | ((unsigned __int64)GetLE32(p + 4) << 32); }
+
+// converts the name of an entry stored in code page 'codePage' (CP_ACP = no conversion)
+// to the form used in paths: backslashes as separators, without leading "./" and "\",
+// without a trailing backslash; sets 'isDir' if the name ended with a separator;
+// returns FALSE if the name is empty or too long
+BOOL GetFindArchiveEntryName(char* name, const char* src, int srcLen, UINT codePage, BOOL* isDir)
+{
+    int len;
+    if (codePage == CP_ACP)
+    {
+        len = (int)strnlen(src, srcLen);
+        if (len >= MAX_PATH)
+            return FALSE;
+        memcpy(name, src, len);
+    }
+    else
+    {
+        WCHAR wide[MAX_PATH];
+        int wideLen = MultiByteToWideChar(codePage, 0, src, srcLen, wide, MAX_PATH);
+        if (wideLen == 0 && srcLen > 0)
+            return FALSE;
+        len = WideCharToMultiByte(CP_ACP, 0, wide, wideLen, name, MAX_PATH - 1, NULL, NULL);
+        if (len == 0 && wideLen > 0)
+            return FALSE;
+    }
+    name[len] = 0;
+
+    char* s;
+    char* d = name;
+    for (s = name; *s != 0; s++) // also joins repeated separators
+    {
+        char c = *s == '/' ? '\\' : *s;
+        if (c != '\\' || d == name || *(d - 1) != '\\')
+            *d++ = c;
+    }
+    *d = 0;
+    len = (int)(d - name);
+    *isDir = len > 0 && name[len - 1] == '\\';
+    while (len > 0 && name[len - 1] == '\\')
+        name[--len] = 0;
+    s = name;
+    while (*s == '\\' || *s == '.' && (s[1] == '\\' || s[1] == 0))
+        s++;
+    if (s > name)
+        memmove(name, s, strlen(s) + 1);
+    return name[0] != 0;
+}
+
+//*********************************************************************************
+//
+// CFindArchiveStream
+//
+// Sequential reading of the archive data: the archive file itself or the data
+// decompressed by CFindInflater. The first error is stored in CFindArchiveError
+// shared by all objects reading one archive.
+//
+
+struct CFindArchiveError
+{
+    int TextID;      // IDS_xxx of the error text; 0 = no error
+    DWORD ErrorCode; // Windows error code (only for IDS_ERROR_OPENING_FILE2)
+
+    CFindArchiveError()
+    {
+        TextID = 0;
+        ErrorCode = ERROR_SUCCESS;
+    }
+
+    void Set(int textID, DWORD errorCode = ERROR_SUCCESS)
+    {
+        if (TextID == 0) // keep the first error, the others are its consequences
+        {
+            TextID = textID;
+            ErrorCode = errorCode;
+        }
+    }
+};
+
+class CFindArchiveStream
+{
+protected:
+    CFindArchiveError* Error;
+
+public:
+    CFindArchiveStream(CFindArchiveError* error) { Error = error; }
+    virtual ~CFindArchiveStream() {}
+
+    // reads up to 'size' bytes; 'read' is 0 at the end of the data; returns FALSE on error
+    virtual BOOL Read(void* buf, DWORD size, DWORD* read) = 0;
+
+    // skips 'size' bytes; returns FALSE on error or at the end of the data
+    virtual BOOL Skip(unsigned __int64 size);
+
+    // reads exactly 'size' bytes; returns FALSE on error or at the end of the data
+    BOOL ReadExact(void* buf, DWORD size);
+};
+
+BOOL CFindArchiveStream::Skip(unsigned __int64 size)
+{
+    char buf[16 * 1024];
+    while (size > 0)
+    {
+        DWORD toRead = size < sizeof(buf) ? (DWORD)size : sizeof(buf);
+        if (!ReadExact(buf, toRead))
+            return FALSE;
+        size -= toRead;
+    }
+    return TRUE;
+}
+
+BOOL CFindArchiveStream::ReadExact(void* buf, DWORD size)
+{
+    while (size > 0)
+    {
+        DWORD read;
+        if (!Read(buf, size, &read))
+            return FALSE;
+        if (read == 0)
+        {
+            Error->Set(IDS_PACKRET_NOTARC); // the archive is truncated
+            return FALSE;
+        }
+        buf = (char*)buf + read;
+        size -= read;
+    }
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CFindArchiveFile
+//
+
+class CFindArchiveFile : public CFindArchiveStream
+{
+protected:
+    HANDLE File;
+    unsigned __int64 Size;
+    unsigned __int64 FilePos; // position of the file pointer (the end of the data in Buffer)
+    BYTE* Buffer;
+    DWORD BufferPos; // next unread byte in Buffer
+    DWORD BufferLen; // number of valid bytes in Buffer
+
+public:
+    CFindArchiveFile(CFindArchiveError* error);
+    ~CFindArchiveFile();
+
+    BOOL Open(const char* name);
+    unsigned __int64 GetSize() { return Size; }
+    BOOL Seek(unsigned __int64 offset);
+
+    virtual BOOL Read(void* buf, DWORD size, DWORD* read);
+    virtual BOOL Skip(unsigned __int64 size);
+};
+
+CFindArchiveFile::CFindArchiveFile(CFindArchiveError* error) : CFindArchiveStream(error)
+{
+    File = INVALID_HANDLE_VALUE;
+    Size = 0;
+    FilePos = 0;
+    Buffer = NULL;
+    BufferPos = 0;
+    BufferLen = 0;
+}
+
+CFindArchiveFile::~CFindArchiveFile()
+{
+    if (File != INVALID_HANDLE_VALUE)
+        HANDLES(CloseHandle(File));
+    if (Buffer != NULL)
+        free(Buffer);
+}
+
+BOOL CFindArchiveFile::Open(const char* name)
+{
+    Buffer = (BYTE*)malloc(ARCHIVE_INPUT_BUFFER);
+    if (Buffer == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        Error->Set(IDS_PACKRET_MEMORY);
+        return FALSE;
+    }
+    File = HANDLES_Q(CreateFile(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    DWORD err;
+    if (File == INVALID_HANDLE_VALUE)
+        err = GetLastError();
+    else
+    {
+        CQuadWord size;
+        if (SalGetFileSize(File, size, err))
+        {
+            Size = size.Value;
+            return TRUE;
+        }
+    }
+    Error->Set(IDS_ERROR_OPENING_FILE2, err);
+    return FALSE;
+}
+
+BOOL CFindArchiveFile::Seek(unsigned __int64 offset)
+{
+    if (offset > Size)
+    {
+        Error->Set(IDS_PACKRET_NOTARC); // an offset from the archive headers points outside of the file
+        return FALSE;
+    }
+    if (offset <= FilePos && offset >= FilePos - BufferLen) // the position is in the buffer
+    {
+        BufferPos = BufferLen - (DWORD)(FilePos - offset);
+        return TRUE;
+    }
+    LARGE_INTEGER pos;
+    pos.QuadPart = offset;
+    if (!SetFilePointerEx(File, pos, NULL, FILE_BEGIN))
+    {
+        Error->Set(IDS_FILEREADERROR2);
+        return FALSE;
+    }
+    FilePos = offset;
+    BufferPos = BufferLen = 0;
+    return TRUE;
+}
+
+BOOL CFindArchiveFile::Read(void* buf, DWORD size, DWORD* read)
+{
+    *read = 0;
+    while (size > 0)
+    {
+        if (BufferPos == BufferLen)
+        {
+            DWORD r;
+            if (size >= ARCHIVE_INPUT_BUFFER) // large blocks are read directly
+            {
+                if (!ReadFile(File, buf, size, &r, NULL))
+                {
+                    Error->Set(IDS_FILEREADERROR2);
+                    return FALSE;
+                }
+                FilePos += r;
+                BufferPos = BufferLen = 0; // the buffer does not end at FilePos anymore (see Seek)
+                *read += r;
+                return TRUE;
+            }
+            if (!ReadFile(File, Buffer, ARCHIVE_INPUT_BUFFER, &r, NULL))
+            {
+                Error->Set(IDS_FILEREADERROR2);
+                return FALSE;
+            }
+            FilePos += r;
+            BufferPos = 0;
+            BufferLen = r;
+            if (r == 0)
+                break; // end of the file
+        }
+        DWORD count = min(size, BufferLen - BufferPos);
+        memcpy(buf, Buffer + BufferPos, count);
+        BufferPos += count;
+        buf = (char*)buf + count;
+        size -= count;
+        *read += count;
+    }
+    return TRUE;
+}
+
+BOOL CFindArchiveFile::Skip(unsigned __int64 size)
+{
+    return Seek(FilePos - (BufferLen - BufferPos) + size);
+}
+
+//*********************************************************************************
+//
+// CFindInflater
+//
+// Decompresses the data read from the archive file: raw deflate data of a ZIP entry
+// ('inputSize' compressed bytes) or a gzip file (possibly of several members).
+//
+
+class CFindInflater : public CFindArchiveStream
+{
+protected:
+    CFindArchiveFile* File;
+    z_stream Stream;
+    BOOL Initialized;
+    BOOL Gzip;
+    unsigned __int64 InputLeft; // compressed bytes not read from the file yet (ZIP only)
+    BOOL MemberEnd;             // the end of a gzip member was reached, another may follow
+    BOOL Finished;              // the end of the compressed data was reached
+    BYTE* Input;
+
+public:
+    CFindInflater(CFindArchiveError* error);
+    ~CFindInflater();
+
+    // starts decompressing data at the current position of 'file'
+    BOOL Start(CFindArchiveFile* file, BOOL gzip, unsigned __int64 inputSize);
+
+    virtual BOOL Read(void* buf, DWORD size, DWORD* read);
+
+protected:
+    // refills the input of zlib; returns FALSE on error
+    BOOL FillInput();
+};
+
+CFindInflater::CFindInflater(CFindArchiveError* error) : CFindArchiveStream(error)
+{
+    File = NULL;
+    memset(&Stream, 0, sizeof(Stream));
+    Initialized = FALSE;
+    Gzip = FALSE;
+    InputLeft = 0;
+    MemberEnd = FALSE;
+    Finished = TRUE;
+    Input = NULL;
+}
+
+CFindInflater::~CFindInflater()
+{
+    if (Initialized)
+        inflateEnd(&Stream);
+    if (Input != NULL)
+        free(Input);
+}
+
+BOOL CFindInflater::Start(CFindArchiveFile* file, BOOL gzip, unsigned __int64 inputSize)
+{
+    if (Input == NULL)
+    {
+        Input = (BYTE*)malloc(ARCHIVE_INPUT_BUFFER);
+        if (Input == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            Error->Set(IDS_PACKRET_MEMORY);
+            return FALSE;
+        }
+    }
+    if (!Initialized)
+    {
+        // gzip: 16 + window bits, raw deflate (ZIP): negative window bits
+        if (inflateInit2(&Stream, gzip ? 16 + MAX_WBITS : -MAX_WBITS) != Z_OK)
+        {
+            Error->Set(IDS_PACKRET_MEMORY);
+            return FALSE;
+        }
+        Initialized = TRUE;
+    }
+    else
+        inflateReset(&Stream);
+    File = file;
+    Gzip = gzip;
+    InputLeft = inputSize;
+    Stream.next_in = Input;
+    Stream.avail_in = 0;
+    MemberEnd = FALSE;
+    Finished = FALSE;
+    return TRUE;
+}
+
+BOOL CFindInflater::FillInput()
+{
+    DWORD toRead = ARCHIVE_INPUT_BUFFER;
+    if (!Gzip && InputLeft < toRead)
+        toRead = (DWORD)InputLeft;
+    DWORD read = 0;
+    if (toRead > 0 && !File->Read(Input, toRead, &read))
+        return FALSE;
+    if (!Gzip)
+        InputLeft -= read;
+    Stream.next_in = Input;
+    Stream.avail_in = read;
+    return TRUE;
+}
+
+BOOL CFindInflater::Read(void* buf, DWORD size, DWORD* read)
+{
+    *read = 0;
+    Stream.next_out = (Bytef*)buf;
+    Stream.avail_out = size;
+    while (Stream.avail_out > 0 && !Finished)
+    {
+        if (Stream.avail_in == 0 && !FillInput())
+            return FALSE;
+        if (MemberEnd) // another gzip member follows, unless we are at the end of the file
+        {
+            if (Stream.avail_in == 0)
+            {
+                Finished = TRUE;
+                break;
+            }
+            inflateReset(&Stream);
+            MemberEnd = FALSE;
+        }
+        int ret = inflate(&Stream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+            if (Gzip)
+                MemberEnd = TRUE;
+            else
+                Finished = TRUE;
+        }
+        else
+        {
+            if (ret == Z_BUF_ERROR && Stream.avail_in == 0) // no progress without more input
+            {
+                Error->Set(IDS_PACKRET_NOTARC); // the compressed data are truncated
+                return FALSE;
+            }
+            if (ret != Z_OK)
+            {
+                Error->Set(ret == Z_MEM_ERROR ? IDS_PACKRET_MEMORY : IDS_PACKRET_EXTRACT);
+                return FALSE;
+            }
+        }
+    }
+    *read = size - Stream.avail_out;
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CFindArchiveReader
+//
+// Enumerates the entries of an archive and reads their data.
+//
+
+struct CFindArchiveEntry
+{
+    char Name[MAX_PATH]; // path inside the archive (backslashes as separators)
+    unsigned __int64 Size;
+    FILETIME LastWrite;
+    DWORD Attr;
+    BOOL IsDir;
+    BOOL CanRead; // FALSE = the data cannot be read (encrypted entry, unsupported compression)
+};
+
+class CFindArchiveReader
+{
+protected:
+    CFindArchiveError* Error;
+
+public:
+    CFindArchiveReader(CFindArchiveError* error) { Error = error; }
+    virtual ~CFindArchiveReader() {}
+
+    virtual BOOL Open() = 0;
+
+    // reads the next entry; returns FALSE at the end of the archive or on error
+    virtual BOOL NextEntry(CFindArchiveEntry* entry) = 0;
+
+    // reads data of the last entry returned by NextEntry; 'read' is 0 at the end of
+    // the entry; returns FALSE on error
+    virtual BOOL ReadData(void* buf, DWORD size, DWORD* read) = 0;
+};
+
+//*********************************************************************************
+//
+// CFindZipReader
+//
+// Entries are taken from the central directory (it holds the correct sizes even when
+// the local headers are followed by data descriptors), the data are read from the
+// local headers. Supports ZIP64.
+//
+
+class CFindZipReader : public CFindArchiveReader
+{
+protected:
+    CFindArchiveFile* File;
+    CFindInflater Inflater;
+
+    BYTE* Dir; // central directory
+    DWORD DirSize;
+    DWORD DirPos;
+    unsigned __int64 EntriesLeft;
+
+    // the current entry
+    int Method;
+    unsigned __int64 CompressedSize;
+    unsigned __int64 LocalOffset;
+    unsigned __int64 DataLeft;
+    BOOL DataStarted;
+
+public:
+    CFindZipReader(CFindArchiveFile* file, CFindArchiveError* error);
+    ~CFindZipReader();
+
+    virtual BOOL Open();
+    virtual BOOL NextEntry(CFindArchiveEntry* entry);
+    virtual BOOL ReadData(void* buf, DWORD size, DWORD* read);
+};
+
+CFindZipReader::CFindZipReader(CFindArchiveFile* file, CFindArchiveError* error)
+    : CFindArchiveReader(error), Inflater(error)
+{
+    File = file;
+    Dir = NULL;
+    DirSize = 0;
+    DirPos = 0;
+    EntriesLeft = 0;
+    Method = 0;
+    CompressedSize = 0;
+    LocalOffset = 0;
+    DataLeft = 0;
+    DataStarted = FALSE;
+}
+
+CFindZipReader::~CFindZipReader()
+{
+    if (Dir != NULL)
+        free(Dir);
+}
+
+BOOL CFindZipReader::Open()
+{
+    // the end of central directory record is at the end of the file, followed only
+    // by the archive comment (at most 64 KB)
+    unsigned __int64 size = File->GetSize();
+    DWORD tailSize = size < 22 + 0xFFFF ? (DWORD)size : 22 + 0xFFFF;
+    if (tailSize < 22)
+    {
+        Error->Set(IDS_PACKRET_NOTARC);
+        return FALSE;
+    }
+    BYTE* tail = (BYTE*)malloc(tailSize);
+    if (tail == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        Error->Set(IDS_PACKRET_MEMORY);
+        return FALSE;
+    }
+    if (!File->Seek(size - tailSize) || !File->ReadExact(tail, tailSize))
+    {
+        free(tail);
+        return FALSE;
+    }
+    int eocd = -1;
+    int i;
+    for (i = tailSize - 22; i >= 0; i--)
+    {
+        if (GetLE32(tail + i) == 0x06054b50)
+        {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd == -1)
+    {
+        free(tail);
+        Error->Set(IDS_PACKRET_NOTARC);
+        return FALSE;
+    }
+    unsigned __int64 entries = GetLE16(tail + eocd + 10);
+    unsigned __int64 dirSize = GetLE32(tail + eocd + 12);
+    unsigned __int64 dirOffset = GetLE32(tail + eocd + 16);
+    if ((entries == 0xFFFF || dirSize == 0xFFFFFFFF || dirOffset == 0xFFFFFFFF) &&
+        eocd >= 20 && GetLE32(tail + eocd - 20) == 0x07064b50) // ZIP64 end of central directory locator
+    {
+        BYTE rec[56];
+        if (!File->Seek(GetLE64(tail + eocd - 20 + 8)) || !File->ReadExact(rec, sizeof(rec)))
+        {
+            free(tail);
+            return FALSE;
+        }
+        if (GetLE32(rec) == 0x06064b50)
+        {
+            entries = GetLE64(rec + 32);
+            dirSize = GetLE64(rec + 40);
+            dirOffset = GetLE64(rec + 48);
+        }
+    }
+    free(tail);
+
+    if (dirSize > ZIP_MAX_CENTRAL_DIR || dirOffset + dirSize > size)
+    {
+        Error->Set(IDS_PACKRET_NOTARC);
+        return FALSE;
+    }
+    Dir = (BYTE*)malloc(dirSize > 0 ? (size_t)dirSize : 1);
+    if (Dir == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        Error->Set(IDS_PACKRET_MEMORY);
+        return FALSE;
+    }
+    if (!File->Seek(dirOffset) || !File->ReadExact(Dir, (DWORD)dirSize))
+        return FALSE;
+    DirSize = (DWORD)dirSize;
+    DirPos = 0;
+    EntriesLeft = entries;
+    return TRUE;
+}
+
+BOOL CFindZipReader::NextEntry(CFindArchiveEntry* entry)
+{
+    while (EntriesLeft > 0)
+    {
+        BYTE* h = Dir + DirPos;
+        if (DirSize - DirPos < 46 || GetLE32(h) != 0x02014b50)
+        {
+            Error->Set(IDS_PACKRET_NOTARC);
+            return FALSE;
+        }
+        int nameLen = GetLE16(h + 28);
+        int extraLen = GetLE16(h + 30);
+        int commentLen = GetLE16(h + 32);
+        if (DirSize - DirPos - 46 < (DWORD)(nameLen + extraLen + commentLen))
+        {
+            Error->Set(IDS_PACKRET_NOTARC);
+            return FALSE;
+        }
+        DirPos += 46 + nameLen + extraLen + commentLen;
+        EntriesLeft--;
+
+        WORD flags = GetLE16(h + 8);
+        unsigned __int64 compressedSize = GetLE32(h + 20);
+        unsigned __int64 size = GetLE32(h + 24);
+        unsigned __int64 localOffset = GetLE32(h + 42);
+
+        // ZIP64 extended information: only the values which do not fit into the header, in this order
+        const BYTE* extra = h + 46 + nameLen;
+        const BYTE* extraEnd = extra + extraLen;
+        while (extraEnd - extra >= 4)
+        {
+            int len = GetLE16(extra + 2);
+            if (len > extraEnd - extra - 4)
+                break;
+            if (GetLE16(extra) == 0x0001)
+            {
+                const BYTE* f = extra + 4;
+                const BYTE* fEnd = f + len;
+                if (size == 0xFFFFFFFF && fEnd - f >= 8)
+                {
+                    size = GetLE64(f);
+                    f += 8;
+                }
+                if (compressedSize == 0xFFFFFFFF && fEnd - f >= 8)
+                {
+                    compressedSize = GetLE64(f);
+                    f += 8;
+                }
+                if (localOffset == 0xFFFFFFFF && fEnd - f >= 8)
+                    localOffset = GetLE64(f);
+            }
+            extra += 4 + len;
+        }
+
+        // names are in UTF-8 (flag bit 11) or in the OEM code page; entries with too long names
+        // could not be opened from the panel, they are skipped
+        BOOL isDir;
+        if (!GetFindArchiveEntryName(entry->Name, (const char*)h + 46, nameLen,
+                                     (flags & 0x0800) ? CP_UTF8 : CP_OEMCP, &isDir))
+        {
+            continue;
+        }
+
+        // attributes are meaningful only for archives created on DOS/Windows
+        BYTE host = h[5];
+        DWORD attr = FILE_ATTRIBUTE_ARCHIVE;
+        if (host == 0 /* FAT */ || host == 11 /* NTFS */ || host == 14 /* VFAT */)
+        {
+            attr = GetLE32(h + 38) & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM |
+                                      FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_ARCHIVE);
+            if (attr & FILE_ATTRIBUTE_DIRECTORY)
+                isDir = TRUE;
+        }
+        if (isDir)
+            attr |= FILE_ATTRIBUTE_DIRECTORY;
+
+        FILETIME ft;
+        if (!DosDateTimeToFileTime(GetLE16(h + 14), GetLE16(h + 12), &ft) ||
+            !LocalFileTimeToFileTime(&ft, &entry->LastWrite))
+        {
+            entry->LastWrite.dwLowDateTime = entry->LastWrite.dwHighDateTime = 0;
+        }
+        Method = GetLE16(h + 10);
+        entry->Size = isDir ? 0 : size;
+        entry->Attr = attr;
+        entry->IsDir = isDir;
+        entry->CanRead = !isDir && (flags & 0x0001) == 0 /* encrypted */ && (Method == 0 || Method == 8);
+
+        CompressedSize = compressedSize;
+        LocalOffset = localOffset;
+        DataLeft = entry->Size;
+        DataStarted = FALSE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+BOOL CFindZipReader::ReadData(void* buf, DWORD size, DWORD* read)
+{
+    *read = 0;
+    if (!DataStarted)
+    {
+        DataStarted = TRUE;
+        BYTE h[30];
+        if (!File->Seek(LocalOffset) || !File->ReadExact(h, sizeof(h)))
+            return FALSE;
+        if (GetLE32(h) != 0x04034b50)
+        {
+            Error->Set(IDS_PACKRET_NOTARC);
+            return FALSE;
+        }
+        if (!File->Skip(GetLE16(h + 26) + GetLE16(h + 28)))
+            return FALSE;
+        if (Method == 8 && !Inflater.Start(File, FALSE, CompressedSize))
+            return FALSE;
+    }
+    if (DataLeft == 0)
+        return TRUE;
+    if (DataLeft < size)
+        size = (DWORD)DataLeft;
+    if (Method == 0)
+    {
+        if (!File->ReadExact(buf, size))
+            return FALSE;
+        *read = size;
+    }
+    else
+    {
+        if (!Inflater.Read(buf, size, read))
+            return FALSE;
+        if (*read == 0)
+        {
+            Error->Set(IDS_PACKRET_EXTRACT); // less data than the header says
+            return FALSE;
+        }
+    }
+    DataLeft -= *read;
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CFindTarReader
+//
+// Reads TAR (ustar, GNU long names, pax path records) from a stream, so it works
+// the same for TAR and TAR.GZ.
+//
+
+class CFindTarReader : public CFindArchiveReader
+{
+protected:
+    CFindArchiveStream* Stream;
+    unsigned __int64 DataLeft; // unread data of the current entry
+    DWORD Padding;             // bytes after the data of the current entry up to the end of the block
+
+public:
+    CFindTarReader(CFindArchiveStream* stream, CFindArchiveError* error);
+
+    virtual BOOL Open() { return TRUE; }
+    virtual BOOL NextEntry(CFindArchiveEntry* entry);
+    virtual BOOL ReadData(void* buf, DWORD size, DWORD* read);
+
+protected:
+    // reads the data of an extended header (GNU long name or pax) into 'name'
+    BOOL ReadLongName(char* name, BOOL pax);
+};
+
+CFindTarReader::CFindTarReader(CFindArchiveStream* stream, CFindArchiveError* error)
+    : CFindArchiveReader(error)
+{
+    Stream = stream;
+    DataLeft = 0;
+    Padding = 0;
+}
+
+// numbers are octal text or (large values) big-endian binary with the highest bit set
+unsigned __int64 GetTarNumber(const BYTE* p, int len)
+{
+    unsigned __int64 value = 0;
+    if (p[0] & 0x80)
+    {
+        value = p[0] & 0x7F;
+        int i;
+        for (i = 1; i < len; i++)
+            value = (value << 8) | p[i];
+        return value;
+    }
+    int i = 0;
+    while (i < len && p[i] == ' ')
+        i++;
+    while (i < len && p[i] >= '0' && p[i] <= '7')
+        value = (value << 3) | (p[i++] - '0');
+    return value;
+}
+
+BOOL CFindTarReader::ReadLongName(char* name, BOOL pax)
+{
+    unsigned __int64 size = DataLeft;
+    DWORD limit = pax ? TAR_MAX_PAX_HEADER : MAX_PATH * 2;
+    DataLeft = 0;
+    if (size > limit)
+        return Stream->Skip(size); // the name would be too long anyway
+    char* data = (char*)malloc((size_t)size + 1);
+    if (data == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        Error->Set(IDS_PACKRET_MEMORY);
+        return FALSE;
+    }
+    if (!Stream->ReadExact(data, (DWORD)size))
+    {
+        free(data);
+        return FALSE;
+    }
+    data[size] = 0;
+    if (!pax)
+    {
+        lstrcpyn(name, data, MAX_PATH * 2);
+        free(data);
+        return TRUE;
+    }
+
+    // records "<length> <keyword>=<value>\n", we are interested in "path" only (UTF-8)
+    char* s = data;
+    char* end = data + size;
+    while (s < end)
+    {
+        int len = atoi(s);
+        char* rec = s;
+        while (rec < end && *rec != ' ')
+            rec++;
+        if (len <= 0 || s + len > end || rec >= s + len)
+            break;
+        rec++;
+        if (strncmp(rec, "path=", 5) == 0)
+        {
+            BOOL isDir;
+            char* value = rec + 5;
+            int valueLen = (int)(s + len - 1 - value); // without the trailing LF
+            if (!GetFindArchiveEntryName(name, value, valueLen, CP_UTF8, &isDir))
+                name[0] = 0;
+            else
+            {
+                if (isDir) // keep the separator, NextEntry converts the name once more
+                    strcat(name, "\\");
+            }
+        }
+        s += len;
+    }
+    free(data);
+    return TRUE;
+}
+
+BOOL CFindTarReader::NextEntry(CFindArchiveEntry* entry)
+{
+    char longName[MAX_PATH * 2]; // name from the preceding extended header
+    longName[0] = 0;
+    BYTE h[512];
+    while (TRUE)
+    {
+        // skip the rest of the previous entry
+        if (!Stream->Skip(DataLeft + Padding))
+            return FALSE;
+        DataLeft = 0;
+        Padding = 0;
+
+        DWORD read = 0;
+        while (read < sizeof(h))
+        {
+            DWORD r;
+            if (!Stream->Read(h + read, sizeof(h) - read, &r))
+                return FALSE;
+            if (r == 0)
+                break;
+            read += r;
+        }
+        if (read == 0)
+            return FALSE; // the archive ends without the terminating blocks
+        if (read < sizeof(h))
+        {
+            Error->Set(IDS_PACKRET_NOTARC);
+            return FALSE;
+        }
+
+        DWORD sum = 0;
+        int i;
+        for (i = 0; i < (int)sizeof(h); i++)
+            sum += (i >= 148 && i < 156) ? ' ' : h[i];
+        if (sum == 8 * ' ')
+            return FALSE; // an empty block terminates the archive
+        if (sum != (DWORD)GetTarNumber(h + 148, 8))
+        {
+            Error->Set(IDS_PACKRET_NOTARC);
+            return FALSE;
+        }
+
+        unsigned __int64 size = GetTarNumber(h + 124, 12);
+        DataLeft = size;
+        Padding = (DWORD)((512 - size % 512) % 512);
+
+        char type = h[156];
+        if (type == 'L' || type == 'x') // GNU long name, pax extended header
+        {
+            if (!ReadLongName(longName, type == 'x'))
+                return FALSE;
+            continue;
+        }
+        BOOL isDir = type == '5';
+        if (!isDir && type != '0' && type != 0 && type != '7')
+        {
+            longName[0] = 0; // links, devices, global headers etc. are not searched
+            continue;
+        }
+
+        char name[256 + 2];
+        const char* src = longName;
+        if (longName[0] == 0)
+        {
+            // ustar: the name can be split into a prefix and the name itself
+            int nameLen = (int)strnlen((const char*)h, 100);
+            if (memcmp(h + 257, "ustar", 5) == 0 && h[345] != 0)
+            {
+                int prefixLen = (int)strnlen((const char*)h + 345, 155);
+                memcpy(name, h + 345, prefixLen);
+                name[prefixLen] = '/';
+                memcpy(name + prefixLen + 1, h, nameLen);
+                name[prefixLen + 1 + nameLen] = 0;
+            }
+            else
+            {
+                memcpy(name, h, nameLen);
+                name[nameLen] = 0;
+            }
+            src = name;
+        }
+        BOOL nameIsDir;
+        BOOL good = GetFindArchiveEntryName(entry->Name, src, (int)strlen(src) + 1, CP_ACP, &nameIsDir);
+        longName[0] = 0;
+        if (!good)
+            continue; // empty or too long name
+
+        unsigned __int64 mtime = GetTarNumber(h + 136, 12);
+        unsigned __int64 ft = mtime * 10000000 + 116444736000000000; // seconds since 1970 -> 100 ns since 1601
+        entry->LastWrite.dwLowDateTime = (DWORD)ft;
+        entry->LastWrite.dwHighDateTime = (DWORD)(ft >> 32);
+        entry->IsDir = isDir || nameIsDir;
+        entry->Size = entry->IsDir ? 0 : size;
+        entry->Attr = entry->IsDir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+        entry->CanRead = !entry->IsDir;
+        return TRUE;
+    }
+}
+
+BOOL CFindTarReader::ReadData(void* buf, DWORD size, DWORD* read)
+{
+    *read = 0;
+    if (DataLeft == 0)
+        return TRUE;
+    if (DataLeft < size)
+        size = (DWORD)DataLeft;
+    if (!Stream->ReadExact(buf, size))
+        return FALSE;
+    *read = size;
+    DataLeft -= size;
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CFindArchiveSearch
+//
+// Searching one archive: opens the right reader, reports errors to the Find log and
+// searches the entry data decompressed in memory.
+//
+
+class CFindArchiveSearch
+{
+protected:
+    CGrepData* Data;
+    const char* Archive; // full name of the archive
+    CFindArchiveError Error;
+    CFindArchiveFile File;
+    CFindInflater Gzip; // decompresses TAR.GZ
+    CFindArchiveReader* Reader;
+    char* Buffer; // ARCHIVE_SEARCH_BUFFER bytes for the searched data
+    BOOL Failed;  // an error occurred and was reported, the archive cannot be read further
+
+public:
+    CFindArchiveSearch(CGrepData* data, const char* archive);
+    ~CFindArchiveSearch();
+
+    BOOL Open();
+
+    // returns the next entry; FALSE at the end of the archive or on error
+    BOOL NextEntry(CFindArchiveEntry* entry);
+
+    // returns TRUE if the data of 'entry' (the last one returned by NextEntry) contain
+    // the searched text; 'fullName' is the name of the entry for the Find log
+    BOOL TestContent(const CFindArchiveEntry* entry, const char* fullName);
+
+    BOOL HasFailed() { return Failed; }
+
+protected:
+    void ReportError(const char* path);
+};
+
+CFindArchiveSearch::CFindArchiveSearch(CGrepData* data, const char* archive)
+    : File(&Error), Gzip(&Error)
+{
+    Data = data;
+    Archive = archive;
+    Reader = NULL;
+    Buffer = NULL;
+    Failed = FALSE;
+}
+
+CFindArchiveSearch::~CFindArchiveSearch()
+{
+    if (Reader != NULL)
+        delete Reader;
+    if (Buffer != NULL)
+        free(Buffer);
+}
+
+void CFindArchiveSearch::ReportError(const char* path)
+{
+    char buf[MAX_PATH + 100];
+    FIND_LOG_ITEM log;
+    log.Flags = FLI_ERROR;
+    if (Error.TextID == IDS_ERROR_OPENING_FILE2)
+    {
+        sprintf(buf, LoadStr(IDS_ERROR_OPENING_FILE2), GetErrorText(Error.ErrorCode));
+        log.Text = buf;
+    }
+    else
+        log.Text = LoadStr(Error.TextID != 0 ? Error.TextID : IDS_PACKRET_NOTARC);
+    log.Path = path;
+    SendMessage(Data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+    Failed = TRUE;
+}
+
+BOOL CFindArchiveSearch::Open()
+{
+    CFindArchiveType type = GetFindArchiveType(Archive);
+    if (type == fatNone)
+        return FALSE;
+    if (!File.Open(Archive))
+    {
+        ReportError(Archive);
+        return FALSE;
+    }
+    if (type == fatZip)
+        Reader = new CFindZipReader(&File, &Error);
+    else
+    {
+        if (type == fatTarGz)
+        {
+            if (!Gzip.Start(&File, TRUE, 0))
+            {
+                ReportError(Archive);
+                return FALSE;
+            }
+            Reader = new CFindTarReader(&Gzip, &Error);
+        }
+        else
+            Reader = new CFindTarReader(&File, &Error);
+    }
+    if (Reader == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    if (!Reader->Open())
+    {
+        ReportError(Archive);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL CFindArchiveSearch::NextEntry(CFindArchiveEntry* entry)
+{
+    if (Failed)
+        return FALSE;
+    if (Reader->NextEntry(entry))
+        return TRUE;
+    if (Error.TextID != 0)
+        ReportError(Archive);
+    return FALSE;
+}
+
+BOOL CFindArchiveSearch::TestContent(const CFindArchiveEntry* entry, const char* fullName)
+{
+    if (!entry->CanRead || entry->Size == 0)
+        return FALSE; // cannot be searched or there is nothing to find
+    if (Buffer == NULL)
+    {
+        Buffer = (char*)malloc(ARCHIVE_SEARCH_BUFFER);
+        if (Buffer == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            return FALSE;
+        }
+    }
+    Data->SearchingText->Set(fullName); // set the current file
+
+    // the data are searched in views like a mapped file; the part of the buffer the next
+    // view starts with (the unfinished line or the possible start of the text) is moved
+    // to the beginning of the buffer and the rest is filled with more data
+    CQuadWord totalSize;
+    totalSize.SetUI64(entry->Size);
+    CQuadWord fileOffset(0, 0);
+    unsigned __int64 bufferOffset = 0; // offset of Buffer in the entry
+    DWORD bufferLen = 0;
+    BOOL ok = FALSE;
+    while (!Data->StopSearch && fileOffset < totalSize)
+    {
+        DWORD done = (DWORD)min(fileOffset.Value - bufferOffset, (unsigned __int64)bufferLen);
+        if (done > 0)
+        {
+            memmove(Buffer, Buffer + done, bufferLen - done);
+            bufferLen -= done;
+            bufferOffset += done;
+        }
+        while (bufferLen < ARCHIVE_SEARCH_BUFFER && bufferOffset + bufferLen < entry->Size)
+        {
+            DWORD read;
+            if (!Reader->ReadData(Buffer + bufferLen, ARCHIVE_SEARCH_BUFFER - bufferLen, &read) || read == 0)
+            {
+                ReportError(fullName);
+                return FALSE;
+            }
+            bufferLen += read;
+        }
+
+        CQuadWord viewOffset(fileOffset);
+        if (!TestFileContentAux(ok, fileOffset, totalSize, bufferLen, fullName, Buffer, Data,
+                                &Data->SearchData, &Data->RegExp) ||
+            ok)
+        {
+            break;
+        }
+        if (fileOffset == viewOffset) // a line longer than GREP_LINE_LEN, it is split
+            fileOffset += CQuadWord(GREP_LINE_LEN, 0);
+    }
+    return ok;
+}
+
+//
+// ****************************************************************************
+
+void SearchArchive(const char* archive, CMaskGroup* masksGroup, CGrepData* data)
+{
+    SLOW_CALL_STACK_MESSAGE2("SearchArchive(%s, , )", archive);
+
+    data->SearchingText->Set(archive); // set the current path
+    CFindArchiveSearch search(data, archive);
+    if (!search.Open())
+        return;
+
+    int archiveLen = (int)strlen(archive);
+    char fullName[MAX_PATH];
+    CFindArchiveEntry entry;
+    while (!data->StopSearch && search.NextEntry(&entry))
+    {
+        if (archiveLen + 1 + (int)strlen(entry.Name) >= MAX_PATH)
+        {
+            FIND_LOG_ITEM log;
+            log.Flags = FLI_ERROR;
+            log.Text = LoadStr(IDS_TOOLONGNAME);
+            log.Path = archive;
+            SendMessage(data->HWindow, WM_USER_ADDLOG, (WPARAM)&log, 0);
+            continue;
+        }
+        memcpy(fullName, archive, archiveLen);
+        fullName[archiveLen] = '\\';
+        strcpy(fullName + archiveLen + 1, entry.Name);
+        char* name = strrchr(fullName, '\\') + 1;
+
+        // test the criteria attributes, size, date and time, then the name
+        CQuadWord size;
+        size.SetUI64(entry.Size);
+        if (!data->Criteria.Test(entry.Attr, &size, &entry.LastWrite) ||
+            !masksGroup->AgreeMasks(name, NULL))
+        {
+            continue;
+        }
+
+        BOOL ok;
+        if (data->Grep)
+            ok = !entry.IsDir && search.TestContent(&entry, fullName); // a directory cannot be grepped
+        else
+            ok = TRUE;
+        if (search.HasFailed())
+            break;
+
+        if (ok)
+        {
+            *(name - 1) = 0;
+            // the entry must not overtake the files being searched by the grep pipeline
+            if (!AddFoundItemInOrder(fullName, name, size.LoDWord, size.HiDWord, entry.Attr, &entry.LastWrite,
+                                     entry.IsDir, data, TRUE))
+            {
+                break;
+            }
+        }
+    }
+}
+
+BOOL TestArchiveItemContent(const char* path, const char* name, CGrepData* data)
+{
+    SLOW_CALL_STACK_MESSAGE3("TestArchiveItemContent(%s, %s, )", path, name);
+
+    char fullName[MAX_PATH];
+    int pathLen = (int)strlen(path);
+    if (pathLen + 1 + (int)strlen(name) >= MAX_PATH)
+        return FALSE;
+    memcpy(fullName, path, pathLen);
+    fullName[pathLen] = '\\';
+    strcpy(fullName + pathLen + 1, name);
+
+    // the archive is the first existing file on the path with the extension of an archive
+    char* archiveEnd = NULL;
+    char* s;
+    for (s = strchr(fullName, '\\'); s != NULL; s = strchr(s + 1, '\\'))
+    {
+        *s = 0;
+        BOOL isArchive = IsSearchableArchive(fullName);
+        if (isArchive)
+        {
+            DWORD attr = SalGetFileAttributes(fullName);
+            isArchive = attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) == 0;
+        }
+        *s = '\\';
+        if (isArchive)
+        {
+            archiveEnd = s;
+            break;
+        }
+    }
+    if (archiveEnd == NULL)
+        return FALSE;
+
+    *archiveEnd = 0;
+    CFindArchiveSearch search(data, fullName);
+    BOOL ok = FALSE;
+    if (search.Open())
+    {
+        CFindArchiveEntry entry;
+        while (!data->StopSearch && search.NextEntry(&entry))
+        {
+            if (StrICmp(entry.Name, archiveEnd + 1) == 0)
+            {
+                *archiveEnd = '\\';
+                ok = !entry.IsDir && search.TestContent(&entry, fullName);
+                break;
+            }
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,30 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+//*********************************************************************************
+//
+// Searching inside archives
+//
+// When Configuration.FindSearchArchives is set, Find descends into ZIP, TAR and
+// TAR.GZ (TGZ) archives found during the search. The archives are read by the core
+// itself (the central directory of ZIP, the headers of TAR) and the entries are
+// decompressed in memory straight into the matcher, nothing is unpacked to disk.
+// Found entries are reported as "archive\path\name", a path the panel can open.
+// Encrypted entries and entries packed by other methods than "stored" and
+// "deflate" are matched by name only.
+//
+
+// returns TRUE if 'name' has the extension of an archive Find can search
+BOOL IsSearchableArchive(const char* name);
+
+// searches the entries of the archive 'archive' (full name); entries matching the
+// criteria, the masks and (when grepping) containing the searched text are added to
+// the found items; called from the grep thread
+void SearchArchive(const char* archive, CMaskGroup* masksGroup, CGrepData* data);
+
+// returns TRUE if the entry 'name' found in 'path' (a path inside an archive, see above)
+// contains the searched text; used when refining the found items
+BOOL TestArchiveItemContent(const char* path, const char* name, CGrepData* data);
@@ -70,12 +70,88 @@ void CFindOptions::InitMenu(CMenuPopup* popup, BOOL enabled, int originalCount)
 // CFoundFilesData
 //
 
+// items are carved from blocks of FOUNDDATA_BLOCK_ITEMS, released items go to a free
+// list; the blocks are released when no item is allocated
+#define FOUNDDATA_BLOCK_ITEMS 4096
+
+union CFoundFilesDataSlot
+{
+    CFoundFilesDataSlot* Next; // next free slot
+    unsigned __int64 Align;
+    BYTE Data[sizeof(CFoundFilesData)];
+};
+
+CCriticalSection FoundDataCS;                                   // guards the following variables
+TDirectArray<CFoundFilesDataSlot*> FoundDataBlocks(10, 100);    // allocated blocks
+CFoundFilesDataSlot* FoundDataFree = NULL;                      // list of free slots
+int FoundDataBlockUsed = FOUNDDATA_BLOCK_ITEMS;                 // slots of the last block given out so far
+int FoundDataCount = 0;                                         // number of allocated items
+
+#ifdef new // precomp.h redefines 'new' in the debug version (see also array.h)
+#define __FOUNDDATA_REDEF_NEW
+#undef new
+#endif
+
+void* CFoundFilesData::operator new(size_t size) throw()
+{
+    CEnterCriticalSection enterCS(FoundDataCS);
+    CFoundFilesDataSlot* slot = FoundDataFree;
+    if (slot != NULL)
+        FoundDataFree = slot->Next;
+    else
+    {
+        if (FoundDataBlockUsed == FOUNDDATA_BLOCK_ITEMS)
+        {
+            CFoundFilesDataSlot* block = (CFoundFilesDataSlot*)malloc(FOUNDDATA_BLOCK_ITEMS * sizeof(CFoundFilesDataSlot));
+            if (block == NULL)
+                return NULL;
+            FoundDataBlocks.Add(block);
+            if (!FoundDataBlocks.IsGood())
+            {
+                FoundDataBlocks.ResetState();
+                free(block);
+                return NULL;
+            }
+            FoundDataBlockUsed = 0;
+        }
+        slot = FoundDataBlocks[FoundDataBlocks.Count - 1] + FoundDataBlockUsed++;
+    }
+    FoundDataCount++;
+    return slot;
+}
+
+void CFoundFilesData::operator delete(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+    CEnterCriticalSection enterCS(FoundDataCS);
+    CFoundFilesDataSlot* slot = (CFoundFilesDataSlot*)ptr;
+    slot->Next = FoundDataFree;
+    FoundDataFree = slot;
+    if (--FoundDataCount == 0)
+    {
+        // all items were released (all Find windows were cleared or closed)
+        int i;
+        for (i = 0; i < FoundDataBlocks.Count; i++)
+            free(FoundDataBlocks[i]);
+        FoundDataBlocks.DestroyMembers();
+        FoundDataFree = NULL;
+        FoundDataBlockUsed = FOUNDDATA_BLOCK_ITEMS;
+    }
+}
+
+#ifdef __FOUNDDATA_REDEF_NEW
+#define new new (_NORMAL_BLOCK, __FILE__, __LINE__)
+#undef __FOUNDDATA_REDEF_NEW
+#endif
+
 BOOL CFoundFilesData::Set(const char* path, const char* name, const CQuadWord& size, DWORD attr,
                           const FILETIME* lastWrite, BOOL isDir)
 {
     CALL_STACK_MESSAGE_NONE
     //  CALL_STACK_MESSAGE5("CFoundFilesData::Set(%s, %s, %g, 0x%X, )", path, name, size.GetDouble(), attr);
     int l1 = (int)strlen(path), l2 = (int)strlen(name);
+    OwnStrings = 1;
     Path = (char*)malloc(l1 + 1);
     Name = (char*)malloc(l2 + 1);
     if (Path == NULL || Name == NULL)
@@ -89,6 +165,176 @@ BOOL CFoundFilesData::Set(const char* path, const char* name, const CQuadWord& s
     return TRUE;
 }
 
+BOOL CFoundFilesData::Set(CFoundFilesStrings* strings, const char* path, const char* name, const CQuadWord& size,
+                          DWORD attr, const FILETIME* lastWrite, BOOL isDir)
+{
+    CALL_STACK_MESSAGE_NONE
+    OwnStrings = 0;
+    Path = strings->AddPath(path);
+    Name = strings->AddName(name);
+    if (Path == NULL || Name == NULL)
+        return FALSE;
+    Size = size;
+    Attr = attr;
+    LastWrite = *lastWrite;
+    IsDir = isDir ? 1 : 0;
+    return TRUE;
+}
+
+//****************************************************************************
+//
+// CFoundFilesStrings
+//
+
+#define FOUNDSTRINGS_BLOCK_SIZE (64 * 1024) // size of the blocks strings are allocated from
+#define FOUNDSTRINGS_PATHS_BASE 1024        // initial size of the hash table of paths
+
+CFoundFilesStrings::CFoundFilesStrings() : Blocks(10, 100)
+{
+    HANDLES(InitializeCriticalSection(&CS));
+    Free = NULL;
+    FreeSize = 0;
+    Paths = NULL;
+    PathsSize = 0;
+    PathsCount = 0;
+    LastPath = NULL;
+}
+
+CFoundFilesStrings::~CFoundFilesStrings()
+{
+    Clear();
+    HANDLES(DeleteCriticalSection(&CS));
+}
+
+void CFoundFilesStrings::Clear()
+{
+    HANDLES(EnterCriticalSection(&CS));
+    int i;
+    for (i = 0; i < Blocks.Count; i++)
+        free(Blocks[i]);
+    Blocks.DestroyMembers();
+    Free = NULL;
+    FreeSize = 0;
+    if (Paths != NULL)
+        free(Paths);
+    Paths = NULL;
+    PathsSize = 0;
+    PathsCount = 0;
+    LastPath = NULL;
+    HANDLES(LeaveCriticalSection(&CS));
+}
+
+char* CFoundFilesStrings::Alloc(int size)
+{
+    if (size > FreeSize)
+    {
+        // long strings get their own block so the rest of the current block is not wasted
+        int blockSize = size > FOUNDSTRINGS_BLOCK_SIZE / 4 ? size : FOUNDSTRINGS_BLOCK_SIZE;
+        char* block = (char*)malloc(blockSize);
+        if (block == NULL)
+            return NULL;
+        Blocks.Add(block);
+        if (!Blocks.IsGood())
+        {
+            Blocks.ResetState();
+            free(block);
+            return NULL;
+        }
+        if (blockSize == size)
+            return block;
+        Free = block;
+        FreeSize = blockSize;
+    }
+    char* ret = Free;
+    Free += size;
+    FreeSize -= size;
+    return ret;
+}
+
+// FNV-1a hash of a path (paths are interned case-sensitively, like they were found)
+DWORD GetPathHash(const char* path)
+{
+    DWORD hash = 2166136261u;
+    while (*path != 0)
+        hash = (hash ^ (BYTE)*path++) * 16777619;
+    return hash;
+}
+
+BOOL CFoundFilesStrings::GrowPaths()
+{
+    int newSize = PathsSize == 0 ? FOUNDSTRINGS_PATHS_BASE : 2 * PathsSize;
+    char** newPaths = (char**)calloc(newSize, sizeof(char*));
+    if (newPaths == NULL)
+        return FALSE;
+    int i;
+    for (i = 0; i < PathsSize; i++)
+    {
+        if (Paths[i] != NULL)
+        {
+            DWORD h = GetPathHash(Paths[i]) & (newSize - 1);
+            while (newPaths[h] != NULL)
+                h = (h + 1) & (newSize - 1);
+            newPaths[h] = Paths[i];
+        }
+    }
+    if (Paths != NULL)
+        free(Paths);
+    Paths = newPaths;
+    PathsSize = newSize;
+    return TRUE;
+}
+
+char* CFoundFilesStrings::AddPath(const char* path)
+{
+    char* ret = NULL;
+    HANDLES(EnterCriticalSection(&CS));
+    if (LastPath != NULL && strcmp(LastPath, path) == 0)
+        ret = LastPath;
+    else
+    {
+        if (2 * (PathsCount + 1) > PathsSize && !GrowPaths()) // we keep the table at most half full
+            TRACE_E(LOW_MEMORY);
+        else
+        {
+            DWORD h = GetPathHash(path) & (PathsSize - 1);
+            while (Paths[h] != NULL && strcmp(Paths[h], path) != 0)
+                h = (h + 1) & (PathsSize - 1);
+            if (Paths[h] != NULL)
+                ret = Paths[h];
+            else
+            {
+                int len = (int)strlen(path);
+                ret = Alloc(len + 1);
+                if (ret == NULL)
+                    TRACE_E(LOW_MEMORY);
+                else
+                {
+                    memcpy(ret, path, len + 1);
+                    Paths[h] = ret;
+                    PathsCount++;
+                }
+            }
+            if (ret != NULL)
+                LastPath = ret;
+        }
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+    return ret;
+}
+
+char* CFoundFilesStrings::AddName(const char* name)
+{
+    int len = (int)strlen(name);
+    HANDLES(EnterCriticalSection(&CS));
+    char* ret = Alloc(len + 1);
+    HANDLES(LeaveCriticalSection(&CS));
+    if (ret != NULL)
+        memcpy(ret, name, len + 1);
+    else
+        TRACE_E(LOW_MEMORY);
+    return ret;
+}
+
 char* CFoundFilesData::GetText(int i, char* text, int fileNameFormat)
 {
     // several FIND windows may run in parallel, which could overwrite this static buffer
@@ -190,6 +436,8 @@ void CFoundFilesListView::DestroyMembers()
     //  HANDLES(EnterCriticalSection(&DataCriticalSection));
     Data.DestroyMembers();
     //  HANDLES(LeaveCriticalSection(&DataCriticalSection));
+    if (DataForRefine.Count == 0)
+        Strings.Clear(); // no item uses the strings any longer
 }
 
 void CFoundFilesListView::Delete(int index)
@@ -217,6 +465,18 @@ int CFoundFilesListView::Add(CFoundFilesData* item)
     return index;
 }
 
+BOOL CFoundFilesListView::AddBatch(CFoundFilesData* const* items, int count)
+{
+    BOOL ok;
+    HANDLES(EnterCriticalSection(&DataCriticalSection));
+    Data.Add(items, count);
+    ok = Data.IsGood();
+    if (!ok)
+        Data.ResetState();
+    HANDLES(LeaveCriticalSection(&DataCriticalSection));
+    return ok;
+}
+
 BOOL CFoundFilesListView::TakeDataForRefine()
 {
     DataForRefine.DestroyMembers();
@@ -239,6 +499,8 @@ BOOL CFoundFilesListView::TakeDataForRefine()
 void CFoundFilesListView::DestroyDataForRefine()
 {
     DataForRefine.DestroyMembers();
+    if (Data.Count == 0)
+        Strings.Clear(); // no item uses the strings any longer
 }
 
 int CFoundFilesListView::GetDataForRefineCount()
@@ -619,8 +881,7 @@ int CFoundFilesListView::CompareFunc(CFoundFilesData* f1, CFoundFilesData* f2, i
 
             case 1:
             {
-                res = RegSetStrICmp(f1->Path, f2->Path);
-                break;
+                res = f1->Path == f2->Path ? 0 : RegSetStrICmp(f1->Path, f2->Path); // paths are mostly interned
                 break;
             }
 
@@ -2159,16 +2420,18 @@ void CFindDialog::EnableToolBar()
     BOOL lvFocused = GetFocus() == FoundFilesListView->HWindow;
     BOOL selectedCount = ListView_GetSelectedCount(FoundFilesListView->HWindow);
     int focusedIndex = ListView_GetNextItem(FoundFilesListView->HWindow, -1, LVNI_FOCUSED);
-    BOOL focusedIsFile = focusedIndex != -1 && !FoundFilesListView->At(focusedIndex)->IsDir;
+    BOOL focusedIsFile = focusedIndex != -1 && !FoundFilesListView->At(focusedIndex)->IsDir &&
+                         !FoundFilesListView->At(focusedIndex)->InArchive;
+    BOOL selectedOnDisk = selectedCount > 0 && !SelectionHasArchiveItems(); // archive entries can only be focused
 
     TBHeader->EnableItem(CM_FIND_FOCUS, FALSE, lvFocused && focusedIndex != -1);
     TBHeader->EnableItem(CM_FIND_VIEW, FALSE, lvFocused && focusedIsFile);
     TBHeader->EnableItem(CM_FIND_EDIT, FALSE, lvFocused && focusedIsFile);
-    TBHeader->EnableItem(CM_FIND_DELETE, FALSE, lvFocused && selectedCount > 0);
-    TBHeader->EnableItem(CM_FIND_USERMENU, FALSE, lvFocused && selectedCount > 0);
-    TBHeader->EnableItem(CM_FIND_PROPERTIES, FALSE, lvFocused && selectedCount > 0);
-    TBHeader->EnableItem(CM_FIND_CLIPCUT, FALSE, lvFocused && selectedCount > 0);
-    TBHeader->EnableItem(CM_FIND_CLIPCOPY, FALSE, lvFocused && selectedCount > 0);
+    TBHeader->EnableItem(CM_FIND_DELETE, FALSE, lvFocused && selectedOnDisk);
+    TBHeader->EnableItem(CM_FIND_USERMENU, FALSE, lvFocused && selectedOnDisk);
+    TBHeader->EnableItem(CM_FIND_PROPERTIES, FALSE, lvFocused && selectedOnDisk);
+    TBHeader->EnableItem(CM_FIND_CLIPCUT, FALSE, lvFocused && selectedOnDisk);
+    TBHeader->EnableItem(CM_FIND_CLIPCOPY, FALSE, lvFocused && selectedOnDisk);
     TBHeader->EnableItem(IDC_FIND_STOP, FALSE, SearchInProgress);
 }
 
@@ -2372,7 +2635,7 @@ BOOL CFindDialog::GetFocusedFile(char* buffer, int bufferLen, int* viewedIndex)
         *viewedIndex = index;
 
     CFoundFilesData* data = FoundFilesListView->At(index);
-    if (data->IsDir)
+    if (data->IsDir || data->InArchive)
         return FALSE;
     char longName[MAX_PATH];
     int len = (int)strlen(data->Path);
@@ -2385,6 +2648,17 @@ BOOL CFindDialog::GetFocusedFile(char* buffer, int bufferLen, int* viewedIndex)
     return TRUE;
 }
 
+BOOL CFindDialog::SelectionHasArchiveItems()
+{
+    int index = -1;
+    while ((index = ListView_GetNextItem(FoundFilesListView->HWindow, index, LVNI_SELECTED)) != -1)
+    {
+        if (FoundFilesListView->At(index)->InArchive)
+            return TRUE;
+    }
+    return FALSE;
+}
+
 void CFindDialog::UpdateInternalViewerData()
 {
     // copy the find text to the internal viewer
@@ -2554,7 +2828,7 @@ void CFindDialog::OnUserMenu()
 {
     CALL_STACK_MESSAGE1("CFindDialog::OnUserMenu()");
     DWORD selectedCount = ListView_GetSelectedCount(FoundFilesListView->HWindow);
-    if (selectedCount < 1)
+    if (selectedCount < 1 || SelectionHasArchiveItems())
         return;
 
     UserMenuIconBkgndReader.BeginUserMenuIconsInUse();
@@ -3119,14 +3393,16 @@ CFindDialog::DialogProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
             DWORD totalCount = ListView_GetItemCount(FoundFilesListView->HWindow);
             BOOL selectedCount = ListView_GetSelectedCount(FoundFilesListView->HWindow);
             int focusedIndex = ListView_GetNextItem(FoundFilesListView->HWindow, -1, LVNI_FOCUSED);
-            BOOL focusedIsFile = focusedIndex != -1 && !FoundFilesListView->At(focusedIndex)->IsDir;
+            BOOL focusedIsFile = focusedIndex != -1 && !FoundFilesListView->At(focusedIndex)->IsDir &&
+                                 !FoundFilesListView->At(focusedIndex)->InArchive;
+            BOOL selectedOnDisk = selectedCount > 0 && !SelectionHasArchiveItems(); // archive entries can only be focused
 
             switch (popupID)
             {
             case CML_FIND_FILES:
             {
-                popup->EnableItem(CM_FIND_OPEN, FALSE, lvFocused && selectedCount > 0);
-                popup->EnableItem(CM_FIND_OPENSEL, FALSE, lvFocused && selectedCount > 0);
+                popup->EnableItem(CM_FIND_OPEN, FALSE, lvFocused && selectedOnDisk);
+                popup->EnableItem(CM_FIND_OPENSEL, FALSE, lvFocused && selectedOnDisk);
                 popup->EnableItem(CM_FIND_FOCUS, FALSE, lvFocused && focusedIndex != -1);
                 popup->EnableItem(CM_FIND_HIDESEL, FALSE, lvFocused && selectedCount > 0);
                 popup->EnableItem(CM_FIND_HIDE_DUP, FALSE, totalCount > 0);
@@ -3135,9 +3411,9 @@ CFindDialog::DialogProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
                 popup->EnableItem(CM_FIND_ALTVIEW, FALSE, lvFocused && focusedIsFile);
                 popup->EnableItem(CM_FIND_EDIT, FALSE, lvFocused && focusedIsFile);
                 popup->EnableItem(CM_FIND_EDIT_WITH, FALSE, lvFocused && focusedIsFile);
-                popup->EnableItem(CM_FIND_DELETE, FALSE, lvFocused && selectedCount > 0);
-                popup->EnableItem(CM_FIND_USERMENU, FALSE, lvFocused && selectedCount > 0);
-                popup->EnableItem(CM_FIND_PROPERTIES, FALSE, lvFocused && selectedCount > 0);
+                popup->EnableItem(CM_FIND_DELETE, FALSE, lvFocused && selectedOnDisk);
+                popup->EnableItem(CM_FIND_USERMENU, FALSE, lvFocused && selectedOnDisk);
+                popup->EnableItem(CM_FIND_PROPERTIES, FALSE, lvFocused && selectedOnDisk);
                 break;
             }
 
@@ -3154,8 +3430,8 @@ CFindDialog::DialogProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
 
             case CML_FIND_EDIT:
             {
-                popup->EnableItem(CM_FIND_CLIPCUT, FALSE, lvFocused && selectedCount > 0);
-                popup->EnableItem(CM_FIND_CLIPCOPY, FALSE, lvFocused && selectedCount > 0);
+                popup->EnableItem(CM_FIND_CLIPCUT, FALSE, lvFocused && selectedOnDisk);
+                popup->EnableItem(CM_FIND_CLIPCOPY, FALSE, lvFocused && selectedOnDisk);
                 popup->EnableItem(CM_FIND_CLIPCOPYFULLNAME, FALSE, lvFocused && selectedCount == 1);
                 popup->EnableItem(CM_FIND_CLIPCOPYNAME, FALSE, lvFocused && selectedCount == 1);
                 popup->EnableItem(CM_FIND_CLIPCOPYFULLPATH, FALSE, lvFocused && selectedCount == 1);
@@ -132,7 +132,7 @@ void CFindDialog::OnDelete(BOOL toRecycle)
     CALL_STACK_MESSAGE1("CFindDialog::OnDelete()");
     HWND hListView = FoundFilesListView->HWindow;
     DWORD selCount = ListView_GetSelectedCount(hListView);
-    if (selCount == 0)
+    if (selCount == 0 || SelectionHasArchiveItems())
         return;
 
     // compute the final size of the list
@@ -1341,7 +1341,7 @@ void CFindDialog::OnDrag(BOOL rightMouseButton)
 
     HWND hListView = FoundFilesListView->HWindow;
     DWORD selCount = ListView_GetSelectedCount(hListView);
-    if (selCount < 1)
+    if (selCount < 1 || SelectionHasArchiveItems())
         return;
 
     char commonPrefixPath[MAX_PATH];
@@ -1418,7 +1418,7 @@ void CFindDialog::OnContextMenu(int x, int y)
 
     HWND hListView = FoundFilesListView->HWindow;
     DWORD selCount = ListView_GetSelectedCount(hListView);
-    if (selCount < 1)
+    if (selCount < 1 || SelectionHasArchiveItems())
         return;
 
     char commonPrefixPath[MAX_PATH];
@@ -1501,7 +1501,7 @@ BOOL CFindDialog::InvokeContextMenu(const char* lpVerb)
     BOOL ret = FALSE;
     HWND hListView = FoundFilesListView->HWindow;
     DWORD selCount = ListView_GetSelectedCount(hListView);
-    if (selCount < 1)
+    if (selCount < 1 || SelectionHasArchiveItems())
         return FALSE;
     HCURSOR hOldCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
     if (InitializeOle())
@@ -1564,7 +1564,7 @@ void CFindDialog::OnProperties()
 void CFindDialog::OnOpen(BOOL onlyFocused)
 {
     int count = ListView_GetSelectedCount(FoundFilesListView->HWindow);
-    if (count == 0)
+    if (count == 0 || SelectionHasArchiveItems())
         return;
 
     if (!InitializeOle())
@@ -0,0 +1,855 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#include "precomp.h"
+
+#include "cfgdlg.h"
+#include "dirwalk.h"
+#include "findidx.h"
+
+CFindIndex FindIndex;
+
+#define FINDINDEX_MAGIC "SALFIDX1"                       // beginning of the file with a stored index
+#define FINDINDEX_BUFFER_SIZE (64 * 1024)                // buffer for reading indexed files and writing the index
+#define FINDINDEX_UPDATE_INTERVAL (5 * 60 * 1000)        // min. time between two updates of the index (in ms)
+#define FINDINDEX_BITMAP_SIZE ((1 << 24) / 8)            // one bit for every possible trigram
+
+//*********************************************************************************
+//
+// CFindIndexFile, CFindIndexRoot
+//
+
+struct CFindIndexFile
+{
+    char* Name; // name relative to the root
+    CQuadWord Size;
+    FILETIME LastWrite;
+    BOOL Indexed; // FALSE = the trigrams are unknown (file too large, too many trigrams, read error)
+
+    // sorted trigrams, each stored as the difference from the previous one: 7 bits
+    // per byte starting with the lowest bits, the highest bit is set if more bytes follow
+    BYTE* Trigrams;
+    DWORD TrigramsSize;
+
+    CFindIndexFile()
+    {
+        Name = NULL;
+        Size.Set(0, 0);
+        LastWrite.dwLowDateTime = LastWrite.dwHighDateTime = 0;
+        Indexed = FALSE;
+        Trigrams = NULL;
+        TrigramsSize = 0;
+    }
+    ~CFindIndexFile()
+    {
+        if (Name != NULL)
+            free(Name);
+        if (Trigrams != NULL)
+            free(Trigrams);
+    }
+};
+
+int CompareIndexFiles(const void* elem1, const void* elem2)
+{
+    return StrICmp((*(CFindIndexFile**)elem1)->Name, (*(CFindIndexFile**)elem2)->Name);
+}
+
+struct CFindIndexRoot
+{
+    char Path[MAX_PATH]; // full path with a trailing backslash
+    int PathLen;
+    char IndexName[MAX_PATH];               // file with the stored index
+    TIndirectArray<CFindIndexFile>* Files; // indexed files sorted by Name; NULL = nothing indexed yet
+
+    CFindIndexRoot()
+    {
+        Path[0] = 0;
+        PathLen = 0;
+        IndexName[0] = 0;
+        Files = NULL;
+    }
+    ~CFindIndexRoot()
+    {
+        if (Files != NULL)
+            delete Files;
+    }
+
+    // returns the file 'name' (relative to the root) or NULL if it is not indexed
+    CFindIndexFile* Find(const char* name);
+
+    // loads the stored index; returns FALSE if it does not exist or is damaged
+    BOOL LoadIndex();
+
+    // stores the index (the previous index is replaced only if the new one is written
+    // completely); returns FALSE on errors
+    BOOL SaveIndex();
+};
+
+CFindIndexFile* CFindIndexRoot::Find(const char* name)
+{
+    if (Files == NULL)
+        return NULL;
+    int l = 0, r = Files->Count - 1;
+    while (l <= r)
+    {
+        int m = (l + r) / 2;
+        int res = StrICmp(name, Files->At(m)->Name);
+        if (res == 0)
+            return Files->At(m);
+        if (res < 0)
+            r = m - 1;
+        else
+            l = m + 1;
+    }
+    return NULL;
+}
+
+BOOL CFindIndexRoot::LoadIndex()
+{
+    CALL_STACK_MESSAGE2("CFindIndexRoot::LoadIndex() %s", Path);
+    HANDLE hFile = HANDLES_Q(CreateFile(IndexName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                        FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE; // the index has not been stored yet
+    DWORD sizeHigh;
+    DWORD size = GetFileSize(hFile, &sizeHigh);
+    BYTE* data = NULL;
+    DWORD read;
+    if (size != INVALID_FILE_SIZE && sizeHigh == 0)
+    {
+        data = (BYTE*)malloc(size);
+        if (data == NULL)
+            TRACE_E(LOW_MEMORY);
+        else
+        {
+            if (!ReadFile(hFile, data, size, &read, NULL) || read != size)
+            {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    HANDLES(CloseHandle(hFile));
+    if (data == NULL)
+        return FALSE;
+
+    TIndirectArray<CFindIndexFile>* files = new TIndirectArray<CFindIndexFile>(1000, 5000);
+    BOOL ok = files != NULL;
+    BYTE* p = data;
+    BYTE* end = data + size;
+    DWORD count = 0;
+    if (ok)
+    {
+        // header: magic, the root path and the number of files
+        DWORD rootLen;
+        ok = end - p >= 8 + sizeof(DWORD) && memcmp(p, FINDINDEX_MAGIC, 8) == 0 &&
+             (rootLen = *(DWORD*)(p + 8)) == (DWORD)PathLen &&
+             (DWORD)(end - p) >= 8 + sizeof(DWORD) + rootLen + sizeof(DWORD) &&
+             StrNICmp((char*)p + 8 + sizeof(DWORD), Path, PathLen) == 0;
+        if (ok)
+        {
+            p += 8 + sizeof(DWORD) + rootLen;
+            count = *(DWORD*)p;
+            p += sizeof(DWORD);
+        }
+    }
+    DWORD i;
+    for (i = 0; ok && i < count; i++)
+    {
+        // file: name length, name, size, time, flag, trigrams size, trigrams
+        WORD nameLen;
+        DWORD trigramsSize;
+        if ((DWORD)(end - p) < sizeof(WORD))
+        {
+            ok = FALSE;
+            break;
+        }
+        nameLen = *(WORD*)p;
+        if ((DWORD)(end - p) < sizeof(WORD) + nameLen + 6 * sizeof(DWORD))
+        {
+            ok = FALSE;
+            break;
+        }
+        p += sizeof(WORD);
+        CFindIndexFile* file = new CFindIndexFile;
+        if (file == NULL || (file->Name = (char*)malloc(nameLen + 1)) == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            if (file != NULL)
+                delete file;
+            ok = FALSE;
+            break;
+        }
+        memcpy(file->Name, p, nameLen);
+        file->Name[nameLen] = 0;
+        p += nameLen;
+        file->Size.Set(((DWORD*)p)[0], ((DWORD*)p)[1]);
+        file->LastWrite.dwLowDateTime = ((DWORD*)p)[2];
+        file->LastWrite.dwHighDateTime = ((DWORD*)p)[3];
+        file->Indexed = ((DWORD*)p)[4] != 0;
+        trigramsSize = ((DWORD*)p)[5];
+        p += 6 * sizeof(DWORD);
+        if ((DWORD)(end - p) < trigramsSize)
+            ok = FALSE;
+        else
+        {
+            if (trigramsSize > 0)
+            {
+                file->Trigrams = (BYTE*)malloc(trigramsSize);
+                if (file->Trigrams == NULL)
+                {
+                    TRACE_E(LOW_MEMORY);
+                    ok = FALSE;
+                }
+                else
+                {
+                    memcpy(file->Trigrams, p, trigramsSize);
+                    file->TrigramsSize = trigramsSize;
+                }
+            }
+            p += trigramsSize;
+        }
+        if (ok)
+        {
+            files->Add(file);
+            if (!files->IsGood())
+            {
+                files->ResetState();
+                ok = FALSE;
+            }
+        }
+        if (!ok)
+            delete file;
+    }
+    free(data);
+
+    if (!ok || p != end)
+    {
+        TRACE_E("Find index " << IndexName << " is damaged, it will be rebuilt.");
+        if (files != NULL)
+            delete files;
+        return FALSE;
+    }
+    Files = files; // the files were stored sorted
+    return TRUE;
+}
+
+// buffered writing of the index file
+class CFindIndexWriter
+{
+protected:
+    HANDLE File;
+    BYTE* Buffer;
+    DWORD Used;
+    BOOL Error;
+
+public:
+    CFindIndexWriter(HANDLE file)
+    {
+        File = file;
+        Buffer = (BYTE*)malloc(FINDINDEX_BUFFER_SIZE);
+        Used = 0;
+        Error = Buffer == NULL;
+    }
+    ~CFindIndexWriter()
+    {
+        if (Buffer != NULL)
+            free(Buffer);
+    }
+
+    void Write(const void* data, DWORD size)
+    {
+        while (!Error && size > 0)
+        {
+            DWORD part = min(size, FINDINDEX_BUFFER_SIZE - Used);
+            memcpy(Buffer + Used, data, part);
+            Used += part;
+            data = (const BYTE*)data + part;
+            size -= part;
+            if (Used == FINDINDEX_BUFFER_SIZE)
+                Flush();
+        }
+    }
+
+    void WriteDWord(DWORD value) { Write(&value, sizeof(value)); }
+
+    // returns FALSE if some write failed
+    BOOL Flush()
+    {
+        DWORD written;
+        if (!Error && Used > 0 && (!WriteFile(File, Buffer, Used, &written, NULL) || written != Used))
+            Error = TRUE;
+        Used = 0;
+        return !Error;
+    }
+};
+
+BOOL CFindIndexRoot::SaveIndex()
+{
+    CALL_STACK_MESSAGE2("CFindIndexRoot::SaveIndex() %s", Path);
+    if (Files == NULL)
+        return FALSE;
+
+    // the directory for indexes (its parent is created as well)
+    char dir[MAX_PATH];
+    lstrcpyn(dir, IndexName, MAX_PATH);
+    CutDirectory(dir);
+    char parent[MAX_PATH];
+    lstrcpyn(parent, dir, MAX_PATH);
+    CutDirectory(parent);
+    CreateDirectory(parent, NULL); // if it fails (e.g. it already exists), we do not care...
+    CreateDirectory(dir, NULL);
+
+    char tmpName[MAX_PATH + 4];
+    sprintf(tmpName, "%s.tmp", IndexName);
+    HANDLE hFile = HANDLES_Q(CreateFile(tmpName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                        FILE_ATTRIBUTE_NORMAL, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        DWORD err = GetLastError();
+        TRACE_E("Unable to create find index " << tmpName << ": " << GetErrorText(err));
+        return FALSE;
+    }
+    BOOL ok;
+    {
+        CFindIndexWriter writer(hFile);
+        writer.Write(FINDINDEX_MAGIC, 8);
+        writer.WriteDWord(PathLen);
+        writer.Write(Path, PathLen);
+        writer.WriteDWord(Files->Count);
+        int i;
+        for (i = 0; i < Files->Count; i++)
+        {
+            CFindIndexFile* file = Files->At(i);
+            WORD nameLen = (WORD)strlen(file->Name);
+            writer.Write(&nameLen, sizeof(nameLen));
+            writer.Write(file->Name, nameLen);
+            writer.WriteDWord(file->Size.LoDWord);
+            writer.WriteDWord(file->Size.HiDWord);
+            writer.WriteDWord(file->LastWrite.dwLowDateTime);
+            writer.WriteDWord(file->LastWrite.dwHighDateTime);
+            writer.WriteDWord(file->Indexed);
+            writer.WriteDWord(file->TrigramsSize);
+            writer.Write(file->Trigrams, file->TrigramsSize);
+        }
+        ok = writer.Flush();
+    }
+    HANDLES(CloseHandle(hFile));
+    if (ok)
+        ok = MoveFileEx(tmpName, IndexName, MOVEFILE_REPLACE_EXISTING);
+    if (!ok)
+    {
+        DWORD err = GetLastError();
+        TRACE_E("Unable to store find index " << IndexName << ": " << GetErrorText(err));
+        DeleteFile(tmpName);
+    }
+    return ok;
+}
+
+//*********************************************************************************
+//
+// CFindIndexQuery
+//
+
+int CompareTrigrams(const void* elem1, const void* elem2)
+{
+    DWORD t1 = *(DWORD*)elem1;
+    DWORD t2 = *(DWORD*)elem2;
+    return t1 < t2 ? -1 : (t1 == t2 ? 0 : 1);
+}
+
+// sorts 'count' trigrams in 'trigrams' and removes duplicates; returns the new count
+int SortTrigrams(DWORD* trigrams, int count)
+{
+    qsort(trigrams, count, sizeof(DWORD), CompareTrigrams);
+    int n = 0;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if (n == 0 || trigrams[n - 1] != trigrams[i])
+            trigrams[n++] = trigrams[i];
+    }
+    return n;
+}
+
+BOOL CFindIndexQuery::Set(const char* text, int length)
+{
+    if (Trigrams != NULL)
+        free(Trigrams);
+    Trigrams = NULL;
+    Count = 0;
+    if (length < 3)
+        return FALSE;
+    Trigrams = (DWORD*)malloc((length - 2) * sizeof(DWORD));
+    if (Trigrams == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    DWORD t = (LowerCase[(BYTE)text[0]] << 8) | LowerCase[(BYTE)text[1]];
+    int i;
+    for (i = 2; i < length; i++)
+    {
+        t = ((t << 8) | LowerCase[(BYTE)text[i]]) & 0xFFFFFF;
+        Trigrams[i - 2] = t;
+    }
+    Count = SortTrigrams(Trigrams, length - 2);
+    return TRUE;
+}
+
+BOOL CFindIndexQuery::IsContainedIn(const BYTE* trigrams, DWORD size) const
+{
+    const BYTE* p = trigrams;
+    const BYTE* end = trigrams + size;
+    DWORD t = 0;          // last decoded trigram of the file
+    BOOL decoded = FALSE; // TRUE = 't' is valid
+    int i;
+    for (i = 0; i < Count; i++)
+    {
+        DWORD wanted = Trigrams[i];
+        while (!decoded || t < wanted)
+        {
+            if (p >= end)
+                return FALSE; // the file does not contain the rest of the query trigrams
+            DWORD delta = 0;
+            int shift = 0;
+            while (p < end && (*p & 0x80))
+            {
+                delta |= (DWORD)(*p++ & 0x7F) << shift;
+                shift += 7;
+            }
+            if (p < end)
+                delta |= (DWORD)*p++ << shift;
+            t += delta;
+            decoded = TRUE;
+        }
+        if (t != wanted)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CFindIndexUpdater
+//
+// Walks one root (on one thread, the update runs in the background and should not
+// load the disk) and builds the new array of indexed files; files with the same size
+// and time as in the current index are taken over without reading them.
+//
+
+class CFindIndexUpdater : public CDirWalkerCallback
+{
+public:
+    CFindIndexRoot* Root;
+    TIndirectArray<CFindIndexFile>* Files; // new array of indexed files
+    BOOL LowMemory;
+    volatile BOOL* Stop;
+
+protected:
+    BYTE* Bitmap;     // trigrams found in the indexed file (FINDINDEX_BITMAP_SIZE bytes, zeroed between files)
+    DWORD* List;      // trigrams found in the indexed file (FINDINDEX_MAX_TRIGRAMS items)
+    BYTE* Buffer;     // FINDINDEX_BUFFER_SIZE bytes for reading the indexed file
+    char FullName[MAX_PATH];
+
+public:
+    CFindIndexUpdater(CFindIndexRoot* root, BYTE* bitmap, DWORD* list, BYTE* buffer, volatile BOOL* stop)
+    {
+        Root = root;
+        Files = new TIndirectArray<CFindIndexFile>(1000, 5000);
+        LowMemory = Files == NULL;
+        Stop = stop;
+        Bitmap = bitmap;
+        List = list;
+        Buffer = buffer;
+    }
+
+    virtual BOOL FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file);
+    virtual void WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err);
+
+protected:
+    // reads file FullName and stores its trigrams to 'file'; returns FALSE if the file
+    // cannot be indexed
+    BOOL IndexFile(CFindIndexFile* file);
+};
+
+BOOL CFindIndexUpdater::FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file)
+{
+    if (file->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        return (file->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0 && !LowMemory; // do not follow links (cycles)
+    if (LowMemory)
+        return FALSE;
+
+    int nameLen = (int)strlen(file->cFileName);
+    if (pathLen + nameLen >= MAX_PATH)
+        return FALSE; // too long name, the file is simply not indexed
+    memcpy(FullName, path, pathLen);
+    memcpy(FullName + pathLen, file->cFileName, nameLen + 1);
+    const char* name = FullName + Root->PathLen;
+
+    CFindIndexFile* item = new CFindIndexFile;
+    if (item == NULL || (item->Name = DupStr(name)) == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        if (item != NULL)
+            delete item;
+        LowMemory = TRUE;
+        return FALSE;
+    }
+    item->Size.Set(file->nFileSizeLow, file->nFileSizeHigh);
+    item->LastWrite = file->ftLastWriteTime;
+
+    CFindIndexFile* old = Root->Find(name); // only this thread changes Root->Files, no need to lock
+    if (old != NULL && old->Size == item->Size && CompareFileTime(&old->LastWrite, &item->LastWrite) == 0)
+    {
+        // the file has not changed, take over its trigrams
+        item->Indexed = old->Indexed;
+        if (old->TrigramsSize > 0)
+        {
+            item->Trigrams = (BYTE*)malloc(old->TrigramsSize);
+            if (item->Trigrams == NULL)
+                item->Indexed = FALSE;
+            else
+            {
+                memcpy(item->Trigrams, old->Trigrams, old->TrigramsSize);
+                item->TrigramsSize = old->TrigramsSize;
+            }
+        }
+    }
+    else
+    {
+        // links have zero size, their targets are not indexed
+        if ((file->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0 &&
+            item->Size <= CQuadWord(FINDINDEX_MAX_FILE_SIZE, 0))
+        {
+            item->Indexed = IndexFile(item);
+        }
+    }
+
+    Files->Add(item);
+    if (!Files->IsGood())
+    {
+        Files->ResetState();
+        delete item;
+        LowMemory = TRUE;
+    }
+    return FALSE;
+}
+
+void CFindIndexUpdater::WalkError(int worker, CDirWalkerErrorType type, const char* path, DWORD err)
+{
+    // the files of the directory are not indexed, they are searched as usual
+    TRACE_I("Find index: unable to list " << path << ": " << GetErrorText(err));
+}
+
+BOOL CFindIndexUpdater::IndexFile(CFindIndexFile* file)
+{
+    HANDLE hFile = HANDLES_Q(CreateFile(FullName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    int count = 0;
+    BOOL ok = TRUE;
+    DWORD t = 0;
+    DWORD total = 0; // number of bytes read so far
+    DWORD read;
+    while (ok && !*Stop)
+    {
+        if (!ReadFile(hFile, Buffer, FINDINDEX_BUFFER_SIZE, &read, NULL))
+        {
+            ok = FALSE;
+            break;
+        }
+        DWORD i;
+        for (i = 0; i < read; i++)
+        {
+            t = ((t << 8) | LowerCase[Buffer[i]]) & 0xFFFFFF;
+            if (total + i >= 2 && (Bitmap[t >> 3] & (1 << (t & 7))) == 0)
+            {
+                if (count == FINDINDEX_MAX_TRIGRAMS)
+                {
+                    ok = FALSE; // probably a binary file, the index would not help
+                    break;
+                }
+                Bitmap[t >> 3] |= 1 << (t & 7);
+                List[count++] = t;
+            }
+        }
+        total += read;
+        if (read != FINDINDEX_BUFFER_SIZE)
+            break;
+    }
+    HANDLES(CloseHandle(hFile));
+    if (*Stop)
+        ok = FALSE;
+
+    int i;
+    for (i = 0; i < count; i++) // prepare the bitmap for the next file
+        Bitmap[List[i] >> 3] = 0;
+    if (!ok || total != file->Size.LoDWord) // the file was changing while it was read
+        return FALSE;
+
+    qsort(List, count, sizeof(DWORD), CompareTrigrams);
+    if (count > 0)
+    {
+        file->Trigrams = (BYTE*)malloc(count * 4); // a difference of trigrams never takes more than 4 bytes
+        if (file->Trigrams == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            return FALSE;
+        }
+        BYTE* p = file->Trigrams;
+        DWORD last = 0;
+        for (i = 0; i < count; i++)
+        {
+            DWORD delta = List[i] - last;
+            last = List[i];
+            while (delta >= 0x80)
+            {
+                *p++ = (BYTE)(delta | 0x80);
+                delta >>= 7;
+            }
+            *p++ = (BYTE)delta;
+        }
+        file->TrigramsSize = (DWORD)(p - file->Trigrams);
+        BYTE* shrunk = (BYTE*)realloc(file->Trigrams, file->TrigramsSize);
+        if (shrunk != NULL)
+            file->Trigrams = shrunk;
+    }
+    return TRUE;
+}
+
+//*********************************************************************************
+//
+// CFindIndex
+//
+
+unsigned FindIndexThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("FindIndexThreadBody()");
+    SetThreadNameInVCAndTrace("FindIndex");
+    TRACE_I("Begin");
+    ((CFindIndex*)param)->UpdateBody();
+    TRACE_I("End");
+    return 0;
+}
+
+unsigned FindIndexThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return FindIndexThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread FindIndex: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // harder exit (this call still performs some operations)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI FindIndexThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return FindIndexThreadEH(param);
+}
+
+CFindIndex::CFindIndex() : Roots(5, 5)
+{
+    HANDLES(InitializeCriticalSection(&CS));
+    Loaded = FALSE;
+    UpdateFinished = TRUE;
+    UpdateStop = FALSE;
+    LastUpdate = 0;
+}
+
+CFindIndex::~CFindIndex()
+{
+    HANDLES(DeleteCriticalSection(&CS));
+}
+
+void CFindIndex::Load()
+{
+    CALL_STACK_MESSAGE1("CFindIndex::Load()");
+    Loaded = TRUE;
+    char base[MAX_PATH];
+    if (SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, 0 /* SHGFP_TYPE_CURRENT */, base) != S_OK ||
+        !SalPathAppend(base, "Open Salamander\\Find Index", MAX_PATH))
+    {
+        TRACE_E("CFindIndex::Load(): unable to get the local application data directory.");
+        return;
+    }
+
+    const char* s = Configuration.FindIndexRoots;
+    while (*s != 0)
+    {
+        // roots are separated by semicolons
+        while (*s == ';' || *s == ' ')
+            s++;
+        const char* end = s;
+        while (*end != 0 && *end != ';')
+            end++;
+        const char* e = end;
+        while (e > s && *(e - 1) == ' ')
+            e--;
+        if (e > s && e - s < MAX_PATH - 1)
+        {
+            CFindIndexRoot* root = new CFindIndexRoot;
+            if (root == NULL)
+            {
+                TRACE_E(LOW_MEMORY);
+                break;
+            }
+            memcpy(root->Path, s, e - s);
+            root->Path[e - s] = 0;
+            SalPathAddBackslash(root->Path, MAX_PATH);
+            root->PathLen = (int)strlen(root->Path);
+
+            // the index file is named after the hash of the root path
+            DWORD hash = 2166136261u; // FNV-1a
+            const char* p;
+            for (p = root->Path; *p != 0; p++)
+                hash = (hash ^ LowerCase[*p]) * 16777619;
+            char name[20];
+            sprintf(name, "%08X.idx", hash);
+            lstrcpyn(root->IndexName, base, MAX_PATH);
+            if (!SalPathAppend(root->IndexName, name, MAX_PATH))
+            {
+                delete root;
+                break;
+            }
+
+            root->LoadIndex();
+            Roots.Add(root);
+            if (!Roots.IsGood())
+            {
+                Roots.ResetState();
+                delete root;
+                break;
+            }
+        }
+        s = end;
+    }
+}
+
+void CFindIndex::StartUpdate()
+{
+    CALL_STACK_MESSAGE1("CFindIndex::StartUpdate()");
+    if (Configuration.FindIndexRoots[0] == 0)
+        return; // the index is not used
+    if (!Loaded)
+        Load();
+    if (Roots.Count == 0 || !UpdateFinished ||
+        LastUpdate != 0 && GetTickCount() - LastUpdate < FINDINDEX_UPDATE_INTERVAL)
+    {
+        return; // the update is running or the index is fresh enough
+    }
+
+    UpdateFinished = FALSE;
+    DWORD threadID;
+    HANDLE thread = HANDLES(CreateThread(NULL, 0, FindIndexThread, this, 0, &threadID));
+    if (thread == NULL)
+    {
+        TRACE_E("Unable to start FindIndex thread.");
+        UpdateFinished = TRUE;
+        return;
+    }
+    AddAuxThread(thread); // killed on exit if it is still running
+}
+
+void CFindIndex::UpdateBody()
+{
+    // the update must not slow down the user's work (background mode lowers the I/O priority too)
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+
+    BYTE* bitmap = (BYTE*)calloc(FINDINDEX_BITMAP_SIZE, 1);
+    DWORD* list = (DWORD*)malloc(FINDINDEX_MAX_TRIGRAMS * sizeof(DWORD));
+    BYTE* buffer = (BYTE*)malloc(FINDINDEX_BUFFER_SIZE);
+    if (bitmap != NULL && list != NULL && buffer != NULL)
+    {
+        int i;
+        for (i = 0; i < Roots.Count && !UpdateStop; i++)
+        {
+            CFindIndexRoot* root = Roots[i];
+            CFindIndexUpdater updater(root, bitmap, list, buffer, &UpdateStop);
+            BOOL walked = FALSE;
+            if (!updater.LowMemory)
+            {
+                CParallelDirWalker walker(&updater, 1, &UpdateStop);
+                if (walker.IsGood())
+                    walked = walker.Walk(root->Path);
+            }
+            if (walked && !UpdateStop && !updater.LowMemory)
+            {
+                TIndirectArray<CFindIndexFile>* files = updater.Files;
+                qsort(files->GetData(), files->Count, sizeof(CFindIndexFile*), CompareIndexFiles);
+                HANDLES(EnterCriticalSection(&CS));
+                TIndirectArray<CFindIndexFile>* old = root->Files;
+                root->Files = files;
+                HANDLES(LeaveCriticalSection(&CS));
+                if (old != NULL)
+                    delete old;
+                root->SaveIndex();
+                TRACE_I("Find index of " << root->Path << " updated: " << files->Count << " files.");
+            }
+            else
+            {
+                if (updater.Files != NULL)
+                    delete updater.Files;
+            }
+        }
+    }
+    else
+        TRACE_E(LOW_MEMORY);
+    if (bitmap != NULL)
+        free(bitmap);
+    if (list != NULL)
+        free(list);
+    if (buffer != NULL)
+        free(buffer);
+    LastUpdate = GetTickCount();
+    if (LastUpdate == 0)
+        LastUpdate = 1; // zero means "never updated"
+    UpdateFinished = TRUE;
+}
+
+BOOL CFindIndex::CannotContain(const CFindIndexQuery* query, const char* path, const CQuadWord& size,
+                               const FILETIME* lastWrite)
+{
+    BOOL ret = FALSE;
+    HANDLES(EnterCriticalSection(&CS));
+    int i;
+    for (i = 0; i < Roots.Count; i++)
+    {
+        CFindIndexRoot* root = Roots[i];
+        if (StrNICmp(path, root->Path, root->PathLen) == 0)
+        {
+            CFindIndexFile* file = root->Find(path + root->PathLen);
+            if (file != NULL && file->Indexed && file->Size == size &&
+                CompareFileTime(&file->LastWrite, lastWrite) == 0)
+            {
+                ret = !query->IsContainedIn(file->Trigrams, file->TrigramsSize);
+                break;
+            }
+        }
+    }
+    HANDLES(LeaveCriticalSection(&CS));
+    return ret;
+}
+
+void CFindIndex::Release()
+{
+    UpdateStop = TRUE;
+    Roots.DestroyMembers();
+    Loaded = FALSE;
+}
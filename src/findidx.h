@@ -0,0 +1,100 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// CommentsTranslationProject: TRANSLATED
+
+#pragma once
+
+#define FINDINDEX_MAX_FILE_SIZE (16 * 1024 * 1024) // larger files are not indexed (they are always searched)
+#define FINDINDEX_MAX_TRIGRAMS (256 * 1024)        // files with more distinct trigrams (mostly binary) are not indexed
+
+//*********************************************************************************
+//
+// CFindIndexQuery
+//
+// Trigrams of the searched text (folded to lower case like the index). A file which
+// does not contain all of them cannot contain the text.
+//
+
+class CFindIndexQuery
+{
+protected:
+    DWORD* Trigrams; // sorted, without duplicates
+    int Count;
+
+public:
+    CFindIndexQuery()
+    {
+        Trigrams = NULL;
+        Count = 0;
+    }
+    ~CFindIndexQuery()
+    {
+        if (Trigrams != NULL)
+            free(Trigrams);
+    }
+
+    // sets the searched text (any bytes); returns FALSE if the index cannot be used for
+    // it (the text is shorter than three characters, low memory)
+    BOOL Set(const char* text, int length);
+
+    // returns TRUE if the delta-coded trigrams of a file (see CFindIndexFile) contain all
+    // trigrams of the query
+    BOOL IsContainedIn(const BYTE* trigrams, DWORD size) const;
+};
+
+//*********************************************************************************
+//
+// CFindIndex
+//
+// Persistent trigram index of the file contents under the roots listed in
+// Configuration.FindIndexRoots (separated by semicolons). For every file the index
+// keeps its size, the time of the last write and the set of trigrams (three bytes
+// folded to lower case) it contains. Find asks the index before it reads a file:
+// if the file is indexed with the same size and time and some trigram of the searched
+// text is missing, the file cannot match. Files outside the roots, new or changed
+// files and files too large to index are searched as usual.
+//
+// The index is brought up to date by a background thread (started when the Find
+// dialog is opened) which walks the roots, reindexes only files whose size or time
+// changed and stores the index in the local application data directory.
+//
+
+struct CFindIndexRoot;
+
+class CFindIndex
+{
+protected:
+    CRITICAL_SECTION CS; // guards the file arrays of the roots (the updating thread swaps them)
+    TIndirectArray<CFindIndexRoot> Roots;
+    BOOL Loaded;                  // TRUE = Roots were set up from the configuration
+    volatile BOOL UpdateFinished; // TRUE = the updating thread is not running
+    volatile BOOL UpdateStop;     // TRUE = the updating thread should end
+    DWORD LastUpdate;             // GetTickCount() of the end of the last update; 0 = not updated yet
+
+public:
+    CFindIndex();
+    ~CFindIndex();
+
+    // starts bringing the index up to date in a background thread (if it is not running
+    // yet and some roots are configured); called from the main thread
+    void StartUpdate();
+
+    // returns TRUE if the file 'path' (full name) is indexed with size 'size' and time
+    // 'lastWrite' and does not contain all trigrams of 'query' (it cannot contain the text)
+    BOOL CannotContain(const CFindIndexQuery* query, const char* path, const CQuadWord& size,
+                       const FILETIME* lastWrite);
+
+    // releases the index data; called on exit (the updating thread was terminated already)
+    void Release();
+
+protected:
+    // sets up Roots from Configuration.FindIndexRoots and loads their stored indexes
+    void Load();
+
+    // body of the updating thread
+    void UpdateBody();
+
+    friend unsigned FindIndexThreadBody(void* param);
+};
+
+extern CFindIndex FindIndex;
@@ -664,6 +664,27 @@ void CIconCache::GetIconsAndThumbsFrom(CIconCache* icons, CPluginDataInterfaceEn
     }
 }
 
+void CIconCache::SetOldVersion(const char* name, int nameLen)
+{
+    char alignedName[MAX_PATH + 4];
+    if (nameLen >= MAX_PATH)
+        return;
+    memcpy(alignedName, name, nameLen);
+    *(DWORD*)(alignedName + nameLen) = 0; // zarovnani po DWORDech pro CompareDWORDS
+    int index;
+    if (GetIndex(alignedName, index, NULL, NULL))
+    {
+        CIconData* data = &At(index);
+        if (data->GetFlag() == 1) // platna ikona -> stara ikona
+            data->SetFlag(2);
+        else
+        {
+            if (data->GetFlag() == 5) // platny thumbnail -> stary thumbnail
+                data->SetFlag(6);
+        }
+    }
+}
+
 void CIconCache::SetIconSize(CIconSizeEnum iconSize)
 {
     if (iconSize == ICONSIZE_COUNT)
@@ -121,6 +121,11 @@ public:
                                BOOL transferIconsAndThumbnailsAsNew = FALSE,
                                BOOL forceReloadThumbnails = FALSE);
 
+    // nactenou ikonu nebo thumbnail souboru/adresare 'name' (delky 'nameLen') prehlasi za starou
+    // verzi, icon-reader ji nacte znovu (soubor se zmenil); pouziti jen pokud 'dataIface' je NULL
+    // (viz GetIndex())
+    void SetOldVersion(const char* name, int nameLen);
+
     // musi prekreslit zakladni sadu ikon s novym pozadim
     void ColorsChanged();
 
@@ -417,6 +417,19 @@ const char* CONFIG_SAVECMDLINEHISTORY_REG = "Save CmdLine History";
 const char* CONFIG_USESALOPEN_REG = "Use salopen.exe";
 const char* CONFIG_NETWAREFASTDIRMOVE_REG = "Netware Fast Dir Move";
 const char* CONFIG_ASYNCCOPYALG_REG = "Async Copy Alg On Network";
+const char* CONFIG_COPYSMALLFILESCONCUR_REG = "Copy Small Files Concurrently";
+const char* CONFIG_VERIFYCOPIEDFILES_REG = "Verify Copied Files";
+const char* CONFIG_COPYCHANGEDBLOCKS_REG = "Copy Changed Blocks Only";
+const char* CONFIG_RESUMECOPIES_REG = "Resume Interrupted Copies";
+const char* CONFIG_COPYDURINGANALYSIS_REG = "Copy During Tree Analysis";
+const char* CONFIG_COPYSPARSEFILES_REG = "Copy Sparse Files";
+const char* CONFIG_ZERORUNSSPARSE_REG = "Make Zero Runs Sparse";
+const char* CONFIG_QUEUEBYDEVICE_REG = "Queue Operations By Device";
+const char* CONFIG_CONCURRENTDELETE_REG = "Delete And Change Attrs Concurrently";
+const char* CONFIG_COPYTELEMETRY_REG = "Record Copy Telemetry";
+const char* CONFIG_READDIRSPROGRESSIVELY_REG = "Read Directories Progressively";
+const char* CONFIG_CALCDIRSIZESCONCUR_REG = "Calculate Directory Sizes Concurrently";
+const char* CONFIG_CACHEDIRSIZES_REG = "Cache Directory Sizes";
 const char* CONFIG_RELOAD_ENV_VARS_REG = "Reload Environment Variables";
 const char* CONFIG_QUICKRENAME_SELALL_REG = "Quick Rename Select All";
 const char* CONFIG_EDITNEW_SELALL_REG = "Edit New File Select All";
@@ -456,6 +469,10 @@ const char* CONFIG_CHD_SHOWCLOUDSTOR = "Change Drive Show Cloud Storages";
 const char* CONFIG_CHD_SHOWNET = "Change Drive Network";
 const char* CONFIG_CURRRENTTIPINDEX = "Current Tip Index";
 const char* CONFIG_SEARCHFILECONTENT = "Search File Content";
+const char* CONFIG_FINDWORKERTHREADS = "Find Worker Threads";
+const char* CONFIG_FINDDUPCOMPAREBYTES = "Find Duplicates Compare Bytes";
+const char* CONFIG_FINDINDEXROOTS = "Find Index Roots";
+const char* CONFIG_FINDSEARCHARCHIVES = "Find Search Archives";
 const char* CONFIG_FINDOPTIONS_REG = "Find Options";
 const char* CONFIG_FINDIGNORE_REG = "Find Ignore";
 #ifdef _WIN64
@@ -1811,6 +1828,13 @@ void CMainWindow::SaveConfig(HWND parent)
                          &Configuration.ChangeDriveShowNet, sizeof(DWORD));
                 SetValue(actKey, CONFIG_SEARCHFILECONTENT, REG_DWORD,
                          &Configuration.SearchFileContent, sizeof(DWORD));
+                SetValue(actKey, CONFIG_FINDWORKERTHREADS, REG_DWORD,
+                         &Configuration.FindWorkerThreads, sizeof(DWORD));
+                SetValue(actKey, CONFIG_FINDDUPCOMPAREBYTES, REG_DWORD,
+                         &Configuration.FindDupCompareBytes, sizeof(DWORD));
+                SetValue(actKey, CONFIG_FINDINDEXROOTS, REG_SZ, Configuration.FindIndexRoots, -1);
+                SetValue(actKey, CONFIG_FINDSEARCHARCHIVES, REG_DWORD,
+                         &Configuration.FindSearchArchives, sizeof(DWORD));
                 SetValue(actKey, CONFIG_LASTPLUGINVER, REG_DWORD,
                          &Configuration.LastPluginVer, sizeof(DWORD));
                 SetValue(actKey, CONFIG_LASTPLUGINVER_OP, REG_DWORD,
@@ -1822,6 +1846,32 @@ void CMainWindow::SaveConfig(HWND parent)
                 if (Windows7AndLater)
                     SetValue(actKey, CONFIG_ASYNCCOPYALG_REG, REG_DWORD,
                              &Configuration.UseAsyncCopyAlg, sizeof(DWORD));
+                SetValue(actKey, CONFIG_COPYSMALLFILESCONCUR_REG, REG_DWORD,
+                         &Configuration.CopySmallFilesConcurrently, sizeof(DWORD));
+                SetValue(actKey, CONFIG_VERIFYCOPIEDFILES_REG, REG_DWORD,
+                         &Configuration.VerifyCopiedFiles, sizeof(DWORD));
+                SetValue(actKey, CONFIG_COPYCHANGEDBLOCKS_REG, REG_DWORD,
+                         &Configuration.CopyChangedBlocksOnly, sizeof(DWORD));
+                SetValue(actKey, CONFIG_RESUMECOPIES_REG, REG_DWORD,
+                         &Configuration.ResumeInterruptedCopies, sizeof(DWORD));
+                SetValue(actKey, CONFIG_COPYDURINGANALYSIS_REG, REG_DWORD,
+                         &Configuration.CopyDuringTreeAnalysis, sizeof(DWORD));
+                SetValue(actKey, CONFIG_COPYSPARSEFILES_REG, REG_DWORD,
+                         &Configuration.CopySparseFiles, sizeof(DWORD));
+                SetValue(actKey, CONFIG_ZERORUNSSPARSE_REG, REG_DWORD,
+                         &Configuration.MakeZeroRunsSparse, sizeof(DWORD));
+                SetValue(actKey, CONFIG_QUEUEBYDEVICE_REG, REG_DWORD,
+                         &Configuration.QueueOperationsByDevice, sizeof(DWORD));
+                SetValue(actKey, CONFIG_CONCURRENTDELETE_REG, REG_DWORD,
+                         &Configuration.DeleteAndChangeAttrsConcurrently, sizeof(DWORD));
+                SetValue(actKey, CONFIG_COPYTELEMETRY_REG, REG_DWORD,
+                         &Configuration.RecordCopyTelemetry, sizeof(DWORD));
+                SetValue(actKey, CONFIG_READDIRSPROGRESSIVELY_REG, REG_DWORD,
+                         &Configuration.ReadDirsProgressively, sizeof(DWORD));
+                SetValue(actKey, CONFIG_CALCDIRSIZESCONCUR_REG, REG_DWORD,
+                         &Configuration.CalcDirSizesConcurrently, sizeof(DWORD));
+                SetValue(actKey, CONFIG_CACHEDIRSIZES_REG, REG_DWORD,
+                         &Configuration.CacheDirSizes, sizeof(DWORD));
                 SetValue(actKey, CONFIG_RELOAD_ENV_VARS_REG, REG_DWORD,
                          &Configuration.ReloadEnvVariables, sizeof(DWORD));
                 SetValue(actKey, CONFIG_QUICKRENAME_SELALL_REG, REG_DWORD,
@@ -3325,6 +3375,13 @@ BOOL CMainWindow::LoadConfig(BOOL importingOldConfig, const CCommandLineParams*
                      &Configuration.ChangeDriveShowNet, sizeof(DWORD));
             GetValue(actKey, CONFIG_SEARCHFILECONTENT, REG_DWORD,
                      &Configuration.SearchFileContent, sizeof(DWORD));
+            GetValue(actKey, CONFIG_FINDWORKERTHREADS, REG_DWORD,
+                     &Configuration.FindWorkerThreads, sizeof(DWORD));
+            GetValue(actKey, CONFIG_FINDDUPCOMPAREBYTES, REG_DWORD,
+                     &Configuration.FindDupCompareBytes, sizeof(DWORD));
+            GetValue(actKey, CONFIG_FINDINDEXROOTS, REG_SZ, Configuration.FindIndexRoots, FINDINDEX_ROOTS_SIZE);
+            GetValue(actKey, CONFIG_FINDSEARCHARCHIVES, REG_DWORD,
+                     &Configuration.FindSearchArchives, sizeof(DWORD));
             GetValue(actKey, CONFIG_LASTPLUGINVER, REG_DWORD,
                      &Configuration.LastPluginVer, sizeof(DWORD));
             GetValue(actKey, CONFIG_LASTPLUGINVER_OP, REG_DWORD,
@@ -3350,6 +3407,32 @@ BOOL CMainWindow::LoadConfig(BOOL importingOldConfig, const CCommandLineParams*
             if (Windows7AndLater)
                 GetValue(actKey, CONFIG_ASYNCCOPYALG_REG, REG_DWORD,
                          &Configuration.UseAsyncCopyAlg, sizeof(DWORD));
+            GetValue(actKey, CONFIG_COPYSMALLFILESCONCUR_REG, REG_DWORD,
+                     &Configuration.CopySmallFilesConcurrently, sizeof(DWORD));
+            GetValue(actKey, CONFIG_VERIFYCOPIEDFILES_REG, REG_DWORD,
+                     &Configuration.VerifyCopiedFiles, sizeof(DWORD));
+            GetValue(actKey, CONFIG_COPYCHANGEDBLOCKS_REG, REG_DWORD,
+                     &Configuration.CopyChangedBlocksOnly, sizeof(DWORD));
+            GetValue(actKey, CONFIG_RESUMECOPIES_REG, REG_DWORD,
+                     &Configuration.ResumeInterruptedCopies, sizeof(DWORD));
+            GetValue(actKey, CONFIG_COPYDURINGANALYSIS_REG, REG_DWORD,
+                     &Configuration.CopyDuringTreeAnalysis, sizeof(DWORD));
+            GetValue(actKey, CONFIG_COPYSPARSEFILES_REG, REG_DWORD,
+                     &Configuration.CopySparseFiles, sizeof(DWORD));
+            GetValue(actKey, CONFIG_ZERORUNSSPARSE_REG, REG_DWORD,
+                     &Configuration.MakeZeroRunsSparse, sizeof(DWORD));
+            GetValue(actKey, CONFIG_QUEUEBYDEVICE_REG, REG_DWORD,
+                     &Configuration.QueueOperationsByDevice, sizeof(DWORD));
+            GetValue(actKey, CONFIG_CONCURRENTDELETE_REG, REG_DWORD,
+                     &Configuration.DeleteAndChangeAttrsConcurrently, sizeof(DWORD));
+            GetValue(actKey, CONFIG_COPYTELEMETRY_REG, REG_DWORD,
+                     &Configuration.RecordCopyTelemetry, sizeof(DWORD));
+            GetValue(actKey, CONFIG_READDIRSPROGRESSIVELY_REG, REG_DWORD,
+                     &Configuration.ReadDirsProgressively, sizeof(DWORD));
+            GetValue(actKey, CONFIG_CALCDIRSIZESCONCUR_REG, REG_DWORD,
+                     &Configuration.CalcDirSizesConcurrently, sizeof(DWORD));
+            GetValue(actKey, CONFIG_CACHEDIRSIZES_REG, REG_DWORD,
+                     &Configuration.CacheDirSizes, sizeof(DWORD));
             GetValue(actKey, CONFIG_RELOAD_ENV_VARS_REG, REG_DWORD,
                      &Configuration.ReloadEnvVariables, sizeof(DWORD));
             GetValue(actKey, CONFIG_SHIFTFORHOTPATHS_REG, REG_DWORD,
@@ -76,15 +76,22 @@
 #include "iconlist.h"
 #include "consts.h"
 #include "icncache.h"
+#include "liststore.h"
+#include "listdelta.h"
+#include "listread.h"
 #include "salamand.h"
 #include "sort.h"
 #include "masks.h"
 #include "str.h"
 #include "callstk.h"
 #include "moore.h"
+#include "litsrch.h"
 #include "regexp.h"
 #include "filter.h"
 #include "regwork.h"
+#include "devsched.h"
+#include "treebatch.h"
+#include "copytelem.h"
 
 #include "texts.rh2"
 #include "lang\lang.rh"
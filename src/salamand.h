@@ -30,22 +30,67 @@ class CMenuPopup;
 class CFilesArray : public TDirectArray<CFileData>
 {
 protected:
-    BOOL DeleteData; // ma volat destruktory rusenych prvku?
+    BOOL DeleteData;   // ma volat destruktory rusenych prvku?
+    BOOL NamesInArena; // TRUE = Name a DosName polozek jsou v Names (uvolni se najednou), jinak kazde na heapu
+    CNameArena Names;  // jmena polozek listingu pri NamesInArena == TRUE
+    int FreedNames;    // pocet jmen uvolnenych pres FreeName(), ktera v Names zustavaji do Reset()
 
 public:
+    CListingColumns Columns; // razene sloupce listingu pro sort podle velikosti, casu a atributu (viz sort.cpp)
+
     // j.r. zvetsuji deltu na 800, protoze pri vstupu do vetsich adresaru (nekolik tisic souboru)
     // zacina Enlarge() podle profileru celkem zrat CPU
-    CFilesArray(int base = 200, int delta = 800) : TDirectArray<CFileData>(base, delta) { DeleteData = TRUE; }
+    CFilesArray(int base = 200, int delta = 800) : TDirectArray<CFileData>(base, delta)
+    {
+        DeleteData = TRUE;
+        NamesInArena = FALSE;
+        FreedNames = 0;
+    }
     ~CFilesArray() { Destroy(); }
 
     void SetDeleteData(BOOL deleteData) { DeleteData = deleteData; }
 
+    // zapina alokaci jmen polozek v CNameArena (jen pri DeleteData == TRUE); menit jen u prazdneho pole;
+    // jmena polozek pak musi alokovat AllocName() a nikdo je nesmi uvolnovat/realokovat
+    void SetNamesInArena(BOOL namesInArena) { NamesInArena = namesInArena; }
+    BOOL GetNamesInArena() { return NamesInArena; }
+
+    // vraci kopii 'name' delky 'len' pro Name nebo DosName polozky tohoto pole (v arene nebo
+    // na heapu); pri nedostatku pameti vraci NULL
+    char* AllocName(const char* name, int len)
+    {
+        if (NamesInArena)
+            return Names.AllocName(name, len);
+        char* s = (char*)malloc(len + 1);
+        if (s != NULL)
+        {
+            memcpy(s, name, len);
+            s[len] = 0;
+        }
+        return s;
+    }
+
+    // uvolni jmeno z AllocName(), ktere se nakonec do pole nepridalo nebo jehoz polozka se
+    // z pole odebrala bez destruktoru (inkrementalni refresh, viz RefreshDirectory)
+    void FreeName(char* name)
+    {
+        if (!NamesInArena)
+            free(name);
+        else
+            FreedNames++; // v arene zustava az do Reset()
+    }
+
+    // vraci pocet jmen, ktera v arene zbytecne zabiraji misto (viz FreeName())
+    int GetFreedNamesCount() { return FreedNames; }
+
     void DestroyMembers()
     {
         if (DeleteData)
             TDirectArray<CFileData>::DestroyMembers();
         else
             TDirectArray<CFileData>::DetachMembers();
+        Names.Reset(); // polozky uz nejsou, jejich jmena muzeme uvolnit najednou
+        FreedNames = 0;
     }
 
     void Destroy()
@@ -53,6 +98,9 @@ public:
         if (!DeleteData)
             DetachMembers();
         TDirectArray<CFileData>::Destroy();
+        Names.Release();
+        FreedNames = 0;
+        Columns.Release();
     }
 
     void Delete(int index)
@@ -69,9 +117,12 @@ public:
         if (!DeleteData)
             TRACE_E("Unexpected situation in CFilesArray::CallDestructor()");
 #endif // _DEBUG
-        free(member.Name);
-        if (member.DosName != NULL)
-            free(member.DosName);
+        if (!NamesInArena) // jmena v arene se uvolnuji najednou v DestroyMembers() a Destroy()
+        {
+            free(member.Name);
+            if (member.DosName != NULL)
+                free(member.DosName);
+        }
     }
 };
 
@@ -1162,3 +1213,7 @@ void RegenEnvironmentVariables();
 
 // pokus o detekce SSD, vice viz CSalamanderGeneralAbstract::IsPathOnSSD()
 BOOL IsPathOnSSD(const char* path);
+
+// zjisti, jestli svazek 'volume' (GUID cesta svazku bez zpetneho lomitka na konci) lezi na disku
+// s "seek penalty" (rotacni disk); vraci FALSE pokud to nelze zjistit
+BOOL QueryVolumeSeekPenalty(const char* volume, BOOL* seekPenalty);
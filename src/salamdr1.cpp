@@ -46,6 +46,8 @@ extern "C"
 #include "usermenu.h"
 #include "execute.h"
 #include "drivelst.h"
+#include "dirwalk.h"
+#include "dirsize.h"
 
 #pragma comment(linker, "/ENTRY:MyEntryPoint") // chceme vlastni vstupni bod do aplikace
 
@@ -4688,6 +4690,7 @@ MENU_TEMPLATE_ITEM MsgBoxButtons[] =
     ReleaseWinLib();
     ReleaseMenuWheelHook();
     ReleaseFind();
+    DirSizeCache.Release(); // stores the calculated sizes of directories
     ReleaseCheckThreads();
     ReleasePreloadedStrings();
     ReleaseShellib();
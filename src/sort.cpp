@@ -8,166 +8,21 @@
 //
 //*****************************************************************************
 
+// pravidla porovnani jmen podle konfigurace (viz ListingStrCmp v liststore.cpp), podle nich se
+// take stavi klice jmen v CListingColumns
+static void GetListingNameKeyRules(CListingNameKeyRules* rules)
+{
+    rules->LowerCase = Configuration.SortUsesLocale ? NULL : LowerCase; // CompareString neumime prevest na klice
+    rules->Numbers = Configuration.SortDetectNumbers;
+    rules->Dots = WindowsVistaAndLater && !SystemPolicies.GetNoDotBreakInLogicalCompare(); // viz StrCmpLogicalEx
+}
+
 // od XPcek je v systemu StrCmpLogicalW, kterou pro toto porovnani pouziva Explorer
 int StrCmpLogicalEx(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual, BOOL ignoreCase)
 {
-    const char* strEnd1 = s1 + l1; // konec retezce 's1'
-    const char* beg1 = s1;         // zacatek useku (textu nebo cisla)
-    const char* end1 = s1;         // konec useku (textu nebo cisla)
-    const char* strEnd2 = s2 + l2; // konec retezce 's2'
-    const char* beg2 = s2;         // zacatek useku (textu nebo cisla)
-    const char* end2 = s2;         // konec useku (textu nebo cisla)
-    int suggestion = 0;            // "doporuceni" vysledku (0 / -1 / 1 = nic / s1<s2 / s1>s2) - napr. "001" < "01"
-
-    BOOL findDots = WindowsVistaAndLater && !SystemPolicies.GetNoDotBreakInLogicalCompare(); // TRUE = jmena se deli taky po teckach (nejen po cislech)
-
-    while (1)
-    {
-        const char* numBeg1 = NULL; // pozice prvni nenulovy cislice
-        BOOL isStr1 = (end1 >= strEnd1 || *end1 < '0' || *end1 > '9');
-        if (isStr1) // text (i prazdny) nebo tecka
-        {
-            if (findDots && end1 < strEnd1 && *end1 == '.')
-                end1++; // tecka: pokud je hledame, bereme jednu po druhe
-            else        // text (i prazdny)
-            {
-                while (end1 < strEnd1 && (*end1 < '0' || *end1 > '9') && (!findDots || *end1 != '.'))
-                    end1++;
-            }
-        }
-        else // cislo
-        {
-            while (end1 < strEnd1 && *end1 >= '0' && *end1 <= '9')
-            {
-                if (numBeg1 == NULL && *end1 != '0')
-                    numBeg1 = end1;
-                end1++;
-            }
-        }
-        const char* numBeg2 = NULL; // pozice prvni nenulovy cislice
-        BOOL isStr2 = (end2 >= strEnd2 || *end2 < '0' || *end2 > '9');
-        if (isStr2) // text (i prazdny) nebo tecka
-        {
-            if (findDots && end2 < strEnd2 && *end2 == '.')
-                end2++; // tecka: pokud je hledame, bereme jednu po druhe
-            else        // text (i prazdny)
-            {
-                while (end2 < strEnd2 && (*end2 < '0' || *end2 > '9') && (!findDots || *end2 != '.'))
-                    end2++;
-            }
-        }
-        else // cislo
-        {
-            while (end2 < strEnd2 && *end2 >= '0' && *end2 <= '9')
-            {
-                if (numBeg2 == NULL && *end2 != '0')
-                    numBeg2 = end2;
-                end2++;
-            }
-        }
-
-        if (isStr1 || isStr2) // porovnani textu, tecek nebo kombinovane dvojice textu, tecky nebo cisla (vse krom dvou cisel se porovnava stringove)
-        {
-            int ret;
-            if (Configuration.SortUsesLocale)
-            {
-                ret = CompareString(LOCALE_USER_DEFAULT, ignoreCase ? NORM_IGNORECASE : 0,
-                                    beg1, (int)(end1 - beg1), beg2, (int)(end2 - beg2)) -
-                      CSTR_EQUAL;
-            }
-            else
-            {
-                if (ignoreCase)
-                    ret = StrICmpEx(beg1, (int)(end1 - beg1), beg2, (int)(end2 - beg2));
-                else
-                    ret = StrCmpEx(beg1, (int)(end1 - beg1), beg2, (int)(end2 - beg2));
-            }
-            if (ret != 0)
-            {
-                if (numericalyEqual != NULL)
-                    *numericalyEqual = FALSE;
-                return ret;
-            }
-        }
-        else // porovnani dvou cisel
-        {
-            if (numBeg1 == NULL)
-            {
-                if (numBeg2 == NULL) // obe cisla jsou nulova
-                {
-                    if (suggestion == 0) // zajima nas jen prvni "doporuceni" vysledku
-                    {
-                        if (end1 - beg1 > end2 - beg2)
-                            suggestion = -1; // "000" < "00"
-                        else if (end1 - beg1 < end2 - beg2)
-                            suggestion = 1; // "00" > "000"
-                    }
-                }
-                else // prvni cislo je nulove, druhe cislo neni nulove
-                {
-                    if (numericalyEqual != NULL)
-                        *numericalyEqual = FALSE;
-                    return -1; // "00" < "1"
-                }
-            }
-            else
-            {
-                if (numBeg2 == NULL) // prvni cislo neni nulove, druhe cislo je nulove
-                {
-                    if (numericalyEqual != NULL)
-                        *numericalyEqual = FALSE;
-                    return 1; // "1" > "00"
-                }
-                else // obe cisla jsou nenulova
-                {
-                    if (end1 - numBeg1 > end2 - numBeg2) // prvni cislo ma vic cislic nez druhe
-                    {
-                        if (numericalyEqual != NULL)
-                            *numericalyEqual = FALSE;
-                        return 1; // "100" > "99"
-                    }
-                    else
-                    {
-                        if (end1 - numBeg1 < end2 - numBeg2) // druhe cislo ma vic cislic nez prvni
-                        {
-                            if (numericalyEqual != NULL)
-                                *numericalyEqual = FALSE;
-                            return -1; // "99" < "100"
-                        }
-                        else // cisla maji stejny pocet cislic, porovname je podle hodnoty (ekvivalentni retezcovemu porovnani)
-                        {
-                            int ret = StrCmpEx(numBeg1, (int)(end1 - numBeg1), numBeg2, (int)(end2 - numBeg2));
-                            if (ret != 0) // hodnoty nejsou shodne
-                            {
-                                if (numericalyEqual != NULL)
-                                    *numericalyEqual = FALSE;
-                                return ret;
-                            }
-                            else // hodnoty cisel jsou stejne, pokud se lisi poctem nul v prefixu, prevezmeme to do "doporuceni" vysledku
-                            {
-                                if (suggestion == 0) // zajima nas jen prvni "doporuceni" vysledku
-                                {
-                                    if (end1 - beg1 > end2 - beg2)
-                                        suggestion = -1; // "0001" < "001"
-                                    else if (end1 - beg1 < end2 - beg2)
-                                        suggestion = 1; // "001" > "0001"
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        if (end1 >= strEnd1 && end2 >= strEnd2)
-            break; // konec porovnavani
-        beg1 = end1;
-        beg2 = end2;
-    }
-
-    if (numericalyEqual != NULL)
-        *numericalyEqual = TRUE; // s1 a s2 jsou shodna nebo numericky shodna
-    return suggestion;           // pri shode nebo numericke shode vracime "doporuceny" vysledek
+    CListingNameKeyRules rules;
+    GetListingNameKeyRules(&rules);
+    return ListingStrCmpLogical(s1, l1, s2, l2, numericalyEqual, ignoreCase, &rules);
 }
 
 //
@@ -194,25 +49,9 @@ int RegSetStrICmp(const char* s1, const char* s2)
 
 int RegSetStrICmpEx(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual)
 {
-    if (Configuration.SortDetectNumbers)
-    {
-        return StrCmpLogicalEx(s1, l1, s2, l2, numericalyEqual, TRUE);
-    }
-    else
-    {
-        int ret;
-        if (Configuration.SortUsesLocale)
-        {
-            ret = CompareString(LOCALE_USER_DEFAULT, NORM_IGNORECASE, s1, l1, s2, l2) - CSTR_EQUAL;
-        }
-        else
-        {
-            ret = StrICmpEx(s1, l1, s2, l2);
-        }
-        if (numericalyEqual != NULL)
-            *numericalyEqual = ret == 0;
-        return ret;
-    }
+    CListingNameKeyRules rules;
+    GetListingNameKeyRules(&rules);
+    return ListingStrCmp(s1, l1, s2, l2, numericalyEqual, TRUE, &rules);
 }
 
 int RegSetStrCmp(const char* s1, const char* s2)
@@ -236,25 +75,155 @@ int RegSetStrCmp(const char* s1, const char* s2)
 
 int RegSetStrCmpEx(const char* s1, int l1, const char* s2, int l2, BOOL* numericalyEqual)
 {
-    if (Configuration.SortDetectNumbers)
+    CListingNameKeyRules rules;
+    GetListingNameKeyRules(&rules);
+    return ListingStrCmp(s1, l1, s2, l2, numericalyEqual, FALSE, &rules);
+}
+
+//
+//*****************************************************************************
+// razeni pres sloupce listingu (CFilesArray::Columns)
+//
+
+// porovnani polozek pro CListingColumns: stejne jako CmpNameExt a LessExtName
+static int CmpNamesOfItems(const char* name1, int len1, int extOffset1, const char* name2, int len2, int extOffset2)
+{
+    return CmpNames(name1, len1, name2, len2);
+}
+
+static int CmpExtNamesOfItems(const char* name1, int len1, int extOffset1, const char* name2, int len2, int extOffset2)
+{
+    return CmpExtName(name1, len1, name1 + extOffset1, name2, len2, name2 + extOffset2);
+}
+
+// pocet casti listingu razenych paralelne (CListingColumns::PrepareSort je pripadne snizi)
+static int GetListingSortThreadCount()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = (int)si.dwNumberOfProcessors;
+    if (count > LISTING_MAX_SORT_RUNS)
+        count = LISTING_MAX_SORT_RUNS;
+    return count < 1 ? 1 : count;
+}
+
+struct CListingSortThreadData
+{
+    CListingColumns* Columns;
+    int Run;
+};
+
+unsigned ListingSortThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("ListingSortThreadBody()");
+    SetThreadNameInVCAndTrace("ListingSort");
+    CListingSortThreadData* data = (CListingSortThreadData*)param;
+    data->Columns->SortRun(data->Run);
+    return 0;
+}
+
+unsigned ListingSortThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
     {
-        return StrCmpLogicalEx(s1, l1, s2, l2, numericalyEqual, FALSE);
+#endif // CALLSTK_DISABLE
+        return ListingSortThreadBody(param);
+#ifndef CALLSTK_DISABLE
     }
-    else
+    __except (CCallStack::HandleException(GetExceptionInformation()))
     {
-        int ret;
-        if (Configuration.SortUsesLocale)
+        TRACE_I("Thread ListingSort: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // tvrdsi exit (tenhle jeste neco vola)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI ListingSortThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return ListingSortThreadEH(param);
+}
+
+// seradi polozky 'left' az 'right' podle klice 'key' (pak podle jmena) - klice se nejdrive vyberou
+// do souvislych sloupcu, radi se jen male zaznamy (klic, klic jmena, index) a polozky se pak jednou
+// presunou na sve misto; klice jmen (prvni znaky jmena predpripravene pro porovnani) rozhodnou
+// vetsinu porovnani bez RegSetStrICmpEx; velky listing se radi po castech v pomocnych threadech
+// a casti se pak slouci; 'cmp' porovnava polozky se shodnymi klici;
+// vraci FALSE pri nedostatku pameti (pak je nutne radit primo polozky)
+static BOOL SortByColumns(CFilesArray& files, int left, int right, CListingSortKey key,
+                          BOOL keyReverse, BOOL nameReverse, CListingItemCompare cmp)
+{
+    int count = right - left + 1;
+    if (count < 2)
+        return TRUE;
+    CListingColumns* cols = &files.Columns;
+    if (!cols->SetCount(count))
+        return FALSE;
+    CFileData* items = &files[left];
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        CFileData* f = &items[i];
+        cols->Set(i, f->Name, f->NameLen, f->Size.Value, f->LastWrite.dwLowDateTime,
+                  f->LastWrite.dwHighDateTime, f->Attr, (int)(f->Ext - f->Name));
+    }
+    CListingNameKeyRules rules;
+    GetListingNameKeyRules(&rules);
+    int runs = cols->PrepareSort(key, keyReverse, nameReverse, cmp, &rules, GetListingSortThreadCount());
+    CListingSortThreadData data[LISTING_MAX_SORT_RUNS];
+    HANDLE threads[LISTING_MAX_SORT_RUNS];
+    int threadsCount = 0;
+    for (i = 1; i < runs; i++) // cast 0 radi tento thread
+    {
+        data[i].Columns = cols;
+        data[i].Run = i;
+        DWORD threadID;
+        HANDLE thread = HANDLES(CreateThread(NULL, 0, ListingSortThread, &data[i], 0, &threadID));
+        if (thread != NULL)
         {
-            ret = CompareString(LOCALE_USER_DEFAULT, 0, s1, l1, s2, l2) - CSTR_EQUAL;
+            SetThreadPriority(thread, GetThreadPriority(GetCurrentThread()));
+            threads[threadsCount++] = thread;
         }
         else
         {
-            ret = StrCmpEx(s1, l1, s2, l2);
+            TRACE_E("SortByColumns(): unable to start helper thread."); // cast seradime sami
+            cols->SortRun(i);
         }
-        if (numericalyEqual != NULL)
-            *numericalyEqual = ret == 0;
-        return ret;
     }
+    cols->SortRun(0);
+    for (i = 0; i < threadsCount; i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        HANDLES(CloseHandle(threads[i]));
+    }
+    cols->FinishSort();
+
+    // presun polozek do serazeneho poradi: polozka 'Order[i]' patri na index 'i', prochazime
+    // cykly permutace (kazda polozka se presune jednou, neni potreba dalsi pamet)
+    int* order = cols->Order;
+    for (i = 0; i < count; i++)
+    {
+        if (order[i] != i)
+        {
+            CFileData tmp = items[i];
+            int j = i;
+            while (order[j] != i)
+            {
+                int next = order[j];
+                items[j] = items[next];
+                order[j] = j;
+                j = next;
+            }
+            items[j] = tmp;
+            order[j] = j;
+        }
+    }
+    return TRUE;
 }
 
 //
@@ -315,11 +284,14 @@ int CmpNameExt(const CFileData& f1, const CFileData& f2)
   else return res2;
 */
     //--- porovnavame cele Name (vcetne Ext), jako Explorer
-    int res = RegSetStrICmpEx(f1.Name, f1.NameLen, f2.Name, f2.NameLen, NULL);
-    if (res != 0 || f1.Name == f2.Name)
-        return res; // pokud jsou shodne adresy, musi se rovnat
-                    //--- shodna jmena (archivy nebo FS) - zkusime jestli se nelisi aspon ve velikosti pismen
-    return RegSetStrCmpEx(f1.Name, f1.NameLen, f2.Name, f2.NameLen, NULL);
+    return CmpNames(f1.Name, f1.NameLen, f2.Name, f2.NameLen);
+}
+
+int CmpNames(const char* name1, int len1, const char* name2, int len2)
+{
+    CListingNameKeyRules rules;
+    GetListingNameKeyRules(&rules);
+    return ListingCmpNames(name1, len1, name2, len2, &rules);
 }
 
 BOOL LessNameExt(const CFileData& f1, const CFileData& f2, BOOL reverse)
@@ -398,7 +370,8 @@ LABEL_SortNameExtAux:
 
 void SortNameExt(CFilesArray& files, int left, int right, BOOL reverse)
 {
-    SortNameExtAux(files, left, right, reverse);
+    if (!SortByColumns(files, left, right, lskName, reverse, reverse, CmpNamesOfItems))
+        SortNameExtAux(files, left, right, reverse);
 }
 
 //
@@ -406,40 +379,17 @@ void SortNameExt(CFilesArray& files, int left, int right, BOOL reverse)
 // QuickSort   1.klic Ext, 2.klic Name
 //
 
+int CmpExtName(const char* name1, int len1, const char* ext1, const char* name2, int len2, const char* ext2)
+{
+    CListingNameKeyRules rules;
+    GetListingNameKeyRules(&rules);
+    return ListingCmpExtName(name1, len1, ext1, name2, len2, ext2, &rules);
+}
+
 BOOL LessExtName(const CFileData& f1, const CFileData& f2, BOOL reverse)
 {
-    //--- nejprve podle Ext
-    BOOL numericalyEqual1;
-    int res1 = RegSetStrICmpEx(f1.Ext, f1.NameLen - (int)(f1.Ext - f1.Name),
-                               f2.Ext, f2.NameLen - (int)(f2.Ext - f2.Name),
-                               &numericalyEqual1);
-    if (!numericalyEqual1)
-        return reverse ? res1 > 0 : res1 < 0; // pripony se lisi (nejsou shodne ani numericky shodne)
-                                              //--- podle Ext se rovnaji, rozhodne Name
-    BOOL numericalyEqual2;
-    int res2 = RegSetStrICmpEx(f1.Name, (*f1.Ext != 0) ? (int)(f1.Ext - 1 - f1.Name) : f1.NameLen,
-                               f2.Name, (*f2.Ext != 0) ? (int)(f2.Ext - 1 - f2.Name) : f2.NameLen,
-                               &numericalyEqual2);
-    if (numericalyEqual2 && res1 != 0)
-        return reverse ? res1 > 0 : res1 < 0; // pripony jsou shodne nebo numericky shodne a jmena jsou jen numericky shodna (porovnani jmen je prioritnejsi)
-    else
-    {
-        if (res2 == 0 && f1.Name != f2.Name) // shodna jmena (archivy nebo FS) - zkusime jestli se nelisi aspon ve velikosti pismen
-        {
-            res1 = RegSetStrCmpEx(f1.Ext, f1.NameLen - (int)(f1.Ext - f1.Name),
-                                  f2.Ext, f2.NameLen - (int)(f2.Ext - f2.Name),
-                                  &numericalyEqual1);
-            if (!numericalyEqual1)
-                return reverse ? res1 > 0 : res1 < 0; // pripony se lisi (nejsou shodne ani numericky shodne)
-            //--- podle Ext se opet rovnaji, rozhodne Name
-            res2 = RegSetStrCmpEx(f1.Name, (*f1.Ext != 0) ? (int)(f1.Ext - 1 - f1.Name) : f1.NameLen,
-                                  f2.Name, (*f2.Ext != 0) ? (int)(f2.Ext - 1 - f2.Name) : f2.NameLen,
-                                  &numericalyEqual2);
-            if (numericalyEqual2 && res1 != 0)
-                return reverse ? res1 > 0 : res1 < 0; // jmena jsou shodna nebo numericky shodna a pripony jsou jen numericky shodne (porovnani pripon je prioritnejsi)
-        }
-        return reverse ? res2 > 0 : res2 < 0;
-    }
+    int res = CmpExtName(f1.Name, f1.NameLen, f1.Ext, f2.Name, f2.NameLen, f2.Ext);
+    return reverse ? res > 0 : res < 0;
 }
 
 void SortExtNameAux(CFilesArray& files, int left, int right, BOOL reverse)
@@ -506,7 +456,8 @@ LABEL_SortExtNameAux:
 
 void SortExtName(CFilesArray& files, int left, int right, BOOL reverse)
 {
-    SortExtNameAux(files, left, right, reverse);
+    if (!SortByColumns(files, left, right, lskExt, reverse, reverse, CmpExtNamesOfItems))
+        SortExtNameAux(files, left, right, reverse);
 }
 
 //
@@ -589,7 +540,8 @@ LABEL_SortTimeNameExtAux:
 
 void SortTimeNameExt(CFilesArray& files, int left, int right, BOOL reverse)
 {
-    SortTimeNameExtAux(files, left, right, reverse);
+    if (!SortByColumns(files, left, right, lskTime, reverse ^ Configuration.SortNewerOnTop, reverse, CmpNamesOfItems))
+        SortTimeNameExtAux(files, left, right, reverse);
 }
 
 //
@@ -671,7 +623,8 @@ LABEL_SortSizeNameExtAux:
 
 void SortSizeNameExt(CFilesArray& files, int left, int right, BOOL reverse)
 {
-    SortSizeNameExtAux(files, left, right, reverse);
+    if (!SortByColumns(files, left, right, lskSize, reverse, reverse, CmpNamesOfItems))
+        SortSizeNameExtAux(files, left, right, reverse);
 }
 
 //
@@ -691,37 +644,8 @@ BOOL LessAttrNameExt(const CFileData& f1, const CFileData& f2, BOOL reverse)
     // je treba rozsirit masku DISPLAYED_ATTRIBUTES
 
     // prejdeme na abecedni razeni, jako ma explorer a speed commander
-    DWORD f1Attr = 0;
-    DWORD f2Attr = 0;
-    if (f1.Attr & FILE_ATTRIBUTE_ARCHIVE)
-        f1Attr |= 0x00000001;
-    if (f1.Attr & FILE_ATTRIBUTE_COMPRESSED)
-        f1Attr |= 0x00000002;
-    if (f1.Attr & FILE_ATTRIBUTE_ENCRYPTED)
-        f1Attr |= 0x00000004;
-    if (f1.Attr & FILE_ATTRIBUTE_HIDDEN)
-        f1Attr |= 0x00000008;
-    if (f1.Attr & FILE_ATTRIBUTE_READONLY)
-        f1Attr |= 0x00000010;
-    if (f1.Attr & FILE_ATTRIBUTE_SYSTEM)
-        f1Attr |= 0x00000020;
-    if (f1.Attr & FILE_ATTRIBUTE_TEMPORARY)
-        f1Attr |= 0x00000040;
-
-    if (f2.Attr & FILE_ATTRIBUTE_ARCHIVE)
-        f2Attr |= 0x00000001;
-    if (f2.Attr & FILE_ATTRIBUTE_COMPRESSED)
-        f2Attr |= 0x00000002;
-    if (f2.Attr & FILE_ATTRIBUTE_ENCRYPTED)
-        f2Attr |= 0x00000004;
-    if (f2.Attr & FILE_ATTRIBUTE_HIDDEN)
-        f2Attr |= 0x00000008;
-    if (f2.Attr & FILE_ATTRIBUTE_READONLY)
-        f2Attr |= 0x00000010;
-    if (f2.Attr & FILE_ATTRIBUTE_SYSTEM)
-        f2Attr |= 0x00000020;
-    if (f2.Attr & FILE_ATTRIBUTE_TEMPORARY)
-        f2Attr |= 0x00000040;
+    DWORD f1Attr = CListingColumns::ListingAttrSortKey(f1.Attr);
+    DWORD f2Attr = CListingColumns::ListingAttrSortKey(f2.Attr);
 
     //--- nejprve podle Attr
     if (f1Attr != f2Attr)
@@ -795,7 +719,8 @@ LABEL_SortAttrNameExtAux:
 
 void SortAttrNameExt(CFilesArray& files, int left, int right, BOOL reverse)
 {
-    SortAttrNameExtAux(files, left, right, reverse);
+    if (!SortByColumns(files, left, right, lskAttr, reverse, reverse, CmpNamesOfItems))
+        SortAttrNameExtAux(files, left, right, reverse);
 }
 
 //
@@ -26,9 +26,17 @@ void SortAttrNameExt(CFilesArray& files, int left, int right, BOOL reverse);
 
 typedef BOOL (*CLessFunction)(const CFileData&, const CFileData&, BOOL);
 
+// vraci porovnani odpovidajici razeni SortFilesAndDirectories pro 'sortType' (adresare pro
+// 'isDirs' TRUE); v 'reverseSort' vraci smer razeni (adresare razene dle jmena se neobraci)
+CLessFunction GetListingLessFunction(CSortType sortType, BOOL isDirs, BOOL* reverseSort);
+
 // porovnani pro dva soubory, 1. klic jmeno, 2. klic pripona, vraci -1, 0, 1 ala strcmp
 int CmpNameExt(const CFileData& f1, const CFileData& f2);
 int CmpNameExtIgnCase(const CFileData& f1, const CFileData& f2); // ignore-case varianta
+// totez pro jmena 'name1' a 'name2' delek 'len1' a 'len2' (CFileData::Name a NameLen)
+int CmpNames(const char* name1, int len1, const char* name2, int len2);
+// porovnani pro dva soubory, 1. klic pripona, 2. klic jmeno; 'ext1' a 'ext2' jsou CFileData::Ext
+int CmpExtName(const char* name1, int len1, const char* ext1, const char* name2, int len2, const char* ext2);
 
 // POZOR: sort-kody v RefreshDirectory, ChangeSortType a CompareDirectories si musi odpovidat!!!
 
@@ -5,6 +5,7 @@
 
 #include "cfgdlg.h"
 #include "worker.h"
+#include "copyeng.h"
 
 #include <Aclapi.h>
 #include <Ntsecapi.h>
@@ -461,13 +462,224 @@ void CProgressSpeedMeter::BytesReceived(DWORD count, DWORD time, DWORD maxPacket
     }
 }
 
+//
+// ****************************************************************************
+// CScriptNames
+//
+
+CScriptNames::CScriptNames()
+{
+    ChunksCount = 0;
+    ChunkUsed = SCRIPTNAMES_CHUNK_SIZE; // prvni retezec alokuje blok
+    DirsCount = 0;
+    DirHash = NULL;
+    DirHashSize = 0;
+    LastDirLen = -1;
+    LastDirIndex = SCRIPTNAME_NODIR;
+}
+
+CScriptNames::~CScriptNames()
+{
+    int i;
+    for (i = 0; i < ChunksCount; i++)
+        free(Chunks[i]);
+    int dirChunks = (int)((DirsCount + SCRIPTDIRS_CHUNK_SIZE - 1) / SCRIPTDIRS_CHUNK_SIZE);
+    for (i = 0; i < dirChunks; i++)
+        free(DirChunks[i]);
+    if (DirHash != NULL)
+        free(DirHash);
+}
+
+DWORD GetScriptDirHash(DWORD parent, const char* name, int len)
+{
+    DWORD hash = 2166136261 ^ parent; // FNV-1a
+    const char* end = name + len;
+    for (; name < end; name++)
+        hash = (hash ^ (BYTE)*name) * 16777619;
+    return hash;
+}
+
+BOOL CScriptNames::AddStr(const char* str, int len, DWORD* offset)
+{
+    if (ChunkUsed + len + 1 > SCRIPTNAMES_CHUNK_SIZE)
+    {
+        if (ChunksCount >= SCRIPTNAMES_MAX_CHUNKS)
+        {
+            TRACE_E("CScriptNames::AddStr(): too many names in script!");
+            return FALSE;
+        }
+        char* chunk = (char*)malloc(SCRIPTNAMES_CHUNK_SIZE);
+        if (chunk == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            return FALSE;
+        }
+        Chunks[ChunksCount++] = chunk;
+        ChunkUsed = 0;
+    }
+    char* s = Chunks[ChunksCount - 1] + ChunkUsed;
+    memcpy(s, str, len);
+    s[len] = 0;
+    *offset = (DWORD)(ChunksCount - 1) * SCRIPTNAMES_CHUNK_SIZE + ChunkUsed;
+    ChunkUsed += len + 1;
+    return TRUE;
+}
+
+BOOL CScriptNames::GrowDirHash()
+{
+    DWORD size = DirHashSize == 0 ? 1024 : 2 * DirHashSize;
+    DWORD* hash = (DWORD*)malloc(size * sizeof(DWORD));
+    if (hash == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return FALSE;
+    }
+    memset(hash, 0xFF, size * sizeof(DWORD)); // SCRIPTNAME_NODIR = prazdne misto
+    DWORD i;
+    for (i = 0; i < DirsCount; i++)
+    {
+        CScriptDir* dir = GetDir(i);
+        const char* name = GetStr(dir->Name);
+        DWORD h = GetScriptDirHash(dir->Parent, name, (int)strlen(name)) & (size - 1);
+        while (hash[h] != SCRIPTNAME_NODIR)
+            h = (h + 1) & (size - 1);
+        hash[h] = i;
+    }
+    if (DirHash != NULL)
+        free(DirHash);
+    DirHash = hash;
+    DirHashSize = size;
+    return TRUE;
+}
+
+BOOL CScriptNames::AddDir(const char* dir, int len, DWORD* index)
+{
+    if (len == LastDirLen && memcmp(dir, LastDir, len) == 0) // dalsi jmeno ze stejneho adresare
+    {
+        *index = LastDirIndex;
+        return TRUE;
+    }
+
+    // adresar = rodic + slozka za poslednim backslashem
+    const char* comp = dir + len;
+    while (comp > dir && *(comp - 1) != '\\')
+        comp--;
+    int compLen = (int)(dir + len - comp);
+    DWORD parent = SCRIPTNAME_NODIR;
+    if (comp > dir && !AddDir(dir, (int)(comp - 1 - dir), &parent))
+        return FALSE;
+
+    if (2 * (DirsCount + 1) > DirHashSize && !GrowDirHash())
+        return FALSE;
+    DWORD h = GetScriptDirHash(parent, comp, compLen) & (DirHashSize - 1);
+    while (DirHash[h] != SCRIPTNAME_NODIR)
+    {
+        CScriptDir* d = GetDir(DirHash[h]);
+        if (d->Parent == parent)
+        {
+            const char* name = GetStr(d->Name);
+            if (strncmp(name, comp, compLen) == 0 && name[compLen] == 0)
+                break; // adresar uz mame
+        }
+        h = (h + 1) & (DirHashSize - 1);
+    }
+    if (DirHash[h] == SCRIPTNAME_NODIR) // novy adresar
+    {
+        if (DirsCount % SCRIPTDIRS_CHUNK_SIZE == 0)
+        {
+            if (DirsCount / SCRIPTDIRS_CHUNK_SIZE >= SCRIPTDIRS_MAX_CHUNKS)
+            {
+                TRACE_E("CScriptNames::AddDir(): too many directories in script!");
+                return FALSE;
+            }
+            CScriptDir* chunk = (CScriptDir*)malloc(SCRIPTDIRS_CHUNK_SIZE * sizeof(CScriptDir));
+            if (chunk == NULL)
+            {
+                TRACE_E(LOW_MEMORY);
+                return FALSE;
+            }
+            DirChunks[DirsCount / SCRIPTDIRS_CHUNK_SIZE] = chunk;
+        }
+        DWORD name;
+        if (!AddStr(comp, compLen, &name))
+            return FALSE;
+        CScriptDir* d = GetDir(DirsCount);
+        d->Parent = parent;
+        d->Name = name;
+        DirHash[h] = DirsCount++;
+    }
+    *index = DirHash[h];
+    if (len < MAX_PATH)
+    {
+        memcpy(LastDir, dir, len);
+        LastDirLen = len;
+        LastDirIndex = *index;
+    }
+    return TRUE;
+}
+
+BOOL CScriptNames::Add(const char* name, BOOL isValue, CScriptName* res)
+{
+    if (isValue || name == NULL)
+    {
+        res->Dir = SCRIPTNAME_VALUE;
+        res->Leaf = (DWORD)(DWORD_PTR)name;
+        return TRUE;
+    }
+    int len = (int)strlen(name);
+    const char* leaf = name + len;
+    while (leaf > name && *(leaf - 1) != '\\')
+        leaf--;
+    res->Dir = SCRIPTNAME_NODIR;
+    if (leaf > name && !AddDir(name, (int)(leaf - 1 - name), &res->Dir))
+        return FALSE;
+    return AddStr(leaf, (int)(name + len - leaf), &res->Leaf);
+}
+
+char* CScriptNames::Get(const CScriptName& name, char* buf) const
+{
+    if (name.Dir == SCRIPTNAME_VALUE)
+        return (char*)(DWORD_PTR)name.Leaf;
+
+    DWORD dirs[MAX_PATH]; // kazda slozka zabere aspon jeden znak (backslash)
+    int count = 0;
+    DWORD dir = name.Dir;
+    while (dir != SCRIPTNAME_NODIR && count < MAX_PATH)
+    {
+        dirs[count++] = dir;
+        dir = GetDir(dir)->Parent;
+    }
+    int len = 0;
+    int i;
+    for (i = count; i >= 0; i--)
+    {
+        const char* s = i > 0 ? GetStr(GetDir(dirs[i - 1])->Name) : GetStr(name.Leaf);
+        while (*s != 0 && len < MAX_PATH - 1)
+            buf[len++] = *s++;
+        if (i > 0 && len < MAX_PATH - 1)
+            buf[len++] = '\\';
+    }
+    if (len == MAX_PATH - 1)
+        TRACE_E("CScriptNames::Get(): name is too long!");
+    buf[len] = 0;
+    return buf;
+}
+
+DWORD_PTR CScriptNames::GetAllocatedSize() const
+{
+    DWORD_PTR dirChunks = (DirsCount + SCRIPTDIRS_CHUNK_SIZE - 1) / SCRIPTDIRS_CHUNK_SIZE;
+    return (DWORD_PTR)ChunksCount * SCRIPTNAMES_CHUNK_SIZE +
+           dirChunks * SCRIPTDIRS_CHUNK_SIZE * sizeof(CScriptDir) + (DWORD_PTR)DirHashSize * sizeof(DWORD);
+}
+
 //
 // ****************************************************************************
 // COperations
 //
 
 COperations::COperations(int base, int delta, char* waitInQueueSubject, char* waitInQueueFrom,
-                         char* waitInQueueTo) : TDirectArray<COperation>(base, delta), Sizes(1, 400)
+                         char* waitInQueueTo) : TGrowingDirectArray<CScriptOp>(base, delta), Sizes(1, 400),
+                                                StreamPending(1, 1000), StreamOps(1, 5000)
 {
     TotalSize = CQuadWord(0, 0);
     CompressedSize = CQuadWord(0, 0);
@@ -505,9 +717,12 @@ COperations::COperations(int base, int delta, char* waitInQueueSubject, char* wa
     WorkPath1InclSubDirs = FALSE;
     WorkPath2[0] = 0;
     WorkPath2InclSubDirs = FALSE;
+    DeviceSrcPath[0] = 0;
+    DeviceTgtPath[0] = 0;
     WaitInQueueSubject = waitInQueueSubject; // uvolnuje se ve FreeScript()
     WaitInQueueFrom = waitInQueueFrom;       // uvolnuje se ve FreeScript()
     WaitInQueueTo = waitInQueueTo;           // uvolnuje se ve FreeScript()
+    Telemetry = NULL;
     HANDLES(InitializeCriticalSection(&StatusCS));
     TransferredFileSize = CQuadWord(0, 0);
     ProgressSize = CQuadWord(0, 0);
@@ -522,6 +737,71 @@ COperations::COperations(int base, int delta, char* waitInQueueSubject, char* wa
     LastProgBufLimTestTime = GetTickCount() - 1000;
     LastFileBlockCount = 0;
     LastFileStartTime = GetTickCount();
+    HANDLES(InitializeCriticalSection(&StreamCS));
+    StreamEvent = NULL;
+    StreamEndEvent = NULL;
+    StreamCaption = NULL;
+    StreamStartTime = 0;
+    StreamStarted = FALSE;
+    StreamPublished = 0;
+    StreamEnded = FALSE;
+    StreamFailed = FALSE;
+    StreamWorkerDone = FALSE;
+}
+
+COperations::~COperations()
+{
+    // jmena operaci (i ze StreamPending a StreamOps) uvolni destruktor Names
+    if (StreamEvent != NULL)
+        HANDLES(CloseHandle(StreamEvent));
+    if (StreamEndEvent != NULL)
+        HANDLES(CloseHandle(StreamEndEvent));
+    HANDLES(DeleteCriticalSection(&StreamCS));
+    HANDLES(DeleteCriticalSection(&StatusCS));
+    if (Telemetry != NULL)
+        delete Telemetry;
+}
+
+int COperations::Add(COperation& op)
+{
+    CScriptOp rec;
+    rec.Size = op.Size;
+    rec.FileSize = op.FileSize;
+    rec.Attr = op.Attr;
+    rec.Opcode = (BYTE)op.Opcode;
+    rec.OpFlags = (BYTE)op.OpFlags;
+    // hodnoty ulozene misto jmen, viz COperationCode
+    BOOL srcIsValue = op.Opcode == ocCopyDirTime || op.Opcode == ocLabelForSkipOfCreateDir;
+    BOOL tgtIsValue = op.Opcode == ocChangeAttrs || op.Opcode == ocLabelForSkipOfCreateDir;
+    if (!Names.Add(op.SourceName, srcIsValue, &rec.Source) ||
+        !Names.Add(op.TargetName, tgtIsValue, &rec.Target))
+    {
+        Error(etLowMemory);
+        return -1;
+    }
+    int index = TGrowingDirectArray<CScriptOp>::Add(rec);
+    if (IsGood()) // jmena uz jsou ve skriptu, malloc-ove kopie nepotrebujeme
+    {
+        if (!srcIsValue && op.SourceName != NULL)
+            free(op.SourceName);
+        if (!tgtIsValue && op.TargetName != NULL)
+            free(op.TargetName);
+        op.SourceName = NULL;
+        op.TargetName = NULL;
+    }
+    return index;
+}
+
+void COperations::GetOperation(const CScriptOp* rec, CScriptOpView* view) const
+{
+    COperation* op = &view->Op;
+    op->Opcode = (COperationCode)rec->Opcode;
+    op->Size = rec->Size;
+    op->FileSize = rec->FileSize;
+    op->SourceName = Names.Get(rec->Source, view->SourceBuf);
+    op->TargetName = Names.Get(rec->Target, view->TargetBuf);
+    op->Attr = rec->Attr;
+    op->OpFlags = rec->OpFlags;
 }
 
 void COperations::SetTFS(const CQuadWord& TFS)
@@ -676,7 +956,9 @@ void COperations::AddBytesToSpeedMetersAndTFSandPS(DWORD bytesCount, BOOL onlyTo
                     if (sleepNow > 0)                          // brzdime kvuli speed-limitu
                     {
                         HANDLES(LeaveCriticalSection(&StatusCS));
+                        unsigned __int64 sleepStart = GetTelemetryTime();
                         Sleep(sleepNow);
+                        AddTelemetry(ctpStall, sleepStart, 0, NO_ERROR, ctsSpeedLimit);
                         HANDLES(EnterCriticalSection(&StatusCS));
                         ti = GetTickCount();
                     }
@@ -779,6 +1061,18 @@ void COperations::GetStatus(CQuadWord* transferredFileSize, CQuadWord* transferS
     HANDLES(LeaveCriticalSection(&StatusCS));
 }
 
+BOOL COperations::GetTransferSpeed(CQuadWord* transferSpeed)
+{
+    if (ShowStatus)
+    {
+        HANDLES(EnterCriticalSection(&StatusCS));
+        TransferSpeedMeter.GetSpeed(transferSpeed);
+        HANDLES(LeaveCriticalSection(&StatusCS));
+        return TRUE;
+    }
+    return FALSE;
+}
+
 void COperations::InitSpeedMeters(BOOL operInProgress)
 {
     if (ShowStatus)
@@ -831,6 +1125,203 @@ void COperations::GetSpeedLimit(BOOL* useSpeedLimit, DWORD* speedLimit)
     HANDLES(LeaveCriticalSection(&StatusCS));
 }
 
+void COperations::StartTelemetry()
+{
+    if (Telemetry == NULL)
+    {
+        Telemetry = new CCopyTelemetry;
+        if (!Telemetry->Init())
+        {
+            delete Telemetry; // bez mereni se obejdeme
+            Telemetry = NULL;
+        }
+    }
+}
+
+void COperations::DumpTelemetry()
+{
+    if (Telemetry == NULL)
+        return;
+    char name[MAX_PATH + 50];
+    if (!GetTempPath(MAX_PATH, name))
+    {
+        DWORD err = GetLastError();
+        TRACE_E("COperations::DumpTelemetry(): unable to get TEMP directory: " << GetErrorText(err));
+        return;
+    }
+    SYSTEMTIME st;
+    GetLocalTime(&st);
+    char* s = name + strlen(name);
+    if (s > name && *(s - 1) != '\\')
+        *s++ = '\\';
+    sprintf(s, "SalCopyTelemetry-%04u%02u%02u-%02u%02u%02u-%u.csv", st.wYear, st.wMonth, st.wDay,
+            st.wHour, st.wMinute, st.wSecond, GetCurrentThreadId());
+    if (Telemetry->Dump(name))
+        TRACE_I("Copy telemetry saved to " << name);
+    else
+    {
+        DWORD err = GetLastError();
+        TRACE_E("COperations::DumpTelemetry(): unable to save copy telemetry to " << name << ": " << GetErrorText(err));
+    }
+}
+
+void COperations::EnableStreaming(const char* caption)
+{
+    if (StreamEvent == NULL)
+        StreamEvent = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL)); // "nonsignaled" state, auto
+    if (StreamEndEvent == NULL)
+        StreamEndEvent = HANDLES(CreateEvent(NULL, TRUE, FALSE, NULL)); // "nonsignaled" state, manual
+    if (StreamEvent == NULL || StreamEndEvent == NULL)
+    {
+        TRACE_E("COperations::EnableStreaming(): unable to create events, script will be built completely before the operation starts.");
+        return;
+    }
+    StreamCaption = caption;
+    StreamStartTime = GetTickCount();
+}
+
+BOOL COperations::IsStreamDue()
+{
+    return StreamCaption != NULL && !StreamStarted && Count > 1 &&
+           GetTickCount() - StreamStartTime >= SCRIPT_STREAM_DELAY;
+}
+
+BOOL COperations::PublishStreamedOps()
+{
+    // vytvoreni adresaru na konci skriptu muze stavba jeste smazat (prazdny adresar, viz SkipEmptyDirs;
+    // po smazani vnoreneho prazdneho adresare muze byt prazdny i nadrazeny), predame je az za nimi
+    // pribude jina operace (ta uz adresar neprazdnym udela), nejpozdeji v EndStreaming()
+    int count = Count;
+    while (count > StreamPublished && At(count - 1).Opcode == ocCreateDir)
+        count--;
+    BOOL ret = TRUE;
+    HANDLES(EnterCriticalSection(&StreamCS));
+    StreamStarted = TRUE;
+    if (count > StreamPublished)
+    {
+        StreamPending.Add(&At(StreamPublished), count - StreamPublished);
+        if (!StreamPending.IsGood())
+        {
+            StreamPending.ResetState(); // operace predame pri dalsim volani (nebo v EndStreaming())
+            ret = !StreamWorkerDone;
+        }
+        else
+        {
+            CQuadWord size(0, 0);
+            for (; StreamPublished < count; StreamPublished++)
+                size += At(StreamPublished).Size;
+            TotalSize += size; // worker ho cte bez kriticke sekce, celkovy progress se behem stavby zpresnuje
+            SetEvent(StreamEvent);
+        }
+    }
+    if (StreamWorkerDone)
+        ret = FALSE;
+    HANDLES(LeaveCriticalSection(&StreamCS));
+    return ret;
+}
+
+void COperations::CancelStreaming()
+{
+    // worker nebezi, zahodime predane operace a stavba skriptu dobehne postaru
+    StreamPending.DetachMembers(); // jmena jsou sdilena se skriptem
+    StreamStarted = FALSE;
+    StreamPublished = 0;
+    StreamCaption = NULL;
+    TotalSize = CQuadWord(0, 0); // spocita se na konci stavby
+}
+
+void COperations::EndStreaming(BOOL success)
+{
+    HANDLES(EnterCriticalSection(&StreamCS));
+    if (success && Count > StreamPublished)
+    {
+        StreamPending.Add(&At(StreamPublished), Count - StreamPublished);
+        if (!StreamPending.IsGood())
+        {
+            StreamPending.ResetState();
+            success = FALSE; // bez zbytku operaci nelze operaci dokoncit, worker se zachova jako pri cancelu
+        }
+        else
+        {
+            CQuadWord size(0, 0);
+            for (; StreamPublished < Count; StreamPublished++)
+                size += At(StreamPublished).Size;
+            TotalSize += size;
+        }
+    }
+    StreamEnded = TRUE;
+    StreamFailed = !success;
+    HANDLE endEvent = StreamEndEvent;
+    SetEvent(StreamEvent);
+    HANDLES(LeaveCriticalSection(&StreamCS));
+    SetEvent(endEvent); // od ted muze worker skript uvolnit, uz na nej nesahame
+}
+
+BOOL COperations::WaitForStreamedOps(int index, BOOL* cancelWorker, BOOL* buildFailed)
+{
+    while (1)
+    {
+        HANDLES(EnterCriticalSection(&StreamCS));
+        if (StreamPending.Count > 0)
+        {
+            StreamOps.Add(&StreamPending.At(0), StreamPending.Count);
+            if (!StreamOps.IsGood())
+            {
+                TRACE_E(LOW_MEMORY);
+                StreamOps.ResetState();
+                StreamFailed = TRUE; // bez operaci nelze pokracovat
+                StreamEnded = TRUE;
+            }
+            StreamPending.DetachMembers(); // jmena jsou sdilena se skriptem
+        }
+        BOOL ended = StreamEnded;
+        *buildFailed = StreamFailed;
+        HANDLES(LeaveCriticalSection(&StreamCS));
+
+        if (index < StreamOps.Count)
+            return TRUE;
+        if (ended || *cancelWorker)
+            return FALSE;
+        WaitForSingleObject(StreamEvent, 200); // pravidelne kontrolujeme i cancel workeru
+    }
+}
+
+void COperations::WaitForStreamEnd()
+{
+    HANDLES(EnterCriticalSection(&StreamCS));
+    StreamWorkerDone = TRUE; // hl. thread stavbu skriptu prerusi
+    HANDLES(LeaveCriticalSection(&StreamCS));
+    WaitForSingleObject(StreamEndEvent, INFINITE);
+}
+
+//
+// ****************************************************************************
+// CCopy_Tuner
+//
+// regulator velikosti bloku a poctu bloku asynchronniho kopirovani pro jednu dvojici
+// zdroj/cil (rooty cest), rychlost bere z meraku rychlosti prenosu operace
+
+class CCopy_Tuner : public CCopyTuner
+{
+public:
+    COperations* Script;
+    char SrcRoot[MAX_PATH]; // root zdrojove cesty
+    char TgtRoot[MAX_PATH]; // root cilove cesty
+    DWORD LastUse;          // GetTickCount() posledniho pouziti (pro vyber regulatoru k nahrazeni)
+
+    CCopy_Tuner(COperations* script, const char* srcRoot, const char* tgtRoot)
+        : CCopyTuner(ASYNC_COPY_MIN_BUF_SIZE, ASYNC_COPY_BUF_SIZE, 2, ASYNC_COPY_MAX_BLOCKS,
+                     ASYNC_COPY_BUF_SIZE, ASYNC_COPY_BLOCKS)
+    {
+        Script = script;
+        lstrcpyn(SrcRoot, srcRoot, MAX_PATH);
+        lstrcpyn(TgtRoot, tgtRoot, MAX_PATH);
+        LastUse = GetTickCount();
+    }
+
+    virtual BOOL GetMeasuredSpeed(CQuadWord* speed) { return Script->GetTransferSpeed(speed); }
+};
+
 //
 // ****************************************************************************
 // CAsyncCopyParams
@@ -838,8 +1329,14 @@ void COperations::GetSpeedLimit(BOOL* useSpeedLimit, DWORD* speedLimit)
 
 struct CAsyncCopyParams
 {
-    void* Buffers[8];         // alokovane buffery o velikosti ASYNC_COPY_BUF_SIZE bytu
-    OVERLAPPED Overlapped[8]; // struktury pro asynchronni operace
+    void* Buffers[ASYNC_COPY_MAX_BLOCKS];         // alokovane buffery o velikosti ASYNC_COPY_BUF_SIZE bytu
+    OVERLAPPED Overlapped[ASYNC_COPY_MAX_BLOCKS]; // struktury pro asynchronni operace
+    int AllocatedBlocks;                          // pocet bloku s alokovanym bufferem a eventem (na zacatku ASYNC_COPY_BLOCKS)
+
+    CCopy_Tuner* Tuners[ASYNC_COPY_TUNERS]; // regulatory pro dvojice zdroj/cil (NULL = nepouzity)
+
+    char NoOffloadSrcRoot[MAX_PATH]; // posledni dvojice zdroj/cil, pro kterou neni k dispozici kopirovani bez bufferu (viz DoCopyFileOffload())
+    char NoOffloadTgtRoot[MAX_PATH];
 
     BOOL UseAsyncAlg; // TRUE = ma se pouzit asynchronni algoritmus (musi se alokovat data), FALSE = synchroni stary algouritmus (nic nealokujeme)
 
@@ -850,6 +1347,17 @@ struct CAsyncCopyParams
 
     void Init(BOOL useAsyncAlg);
 
+    // alokuje buffery a eventy az pro 'count' bloku; vraci pocet pouzitelnych bloku
+    int AllocBlocks(int count);
+
+    // vraci regulator pro kopirovani z 'srcName' do 'tgtName' (dalsi soubor mezi stejnymi
+    // disky/sharey navazuje na naucene hodnoty predchoziho)
+    CCopy_Tuner* GetTuner(COperations* script, const char* srcName, const char* tgtName);
+
+    // vraci TRUE, pokud uz vime, ze mezi disky/sharey 'srcName' a 'tgtName' nelze kopirovat bez bufferu
+    BOOL IsOffloadUnavailable(const char* srcName, const char* tgtName);
+    void SetOffloadUnavailable(const char* srcName, const char* tgtName);
+
     BOOL Failed() { return HasFailed; }
 
     DWORD GetOverlappedFlag() { return UseAsyncAlg ? FILE_FLAG_OVERLAPPED : 0; }
@@ -857,13 +1365,16 @@ struct CAsyncCopyParams
     OVERLAPPED* InitOverlapped(int i);                                    // vynuluje a vrati Overlapped[i]
     OVERLAPPED* InitOverlappedWithOffset(int i, const CQuadWord& offset); // vynuluje, nastavi 'offset' a vrati Overlapped[i]
     OVERLAPPED* GetOverlapped(int i) { return &Overlapped[i]; }
-    void SetOverlappedToEOF(int i, const CQuadWord& offset); // nastavi Overlapped[i] do stavu po dokonceni asynchronniho cteni, ktere detekovalo EOF
 };
 
 CAsyncCopyParams::CAsyncCopyParams()
 {
     memset(Buffers, 0, sizeof(Buffers));
     memset(Overlapped, 0, sizeof(Overlapped));
+    AllocatedBlocks = 0;
+    memset(Tuners, 0, sizeof(Tuners));
+    NoOffloadSrcRoot[0] = 0;
+    NoOffloadTgtRoot[0] = 0;
     UseAsyncAlg = FALSE;
     HasFailed = FALSE;
 }
@@ -873,7 +1384,7 @@ void CAsyncCopyParams::Init(BOOL useAsyncAlg)
     UseAsyncAlg = useAsyncAlg;
     if (UseAsyncAlg && Buffers[0] == NULL)
     {
-        for (int i = 0; i < 8; i++)
+        for (int i = 0; i < ASYNC_COPY_BLOCKS; i++)
         {
             Buffers[i] = malloc(ASYNC_COPY_BUF_SIZE);
             Overlapped[i].hEvent = HANDLES(CreateEvent(NULL, TRUE, FALSE, NULL));
@@ -884,18 +1395,93 @@ void CAsyncCopyParams::Init(BOOL useAsyncAlg)
                 HasFailed = TRUE;
             }
         }
+        AllocatedBlocks = ASYNC_COPY_BLOCKS;
+    }
+}
+
+int CAsyncCopyParams::AllocBlocks(int count)
+{
+    if (count > ASYNC_COPY_MAX_BLOCKS)
+        count = ASYNC_COPY_MAX_BLOCKS;
+    while (AllocatedBlocks < count)
+    {
+        int i = AllocatedBlocks;
+        Buffers[i] = malloc(ASYNC_COPY_BUF_SIZE);
+        if (Buffers[i] == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            break; // staci mene bloku
+        }
+        Overlapped[i].hEvent = HANDLES(CreateEvent(NULL, TRUE, FALSE, NULL));
+        if (Overlapped[i].hEvent == NULL)
+        {
+            DWORD err = GetLastError();
+            TRACE_E("Unable to create synchronization object for Copy rutine: " << GetErrorText(err));
+            free(Buffers[i]);
+            Buffers[i] = NULL;
+            break; // staci mene bloku
+        }
+        AllocatedBlocks++;
+    }
+    return count < AllocatedBlocks ? count : AllocatedBlocks;
+}
+
+CCopy_Tuner*
+CAsyncCopyParams::GetTuner(COperations* script, const char* srcName, const char* tgtName)
+{
+    char srcRoot[MAX_PATH];
+    char tgtRoot[MAX_PATH];
+    GetRootPath(srcRoot, srcName);
+    GetRootPath(tgtRoot, tgtName);
+    int oldest = 0;
+    for (int i = 0; i < ASYNC_COPY_TUNERS; i++)
+    {
+        if (Tuners[i] != NULL && StrICmp(Tuners[i]->SrcRoot, srcRoot) == 0 &&
+            StrICmp(Tuners[i]->TgtRoot, tgtRoot) == 0)
+        {
+            Tuners[i]->LastUse = GetTickCount();
+            return Tuners[i];
+        }
+        if (Tuners[oldest] != NULL && (Tuners[i] == NULL || (int)(Tuners[i]->LastUse - Tuners[oldest]->LastUse) < 0))
+            oldest = i; // volne misto nebo regulator, ktery se nejdele nepouzil
     }
+    if (Tuners[oldest] != NULL)
+        delete Tuners[oldest];
+    Tuners[oldest] = new CCopy_Tuner(script, srcRoot, tgtRoot);
+    return Tuners[oldest];
+}
+
+BOOL CAsyncCopyParams::IsOffloadUnavailable(const char* srcName, const char* tgtName)
+{
+    if (NoOffloadSrcRoot[0] == 0)
+        return FALSE;
+    char srcRoot[MAX_PATH];
+    char tgtRoot[MAX_PATH];
+    GetRootPath(srcRoot, srcName);
+    GetRootPath(tgtRoot, tgtName);
+    return StrICmp(NoOffloadSrcRoot, srcRoot) == 0 && StrICmp(NoOffloadTgtRoot, tgtRoot) == 0;
+}
+
+void CAsyncCopyParams::SetOffloadUnavailable(const char* srcName, const char* tgtName)
+{
+    GetRootPath(NoOffloadSrcRoot, srcName);
+    GetRootPath(NoOffloadTgtRoot, tgtName);
 }
 
 CAsyncCopyParams::~CAsyncCopyParams()
 {
-    for (int i = 0; i < 8; i++)
+    for (int i = 0; i < ASYNC_COPY_MAX_BLOCKS; i++)
     {
         if (Buffers[i] != NULL)
             free(Buffers[i]);
         if (Overlapped[i].hEvent != NULL)
             HANDLES(CloseHandle(Overlapped[i].hEvent));
     }
+    for (int i = 0; i < ASYNC_COPY_TUNERS; i++)
+    {
+        if (Tuners[i] != NULL)
+            delete Tuners[i];
+    }
 }
 
 OVERLAPPED*
@@ -924,18 +1510,6 @@ CAsyncCopyParams::InitOverlappedWithOffset(int i, const CQuadWord& offset)
     return &Overlapped[i];
 }
 
-void CAsyncCopyParams::SetOverlappedToEOF(int i, const CQuadWord& offset)
-{
-    if (!UseAsyncAlg)
-        TRACE_C("CAsyncCopyParams::SetOverlappedToEOF(): unexpected call, UseAsyncAlg is FALSE!");
-    Overlapped[i].Internal = 0xC0000011 /* STATUS_END_OF_FILE */; // NTSTATUS code equivalent to system error code ERROR_HANDLE_EOF
-    Overlapped[i].InternalHigh = 0;
-    Overlapped[i].Offset = offset.LoDWord;
-    Overlapped[i].OffsetHigh = offset.HiDWord;
-    // Overlapped[i].Pointer = 0;  // je to union, Pointer se kryje s Offset a OffsetHigh
-    SetEvent(Overlapped[i].hEvent);
-}
-
 // **********************************************************************************
 
 BOOL HaveWriteOwnerRight = FALSE; // ma proces pravo WRITE_OWNER?
@@ -2327,40 +2901,547 @@ BOOL CheckTailOfOutFile(CAsyncCopyParams* asyncPar, HANDLE in, HANDLE out, const
     return ok;
 }
 
-// nakopiruje ADS do nove vznikleho souboru/adresare
-// FALSE vraci jen pri Cancel; uspech + Skip vraci TRUE; Skip nastavuje 'skip'
-// (neni-li NULL) na TRUE
-BOOL DoCopyADS(HWND hProgressDlg, const char* sourceName, BOOL isDir, const char* targetName,
-               CQuadWord const& totalDone, CQuadWord& operDone, CQuadWord const& operTotal,
-               CProgressDlgData& dlgData, COperations* script, BOOL* skip, void* buffer)
+#define VERIFYCOPY_BUF_SIZE (1024 * 1024)     // max. velikost bufferu pro cteni souboru pri overeni kopie (nasobek velikosti sektoru kvuli FILE_FLAG_NO_BUFFERING)
+#define VERIFYCOPY_MIN_BUF_SIZE (64 * 1024) // min. velikost bufferu pro cteni souboru pri overeni kopie (nasobek velikosti sektoru kvuli FILE_FLAG_NO_BUFFERING)
+
+// CRC32 dat zapisovanych do ciloveho souboru, pocita se prubezne behem kopirovani (zdroj se kvuli
+// overeni kopie nemusi cist znovu), po dokonceni kopie se porovna s CRC32 zpetne nacteneho
+// ciloveho souboru, viz VerifyCopiedFile()
+struct CCopyVerifyCrc
 {
-    BOOL doCopyADSRet = TRUE;
-    BOOL lowMemory;
-    DWORD adsWinError;
-    wchar_t** streamNames;
-    int streamNamesCount;
-    BOOL skipped = FALSE;
-    CQuadWord lastTransferredFileSize, finalTransferredFileSize;
-    script->GetTFSandResetTrSpeedIfNeeded(&lastTransferredFileSize);
-    finalTransferredFileSize = lastTransferredFileSize;
-    if (operTotal > operDone) // melo by byt vzdycky aspon ==, ale sychrujeme se...
-        finalTransferredFileSize += (operTotal - operDone);
+    BOOL Enabled;     // TRUE = overujeme kopii (Configuration.VerifyCopiedFiles)
+    BOOL Valid;       // FALSE = data neprisla souvisle (nemelo by nastat), CRC32 zdroje se musi spocitat ctenim zdrojoveho souboru
+    CQuadWord Offset; // 'Crc' obsahuje data od zacatku souboru az do tohoto offsetu
+    DWORD Crc;
 
-COPY_ADS_AGAIN:
+    void Init(BOOL enabled)
+    {
+        Enabled = enabled;
+        Valid = TRUE;
+        Offset.SetUI64(0);
+        Crc = 0;
+    }
 
-    if (CheckFileOrDirADS(sourceName, isDir, NULL, &streamNames, &streamNamesCount,
-                          &lowMemory, &adsWinError, 0, NULL, NULL) &&
-        !lowMemory && streamNames != NULL)
-    {                                  // mame seznam ADS, zkusime je nakopirovat do ciloveho souboru/adresare
-        wchar_t srcName[2 * MAX_PATH]; // MAX_PATH pro jmeno souboru i pro jmeno ADS (netusim kolik jsou realne maximalni delky)
-        wchar_t tgtName[2 * MAX_PATH];
-        char longSourceName[MAX_PATH + 100];
-        char longTargetName[MAX_PATH + 100];
-        DoLongName(longSourceName, sourceName, MAX_PATH + 100);
-        DoLongName(longTargetName, targetName, MAX_PATH + 100);
-        if (!MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, longSourceName, -1, srcName, 2 * MAX_PATH))
-            srcName[0] = 0;
-        if (!MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, longTargetName, -1, tgtName, 2 * MAX_PATH))
+    // prida data zapisovana na offset 'offset' ciloveho souboru; opakovany zapis uz zapocitanych
+    // dat (Retry po chybe zapisu) se preskoci
+    void AddData(const void* data, DWORD size, const CQuadWord& offset)
+    {
+        if (!Enabled || !Valid)
+            return;
+        if (offset > Offset)
+        {
+            TRACE_E("CCopyVerifyCrc::AddData(): unexpected gap in written data, source file will be read again during verification.");
+            Valid = FALSE;
+            return;
+        }
+        CQuadWord end = offset + CQuadWord(size, 0);
+        if (end > Offset)
+        {
+            DWORD skip = (DWORD)(Offset - offset).Value;
+            Crc = UpdateCrc32((const char*)data + skip, size - skip, Crc);
+            Offset = end;
+        }
+    }
+};
+
+// spocita CRC32 a velikost souboru 'name'; je-li 'noBuffering' TRUE, cte se pokud mozno mimo
+// systemovou cache (overujeme, co je skutecne zapsane na disku); 'buffer' (o velikosti 'bufSize')
+// musi byt zarovnany na velikost sektoru; vraci NO_ERROR nebo kod chyby (ERROR_CANCELLED = cancel)
+DWORD GetFileCrc32(const char* name, BOOL noBuffering, void* buffer, DWORD bufSize, CProgressDlgData& dlgData,
+                   CQuadWord* size, DWORD* crc)
+{
+    HANDLE file = INVALID_HANDLE_VALUE;
+    if (noBuffering)
+    {
+        file = HANDLES_Q(CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                    FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    }
+    if (file == INVALID_HANDLE_VALUE) // nektere FS cteni mimo cache nepodporuji, zkusime cteni pres cache
+    {
+        file = HANDLES_Q(CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                    FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+        if (file == INVALID_HANDLE_VALUE)
+            return GetLastError();
+    }
+
+    DWORD err = NO_ERROR;
+    size->SetUI64(0);
+    *crc = 0;
+    while (1)
+    {
+        WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        if (*dlgData.CancelWorker)
+        {
+            err = ERROR_CANCELLED;
+            break;
+        }
+        DWORD read;
+        if (!ReadFile(file, buffer, bufSize, &read, NULL))
+        {
+            err = GetLastError();
+            break;
+        }
+        if (read == 0)
+            break; // EOF
+        *crc = UpdateCrc32(buffer, read, *crc);
+        *size += CQuadWord(read, 0);
+    }
+    HANDLES(CloseHandle(file));
+    return err;
+}
+
+// overeni kopie: porovna CRC32 dat zapsanych do ciloveho souboru (viz 'verifyCrc') s CRC32
+// zpetne nacteneho (uz zavreneho) ciloveho souboru; vraci NO_ERROR pri shode, ERROR_CRC pri
+// rozdilu, jinak kod chyby cteni (ERROR_CANCELLED = cancel)
+DWORD VerifyCopiedFile(COperation* op, CCopyVerifyCrc* verifyCrc, CProgressDlgData& dlgData)
+{
+    CALL_STACK_MESSAGE2("VerifyCopiedFile(%s)", op->TargetName);
+
+    DWORD bufSize = VERIFYCOPY_BUF_SIZE;
+    if (verifyCrc->Offset < CQuadWord(VERIFYCOPY_BUF_SIZE, 0)) // pro male soubory staci mensi buffer
+        bufSize = (verifyCrc->Offset.LoDWord + VERIFYCOPY_MIN_BUF_SIZE) & ~(VERIFYCOPY_MIN_BUF_SIZE - 1);
+    void* buffer = VirtualAlloc(NULL, bufSize, MEM_COMMIT, PAGE_READWRITE); // zarovnani na stranku staci pro FILE_FLAG_NO_BUFFERING
+    if (buffer == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    CQuadWord srcSize = verifyCrc->Offset;
+    DWORD srcCrc = verifyCrc->Crc;
+    DWORD err = NO_ERROR;
+    if (!verifyCrc->Valid) // zapsana data nemame spocitana, musime precist zdroj
+        err = GetFileCrc32(op->SourceName, FALSE, buffer, bufSize, dlgData, &srcSize, &srcCrc);
+    if (err == NO_ERROR)
+    {
+        CQuadWord tgtSize;
+        DWORD tgtCrc;
+        err = GetFileCrc32(op->TargetName, TRUE, buffer, bufSize, dlgData, &tgtSize, &tgtCrc);
+        if (err == NO_ERROR && (tgtSize != srcSize || tgtCrc != srcCrc))
+        {
+            TRACE_I("VerifyCopiedFile(): target file " << op->TargetName << " differs from source file.");
+            err = ERROR_CRC;
+        }
+    }
+    VirtualFree(buffer, 0, MEM_RELEASE);
+    return err;
+}
+
+#define DELTACOPY_MIN_FILE_SIZE (16 * 1024 * 1024) // mensi existujici cilove soubory se vzdy prepisuji cele (porovnavani bloku ani navazani kopie se nevyplati)
+#define DELTACOPY_BUF_SIZE (1024 * 1024)           // velikost bloku cteneho ze zdroje i z cile pri aktualizaci zmenenych bloku
+#define DELTACOPY_CMP_BLOCK (64 * 1024)            // granularita porovnani: do cile se zapisuji jen rozdilne useky teto velikosti; POZOR: DELTACOPY_BUF_SIZE musi byt jejim nasobkem
+
+// I/O na zadanem offsetu souboru pro DoCopyFileLoopDelta(): je-li 'asyncPar' v asynchronnim rezimu
+// (soubory jsou otevrene s FILE_FLAG_OVERLAPPED), operace se jen nastartuje nad asyncPar->Overlapped[ovIndex]
+// a dokonci ji DeltaFinishIO(), jinak probehne synchronne hned; vraci NO_ERROR nebo kod chyby
+DWORD DeltaStartIO(CAsyncCopyParams* asyncPar, int ovIndex, HANDLE file, BOOL write, void* buf, DWORD size,
+                   const CQuadWord& offset, DWORD* done)
+{
+    if (asyncPar->GetOverlappedFlag() != 0)
+    {
+        OVERLAPPED* ov = asyncPar->InitOverlappedWithOffset(ovIndex, offset);
+        BOOL res = write ? WriteFile(file, buf, size, NULL, ov) : ReadFile(file, buf, size, NULL, ov);
+        if (!res && GetLastError() != ERROR_IO_PENDING)
+        {
+            DWORD err = GetLastError();
+            if (!write && err == ERROR_HANDLE_EOF) // synchronne hlaseny EOF prevedeme na asynchronne hlaseny (viz CCopyIoOverlapped::StartRead)
+            {
+                ov->Internal = 0xC0000011 /* STATUS_END_OF_FILE */;
+                ov->InternalHigh = 0;
+                SetEvent(ov->hEvent);
+                return NO_ERROR;
+            }
+            return err;
+        }
+        return NO_ERROR;
+    }
+    if (!SalSetFilePointer(file, offset))
+        return GetLastError();
+    BOOL res = write ? WriteFile(file, buf, size, done, NULL) : ReadFile(file, buf, size, done, NULL);
+    return res ? NO_ERROR : GetLastError();
+}
+
+DWORD DeltaFinishIO(CAsyncCopyParams* asyncPar, int ovIndex, HANDLE file, DWORD* done)
+{
+    if (asyncPar->GetOverlappedFlag() != 0 &&
+        !GetOverlappedResult(file, asyncPar->GetOverlapped(ovIndex), done, TRUE))
+    {
+        DWORD err = GetLastError();
+        if (err != ERROR_HANDLE_EOF)
+            return err;
+        *done = 0; // cteni za koncem souboru
+    }
+    return NO_ERROR;
+}
+
+// chyba pri aktualizaci zmenenych bloku: zobrazi ji a vraci TRUE pro Retry; pri Skip nastavi 'skipCopy',
+// pri Cancel 'copyError' a vraci FALSE
+BOOL DeltaHandleError(BOOL write, const char* fileName, DWORD err, HWND hProgressDlg, CProgressDlgData& dlgData,
+                      BOOL& copyError, BOOL& skipCopy)
+{
+    WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+    if (*dlgData.CancelWorker)
+    {
+        copyError = TRUE; // goto COPY_ERROR
+        return FALSE;
+    }
+    if (write ? dlgData.SkipAllFileWrite : dlgData.SkipAllFileRead)
+    {
+        skipCopy = TRUE; // goto SKIP_COPY
+        return FALSE;
+    }
+
+    int ret = IDCANCEL;
+    char* data[4];
+    data[0] = (char*)&ret;
+    data[1] = LoadStr(write ? IDS_ERRORWRITINGFILE : IDS_ERRORREADINGFILE);
+    data[2] = (char*)fileName;
+    data[3] = GetErrorText(err);
+    SendMessage(hProgressDlg, WM_USER_DIALOG, 0, (LPARAM)data);
+    switch (ret)
+    {
+    case IDRETRY:
+        return TRUE;
+
+    case IDB_SKIPALL:
+    {
+        if (write)
+            dlgData.SkipAllFileWrite = TRUE;
+        else
+            dlgData.SkipAllFileRead = TRUE;
+    }
+    case IDB_SKIP:
+    {
+        skipCopy = TRUE; // goto SKIP_COPY
+        return FALSE;
+    }
+
+    default: // IDCANCEL
+    {
+        copyError = TRUE; // goto COPY_ERROR
+        return FALSE;
+    }
+    }
+}
+
+// aktualizace existujiciho ciloveho souboru (velikosti 'tgtFileSize', 'out' je otevreny pro cteni
+// i zapis): zdroj a cil se ctou soucasne po blocich, bloky se porovnaji a do cile se zapisi jen
+// rozdilne useky (velikosti DELTACOPY_CMP_BLOCK); data pred 'resumeOffset' se nectou ani neporovnavaji
+// (navazani prerusene kopie, shodu konce ciloveho souboru uz overil volajici), data za koncem
+// puvodniho cile se jen zapisuji; na konci zkrati cil na velikost zdroje
+void DoCopyFileLoopDelta(CAsyncCopyParams* asyncPar, HANDLE& in, HANDLE& out, int& limitBufferSize,
+                         COperations* script, CProgressDlgData& dlgData, COperation* op,
+                         const CQuadWord& totalDone, BOOL& copyError, BOOL& skipCopy, HWND hProgressDlg,
+                         CQuadWord& operationDone, int bufferSize, const CQuadWord& tgtFileSize,
+                         const CQuadWord& resumeOffset, const CQuadWord& lastTransferredFileSize,
+                         CCopyVerifyCrc* verifyCrc)
+{
+    CALL_STACK_MESSAGE2("DoCopyFileLoopDelta(%s)", op->TargetName);
+
+    char* bufIn = (char*)malloc(DELTACOPY_BUF_SIZE);
+    char* bufOut = (char*)malloc(DELTACOPY_BUF_SIZE);
+    if (bufIn == NULL || bufOut == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        if (bufIn != NULL)
+            free(bufIn);
+        if (bufOut != NULL)
+            free(bufOut);
+        DeltaHandleError(FALSE, op->SourceName, ERROR_NOT_ENOUGH_MEMORY, hProgressDlg, dlgData, copyError, skipCopy);
+        if (!copyError && !skipCopy) // Retry nema smysl, bereme jako Cancel
+            copyError = TRUE;
+        return;
+    }
+
+    if (resumeOffset.Value > 0) // navazujeme prerusenou kopii: zacatek souboru uz je zkopirovany
+    {
+        operationDone = resumeOffset;
+        verifyCrc->Valid = FALSE; // zacatek zdroje necteme, pripadne overeni kopie ho musi precist
+        script->SetTFSandProgressSize(lastTransferredFileSize + resumeOffset, totalDone + resumeOffset,
+                                      &limitBufferSize, bufferSize);
+        SetProgress(hProgressDlg, CaclProg(operationDone, op->Size),
+                    CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
+    }
+
+    CQuadWord written(0, 0); // kolik bajtu jsme skutecne zapsali (jen pro TRACE)
+    while (1)
+    {
+        DWORD size = limitBufferSize < DELTACOPY_BUF_SIZE ? limitBufferSize : DELTACOPY_BUF_SIZE;
+        BOOL compare = operationDone < tgtFileSize; // za koncem puvodniho ciloveho souboru neni s cim porovnavat
+
+        // nacteme blok zdroje a (je-li s cim porovnavat) i cile, v asynchronnim rezimu soucasne
+        DWORD read = 0;
+        DWORD readOut = 0;
+        DWORD err = DeltaStartIO(asyncPar, 0, in, FALSE, bufIn, size, operationDone, &read);
+        if (err == NO_ERROR)
+            err = DeltaFinishIO(asyncPar, 0, in, &read);
+        if (err != NO_ERROR)
+        {
+            if (DeltaHandleError(FALSE, op->SourceName, err, hProgressDlg, dlgData, copyError, skipCopy))
+                continue; // retry
+            break;
+        }
+        if (read == 0)
+            break; // EOF
+        if (compare)
+        {
+            err = DeltaStartIO(asyncPar, 1, out, FALSE, bufOut, read, operationDone, &readOut);
+            if (err == NO_ERROR)
+                err = DeltaFinishIO(asyncPar, 1, out, &readOut);
+            if (err != NO_ERROR)
+            {
+                if (DeltaHandleError(FALSE, op->TargetName, err, hProgressDlg, dlgData, copyError, skipCopy))
+                    continue; // retry
+                break;
+            }
+        }
+
+        // zapiseme rozdilne useky (sousedni rozdilne useky zapiseme najednou)
+        DWORD pos = 0;
+        while (pos < read)
+        {
+            DWORD start = pos;
+            DWORD end;
+            if (compare)
+            {
+                while (start < read)
+                {
+                    DWORD len = read - start < DELTACOPY_CMP_BLOCK ? read - start : DELTACOPY_CMP_BLOCK;
+                    if (start + len > readOut || memcmp(bufIn + start, bufOut + start, len) != 0)
+                        break;
+                    start += len;
+                }
+                end = start;
+                while (end < read)
+                {
+                    DWORD len = read - end < DELTACOPY_CMP_BLOCK ? read - end : DELTACOPY_CMP_BLOCK;
+                    if (end + len <= readOut && memcmp(bufIn + end, bufOut + end, len) == 0)
+                        break;
+                    end += len;
+                }
+            }
+            else
+                end = read;
+            if (start < end)
+            {
+                DWORD done = 0;
+                err = DeltaStartIO(asyncPar, 2, out, TRUE, bufIn + start, end - start, operationDone + CQuadWord(start, 0), &done);
+                if (err == NO_ERROR)
+                    err = DeltaFinishIO(asyncPar, 2, out, &done);
+                if (err == NO_ERROR && done != end - start)
+                    err = ERROR_DISK_FULL;
+                if (err != NO_ERROR)
+                {
+                    if (DeltaHandleError(TRUE, op->TargetName, err, hProgressDlg, dlgData, copyError, skipCopy))
+                        continue; // retry (zapis tehoz useku)
+                    break;
+                }
+                written += CQuadWord(end - start, 0);
+            }
+            pos = end;
+        }
+        if (pos < read) // chyba zapisu: cancel nebo skip
+            break;
+
+        if (!script->ChangeSpeedLimit)                                 // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        if (*dlgData.CancelWorker)
+        {
+            copyError = TRUE; // goto COPY_ERROR
+            break;
+        }
+
+        script->AddBytesToSpeedMetersAndTFSandPS(read, FALSE, bufferSize, &limitBufferSize);
+
+        if (!script->ChangeSpeedLimit)                                 // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        verifyCrc->AddData(bufIn, read, operationDone);
+        operationDone += CQuadWord(read, 0);
+        SetProgressWithoutSuspend(hProgressDlg, CaclProg(operationDone, op->Size),
+                                  CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
+
+        if (script->ChangeSpeedLimit)                                  // asi se bude menit speed-limit, zde je "vhodne" misto na cekani, az se
+        {                                                              // worker zase rozbehne, ziskame znovu velikost bufferu pro kopirovani
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+            script->GetNewBufSize(&limitBufferSize, bufferSize);
+        }
+    }
+    free(bufIn);
+    free(bufOut);
+
+    // file-pointer nastavime na konec zpracovane casti: pri uspechu cil zkratime na velikost zdroje,
+    // pri chybe volajici pripadne zkrati cil pred jeho zachovanim nebo vymazem
+    if (!SalSetFilePointer(out, operationDone))
+    {
+        DWORD err = GetLastError();
+        TRACE_E("DoCopyFileLoopDelta(): unable to set file pointer in OUT file, error: " << GetErrorText(err));
+    }
+    if (copyError || skipCopy)
+        return;
+    while (!SetEndOfFile(out))
+    {
+        if (!DeltaHandleError(TRUE, op->TargetName, GetLastError(), hProgressDlg, dlgData, copyError, skipCopy))
+            return;
+    }
+    TRACE_I("DoCopyFileLoopDelta(): " << op->TargetName << ": written " << written.Value << " of " << operationDone.Value << " bytes.");
+}
+
+// znacka ciloveho souboru, ktery zustal po cancelu castecne zkopirovany pro navazani kopie
+// (Configuration.ResumeInterruptedCopies); je v ADS ciloveho souboru (jinak se cast cile nenechava),
+// navazuje se jen na cil se znackou od zdroje se stejnou velikosti a casem posledniho zapisu;
+// prepis cile i otevreni pro DoCopyFileLoopDelta() ADS (a tim i znacku) mazou
+#define RESUMEMARK_ADS_NAME ":SalamanderResume"
+#define RESUMEMARK_MAGIC 0x4D525353 // "SSRM"
+
+struct CResumeMark
+{
+    DWORD Magic;
+    CQuadWord SrcSize;
+    FILETIME SrcLastWrite;
+};
+
+// sestavi jmeno ADS se znackou souboru 'targetName' do 'name' (MAX_PATH + 50 znaku); vraci FALSE
+// pri prilis dlouhem jmenu
+BOOL GetResumeMarkName(const char* targetName, char* name)
+{
+    int len = (int)strlen(targetName);
+    if (len + (int)strlen(RESUMEMARK_ADS_NAME) >= MAX_PATH + 50)
+        return FALSE;
+    memcpy(name, targetName, len);
+    strcpy(name + len, RESUMEMARK_ADS_NAME);
+    return TRUE;
+}
+
+// zapise znacku do zavreneho ciloveho souboru 'targetName' (zdroj ma velikost 'srcSize' a cas posledniho
+// zapisu 'srcLastWrite'); vraci FALSE pokud se znacku nepodarilo zapsat
+BOOL WriteResumeMark(const char* targetName, const CQuadWord& srcSize, const FILETIME& srcLastWrite)
+{
+    char name[MAX_PATH + 50];
+    if (!GetResumeMarkName(targetName, name))
+        return FALSE;
+    HANDLE file = HANDLES_Q(CreateFile(name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+    CResumeMark mark;
+    memset(&mark, 0, sizeof(mark));
+    mark.Magic = RESUMEMARK_MAGIC;
+    mark.SrcSize = srcSize;
+    mark.SrcLastWrite = srcLastWrite;
+    DWORD written;
+    BOOL ok = WriteFile(file, &mark, sizeof(mark), &written, NULL) && written == sizeof(mark);
+    HANDLES(CloseHandle(file));
+    if (!ok)
+        DeleteFile(name);
+    return ok;
+}
+
+// vraci TRUE pokud ma cilovy soubor 'targetName' znacku od zdroje 'in' velikosti 'srcSize'
+BOOL CheckResumeMark(const char* targetName, HANDLE in, const CQuadWord& srcSize)
+{
+    FILETIME srcLastWrite;
+    char name[MAX_PATH + 50];
+    if (!GetFileTime(in, NULL, NULL, &srcLastWrite) || !GetResumeMarkName(targetName, name))
+        return FALSE;
+    HANDLE file = HANDLES_Q(CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL));
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+    CResumeMark mark;
+    DWORD read;
+    BOOL ok = ReadFile(file, &mark, sizeof(mark), &read, NULL) && read == sizeof(mark) &&
+              mark.Magic == RESUMEMARK_MAGIC && mark.SrcSize == srcSize &&
+              CompareFileTime(&mark.SrcLastWrite, &srcLastWrite) == 0;
+    HANDLES(CloseHandle(file));
+    return ok;
+}
+
+// pokusi se otevrit existujici cilovy soubor (atributy 'attr') pro aktualizaci zmenenych bloku
+// (Configuration.CopyChangedBlocksOnly) nebo pro navazani prerusene kopie (Configuration.ResumeInterruptedCopies,
+// cil je kratsi nez zdroj, ma znacku od tohoto zdroje (viz CResumeMark) a jeho konec se shoduje se zdrojem); vraci TRUE pokud se ma kopirovat pres
+// DoCopyFileLoopDelta() (v 'out' je otevreny cil, v 'tgtFileSize' jeho velikost a v 'resumeOffset' offset,
+// od ktereho se kopiruje), FALSE = cil se ma prepsat cely obvyklym zpusobem
+BOOL OpenTgtForDeltaCopy(CAsyncCopyParams* asyncPar, HANDLE in, COperation* op, COperations* script, DWORD attr,
+                         const CQuadWord& fileSize, HANDLE* out, CQuadWord* tgtFileSize, CQuadWord* resumeOffset)
+{
+    CALL_STACK_MESSAGE2("OpenTgtForDeltaCopy(%s)", op->TargetName);
+
+    BOOL chAttr = FALSE;
+    if (attr != INVALID_FILE_ATTRIBUTES &&
+        (attr & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)))
+    { // zapis do read-only souboru nejde, atributy po kopii stejne nastavujeme znovu
+        chAttr = TRUE;
+        SetFileAttributes(op->TargetName, 0);
+    }
+    HANDLE file = HANDLES_Q(CreateFile(op->TargetName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                                       asyncPar->GetOverlappedFlag() | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CQuadWord size;
+        size.LoDWord = GetFileSize(file, &size.HiDWord);
+        if (size.LoDWord != INVALID_FILE_SIZE || GetLastError() == NO_ERROR)
+        {
+            BOOL useDelta = FALSE;
+            resumeOffset->SetUI64(0);
+            if (Configuration.ResumeInterruptedCopies && size.Value > 0 && size < fileSize &&
+                script->TargetPathSupADS && CheckResumeMark(op->TargetName, in, fileSize) &&
+                CheckTailOfOutFile(asyncPar->GetOverlappedFlag() != 0 ? asyncPar : NULL, in, file, size, size, FALSE))
+            {
+                *resumeOffset = size;
+                useDelta = TRUE;
+            }
+            else
+            {
+                if (Configuration.CopyChangedBlocksOnly && size >= CQuadWord(DELTACOPY_MIN_FILE_SIZE, 0))
+                    useDelta = TRUE;
+            }
+            // ADS by se pri prepisu smazaly (viz CREATE_ALWAYS + DeleteAllADS), zachovame se stejne
+            if (useDelta && (!script->TargetPathSupADS || DeleteAllADS(file, op->TargetName)))
+            {
+                *out = file;
+                *tgtFileSize = size;
+                return TRUE;
+            }
+        }
+        HANDLES(CloseHandle(file));
+    }
+    if (chAttr)
+        SetFileAttributes(op->TargetName, attr);
+    return FALSE;
+}
+
+// nakopiruje ADS do nove vznikleho souboru/adresare
+// FALSE vraci jen pri Cancel; uspech + Skip vraci TRUE; Skip nastavuje 'skip'
+// (neni-li NULL) na TRUE
+BOOL DoCopyADS(HWND hProgressDlg, const char* sourceName, BOOL isDir, const char* targetName,
+               CQuadWord const& totalDone, CQuadWord& operDone, CQuadWord const& operTotal,
+               CProgressDlgData& dlgData, COperations* script, BOOL* skip, void* buffer)
+{
+    BOOL doCopyADSRet = TRUE;
+    BOOL lowMemory;
+    DWORD adsWinError;
+    wchar_t** streamNames;
+    int streamNamesCount;
+    BOOL skipped = FALSE;
+    CQuadWord lastTransferredFileSize, finalTransferredFileSize;
+    script->GetTFSandResetTrSpeedIfNeeded(&lastTransferredFileSize);
+    finalTransferredFileSize = lastTransferredFileSize;
+    if (operTotal > operDone) // melo by byt vzdycky aspon ==, ale sychrujeme se...
+        finalTransferredFileSize += (operTotal - operDone);
+
+COPY_ADS_AGAIN:
+
+    if (CheckFileOrDirADS(sourceName, isDir, NULL, &streamNames, &streamNamesCount,
+                          &lowMemory, &adsWinError, 0, NULL, NULL) &&
+        !lowMemory && streamNames != NULL)
+    {                                  // mame seznam ADS, zkusime je nakopirovat do ciloveho souboru/adresare
+        wchar_t srcName[2 * MAX_PATH]; // MAX_PATH pro jmeno souboru i pro jmeno ADS (netusim kolik jsou realne maximalni delky)
+        wchar_t tgtName[2 * MAX_PATH];
+        char longSourceName[MAX_PATH + 100];
+        char longTargetName[MAX_PATH + 100];
+        DoLongName(longSourceName, sourceName, MAX_PATH + 100);
+        DoLongName(longTargetName, targetName, MAX_PATH + 100);
+        if (!MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, longSourceName, -1, srcName, 2 * MAX_PATH))
+            srcName[0] = 0;
+        if (!MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, longTargetName, -1, tgtName, 2 * MAX_PATH))
             tgtName[0] = 0;
         wchar_t* srcEnd = srcName + lstrlenW(srcName);
         if (srcEnd > srcName && *(srcEnd - 1) == L'\\')
@@ -3166,14 +4247,20 @@ void DoCopyFileLoopOrig(HANDLE& in, HANDLE& out, void* buffer, int& limitBufferS
                         COperations* script, CProgressDlgData& dlgData, BOOL wholeFileAllocated,
                         COperation* op, const CQuadWord& totalDone, BOOL& copyError, BOOL& skipCopy,
                         HWND hProgressDlg, CQuadWord& operationDone, CQuadWord& fileSize,
-                        int bufferSize, int& allocWholeFileOnStart, BOOL& copyAgain)
+                        int bufferSize, int& allocWholeFileOnStart, BOOL& copyAgain,
+                        CCopyVerifyCrc* verifyCrc)
 {
     int autoRetryAttemptsSNAP = 0;
     DWORD read;
     DWORD written;
+    unsigned __int64 ioStart; // telemetrie kopirovani: zacatek cteni/zapisu bloku
+    BOOL ioDone;
     while (1)
     {
-        if (ReadFile(in, buffer, limitBufferSize, &read, NULL))
+        ioStart = script->GetTelemetryTime();
+        ioDone = ReadFile(in, buffer, limitBufferSize, &read, NULL);
+        script->AddTelemetry(ctpRead, ioStart, ioDone ? read : 0, ioDone ? NO_ERROR : GetLastError());
+        if (ioDone)
         {
             autoRetryAttemptsSNAP = 0;
             if (read == 0)
@@ -3188,11 +4275,11 @@ void DoCopyFileLoopOrig(HANDLE& in, HANDLE& out, void* buffer, int& limitBufferS
 
             while (1)
             {
-                if (WriteFile(out, buffer, read, &written, NULL) &&
-                    read == written)
-                {
+                ioStart = script->GetTelemetryTime();
+                ioDone = WriteFile(out, buffer, read, &written, NULL);
+                script->AddTelemetry(ctpWrite, ioStart, ioDone ? written : 0, ioDone ? NO_ERROR : GetLastError());
+                if (ioDone && read == written)
                     break;
-                }
 
             WRITE_ERROR:
 
@@ -3286,6 +4373,7 @@ void DoCopyFileLoopOrig(HANDLE& in, HANDLE& out, void* buffer, int& limitBufferS
 
             if (!script->ChangeSpeedLimit)                                 // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
                 WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+            verifyCrc->AddData(buffer, read, operationDone);
             operationDone += CQuadWord(read, 0);
             SetProgressWithoutSuspend(hProgressDlg, CaclProg(operationDone, op->Size),
                                       CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
@@ -3442,76 +4530,398 @@ void DoCopyFileLoopOrig(HANDLE& in, HANDLE& out, void* buffer, int& limitBufferS
     }
 }
 
-enum CCopy_BlkState
-{
-    cbsFree,       // blok se nepouziva
-    cbsRead,       // cteni zdrojoveho souboru do bloku - dokoncene (ceka na zapis)
-    cbsInProgress, // --- dole jsou stavy bloku "ceka se na dokonceni operace" (nahore jsou dokoncene stavy)
-    cbsReading,    // cteni zdrojoveho souboru do bloku - zadane (probiha)
-    cbsTestingEOF, // testovani konce zdrojoveho souboru
-    cbsWriting,    // zapis bloku do ciloveho souboru
-    cbsDiscarded,  // cteni zdrojoveho souboru za koncem souboru (melo by vratit jen error: EOF)
-};
+#define SPARSECOPY_MIN_FILE_SIZE (16 * 1024 * 1024) // mensi neridke soubory se na nulove useky neprohledavaji (viz Configuration.MakeZeroRunsSparse)
+#define SPARSECOPY_BUF_SIZE (1024 * 1024)           // velikost bloku cteneho ze zdroje pri kopii do ridkeho souboru
+#define SPARSECOPY_ZERO_BLOCK (64 * 1024)           // granularita vynechavani nulovych useku (NTFS alokuje ridke soubory po 64KB); POZOR: SPARSECOPY_BUF_SIZE musi byt jejim nasobkem
 
-enum CCopy_ForceOp
+// oznaci prave vytvoreny (prazdny) cilovy soubor 'out' jako ridky; vraci FALSE pokud to cilovy
+// svazek neumi (soubor se pak kopiruje obvyklym zpusobem)
+BOOL PrepareSparseTgt(CAsyncCopyParams* asyncPar, HANDLE out, COperation* op)
 {
-    fopNotUsed, // muzeme cist nebo zapisovat, jak se zrovna hodi...
-    fopReading, // musime cist
-    fopWriting  // musime zapisovat
-};
+    DWORD fsFlags;
+    if (!GetVolumeInformationByHandleW(out, NULL, 0, NULL, NULL, &fsFlags, NULL, 0) ||
+        (fsFlags & FILE_SUPPORTS_SPARSE_FILES) == 0)
+    {
+        return FALSE;
+    }
+    DWORD returned, err;
+    if (!SyncOrAsyncDeviceIoControl(asyncPar, out, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, &err))
+    {
+        TRACE_I("PrepareSparseTgt(): unable to make target file sparse: " << op->TargetName << ": " << GetErrorText(err));
+        return FALSE;
+    }
+    return TRUE;
+}
 
-struct CCopy_Context
+// kopie do ridkeho souboru (cil uz je oznaceny jako ridky, viz PrepareSparseTgt()): ze zdroje se
+// ctou jen alokovane useky (CCopyRangesAllocated, viz copyeng.h), diry se preskakuji a do cile se
+// nezapisuji ani nulove useky (velikosti SPARSECOPY_ZERO_BLOCK), v cili tak zustanou dirami;
+// pokud zdroj alokovane useky nevraci (neni ridky nebo to neumi jeho svazek), cte se cely;
+// na konci nastavi velikost cile na velikost zdroje
+void DoCopyFileLoopSparse(CAsyncCopyParams* asyncPar, HANDLE& in, HANDLE& out, int& limitBufferSize,
+                          COperations* script, CProgressDlgData& dlgData, COperation* op,
+                          const CQuadWord& totalDone, BOOL& copyError, BOOL& skipCopy, HWND hProgressDlg,
+                          CQuadWord& operationDone, int bufferSize, const CQuadWord& fileSize,
+                          const CQuadWord& lastTransferredFileSize, CCopyVerifyCrc* verifyCrc)
 {
-    CAsyncCopyParams* AsyncPar;
+    CALL_STACK_MESSAGE2("DoCopyFileLoopSparse(%s)", op->TargetName);
 
-    CCopy_ForceOp ForceOp;        // TRUE = ted se musi cist, FALSE = ted se musi zapisovat
-    BOOL ReadingDone;             // TRUE = zdrojovy soubor uz je komplet nacteny
-    CCopy_BlkState BlockState[8]; // stav bloku
-    DWORD BlockDataLen[8];        // pro kazdy blok: ocekavana data (cbsReading + cbsTestingEOF), platna data (cbsWriting)
-    CQuadWord BlockOffset[8];     // pro kazdy blok: offset bloku ve zdrojovem/cilovem souboru (je i v OVERLAPPED strukture v 'AsyncPar')
-    DWORD BlockTime[8];           // pro kazdy blok: "cas" zahajeni posledni asynchronni operace v tomto bloku
-    DWORD CurTime;                // "cas" pro 'BlockTime', pocitame s pretecenim (i kdyz je asi nerealne)
-    int FreeBlocks;               // aktualni pocet volnych bloku (cbsFree)
-    int FreeBlockIndex;           // tip na index bloku, ktery je volny (cbsFree), nutno overit!
-    int ReadingBlocks;            // aktualni pocet bloku, do kterych se zrovna cte (cbsReading a cbsTestingEOF)
-    int WritingBlocks;            // aktualni pocet bloku, ze kterych se zrovna zapisuje do souboru (cbsWriting)
-    CQuadWord ReadOffset;         // offset pro cteni dalsiho bloku ze zdrojoveho souboru (predchozi uz se cte/cetlo)
-    CQuadWord WriteOffset;        // offset pro zapis dalsiho bloku do ciloveho souboru (predchozi uz se zapisuje/zapsal)
-    int AutoRetryAttemptsSNAP;    // pocet opakovani automatickeho Retry (nedelame vic jak 3x): na SNAP serveru dochazi pri cteni souboru k nahodnemu vyskytu chyby ERROR_NETNAME_DELETED, tlacitko Retry pry funguje, "mackame" ho tedy automaticky
+    char* buf = (char*)malloc(SPARSECOPY_BUF_SIZE);
+    if (buf == NULL)
+    {
+        TRACE_E(LOW_MEMORY);
+        DeltaHandleError(FALSE, op->SourceName, ERROR_NOT_ENOUGH_MEMORY, hProgressDlg, dlgData, copyError, skipCopy);
+        if (!copyError && !skipCopy) // Retry nema smysl, bereme jako Cancel
+            copyError = TRUE;
+        return;
+    }
+    verifyCrc->Valid = FALSE; // diry necteme, pripadne overeni kopie musi zdroj precist cely
 
-    // vybrane parametry DoCopyFileLoopAsync, at se to vsude nepredava v paremetrech volani
-    CProgressDlgData* DlgData;
-    COperation* Op;
-    HWND HProgressDlg;
-    HANDLE* In;
-    HANDLE* Out;
-    BOOL WholeFileAllocated;
-    COperations* Script;
-    CQuadWord* OperationDone;
+    CCopyRangesAllocated ranges(&in, asyncPar->UseAsyncAlg ? asyncPar->Overlapped : NULL);
+    BOOL allocatedOnly = TRUE; // FALSE = zdroj alokovane useky nevraci, cte se cely
+    CQuadWord dataEnd(0, 0); // konec prave kopirovaneho alokovaneho useku
+    CQuadWord written(0, 0); // kolik bajtu jsme skutecne zapsali (jen pro TRACE)
+    while (1)
+    {
+        if (allocatedOnly && operationDone >= dataEnd)
+        { // najdeme dalsi alokovany usek zdroje
+            CQuadWord dataStart;
+            DWORD err;
+            if (!ranges.GetNextRange(operationDone, fileSize, &dataStart, &dataEnd, &err))
+            {
+                if (err != NO_ERROR)
+                {
+                    TRACE_I("DoCopyFileLoopSparse(): unable to get allocated ranges of " << op->SourceName << ": " << GetErrorText(err));
+                    allocatedOnly = FALSE;
+                    continue;
+                }
+                // za poslednim alokovanym usekem je do konce souboru dira, pak uz jen pripadna data pripsana behem kopie
+                dataStart = fileSize > operationDone ? fileSize : operationDone;
+                allocatedOnly = FALSE;
+            }
+            if (dataStart > operationDone) // diru preskocime, v cili zustane dirou
+            {
+                operationDone = dataStart;
+                script->SetTFSandProgressSize(lastTransferredFileSize + operationDone, totalDone + operationDone,
+                                              &limitBufferSize, bufferSize);
+                SetProgressWithoutSuspend(hProgressDlg, CaclProg(operationDone, op->Size),
+                                          CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
+            }
+            continue;
+        }
+
+        DWORD size = limitBufferSize < SPARSECOPY_BUF_SIZE ? limitBufferSize : SPARSECOPY_BUF_SIZE;
+        if (allocatedOnly && dataEnd - operationDone < CQuadWord(size, 0))
+            size = (dataEnd - operationDone).LoDWord;
+
+        DWORD read = 0;
+        DWORD err = DeltaStartIO(asyncPar, 0, in, FALSE, buf, size, operationDone, &read);
+        if (err == NO_ERROR)
+            err = DeltaFinishIO(asyncPar, 0, in, &read);
+        if (err != NO_ERROR)
+        {
+            if (DeltaHandleError(FALSE, op->SourceName, err, hProgressDlg, dlgData, copyError, skipCopy))
+                continue; // retry
+            break;
+        }
+        if (read == 0)
+            break; // EOF
+
+        // zapiseme nenulove useky (sousedni nenulove useky zapiseme najednou)
+        DWORD pos = 0;
+        while (pos < read)
+        {
+            DWORD start, end;
+            CopyFindDataRun(buf, read, pos, SPARSECOPY_ZERO_BLOCK, &start, &end);
+            if (start < end)
+            {
+                DWORD done = 0;
+                err = DeltaStartIO(asyncPar, 2, out, TRUE, buf + start, end - start, operationDone + CQuadWord(start, 0), &done);
+                if (err == NO_ERROR)
+                    err = DeltaFinishIO(asyncPar, 2, out, &done);
+                if (err == NO_ERROR && done != end - start)
+                    err = ERROR_DISK_FULL;
+                if (err != NO_ERROR)
+                {
+                    if (DeltaHandleError(TRUE, op->TargetName, err, hProgressDlg, dlgData, copyError, skipCopy))
+                        continue; // retry (zapis tehoz useku)
+                    break;
+                }
+                written += CQuadWord(end - start, 0);
+            }
+            pos = end;
+        }
+        if (pos < read) // chyba zapisu: cancel nebo skip
+            break;
+
+        if (!script->ChangeSpeedLimit)                                 // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        if (*dlgData.CancelWorker)
+        {
+            copyError = TRUE; // goto COPY_ERROR
+            break;
+        }
+
+        script->AddBytesToSpeedMetersAndTFSandPS(read, FALSE, bufferSize, &limitBufferSize);
+
+        if (!script->ChangeSpeedLimit)                                 // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        operationDone += CQuadWord(read, 0);
+        SetProgressWithoutSuspend(hProgressDlg, CaclProg(operationDone, op->Size),
+                                  CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
+
+        if (script->ChangeSpeedLimit)                                  // asi se bude menit speed-limit, zde je "vhodne" misto na cekani, az se
+        {                                                              // worker zase rozbehne, ziskame znovu velikost bufferu pro kopirovani
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+            script->GetNewBufSize(&limitBufferSize, bufferSize);
+        }
+    }
+    free(buf);
+
+    // file-pointer nastavime na konec zpracovane casti: pri uspechu tim nastavime velikost cile
+    // (diry na konci souboru), pri chybe volajici pripadne zkrati cil pred jeho zachovanim nebo vymazem
+    if (!SalSetFilePointer(out, operationDone))
+    {
+        DWORD err = GetLastError();
+        TRACE_E("DoCopyFileLoopSparse(): unable to set file pointer in OUT file, error: " << GetErrorText(err));
+    }
+    if (copyError || skipCopy)
+        return;
+    while (!SetEndOfFile(out))
+    {
+        if (!DeltaHandleError(TRUE, op->TargetName, GetLastError(), hProgressDlg, dlgData, copyError, skipCopy))
+            return;
+    }
+    TRACE_I("DoCopyFileLoopSparse(): " << op->TargetName << ": written " << written.Value << " of " << operationDone.Value << " bytes.");
+}
+
+#define OFFLOADCOPY_MIN_FILE_SIZE (1024 * 1024)    // mensi soubory kopirujeme vzdy pres buffery (zjistovani moznosti offloadu by trvalo dele nez samotna kopie)
+#define OFFLOADCOPY_CLONE_CHUNK (256 * 1024 * 1024) // velikost useku klonovaneho jednim FSCTL_DUPLICATE_EXTENTS_TO_FILE (kvuli progresu a cancelu)
+#define OFFLOADCOPY_SMB_CHUNK (1024 * 1024)         // velikost jednoho chunku server-side copy (SMB2 server standardne pripousti max. 1MB)
+#define OFFLOADCOPY_SMB_CHUNKS 16                   // pocet chunku v jednom FSCTL_SRV_COPYCHUNK_WRITE (SMB2 server standardne pripousti max. 16)
+
+#ifndef FSCTL_DUPLICATE_EXTENTS_TO_FILE // SDK pro _WIN32_WINNT < Windows 10 ho nedefinuje
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#endif
+#ifndef FILE_SUPPORTS_BLOCK_REFCOUNTING
+#define FILE_SUPPORTS_BLOCK_REFCOUNTING 0x08000000
+#endif
+#define FSCTL_SRV_REQUEST_RESUME_KEY CTL_CODE(FILE_DEVICE_NETWORK_FILE_SYSTEM, 30, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_SRV_COPYCHUNK_WRITE CTL_CODE(FILE_DEVICE_NETWORK_FILE_SYSTEM, 60, METHOD_OUT_DIRECT, FILE_WRITE_ACCESS)
+
+struct CDuplicateExtentsData // DUPLICATE_EXTENTS_DATA
+{
+    HANDLE FileHandle; // zdrojovy soubor
+    LARGE_INTEGER SourceFileOffset;
+    LARGE_INTEGER TargetFileOffset;
+    LARGE_INTEGER ByteCount;
+};
+
+struct CSrvResumeKey // odpoved na FSCTL_SRV_REQUEST_RESUME_KEY (MS-SMB2: SRV_REQUEST_RESUME_KEY)
+{
+    BYTE Key[24];
+    DWORD ContextLength;
+    BYTE Context[4];
+};
+
+struct CSrvCopyChunk // MS-SMB2: SRV_COPYCHUNK
+{
+    LARGE_INTEGER SourceOffset;
+    LARGE_INTEGER TargetOffset;
+    DWORD Length;
+    DWORD Reserved;
+};
+
+struct CSrvCopyChunkCopy // MS-SMB2: SRV_COPYCHUNK_COPY
+{
+    BYTE SourceKey[24];
+    DWORD ChunkCount;
+    DWORD Reserved;
+    CSrvCopyChunk Chunks[OFFLOADCOPY_SMB_CHUNKS];
+};
+
+struct CSrvCopyChunkResponse // MS-SMB2: SRV_COPYCHUNK_RESPONSE
+{
+    DWORD ChunksWritten;
+    DWORD ChunkBytesWritten;
+    DWORD TotalBytesWritten;
+};
+
+// po zkopirovani 'bytes' bajtu bez bufferu: progress + test cancelu (pri cancelu nastavi 'copyError' a vraci FALSE)
+BOOL OffloadCopyProgress(DWORD bytes, COperations* script, CProgressDlgData& dlgData, COperation* op,
+                         const CQuadWord& totalDone, BOOL& copyError, HWND hProgressDlg, CQuadWord& operationDone,
+                         int bufferSize, int& limitBufferSize)
+{
+    script->AddBytesToSpeedMetersAndTFSandPS(bytes, FALSE, bufferSize, &limitBufferSize);
+    operationDone += CQuadWord(bytes, 0);
+    SetProgressWithoutSuspend(hProgressDlg, CaclProg(operationDone, op->Size),
+                              CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
+    WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+    if (*dlgData.CancelWorker)
+    {
+        copyError = TRUE; // goto COPY_ERROR
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// kopirovani bez pruchodu dat pres nase buffery: klonovani bloku v ramci svazku (ReFS:
+// FSCTL_DUPLICATE_EXTENTS_TO_FILE), jinak server-side copy mezi soubory na SMB serveru
+// (FSCTL_SRV_COPYCHUNK_WRITE); 'operationDone' zvysi o pocet takto zkopirovanych bajtu od zacatku
+// souboru (nula = offload neni k dispozici, pri chybe uprostred vrati dosud zkopirovanou cast),
+// zbytek zkopiruje volajici obvyklym zpusobem; 'out' musi byt prazdny nebo predalokovany na
+// 'fileSize' (wholeFileAllocated); pri cancelu nastavi 'copyError'
+void DoCopyFileOffload(CAsyncCopyParams* asyncPar, HANDLE in, HANDLE out, COperations* script,
+                       CProgressDlgData& dlgData, COperation* op, const CQuadWord& totalDone, BOOL& copyError,
+                       HWND hProgressDlg, CQuadWord& operationDone, const CQuadWord& fileSize,
+                       BOOL wholeFileAllocated, int bufferSize, int& limitBufferSize)
+{
+    CALL_STACK_MESSAGE2("DoCopyFileOffload(%s)", op->TargetName);
+
+    if (asyncPar->IsOffloadUnavailable(op->SourceName, op->TargetName))
+        return;
+
+    DWORD err = NO_ERROR;
+    DWORD returned;
+
+    // klonovani bloku: oba soubory musi byt na stejnem svazku, ktery podporuje sdileni bloku
+    DWORD srcSerial, tgtSerial, fsFlags;
+    if (GetVolumeInformationByHandleW(in, NULL, 0, &srcSerial, NULL, NULL, NULL, 0) &&
+        GetVolumeInformationByHandleW(out, NULL, 0, &tgtSerial, NULL, &fsFlags, NULL, 0) &&
+        srcSerial == tgtSerial && (fsFlags & FILE_SUPPORTS_BLOCK_REFCOUNTING) &&
+        (op->Attr & FILE_ATTRIBUTE_SPARSE_FILE) == 0) // ridky cil bychom museli nejdrive nastavit (FSCTL_SET_SPARSE)
+    {
+        char root[MAX_PATH];
+        GetRootPath(root, op->TargetName);
+        DWORD sectorsPerCluster, bytesPerSector, freeClusters, totalClusters;
+        DWORD clusterSize = 0;
+        if (GetDiskFreeSpace(root, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters))
+            clusterSize = sectorsPerCluster * bytesPerSector;
+
+        // cil musi mit velikost zdroje uz pred klonovanim
+        BOOL sizeChanged = FALSE;
+        if (clusterSize != 0 && !wholeFileAllocated)
+        {
+            if (SalSetFilePointer(out, fileSize) && SetEndOfFile(out))
+                sizeChanged = TRUE;
+            else
+                clusterSize = 0;
+        }
+        while (clusterSize != 0 && operationDone < fileSize)
+        {
+            CQuadWord len = fileSize - operationDone;
+            if (len > CQuadWord(OFFLOADCOPY_CLONE_CHUNK, 0))
+                len.Set(OFFLOADCOPY_CLONE_CHUNK, 0);
+            CDuplicateExtentsData data;
+            data.FileHandle = in;
+            data.SourceFileOffset.QuadPart = operationDone.Value;
+            data.TargetFileOffset.QuadPart = operationDone.Value;
+            // posledni usek zaokrouhlime na cele clustery (soubor konci uprostred clusteru, NTFS/ReFS to pripousti)
+            data.ByteCount.QuadPart = (len.Value + clusterSize - 1) / clusterSize * clusterSize;
+            if (!SyncOrAsyncDeviceIoControl(asyncPar, out, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &data, sizeof(data),
+                                            NULL, 0, &returned, &err))
+            {
+                TRACE_I("DoCopyFileOffload(): block cloning of " << op->SourceName << " stopped at offset " << operationDone.Value << ": " << GetErrorText(err));
+                break;
+            }
+            if (!OffloadCopyProgress(len.LoDWord, script, dlgData, op, totalDone, copyError, hProgressDlg,
+                                     operationDone, bufferSize, limitBufferSize))
+            {
+                SalSetFilePointer(out, operationDone); // pri navazovani prerusene kopie se cil zkrati na zkopirovanou cast
+                return;                                // cancel
+            }
+        }
+        if (operationDone.Value == 0)
+        {
+            SetFilePointer(out, 0, NULL, FILE_BEGIN); // synchronni kopie zapisuje na aktualni pozici
+            if (sizeChanged)                          // vratime cil do puvodniho stavu (prazdny)
+                SetEndOfFile(out);
+        }
+        else
+            return; // pripadny zbytek dokopiruje volajici
+    }
+
+    // server-side copy: oba soubory na SMB serveru (na ruznych serverech selze uz prvni pozadavek)
+    if ((op->OpFlags & OPFL_SRCPATH_IS_NET) && (op->OpFlags & OPFL_TGTPATH_IS_NET))
+    {
+        CSrvResumeKey key;
+        if (SyncOrAsyncDeviceIoControl(asyncPar, in, FSCTL_SRV_REQUEST_RESUME_KEY, NULL, 0, &key, sizeof(key),
+                                       &returned, &err))
+        {
+            CSrvCopyChunkCopy copy;
+            memcpy(copy.SourceKey, key.Key, sizeof(copy.SourceKey));
+            copy.Reserved = 0;
+            while (operationDone < fileSize)
+            {
+                CQuadWord offset = operationDone;
+                DWORD total = 0;
+                for (copy.ChunkCount = 0; copy.ChunkCount < OFFLOADCOPY_SMB_CHUNKS && offset < fileSize; copy.ChunkCount++)
+                {
+                    CSrvCopyChunk* chunk = &copy.Chunks[copy.ChunkCount];
+                    chunk->SourceOffset.QuadPart = offset.Value;
+                    chunk->TargetOffset.QuadPart = offset.Value;
+                    chunk->Length = fileSize - offset > CQuadWord(OFFLOADCOPY_SMB_CHUNK, 0) ? OFFLOADCOPY_SMB_CHUNK : (fileSize - offset).LoDWord;
+                    chunk->Reserved = 0;
+                    offset += CQuadWord(chunk->Length, 0);
+                    total += chunk->Length;
+                }
+                CSrvCopyChunkResponse response;
+                if (!SyncOrAsyncDeviceIoControl(asyncPar, out, FSCTL_SRV_COPYCHUNK_WRITE, &copy,
+                                                (DWORD)((char*)&copy.Chunks[copy.ChunkCount] - (char*)&copy),
+                                                &response, sizeof(response), &returned, &err) ||
+                    response.TotalBytesWritten != total)
+                {
+                    TRACE_I("DoCopyFileOffload(): server-side copy of " << op->SourceName << " stopped at offset " << operationDone.Value << ": " << GetErrorText(err));
+                    break;
+                }
+                if (!OffloadCopyProgress(total, script, dlgData, op, totalDone, copyError, hProgressDlg,
+                                         operationDone, bufferSize, limitBufferSize))
+                {
+                    SalSetFilePointer(out, operationDone); // pri navazovani prerusene kopie se cil zkrati na zkopirovanou cast
+                    return;                                // cancel
+                }
+            }
+        }
+        if (operationDone.Value > 0)
+            return; // pripadny zbytek dokopiruje volajici
+    }
+    asyncPar->SetOffloadUnavailable(op->SourceName, op->TargetName); // dalsi soubory mezi stejnymi disky/sharey uz nezkousime
+}
+
+class CCopy_Context : public CCopyEngine
+{
+public:
+    int AutoRetryAttemptsSNAP; // pocet opakovani automatickeho Retry (nedelame vic jak 3x): na SNAP serveru dochazi pri cteni souboru k nahodnemu vyskytu chyby ERROR_NETNAME_DELETED, tlacitko Retry pry funguje, "mackame" ho tedy automaticky
+
+    // vybrane parametry DoCopyFileLoopAsync, at se to vsude nepredava v paremetrech volani
+    CAsyncCopyParams* AsyncPar;
+    CProgressDlgData* DlgData;
+    COperation* Op;
+    HWND HProgressDlg;
+    HANDLE* In;
+    HANDLE* Out;
+    BOOL WholeFileAllocated;
+    COperations* Script;
+    CQuadWord* OperationDone;
     const CQuadWord* TotalDone;
     const CQuadWord* LastTransferredFileSize;
-
-    CCopy_Context(CAsyncCopyParams* asyncPar, int numOfBlocks, CProgressDlgData* dlgData, COperation* op,
+    int BufferSize;
+    CQuadWord AllocFileSize;
+    BOOL* CopyError;
+    BOOL* SkipCopy;
+    BOOL* CopyAgain;
+    CCopyVerifyCrc* VerifyCrc;
+
+    CCopy_Context(CCopyIoBackend* io, CAsyncCopyParams* asyncPar, int numOfBlocks, CQuadWord* fileSize,
+                  int* limitBufferSize, int bufferSize, CProgressDlgData* dlgData, COperation* op,
                   HWND hProgressDlg, HANDLE* in, HANDLE* out, BOOL wholeFileAllocated, COperations* script,
-                  CQuadWord* operationDone, const CQuadWord* totalDone, const CQuadWord* lastTransferredFileSize)
+                  CQuadWord* operationDone, const CQuadWord* totalDone, const CQuadWord* lastTransferredFileSize,
+                  BOOL* copyError, BOOL* skipCopy, BOOL* copyAgain, CCopyVerifyCrc* verifyCrc)
+        : CCopyEngine(io, asyncPar->Buffers, numOfBlocks, fileSize, limitBufferSize)
     {
-        AsyncPar = asyncPar;
-        ForceOp = fopNotUsed;
-        ReadingDone = FALSE;
-        CurTime = 0;
-        for (int i = 0; i < _countof(BlockState); i++)
-            BlockState[i] = cbsFree;
-        memset(BlockDataLen, 0, sizeof(BlockDataLen));
-        memset(BlockOffset, 0, sizeof(BlockOffset));
-        memset(BlockTime, 0, sizeof(BlockTime));
-        FreeBlocks = numOfBlocks;
-        FreeBlockIndex = 0;
-        ReadingBlocks = 0;
-        WritingBlocks = 0;
-        ReadOffset.SetUI64(0);
-        WriteOffset.SetUI64(0);
         AutoRetryAttemptsSNAP = 0;
 
+        AsyncPar = asyncPar;
         DlgData = dlgData;
         Op = op;
         HProgressDlg = hProgressDlg;
@@ -3522,26 +4932,18 @@ struct CCopy_Context
         OperationDone = operationDone;
         TotalDone = totalDone;
         LastTransferredFileSize = lastTransferredFileSize;
+        BufferSize = bufferSize;
+        AllocFileSize = *fileSize;
+        CopyError = copyError;
+        SkipCopy = skipCopy;
+        CopyAgain = copyAgain;
+        VerifyCrc = verifyCrc;
     }
 
-    BOOL IsOperationDone(int numOfBlocks)
-    {
-        return ReadingDone && FreeBlocks == numOfBlocks;
-    }
-
-    BOOL StartReading(int blkIndex, DWORD readSize, DWORD* err, BOOL testEOF);
-    BOOL StartWriting(int blkIndex, DWORD* err);
-    int FindBlock(CCopy_BlkState state);
-    void FreeBlock(int blkIndex);
-    void DiscardBlocksBehindEOF(const CQuadWord& fileSize, int excludeIndex);
-    void GetNewFileSize(const char* fileName, HANDLE file, CQuadWord* fileSize, const CQuadWord& minFileSize);
-
     BOOL HandleReadingErr(int blkIndex, DWORD err, BOOL* copyError, BOOL* skipCopy, BOOL* copyAgain);
     BOOL HandleWritingErr(int blkIndex, DWORD err, BOOL* copyError, BOOL* skipCopy, BOOL* copyAgain,
                           const CQuadWord& allocFileSize, const CQuadWord& maxWriteOffset);
 
-    // prerusi pripadne asynchronni operace
-    void CancelOpPhase1();
     // zajisti, ze vsechny asynchronni operace skutecne dobehly + nastavi ukazovatko na konec souvisle
     // zapsane casti ciloveho souboru, aby se soubor spravne zarizl (pred pripadnym uzavrenim a vymazem)
     // POZOR: uvolni nepotrebne bloky, zustavaji jen ty s nactenymi daty IN souboru, ktere navic
@@ -3551,6 +4953,18 @@ struct CCopy_Context
     BOOL RetryCopyWriteErr(DWORD* err, BOOL* copyAgain, BOOL* errAgain, const CQuadWord& allocFileSize,
                            const CQuadWord& maxWriteOffset);
     BOOL HandleSuspModeAndCancel(BOOL* copyError);
+
+protected:
+    // CCopyEngine
+    virtual BOOL OnReadError(int blkIndex, DWORD err);
+    virtual BOOL OnWriteError(int blkIndex, DWORD err, const CQuadWord& maxWriteOffset);
+    virtual BOOL OnOpStarted(BOOL opCompleted);
+    virtual void OnBlockRead() { AutoRetryAttemptsSNAP = 0; }
+    virtual void OnBlockWriting(const void* data, DWORD size, const CQuadWord& offset) { VerifyCrc->AddData(data, size, offset); }
+    virtual BOOL OnBlockWritten(DWORD bytes);
+    virtual BOOL OnWaitDone() { return !HandleSuspModeAndCancel(CopyError); }
+    virtual void GetNewFileSize(const CQuadWord& minFileSize);
+    virtual int OnQueueDepthChange(int queueDepth) { return AsyncPar->AllocBlocks(queueDepth); }
 };
 
 BOOL DisableLocalBuffering(CAsyncCopyParams* asyncPar, HANDLE file, DWORD* err)
@@ -3578,247 +4992,76 @@ BOOL DisableLocalBuffering(CAsyncCopyParams* asyncPar, HANDLE file, DWORD* err)
     return FALSE;
 }
 
-BOOL CCopy_Context::StartReading(int blkIndex, DWORD readSize, DWORD* err, BOOL testEOF)
+void CCopy_Context::GetNewFileSize(const CQuadWord& minFileSize)
 {
-#ifdef ASYNC_COPY_DEBUG_MSG
-    char sss[1000];
-    sprintf(sss, "ReadFile: %d 0x%08X 0x%08X", blkIndex, ReadOffset.LoDWord, readSize);
-    TRACE_I(sss);
-#endif // ASYNC_COPY_DEBUG_MSG
-
-    if (!ReadFile(*In, AsyncPar->Buffers[blkIndex], readSize, NULL,
-                  AsyncPar->InitOverlappedWithOffset(blkIndex, ReadOffset)) &&
-        GetLastError() != ERROR_IO_PENDING)
-    { // nastala chyba cteni, jdeme ji poresit
-        *err = GetLastError();
-        if (*err == ERROR_HANDLE_EOF) // synchronne ohlaseny EOF, prevedeme ho na asynchronne hlaseny EOF
-            AsyncPar->SetOverlappedToEOF(blkIndex, ReadOffset);
-        else
-            return FALSE;
-    }
-    // pokud cteni probehlo synchronne (nebo z cache, coz bohuzel nejsem schopen detekovat), tak ted
-    // musime neco zapsat, jinak se muze zapis flakat = celkove zpomaleni operace
-    BOOL opCompleted = HasOverlappedIoCompleted(AsyncPar->GetOverlapped(blkIndex));
-    ForceOp = opCompleted ? fopWriting : fopNotUsed;
-
-#ifdef ASYNC_COPY_DEBUG_MSG
-    TRACE_I("ReadFile result: " << (opCompleted ? "DONE" : "ASYNC"));
-#endif // ASYNC_COPY_DEBUG_MSG
-
-    if (opCompleted && !Script->ChangeSpeedLimit)                   // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
-        WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
-    if (*DlgData->CancelWorker)
-    {
-        *err = ERROR_CANCELLED;
-        return FALSE; // cancel se provede v error-handlingu
-    }
-
-    BlockOffset[blkIndex] = ReadOffset;
-    BlockDataLen[blkIndex] = readSize;
-    if (!testEOF) // blok byl pred volanim teto metody ve stavu cbsFree
+    FileSize->LoDWord = GetFileSize(*In, &FileSize->HiDWord);
+    if (FileSize->LoDWord == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
     {
-        ReadOffset.Value += readSize;
-        BlockState[blkIndex] = cbsReading;
+        DWORD err = GetLastError();
+        TRACE_E("CCopy_Context::GetNewFileSize(): GetFileSize(" << Op->SourceName << "): unexpected error: " << GetErrorText(err));
+        *FileSize = minFileSize;
     }
     else
-        BlockState[blkIndex] = cbsTestingEOF;
-    BlockTime[blkIndex] = CurTime++;
-    FreeBlocks--;
-    ReadingBlocks++;
-    return TRUE;
-}
-
-BOOL CCopy_Context::StartWriting(int blkIndex, DWORD* err)
-{
-#ifdef ASYNC_COPY_DEBUG_MSG
-    char sss[1000];
-    sprintf(sss, "WriteFile: %d 0x%08X 0x%08X", blkIndex, WriteOffset.LoDWord, BlockDataLen[blkIndex]);
-    TRACE_I(sss);
-#endif // ASYNC_COPY_DEBUG_MSG
-
-    if (!WriteFile(*Out, AsyncPar->Buffers[blkIndex], BlockDataLen[blkIndex], NULL,
-                   AsyncPar->InitOverlappedWithOffset(blkIndex, WriteOffset)) &&
-        GetLastError() != ERROR_IO_PENDING)
-    { // nastala chyba zapisu, jdeme ji poresit
-        *err = GetLastError();
-        return FALSE;
-    }
-    // pokud zapis probehl synchronne (nebo do cache, coz bohuzel nejsem schopen detekovat), tak ted
-    // musime neco precist, jinak se muze cteni flakat = celkove zpomaleni operace
-    BOOL opCompleted = HasOverlappedIoCompleted(AsyncPar->GetOverlapped(blkIndex));
-    ForceOp = !ReadingDone && opCompleted ? fopReading : fopNotUsed;
-
-#ifdef ASYNC_COPY_DEBUG_MSG
-    TRACE_I("WriteFile result: " << (opCompleted ? "DONE" : "ASYNC"));
-#endif // ASYNC_COPY_DEBUG_MSG
-
-    if (opCompleted && !Script->ChangeSpeedLimit)                   // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
-        WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
-    if (*DlgData->CancelWorker)
     {
-        *err = ERROR_CANCELLED;
-        return FALSE; // cancel se provede v error-handlingu
+        if (*FileSize < minFileSize) // pokud by nahodou GetFileSize vratila kratsi soubor nez uz mame nacteny
+            *FileSize = minFileSize;
     }
-
-    WriteOffset.Value += BlockDataLen[blkIndex];
-    BlockState[blkIndex] = cbsWriting; // blok byl pred volanim teto metody ve stavu cbsRead
-    BlockTime[blkIndex] = CurTime++;
-    WritingBlocks++;
-    return TRUE;
 }
 
-int CCopy_Context::FindBlock(CCopy_BlkState state)
-{
-    for (int i = 0; i < _countof(BlockState); i++)
-        if (BlockState[i] == state)
-            return i;
-    TRACE_C("CCopy_Context::FindBlock(): unable to find block with required state (" << (int)state << ").");
-    return -1; // dead code, jen pro kompilator
-}
-
-void CCopy_Context::FreeBlock(int blkIndex)
+void CCopy_Context::CancelOpPhase2(int errBlkIndex)
 {
-    if (BlockState[blkIndex] == cbsReading || BlockState[blkIndex] == cbsTestingEOF)
-        ReadingBlocks--;
-    if (BlockState[blkIndex] == cbsWriting)
-        WritingBlocks--;
-    BlockState[blkIndex] = cbsFree;
-    FreeBlockIndex = blkIndex;
-    FreeBlocks++;
-}
+    CCopyEngine::CancelOpPhase2(errBlkIndex);
 
-void CCopy_Context::DiscardBlocksBehindEOF(const CQuadWord& fileSize, int excludeIndex)
-{
-    for (int i = 0; i < _countof(BlockState); i++)
+    // pro pripad ruseni ciloveho souboru nastavime file pointer na konec zapsane casti, volajici
+    // pak pres SetEndOfFile zarizne soubor pred jeho vymazem (jinak by mohlo dojit k nesmyslnemu
+    // zapisu nul od konce zapsane casti az do konce souboru - soubor je predalokovany kvuli
+    // prevenci fragmentace)
+    if (*Out != NULL) // jen pokud mezitim nebyl cilovy soubor zavreny
     {
-        if (i == excludeIndex)
-            continue;
-        CCopy_BlkState st = BlockState[i];
-        if ((st == cbsRead || st == cbsReading) && BlockOffset[i] >= fileSize)
+        if (!SalSetFilePointer(*Out, WriteOffset))
         {
-            if (st == cbsRead) // zahodime nactena data za koncem souboru, nemaji smysl
-                FreeBlock(i);
-            else
-            {
-                BlockState[i] = cbsDiscarded; // cteni za koncem souboru nema smysl; BlockTime neni duvod menit
-                ReadingBlocks--;
-            }
+            DWORD err = GetLastError();
+            TRACE_E("CCopy_Context::CancelOpPhase2(): unable to set file pointer in OUT file, error: " << GetErrorText(err));
         }
     }
 }
 
-void CCopy_Context::GetNewFileSize(const char* fileName, HANDLE file, CQuadWord* fileSize, const CQuadWord& minFileSize)
+BOOL CCopy_Context::OnReadError(int blkIndex, DWORD err)
 {
-    fileSize->LoDWord = GetFileSize(file, &fileSize->HiDWord);
-    if (fileSize->LoDWord == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
-    {
-        DWORD err = GetLastError();
-        TRACE_E("CCopy_Context::GetNewFileSize(): GetFileSize(" << fileName << "): unexpected error: " << GetErrorText(err));
-        *fileSize = minFileSize;
-    }
-    else
-    {
-        if (*fileSize < minFileSize) // pokud by nahodou GetFileSize vratila kratsi soubor nez uz mame nacteny
-            *fileSize = minFileSize;
-    }
+    return HandleReadingErr(blkIndex, err, CopyError, SkipCopy, CopyAgain);
 }
 
-void CCopy_Context::CancelOpPhase1()
+BOOL CCopy_Context::OnWriteError(int blkIndex, DWORD err, const CQuadWord& maxWriteOffset)
 {
-    if (!CancelIo(*In))
-    {
-        DWORD err = GetLastError();
-        TRACE_E("CCopy_Context::CancelOpPhase1(): CancelIo(IN) failed, error: " << GetErrorText(err));
-    }
-    if (*Out != NULL && !CancelIo(*Out))
-    {
-        DWORD err = GetLastError();
-        TRACE_E("CCopy_Context::CancelOpPhase1(): CancelIo(OUT) failed, error: " << GetErrorText(err));
-    }
+    return HandleWritingErr(blkIndex, err, CopyError, SkipCopy, CopyAgain, AllocFileSize, maxWriteOffset);
 }
 
-void CCopy_Context::CancelOpPhase2(int errBlkIndex)
+BOOL CCopy_Context::OnOpStarted(BOOL opCompleted)
 {
-    // POZOR: errBlkIndex == -1 pro chybu pri zadani asynchronniho cteni (nema prideleny blok)
-    //        nebo pro chybu pri zkracovani souboru po dobehnuti hl. kopirovaciho cyklu (nema prideleny blok)
-    //        nebo pro Cancel v progress dialogu (nema prideleny blok)
-
-    DWORD bytes;
-    for (int i = 0; i < _countof(BlockState); i++)
-    {
-        if (BlockState[i] > cbsInProgress)
-        { // GetOverlappedResult by mel hned vratit vysledek, protoze jsme pro oba soubory volali CancelIo()
-            if (GetOverlappedResult(BlockState[i] == cbsWriting ? *Out : *In, AsyncPar->GetOverlapped(i), &bytes, TRUE))
-            {
-                if (BlockState[i] == cbsReading && BlockDataLen[i] == bytes) // komplet prectene -> zmena na cbsRead blok
-                {
-                    BlockState[i] = cbsRead;
-                    ReadingBlocks--;
-                }
-                else
-                {
-                    if (BlockState[i] == cbsWriting && BlockDataLen[i] == bytes) // komplet zapsane -> zmena na cbsRead blok (mozna budeme zapisovat znovu, tak si ted blok nezahodime)
-                    {
-                        BlockState[i] = cbsRead;
-                        WritingBlocks--;
-                    }
-                }
-            }
-            else
-            {
-                DWORD err = GetLastError();
-                if (i != errBlkIndex &&             // pro tento blok hlasime chybu, znovu ji hlasit do TRACE nema smysl
-                    err != ERROR_OPERATION_ABORTED) // tohle neni chyba, jen hlasi, ze to bylo preruseno (volanim CancelIo())
-                {                                   // vypiseme si chyby v dalsich blocich, nejspis nic duleziteho a meli bysme je proste jen ignorovat
-                    TRACE_I("CCopy_Context::CancelOpPhase2(): GetOverlappedResult(" << (BlockState[i] == cbsWriting ? "OUT" : "IN") << ", " << i << ") returned error: " << GetErrorText(err));
-                }
-            }
-            switch (BlockState[i])
-            {
-            case cbsReading:    // neni kompletne prectene
-            case cbsTestingEOF: // nedokonceny test EOFu
-            case cbsDiscarded:
-                FreeBlock(i);
-                break;
+    if (opCompleted && !Script->ChangeSpeedLimit)                   // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
+        WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+    return !*DlgData->CancelWorker;                                 // cancel se provede v error-handlingu
+}
 
-            case cbsWriting:                      // nezapsany blok
-                if (WriteOffset > BlockOffset[i]) // pripadne snizime WriteOffset
-                    WriteOffset = BlockOffset[i];
-                BlockState[i] = cbsRead; // neni komplet zapsane, ale prectene ano -> zmena na cbsRead blok (mozna budeme zapisovat znovu, tak si ted blok nezahodime)
-                WritingBlocks--;
-                break;
-            }
-        }
-    }
+BOOL CCopy_Context::OnBlockWritten(DWORD bytes)
+{
+    if (HandleSuspModeAndCancel(CopyError))
+        return FALSE; // cancel
 
-    ReadOffset = WriteOffset; // zjistime, kam az mame souvisle nactena data od offsetu, kde potrebujeme zacit zapis
-    for (int i = 0; i < _countof(BlockState); i++)
-    {
-        if (BlockState[i] == cbsRead && BlockOffset[i] == ReadOffset) // mame nacteny blok navazujici na ReadOffset
-        {
-            ReadOffset.Value += BlockDataLen[i];
-            i = -1; // a hledame zase pekne od zacatku (pri poctu 8 bloku si to muzeme dovolit, max. 36 pruchodu cyklem)
-        }
-    }
+    Script->AddBytesToSpeedMetersAndTFSandPS(bytes, FALSE, BufferSize, BlockSize);
 
-    // zahodime bloky, ktere uz jsou zapsane nebo naopak jsou moc vpredu (nenavazuji),
-    // takze je radsi nechame nacist znovu
-    for (int i = 0; i < _countof(BlockState); i++)
-        if (BlockState[i] == cbsRead && (BlockOffset[i] < WriteOffset || BlockOffset[i] > ReadOffset))
-            FreeBlock(i);
+    if (!Script->ChangeSpeedLimit)                                  // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
+        WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+    *OperationDone += CQuadWord(bytes, 0);
+    SetProgressWithoutSuspend(HProgressDlg, CaclProg(*OperationDone, Op->Size),
+                              CaclProg(*TotalDone + *OperationDone, Script->TotalSize), *DlgData);
 
-    // pro pripad ruseni ciloveho souboru nastavime file pointer na konec zapsane casti, volajici
-    // pak pres SetEndOfFile zarizne soubor pred jeho vymazem (jinak by mohlo dojit k nesmyslnemu
-    // zapisu nul od konce zapsane casti az do konce souboru - soubor je predalokovany kvuli
-    // prevenci fragmentace)
-    if (*Out != NULL) // jen pokud mezitim nebyl cilovy soubor zavreny
-    {
-        if (!SalSetFilePointer(*Out, WriteOffset))
-        {
-            DWORD err = GetLastError();
-            TRACE_E("CCopy_Context::CancelOpPhase2(): unable to set file pointer in OUT file, error: " << GetErrorText(err));
-        }
+    if (Script->ChangeSpeedLimit)                                   // asi se bude menit speed-limit, zde je "vhodne" misto na cekani, az se
+    {                                                               // worker zase rozbehne, ziskame znovu velikost bufferu pro kopirovani
+        WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        Script->GetNewBufSize(BlockSize, BufferSize);
     }
+    return TRUE;
 }
 
 BOOL CCopy_Context::RetryCopyReadErr(DWORD* err, BOOL* copyAgain, BOOL* errAgain)
@@ -4086,262 +5329,108 @@ BOOL CCopy_Context::HandleSuspModeAndCancel(BOOL* copyError)
     return FALSE;
 }
 
-void DoCopyFileLoopAsync(CAsyncCopyParams* asyncPar, HANDLE& in, HANDLE& out, void* buffer, int& limitBufferSize,
-                         COperations* script, CProgressDlgData& dlgData, BOOL wholeFileAllocated, COperation* op,
-                         const CQuadWord& totalDone, BOOL& copyError, BOOL& skipCopy, HWND hProgressDlg,
-                         CQuadWord& operationDone, CQuadWord& fileSize, int bufferSize,
-                         int& allocWholeFileOnStart, BOOL& copyAgain, const CQuadWord& lastTransferredFileSize)
+//
+// ****************************************************************************
+// CCopyIoTelemetry
+//
+// backend asynchronniho kopirovani, ktery zaznamenava doby cteni a zapisu bloku do
+// telemetrie kopirovani (viz Configuration.RecordCopyTelemetry); vlastni I/O provadi
+// backend 'io'; doba bloku konci prvnim prevzetim vysledku (CCopyEngine ho nemusi prevzit
+// hned po dokonceni operace, latence tak muze byt o neco delsi nez skutecna; pri cekani na
+// nejstarsi operaci vola GetResult() a vysledek pak prevezme znovu, zaznamenava se jen jednou)
+
+class CCopyIoTelemetry : public CCopyIoBackend
 {
-    CQuadWord allocFileSize = fileSize;
-    DWORD err = NO_ERROR;
-    DWORD bytes = 0; // pomocny DWORD - kolik bajtu se precetlo/zapsalo v bloku
+protected:
+    CCopyIoBackend* Io;
+    CCopyTelemetry* Telemetry;
+    unsigned __int64 Start[COPYENGINE_MAX_BLOCKS]; // pro kazdy blok: zacatek posledni operace (CCopyTelemetry::GetTime())
+    BOOL Writing[COPYENGINE_MAX_BLOCKS];           // pro kazdy blok: TRUE = posledni operace byl zapis
+    BOOL Recorded[COPYENGINE_MAX_BLOCKS];          // pro kazdy blok: TRUE = posledni operace uz je v telemetrii
 
-    // je-li zdroj/cil na siti: disable local client-side in-memory caching
-    // http://msdn.microsoft.com/en-us/library/ee210753%28v=vs.85%29.aspx
-    if ((op->OpFlags & OPFL_SRCPATH_IS_NET) && !DisableLocalBuffering(asyncPar, in, &err))
-        TRACE_E("DoCopyFileLoopAsync(): IOCTL_LMR_DISABLE_LOCAL_BUFFERING failed for network source file: " << op->SourceName << ", error: " << GetErrorText(err));
-    if ((op->OpFlags & OPFL_TGTPATH_IS_NET) && !DisableLocalBuffering(asyncPar, out, &err))
-        TRACE_E("DoCopyFileLoopAsync(): IOCTL_LMR_DISABLE_LOCAL_BUFFERING failed for network target file: " << op->TargetName << ", error: " << GetErrorText(err));
+public:
+    CCopyIoTelemetry(CCopyIoBackend* io, CCopyTelemetry* telemetry)
+    {
+        Io = io;
+        Telemetry = telemetry;
+        memset(Start, 0, sizeof(Start));
+        memset(Writing, 0, sizeof(Writing));
+        memset(Recorded, 0, sizeof(Recorded));
+    }
 
-    // parametry kopirovaci smycky
-    int numOfBlocks = 8;
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+    {
+        Start[block] = Telemetry->GetTime();
+        Writing[block] = FALSE;
+        Recorded[block] = FALSE;
+        return Io->StartRead(block, buffer, size, offset, err);
+    }
 
-    // kontext Copy operace (zabranuje predavani hromady parametru do pomocnych funkci, nyni metod kontextu)
-    CCopy_Context ctx(asyncPar, numOfBlocks, &dlgData, op, hProgressDlg, &in, &out, wholeFileAllocated, script,
-                      &operationDone, &totalDone, &lastTransferredFileSize);
-    BOOL doCopy = TRUE;
-    while (doCopy)
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
     {
-        if (ctx.ForceOp != fopWriting && ctx.FreeBlocks > 0 && !ctx.ReadingDone && ctx.ReadingBlocks < (numOfBlocks + 1) / 2) // cist soubezne budeme maximalne do poloviny bloku
-        {
-            DWORD toRead = ctx.ReadOffset + CQuadWord(limitBufferSize, 0) <= fileSize ? limitBufferSize : (fileSize - ctx.ReadOffset).LoDWord;
-            BOOL testEOF = toRead == 0;
-            if (!testEOF || ctx.ReadingBlocks == 0) // cteni dat nebo test EOFu (test EOFu se dela, jen kdyz jsou vsechna cteni dokoncena)
-            {
-                if (ctx.BlockState[ctx.FreeBlockIndex] != cbsFree)
-                    ctx.FreeBlockIndex = ctx.FindBlock(cbsFree);
-                // test EOFu = cteni do celeho bloku, jinak bezne cteni 'toRead'
-                if (ctx.StartReading(ctx.FreeBlockIndex, testEOF ? limitBufferSize : toRead, &err, testEOF))
-                    continue; // uspech (start asynchronniho cteni), zkusime nastartovat dalsi cteni
-                else
-                { // chyba (start asynchronniho cteni)
-                    if (!ctx.HandleReadingErr(-1, err, &copyError, &skipCopy, &copyAgain))
-                        return; // cancel/skip(skip-all)/retry-complete
-                    continue;   // retry-resume
-                }
-            }
-        }
-        // cteni uz je zadane nebo neni potreba, jdeme zjistit, jestli se neco nedokoncilo
-        BOOL shouldWait = TRUE; // TRUE = uz neni co dalsiho asynchronniho zadat, musime pockat na dokonceni nejake zadane operace
-        BOOL retryCopy = FALSE; // TRUE = po chybe se ma provest Retry = zacit pekne od zacatku cyklu "doCopy"
-        // dve kola jsou potreba jen v pripade synchronniho zapisu (chceme ho oznacit za
-        // dokonceny hned a ne az po dalsim cteni, uz kvuli progresu)
-        for (int afterWriting = 0; afterWriting < 2; afterWriting++)
-        {
-            for (int i = 0; i < _countof(ctx.BlockState); i++)
-            {
-                if (ctx.BlockState[i] > cbsInProgress && HasOverlappedIoCompleted(asyncPar->GetOverlapped(i)))
-                {
-                    shouldWait = FALSE; // v duchu "keep it simple" (jsou situace, kdy by to mohlo zustat TRUE, ale ignorujeme je)
-                    switch (ctx.BlockState[i])
-                    {
-                    case cbsReading:    // cteni zdrojoveho souboru do bloku - zadane (probiha)
-                    case cbsTestingEOF: // testovani konce zdrojoveho souboru
-                    {
-                        BOOL testingEOF = ctx.BlockState[i] == cbsTestingEOF;
-
-#ifdef ASYNC_COPY_DEBUG_MSG
-                        TRACE_I("READ done: " << i);
-#endif // ASYNC_COPY_DEBUG_MSG
-
-                        BOOL res = GetOverlappedResult(in, asyncPar->GetOverlapped(i), &bytes, TRUE);
-                        if (testingEOF && res && bytes == 0)
-                        {
-                            res = FALSE; // podle MSDN ma na EOFu vracet FALSE a ERROR_HANDLE_EOF, tak si to posychrujeme (na disku Novell Netware 6.5 vraci TRUE)
-                            SetLastError(ERROR_HANDLE_EOF);
-                        }
-                        if (res || GetLastError() == ERROR_HANDLE_EOF)
-                        {
-                            ctx.AutoRetryAttemptsSNAP = 0;
-                            if (!res) // EOF na zacatku bloku (jen cbsReading: EOF muze byt i pred timto blokem, to se pripadne vyresi nalezenim EOFu pozdeji v bloku s nizsim offsetem)
-                            {
-                                // kdyz GetOverlappedResult() vraci FALSE, nemusi vratit bytes==0 (byl tu na to TRACE_C
-                                // a padacky prisly), takze bytes vynulujeme explicitne
-                                bytes = 0;
-                                if (testingEOF)
-                                    ctx.ReadingDone = TRUE; // potvrzeny konec zdrojoveho souboru, dale uz nic necteme
-                                // nesmime forcovat fopWriting (nic jsme neprecetli, nemame co zapsat), pokud nejde o test EOFu,
-                                // nechame dokoncit ostatni asynchronni cteni, a pak provedeme test EOFu, a pak uz se bude jen zapisovat
-                                ctx.ForceOp = fopNotUsed;
-                            }
-                            if (bytes < ctx.BlockDataLen[i]) // soubor je kratsi nez jsme cekali -> nastavime novou velikost souboru
-                            {
-                                if (!testingEOF || bytes != 0)
-                                    ctx.ReadOffset = fileSize = ctx.BlockOffset[i] + CQuadWord(bytes, 0);
-                                if (!testingEOF)
-                                    ctx.DiscardBlocksBehindEOF(fileSize, i);
-                                if (bytes == 0) // EOF = zadna data, uvolnime blok
-                                {
-                                    ctx.FreeBlock(i);
-                                    if (testingEOF)
-                                        doCopy = !ctx.IsOperationDone(numOfBlocks); // otestujeme, jestli jsme timto nedokoncili kopirovani
-                                }
-                                else
-                                    ctx.BlockDataLen[i] = bytes; // dale si hrajeme na to, ze jsme chteli nacist presne tolik
-                            }
-                            else
-                            {
-                                if (testingEOF) // hledali jsme EOF a nacetl se plny blok, asi doslo k razantnimu narustu souboru, zjistime novou velikost
-                                {
-                                    ctx.ReadOffset = ctx.BlockOffset[i] + CQuadWord(bytes, 0);
-                                    ctx.GetNewFileSize(op->SourceName, in, &fileSize, ctx.ReadOffset);
-                                }
-                            }
-                            if (ctx.BlockState[i] == cbsReading || ctx.BlockState[i] == cbsTestingEOF)
-                            {
-                                ctx.ReadingBlocks--;
-                                ctx.BlockState[i] = cbsRead;
-                            }
-                        }
-                        else // chyba
-                        {
-                            if (!ctx.HandleReadingErr(i, GetLastError(), &copyError, &skipCopy, &copyAgain))
-                                return;       // cancel/skip(skip-all)/retry-complete
-                            retryCopy = TRUE; // retry-resume
-                        }
-                        break;
-                    }
-
-                    case cbsWriting: // zapis bloku do ciloveho souboru
-                    {
-#ifdef ASYNC_COPY_DEBUG_MSG
-                        TRACE_I("WRITE done: " << i);
-#endif // ASYNC_COPY_DEBUG_MSG
-
-                        BOOL res = GetOverlappedResult(out, asyncPar->GetOverlapped(i), &bytes, TRUE);
-                        if (!res || bytes != ctx.BlockDataLen[i]) // chyba
-                        {
-                            err = GetLastError();
-                            if (err == NO_ERROR && bytes != ctx.BlockDataLen[i])
-                                err = ERROR_DISK_FULL;
-                            CQuadWord maxWriteOffset = ctx.WriteOffset;
-                            if (!ctx.HandleWritingErr(i, err, &copyError, &skipCopy, &copyAgain, allocFileSize, maxWriteOffset))
-                                return;       // cancel/skip(skip-all)/retry-complete
-                            retryCopy = TRUE; // retry-resume
-                            break;
-                        }
-
-                        if (ctx.HandleSuspModeAndCancel(&copyError))
-                            return; // cancel
-
-                        script->AddBytesToSpeedMetersAndTFSandPS(bytes, FALSE, bufferSize, &limitBufferSize);
-
-                        if (!script->ChangeSpeedLimit)                                 // pokud se muze zmenit speed-limit, tady neni "vhodne" misto pro cekani
-                            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
-                        operationDone += CQuadWord(bytes, 0);
-                        SetProgressWithoutSuspend(hProgressDlg, CaclProg(operationDone, op->Size),
-                                                  CaclProg(totalDone + operationDone, script->TotalSize), dlgData);
-
-                        if (script->ChangeSpeedLimit)                                  // asi se bude menit speed-limit, zde je "vhodne" misto na cekani, az se
-                        {                                                              // worker zase rozbehne, ziskame znovu velikost bufferu pro kopirovani
-                            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
-                            script->GetNewBufSize(&limitBufferSize, bufferSize);
-                        }
+        Start[block] = Telemetry->GetTime();
+        Writing[block] = TRUE;
+        Recorded[block] = FALSE;
+        return Io->StartWrite(block, buffer, size, offset, err);
+    }
 
-                        // break; // tady break nechybi...
-                    }
-                    case cbsDiscarded: // cteni zdrojoveho souboru za koncem souboru (melo by vratit jen error: EOF)
-                    {
-                        ctx.FreeBlock(i);
-                        doCopy = !ctx.IsOperationDone(numOfBlocks);
-                        break;
-                    }
-                    }
-                }
-                if (!doCopy || retryCopy)
-                    break;
-            }
-            if (!doCopy || retryCopy)
-                break;
+    virtual BOOL IsDone(int block) { return Io->IsDone(block); }
 
-            // nacetli jsme data do bloku, zjistime, jestli by nesly zapsat do ciloveho souboru;
-            // uvolnili jsme zapsane/discardnute bloky (zase do nich pujdeme cist na zacatek smycky)
-            CQuadWord nextReadBlkOffset; // nejnizsi offset preskoceneho cbsRead bloku
-            do
-            {
-                nextReadBlkOffset.SetUI64(0);
-                // zapisovat soubezne budeme maximalne do poloviny bloku
-                for (int i = 0; ctx.ForceOp != fopReading && i < _countof(ctx.BlockState) && ctx.WritingBlocks < (numOfBlocks + 1) / 2; i++)
-                {
-                    if (ctx.BlockState[i] == cbsRead)
-                    {
-                        if (ctx.WriteOffset == ctx.BlockOffset[i])
-                        {
-                            if (!ctx.StartWriting(i, &err))
-                            { // chyba (asynchronniho zapisu)
-                                CQuadWord maxWriteOffset = ctx.WriteOffset + CQuadWord(ctx.BlockDataLen[i], 0);
-                                if (!ctx.HandleWritingErr(i, err, &copyError, &skipCopy, &copyAgain, allocFileSize, maxWriteOffset))
-                                    return;       // cancel/skip(skip-all)/retry-complete
-                                retryCopy = TRUE; // retry-resume
-                                break;
-                            }
-                        }
-                        else
-                        {
-                            if (nextReadBlkOffset.Value == 0 || ctx.BlockOffset[i] < nextReadBlkOffset)
-                                nextReadBlkOffset = ctx.BlockOffset[i];
-                        }
-                    }
-                } // mame dalsi cbsRead blok a navazuje na zapsanou cast ciloveho souboru -> zapisujeme dale
-            } while (!retryCopy && ctx.ForceOp != fopReading && nextReadBlkOffset.Value != 0 && nextReadBlkOffset == ctx.WriteOffset &&
-                     ctx.WritingBlocks < (numOfBlocks + 1) / 2); // zapisovat soubezne budeme maximalne do poloviny bloku
-            if (retryCopy || ctx.ForceOp != fopReading)
-                break; // jdeme na Retry nebo zapis nebyl synchronni (tedy byl hotov za cca 0 ms) nebo uz jen zapisujeme, kazdopadne dve kola jsou zbytecna
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err)
+    {
+        BOOL ret = Io->GetResult(block, bytes, err);
+        if (!Recorded[block])
+        {
+            Telemetry->Add(Writing[block] ? ctpWrite : ctpRead, Start[block], ret ? *bytes : 0, ret ? NO_ERROR : *err);
+            Recorded[block] = TRUE;
         }
-        if (!doCopy || retryCopy)
-            continue;
-
-        if (shouldWait) // dalsi pruchod cyklem nema smysl, neni nadeje na zahajeni noveho cteni ani zapisu, pockame
-        {               // na dokonceni nejstarsi asynchronni operace
-            DWORD oldestBlockTime = 0;
-            int oldestBlockIndex = -1;
-            for (int i = 0; i < _countof(ctx.BlockState); i++)
-            {
-                if (ctx.BlockState[i] > cbsInProgress)
-                {
-                    DWORD ti = ctx.CurTime - ctx.BlockTime[i];
-                    if (oldestBlockTime < ti)
-                    {
-                        oldestBlockTime = ti;
-                        oldestBlockIndex = i;
-                    }
-                }
-            }
-            if (oldestBlockIndex == -1)
-                TRACE_C("DoCopyFileLoopAsync(): unexpected situation: unable to find any block with operation in progress!");
+        return ret;
+    }
 
-#ifdef ASYNC_COPY_DEBUG_MSG
-            TRACE_I("wait: GetOverlappedResult: " << oldestBlockIndex << (ctx.BlockState[oldestBlockIndex] == cbsWriting ? " WRITE" : " READ"));
-#endif // ASYNC_COPY_DEBUG_MSG
+    virtual void CancelAll() { Io->CancelAll(); }
+};
 
-            // zde pockame na dokonceni nejstarsi zadane probihajici asynchronni operace
-            // zdrojoveho souboru ('in') se tyka: cbsReading, cbsTestingEOF a cbsDiscarded
-            // ciloveho souboru ('out') se tyka jen cbsWriting
-            GetOverlappedResult(ctx.BlockState[oldestBlockIndex] == cbsWriting ? out : in,
-                                asyncPar->GetOverlapped(oldestBlockIndex), &bytes, TRUE);
+void DoCopyFileLoopAsync(CAsyncCopyParams* asyncPar, HANDLE& in, HANDLE& out, void* buffer, int& limitBufferSize,
+                         COperations* script, CProgressDlgData& dlgData, BOOL wholeFileAllocated, COperation* op,
+                         const CQuadWord& totalDone, BOOL& copyError, BOOL& skipCopy, HWND hProgressDlg,
+                         CQuadWord& operationDone, CQuadWord& fileSize, int bufferSize,
+                         int& allocWholeFileOnStart, BOOL& copyAgain, const CQuadWord& lastTransferredFileSize,
+                         CCopyVerifyCrc* verifyCrc)
+{
+    CQuadWord allocFileSize = fileSize;
+    DWORD err = NO_ERROR;
 
-#ifdef ASYNC_COPY_DEBUG_MSG
-            char sss[1000];
-            sprintf(sss, "wait done: 0x%08X 0x%08X", ctx.BlockOffset[oldestBlockIndex].LoDWord, bytes);
-            TRACE_I(sss);
-#endif // ASYNC_COPY_DEBUG_MSG
+    // je-li zdroj/cil na siti: disable local client-side in-memory caching
+    // http://msdn.microsoft.com/en-us/library/ee210753%28v=vs.85%29.aspx
+    if ((op->OpFlags & OPFL_SRCPATH_IS_NET) && !DisableLocalBuffering(asyncPar, in, &err))
+        TRACE_E("DoCopyFileLoopAsync(): IOCTL_LMR_DISABLE_LOCAL_BUFFERING failed for network source file: " << op->SourceName << ", error: " << GetErrorText(err));
+    if ((op->OpFlags & OPFL_TGTPATH_IS_NET) && !DisableLocalBuffering(asyncPar, out, &err))
+        TRACE_E("DoCopyFileLoopAsync(): IOCTL_LMR_DISABLE_LOCAL_BUFFERING failed for network target file: " << op->TargetName << ", error: " << GetErrorText(err));
 
-            if (ctx.HandleSuspModeAndCancel(&copyError))
-                return; // cancel
+    // kontext Copy operace (zabranuje predavani hromady parametru do pomocnych funkci, nyni metod kontextu),
+    // bloky kopiruje CCopyEngine, I/O provadi overlapped backend nad strukturami z 'asyncPar'
+    CCopyIoOverlapped io(&in, &out, asyncPar->Overlapped);
+    CCopyIoTelemetry ioTelemetry(&io, script->Telemetry); // pri mereni fazi kopirovani meri i jednotlive bloky
+    CCopy_Context ctx(script->Telemetry != NULL ? (CCopyIoBackend*)&ioTelemetry : &io, asyncPar, ASYNC_COPY_MAX_BLOCKS,
+                      &fileSize, &limitBufferSize, bufferSize, &dlgData, op,
+                      hProgressDlg, &in, &out, wholeFileAllocated, script, &operationDone, &totalDone,
+                      &lastTransferredFileSize, &copyError, &skipCopy, &copyAgain, verifyCrc);
+    // velikost bloku (max. 'limitBufferSize') a pocet bloku ridi regulator naucenych hodnot pro tuto dvojici zdroj/cil
+    ctx.SetTuner(asyncPar->GetTuner(script, op->SourceName, op->TargetName));
+    if (!ctx.Run())
+    {
+        // pri cancelu muze volajici nechat zkopirovanou cast cile na disku (viz keepPartialTgt) a zarizne
+        // ho na file-pointeru 'out'; overlapped zapisy ani predalokace souboru ho neposouvaji, takze ho
+        // nastavime na konec souvisle zapsane casti
+        if (copyError && out != NULL && !SalSetFilePointer(out, ctx.WriteOffset))
+        {
+            DWORD err2 = GetLastError();
+            TRACE_E("DoCopyFileLoopAsync(): unable to set file pointer in OUT file, error: " << GetErrorText(err2));
         }
+        return; // cancel/skip(skip-all)/retry-complete
     }
-    if (ctx.ReadOffset != ctx.WriteOffset || operationDone != ctx.WriteOffset)
-        TRACE_C("DoCopyFileLoopAsync(): unexpected situation after copy: ReadOffset != WriteOffset || operationDone != ctx.WriteOffset");
+    if (operationDone != ctx.WriteOffset)
+        TRACE_C("DoCopyFileLoopAsync(): unexpected situation after copy: operationDone != ctx.WriteOffset");
 
     if (wholeFileAllocated) // alokovali jsme kompletni podobu souboru (znamena, ze alokace mela smysl, napr. soubor nemuze byt nulovy)
     {
@@ -4518,10 +5607,21 @@ BOOL DoCopyFile(COperation* op, HWND hProgressDlg, void* buffer,
     CQuadWord operationDone;
     CQuadWord lastTransferredFileSize;
     script->GetTFSandResetTrSpeedIfNeeded(&lastTransferredFileSize);
+    CCopyVerifyCrc verifyCrc; // CRC32 zapsanych dat pro overeni kopie
+    BOOL deltaCopyTested;     // TRUE = uz jsme zkouseli otevrit cil pro aktualizaci zmenenych bloku (OpenTgtForDeltaCopy)
+    BOOL deltaCopy;           // TRUE = kopirujeme pres DoCopyFileLoopDelta() (cil se aktualizuje, neprepisuje)
+    CQuadWord deltaTgtFileSize;
+    CQuadWord deltaResumeOffset;
+    BOOL keepPartialTgt; // TRUE = pri cancelu nechame castecne zkopirovany cil na disku (pro navazani kopie)
+    unsigned __int64 fileStart = script->GetTelemetryTime(); // telemetrie kopirovani: zacatek kopie souboru
+    unsigned __int64 phaseStart;                             // telemetrie kopirovani: zacatek prave merene faze
 
 COPY_AGAIN:
 
     operationDone = CQuadWord(0, 0);
+    deltaCopyTested = FALSE;
+    deltaCopy = FALSE;
+    keepPartialTgt = FALSE;
     HANDLE in;
 
     if (skip != NULL)
@@ -4549,9 +5649,11 @@ COPY_AGAIN:
     {
         if (!invalidSrcName && !asyncPar->Failed())
         {
+            phaseStart = script->GetTelemetryTime();
             in = HANDLES_Q(CreateFile(op->SourceName, GENERIC_READ,
                                       FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
                                       OPEN_EXISTING, asyncPar->GetOverlappedFlag() | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+            script->AddTelemetry(ctpOpenSource, phaseStart, 0, in != INVALID_HANDLE_VALUE ? NO_ERROR : GetLastError());
         }
         else
         {
@@ -4568,6 +5670,7 @@ COPY_AGAIN:
             {
             OPEN_TGT_FILE:
 
+                deltaCopy = FALSE;
                 BOOL encryptionNotSupported = FALSE;
                 DWORD fileAttrs = asyncPar->GetOverlappedFlag() | FILE_FLAG_SEQUENTIAL_SCAN |
                                   (!lossEncryptionAttr && copyAsEncrypted ? FILE_ATTRIBUTE_ENCRYPTED : 0) |
@@ -4575,6 +5678,7 @@ COPY_AGAIN:
                 if (!invalidTgtName)
                 {
                     // GENERIC_READ pro 'out' zpusobi zpomaleni u asynchronniho kopirovani z disku na sit (na Win7 x64 GLAN namereno 95MB/s misto 111MB/s)
+                    phaseStart = script->GetTelemetryTime();
                     out = SalCreateFileEx(op->TargetName, GENERIC_WRITE | (script->CopyAttrs ? GENERIC_READ : 0), 0, fileAttrs, &encryptionNotSupported);
                     if (!encryptionNotSupported && script->CopyAttrs && out == INVALID_HANDLE_VALUE) // pro pripad, ze neni povolen read-access do adresare (ten jsme pridali jen kvuli nastavovani Compressed atributu) zkusime jeste vytvorit soubor jen pro zapis
                         out = SalCreateFileEx(op->TargetName, GENERIC_WRITE, 0, fileAttrs, &encryptionNotSupported);
@@ -4591,6 +5695,7 @@ COPY_AGAIN:
                         fileAttrs = lossEncryptionAttr ? (op->Attr & ~FILE_ATTRIBUTE_ENCRYPTED) : op->Attr;
                         SetCompressAndEncryptedAttrs(op->TargetName, fileAttrs, &out, TRUE, NULL, asyncPar);
                     }
+                    script->AddTelemetry(ctpCreateTarget, phaseStart, 0, out != INVALID_HANDLE_VALUE ? NO_ERROR : GetLastError());
 
                     if (out != INVALID_HANDLE_VALUE && (fileAttrs & FILE_ATTRIBUTE_ENCRYPTED))
                     { // zkontrolujeme jestli je Encrypted skutecne nastaveny (treba na FATce se proste ignoruje, system chyby nevraci (konkretne pro CreateFile))
@@ -4659,9 +5764,20 @@ COPY_AGAIN:
 
                 COPY:
 
+                    // ridky zdroj kopirujeme do ridkeho cile (diry ani nulove useky se nezapisuji)
+                    BOOL sparseCopy = FALSE;
+                    if (!deltaCopy && Configuration.CopySparseFiles &&
+                        ((op->Attr & FILE_ATTRIBUTE_SPARSE_FILE) ||
+                         Configuration.MakeZeroRunsSparse && fileSize >= CQuadWord(SPARSECOPY_MIN_FILE_SIZE, 0)) &&
+                        !copyAsEncrypted && (op->Attr & FILE_ATTRIBUTE_ENCRYPTED) == 0)
+                    {
+                        sparseCopy = PrepareSparseTgt(asyncPar, out, op);
+                    }
+
                     // pokud je to mozne, provedeme alokaci potrebneho mista pro soubor (nedochazi pak k fragmentaci disku + hladsi zapis na diskety)
                     BOOL wholeFileAllocated = FALSE;
-                    if (!skipAllocWholeFileOnStart &&               // minule doslo k chybe, ted by nejspis doslo k te same
+                    if (!sparseCopy &&                              // ridky cil nealokujeme (diry by se zaplnily)
+                        !skipAllocWholeFileOnStart &&               // minule doslo k chybe, ted by nejspis doslo k te same
                         allocWholeFileOnStart != 2 /* no */ &&      // alokovani celeho souboru neni zakazano
                         fileSize > CQuadWord(limitBufferSize, 0) && // pod velikost kopirovaciho bufferu nema alokace souboru smysl
                         fileSize < CQuadWord(0, 0x80000000))        // velikost souboru je kladne cislo (jinak nelze seekovat - jde o cisla nad 8EB, takze zrejme nikdy nenastane)
@@ -4711,15 +5827,47 @@ COPY_AGAIN:
                     }
 
                     script->SetFileStartParams();
+                    verifyCrc.Init(Configuration.VerifyCopiedFiles);
+                    phaseStart = script->GetTelemetryTime();
 
                     BOOL copyError = FALSE;
                     BOOL skipCopy = FALSE;
                     BOOL copyAgain = FALSE;
-                    if (useAsyncAlg)
+                    BOOL useSpeedLimit;
+                    DWORD speedLimit;
+                    script->GetSpeedLimit(&useSpeedLimit, &speedLimit);
+                    if (!deltaCopy && !sparseCopy && !useSpeedLimit && fileSize >= CQuadWord(OFFLOADCOPY_MIN_FILE_SIZE, 0) &&
+                        !copyAsEncrypted && (op->Attr & FILE_ATTRIBUTE_ENCRYPTED) == 0)
+                    { // zkusime kopii bez bufferu (klonovani bloku, server-side copy), zbytek se dokopiruje jako u navazani kopie
+                        DoCopyFileOffload(asyncPar, in, out, script, dlgData, op, totalDone, copyError, hProgressDlg,
+                                          operationDone, fileSize, wholeFileAllocated, bufferSize, limitBufferSize);
+                        if (!copyError && operationDone.Value > 0)
+                        {
+                            deltaCopy = TRUE;
+                            deltaTgtFileSize = operationDone;
+                            deltaResumeOffset = operationDone;
+                        }
+                    }
+                    if (copyError)
+                        ; // cancel behem kopie bez bufferu
+                    else if (sparseCopy)
+                    {
+                        DoCopyFileLoopSparse(asyncPar, in, out, limitBufferSize, script, dlgData, op, totalDone, copyError,
+                                             skipCopy, hProgressDlg, operationDone, bufferSize, fileSize,
+                                             lastTransferredFileSize, &verifyCrc);
+                    }
+                    else if (deltaCopy)
+                    {
+                        DoCopyFileLoopDelta(asyncPar, in, out, limitBufferSize, script, dlgData, op, totalDone, copyError,
+                                            skipCopy, hProgressDlg, operationDone, bufferSize, deltaTgtFileSize,
+                                            deltaResumeOffset, lastTransferredFileSize, &verifyCrc);
+                    }
+                    else if (useAsyncAlg)
                     {
                         DoCopyFileLoopAsync(asyncPar, in, out, buffer, limitBufferSize, script, dlgData, wholeFileAllocated, op,
                                             totalDone, copyError, skipCopy, hProgressDlg, operationDone, fileSize,
-                                            bufferSize, allocWholeFileOnStart, copyAgain, lastTransferredFileSize);
+                                            bufferSize, allocWholeFileOnStart, copyAgain, lastTransferredFileSize,
+                                            &verifyCrc);
                         // POZOR: 'in' ani 'out' nemaji nastaveny file-pointer (SetFilePointer) na konec souboru,
                         //        respektive 'out' ho ma nastaveny jen pri (copyError || skipCopy)
                     }
@@ -4727,22 +5875,35 @@ COPY_AGAIN:
                     {
                         DoCopyFileLoopOrig(in, out, buffer, limitBufferSize, script, dlgData, wholeFileAllocated, op,
                                            totalDone, copyError, skipCopy, hProgressDlg, operationDone, fileSize,
-                                           bufferSize, allocWholeFileOnStart, copyAgain);
+                                           bufferSize, allocWholeFileOnStart, copyAgain, &verifyCrc);
                     }
+                    script->AddTelemetry(ctpData, phaseStart, operationDone.Value, copyError || skipCopy ? ERROR_CANCELLED : NO_ERROR);
+                    // cancel behem kopirovani velkeho souboru: pri navazovani prerusenych kopii nechame zkopirovanou
+                    // cast cile na disku (file-pointer 'out' je po cancelu na konci souvisle zapsane casti)
+                    // (jen kde muze byt znacka pro navazani kopie, viz CResumeMark)
+                    keepPartialTgt = copyError && *dlgData.CancelWorker && Configuration.ResumeInterruptedCopies &&
+                                     script->TargetPathSupADS && out != NULL &&
+                                     operationDone >= CQuadWord(DELTACOPY_MIN_FILE_SIZE, 0);
 
                     if (copyError)
                     {
                     COPY_ERROR:
 
+                        FILETIME srcLastWrite; // pro znacku navazani kopie
+                        if (keepPartialTgt && (in == NULL || !GetFileTime(in, NULL, NULL, &srcLastWrite)))
+                            keepPartialTgt = FALSE;
                         if (in != NULL)
                             HANDLES(CloseHandle(in));
                         if (out != NULL)
                         {
-                            if (wholeFileAllocated)
+                            if (wholeFileAllocated || keepPartialTgt)
                                 SetEndOfFile(out); // u floppy by se jinak zapisoval zbytek souboru
                             HANDLES(CloseHandle(out));
                         }
-                        DeleteFile(op->TargetName);
+                        if (keepPartialTgt && WriteResumeMark(op->TargetName, fileSize, srcLastWrite))
+                            TRACE_I("DoCopyFile(): cancelled, keeping partially copied file for resume: " << op->TargetName);
+                        else
+                            DeleteFile(op->TargetName);
                         return FALSE;
                     }
                     if (skipCopy)
@@ -4878,9 +6039,11 @@ COPY_AGAIN:
                         if (operDone < COPY_MIN_FILE_SIZE)
                             operDone = COPY_MIN_FILE_SIZE; // nulove/male soubory trvaji aspon jako soubory s velikosti COPY_MIN_FILE_SIZE
                         BOOL adsSkip = FALSE;
-                        if (!DoCopyADS(hProgressDlg, op->SourceName, FALSE, op->TargetName, totalDone,
-                                       operDone, op->Size, dlgData, script, &adsSkip, buffer) ||
-                            adsSkip) // user dal cancel nebo Skip aspon jedno ADS
+                        phaseStart = script->GetTelemetryTime();
+                        BOOL adsCopied = DoCopyADS(hProgressDlg, op->SourceName, FALSE, op->TargetName, totalDone,
+                                                   operDone, op->Size, dlgData, script, &adsSkip, buffer);
+                        script->AddTelemetry(ctpADS, phaseStart, 0, adsCopied && !adsSkip ? NO_ERROR : ERROR_CANCELLED);
+                        if (!adsCopied || adsSkip) // user dal cancel nebo Skip aspon jedno ADS
                         {
                             if (out != NULL)
                                 HANDLES(CloseHandle(out));
@@ -4902,6 +6065,7 @@ COPY_AGAIN:
                         if (!ignoreGetFileTimeErr) // jen pokud jsme neignorovali chybu cteni casu souboru (neni co nastavovat)
                         {
                             BOOL ignoreSetFileTimeErr = FALSE;
+                            phaseStart = script->GetTelemetryTime();
                             while (!ignoreSetFileTimeErr &&
                                    !SetFileTime(out, NULL /*&creation*/, NULL /*&lastAccess*/, &lastWrite))
                             {
@@ -4949,8 +6113,12 @@ COPY_AGAIN:
                                     goto COPY_ERROR;
                                 }
                             }
+                            script->AddTelemetry(ctpSetTimes, phaseStart);
                         }
-                        if (!HANDLES(CloseHandle(out)))
+                        phaseStart = script->GetTelemetryTime();
+                        BOOL outClosed = HANDLES(CloseHandle(out));
+                        script->AddTelemetry(ctpClose, phaseStart, 0, outClosed ? NO_ERROR : GetLastError());
+                        if (!outClosed)
                         {
                             out = NULL;
                             DWORD err = GetLastError();
@@ -4990,7 +6158,58 @@ COPY_AGAIN:
                             }
                         }
 
+                        if (verifyCrc.Enabled) // overeni kopie: cilovy soubor (uz zavreny) zpetne nacteme a porovname s daty zdroje
+                        {
+                            out = NULL; // handle uz je zavreny
+                            DWORD err;
+                            phaseStart = script->GetTelemetryTime();
+                            while ((err = VerifyCopiedFile(op, &verifyCrc, dlgData)) != NO_ERROR)
+                            {
+                                WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+                                if (*dlgData.CancelWorker)
+                                    goto COPY_ERROR;
+
+                                if (dlgData.SkipAllFileWrite)
+                                    goto SKIP_COPY;
+
+                                int ret = IDCANCEL;
+                                char* data[4];
+                                data[0] = (char*)&ret;
+                                data[1] = LoadStr(IDS_ERRORVERIFYINGFILE);
+                                data[2] = op->TargetName;
+                                data[3] = GetErrorText(err);
+                                SendMessage(hProgressDlg, WM_USER_DIALOG, 0, (LPARAM)data);
+                                switch (ret)
+                                {
+                                case IDRETRY:
+                                {
+                                    if (err == ERROR_CRC) // kopie je vadna, kopirujeme znovu (jinak zkusime znovu jen overeni)
+                                    {
+                                        if (DeleteFile(op->TargetName) == 0)
+                                        {
+                                            DWORD err2 = GetLastError();
+                                            TRACE_E("DoCopyFile(): Unable to remove newly created file: " << op->TargetName << ", error: " << GetErrorText(err2));
+                                        }
+                                        goto COPY_AGAIN;
+                                    }
+                                    break;
+                                }
+
+                                case IDB_SKIPALL:
+                                    dlgData.SkipAllFileWrite = TRUE;
+                                case IDB_SKIP:
+                                    goto SKIP_COPY;
+
+                                case IDCANCEL:
+                                    goto COPY_ERROR;
+                                }
+                            }
+                            script->AddTelemetry(ctpVerify, phaseStart, operationDone.Value);
+                        }
+
+                        phaseStart = script->GetTelemetryTime();
                         SetFileAttributes(op->TargetName, script->CopyAttrs ? attr : (attr | FILE_ATTRIBUTE_ARCHIVE));
+                        script->AddTelemetry(ctpSetAttrs, phaseStart);
                     }
 
                     if (script->CopyAttrs) // zkontrolujeme jestli se podarilo zachovat atributy zdrojoveho souboru
@@ -5038,7 +6257,10 @@ COPY_AGAIN:
                     if (script->CopySecurity) // mame kopirovat NTFS security permissions?
                     {
                         DWORD err;
-                        if (!DoCopySecurity(op->SourceName, op->TargetName, &err, NULL))
+                        phaseStart = script->GetTelemetryTime();
+                        BOOL securityCopied = DoCopySecurity(op->SourceName, op->TargetName, &err, NULL);
+                        script->AddTelemetry(ctpSecurity, phaseStart, 0, securityCopied ? NO_ERROR : err);
+                        if (!securityCopied)
                         {
                             WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
                             if (*dlgData.CancelWorker)
@@ -5070,6 +6292,7 @@ COPY_AGAIN:
                         }
                     }
 
+                    script->AddTelemetry(ctpFile, fileStart, op->FileSize.Value);
                     totalDone += op->Size;
                     script->SetProgressSize(totalDone);
                     return TRUE;
@@ -5306,6 +6529,21 @@ COPY_AGAIN:
                                 }
                                 else // jdeme soubor prepsat na miste
                                 {
+                                    // velky soubor misto prepsani jen aktualizujeme (zapiseme zmenene bloky), pripadne navazeme prerusenou kopii
+                                    if (!deltaCopyTested && (Configuration.CopyChangedBlocksOnly || Configuration.ResumeInterruptedCopies) &&
+                                        fileSize >= CQuadWord(DELTACOPY_MIN_FILE_SIZE, 0) && !copyAsEncrypted &&
+                                        (op->Attr & FILE_ATTRIBUTE_ENCRYPTED) == 0 &&
+                                        (attr == INVALID_FILE_ATTRIBUTES || (attr & FILE_ATTRIBUTE_ENCRYPTED) == 0))
+                                    {
+                                        deltaCopyTested = TRUE;
+                                        if (OpenTgtForDeltaCopy(asyncPar, in, op, script, attr, fileSize, &out,
+                                                                &deltaTgtFileSize, &deltaResumeOffset))
+                                        {
+                                            deltaCopy = TRUE;
+                                            break; // goto COPY
+                                        }
+                                    }
+
                                     // pokud jsme jeste nedelali test funkcnosti zkraceni souboru na nulu, ziskame soucasnou velikost souboru
                                     CQuadWord origFileSize(0, 0); // velikost souboru pred zkracenim
                                     if (mustDeleteFileBeforeOverwrite == 0 /* need test */)
@@ -6113,6 +7351,61 @@ BOOL DoMoveFile(COperation* op, HWND hProgressDlg, void* buffer,
     }
 }
 
+// vraci TRUE pokud se ma soubor 'name' mazat do kose (podle nastaveni Recycle Bin)
+BOOL UseRecycleBinForFile(const char* name, COperations* script, CProgressDlgData& dlgData)
+{
+    BOOL useRecycleBin;
+    switch (dlgData.UseRecycleBin)
+    {
+    case 0:
+        useRecycleBin = script->CanUseRecycleBin && script->InvertRecycleBin;
+        break;
+    case 1:
+        useRecycleBin = script->CanUseRecycleBin && !script->InvertRecycleBin;
+        break;
+    case 2:
+    {
+        if (!script->CanUseRecycleBin || script->InvertRecycleBin)
+            useRecycleBin = FALSE;
+        else
+        {
+            const char* fileName = strrchr(name, '\\');
+            if (fileName != NULL) // "always true"
+            {
+                fileName++;
+                int tmpLen = lstrlen(fileName);
+                const char* ext = fileName + tmpLen;
+                //            while (ext > fileName && *ext != '.') ext--;
+                while (--ext >= fileName && *ext != '.')
+                    ;
+                //            if (ext == fileName)   // ".cvspass" ve Windows je pripona ...
+                if (ext < fileName)
+                    ext = fileName + tmpLen;
+                else
+                    ext++;
+                useRecycleBin = dlgData.AgreeRecycleMasks(fileName, ext);
+            }
+            else
+            {
+                useRecycleBin = TRUE; // pri chybe volime bezpecnou variantu, mazeme do kose
+                TRACE_E("UseRecycleBinForFile(): unexpected situation: filename does not contain backslash: " << name);
+            }
+        }
+        break;
+    }
+    }
+    return useRecycleBin;
+}
+
+// vraci TRUE pokud se ma adresar mazat do kose (podle nastaveni Recycle Bin; do kose jde jen
+// prazdny adresar, to uz musi overit volajici); 'dontUseRecycleBin' viz DoDeleteDir()
+BOOL UseRecycleBinForDir(COperations* script, BOOL dontUseRecycleBin, CProgressDlgData& dlgData)
+{
+    return script->CanUseRecycleBin && !dontUseRecycleBin &&
+           (script->InvertRecycleBin && dlgData.UseRecycleBin == 0 ||
+            !script->InvertRecycleBin && dlgData.UseRecycleBin == 1);
+}
+
 BOOL DoDeleteFile(HWND hProgressDlg, char* name, const CQuadWord& size, COperations* script,
                   CQuadWord& totalDone, DWORD attr, CProgressDlgData& dlgData)
 {
@@ -6163,46 +7456,7 @@ BOOL DoDeleteFile(HWND hProgressDlg, char* name, const CQuadWord& size, COperati
             ClearReadOnlyAttr(name, attr); // aby sel smazat ...
 
             err = ERROR_SUCCESS;
-            BOOL useRecycleBin;
-            switch (dlgData.UseRecycleBin)
-            {
-            case 0:
-                useRecycleBin = script->CanUseRecycleBin && script->InvertRecycleBin;
-                break;
-            case 1:
-                useRecycleBin = script->CanUseRecycleBin && !script->InvertRecycleBin;
-                break;
-            case 2:
-            {
-                if (!script->CanUseRecycleBin || script->InvertRecycleBin)
-                    useRecycleBin = FALSE;
-                else
-                {
-                    const char* fileName = strrchr(name, '\\');
-                    if (fileName != NULL) // "always true"
-                    {
-                        fileName++;
-                        int tmpLen = lstrlen(fileName);
-                        const char* ext = fileName + tmpLen;
-                        //            while (ext > fileName && *ext != '.') ext--;
-                        while (--ext >= fileName && *ext != '.')
-                            ;
-                        //            if (ext == fileName)   // ".cvspass" ve Windows je pripona ...
-                        if (ext < fileName)
-                            ext = fileName + tmpLen;
-                        else
-                            ext++;
-                        useRecycleBin = dlgData.AgreeRecycleMasks(fileName, ext);
-                    }
-                    else
-                    {
-                        useRecycleBin = TRUE; // pri chybe volime bezpecnou variantu, mazeme do kose
-                        TRACE_E("DoDeleteFile(): unexpected situation: filename does not contain backslash: " << name);
-                    }
-                }
-                break;
-            }
-            }
+            BOOL useRecycleBin = UseRecycleBinForFile(name, script, dlgData);
             if (useRecycleBin)
             {
                 char nameList[MAX_PATH + 1];
@@ -6818,9 +8072,7 @@ BOOL DoDeleteDir(HWND hProgressDlg, char* name, const CQuadWord& size, COperatio
         ClearReadOnlyAttr(nameRmDir, attr); // aby sel smazat ...
 
         err = ERROR_SUCCESS;
-        if (script->CanUseRecycleBin && !dontUseRecycleBin &&
-            (script->InvertRecycleBin && dlgData.UseRecycleBin == 0 ||
-             !script->InvertRecycleBin && dlgData.UseRecycleBin == 1) &&
+        if (UseRecycleBinForDir(script, dontUseRecycleBin, dlgData) &&
             IsDirectoryEmpty(name)) // podadresar nesmi obsahovat zadne soubory !!!
         {
             char nameList[MAX_PATH + 1];
@@ -7630,170 +8882,793 @@ CONVERT_AGAIN:
             }
         }
     }
-}
+}
+
+// nastavi souboru/adresari 'name' atributy 'attrs' a casy, ktere nejsou NULL; pri chybe vraci
+// FALSE, kod chyby vraci GetLastError()
+BOOL SetAttrsAndFileTimes(const char* name, DWORD attrs, FILETIME* timeModified,
+                          FILETIME* timeCreated, FILETIME* timeAccessed)
+{
+    if (!SetFileAttributes(name, attrs))
+        return FALSE;
+    BOOL isDir = ((attrs & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    // pokud mame nastavit jeden z casu
+    if (timeModified != NULL || timeCreated != NULL || timeAccessed != NULL)
+    {
+        HANDLE file;
+        if (attrs & FILE_ATTRIBUTE_READONLY)
+            SetFileAttributes(name, attrs & (~FILE_ATTRIBUTE_READONLY));
+        file = HANDLES_Q(CreateFile(name, GENERIC_READ | GENERIC_WRITE,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                    NULL, OPEN_EXISTING, isDir ? FILE_FLAG_BACKUP_SEMANTICS : 0, NULL));
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            FILETIME ftCreated, ftAccessed, ftModified;
+            GetFileTime(file, &ftCreated, &ftAccessed, &ftModified);
+            if (timeCreated != NULL)
+                ftCreated = *timeCreated;
+            if (timeAccessed != NULL)
+                ftAccessed = *timeAccessed;
+            if (timeModified != NULL)
+                ftModified = *timeModified;
+            SetFileTime(file, &ftCreated, &ftAccessed, &ftModified);
+            HANDLES(CloseHandle(file));
+            if (attrs & FILE_ATTRIBUTE_READONLY)
+                SetFileAttributes(name, attrs);
+        }
+        else
+        {
+            DWORD err = GetLastError();
+            if (attrs & FILE_ATTRIBUTE_READONLY)
+                SetFileAttributes(name, attrs);
+            SetLastError(err); // chyba CreateFile, ne obnovy atributu
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+BOOL DoChangeAttrs(HWND hProgressDlg, char* name, const CQuadWord& size, DWORD attrs,
+                   COperations* script, CQuadWord& totalDone,
+                   FILETIME* timeModified, FILETIME* timeCreated, FILETIME* timeAccessed,
+                   BOOL& changeCompression, BOOL& changeEncryption, DWORD fileAttr,
+                   CProgressDlgData& dlgData)
+{
+    // pokud cesta konci mezerou/teckou, musime pripojit '\\', jinak
+    // SetFileAttributes (a dalsi) mezery/tecky orizne a pracuje
+    // tak s jinou cestou
+    const char* nameSetAttrs = name;
+    char nameSetAttrsCopy[3 * MAX_PATH];
+    MakeCopyWithBackslashIfNeeded(nameSetAttrs, nameSetAttrsCopy);
+
+    while (1)
+    {
+        DWORD error = ERROR_SUCCESS;
+        BOOL showCompressErr = FALSE;
+        BOOL showEncryptErr = FALSE;
+        char* errTitle = NULL;
+        if (changeCompression && (attrs & FILE_ATTRIBUTE_COMPRESSED) == 0)
+        {
+            error = UncompressFile(name, fileAttr);
+            if (error != ERROR_SUCCESS)
+            {
+                errTitle = LoadStr(IDS_ERRORCOMPRESSING);
+                if (error == ERROR_INVALID_FUNCTION)
+                    showCompressErr = TRUE; // not supported
+            }
+        }
+        if (error == ERROR_SUCCESS && changeEncryption && (attrs & FILE_ATTRIBUTE_ENCRYPTED) == 0)
+        {
+            error = MyDecryptFile(name, fileAttr, TRUE);
+            if (error != ERROR_SUCCESS)
+            {
+                errTitle = LoadStr(IDS_ERRORENCRYPTING);
+                if (error == ERROR_INVALID_FUNCTION)
+                    showEncryptErr = TRUE; // not supported
+            }
+        }
+        if (error == ERROR_SUCCESS && changeCompression && (attrs & FILE_ATTRIBUTE_COMPRESSED))
+        {
+            error = CompressFile(name, fileAttr);
+            if (error != ERROR_SUCCESS)
+            {
+                errTitle = LoadStr(IDS_ERRORCOMPRESSING);
+                if (error == ERROR_INVALID_FUNCTION)
+                    showCompressErr = TRUE; // not supported
+            }
+        }
+        if (error == ERROR_SUCCESS && changeEncryption && (attrs & FILE_ATTRIBUTE_ENCRYPTED))
+        {
+            BOOL cancelOper = FALSE;
+            error = MyEncryptFile(hProgressDlg, name, fileAttr, attrs, dlgData, cancelOper, TRUE);
+            if (*dlgData.CancelWorker || cancelOper)
+                return FALSE;
+            if (error != ERROR_SUCCESS)
+            {
+                errTitle = LoadStr(IDS_ERRORENCRYPTING);
+                if (error == ERROR_INVALID_FUNCTION)
+                    showEncryptErr = TRUE; // not supported
+            }
+        }
+        if (showCompressErr || showEncryptErr)
+        {
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+            if (*dlgData.CancelWorker)
+                return FALSE;
+
+            if (showCompressErr)
+                changeCompression = FALSE;
+            if (showEncryptErr)
+                changeEncryption = FALSE;
+            char* data[3];
+            data[0] = LoadStr((showCompressErr && (attrs & FILE_ATTRIBUTE_COMPRESSED) || !showEncryptErr) ? IDS_ERRORCOMPRESSING : IDS_ERRORENCRYPTING);
+            data[1] = name;
+            data[2] = LoadStr((showCompressErr && (attrs & FILE_ATTRIBUTE_COMPRESSED) || !showEncryptErr) ? IDS_COMPRNOTSUPPORTED : IDS_ENCRYPNOTSUPPORTED);
+            SendMessage(hProgressDlg, WM_USER_DIALOG, 5, (LPARAM)data);
+            error = ERROR_SUCCESS;
+        }
+        if (error == ERROR_SUCCESS &&
+            SetAttrsAndFileTimes(nameSetAttrs, attrs, timeModified, timeCreated, timeAccessed))
+        {
+            totalDone += size;
+            SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
+            return TRUE;
+        }
+        else
+        {
+            if (error == ERROR_SUCCESS)
+                error = GetLastError();
+            if (errTitle == NULL)
+                errTitle = LoadStr(IDS_ERRORCHANGINGATTRS);
+
+            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+            if (*dlgData.CancelWorker)
+                return FALSE;
+
+            if (dlgData.SkipAllChangeAttrs)
+                goto SKIP_ATTRS_ERROR;
+
+            int ret;
+            ret = IDCANCEL;
+            char* data[4];
+            data[0] = (char*)&ret;
+            data[1] = errTitle;
+            data[2] = name;
+            data[3] = GetErrorText(error);
+            SendMessage(hProgressDlg, WM_USER_DIALOG, 0, (LPARAM)data);
+            switch (ret)
+            {
+            case IDRETRY:
+                break;
+
+            case IDB_SKIPALL:
+                dlgData.SkipAllChangeAttrs = TRUE;
+            case IDB_SKIP:
+            {
+            SKIP_ATTRS_ERROR:
+
+                totalDone += size;
+                SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
+                return TRUE;
+            }
+
+            case IDCANCEL:
+                return FALSE;
+            }
+        }
+    }
+}
+
+//
+// ****************************************************************************
+// CSmallFilesCopier
+//
+// soubezne kopirovani malych souboru: pomocne thready kopiruji soubory davky (souvisly
+// usek ocCopyFile operaci skriptu) bez jakekoliv interakce s userem, worker pak davku
+// prochazi v poradi skriptu, hlasi progress a soubory, ktere pomocne thready nezvladly
+// (jakakoliv chyba, existujici cilovy soubor, atd.), kopiruje klasicky pres DoCopyFile;
+// dialogy, dotazy na prepis i progress tak zustavaji serializovane ve workeru
+
+#define SMALLCOPY_THREADS 8      // pocet pomocnych threadu
+#define SMALLCOPY_MIN_BATCH 2    // kratsi davky nema smysl rozdelovat mezi thready
+#define SMALLCOPY_MAX_BATCH 256  // max. pocet operaci v davce (behem davky se napr. nezapne speed-limit)
+
+enum CSmallCopyState
+{
+    scsPending,  // soubor ceka na pomocny thread
+    scsCopied,   // soubor zkopiroval pomocny thread
+    scsFallback, // soubor zkopiruje worker pres DoCopyFile
+};
+
+struct CSmallCopyItem
+{
+    CScriptOpView View;  // operace rozbalena ze skriptu
+    volatile LONG State; // hodnota z CSmallCopyState
+};
+
+class CSmallFilesCopier;
+
+struct CSmallCopyHelper
+{
+    CSmallFilesCopier* Copier;
+    void* Buffer; // buffer o velikosti OPERATION_BUFFER
+    HANDLE Thread;
+};
+
+class CSmallFilesCopier
+{
+protected:
+    CProgressDlgData* DlgData;
+    DWORD ClearReadonlyMask;
+    CCopyTelemetry* Telemetry; // telemetrie kopirovani skriptu davky (NULL = nemeri se)
+
+    CSmallCopyItem Items[SMALLCOPY_MAX_BATCH];
+    int First;              // index prvni operace davky ve skriptu
+    int Count;              // pocet operaci v davce (0 = zadna davka)
+    volatile LONG NextItem; // index dalsi polozky pro pomocne thready
+    volatile BOOL Stop;     // TRUE = pomocne thready uz nemaji kopirovat (zbytek davky preda workeru)
+    HANDLE ItemFinished;    // auto-reset event: pomocny thread dokoncil nejakou polozku
+
+    CSmallCopyHelper Helpers[SMALLCOPY_THREADS];
+
+public:
+    CSmallFilesCopier(CProgressDlgData* dlgData, DWORD clearReadonlyMask);
+    ~CSmallFilesCopier();
+
+    // zahaji davku od operace 'first'; vraci FALSE pokud operace nejsou vhodne pro
+    // soubezne kopirovani (worker je pak provede klasicky)
+    BOOL StartBatch(COperations* script, TDirectArray<CScriptOp>* ops, int first,
+                    char* lastLantasticCheckRoot, BOOL& lastIsLantasticPath);
+    // pocka na dobehnuti pomocnych threadu, zbytek davky se zahodi
+    void FinishBatch();
+
+    BOOL IsInBatch(int i) { return Count > 0 && i >= First && i < First + Count; }
+
+    // pocka na zpracovani operace 'i' z davky; vraci TRUE pokud ji zkopiroval pomocny thread
+    BOOL WaitForItem(int i);
+
+    void HelperBody(CSmallCopyHelper* helper);
+
+protected:
+    BOOL CanCopyConcurrently(COperation* op, char* lastLantasticCheckRoot, BOOL& lastIsLantasticPath);
+    BOOL CopyFileQuietly(COperation* op, void* buffer);
+};
+
+unsigned SmallCopyThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("SmallCopyThreadBody()");
+    SetThreadNameInVCAndTrace("SmallCopy");
+    CSmallCopyHelper* helper = (CSmallCopyHelper*)param;
+    helper->Copier->HelperBody(helper);
+    return 0;
+}
+
+unsigned SmallCopyThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return SmallCopyThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread SmallCopy: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // tvrdsi exit (tenhle jeste neco vola)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI SmallCopyThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return SmallCopyThreadEH(param);
+}
+
+CSmallFilesCopier::CSmallFilesCopier(CProgressDlgData* dlgData, DWORD clearReadonlyMask)
+{
+    DlgData = dlgData;
+    ClearReadonlyMask = clearReadonlyMask;
+    Telemetry = NULL;
+    First = 0;
+    Count = 0;
+    NextItem = 0;
+    Stop = FALSE;
+    ItemFinished = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL));
+    if (ItemFinished == NULL)
+        TRACE_E("CSmallFilesCopier::CSmallFilesCopier(): unable to create event.");
+    int i;
+    for (i = 0; i < SMALLCOPY_THREADS; i++)
+    {
+        Helpers[i].Copier = this;
+        Helpers[i].Buffer = NULL;
+        Helpers[i].Thread = NULL;
+    }
+}
+
+CSmallFilesCopier::~CSmallFilesCopier()
+{
+    FinishBatch();
+    int i;
+    for (i = 0; i < SMALLCOPY_THREADS; i++)
+    {
+        if (Helpers[i].Buffer != NULL)
+            free(Helpers[i].Buffer);
+    }
+    if (ItemFinished != NULL)
+        HANDLES(CloseHandle(ItemFinished));
+}
+
+BOOL CSmallFilesCopier::CanCopyConcurrently(COperation* op, char* lastLantasticCheckRoot,
+                                            BOOL& lastIsLantasticPath)
+{
+    // jen kopie bez ADS a sifrovani, maleho souboru s platnymi jmeny (jinak by CreateFile
+    // orizlo mezery/tecky), a ne na Lantastic (vyzaduje kontrolu velikosti ciloveho souboru)
+    return op->Opcode == ocCopyFile &&
+           (op->OpFlags & (OPFL_COPY_ADS | OPFL_AS_ENCRYPTED)) == 0 &&
+           op->FileSize <= CQuadWord(OPERATION_BUFFER, 0) &&
+           !FileNameIsInvalid(op->SourceName, TRUE) &&
+           !FileNameIsInvalid(op->TargetName, TRUE) &&
+           !IsLantasticDrive(op->TargetName, lastLantasticCheckRoot, lastIsLantasticPath);
+}
+
+BOOL CSmallFilesCopier::StartBatch(COperations* script, TDirectArray<CScriptOp>* ops, int first,
+                                   char* lastLantasticCheckRoot, BOOL& lastIsLantasticPath)
+{
+    CALL_STACK_MESSAGE2("CSmallFilesCopier::StartBatch(%d)", first);
+    FinishBatch();
+    if (ItemFinished == NULL)
+        return FALSE;
+
+    // atributy, security, vymenna media a speed-limit resi jen DoCopyFile
+    BOOL useSpeedLimit;
+    DWORD speedLimit;
+    script->GetSpeedLimit(&useSpeedLimit, &speedLimit);
+    if (script->CopyAttrs || script->CopySecurity || script->RemovableSrcDisk ||
+        script->RemovableTgtDisk || useSpeedLimit || script->ChangeSpeedLimit)
+    {
+        return FALSE;
+    }
+
+    int count = 0;
+    while (count < SMALLCOPY_MAX_BATCH && first + count < ops->Count &&
+           ops->At(first + count).Opcode == ocCopyFile)
+    {
+        script->GetOperation(&ops->At(first + count), &Items[count].View);
+        if (!CanCopyConcurrently(&Items[count].View.Op, lastLantasticCheckRoot, lastIsLantasticPath))
+            break;
+        Items[count].State = scsPending;
+        count++;
+    }
+    if (count < SMALLCOPY_MIN_BATCH)
+        return FALSE;
+
+    First = first;
+    Count = count;
+    NextItem = 0;
+    Stop = FALSE;
+    Telemetry = script->Telemetry;
+    int started = 0;
+    int i;
+    for (i = 0; i < SMALLCOPY_THREADS && i < count; i++)
+    {
+        if (Helpers[i].Buffer == NULL)
+            Helpers[i].Buffer = malloc(OPERATION_BUFFER);
+        if (Helpers[i].Buffer == NULL)
+        {
+            TRACE_E(LOW_MEMORY);
+            break;
+        }
+        DWORD threadID;
+        Helpers[i].Thread = HANDLES(CreateThread(NULL, 0, SmallCopyThread, &Helpers[i], 0, &threadID));
+        if (Helpers[i].Thread == NULL)
+        {
+            TRACE_E("CSmallFilesCopier::StartBatch(): unable to start helper thread."); // staci mene threadu
+            break;
+        }
+        SetThreadPriority(Helpers[i].Thread, GetThreadPriority(GetCurrentThread()));
+        started++;
+    }
+    if (started == 0) // nikdo by davku nezpracoval
+    {
+        Count = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void CSmallFilesCopier::FinishBatch()
+{
+    Stop = TRUE;
+    int i;
+    for (i = 0; i < SMALLCOPY_THREADS; i++)
+    {
+        if (Helpers[i].Thread != NULL)
+        {
+            WaitForSingleObject(Helpers[i].Thread, INFINITE);
+            HANDLES(CloseHandle(Helpers[i].Thread));
+            Helpers[i].Thread = NULL;
+        }
+    }
+    Count = 0;
+}
+
+BOOL CSmallFilesCopier::WaitForItem(int i)
+{
+    CSmallCopyItem* item = &Items[i - First];
+    while (item->State == scsPending) // pomocne thready zpracuji vsechny polozky (i po cancelu), cekani je konecne
+        WaitForSingleObject(ItemFinished, INFINITE);
+    return item->State == scsCopied;
+}
+
+void CSmallFilesCopier::HelperBody(CSmallCopyHelper* helper)
+{
+    while (1)
+    {
+        LONG index = InterlockedIncrement(&NextItem) - 1;
+        if (index >= Count)
+            break;
+        CSmallCopyItem* item = &Items[index];
+        if (!Stop)
+            WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        unsigned __int64 start = Telemetry != NULL ? Telemetry->GetTime() : 0;
+        BOOL copied = !Stop && !*DlgData->CancelWorker && CopyFileQuietly(&item->View.Op, helper->Buffer);
+        if (copied && Telemetry != NULL)
+            Telemetry->Add(ctpFile, start, item->View.Op.FileSize.Value);
+        InterlockedExchange(&item->State, copied ? scsCopied : scsFallback);
+        SetEvent(ItemFinished);
+    }
+}
+
+BOOL CSmallFilesCopier::CopyFileQuietly(COperation* op, void* buffer)
+{
+    HANDLE in = HANDLES_Q(CreateFile(op->SourceName, GENERIC_READ,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (in == INVALID_HANDLE_VALUE)
+        return FALSE;
+    HANDLE out = HANDLES_Q(CreateFile(op->TargetName, GENERIC_WRITE, 0, NULL,
+                                      CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (out == INVALID_HANDLE_VALUE) // napr. cilovy soubor existuje, na prepis se zepta DoCopyFile
+    {
+        HANDLES(CloseHandle(in));
+        return FALSE;
+    }
+
+    BOOL ok = TRUE;
+    CQuadWord copied(0, 0);
+    while (ok)
+    {
+        DWORD read;
+        if (!ReadFile(in, buffer, OPERATION_BUFFER, &read, NULL))
+            ok = FALSE;
+        else
+        {
+            if (read == 0)
+                break; // EOF
+            copied += CQuadWord(read, 0);
+            DWORD written;
+            if (copied > op->FileSize || // soubor mezitim narostl, at se s tim vyporada DoCopyFile
+                !WriteFile(out, buffer, read, &written, NULL) || written != read)
+            {
+                ok = FALSE;
+            }
+        }
+    }
+    if (ok && copied != op->FileSize) // soubor se mezitim zkratil
+        ok = FALSE;
+
+    FILETIME lastWrite;
+    if (ok && (!GetFileTime(in, NULL, NULL, &lastWrite) || !SetFileTime(out, NULL, NULL, &lastWrite)))
+        ok = FALSE;
+    HANDLES(CloseHandle(in));
+    if (!HANDLES(CloseHandle(out)))
+        ok = FALSE;
+
+    if (ok)
+        SetFileAttributes(op->TargetName, (op->Attr & ClearReadonlyMask) | FILE_ATTRIBUTE_ARCHIVE);
+    else
+    {
+        if (DeleteFile(op->TargetName) == 0) // soubor jsme vytvorili, DoCopyFile ho vytvori znovu
+        {
+            DWORD err = GetLastError();
+            TRACE_E("CSmallFilesCopier::CopyFileQuietly(): Unable to remove newly created file: " << op->TargetName << ", error: " << GetErrorText(err));
+        }
+    }
+    return ok;
+}
+
+//
+// ****************************************************************************
+// CTreeOpsProcessor
+//
+// soubezne mazani a zmena atributu: pomocne thready zpracuji davku (souvisly usek
+// ocDeleteFile, ocDeleteDir a ocChangeAttrs operaci skriptu) bez jakekoliv interakce
+// s userem, adresar mazou az po zpracovani vsech polozek davky, ktere obsahuje (viz
+// CTreeBatch); worker pak davku prochazi v poradi skriptu, hlasi progress a operace,
+// ktere pomocne thready nezvladly (jakakoliv chyba, adresar s nesmazanym obsahem, atd.),
+// provede klasicky pres DoDeleteFile, DoDeleteDir a DoChangeAttrs; dotazy na mazani
+// skrytych souboru, mazani do kose a zmeny komprese/sifrovani do davky vubec nejdou
+
+#define TREEOPS_THREADS 8      // pocet pomocnych threadu (mazani je hlavne cekani na disk/sit)
+#define TREEOPS_MIN_BATCH 4    // kratsi davky nema smysl rozdelovat mezi thready
+#define TREEOPS_MAX_BATCH 1024 // max. pocet operaci v davce
+#define TREEOPS_DIR_WAIT 5     // max. doba v ms, po kterou pomocny thread ceka na obsah adresare bez kontroly
+
+class CTreeOpsProcessor
+{
+protected:
+    CProgressDlgData* DlgData;
+    COperations* Script;
+    CChangeAttrsData* AttrsData; // jen pro ocChangeAttrs
+
+    CScriptOpView* Views; // operace davky rozbalene ze skriptu (TREEOPS_MAX_BATCH polozek)
+    CTreeBatch Batch;
+    int First;           // index prvni operace davky ve skriptu
+    volatile BOOL Stop;  // TRUE = pomocne thready uz nemaji nic provadet (zbytek davky preda workeru)
+    HANDLE ItemFinished; // auto-reset event: pomocny thread dokoncil nejakou polozku (ceka worker)
+    HANDLE DirWait;      // auto-reset event: totez pro pomocne thready cekajici na obsah adresare
+
+    HANDLE Helpers[TREEOPS_THREADS];
+
+public:
+    CTreeOpsProcessor(CProgressDlgData* dlgData, COperations* script, CChangeAttrsData* attrsData);
+    ~CTreeOpsProcessor();
+
+    // zahaji davku od operace 'first'; vraci FALSE pokud operace nejsou vhodne pro
+    // soubezne zpracovani (worker je pak provede klasicky)
+    BOOL StartBatch(TDirectArray<CScriptOp>* ops, int first);
+    // pocka na dobehnuti pomocnych threadu, zbytek davky se zahodi
+    void FinishBatch();
+
+    BOOL IsInBatch(int i) { return Batch.GetCount() > 0 && i >= First && i < First + Batch.GetCount(); }
+
+    // pocka na zpracovani operace 'i' z davky; vraci TRUE pokud ji provedl pomocny thread
+    BOOL WaitForItem(int i);
+
+    void HelperBody();
+
+protected:
+    BOOL CanProcessConcurrently(COperation* op);
+    BOOL ProcessQuietly(COperation* op);
+};
+
+unsigned TreeOpsThreadBody(void* param)
+{
+    CALL_STACK_MESSAGE1("TreeOpsThreadBody()");
+    SetThreadNameInVCAndTrace("TreeOps");
+    ((CTreeOpsProcessor*)param)->HelperBody();
+    return 0;
+}
+
+unsigned TreeOpsThreadEH(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    __try
+    {
+#endif // CALLSTK_DISABLE
+        return TreeOpsThreadBody(param);
+#ifndef CALLSTK_DISABLE
+    }
+    __except (CCallStack::HandleException(GetExceptionInformation()))
+    {
+        TRACE_I("Thread TreeOps: calling ExitProcess(1).");
+        //    ExitProcess(1);
+        TerminateProcess(GetCurrentProcess(), 1); // tvrdsi exit (tenhle jeste neco vola)
+        return 1;
+    }
+#endif // CALLSTK_DISABLE
+}
+
+DWORD WINAPI TreeOpsThread(void* param)
+{
+#ifndef CALLSTK_DISABLE
+    CCallStack stack;
+#endif // CALLSTK_DISABLE
+    return TreeOpsThreadEH(param);
+}
+
+CTreeOpsProcessor::CTreeOpsProcessor(CProgressDlgData* dlgData, COperations* script, CChangeAttrsData* attrsData)
+{
+    DlgData = dlgData;
+    Script = script;
+    AttrsData = attrsData;
+    First = 0;
+    Stop = FALSE;
+    Views = NULL;
+    ItemFinished = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL));
+    DirWait = HANDLES(CreateEvent(NULL, FALSE, FALSE, NULL));
+    if (ItemFinished == NULL || DirWait == NULL)
+        TRACE_E("CTreeOpsProcessor::CTreeOpsProcessor(): unable to create event.");
+    int i;
+    for (i = 0; i < TREEOPS_THREADS; i++)
+        Helpers[i] = NULL;
+}
+
+CTreeOpsProcessor::~CTreeOpsProcessor()
+{
+    FinishBatch();
+    if (Views != NULL)
+        delete[] Views;
+    if (ItemFinished != NULL)
+        HANDLES(CloseHandle(ItemFinished));
+    if (DirWait != NULL)
+        HANDLES(CloseHandle(DirWait));
+}
+
+BOOL CTreeOpsProcessor::CanProcessConcurrently(COperation* op)
+{
+    switch (op->Opcode)
+    {
+    case ocDeleteFile:
+    {
+        // bez dotazu na mazani skrytych/systemovych souboru, bez kose a s platnym jmenem
+        // (jinak by DeleteFile orizlo mezery/tecky a smazalo jiny soubor)
+        return ((op->Attr & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) == 0 ||
+                DlgData->DeleteHiddenAll || !DlgData->CnfrmSHFileDel) &&
+               !FileNameIsInvalid(op->SourceName, TRUE) &&
+               !UseRecycleBinForFile(op->SourceName, Script, *DlgData);
+    }
+
+    case ocDeleteDir:
+        return !UseRecycleBinForDir(Script, (DWORD)(DWORD_PTR)op->TargetName != -1, *DlgData);
+
+    case ocChangeAttrs: // kompresi a sifrovani (dotazy, dlouhe operace) resi jen DoChangeAttrs
+        return AttrsData != NULL && !AttrsData->ChangeCompression && !AttrsData->ChangeEncryption;
+    }
+    return FALSE;
+}
+
+BOOL CTreeOpsProcessor::StartBatch(TDirectArray<CScriptOp>* ops, int first)
+{
+    CALL_STACK_MESSAGE2("CTreeOpsProcessor::StartBatch(%d)", first);
+    FinishBatch();
+    if (ItemFinished == NULL || DirWait == NULL)
+        return FALSE;
+    if (Views == NULL)
+    {
+        Views = new CScriptOpView[TREEOPS_MAX_BATCH];
+        if (Views == NULL || !Batch.Init(TREEOPS_MAX_BATCH))
+        {
+            TRACE_E(LOW_MEMORY);
+            if (Views != NULL)
+                delete[] Views;
+            Views = NULL;
+            return FALSE;
+        }
+    }
 
-BOOL DoChangeAttrs(HWND hProgressDlg, char* name, const CQuadWord& size, DWORD attrs,
-                   COperations* script, CQuadWord& totalDone,
-                   FILETIME* timeModified, FILETIME* timeCreated, FILETIME* timeAccessed,
-                   BOOL& changeCompression, BOOL& changeEncryption, DWORD fileAttr,
-                   CProgressDlgData& dlgData)
-{
-    // pokud cesta konci mezerou/teckou, musime pripojit '\\', jinak
-    // SetFileAttributes (a dalsi) mezery/tecky orizne a pracuje
-    // tak s jinou cestou
-    const char* nameSetAttrs = name;
-    char nameSetAttrsCopy[3 * MAX_PATH];
-    MakeCopyWithBackslashIfNeeded(nameSetAttrs, nameSetAttrsCopy);
+    int count = 0;
+    while (count < TREEOPS_MAX_BATCH && first + count < ops->Count)
+    {
+        BYTE opcode = ops->At(first + count).Opcode;
+        if (opcode != ocDeleteFile && opcode != ocDeleteDir && opcode != ocChangeAttrs)
+            break;
+        Script->GetOperation(&ops->At(first + count), &Views[count]);
+        COperation* op = &Views[count].Op;
+        if (!CanProcessConcurrently(op))
+            break;
+        Batch.Add(op->SourceName, op->Opcode == ocDeleteDir);
+        count++;
+    }
+    if (count < TREEOPS_MIN_BATCH)
+    {
+        Batch.Reset();
+        return FALSE;
+    }
 
-    while (1)
+    First = first;
+    Stop = FALSE;
+    int started = 0;
+    int i;
+    for (i = 0; i < TREEOPS_THREADS && i < count; i++)
     {
-        DWORD error = ERROR_SUCCESS;
-        BOOL showCompressErr = FALSE;
-        BOOL showEncryptErr = FALSE;
-        char* errTitle = NULL;
-        if (changeCompression && (attrs & FILE_ATTRIBUTE_COMPRESSED) == 0)
-        {
-            error = UncompressFile(name, fileAttr);
-            if (error != ERROR_SUCCESS)
-            {
-                errTitle = LoadStr(IDS_ERRORCOMPRESSING);
-                if (error == ERROR_INVALID_FUNCTION)
-                    showCompressErr = TRUE; // not supported
-            }
-        }
-        if (error == ERROR_SUCCESS && changeEncryption && (attrs & FILE_ATTRIBUTE_ENCRYPTED) == 0)
-        {
-            error = MyDecryptFile(name, fileAttr, TRUE);
-            if (error != ERROR_SUCCESS)
-            {
-                errTitle = LoadStr(IDS_ERRORENCRYPTING);
-                if (error == ERROR_INVALID_FUNCTION)
-                    showEncryptErr = TRUE; // not supported
-            }
-        }
-        if (error == ERROR_SUCCESS && changeCompression && (attrs & FILE_ATTRIBUTE_COMPRESSED))
+        DWORD threadID;
+        Helpers[i] = HANDLES(CreateThread(NULL, 0, TreeOpsThread, this, 0, &threadID));
+        if (Helpers[i] == NULL)
         {
-            error = CompressFile(name, fileAttr);
-            if (error != ERROR_SUCCESS)
-            {
-                errTitle = LoadStr(IDS_ERRORCOMPRESSING);
-                if (error == ERROR_INVALID_FUNCTION)
-                    showCompressErr = TRUE; // not supported
-            }
+            TRACE_E("CTreeOpsProcessor::StartBatch(): unable to start helper thread."); // staci mene threadu
+            break;
         }
-        if (error == ERROR_SUCCESS && changeEncryption && (attrs & FILE_ATTRIBUTE_ENCRYPTED))
+        SetThreadPriority(Helpers[i], GetThreadPriority(GetCurrentThread()));
+        started++;
+    }
+    if (started == 0) // nikdo by davku nezpracoval
+    {
+        Batch.Reset();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void CTreeOpsProcessor::FinishBatch()
+{
+    Stop = TRUE;
+    int i;
+    for (i = 0; i < TREEOPS_THREADS; i++)
+    {
+        if (Helpers[i] != NULL)
         {
-            BOOL cancelOper = FALSE;
-            error = MyEncryptFile(hProgressDlg, name, fileAttr, attrs, dlgData, cancelOper, TRUE);
-            if (*dlgData.CancelWorker || cancelOper)
-                return FALSE;
-            if (error != ERROR_SUCCESS)
-            {
-                errTitle = LoadStr(IDS_ERRORENCRYPTING);
-                if (error == ERROR_INVALID_FUNCTION)
-                    showEncryptErr = TRUE; // not supported
-            }
+            WaitForSingleObject(Helpers[i], INFINITE);
+            HANDLES(CloseHandle(Helpers[i]));
+            Helpers[i] = NULL;
         }
-        if (showCompressErr || showEncryptErr)
-        {
-            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
-            if (*dlgData.CancelWorker)
-                return FALSE;
+    }
+    Batch.Reset();
+}
 
-            if (showCompressErr)
-                changeCompression = FALSE;
-            if (showEncryptErr)
-                changeEncryption = FALSE;
-            char* data[3];
-            data[0] = LoadStr((showCompressErr && (attrs & FILE_ATTRIBUTE_COMPRESSED) || !showEncryptErr) ? IDS_ERRORCOMPRESSING : IDS_ERRORENCRYPTING);
-            data[1] = name;
-            data[2] = LoadStr((showCompressErr && (attrs & FILE_ATTRIBUTE_COMPRESSED) || !showEncryptErr) ? IDS_COMPRNOTSUPPORTED : IDS_ENCRYPNOTSUPPORTED);
-            SendMessage(hProgressDlg, WM_USER_DIALOG, 5, (LPARAM)data);
-            error = ERROR_SUCCESS;
-        }
-        if (error == ERROR_SUCCESS && SetFileAttributes(nameSetAttrs, attrs))
+BOOL CTreeOpsProcessor::WaitForItem(int i)
+{
+    int index = i - First;
+    while (!Batch.IsFinished(index)) // pomocne thready zpracuji vsechny polozky (i po cancelu), cekani je konecne
+        WaitForSingleObject(ItemFinished, INFINITE);
+    return Batch.GetItem(index)->State == tbsDone;
+}
+
+void CTreeOpsProcessor::HelperBody()
+{
+    int index;
+    while ((index = Batch.TakeNext()) != -1)
+    {
+        BOOL done = FALSE;
+        if (!Stop)
+            WaitForSingleObject(DlgData->WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
+        if (!Stop && !*DlgData->CancelWorker)
         {
-            BOOL isDir = ((attrs & FILE_ATTRIBUTE_DIRECTORY) != 0);
-            // pokud mame nastavit jeden z casu
-            if (timeModified != NULL || timeCreated != NULL || timeAccessed != NULL)
+            BOOL fallback = FALSE;
+            if (Batch.GetItem(index)->IsDir)
             {
-                HANDLE file;
-                if (attrs & FILE_ATTRIBUTE_READONLY)
-                    SetFileAttributes(nameSetAttrs, attrs & (~FILE_ATTRIBUTE_READONLY));
-                file = HANDLES_Q(CreateFile(nameSetAttrs, GENERIC_READ | GENERIC_WRITE,
-                                            FILE_SHARE_READ | FILE_SHARE_WRITE,
-                                            NULL, OPEN_EXISTING, isDir ? FILE_FLAG_BACKUP_SEMANTICS : 0, NULL));
-                if (file != INVALID_HANDLE_VALUE)
-                {
-                    FILETIME ftCreated, ftAccessed, ftModified;
-                    GetFileTime(file, &ftCreated, &ftAccessed, &ftModified);
-                    if (timeCreated != NULL)
-                        ftCreated = *timeCreated;
-                    if (timeAccessed != NULL)
-                        ftAccessed = *timeAccessed;
-                    if (timeModified != NULL)
-                        ftModified = *timeModified;
-                    SetFileTime(file, &ftCreated, &ftAccessed, &ftModified);
-                    HANDLES(CloseHandle(file));
-                    if (attrs & FILE_ATTRIBUTE_READONLY)
-                        SetFileAttributes(nameSetAttrs, attrs);
-                }
-                else
-                {
-                    if (attrs & FILE_ATTRIBUTE_READONLY)
-                        SetFileAttributes(nameSetAttrs, attrs);
-                    goto SHOW_ERROR;
-                }
+                // obsah adresare zpracovavaji (nebo uz zpracovaly) ostatni thready, polozky se berou
+                // v poradi davky, takze cekani je konecne
+                while (!Batch.AreChildrenFinished(index, &fallback))
+                    WaitForSingleObject(DirWait, TREEOPS_DIR_WAIT);
             }
-            totalDone += size;
-            SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
-            return TRUE;
+            // adresar, ve kterem neco zustalo (zpracuje ho worker), smazat nejde
+            done = !fallback && ProcessQuietly(&Views[index].Op);
         }
-        else
-        {
-        SHOW_ERROR:
-
-            if (error == ERROR_SUCCESS)
-                error = GetLastError();
-            if (errTitle == NULL)
-                errTitle = LoadStr(IDS_ERRORCHANGINGATTRS);
-
-            WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
-            if (*dlgData.CancelWorker)
-                return FALSE;
-
-            if (dlgData.SkipAllChangeAttrs)
-                goto SKIP_ATTRS_ERROR;
+        Batch.Finish(index, done);
+        SetEvent(ItemFinished);
+        SetEvent(DirWait);
+    }
+}
 
-            int ret;
-            ret = IDCANCEL;
-            char* data[4];
-            data[0] = (char*)&ret;
-            data[1] = errTitle;
-            data[2] = name;
-            data[3] = GetErrorText(error);
-            SendMessage(hProgressDlg, WM_USER_DIALOG, 0, (LPARAM)data);
-            switch (ret)
-            {
-            case IDRETRY:
-                break;
+BOOL CTreeOpsProcessor::ProcessQuietly(COperation* op)
+{
+    // pokud cesta konci mezerou/teckou, musime pripojit '\\', jinak RemoveDirectory
+    // i SetFileAttributes mezery/tecky orizne a pracuje tak s jinou cestou
+    const char* name = op->SourceName;
+    char nameCopy[3 * MAX_PATH];
+    if (op->Opcode != ocDeleteFile)
+        MakeCopyWithBackslashIfNeeded(name, nameCopy);
 
-            case IDB_SKIPALL:
-                dlgData.SkipAllChangeAttrs = TRUE;
-            case IDB_SKIP:
-            {
-            SKIP_ATTRS_ERROR:
+    switch (op->Opcode)
+    {
+    case ocDeleteFile:
+    {
+        ClearReadOnlyAttr(name, op->Attr); // aby sel smazat ...
+        return DeleteFile(name) != 0;
+    }
 
-                totalDone += size;
-                SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
-                return TRUE;
-            }
+    case ocDeleteDir:
+    {
+        ClearReadOnlyAttr(name, op->Attr); // aby sel smazat ...
+        return RemoveDirectory(name) != 0;
+    }
 
-            case IDCANCEL:
-                return FALSE;
-            }
-        }
+    case ocChangeAttrs:
+    {
+        return SetAttrsAndFileTimes(name, (DWORD)(DWORD_PTR)op->TargetName,
+                                    AttrsData->ChangeTimeModified ? &AttrsData->TimeModified : NULL,
+                                    AttrsData->ChangeTimeCreated ? &AttrsData->TimeCreated : NULL,
+                                    AttrsData->ChangeTimeAccessed ? &AttrsData->TimeAccessed : NULL);
     }
+    }
+    return FALSE;
 }
 
 unsigned ThreadWorkerBody(void* parameter)
@@ -7840,6 +9715,9 @@ unsigned ThreadWorkerBody(void* parameter)
         !dlgData.PrepareRecycleMasks(errorPos))
         TRACE_E("Error in recycle-bin group mask.");
     COperations* script = data->Script;
+    TDirectArray<CScriptOp>* ops = script->GetWorkerOps(); // pri streamovani skriptu jen operace, ktere uz hl. thread predal
+    BOOL streamed = script->IsStreamStarted();
+    BOOL buildFailed = FALSE;
     if (script->TotalSize == CQuadWord(0, 0))
     {
         script->TotalSize = CQuadWord(1, 0); // proti deleni nulou
@@ -7898,10 +9776,24 @@ unsigned ThreadWorkerBody(void* parameter)
         char opChangAttrs[50];
         lstrcpyn(opChangAttrs, LoadStr(IDS_CHANGINGATTRS), 50);
 
+        // soubezne kopirovani malych souboru (jen pokud si ho user zapnul)
+        CSmallFilesCopier* smallCopier = NULL;
+        if (Configuration.CopySmallFilesConcurrently && !Configuration.VerifyCopiedFiles) // pomocne thready kopie neoveruji
+            smallCopier = new CSmallFilesCopier(&dlgData, clearReadonlyMask);
+
+        // soubezne mazani a zmena atributu (jen pokud si ho user nevypnul)
+        CTreeOpsProcessor* treeOps = NULL;
+        if (Configuration.DeleteAndChangeAttrsConcurrently)
+            treeOps = new CTreeOpsProcessor(&dlgData, script, bufferIsAllocated ? NULL : attrsData);
+
+        CScriptOpView opView; // prave provadena operace rozbalena ze skriptu
         int i;
-        for (i = 0; !*dlgData.CancelWorker && i < script->Count; i++)
+        for (i = 0; !*dlgData.CancelWorker &&
+                    (i < ops->Count || streamed && script->WaitForStreamedOps(i, dlgData.CancelWorker, &buildFailed));
+             i++)
         {
-            COperation* op = &script->At(i);
+            script->GetOperation(&ops->At(i), &opView);
+            COperation* op = &opView.Op;
 
             switch (op->Opcode)
             {
@@ -7915,6 +9807,19 @@ unsigned ThreadWorkerBody(void* parameter)
 
                 SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
 
+                if (smallCopier != NULL && !smallCopier->IsInBatch(i))
+                    smallCopier->StartBatch(script, ops, i, lastLantasticCheckRoot, lastIsLantasticPath);
+                if (smallCopier != NULL && smallCopier->IsInBatch(i) && smallCopier->WaitForItem(i))
+                { // soubor uz zkopiroval pomocny thread, zbyva jen progress (stejne jako v DoCopyFile)
+                    script->AddBytesToSpeedMetersAndTFSandPS(op->FileSize.LoDWord, FALSE, OPERATION_BUFFER);
+                    if (op->FileSize < COPY_MIN_FILE_SIZE) // nulove/male soubory trvaji aspon jako soubory s velikosti COPY_MIN_FILE_SIZE
+                        script->AddBytesToSpeedMetersAndTFSandPS((DWORD)(COPY_MIN_FILE_SIZE - op->FileSize).Value, TRUE, 0, NULL, MAX_OP_FILESIZE);
+                    totalDone += op->Size;
+                    script->SetProgressSize(totalDone);
+                    SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
+                    break;
+                }
+
                 BOOL lantasticCheck = IsLantasticDrive(op->TargetName, lastLantasticCheckRoot, lastIsLantasticPath);
 
                 Error = !DoCopyFile(op, hProgressDlg, buffer, script, totalDone,
@@ -7974,17 +9879,18 @@ unsigned ThreadWorkerBody(void* parameter)
                         // preskocime vsechny operace skriptu az do znacky uzavreni tohoto adresare
                         CQuadWord skipTotal(0, 0);
                         int createDirIndex = i;
-                        while (++i < script->Count)
+                        while (++i < ops->Count ||
+                               streamed && script->WaitForStreamedOps(i, dlgData.CancelWorker, &buildFailed))
                         {
-                            COperation* oper = &script->At(i);
+                            CScriptOp* oper = &ops->At(i);
                             if (oper->Opcode == ocLabelForSkipOfCreateDir && (int)oper->Attr == createDirIndex)
                             {
-                                script->AddBytesToTFS(CQuadWord((DWORD)(DWORD_PTR)oper->SourceName, (DWORD)(DWORD_PTR)oper->TargetName));
+                                script->AddBytesToTFS(CQuadWord(oper->Source.Leaf, oper->Target.Leaf));
                                 break;
                             }
                             skipTotal += oper->Size;
                         }
-                        if (i == script->Count)
+                        if (i >= ops->Count)
                         {
                             i = createDirIndex;
                             TRACE_E("ThreadWorkerBody(): unable to find end-label for dir-create operation: opcode=" << op->Opcode << ", index=" << i);
@@ -7994,10 +9900,10 @@ unsigned ThreadWorkerBody(void* parameter)
                     }
                     else
                     {
-                        if (alreadyExisted)
-                            op->Attr = 0x10000000 /* dir already existed */;
+                        if (alreadyExisted) // do skriptu, cte se u ocCopyDirTime
+                            ops->At(i).Attr = 0x10000000 /* dir already existed */;
                         else
-                            op->Attr = 0x01000000 /* dir was created */;
+                            ops->At(i).Attr = 0x01000000 /* dir was created */;
                     }
                     totalDone += op->Size;
                     script->SetProgressSize(totalDone);
@@ -8012,19 +9918,25 @@ unsigned ThreadWorkerBody(void* parameter)
                 // najdeme skip-label, u nej je index create-dir operace a v ni je ulozene, jestli
                 // cilovy adresar uz existoval nebo jestli jsme ho vytvareli (datum&cas se kopiruje
                 // jen pokud jsme adresar vytvareli)
-                COperation* skipLabel = NULL;
-                if (i + 1 < script->Count && script->At(i + 1).Opcode == ocLabelForSkipOfCreateDir)
-                    skipLabel = &script->At(i + 1);
+                CScriptOp* skipLabel = NULL;
+                if ((i + 1 < ops->Count || streamed && script->WaitForStreamedOps(i + 1, dlgData.CancelWorker, &buildFailed)) &&
+                    ops->At(i + 1).Opcode == ocLabelForSkipOfCreateDir)
+                {
+                    skipLabel = &ops->At(i + 1);
+                }
                 else
                 {
-                    if (i + 2 < script->Count && script->At(i + 2).Opcode == ocLabelForSkipOfCreateDir)
-                        skipLabel = &script->At(i + 2);
+                    if ((i + 2 < ops->Count || streamed && script->WaitForStreamedOps(i + 2, dlgData.CancelWorker, &buildFailed)) &&
+                        ops->At(i + 2).Opcode == ocLabelForSkipOfCreateDir)
+                    {
+                        skipLabel = &ops->At(i + 2);
+                    }
                 }
                 if (skipLabel != NULL)
                 {
-                    if (skipLabel->Attr < (DWORD)script->Count)
+                    if (skipLabel->Attr < (DWORD)ops->Count)
                     {
-                        COperation* crDir = &script->At(skipLabel->Attr);
+                        CScriptOp* crDir = &ops->At(skipLabel->Attr);
                         if (crDir->Opcode == ocCreateDir && (crDir->OpFlags & OPFL_AS_ENCRYPTED) == 0)
                         {
                             if (crDir->Attr == 0x10000000 /* dir already existed */)
@@ -8036,7 +9948,7 @@ unsigned ThreadWorkerBody(void* parameter)
                             }
                         }
                         else
-                            TRACE_E("ThreadWorkerBody(): unexpected opcode or flags of create-dir operation! Opcode=" << crDir->Opcode << ", OpFlags=" << crDir->OpFlags);
+                            TRACE_E("ThreadWorkerBody(): unexpected opcode or flags of create-dir operation! Opcode=" << (int)crDir->Opcode << ", OpFlags=" << (int)crDir->OpFlags);
                     }
                     else
                         TRACE_E("ThreadWorkerBody(): unexpected index of create-dir operation! index=" << skipLabel->Attr);
@@ -8081,6 +9993,17 @@ unsigned ThreadWorkerBody(void* parameter)
 
                 SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
 
+                if (treeOps != NULL && op->Opcode != ocDeleteDirLink && !treeOps->IsInBatch(i))
+                    treeOps->StartBatch(ops, i);
+                if (treeOps != NULL && treeOps->IsInBatch(i) && treeOps->WaitForItem(i))
+                { // operaci uz provedl pomocny thread, zbyva jen progress (stejne jako v DoDeleteFile a DoDeleteDir)
+                    if (op->Opcode == ocDeleteDir)
+                        script->AddBytesToSpeedMetersAndTFSandPS((DWORD)op->Size.Value, TRUE, 0, NULL, MAX_OP_FILESIZE);
+                    totalDone += op->Size;
+                    SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
+                    break;
+                }
+
                 if (op->Opcode == ocDeleteFile)
                 {
                     Error = !DoDeleteFile(hProgressDlg, op->SourceName, op->Size,
@@ -8142,6 +10065,15 @@ unsigned ThreadWorkerBody(void* parameter)
 
                 SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
 
+                if (treeOps != NULL && !treeOps->IsInBatch(i))
+                    treeOps->StartBatch(ops, i);
+                if (treeOps != NULL && treeOps->IsInBatch(i) && treeOps->WaitForItem(i))
+                { // atributy uz nastavil pomocny thread, zbyva jen progress (stejne jako v DoChangeAttrs)
+                    totalDone += op->Size;
+                    SetProgress(hProgressDlg, 0, CaclProg(totalDone, script->TotalSize), dlgData);
+                    break;
+                }
+
                 Error = !DoChangeAttrs(hProgressDlg, op->SourceName, op->Size, (DWORD)(DWORD_PTR)op->TargetName,
                                        script, totalDone,
                                        attrsData->ChangeTimeModified ? &attrsData->TimeModified : NULL,
@@ -8159,13 +10091,19 @@ unsigned ThreadWorkerBody(void* parameter)
                 break;
             WaitForSingleObject(dlgData.WorkerNotSuspended, INFINITE); // pokud mame byt v suspend-modu, cekame ...
         }
-        if (!Error && !*dlgData.CancelWorker && i == script->Count && totalDone != script->TotalSize &&
+        if (smallCopier != NULL)
+            delete smallCopier; // pocka na dobehnuti pomocnych threadu
+        if (treeOps != NULL)
+            delete treeOps; // pocka na dobehnuti pomocnych threadu
+        if (buildFailed)
+            Error = TRUE; // stavba skriptu byla prerusena, operace neni kompletni
+        if (!Error && !*dlgData.CancelWorker && i == ops->Count && totalDone != script->TotalSize &&
             (totalDone != CQuadWord(0, 0) || script->TotalSize != CQuadWord(1, 0))) // umyslna zmena script->TotalSize na jednicku (opatreni proti deleni nulou)
         {
             TRACE_E("ThreadWorkerBody(): operation done: totalDone != script->TotalSize (" << totalDone.Value << " != " << script->TotalSize.Value << ")");
         }
         CQuadWord transferredFileSize, progressSize;
-        if (!Error && !*dlgData.CancelWorker && i == script->Count &&
+        if (!Error && !*dlgData.CancelWorker && i == ops->Count &&
             script->GetTFSandProgressSize(&transferredFileSize, &progressSize) &&
             (transferredFileSize != script->TotalFileSize ||
              progressSize != script->TotalSize &&
@@ -8188,6 +10126,9 @@ unsigned ThreadWorkerBody(void* parameter)
         free(tgtBuffer);
     if (bufferIsAllocated)
         free(buffer);
+    if (streamed)
+        script->WaitForStreamEnd();                 // dokud hl. thread stavi skript, nesmime ho uvolnit
+    script->DumpTelemetry();                        // pomocne thready uz dobehly, namerene faze kopirovani jsou kompletni
     *dlgData.CancelWorker = Error;                  // pokud jde o Cancel, dame to najevo ...
     SendMessage(hProgressDlg, WM_COMMAND, IDOK, 0); // koncime ...
     WaitForSingleObject(wContinue, INFINITE);       // potrebujeme zastavit hl.thread
@@ -8274,14 +10215,10 @@ void FreeScript(COperations* script)
 {
     if (script == NULL)
         return;
-    int i;
-    for (i = 0; i < script->Count; i++)
+    // jmena operaci uvolni destruktor skriptu (jsou v arene script->Names)
+    if (script->Count > 0)
     {
-        COperation* op = &script->At(i);
-        if (op->SourceName != NULL && op->Opcode != ocCopyDirTime && op->Opcode != ocLabelForSkipOfCreateDir)
-            free(op->SourceName);
-        if (op->TargetName != NULL && op->Opcode != ocChangeAttrs && op->Opcode != ocLabelForSkipOfCreateDir)
-            free(op->TargetName);
+        TRACE_I("FreeScript(): " << script->Count << " operations, " << (script->Count * sizeof(CScriptOp) / 1024) << " KB of records, " << (script->GetNamesSize() / 1024) << " KB of names");
     }
     if (script->WaitInQueueSubject != NULL)
         free(script->WaitInQueueSubject);
@@ -8292,91 +10229,175 @@ void FreeScript(COperations* script)
     delete script;
 }
 
-BOOL COperationsQueue::AddOperation(HWND dlg, BOOL startOnIdle, BOOL* startPaused)
+// zjisti klice fyzickych zarizeni (pro CDeviceScheduler), na kterych lezi cesta 'path': sitove
+// cesty -> "\\server", lokalni svazky -> "diskN" (svazek na vice discich vraci vice klicu), jinak
+// GUID svazku nebo root cesty; klice uklada do 'keys' (max. 'maxKeys'), max. pocty soubeznych
+// operaci na zarizenich do 'limits'; vraci pocet klicu
+int GetPathDeviceKeys(const char* path, char (*keys)[DEVSCHED_MAX_KEY], int* limits, int maxKeys)
+{
+    CALL_STACK_MESSAGE2("GetPathDeviceKeys(%s, , ,)", path);
+    if (path == NULL || *path == 0 || maxKeys <= 0)
+        return 0;
+
+    char root[MAX_PATH];
+    GetRootPath(root, path);
+    char remote[MAX_PATH];
+    remote[0] = 0;
+    if (IsUNCPath(root))
+        lstrcpyn(remote, root, MAX_PATH);
+    else
+    {
+        if (GetDriveType(root) == DRIVE_REMOTE)
+        {
+            char drive[3];
+            drive[0] = root[0];
+            drive[1] = ':';
+            drive[2] = 0;
+            DWORD size = MAX_PATH;
+            if (WNetGetConnection(drive, remote, &size) != NO_ERROR)
+                lstrcpyn(remote, root, MAX_PATH); // server nezname, rozlisime aspon mapovane disky
+        }
+    }
+    if (remote[0] != 0) // sitova cesta: zarizeni je server (sdileni jednoho serveru se deli o jeho linku a disky)
+    {
+        if (remote[0] == '\\' && remote[1] == '\\')
+        {
+            char* s = remote + 2;
+            while (*s != 0 && *s != '\\')
+                s++;
+            *s = 0;
+        }
+        lstrcpyn(keys[0], remote, DEVSCHED_MAX_KEY);
+        limits[0] = DEVSCHED_LIMIT_NETWORK;
+        return 1;
+    }
+
+    int count = 0;
+    char guidPath[MAX_PATH];
+    if (GetResolvedPathMountPointAndGUID(path, NULL, guidPath))
+    {
+        SalPathRemoveBackslash(guidPath); // CreateFile vadi zpetne lomitko za svazkem
+        BOOL seekPenalty = TRUE;
+        if (!QueryVolumeSeekPenalty(guidPath, &seekPenalty))
+            seekPenalty = TRUE; // nezname, radsi se chovame jako k rotacnimu disku
+        int limit = seekPenalty ? DEVSCHED_LIMIT_HDD : DEVSCHED_LIMIT_SSD;
+
+        HANDLE hVolume = HANDLES_Q(CreateFile(guidPath, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                              OPEN_EXISTING, 0, NULL));
+        if (hVolume != INVALID_HANDLE_VALUE)
+        {
+            union
+            {
+                VOLUME_DISK_EXTENTS Extents;
+                BYTE Buffer[sizeof(VOLUME_DISK_EXTENTS) + (DEVSCHED_MAX_JOB_DEVICES - 1) * sizeof(DISK_EXTENT)];
+            } ext;
+            DWORD bytesReturned = 0;
+            if (DeviceIoControl(hVolume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, NULL, 0,
+                                &ext, sizeof(ext), &bytesReturned, NULL))
+            {
+                DWORD i;
+                for (i = 0; i < ext.Extents.NumberOfDiskExtents && count < maxKeys; i++)
+                {
+                    sprintf(keys[count], "disk%u", ext.Extents.Extents[i].DiskNumber);
+                    limits[count++] = limit;
+                }
+            }
+            else
+            {
+                DWORD err = GetLastError();
+                TRACE_I("GetPathDeviceKeys(): unable to get disk extents of volume " << guidPath << ". Err=" << err);
+            }
+            HANDLES(CloseHandle(hVolume));
+        }
+        if (count == 0) // disky svazku nezname, zarizenim je aspon svazek
+        {
+            lstrcpyn(keys[0], guidPath, DEVSCHED_MAX_KEY);
+            limits[0] = limit;
+            count = 1;
+        }
+    }
+    else
+    {
+        lstrcpyn(keys[0], root, DEVSCHED_MAX_KEY);
+        limits[0] = DEVSCHED_LIMIT_UNKNOWN;
+        count = 1;
+    }
+    return count;
+}
+
+BOOL COperationsQueue::AddOperation(HWND dlg, BOOL startOnIdle, const char* sourcePath,
+                                    const char* targetPath, BOOL* startPaused)
 {
     CALL_STACK_MESSAGE1("COperationsQueue::AddOperation()");
 
+    // zarizeni zjistujeme mimo kritickou sekci (sahame na disky a sit)
+    char keys[DEVSCHED_MAX_JOB_DEVICES][DEVSCHED_MAX_KEY];
+    int limits[DEVSCHED_MAX_JOB_DEVICES];
+    int keysCount = 0;
+    if (Configuration.QueueOperationsByDevice)
+    {
+        keysCount = GetPathDeviceKeys(sourcePath, keys, limits, DEVSCHED_MAX_JOB_DEVICES);
+        keysCount += GetPathDeviceKeys(targetPath, keys + keysCount, limits + keysCount,
+                                       DEVSCHED_MAX_JOB_DEVICES - keysCount);
+    }
+
     HANDLES(EnterCriticalSection(&QueueCritSect));
 
+    int devices[DEVSCHED_MAX_JOB_DEVICES];
     int i;
-    for (i = 0; i < OperDlgs.Count; i++) // zajistime unikatnost (operace muze byt pridana jen jednou)
-        if (OperDlgs[i] == dlg)
-            break;
+    for (i = 0; i < keysCount; i++)
+        devices[i] = Scheduler.GetDevice(keys[i], limits[i]);
 
     BOOL ret = FALSE;
-    if (i == OperDlgs.Count) // operaci je mozne pridat
+    if (Scheduler.AddJob((DWORD_PTR)dlg, devices, keysCount, startOnIdle))
     {
-        OperDlgs.Add(dlg);
-        if (OperDlgs.IsGood())
+        ret = TRUE;
+        TDirectArray<DWORD_PTR> started(5, 10);
+        Scheduler.Schedule(&started);
+        for (i = 0; i < started.Count; i++) // nova operace se spousti sama (startPaused), "resume" postneme jen jinym
         {
-            if (startOnIdle)
-            {
-                int j;
-                for (j = 0; j < OperPaused.Count && OperPaused[j] == 1 /* auto-paused */; j++)
-                    ; // pokud jiz nejaka operace bezi nebo byla rucne pausnuta, startujeme tuto operaci jako "auto-paused"
-                *startPaused = j < OperPaused.Count;
-            }
-            else
-                *startPaused = FALSE;
-            OperPaused.Add(*startPaused ? 1 /* auto-paused */ : 0 /* running */);
-            if (!OperPaused.IsGood())
+            if (started[i] == (DWORD_PTR)dlg)
             {
-                OperPaused.ResetState();
-                OperDlgs.Delete(OperDlgs.Count - 1);
-                if (!OperDlgs.IsGood())
-                    OperDlgs.ResetState();
+                started.Delete(i);
+                break;
             }
-            else
-                ret = TRUE;
         }
-        else
-            OperDlgs.ResetState();
+        *startPaused = Scheduler.GetJobState((DWORD_PTR)dlg) != djsRunning;
+        ResumeStarted(&started, NULL, NULL);
     }
-    else
-        TRACE_E("COperationsQueue::AddOperation(): this operation has already been added!");
 
     HANDLES(LeaveCriticalSection(&QueueCritSect));
 
     return ret;
 }
 
+void COperationsQueue::ResumeStarted(TDirectArray<DWORD_PTR>* started, HWND dlg, HWND* foregroundWnd)
+{
+    int i;
+    for (i = 0; i < started->Count; i++)
+    {
+        HWND operDlg = (HWND)started->At(i);
+        PostMessage(operDlg, WM_COMMAND, CM_RESUMEOPER, 0);
+        if (i == 0 && foregroundWnd != NULL && GetForegroundWindow() == dlg)
+            *foregroundWnd = operDlg;
+    }
+}
+
 void COperationsQueue::OperationEnded(HWND dlg, BOOL doNotResume, HWND* foregroundWnd)
 {
     CALL_STACK_MESSAGE1("COperationsQueue::OperationEnded()");
 
     HANDLES(EnterCriticalSection(&QueueCritSect));
 
-    BOOL found = FALSE;
-    int i;
-    for (i = 0; i < OperDlgs.Count; i++)
-    {
-        if (OperDlgs[i] == dlg)
-        {
-            found = TRUE;
-            OperDlgs.Delete(i);
-            if (!OperDlgs.IsGood())
-                OperDlgs.ResetState();
-            OperPaused.Delete(i);
-            if (!OperPaused.IsGood())
-                OperPaused.ResetState();
-            break;
-        }
-    }
-    if (!found)
+    if (!Scheduler.RemoveJob((DWORD_PTR)dlg))
         TRACE_E("COperationsQueue::OperationEnded(): unexpected situation: operation was not found!");
     else
     {
-        if (!doNotResume)
+        if (!doNotResume) // resumneme operace, ktere muzou bezet na uvolnenych zarizenich
         {
-            int j;
-            for (j = 0; j < OperPaused.Count && OperPaused[j] == 1 /* auto-paused */; j++)
-                ; // pokud nebezi zadna operace ani nebyla zadna operace rucne pausnuta, resumneme prvni operaci ve fronte
-            if (j == OperPaused.Count && OperDlgs.Count > 0)
-            {
-                PostMessage(OperDlgs[0], WM_COMMAND, CM_RESUMEOPER, 0);
-                if (foregroundWnd != NULL && GetForegroundWindow() == dlg)
-                    *foregroundWnd = OperDlgs[0];
-            }
+            TDirectArray<DWORD_PTR> started(5, 10);
+            Scheduler.Schedule(&started);
+            ResumeStarted(&started, dlg, foregroundWnd);
         }
     }
 
@@ -8389,17 +10410,12 @@ void COperationsQueue::SetPaused(HWND dlg, int paused)
 
     HANDLES(EnterCriticalSection(&QueueCritSect));
 
-    int i;
-    for (i = 0; i < OperDlgs.Count; i++)
+    // rucne pausnuta operace si zarizeni drzi (uzivatel ji muze kdykoliv resumnout)
+    if (!Scheduler.SetJobState((DWORD_PTR)dlg, paused == 2 ? djsPaused : paused == 1 ? djsWaiting
+                                                                                      : djsRunning))
     {
-        if (OperDlgs[i] == dlg)
-        {
-            OperPaused[i] = paused;
-            break;
-        }
-    }
-    if (i == OperDlgs.Count)
         TRACE_E("COperationsQueue::SetPaused(): operation was not found!");
+    }
 
     HANDLES(LeaveCriticalSection(&QueueCritSect));
 }
@@ -8409,7 +10425,7 @@ BOOL COperationsQueue::IsEmpty()
     CALL_STACK_MESSAGE1("COperationsQueue::IsEmpty()");
 
     HANDLES(EnterCriticalSection(&QueueCritSect));
-    BOOL ret = OperDlgs.Count == 0;
+    BOOL ret = Scheduler.GetJobsCount() == 0;
     HANDLES(LeaveCriticalSection(&QueueCritSect));
     return ret;
 }
@@ -8420,34 +10436,13 @@ void COperationsQueue::AutoPauseOperation(HWND dlg, HWND* foregroundWnd)
 
     HANDLES(EnterCriticalSection(&QueueCritSect));
 
-    int i;
-    for (i = 0; i < OperDlgs.Count; i++)
-    {
-        if (OperDlgs[i] == dlg)
-        {
-            int j;
-            for (j = i; j + 1 < OperDlgs.Count; j++)
-                OperDlgs[j] = OperDlgs[j + 1];
-            for (j = i; j + 1 < OperPaused.Count; j++)
-                OperPaused[j] = OperPaused[j + 1];
-            OperDlgs[j] = dlg;
-            OperPaused[j] = 1 /* auto-paused */;
-            break;
-        }
-    }
-    if (i == OperDlgs.Count)
+    if (!Scheduler.MoveJobToEnd((DWORD_PTR)dlg, TRUE /* pocka az nic jineho nepobezi */))
         TRACE_E("COperationsQueue::AutoPauseOperation(): operation was not found!");
 
-    // pokud nebezi zadna operace ani nebyla zadna operace rucne pausnuta, resumneme prvni operaci ve fronte
-    int j;
-    for (j = 0; j < OperPaused.Count && OperPaused[j] == 1 /* auto-paused */; j++)
-        ;
-    if (j == OperPaused.Count && OperDlgs.Count > 0)
-    {
-        PostMessage(OperDlgs[0], WM_COMMAND, CM_RESUMEOPER, 0);
-        if (foregroundWnd != NULL && GetForegroundWindow() == dlg)
-            *foregroundWnd = OperDlgs[0];
-    }
+    // resumneme operace, ktere muzou bezet misto pausnute operace
+    TDirectArray<DWORD_PTR> started(5, 10);
+    Scheduler.Schedule(&started);
+    ResumeStarted(&started, dlg, foregroundWnd);
 
     HANDLES(LeaveCriticalSection(&QueueCritSect));
 }
@@ -8457,7 +10452,7 @@ int COperationsQueue::GetNumOfOperations()
     CALL_STACK_MESSAGE1("COperationsQueue::GetNumOfOperations()");
 
     HANDLES(EnterCriticalSection(&QueueCritSect));
-    int c = OperDlgs.Count;
+    int c = Scheduler.GetJobsCount();
     HANDLES(LeaveCriticalSection(&QueueCritSect));
     return c;
 }
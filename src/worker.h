@@ -24,6 +24,10 @@
 #define ASYNC_COPY_BUF_SIZE_2MB (256 * 1024)   // 256KB buffer pro soubory do 2MB
 #define ASYNC_COPY_BUF_SIZE_8MB (512 * 1024)   // 512KB buffer pro soubory do 8MB
 #define ASYNC_COPY_BUF_SIZE (1024 * 1024)      // maximalni velikost bufferu pro asynchronni copy (podle Explorera max. 1MB); POZOR: musi byt >= nez RETRYCOPY_TAIL_MINSIZE
+#define ASYNC_COPY_BLOCKS 8                    // number of blocks (queue depth) of the asynchronous copy, see tools/copybench; WARNING: must be <= COPYENGINE_MAX_BLOCKS
+#define ASYNC_COPY_MAX_BLOCKS 16               // max. pocet bloku, na ktery muze CCopyTuner zvysit ASYNC_COPY_BLOCKS (buffery se alokuji az pri zvyseni); POZOR: musi byt <= COPYENGINE_MAX_BLOCKS
+#define ASYNC_COPY_MIN_BUF_SIZE (32 * 1024)    // min. velikost bloku, na kterou muze CCopyTuner snizit velikost bufferu pro asynchronni copy
+#define ASYNC_COPY_TUNERS 4                    // pocet dvojic zdroj/cil, pro ktere si worker pamatuje naucenou velikost bloku a pocet bloku
 #define ASYNC_SLOW_COPY_BUF_SIZE (8 * 1024)    // 8KB buffer pro pomale kopirovani (hlavne sitove disky pres VPN)
 #define ASYNC_SLOW_COPY_BUF_MINBLOCKS 12
 
@@ -223,7 +227,129 @@ struct COperation
     DWORD OpFlags; // kombinace OPFL_xxx, viz vyse
 };
 
-class COperations : public TDirectArray<COperation>
+//
+// ****************************************************************************
+// CScriptNames
+//
+// kompaktni ulozeni jmen operaci skriptu: jmeno je dvojice adresar + posledni slozka (list),
+// adresare tvori strom sdilenych prefixu (adresar = rodic + slozka), retezce slozek a listu
+// lezi v arene z velkych bloku (zadna samostatna alokace pro kazde jmeno); bloky se nikdy
+// nerealokuji, takze worker muze cist uz predana jmena, zatimco hl. thread pridava dalsi
+
+#define SCRIPTNAMES_CHUNK_SIZE (1024 * 1024) // velikost bloku areny retezcu (nejdelsi retezec je < MAX_PATH)
+#define SCRIPTNAMES_MAX_CHUNKS 4096          // max. pocet bloku areny retezcu (offset retezce je DWORD)
+#define SCRIPTDIRS_CHUNK_SIZE 65536          // pocet adresaru v jednom bloku
+#define SCRIPTDIRS_MAX_CHUNKS 4096           // max. pocet bloku adresaru
+#define SCRIPTNAME_NODIR 0xFFFFFFFF          // CScriptName::Dir / CScriptDir::Parent: bez adresare (retezec neobsahuje zadny backslash)
+#define SCRIPTNAME_VALUE 0xFFFFFFFE          // CScriptName::Dir: nejde o jmeno, v Leaf je primo hodnota (viz COperationCode)
+
+struct CScriptName
+{
+    DWORD Dir;  // index adresare v CScriptNames, SCRIPTNAME_NODIR nebo SCRIPTNAME_VALUE
+    DWORD Leaf; // offset retezce listu v arene (pri SCRIPTNAME_VALUE primo hodnota, 0 = NULL)
+};
+
+struct CScriptDir
+{
+    DWORD Parent; // index rodicovskeho adresare nebo SCRIPTNAME_NODIR
+    DWORD Name;   // offset retezce slozky v arene
+};
+
+class CScriptNames
+{
+protected:
+    char* Chunks[SCRIPTNAMES_MAX_CHUNKS]; // bloky areny retezcu
+    int ChunksCount;                      // pocet alokovanych bloku areny
+    DWORD ChunkUsed;                      // kolik bytu posledniho bloku je obsazeno
+
+    CScriptDir* DirChunks[SCRIPTDIRS_MAX_CHUNKS]; // bloky adresaru
+    DWORD DirsCount;                              // pocet adresaru
+
+    // jen pro hl. thread (stavba skriptu): hash tabulka adresaru (rodic + slozka) s otevrenym
+    // adresovanim, prazdne misto je SCRIPTNAME_NODIR
+    DWORD* DirHash;
+    DWORD DirHashSize; // vzdy mocnina dvou
+
+    // jen pro hl. thread: posledni pridany adresar (soubory jednoho adresare jdou ve skriptu za sebou)
+    char LastDir[MAX_PATH];
+    int LastDirLen; // -1 = zadny
+    DWORD LastDirIndex;
+
+public:
+    CScriptNames();
+    ~CScriptNames();
+
+    // hl. thread: ulozi jmeno 'name' (NULL se uklada jako hodnota 0); je-li 'isValue' TRUE, jde
+    // o hodnotu ulozenou misto jmena (viz COperationCode); vraci FALSE pri nedostatku pameti
+    BOOL Add(const char* name, BOOL isValue, CScriptName* res);
+
+    // vrati jmeno 'name' slozene do 'buf' (velikost MAX_PATH); u hodnot a NULL vraci primo
+    // hodnotu pretypovanou na ukazatel (jako byla ulozena v COperation); volani mozne
+    // z libovolneho threadu (jen pro uz predana jmena)
+    char* Get(const CScriptName& name, char* buf) const;
+
+    // vraci velikost pameti alokovane pro jmena (pro TRACE)
+    DWORD_PTR GetAllocatedSize() const;
+
+protected:
+    const char* GetStr(DWORD offset) const { return Chunks[offset / SCRIPTNAMES_CHUNK_SIZE] + offset % SCRIPTNAMES_CHUNK_SIZE; }
+    CScriptDir* GetDir(DWORD index) const { return DirChunks[index / SCRIPTDIRS_CHUNK_SIZE] + index % SCRIPTDIRS_CHUNK_SIZE; }
+    BOOL AddStr(const char* str, int len, DWORD* offset);
+    BOOL AddDir(const char* dir, int len, DWORD* index);
+    BOOL GrowDirHash();
+};
+
+// operace ulozena ve skriptu (COperations): zaznam pevne delky, jmena v CScriptNames;
+// pro provedeni se rozbali do COperation (viz COperations::GetOperation())
+struct CScriptOp
+{
+    CQuadWord Size;
+    CQuadWord FileSize; // velikost souboru, platne jen pro ocCopyFile a ocMoveFile
+    CScriptName Source, // u hodnot (viz COperationCode) je hodnota v Source.Leaf / Target.Leaf
+        Target;
+    DWORD Attr;
+    BYTE Opcode;  // hodnota z COperationCode
+    BYTE OpFlags; // kombinace OPFL_xxx
+};
+
+// operace rozbalena ze skriptu vcetne bufferu pro jmena
+struct CScriptOpView
+{
+    COperation Op; // SourceName a TargetName ukazuji do SourceBuf a TargetBuf (u hodnot primo hodnota)
+    char SourceBuf[MAX_PATH];
+    char TargetBuf[MAX_PATH];
+};
+
+// TDirectArray, ktere roste geometricky: pred zvetsenim se Delta zvysi na polovinu poctu
+// prvku (s pevnou Deltou by se skript s miliony operaci realokoval kvadraticky)
+template <class DATA_TYPE>
+class TGrowingDirectArray : public TDirectArray<DATA_TYPE>
+{
+public:
+    TGrowingDirectArray(int base, int delta) : TDirectArray<DATA_TYPE>(base, delta) {}
+
+    int Add(const DATA_TYPE& member)
+    {
+        Grow(1);
+        return TDirectArray<DATA_TYPE>::Add(member);
+    }
+    int Add(const DATA_TYPE* members, int count)
+    {
+        Grow(count);
+        return TDirectArray<DATA_TYPE>::Add(members, count);
+    }
+
+protected:
+    void Grow(int count)
+    {
+        if (this->Count + count > this->Available && this->Delta < this->Count / 2)
+            this->Delta = this->Count / 2;
+    }
+};
+
+#define SCRIPT_STREAM_DELAY 2000 // po kolika ms stavby skriptu se zacne kopirovat (viz Configuration.CopyDuringTreeAnalysis)
+
+class COperations : public TGrowingDirectArray<CScriptOp>
 {
 public:
     CQuadWord TotalSize;      // POZOR: neni velikost souboru v bytech (je zde velikost pouzitelna jen pro progress)
@@ -234,7 +360,7 @@ public:
     DWORD BytesPerCluster;    // pro vypocet obsazeneho mista
 
     // velikosti jednotlivych souboru pro odhad pri zadane velikosti clusteru
-    TDirectArray<CQuadWord> Sizes;
+    TGrowingDirectArray<CQuadWord> Sizes;
 
     DWORD ClearReadonlyMask; // pro automaticke cisteni read-only flagu z CD-ROMu
     BOOL InvertRecycleBin;   // invertovat pouziti RecycleBinu
@@ -276,10 +402,15 @@ public:
     char WorkPath2[MAX_PATH];  // jde-li o neprazdny retezec, je to druha cesta, na ktere se pracovalo (pouziva se pro hlaseni zmen)
     BOOL WorkPath2InclSubDirs; // TRUE/FALSE = vcetne/bez podadresaru (druha cesta)
 
+    char DeviceSrcPath[MAX_PATH]; // Copy/Move: zdrojova cesta, podle ni fronta operaci urci zarizeni, ze ktereho se cte ("" = nezname)
+    char DeviceTgtPath[MAX_PATH]; // Copy/Move: cilova cesta, podle ni fronta operaci urci zarizeni, na ktere se zapisuje ("" = nezname)
+
     char* WaitInQueueSubject; // text pro stav "waiting in queue": titulek dialogu
     char* WaitInQueueFrom;    // text pro stav "waiting in queue": horni radek (From)
     char* WaitInQueueTo;      // text pro stav "waiting in queue": dolni radek (To)
 
+    CCopyTelemetry* Telemetry; // Copy/Move: mereni doby fazi kopirovani (viz Configuration.RecordCopyTelemetry), NULL = nemeri se
+
 private:
     // pro status radek v progress dialogu (jen Copy a Move)
     CRITICAL_SECTION StatusCS;              // kriticka sekce pro pristup k TransferSpeedMeter, ProgressSpeedMeter a
@@ -303,9 +434,42 @@ private:
     DWORD LastFileBlockCount;     // kolik bloku uz se prekopirovalo od zacatku posledniho souboru (POZOR: je chranene pred pretecenim, pocet > 1000000 znamena "hafo", kolik presne neni dulezite)
     DWORD LastFileStartTime;      // GetTickCount() z okamziku, kdy jsme zacali kopirovat posledni soubor
 
+    // streamovani skriptu: worker zacne provadet operace jeste behem stavby skriptu v hl. threadu;
+    // hl. thread stavi skript jako obvykle a hotove operace (kopie polozek, jmena jsou sdilena)
+    // predava pres StreamPending do StreamOps, ze kterych cte jen worker (realokace StreamOps tak
+    // nemuze zneplatnit ukazatele na operace drzene workerem)
+    CRITICAL_SECTION StreamCS;              // kriticka sekce pro pristup k StreamPending a Stream* flagum
+    HANDLE StreamEvent;                     // auto-reset event: pribyly operace ve StreamPending nebo skoncila stavba
+    HANDLE StreamEndEvent;                  // manual-reset event: stavba skriptu skoncila (hl. thread uz skript nepouziva)
+    const char* StreamCaption;              // titulek progress dialogu (NULL = streamovani neni povolene)
+    DWORD StreamStartTime;                  // GetTickCount() ze zacatku stavby skriptu
+    BOOL StreamStarted;                     // TRUE = worker uz bezi (operace cte ze StreamOps)
+    int StreamPublished;                    // kolik operaci skriptu uz bylo predano workerovi
+    TGrowingDirectArray<CScriptOp> StreamPending; // operace predane workerovi, ktere si jeste neprevzal
+    TGrowingDirectArray<CScriptOp> StreamOps;     // operace skriptu z pohledu workeru
+    BOOL StreamEnded;                       // TRUE = stavba skriptu skoncila (dalsi operace uz neprijdou)
+    BOOL StreamFailed;                      // TRUE = stavba skriptu skoncila chybou nebo ji user prerusil
+    BOOL StreamWorkerDone;                  // TRUE = worker skoncil (cancel/chyba), stavbu je mozne prerusit
+
+    CScriptNames Names; // jmena operaci skriptu
+
 public:
     COperations(int base, int delta, char* waitInQueueSubject, char* waitInQueueFrom, char* waitInQueueTo);
-    ~COperations() { HANDLES(DeleteCriticalSection(&StatusCS)); }
+    ~COperations();
+
+    // prida operaci 'op' na konec skriptu, vraci jeji index; pri uspechu prevezme jmena 'op'
+    // (alokovana pres malloc, uvolni je a vynuluje), jinak nastavi chybovy stav pole (IsGood())
+    // a jmena zustavaji volajicimu
+    int Add(COperation& op);
+
+    // rozbali operaci 'rec' (zaznam z tohoto skriptu nebo z GetWorkerOps()) do 'view'
+    void GetOperation(const CScriptOp* rec, CScriptOpView* view) const;
+
+    // vraci cilove jmeno operace 'index' slozene do 'buf' (velikost MAX_PATH)
+    char* GetTargetName(int index, char* buf) { return Names.Get(At(index).Target, buf); }
+
+    // vraci velikost pameti alokovane pro jmena operaci (pro TRACE)
+    DWORD_PTR GetNamesSize() const { return Names.GetAllocatedSize(); }
 
     void SetWorkPath1(const char* path, BOOL inclSubDirs)
     {
@@ -319,6 +483,14 @@ public:
         WorkPath2InclSubDirs = inclSubDirs;
     }
 
+    // nastavi cesty, podle kterych fronta diskovych Copy/Move operaci urci pouzita zarizeni;
+    // musi se volat pred spustenim progress dialogu (pri streamovani skriptu pred EnableStreaming)
+    void SetDevicePaths(const char* sourcePath, const char* targetPath)
+    {
+        lstrcpyn(DeviceSrcPath, sourcePath != NULL ? sourcePath : "", MAX_PATH);
+        lstrcpyn(DeviceTgtPath, targetPath != NULL ? targetPath : "", MAX_PATH);
+    }
+
     void SetTFS(const CQuadWord& TFS);
     void SetTFSandProgressSize(const CQuadWord& TFS, const CQuadWord& pSize,
                                int* limitBufferSize = NULL, int bufferSize = 0);
@@ -339,50 +511,100 @@ public:
     void GetStatus(CQuadWord* transferredFileSize, CQuadWord* transferSpeed,
                    CQuadWord* progressSize, CQuadWord* progressSpeed,
                    BOOL* useSpeedLimit, DWORD* speedLimit);
+    BOOL GetTransferSpeed(CQuadWord* transferSpeed); // FALSE = rychlost se nemeri (!ShowStatus)
     void InitSpeedMeters(BOOL operInProgress);
     BOOL GetTFSandProgressSize(CQuadWord* transferredFileSize, CQuadWord* progressSize);
 
     void SetSpeedLimit(BOOL useSpeedLimit, DWORD speedLimit);
     void GetSpeedLimit(BOOL* useSpeedLimit, DWORD* speedLimit);
-};
+
+    // zapne mereni doby fazi kopirovani (Telemetry); musi se volat pred spustenim workera
+    // (dialog pak meri i cekani ve fronte operaci)
+    void StartTelemetry();
+    // zapise namerene faze kopirovani do TEMPu (jmeno souboru vypise do TRACE)
+    void DumpTelemetry();
+
+    // zacatek faze kopirovani pro AddTelemetry(); 0 pokud se nemeri
+    unsigned __int64 GetTelemetryTime() { return Telemetry != NULL ? Telemetry->GetTime() : 0; }
+    // zaznamena fazi kopirovani 'phase' zacatou v case 'start' (z GetTelemetryTime()); nemeni GetLastError()
+    void AddTelemetry(CCopyTelemetryPhase phase, unsigned __int64 start, unsigned __int64 bytes = 0,
+                      DWORD err = NO_ERROR, WORD detail = 0)
+    {
+        if (Telemetry != NULL)
+            Telemetry->Add(phase, start, bytes, err, detail);
+    }
+
+    // hl. thread pred stavbou skriptu: pokud stavba potrva dele nez SCRIPT_STREAM_DELAY ms, spusti se
+    // progress dialog s titulkem 'caption' (musi byt platny az do EndStreaming()) jeste behem stavby
+    void EnableStreaming(const char* caption);
+    BOOL IsStreamStarted() { return StreamStarted; }
+    // vraci TRUE, pokud je cas spustit progress dialog (stavba uz trva SCRIPT_STREAM_DELAY ms)
+    BOOL IsStreamDue();
+    const char* GetStreamCaption() { return StreamCaption; }
+    // hl. thread behem stavby skriptu: preda workerovi hotove operace (krome vytvoreni adresaru na konci
+    // skriptu, ty muze stavba jeste zrusit, viz SkipEmptyDirs); vraci FALSE, pokud worker uz skoncil
+    // (cancel/chyba) a stavbu je potreba prerusit; prvni volani zahajuje streamovani, pak je nutne
+    // spustit progress dialog
+    BOOL PublishStreamedOps();
+    // hl. thread: progress dialog se nepodarilo spustit, skript se dostavi a spusti postaru
+    void CancelStreaming();
+    // hl. thread po stavbe skriptu (jen pokud IsStreamStarted()): preda workerovi zbytek operaci
+    // ('success' TRUE) nebo mu oznami preruseni stavby; POZOR: po navratu uz skript hl. thread
+    // nesmi pouzivat (worker ho muze kdykoliv uvolnit)
+    void EndStreaming(BOOL success);
+    // hl. thread: vraci TRUE, pokud operace 'index' uz byla predana workerovi (skript ji nesmi smazat)
+    BOOL IsOpPublished(int index) { return StreamStarted && index < StreamPublished; }
+    // worker: operace, se kterymi ma pracovat (pri streamovani StreamOps, jinak cely skript)
+    TDirectArray<CScriptOp>* GetWorkerOps() { return StreamStarted ? (TDirectArray<CScriptOp>*)&StreamOps : this; }
+    // worker: pocka, az bude k dispozici operace 'index' (nebo cancel workeru); vraci FALSE pokud
+    // dalsi operace uz neprijdou, v 'buildFailed' pak vraci TRUE, pokud stavba skriptu skoncila
+    // chybou; POZOR: zneplatni ukazatele na operace z GetWorkerOps()
+    BOOL WaitForStreamedOps(int index, BOOL* cancelWorker, BOOL* buildFailed);
+    // worker pred svym koncem: pocka na konec stavby skriptu (do te doby se skript nesmi uvolnit)
+    void WaitForStreamEnd();
 
 class COperationsQueue // fronta diskovych Copy/Move operaci
 {
 protected:
     CRITICAL_SECTION QueueCritSect; // kriticka sekce objektu
 
-    // pole OperDlgs a OperPaused maji stejny pocet prvku a stejne indexovani (jedna operace ma jeden index v obou polich)
-    TDirectArray<HWND> OperDlgs;    // pole typu HWND: dialogy operaci ve fronte
-    TDirectArray<DWORD> OperPaused; // pole typu int: stav operace ve fronte: 2/1/0 = "manually-paused"/"auto-paused"/"running"
+    // operace ve fronte (ID jobu je HWND dialogu operace) a fyzicka zarizeni (disky, servery),
+    // ktera pouzivaji: operace na nezavislych zarizenich bezi soubezne, operace souperici
+    // o zarizeni se stridaji
+    CDeviceScheduler Scheduler;
 
 public:
-    COperationsQueue() : OperDlgs(5, 10), OperPaused(5, 10)
+    COperationsQueue()
     {
         HANDLES(InitializeCriticalSection(&QueueCritSect));
     }
     ~COperationsQueue()
     {
-        if (OperDlgs.Count > 0 || OperPaused.Count > 0)
+        if (Scheduler.GetJobsCount() > 0)
             TRACE_E("~COperationsQueue(): unexpected situation: operation queue is not empty!");
         HANDLES(DeleteCriticalSection(&QueueCritSect));
     }
 
     // prida operaci do fronty; vraci TRUE pri uspechu, jinak se pridani nepodarilo (malo pameti);
     // 'dlg' je handle okna dialogu operace; 'startOnIdle' je TRUE pokud ma dojit ke spusteni
-    // operace az nic jineho nepobezi; ve 'startPaused' (nesmi byt NULL) vraci TRUE pokud
-    // se ma pridana operace spustit v "paused" rezimu, jinak se spousti v "running" rezimu
-    BOOL AddOperation(HWND dlg, BOOL startOnIdle, BOOL* startPaused);
+    // operace az nic jineho nepobezi; 'sourcePath' a 'targetPath' (muzou byt NULL/"") jsou
+    // zdrojova a cilova cesta operace, podle nich se urci zarizeni, o ktera operace souperi
+    // (jen pri Configuration.QueueOperationsByDevice); ve 'startPaused' (nesmi byt NULL) vraci
+    // TRUE pokud se ma pridana operace spustit v "paused" rezimu, jinak se spousti v "running" rezimu
+    BOOL AddOperation(HWND dlg, BOOL startOnIdle, const char* sourcePath, const char* targetPath,
+                      BOOL* startPaused);
 
     // vyhodi operaci z fronty (operace se dokoncila); je-li 'doNotResume' FALSE, postne
-    // "resume" prvni operace ve fronte v pripade, ze vsechny operace z fronty jsou "paused";
+    // "resume" operacim ve fronte, ktere muzou bezet na uvolnenych zarizenich;
     // neni-li 'foregroundWnd' NULL, ulozi se do nej handle dialogu operace, ktery je potreba
     // aktivovat (pokud neni potreba nic aktivovat, hodnota se nemeni)
     void OperationEnded(HWND dlg, BOOL doNotResume, HWND* foregroundWnd);
 
     // nastavi operaci 'dlg' stav na 'paused' (2/1/0 = "manually-paused"/"auto-paused"/"running")
-    void SetPaused(HWND dlg, BOOL paused);
+    void SetPaused(HWND dlg, int paused);
 
-    // presune operaci 'dlg' na konec seznamu + nastavi ji stav na "auto-paused"
+    // presune operaci 'dlg' na konec seznamu + nastavi ji stav na "auto-paused" (spusti se az
+    // nic jineho nepobezi)
     void AutoPauseOperation(HWND dlg, HWND* foregroundWnd);
 
     // vraci TRUE pokud ve fronte neni zadna operace
@@ -390,6 +612,10 @@ public:
 
     // vraci aktualni pocet operaci ve fronte
     int GetNumOfOperations();
+
+protected:
+    // postne "resume" operacim 'started' (spustil je Scheduler); vola se v sekci QueueCritSect
+    void ResumeStarted(TDirectArray<DWORD_PTR>* started, HWND dlg, HWND* foregroundWnd);
 };
 
 extern COperationsQueue OperationsQueue; // fronta diskovych Copy/Move operaci
@@ -0,0 +1,753 @@
+﻿/*
+    Headless benchmark of the block copy engine used by the asynchronous copy in
+    Salamander (src/common/copyeng.cpp, CCopyEngine). It copies one source file
+    to a target directory with every combination of the requested block sizes
+    and queue depths (number of blocks) and prints the transfer speed, so the
+    ASYNC_COPY_BUF_SIZE* tiers and ASYNC_COPY_BLOCKS (src/worker.h) can be
+    tuned from measured data instead of guesses.
+
+    Two I/O backends of the engine are measured:
+
+      • "overlapped" - asynchronous ReadFile/WriteFile on files opened with
+        FILE_FLAG_OVERLAPPED, the backend Salamander uses; on Linux "uring" -
+        asynchronous reads and writes submitted to an io_uring (if the kernel
+        allows it).
+
+      • "positional" - synchronous ReadFile/WriteFile at explicit offsets (on
+        Linux pread/pwrite), the baseline showing what the pipelining gains.
+
+    With -a the asynchronous backend is also measured with the block size and queue
+    depth controlled by CCopyTuner (the "adaptive" lines, the block size and depth
+    columns show where the controller ended). After the table every adaptive run
+    reports how the controller converged: the number of changes, the time of the
+    last change and the speed compared with the fastest fixed combination.
+
+    With -t the phases of the copies (opening, every block read and write, closing
+    with the flush) are recorded by CCopyTelemetry (src/common/copytelem.cpp) and
+    written as CSV at the end, the same format Salamander writes with
+    Configuration.RecordCopyTelemetry.
+
+    With -s no files are copied, the engine runs against a simulated device with
+    the given latency and bandwidth (source and target alike, the time is
+    simulated too, so the result does not depend on the machine); it shows how
+    the fixed values and the controller cope with slow or distant devices.
+
+    Usage:
+      copybench <source file> <target directory> [options]
+      copybench -s <latency ms>,<MB/s> [options]
+        -b <list>  block sizes in KB, comma separated (default 64,128,256,512,1024)
+        -q <list>  queue depths, comma separated (default 2,4,8,16,32)
+        -r <n>     repetitions of every measurement, the fastest is reported (default 3)
+        -f         include FlushFileBuffers (fsync) of the target file in the measured time
+        -a         measure also the adaptive block size and queue depth
+        -z <MB>    size of the simulated file (default 256)
+        -t <file>  record the telemetry of the copies and write it to <file> (not with -s)
+
+    Output:
+      One CSV line per measurement (backend,block_kb,depth,mb_per_s) followed by
+      the fastest block size for every queue depth of the asynchronous backend.
+
+    Notes:
+      The target file "copybench.tmp" is created in the target directory and
+      deleted at the end. After the first pass the source is usually read from
+      the system cache; for disk measurements use a source larger than memory,
+      for network measurements put the source or the target on a share (that is
+      where Salamander uses the asynchronous copy). Linux: builds with
+      g++ -O2 -I. -I../../src/common -I../../src/plugins/shared copybench.cpp
+      ../../src/common/copyeng.cpp ../../src/common/copytelem.cpp
+*/
+
+#include "precomp.h"
+
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include "copyeng.h"
+#include "copytelem.h"
+
+#ifdef _WIN32
+#define ASYNC_BACKEND "overlapped"
+static OVERLAPPED Overlapped[COPYENGINE_MAX_BLOCKS]; // one for every block, each with its event
+#else
+#define ASYNC_BACKEND "uring"
+#endif
+
+// simulated time of the -s mode (in ms)
+static double SimTime = 0;
+
+// telemetry of the copies (-t), NULL = not recorded
+static CCopyTelemetry* Telemetry = NULL;
+
+// adds a phase to the telemetry if it is recorded
+static void AddTelemetry(CCopyTelemetryPhase phase, unsigned __int64 start, unsigned __int64 bytes = 0,
+                         DWORD err = NO_ERROR)
+{
+    if (Telemetry != NULL)
+        Telemetry->Add(phase, start, bytes, err);
+}
+
+static unsigned __int64 GetTelemetryTime() { return Telemetry != NULL ? Telemetry->GetTime() : 0; }
+
+// backend recording the reads and writes of blocks to the telemetry (like in Salamander), the
+// I/O itself is done by backend 'io'; the engine takes the result of the oldest operation twice
+// when it waits for it, every operation is recorded only once
+class CBenchIoTelemetry : public CCopyIoBackend
+{
+protected:
+    CCopyIoBackend* Io;
+    unsigned __int64 Start[COPYENGINE_MAX_BLOCKS]; // for every block: start of the last operation
+    BOOL Writing[COPYENGINE_MAX_BLOCKS];           // for every block: TRUE = the last operation is a write
+    BOOL Recorded[COPYENGINE_MAX_BLOCKS];          // for every block: TRUE = the last operation is recorded
+
+public:
+    CBenchIoTelemetry(CCopyIoBackend* io)
+    {
+        Io = io;
+        memset(Start, 0, sizeof(Start));
+        memset(Writing, 0, sizeof(Writing));
+        memset(Recorded, 0, sizeof(Recorded));
+    }
+
+    virtual BOOL StartRead(int block, void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+    {
+        Start[block] = Telemetry->GetTime();
+        Writing[block] = FALSE;
+        Recorded[block] = FALSE;
+        return Io->StartRead(block, buffer, size, offset, err);
+    }
+    virtual BOOL StartWrite(int block, const void* buffer, DWORD size, const CQuadWord& offset, DWORD* err)
+    {
+        Start[block] = Telemetry->GetTime();
+        Writing[block] = TRUE;
+        Recorded[block] = FALSE;
+        return Io->StartWrite(block, buffer, size, offset, err);
+    }
+    virtual BOOL IsDone(int block) { return Io->IsDone(block); }
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err)
+    {
+        BOOL ret = Io->GetResult(block, bytes, err);
+        if (!Recorded[block])
+        {
+            Telemetry->Add(Writing[block] ? ctpWrite : ctpRead, Start[block], ret ? *bytes : 0, ret ? NO_ERROR : *err);
+            Recorded[block] = TRUE;
+        }
+        return ret;
+    }
+    virtual void CancelAll() { Io->CancelAll(); }
+};
+
+// backend of the -s mode: every device transfers one request at a time at 'Bandwidth', the
+// request is finished 'Latency' ms after its transfer (the latency of the requests overlaps)
+class CCopyIoSimulated : public CCopyIoBackend
+{
+protected:
+    struct CDevice
+    {
+        double Latency;   // in ms
+        double Bandwidth; // in bytes per ms
+        double FreeTime;  // the device finishes the previous transfers at this time
+    };
+
+    CDevice Source;
+    CDevice Target;
+    CQuadWord FileSize;
+    double DoneTime[COPYENGINE_MAX_BLOCKS]; // the operation of the block finishes at this time
+    DWORD Bytes[COPYENGINE_MAX_BLOCKS];
+    DWORD Error[COPYENGINE_MAX_BLOCKS];
+
+    double Schedule(CDevice& device, DWORD bytes)
+    {
+        double start = device.FreeTime > SimTime ? device.FreeTime : SimTime;
+        device.FreeTime = start + bytes / device.Bandwidth;
+        return device.FreeTime + device.Latency;
+    }
+
+public:
+    CCopyIoSimulated(double latency, double megabytesPerSecond, const CQuadWord& fileSize)
+    {
+        Source.Latency = Target.Latency = latency;
+        Source.Bandwidth = Target.Bandwidth = megabytesPerSecond * 1024 * 1024 / 1000;
+        Source.FreeTime = Target.FreeTime = 0;
+        FileSize = fileSize;
+        memset(DoneTime, 0, sizeof(DoneTime));
+        memset(Bytes, 0, sizeof(Bytes));
+        memset(Error, 0, sizeof(Error));
+    }
+
+    virtual BOOL StartRead(int block, void* /*buffer*/, DWORD size, const CQuadWord& offset, DWORD* /*err*/)
+    {
+        Bytes[block] = offset >= FileSize ? 0 : (FileSize - offset < CQuadWord(size, 0) ? (FileSize - offset).LoDWord : size);
+        Error[block] = Bytes[block] == 0 ? ERROR_HANDLE_EOF : NO_ERROR;
+        DoneTime[block] = Schedule(Source, Bytes[block]);
+        return TRUE;
+    }
+    virtual BOOL StartWrite(int block, const void* /*buffer*/, DWORD size, const CQuadWord& /*offset*/, DWORD* /*err*/)
+    {
+        Bytes[block] = size;
+        Error[block] = NO_ERROR;
+        DoneTime[block] = Schedule(Target, size);
+        return TRUE;
+    }
+    virtual BOOL IsDone(int block) { return DoneTime[block] <= SimTime; }
+    virtual BOOL GetResult(int block, DWORD* bytes, DWORD* err)
+    {
+        if (DoneTime[block] > SimTime)
+            SimTime = DoneTime[block]; // waiting for the operation
+        *bytes = Bytes[block];
+        *err = Error[block];
+        return Error[block] == NO_ERROR;
+    }
+    virtual void CancelAll() {}
+};
+
+class CBenchTuner : public CCopyTuner
+{
+public:
+    BOOL Simulated;    // TRUE = the time of the -s mode
+    DWORD StartTime;   // time the copy started (in ms)
+    DWORD LastChange;  // time of the last change of the block size or queue depth, relative to StartTime
+    int Changes;       // number of changes of the block size or queue depth
+
+    CBenchTuner(int minBlockSize, int maxBlockSize, int maxQueueDepth, BOOL simulated)
+        : CCopyTuner(minBlockSize, maxBlockSize, maxQueueDepth < 2 ? maxQueueDepth : 2, maxQueueDepth, maxBlockSize,
+                     maxQueueDepth < 8 ? maxQueueDepth : 8)
+    {
+        Simulated = simulated;
+        StartTime = 0;
+        LastChange = 0;
+        Changes = 0;
+    }
+
+    virtual DWORD GetTime() { return Simulated ? (DWORD)SimTime : GetTickCount(); }
+};
+
+class CBenchCopy : public CCopyEngine
+{
+public:
+    DWORD Error;            // the first error of the copy, NO_ERROR = none
+    CBenchTuner* BenchTuner; // controller of the adaptive run, NULL = fixed values
+
+    CBenchCopy(CCopyIoBackend* io, void** buffers, int numOfBlocks, CQuadWord* fileSize, int* blockSize)
+        : CCopyEngine(io, buffers, numOfBlocks, fileSize, blockSize)
+    {
+        Error = NO_ERROR;
+        BenchTuner = NULL;
+    }
+
+    void SetBenchTuner(CBenchTuner* tuner)
+    {
+        BenchTuner = tuner;
+        if (tuner != NULL)
+        {
+            tuner->StartTime = tuner->GetTime();
+            SetTuner(tuner);
+        }
+    }
+
+protected:
+    // called whenever the controller changed the block size or the queue depth
+    virtual int OnQueueDepthChange(int queueDepth)
+    {
+        if (BenchTuner != NULL)
+        {
+            BenchTuner->Changes++;
+            BenchTuner->LastChange = BenchTuner->GetTime() - BenchTuner->StartTime;
+        }
+        return queueDepth;
+    }
+
+    virtual BOOL OnReadError(int blkIndex, DWORD err) { return StopOnError(blkIndex, err); }
+    virtual BOOL OnWriteError(int blkIndex, DWORD err, const CQuadWord& /*maxWriteOffset*/) { return StopOnError(blkIndex, err); }
+    virtual void GetNewFileSize(const CQuadWord& minFileSize) { *FileSize = minFileSize; }
+
+    BOOL StopOnError(int blkIndex, DWORD err)
+    {
+        CancelOpPhase1();
+        CancelOpPhase2(blkIndex);
+        Error = err;
+        return FALSE;
+    }
+};
+
+static BOOL ParseList(const char* text, std::vector<int>& list)
+{
+    list.clear();
+    while (*text != 0)
+    {
+        char* end;
+        long value = strtol(text, &end, 10);
+        if (end == text || value <= 0)
+            return FALSE;
+        list.push_back((int)value);
+        text = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != 0)
+            return FALSE;
+    }
+    return !list.empty();
+}
+
+static void PrintError(const char* what, const char* name, DWORD err)
+{
+    char msg[300];
+#ifdef _WIN32
+    if (FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, err,
+                       MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), msg, sizeof(msg), NULL) == 0)
+#endif // _WIN32
+    {
+        sprintf_s(msg, "error %u", err);
+    }
+    fprintf(stderr, "%s %s: %s\n", what, name, msg);
+}
+
+// returns the current time in seconds (for measuring intervals)
+static double GetSeconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / freq.QuadPart;
+#else  // _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif // _WIN32
+}
+
+// returns the size of file 'name' in bytes; FALSE = error (reported)
+static BOOL GetSourceSize(const char* name, CQuadWord* size)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (!GetFileAttributesExA(name, GetFileExInfoStandard, &attrs))
+    {
+        PrintError("Unable to open", name, GetLastError());
+        return FALSE;
+    }
+    size->Set(attrs.nFileSizeLow, attrs.nFileSizeHigh);
+#else  // _WIN32
+    struct stat st;
+    if (stat(name, &st) != 0)
+    {
+        fprintf(stderr, "Unable to open %s: %s\n", name, strerror(errno));
+        return FALSE;
+    }
+    size->SetUI64((unsigned __int64)st.st_size);
+#endif // _WIN32
+    return TRUE;
+}
+
+// copies the simulated file once; returns the simulated time in seconds
+static double SimulateOnce(double latency, double megabytesPerSecond, const CQuadWord& size, int blockSize,
+                           int depth, void** buffers, CBenchTuner* tuner)
+{
+    SimTime = 0;
+    CQuadWord fileSize = size;
+    CCopyIoSimulated io(latency, megabytesPerSecond, fileSize);
+    CBenchCopy copy(&io, buffers, depth, &fileSize, &blockSize);
+    copy.SetBenchTuner(tuner);
+    if (!copy.Run())
+        return -1;
+    return SimTime / 1000;
+}
+
+// copies 'source' to 'target' once; returns the time in seconds or a negative number on error
+#ifdef _WIN32
+static double CopyOnce(const char* source, const char* target, BOOL async, int blockSize, int depth,
+                       void** buffers, BOOL flush, CBenchTuner* tuner)
+{
+    DWORD flags = (async ? FILE_FLAG_OVERLAPPED : 0) | FILE_FLAG_SEQUENTIAL_SCAN;
+    unsigned __int64 fileStart = GetTelemetryTime();
+    unsigned __int64 phaseStart = fileStart;
+    HANDLE in = CreateFileA(source, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL);
+    AddTelemetry(ctpOpenSource, phaseStart, 0, in != INVALID_HANDLE_VALUE ? NO_ERROR : GetLastError());
+    if (in == INVALID_HANDLE_VALUE)
+    {
+        PrintError("Unable to open", source, GetLastError());
+        return -1;
+    }
+    phaseStart = GetTelemetryTime();
+    HANDLE out = CreateFileA(target, GENERIC_WRITE | GENERIC_READ, 0, NULL, CREATE_ALWAYS, flags, NULL);
+    AddTelemetry(ctpCreateTarget, phaseStart, 0, out != INVALID_HANDLE_VALUE ? NO_ERROR : GetLastError());
+    if (out == INVALID_HANDLE_VALUE)
+    {
+        PrintError("Unable to create", target, GetLastError());
+        CloseHandle(in);
+        return -1;
+    }
+
+    CQuadWord fileSize;
+    fileSize.LoDWord = GetFileSize(in, &fileSize.HiDWord);
+
+    double start = GetSeconds();
+
+    CCopyIoOverlapped ioAsync(&in, &out, Overlapped);
+    CCopyIoPositional ioPositional(&in, &out);
+    CCopyIoBackend* io = async ? (CCopyIoBackend*)&ioAsync : &ioPositional;
+    CBenchIoTelemetry ioTelemetry(io);
+    CBenchCopy copy(Telemetry != NULL ? &ioTelemetry : io, buffers, depth, &fileSize, &blockSize);
+    copy.SetBenchTuner(tuner);
+    phaseStart = GetTelemetryTime();
+    BOOL ok = copy.Run();
+    AddTelemetry(ctpData, phaseStart, ok ? fileSize.Value : 0, ok ? NO_ERROR : copy.Error);
+    phaseStart = GetTelemetryTime();
+    if (ok && flush && !FlushFileBuffers(out))
+    {
+        copy.Error = GetLastError();
+        ok = FALSE;
+    }
+
+    double end = GetSeconds();
+    CloseHandle(in);
+    CloseHandle(out);
+    AddTelemetry(ctpClose, phaseStart, 0, ok ? NO_ERROR : copy.Error);
+    AddTelemetry(ctpFile, fileStart, fileSize.Value, ok ? NO_ERROR : copy.Error);
+    if (!ok)
+    {
+        PrintError("Unable to copy to", target, copy.Error);
+        return -1;
+    }
+    return end - start;
+}
+#else  // _WIN32
+static double CopyOnce(const char* source, const char* target, BOOL async, int blockSize, int depth,
+                       void** buffers, BOOL flush, CBenchTuner* tuner)
+{
+    unsigned __int64 fileStart = GetTelemetryTime();
+    unsigned __int64 phaseStart = fileStart;
+    int in = open(source, O_RDONLY);
+    AddTelemetry(ctpOpenSource, phaseStart, 0, in != -1 ? NO_ERROR : CopyIoErrorFromErrno(errno));
+    if (in == -1)
+    {
+        fprintf(stderr, "Unable to open %s: %s\n", source, strerror(errno));
+        return -1;
+    }
+    phaseStart = GetTelemetryTime();
+    int out = open(target, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    AddTelemetry(ctpCreateTarget, phaseStart, 0, out != -1 ? NO_ERROR : CopyIoErrorFromErrno(errno));
+    if (out == -1)
+    {
+        fprintf(stderr, "Unable to create %s: %s\n", target, strerror(errno));
+        close(in);
+        return -1;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    CQuadWord fileSize;
+    struct stat st;
+    fileSize.SetUI64(fstat(in, &st) == 0 ? (unsigned __int64)st.st_size : 0);
+
+    double start = GetSeconds();
+
+    BOOL ok;
+    DWORD err;
+    {
+#ifdef COPYENGINE_IO_URING
+        CCopyIoUring ioAsync(&in, &out);
+#endif // COPYENGINE_IO_URING
+        CCopyIoPositional ioPositional(&in, &out);
+        CCopyIoBackend* io = &ioPositional;
+#ifdef COPYENGINE_IO_URING
+        if (async)
+            io = &ioAsync;
+#endif // COPYENGINE_IO_URING
+        CBenchIoTelemetry ioTelemetry(io);
+        CBenchCopy copy(Telemetry != NULL ? &ioTelemetry : io, buffers, depth, &fileSize, &blockSize);
+        copy.SetBenchTuner(tuner);
+        phaseStart = GetTelemetryTime();
+        ok = copy.Run();
+        err = copy.Error;
+        AddTelemetry(ctpData, phaseStart, ok ? fileSize.Value : 0, err);
+    } // the ring is closed before the target is flushed
+    phaseStart = GetTelemetryTime();
+    if (ok && flush && fsync(out) != 0)
+    {
+        err = CopyIoErrorFromErrno(errno);
+        ok = FALSE;
+    }
+
+    double end = GetSeconds();
+    close(in);
+    close(out);
+    AddTelemetry(ctpClose, phaseStart, 0, err);
+    AddTelemetry(ctpFile, fileStart, fileSize.Value, err);
+    if (!ok)
+    {
+        PrintError("Unable to copy to", target, err);
+        return -1;
+    }
+    return end - start;
+}
+#endif // _WIN32
+
+// returns TRUE if the asynchronous backend can be used on this system
+static BOOL IsAsyncBackendAvailable()
+{
+#ifdef _WIN32
+    return TRUE;
+#elif defined(COPYENGINE_IO_URING)
+    int in = -1, out = -1;
+    CCopyIoUring ring(&in, &out);
+    return ring.IsGood();
+#else  // _WIN32
+    return FALSE;
+#endif // _WIN32
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> sizes = {64, 128, 256, 512, 1024};
+    std::vector<int> depths = {2, 4, 8, 16, 32};
+    int repeat = 3;
+    BOOL flush = FALSE;
+    BOOL adaptive = FALSE;
+    BOOL simulated = FALSE;
+    double simLatency = 0;
+    double simBandwidth = 0;
+    int simSize = 256;
+    const char* telemetryName = NULL;
+
+    BOOL simulatedArg = argc >= 2 && strcmp(argv[1], "-s") == 0;
+    if (simulatedArg)
+    {
+        simulated = argc >= 3 && sscanf_s(argv[2], "%lf,%lf", &simLatency, &simBandwidth) == 2 &&
+                    simLatency >= 0 && simBandwidth > 0;
+    }
+    if (argc < 3 || (simulatedArg && !simulated))
+    {
+        fprintf(stderr, "Usage: copybench <source file> <target directory> [-b sizes_kb] [-q depths] [-r repeat] [-f] [-a] [-t telemetry.csv]\n"
+                        "       copybench -s <latency_ms>,<mb_per_s> [-b sizes_kb] [-q depths] [-a] [-z size_mb]\n");
+        return 2;
+    }
+    for (int i = 3; i < argc; i++)
+    {
+        BOOL ok = TRUE;
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            ok = ParseList(argv[++i], sizes);
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+            ok = ParseList(argv[++i], depths);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            ok = (repeat = atoi(argv[++i])) > 0;
+        else if (strcmp(argv[i], "-f") == 0)
+            flush = TRUE;
+        else if (strcmp(argv[i], "-a") == 0)
+            adaptive = TRUE;
+        else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc)
+            ok = (simSize = atoi(argv[++i])) > 0;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && !simulated)
+            telemetryName = argv[++i];
+        else
+            ok = FALSE;
+        if (!ok)
+        {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    for (int depth : depths)
+    {
+        if (depth > COPYENGINE_MAX_BLOCKS)
+        {
+            fprintf(stderr, "Queue depth %d is over the limit of the engine (%d).\n", depth, COPYENGINE_MAX_BLOCKS);
+            return 2;
+        }
+    }
+
+    double megabytes = simSize;
+    char target[MAX_PATH];
+    target[0] = 0;
+    if (!simulated)
+    {
+        CQuadWord sourceSize;
+        if (!GetSourceSize(argv[1], &sourceSize))
+            return 1;
+        megabytes = (double)sourceSize.Value / (1024 * 1024);
+
+#ifdef _WIN32
+        const char* separator = "\\";
+#else  // _WIN32
+        const char* separator = "/";
+#endif // _WIN32
+        sprintf_s(target, "%s%scopybench.tmp", argv[2],
+                  argv[2][0] != 0 && argv[2][strlen(argv[2]) - 1] != separator[0] ? separator : "");
+    }
+    BOOL asyncAvailable = simulated || IsAsyncBackendAvailable();
+    if (!asyncAvailable)
+    {
+        fprintf(stderr, "The %s backend is not available on this system, measuring the positional backend only.\n", ASYNC_BACKEND);
+        adaptive = FALSE;
+    }
+    CQuadWord simFileSize;
+    simFileSize.SetUI64((unsigned __int64)simSize * 1024 * 1024);
+    if (simulated)
+        repeat = 1; // the simulated time is always the same
+
+    int maxBlockSize = 0;
+    for (int size : sizes)
+    {
+        if (size * 1024 > maxBlockSize)
+            maxBlockSize = size * 1024;
+    }
+    int maxDepth = 0;
+    for (int depth : depths)
+    {
+        if (depth > maxDepth)
+            maxDepth = depth;
+    }
+    void* buffers[COPYENGINE_MAX_BLOCKS];
+    memset(buffers, 0, sizeof(buffers));
+    for (int i = 0; i < maxDepth; i++)
+    {
+#ifdef _WIN32
+        buffers[i] = VirtualAlloc(NULL, maxBlockSize, MEM_COMMIT, PAGE_READWRITE);
+        Overlapped[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (buffers[i] == NULL || Overlapped[i].hEvent == NULL)
+#else  // _WIN32
+        if (posix_memalign(&buffers[i], 4096, maxBlockSize) != 0)
+            buffers[i] = NULL;
+        if (buffers[i] == NULL)
+#endif // _WIN32
+        {
+            fprintf(stderr, "Low memory.\n");
+            return 1;
+        }
+    }
+    CCopyTelemetry telemetry;
+    if (telemetryName != NULL)
+    {
+        if (!telemetry.Init())
+        {
+            fprintf(stderr, "Low memory.\n");
+            return 1;
+        }
+        Telemetry = &telemetry;
+    }
+
+    printf("backend,block_kb,depth,mb_per_s\n");
+    std::vector<double> best(depths.size() * sizes.size());
+    int exitCode = 0;
+    for (int backend = asyncAvailable ? 0 : 1; backend < (simulated ? 1 : 2) && exitCode == 0; backend++)
+    {
+        BOOL async = backend == 0;
+        for (size_t s = 0; s < sizes.size() && exitCode == 0; s++)
+        {
+            // the synchronous backend has a single operation in flight, the queue depth does not matter
+            size_t depthsCount = async ? depths.size() : 1;
+            for (size_t d = 0; d < depthsCount && exitCode == 0; d++)
+            {
+                double fastest = 0;
+                for (int r = 0; r < repeat; r++)
+                {
+                    double seconds = simulated ? SimulateOnce(simLatency, simBandwidth, simFileSize, sizes[s] * 1024, depths[d], buffers, NULL)
+                                               : CopyOnce(argv[1], target, async, sizes[s] * 1024, depths[d], buffers, flush, NULL);
+                    if (seconds < 0)
+                    {
+                        exitCode = 1;
+                        break;
+                    }
+                    if (fastest == 0 || seconds < fastest)
+                        fastest = seconds;
+                }
+                if (exitCode != 0)
+                    break;
+                double speed = fastest > 0 ? megabytes / fastest : 0;
+                printf("%s,%d,%d,%.1f\n", simulated ? "simulated" : async ? ASYNC_BACKEND : "positional", sizes[s], depths[d], speed);
+                fflush(stdout);
+                if (async)
+                    best[d * sizes.size() + s] = speed;
+            }
+        }
+    }
+
+    // the controller starts from the largest block and at most 8 blocks, like Salamander
+    int minBlockSize = maxBlockSize;
+    for (int size : sizes)
+    {
+        if (size * 1024 < minBlockSize)
+            minBlockSize = size * 1024;
+    }
+    std::vector<CBenchTuner> tuners;
+    std::vector<double> tunedSeconds;
+    for (int r = 0; adaptive && r < repeat && exitCode == 0; r++)
+    {
+        CBenchTuner tuner(minBlockSize, maxBlockSize, maxDepth, simulated);
+        double seconds = simulated ? SimulateOnce(simLatency, simBandwidth, simFileSize, maxBlockSize, maxDepth, buffers, &tuner)
+                                   : CopyOnce(argv[1], target, TRUE, maxBlockSize, maxDepth, buffers, flush, &tuner);
+        if (seconds < 0)
+            exitCode = 1;
+        else
+        {
+            printf("adaptive,%d,%d,%.1f\n", tuner.GetBlockSize() / 1024, tuner.GetQueueDepth(),
+                   seconds > 0 ? megabytes / seconds : 0);
+            fflush(stdout);
+            tuners.push_back(tuner);
+            tunedSeconds.push_back(seconds);
+        }
+    }
+    if (!simulated)
+    {
+#ifdef _WIN32
+        DeleteFileA(target);
+#else  // _WIN32
+        unlink(target);
+#endif // _WIN32
+    }
+
+    if (exitCode == 0 && asyncAvailable)
+    {
+        printf("\nfastest block size (%s):\n", simulated ? "simulated" : ASYNC_BACKEND);
+        for (size_t d = 0; d < depths.size(); d++)
+        {
+            size_t bestSize = 0;
+            for (size_t s = 1; s < sizes.size(); s++)
+            {
+                if (best[d * sizes.size() + s] > best[d * sizes.size() + bestSize])
+                    bestSize = s;
+            }
+            printf("  depth %d: %d KB (%.1f MB/s)\n", depths[d], sizes[bestSize], best[d * sizes.size() + bestSize]);
+        }
+
+        // convergence of the controller against the fastest fixed combination
+        double fastestFixed = 0;
+        for (double speed : best)
+        {
+            if (speed > fastestFixed)
+                fastestFixed = speed;
+        }
+        if (!tuners.empty())
+            printf("\nadaptive convergence:\n");
+        for (size_t r = 0; r < tuners.size(); r++)
+        {
+            double speed = tunedSeconds[r] > 0 ? megabytes / tunedSeconds[r] : 0;
+            printf("  run %d: %d KB, depth %d, %d changes, last change at %.2f s of %.2f s, %.0f %% of the fastest fixed\n",
+                   (int)r + 1, tuners[r].GetBlockSize() / 1024, tuners[r].GetQueueDepth(), tuners[r].Changes,
+                   tuners[r].LastChange / 1000.0, tunedSeconds[r], fastestFixed > 0 ? speed * 100 / fastestFixed : 0);
+        }
+    }
+    if (Telemetry != NULL)
+    {
+        Telemetry = NULL;
+        if (!telemetry.Dump(telemetryName))
+        {
+            PrintError("Unable to write telemetry to", telemetryName, GetLastError());
+            exitCode = 1;
+        }
+    }
+
+    for (int i = 0; i < maxDepth; i++)
+    {
+#ifdef _WIN32
+        VirtualFree(buffers[i], 0, MEM_RELEASE);
+        CloseHandle(Overlapped[i].hEvent);
+#else  // _WIN32
+        free(buffers[i]);
+#endif // _WIN32
+    }
+    return exitCode;
+}
@@ -0,0 +1,129 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/copyeng.cpp and copytelem.cpp outside of
+// Salamander; they need only Windows types, error codes, GetTickCount and the interlocked
+// functions (the files are accessed by the backends), so on other systems they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <commctrl.h>
+
+#else // _WIN32
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef long long LONGLONG;
+typedef uintptr_t DWORD_PTR;
+#define __int64 long long
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+
+#define MAX_PATH 260
+
+#define NO_ERROR 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_ACCESS_DENIED 5
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_GEN_FAILURE 31
+#define ERROR_HANDLE_EOF 38
+#define ERROR_DISK_FULL 112
+#define ERROR_OPERATION_ABORTED 995
+#define ERROR_CANCELLED 1223
+
+// types used only in declarations of spl_com.h (the benchmark needs CQuadWord from it)
+typedef void* HWND;
+typedef void* HICON;
+typedef void* HIMAGELIST;
+
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+
+struct SYSTEMTIME
+{
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+};
+
+inline DWORD GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// the last error of the thread is errno
+inline DWORD GetLastError() { return (DWORD)errno; }
+inline void SetLastError(DWORD err) { errno = (int)err; }
+inline DWORD GetCurrentThreadId() { return (DWORD)syscall(SYS_gettid); }
+
+// sequentially consistent like the Win32 ones, they return the new value (the compare exchange
+// the original one)
+inline LONG InterlockedIncrement(volatile LONG* value) { return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedIncrement64(volatile LONGLONG* value) { return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* value, LONGLONG add) { return __atomic_fetch_add(value, add, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedCompareExchange(volatile LONG* value, LONG exchange, LONG comparand)
+{
+    __atomic_compare_exchange_n(value, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+// CQuadWord (spl_com.h) has a copy constructor but the implicit assignment, g++ warns about
+// every assignment
+#pragma GCC diagnostic ignored "-Wdeprecated-copy"
+
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+#define sprintf_s(buffer, ...) snprintf(buffer, sizeof(buffer), __VA_ARGS__)
+#define sscanf_s sscanf
+
+#endif // _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ostream>
+#include <sstream>
+
+#include "spl_com.h"
+
+// the engine reports only unexpected situations through TRACE, print them to stderr
+// (an expression, TRACE_C is used inside expressions)
+#define COPYBENCH_TRACE(kind, msg) \
+    ([&]() \
+     { \
+         std::ostringstream _s; \
+         _s << msg; \
+         fprintf(stderr, "%s: %s\n", kind, _s.str().c_str()); \
+     }())
+
+#define TRACE_I(str) COPYBENCH_TRACE("info", str)
+#define TRACE_E(str) COPYBENCH_TRACE("error", str)
+#define TRACE_C(str) (COPYBENCH_TRACE("fatal", str), abort())
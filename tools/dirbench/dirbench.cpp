@@ -0,0 +1,416 @@
+﻿/*
+    Benchmark of the parallel directory walk of Find Files in Salamander
+    (CParallelDirWalker from src/common/dirwalk.cpp). A synthetic directory tree is
+    created and walked in these ways:
+
+      • "serial" - one recursive chain of FindFirstFile/FindNextFile calls, how
+                   SearchDirectory in src/find.cpp walks the tree with one thread.
+
+      • "walker" - CParallelDirWalker with the given numbers of workers (workers
+                   own queues of directories and steal from each other).
+
+    The callback does what the Find callback does cheaply: it tests the name of
+    every entry against a suffix (instead of CMaskGroup::AgreeMasks) and hands the
+    found names over in batches under a lock (instead of the list view).
+
+    Listing a directory on a local disk takes microseconds and the walk is bound by
+    the CPU, on a network share it takes a round trip to the server; with -l the
+    walk waits for the given time before every directory is listed (in both ways),
+    which shows how the workers hide the latency of a share.
+
+    Usage:
+      dirbench <directory> [options]
+        -w <n>     subdirectories in every directory (default 4)
+        -d <n>     depth of the tree (default 5)
+        -f <n>     files in every directory (default 20)
+        -t <list>  numbers of workers, comma separated (default 1,2,4,8,16)
+        -l <us>    latency of listing one directory in microseconds (default 0)
+        -m <s>     suffix of the names searched for (default "7.txt")
+        -r <n>     repetitions of every measurement, the fastest is reported (default 3)
+        -k         keep the tree (the next run with the same options reuses it)
+
+    Output:
+      One CSV line per way: way,workers,dirs,entries,found,ms,entries_per_s,same_result
+      ("same_result" compares the counts with the serial walk).
+
+    Notes:
+      The tree "dirbench.tmp" is created in the given directory. The first pass
+      fills the file system cache, the fastest of the repetitions is reported.
+*/
+
+#include "precomp.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dirwalk.h"
+
+#ifdef _WIN32
+#define DIRBENCH_SEP '\\'
+#else
+#define DIRBENCH_SEP '/'
+#endif
+
+static int Latency = 0;              // -l: latency of listing one directory (in microseconds)
+static std::string Suffix = "7.txt"; // -m: the searched names end with it
+
+static BOOL MakeDir(const char* name)
+{
+#ifdef _WIN32
+    return CreateDirectory(name, NULL) != 0;
+#else
+    return mkdir(name, 0755) == 0;
+#endif
+}
+
+static BOOL MakeFile(const char* name)
+{
+    FILE* f = fopen(name, "wb");
+    if (f == NULL)
+        return FALSE;
+    fclose(f);
+    return TRUE;
+}
+
+static BOOL CreateTree(const std::string& dir, int width, int depth, int files)
+{
+    if (!MakeDir(dir.c_str()))
+    {
+        fprintf(stderr, "unable to create directory %s\n", dir.c_str());
+        return FALSE;
+    }
+    char name[50];
+    int i;
+    for (i = 0; i < files; i++)
+    {
+        sprintf(name, "%cfile%04d.txt", DIRBENCH_SEP, i);
+        if (!MakeFile((dir + name).c_str()))
+        {
+            fprintf(stderr, "unable to create file %s%s\n", dir.c_str(), name);
+            return FALSE;
+        }
+    }
+    if (depth > 0)
+    {
+        for (i = 0; i < width; i++)
+        {
+            sprintf(name, "%cdir%02d", DIRBENCH_SEP, i);
+            if (!CreateTree(dir + name, width, depth - 1, files))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static BOOL IsDots(const char* name)
+{
+    return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+static void RemoveTree(const std::string& dir)
+{
+    WIN32_FIND_DATA file;
+    HANDLE find = FindFirstFile((dir + "\\*").c_str(), &file);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (IsDots(file.cFileName))
+                continue;
+            std::string name = dir + DIRBENCH_SEP + file.cFileName;
+            if (file.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                RemoveTree(name);
+            else
+#ifdef _WIN32
+                DeleteFile(name.c_str());
+#else
+                unlink(name.c_str());
+#endif
+        } while (FindNextFile(find, &file));
+        FindClose(find);
+    }
+#ifdef _WIN32
+    RemoveDirectory(dir.c_str());
+#else
+    rmdir(dir.c_str());
+#endif
+}
+
+static void WaitLatency()
+{
+    if (Latency > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(Latency));
+}
+
+static BOOL HasSuffix(const char* name)
+{
+    size_t len = strlen(name);
+    return len >= Suffix.size() && memcmp(name + len - Suffix.size(), Suffix.c_str(), Suffix.size()) == 0;
+}
+
+struct CWalkResult
+{
+    int Dirs;
+    int Entries;
+    int Found;
+};
+
+// "serial": the recursion of SearchDirectory (the path has a trailing backslash)
+static void WalkSerial(char* path, int len, CWalkResult* result)
+{
+    WaitLatency();
+    result->Dirs++;
+    path[len] = '*';
+    path[len + 1] = 0;
+    WIN32_FIND_DATA file;
+    HANDLE find = FindFirstFile(path, &file);
+    path[len] = 0;
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        if (IsDots(file.cFileName))
+            continue;
+        result->Entries++;
+        if (HasSuffix(file.cFileName))
+            result->Found++;
+        int nameLen = (int)strlen(file.cFileName);
+        if ((file.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && len + nameLen + 2 < MAX_PATH)
+        {
+            memcpy(path + len, file.cFileName, nameLen);
+            path[len + nameLen] = '\\';
+            path[len + nameLen + 1] = 0;
+            WalkSerial(path, len + nameLen + 1, result);
+            path[len] = 0;
+        }
+    } while (FindNextFile(find, &file));
+    FindClose(find);
+}
+
+#define DIRBENCH_BATCH_SIZE 100 // FIND_WALKER_BATCH_SIZE
+
+struct CBenchWorker
+{
+    CWalkResult Result;
+    std::vector<std::string> Batch; // found names not handed over yet
+};
+
+class CBenchCallback : public CDirWalkerCallback
+{
+public:
+    std::vector<CBenchWorker> Workers;
+    std::mutex Lock;                // guards Found (CFoundFilesListView::AddBatch)
+    std::vector<std::string> Found; // the names handed over by the workers
+    volatile LONG Errors;
+
+    CBenchCallback(int workers) : Workers(workers)
+    {
+        int i;
+        for (i = 0; i < workers; i++)
+            memset(&Workers[i].Result, 0, sizeof(Workers[i].Result));
+        Errors = 0;
+    }
+
+    virtual BOOL EnterDirectory(int worker, const char* /*path*/, int /*pathLen*/)
+    {
+        WaitLatency();
+        Workers[worker].Result.Dirs++;
+        return TRUE;
+    }
+
+    virtual BOOL FoundEntry(int worker, const char* path, int pathLen, const WIN32_FIND_DATA* file)
+    {
+        CBenchWorker* w = &Workers[worker];
+        w->Result.Entries++;
+        if (HasSuffix(file->cFileName))
+        {
+            w->Batch.push_back(std::string(path, pathLen) + file->cFileName);
+            if (w->Batch.size() >= DIRBENCH_BATCH_SIZE)
+                Flush(worker);
+        }
+        return (file->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    }
+
+    virtual void WalkError(int /*worker*/, CDirWalkerErrorType /*type*/, const char* path, DWORD err)
+    {
+        fprintf(stderr, "error %u: %s\n", (unsigned)err, path);
+        InterlockedIncrement(&Errors);
+    }
+
+    virtual void WorkerIdle(int worker) { Flush(worker); }
+
+    void Flush(int worker)
+    {
+        CBenchWorker* w = &Workers[worker];
+        if (w->Batch.empty())
+            return;
+        std::lock_guard<std::mutex> lock(Lock);
+        Found.insert(Found.end(), w->Batch.begin(), w->Batch.end());
+        w->Batch.clear();
+    }
+
+    CWalkResult GetResult()
+    {
+        CWalkResult result = {0, 0, 0};
+        size_t i;
+        for (i = 0; i < Workers.size(); i++)
+        {
+            result.Dirs += Workers[i].Result.Dirs;
+            result.Entries += Workers[i].Result.Entries;
+        }
+        result.Found = (int)Found.size();
+        return result;
+    }
+};
+
+// walks the tree at 'root' (workers 0 = serially); returns the time in milliseconds or -1 on error
+static double WalkTree(const std::string& root, int workers, CWalkResult* result)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (workers == 0)
+    {
+        char path[MAX_PATH + 2];
+        memset(result, 0, sizeof(*result));
+        strcpy(path, root.c_str());
+        WalkSerial(path, (int)root.size(), result);
+    }
+    else
+    {
+        volatile BOOL stop = FALSE;
+        CBenchCallback callback(workers);
+        CParallelDirWalker walker(&callback, workers, &stop);
+        if (!walker.IsGood() || !walker.Walk(root.c_str()) || callback.Errors != 0)
+        {
+            fprintf(stderr, "the walk failed\n");
+            return -1;
+        }
+        *result = callback.GetResult();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        fprintf(stderr, "usage: dirbench <directory> [-w <n>] [-d <n>] [-f <n>] [-t <list>] [-l <us>] [-m <s>] [-r <n>] [-k]\n");
+        return 1;
+    }
+    std::string root = argv[1];
+    if (!root.empty() && root[root.size() - 1] != DIRBENCH_SEP)
+        root += DIRBENCH_SEP;
+    root += "dirbench.tmp";
+
+    int width = 4;
+    int depth = 5;
+    int files = 20;
+    int repeats = 3;
+    BOOL keep = FALSE;
+    std::vector<int> workers = {1, 2, 4, 8, 16};
+    int i;
+    for (i = 2; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "-k") == 0)
+            keep = TRUE;
+        else if (value == NULL)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return 1;
+        }
+        else
+        {
+            if (strcmp(arg, "-w") == 0)
+                width = atoi(value);
+            else if (strcmp(arg, "-d") == 0)
+                depth = atoi(value);
+            else if (strcmp(arg, "-f") == 0)
+                files = atoi(value);
+            else if (strcmp(arg, "-l") == 0)
+                Latency = atoi(value);
+            else if (strcmp(arg, "-m") == 0)
+                Suffix = value;
+            else if (strcmp(arg, "-r") == 0)
+                repeats = atoi(value);
+            else if (strcmp(arg, "-t") == 0)
+            {
+                workers.clear();
+                const char* s = value;
+                while (*s != 0)
+                {
+                    workers.push_back(atoi(s));
+                    while (*s != 0 && *s != ',')
+                        s++;
+                    if (*s == ',')
+                        s++;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return 1;
+            }
+            i++;
+        }
+    }
+    BOOL validWorkers = !workers.empty();
+    size_t w;
+    for (w = 0; w < workers.size(); w++)
+    {
+        if (workers[w] < 1 || workers[w] > DIRWALK_MAX_WORKERS)
+            validWorkers = FALSE;
+    }
+    if (width < 0 || depth < 0 || files < 0 || Latency < 0 || repeats < 1 || !validWorkers)
+    {
+        fprintf(stderr, "invalid options\n");
+        return 1;
+    }
+
+    // an existing tree is reused (see -k), it is expected to be created with the same options
+    WIN32_FIND_DATA file;
+    HANDLE find = FindFirstFile((root + "\\*").c_str(), &file);
+    if (find != INVALID_HANDLE_VALUE)
+        FindClose(find);
+    else if (!CreateTree(root, width, depth, files))
+        return 1;
+
+    printf("way,workers,dirs,entries,found,ms,entries_per_s,same_result\n");
+    CWalkResult reference = {0, 0, 0};
+    int exitCode = 0;
+    for (w = 0; w <= workers.size() && exitCode == 0; w++)
+    {
+        int count = w == 0 ? 0 : workers[w - 1];
+        double best = -1;
+        CWalkResult result;
+        int r;
+        for (r = 0; r < repeats; r++)
+        {
+            double ms = WalkTree(root + "\\", count, &result);
+            if (ms < 0)
+            {
+                exitCode = 1;
+                break;
+            }
+            if (best < 0 || ms < best)
+                best = ms;
+        }
+        if (exitCode != 0)
+            break;
+        if (w == 0)
+            reference = result;
+        BOOL same = result.Dirs == reference.Dirs && result.Entries == reference.Entries &&
+                    result.Found == reference.Found;
+        printf("%s,%d,%d,%d,%d,%.1f,%.0f,%s\n", w == 0 ? "serial" : "walker", w == 0 ? 1 : count, result.Dirs,
+               result.Entries, result.Found, best, best > 0 ? result.Entries * 1000.0 / best : 0.0,
+               w == 0 ? "-" : (same ? "yes" : "NO"));
+        fflush(stdout);
+    }
+
+    if (!keep)
+        RemoveTree(root);
+    return exitCode;
+}
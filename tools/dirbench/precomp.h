@@ -0,0 +1,459 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/dirwalk.cpp outside of Salamander; the walker needs
+// critical sections, events, threads and FindFirstFile/FindNextFile, so on other systems
+// they are emulated here (pthreads and opendir/readdir/fstatat)
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else // _WIN32
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef int BOOL;
+typedef int32_t LONG;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+#define __int64 long long
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+
+#define NO_ERROR 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_PATH_NOT_FOUND 3
+#define ERROR_ACCESS_DENIED 5
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_NO_MORE_FILES 18
+#define ERROR_GEN_FAILURE 31
+#define ERROR_FILENAME_EXCED_RANGE 206
+#define ERROR_DIRECTORY 267
+
+#define FILE_ATTRIBUTE_READONLY 0x00000001
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE 0x00000020
+#define FILE_ATTRIBUTE_REPARSE_POINT 0x00000400
+
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+
+struct WIN32_FIND_DATA
+{
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+    DWORD dwReserved0;
+    DWORD dwReserved1;
+    char cFileName[MAX_PATH];
+    char cAlternateFileName[14];
+};
+
+struct SYSTEM_INFO
+{
+    DWORD dwNumberOfProcessors;
+};
+
+inline void GetSystemInfo(SYSTEM_INFO* si)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    si->dwNumberOfProcessors = count > 0 ? (DWORD)count : 1;
+}
+
+inline DWORD& ShimLastError()
+{
+    static thread_local DWORD err = NO_ERROR;
+    return err;
+}
+
+inline DWORD GetLastError() { return ShimLastError(); }
+inline void SetLastError(DWORD err) { ShimLastError() = err; }
+
+inline DWORD ShimErrorFromErrno(int err)
+{
+    switch (err)
+    {
+    case ENOENT:
+        return ERROR_PATH_NOT_FOUND;
+    case EACCES:
+    case EPERM:
+        return ERROR_ACCESS_DENIED;
+    case ENOMEM:
+        return ERROR_NOT_ENOUGH_MEMORY;
+    case ENAMETOOLONG:
+        return ERROR_FILENAME_EXCED_RANGE;
+    case ENOTDIR:
+        return ERROR_DIRECTORY;
+    default:
+        return ERROR_GEN_FAILURE;
+    }
+}
+
+inline LONG InterlockedIncrement(volatile LONG* value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* value)
+{
+    return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+inline DWORD GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// critical section (recursive like the Windows one)
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+inline void InitializeCriticalSection(CRITICAL_SECTION* cs)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+inline void DeleteCriticalSection(CRITICAL_SECTION* cs) { pthread_mutex_destroy(cs); }
+inline void EnterCriticalSection(CRITICAL_SECTION* cs) { pthread_mutex_lock(cs); }
+inline void LeaveCriticalSection(CRITICAL_SECTION* cs) { pthread_mutex_unlock(cs); }
+
+// handles: events, threads and directory listings
+
+struct CShimObject
+{
+    virtual ~CShimObject() {}
+    virtual BOOL IsSignaled() { return FALSE; } // called under ShimWaitLock()
+    virtual void Acquired() {}                  // a wait took the signaled object (under ShimWaitLock())
+};
+
+typedef CShimObject* HANDLE;
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+// all waitable objects share one lock and one condition, a woken thread tests its objects again
+inline pthread_mutex_t* ShimWaitLock()
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    return &lock;
+}
+
+inline pthread_cond_t* ShimWaitCond()
+{
+    static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    return &cond;
+}
+
+struct CShimEvent : public CShimObject
+{
+    BOOL ManualReset;
+    BOOL Signaled;
+
+    virtual BOOL IsSignaled() { return Signaled; }
+    virtual void Acquired()
+    {
+        if (!ManualReset)
+            Signaled = FALSE;
+    }
+};
+
+inline HANDLE CreateEvent(void* /*security*/, BOOL manualReset, BOOL initialState, const char* /*name*/)
+{
+    CShimEvent* event = new CShimEvent;
+    event->ManualReset = manualReset;
+    event->Signaled = initialState;
+    return event;
+}
+
+inline BOOL SetEvent(HANDLE event)
+{
+    pthread_mutex_lock(ShimWaitLock());
+    ((CShimEvent*)event)->Signaled = TRUE;
+    pthread_cond_broadcast(ShimWaitCond());
+    pthread_mutex_unlock(ShimWaitLock());
+    return TRUE;
+}
+
+inline BOOL ResetEvent(HANDLE event)
+{
+    pthread_mutex_lock(ShimWaitLock());
+    ((CShimEvent*)event)->Signaled = FALSE;
+    pthread_mutex_unlock(ShimWaitLock());
+    return TRUE;
+}
+
+inline DWORD WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL /*waitAll*/, DWORD timeout)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (timeout != INFINITE)
+    {
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    DWORD ret = WAIT_TIMEOUT;
+    pthread_mutex_lock(ShimWaitLock());
+    while (TRUE)
+    {
+        DWORD i;
+        for (i = 0; i < count; i++)
+        {
+            if (handles[i]->IsSignaled())
+            {
+                handles[i]->Acquired();
+                break;
+            }
+        }
+        if (i < count)
+        {
+            ret = WAIT_OBJECT_0 + i;
+            break;
+        }
+        if (timeout == INFINITE)
+            pthread_cond_wait(ShimWaitCond(), ShimWaitLock());
+        else if (pthread_cond_timedwait(ShimWaitCond(), ShimWaitLock(), &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(ShimWaitLock());
+    return ret;
+}
+
+inline DWORD WaitForSingleObject(HANDLE handle, DWORD timeout)
+{
+    return WaitForMultipleObjects(1, &handle, FALSE, timeout);
+}
+
+typedef DWORD(WINAPI* LPTHREAD_START_ROUTINE)(void* param);
+
+struct CShimThread : public CShimObject
+{
+    pthread_t Thread;
+    LPTHREAD_START_ROUTINE Start;
+    void* Param;
+    BOOL Finished;
+
+    virtual ~CShimThread() { pthread_join(Thread, NULL); } // CloseHandle is called after the thread ended
+    virtual BOOL IsSignaled() { return Finished; }
+};
+
+inline void* ShimThreadBody(void* param)
+{
+    CShimThread* thread = (CShimThread*)param;
+    thread->Start(thread->Param);
+    pthread_mutex_lock(ShimWaitLock());
+    thread->Finished = TRUE;
+    pthread_cond_broadcast(ShimWaitCond());
+    pthread_mutex_unlock(ShimWaitLock());
+    return NULL;
+}
+
+inline HANDLE CreateThread(void* /*security*/, size_t /*stackSize*/, LPTHREAD_START_ROUTINE start, void* param,
+                           DWORD /*flags*/, DWORD* threadID)
+{
+    CShimThread* thread = new CShimThread;
+    thread->Start = start;
+    thread->Param = param;
+    thread->Finished = FALSE;
+    if (pthread_create(&thread->Thread, NULL, ShimThreadBody, thread) != 0)
+    {
+        delete thread;
+        return NULL;
+    }
+    if (threadID != NULL)
+        *threadID = 0;
+    return thread;
+}
+
+inline HANDLE GetCurrentThread() { return NULL; }
+inline int GetThreadPriority(HANDLE /*thread*/) { return 0; }
+inline BOOL SetThreadPriority(HANDLE /*thread*/, int /*priority*/) { return TRUE; }
+
+// the listing of a directory, one entry is read ahead (FindFirstFile returns the first one)
+struct CShimFind : public CShimObject
+{
+    DIR* Dir;
+
+    virtual ~CShimFind() { closedir(Dir); }
+};
+
+// UNIX time 'sec' + 'nsec' in the FILETIME format (100 ns since 1601)
+inline FILETIME ShimFileTime(time_t sec, long nsec)
+{
+    unsigned long long t = ((unsigned long long)sec + 11644473600ULL) * 10000000 + nsec / 100;
+    FILETIME ft;
+    ft.dwLowDateTime = (DWORD)t;
+    ft.dwHighDateTime = (DWORD)(t >> 32);
+    return ft;
+}
+
+inline BOOL ShimReadEntry(CShimFind* find, WIN32_FIND_DATA* data)
+{
+    struct dirent* entry;
+    errno = 0;
+    while ((entry = readdir(find->Dir)) != NULL)
+    {
+        // like FindFirstFile, the listing returns the size, times and attributes of the entries
+        struct stat st;
+        if (fstatat(dirfd(find->Dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            errno = 0;
+            continue; // deleted in the meantime
+        }
+        memset(data, 0, sizeof(*data));
+        if (S_ISDIR(st.st_mode))
+            data->dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+        else if (S_ISLNK(st.st_mode))
+            data->dwFileAttributes = FILE_ATTRIBUTE_REPARSE_POINT; // symbolic links are not followed
+        else
+        {
+            data->dwFileAttributes = FILE_ATTRIBUTE_ARCHIVE;
+            data->nFileSizeLow = (DWORD)st.st_size;
+            data->nFileSizeHigh = (DWORD)((unsigned long long)st.st_size >> 32);
+        }
+        if ((st.st_mode & S_IWUSR) == 0)
+            data->dwFileAttributes |= FILE_ATTRIBUTE_READONLY;
+        data->ftCreationTime = ShimFileTime(st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+        data->ftLastAccessTime = ShimFileTime(st.st_atim.tv_sec, st.st_atim.tv_nsec);
+        data->ftLastWriteTime = ShimFileTime(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+        strncpy(data->cFileName, entry->d_name, MAX_PATH - 1);
+        return TRUE;
+    }
+    SetLastError(errno != 0 ? ShimErrorFromErrno(errno) : ERROR_NO_MORE_FILES);
+    return FALSE;
+}
+
+// 'pattern' is "<directory>\*" with backslashes as separators (Salamander paths)
+inline HANDLE FindFirstFile(const char* pattern, WIN32_FIND_DATA* data)
+{
+    char dir[2 * MAX_PATH];
+    int len = (int)strlen(pattern);
+    if (len >= (int)sizeof(dir))
+    {
+        SetLastError(ERROR_FILENAME_EXCED_RANGE);
+        return INVALID_HANDLE_VALUE;
+    }
+    int i;
+    for (i = 0; i <= len; i++)
+        dir[i] = pattern[i] == '\\' ? '/' : pattern[i];
+    if (len > 0 && dir[len - 1] == '*')
+        dir[--len] = 0;
+    if (len == 0)
+        strcpy(dir, ".");
+    DIR* d = opendir(dir);
+    if (d == NULL)
+    {
+        SetLastError(ShimErrorFromErrno(errno));
+        return INVALID_HANDLE_VALUE;
+    }
+    CShimFind* find = new CShimFind;
+    find->Dir = d;
+    if (!ShimReadEntry(find, data))
+    {
+        DWORD err = GetLastError();
+        delete find;
+        SetLastError(err == ERROR_NO_MORE_FILES ? ERROR_FILE_NOT_FOUND : err);
+        return INVALID_HANDLE_VALUE;
+    }
+    return find;
+}
+
+inline BOOL FindNextFile(HANDLE find, WIN32_FIND_DATA* data)
+{
+    return ShimReadEntry((CShimFind*)find, data);
+}
+
+inline BOOL FindClose(HANDLE find)
+{
+    delete find;
+    return TRUE;
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+    delete handle;
+    return TRUE;
+}
+
+#endif // _WIN32
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ostream>
+#include <sstream>
+
+// the walker reports only unexpected situations through TRACE, print them to stderr
+// (an expression, TRACE_C is used inside expressions)
+#define DIRBENCH_TRACE(kind, msg) \
+    ([&]() \
+     { \
+         std::ostringstream _s; \
+         _s << msg; \
+         fprintf(stderr, "%s: %s\n", kind, _s.str().c_str()); \
+     }())
+
+#define TRACE_I(str) DIRBENCH_TRACE("info", str)
+#define TRACE_E(str) DIRBENCH_TRACE("error", str)
+#define TRACE_C(str) (DIRBENCH_TRACE("fatal", str), abort())
+#define LOW_MEMORY "Low memory"
+
+// Salamander's handle and call stack monitoring is not used here
+#define CALLSTK_DISABLE
+#define HANDLES(func) (func)
+#define HANDLES_Q(func) (func)
+#define CALL_STACK_MESSAGE1(...)
+#define CALL_STACK_MESSAGE3(...)
+#define SLOW_CALL_STACK_MESSAGE2(...)
+#define SetThreadNameInVCAndTrace(name)
+
+template <class T>
+inline T min(T a, T b) { return a < b ? a : b; }
+
+// TDirectArray of src/common/array.h (built with MSVC only, GCC warns about its style)
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdangling-else"
+#pragma GCC diagnostic ignored "-Woverflow"
+#endif
+#include "array.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,455 @@
+﻿/*
+    Benchmark of the storage of a panel listing in Salamander (CFilesArray in
+    src/salamand.h filled by CFilesWindow::ReadDirectory in src/fileswn3.cpp, sorted
+    by src/sort.cpp). A synthetic listing of a large directory is built, sorted and
+    released in these ways:
+
+      • "heap"    - every name (and DOS name) is a separate heap allocation, the sort
+                    is the quicksort over whole items (how Salamander did it before).
+
+      • "columns" - the names are allocated in CNameArena and released at once, the
+                    sort selects its keys into CListingColumns, sorts only indexes and
+                    then moves every item once (src/common/liststore.cpp), the names
+                    are always compared by the comparison function.
+
+      • "keys"    - the same as "columns", but the sort builds the name keys once per
+                    item and compares the names only when the name keys are equal.
+
+      • "keys-mt" - the same as "keys", the listing is sorted in parts by more threads
+                    and the parts are merged (like SortByColumns in src/sort.cpp).
+
+    All ways sort by the same key and then by the name with the comparisons of the
+    panel: ListingCmpNames and ListingCmpExtName from src/common/liststore.cpp, which
+    CmpNames and CmpExtName in src/sort.cpp call with the rules of the configuration
+    (here without the regional option; with -l the numbers in names compare by value
+    like StrCmpLogicalEx); the tool checks that all give the same order as "heap".
+
+    Usage:
+      listbench [options]
+        -n <n>   items in the listing (default 1000000)
+        -k <s>   sort key: name, ext, size, time or attr (default size)
+        -d       descending sort
+        -l       compare numbers in names by value ("Detect numbers" option)
+        -t <n>   threads of "keys-mt" (default number of processors, max. 8)
+        -r <n>   repetitions of every measurement, the fastest is reported (default 3)
+        -s <n>   seed of the random generator (default 1)
+
+    Output:
+      One CSV line per way: way,items,allocs,build_ms,sort_ms,free_ms,total_ms,same_order
+      ("allocs" counts the allocations of names, one per block for the arena).
+*/
+
+#include "precomp.h"
+
+#include <ctype.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "liststore.h"
+
+// the fields of CFileData (src/plugins/shared/spl_com.h) in the same layout, so the moved
+// items are as large as in Salamander
+struct CBenchFileData
+{
+    char* Name;
+    char* Ext;
+    unsigned __int64 Size;
+    DWORD Attr;
+    DWORD LastWriteLow;
+    DWORD LastWriteHigh;
+    char* DosName;
+    DWORD_PTR PluginData;
+    unsigned NameLen : 9;
+    unsigned Flags : 23;
+};
+
+// source of the listing (what FindFirstFile/FindNextFile would return)
+struct CBenchSource
+{
+    std::vector<char> Names; // names and DOS names, each terminated by null
+    std::vector<int> NameOffset;
+    std::vector<int> DosNameOffset; // -1 = no DOS name
+    std::vector<unsigned __int64> Size;
+    std::vector<unsigned __int64> LastWrite;
+    std::vector<DWORD> Attr;
+};
+
+static unsigned int Seed = 1;
+
+static unsigned int Random()
+{
+    Seed = Seed * 1103515245 + 12345;
+    return (Seed >> 8) & 0xFFFFFF;
+}
+
+static void CreateSource(CBenchSource* src, int count)
+{
+    // names starting with numbers (also with leading zeros) and with dots, so the name keys meet
+    // all kinds of the parts of names
+    static const char* prefixes[] = {"IMG_", "report ", "data", "Backup-", "track", "x", "Setup_v", "~tmp", "", "00", "v1.2.", ".cfg"};
+    static const char* exts[] = {".jpg", ".txt", ".dll", ".log", ".mp3", "", ".tar.gz", ".cpp"};
+    static const DWORD attrs[] = {FILE_ATTRIBUTE_ARCHIVE, FILE_ATTRIBUTE_ARCHIVE, 0, FILE_ATTRIBUTE_READONLY,
+                                  FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_HIDDEN, FILE_ATTRIBUTE_COMPRESSED,
+                                  FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_SYSTEM,
+                                  FILE_ATTRIBUTE_TEMPORARY};
+    char name[100];
+    char dosName[20];
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        sprintf(name, "%s%u_%d%s", prefixes[Random() % 12], Random() % 100000, i, exts[Random() % 8]);
+        if (Random() % 2 == 0) // mixed case, so the case-sensitive tie-breaker is needed sometimes
+            name[0] = (char)toupper((unsigned char)name[0]);
+        src->NameOffset.push_back((int)src->Names.size());
+        src->Names.insert(src->Names.end(), name, name + strlen(name) + 1);
+        if (strlen(name) > 12 || strchr(name, ' ') != NULL)
+        {
+            sprintf(dosName, "%.6s~%d.EXT", name, 1 + i % 4);
+            src->DosNameOffset.push_back((int)src->Names.size());
+            src->Names.insert(src->Names.end(), dosName, dosName + strlen(dosName) + 1);
+        }
+        else
+            src->DosNameOffset.push_back(-1);
+        // many equal sizes and times, so the sort falls back to the names often
+        src->Size.push_back(Random() % 4 == 0 ? (Random() % 64) * 4096 : (unsigned __int64)Random() * 37);
+        src->LastWrite.push_back(132000000000000000ULL + (unsigned __int64)(Random() % 5000) * 10000000);
+        src->Attr.push_back(attrs[Random() % 8]);
+    }
+}
+
+static unsigned char LowerCase[256]; // stand-in for LowerCase from src/common/str.cpp
+static CListingNameKeyRules Rules;   // the rules of the comparisons of names
+
+// the comparisons of the panel (ListingCmpNames() and ListingCmpExtName() from src/common/liststore.cpp
+// called by CmpNames() and CmpExtName() in src/sort.cpp) as CmpNamesOfItems() and CmpExtNamesOfItems()
+// in src/sort.cpp pass them to CListingColumns
+static int CmpNamesOfItems(const char* name1, int len1, int /*extOffset1*/, const char* name2, int len2, int /*extOffset2*/)
+{
+    return ListingCmpNames(name1, len1, name2, len2, &Rules);
+}
+
+static int CmpExtNamesOfItems(const char* name1, int len1, int extOffset1, const char* name2, int len2, int extOffset2)
+{
+    return ListingCmpExtName(name1, len1, name1 + extOffset1, name2, len2, name2 + extOffset2, &Rules);
+}
+
+static CListingSortKey Key = lskSize;
+static BOOL Reverse = FALSE;
+
+// stand-in for LessSizeNameExt() etc. from src/sort.cpp
+static BOOL Less(const CBenchFileData& f1, const CBenchFileData& f2)
+{
+    int res = 0;
+    switch (Key)
+    {
+    case lskSize:
+        res = f1.Size < f2.Size ? -1 : f1.Size > f2.Size ? 1 : 0;
+        break;
+    case lskTime:
+    {
+        unsigned __int64 t1 = ((unsigned __int64)f1.LastWriteHigh << 32) | f1.LastWriteLow;
+        unsigned __int64 t2 = ((unsigned __int64)f2.LastWriteHigh << 32) | f2.LastWriteLow;
+        res = t1 < t2 ? -1 : t1 > t2 ? 1 : 0;
+        break;
+    }
+    case lskAttr:
+    {
+        DWORD a1 = CListingColumns::ListingAttrSortKey(f1.Attr);
+        DWORD a2 = CListingColumns::ListingAttrSortKey(f2.Attr);
+        res = a1 < a2 ? -1 : a1 > a2 ? 1 : 0;
+        break;
+    }
+    case lskExt:
+    {
+        res = ListingCmpExtName(f1.Name, f1.NameLen, f1.Ext, f2.Name, f2.NameLen, f2.Ext, &Rules);
+        break;
+    }
+    default:
+        break;
+    }
+    if (res == 0 && Key != lskExt)
+        res = ListingCmpNames(f1.Name, f1.NameLen, f2.Name, f2.NameLen, &Rules);
+    return Reverse ? res > 0 : res < 0;
+}
+
+// the quicksort from src/sort.cpp (SortSizeNameExtAux, etc.)
+static void SortItems(CBenchFileData* files, int left, int right)
+{
+    int i = left, j = right;
+    CBenchFileData pivot = files[(i + j) / 2];
+    do
+    {
+        while (Less(files[i], pivot) && i < right)
+            i++;
+        while (Less(pivot, files[j]) && j > left)
+            j--;
+        if (i <= j)
+        {
+            CBenchFileData swap = files[i];
+            files[i] = files[j];
+            files[j] = swap;
+            i++;
+            j--;
+        }
+    } while (i <= j);
+    if (left < j)
+        SortItems(files, left, j);
+    if (i < right)
+        SortItems(files, i, right);
+}
+
+// the same as SortByColumns() in src/sort.cpp; 'rules' == NULL means no name keys
+static BOOL SortByColumns(CListingColumns* cols, CBenchFileData* items, int count,
+                          const CListingNameKeyRules* rules, int threads)
+{
+    if (!cols->SetCount(count))
+        return FALSE;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        CBenchFileData* f = &items[i];
+        cols->Set(i, f->Name, f->NameLen, f->Size, f->LastWriteLow, f->LastWriteHigh, f->Attr, (int)(f->Ext - f->Name));
+    }
+    CListingItemCompare cmp = Key == lskExt ? CmpExtNamesOfItems : CmpNamesOfItems;
+    int runs = cols->PrepareSort(Key, Reverse, Reverse, cmp, rules, threads);
+    std::vector<std::thread> helpers;
+    for (i = 1; i < runs; i++)
+        helpers.push_back(std::thread([cols, i]() { cols->SortRun(i); }));
+    cols->SortRun(0);
+    for (i = 0; i < (int)helpers.size(); i++)
+        helpers[i].join();
+    cols->FinishSort();
+    int* order = cols->Order;
+    for (i = 0; i < count; i++)
+    {
+        if (order[i] != i)
+        {
+            CBenchFileData tmp = items[i];
+            int j = i;
+            while (order[j] != i)
+            {
+                int next = order[j];
+                items[j] = items[next];
+                order[j] = j;
+                j = next;
+            }
+            items[j] = tmp;
+            order[j] = j;
+        }
+    }
+    return TRUE;
+}
+
+struct CBenchResult
+{
+    double Build, Sort, Free;
+    long long Allocs;
+};
+
+static double Ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// builds, sorts and releases the listing; 'arena' == NULL means one allocation per name and
+// the quicksort over the items, otherwise the sort through 'cols' with 'rules' and 'threads';
+// 'names' gets the sorted names (only for the check of the order)
+static BOOL RunListing(const CBenchSource& src, CNameArena* arena, CListingColumns* cols,
+                       const CListingNameKeyRules* rules, int threads, CBenchFileData* items,
+                       std::vector<std::string>* names, CBenchResult* res)
+{
+    int count = (int)src.NameOffset.size();
+    res->Allocs = 0;
+
+    // build: the same work with the names as ReadDirectory() does
+    auto start = std::chrono::steady_clock::now();
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        CBenchFileData* f = &items[i];
+        const char* name = &src.Names[src.NameOffset[i]];
+        int len = (int)strlen(name);
+        if (arena != NULL)
+            f->Name = arena->AllocName(name, len);
+        else
+        {
+            f->Name = (char*)malloc(len + 1);
+            if (f->Name != NULL)
+                memcpy(f->Name, name, len + 1);
+            res->Allocs++;
+        }
+        if (f->Name == NULL)
+            return FALSE;
+        f->NameLen = len;
+        const char* ext = strrchr(f->Name, '.');
+        f->Ext = ext != NULL ? f->Name + (ext - f->Name + 1) : f->Name + len;
+        if (src.DosNameOffset[i] != -1)
+        {
+            const char* dosName = &src.Names[src.DosNameOffset[i]];
+            int dosLen = (int)strlen(dosName);
+            if (arena != NULL)
+                f->DosName = arena->AllocName(dosName, dosLen);
+            else
+            {
+                f->DosName = (char*)malloc(dosLen + 1);
+                if (f->DosName != NULL)
+                    memcpy(f->DosName, dosName, dosLen + 1);
+                res->Allocs++;
+            }
+            if (f->DosName == NULL)
+                return FALSE;
+        }
+        else
+            f->DosName = NULL;
+        f->Size = src.Size[i];
+        f->LastWriteLow = (DWORD)src.LastWrite[i];
+        f->LastWriteHigh = (DWORD)(src.LastWrite[i] >> 32);
+        f->Attr = src.Attr[i];
+        f->PluginData = 0;
+        f->Flags = 0;
+    }
+    res->Build = Ms(start);
+    if (arena != NULL)
+        res->Allocs = arena->GetBlocksCount();
+
+    start = std::chrono::steady_clock::now();
+    if (cols != NULL)
+    {
+        if (!SortByColumns(cols, items, count, rules, threads))
+            return FALSE;
+    }
+    else if (count > 1)
+        SortItems(items, 0, count - 1);
+    res->Sort = Ms(start);
+
+    if (names != NULL)
+    {
+        names->clear();
+        for (i = 0; i < count; i++)
+            names->push_back(items[i].Name);
+    }
+
+    start = std::chrono::steady_clock::now();
+    if (arena != NULL)
+        arena->Reset();
+    else
+    {
+        for (i = 0; i < count; i++)
+        {
+            free(items[i].Name);
+            if (items[i].DosName != NULL)
+                free(items[i].DosName);
+        }
+    }
+    res->Free = Ms(start);
+    return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = 1000000;
+    int repeats = 3;
+    int threads = (int)std::thread::hardware_concurrency();
+    if (threads > LISTING_MAX_SORT_RUNS)
+        threads = LISTING_MAX_SORT_RUNS;
+    if (threads < 1)
+        threads = 1;
+    int i;
+    for (i = 0; i < 256; i++)
+        LowerCase[i] = (unsigned char)tolower(i);
+    Rules.LowerCase = LowerCase;
+    Rules.Numbers = FALSE;
+    Rules.Dots = FALSE;
+    for (i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "-d") == 0)
+            Reverse = TRUE;
+        else if (strcmp(arg, "-l") == 0)
+        {
+            Rules.Numbers = TRUE;
+            Rules.Dots = TRUE; // like Windows Vista and later without the NoDotBreakInLogicalCompare policy
+        }
+        else if (value == NULL)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return 1;
+        }
+        else
+        {
+            if (strcmp(arg, "-n") == 0)
+                count = atoi(value);
+            else if (strcmp(arg, "-r") == 0)
+                repeats = atoi(value);
+            else if (strcmp(arg, "-t") == 0)
+                threads = atoi(value);
+            else if (strcmp(arg, "-s") == 0)
+                Seed = (unsigned int)atoi(value);
+            else if (strcmp(arg, "-k") == 0)
+            {
+                if (strcmp(value, "name") == 0)
+                    Key = lskName;
+                else if (strcmp(value, "ext") == 0)
+                    Key = lskExt;
+                else if (strcmp(value, "size") == 0)
+                    Key = lskSize;
+                else if (strcmp(value, "time") == 0)
+                    Key = lskTime;
+                else if (strcmp(value, "attr") == 0)
+                    Key = lskAttr;
+                else
+                {
+                    fprintf(stderr, "unknown sort key %s\n", value);
+                    return 1;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return 1;
+            }
+            i++;
+        }
+    }
+    if (count < 1 || repeats < 1 || threads < 1)
+    {
+        fprintf(stderr, "invalid options\n");
+        return 1;
+    }
+
+    CBenchSource src;
+    CreateSource(&src, count);
+    std::vector<CBenchFileData> items(count);
+    std::vector<std::string> heapOrder;
+    std::vector<std::string> order;
+
+    static const char* ways[] = {"heap", "columns", "keys", "keys-mt"};
+    printf("way,items,allocs,build_ms,sort_ms,free_ms,total_ms,same_order\n");
+    int way;
+    for (way = 0; way < 4; way++)
+    {
+        CNameArena arena; // one listing object per way: the arena and the columns are reused by the repetitions
+        CListingColumns cols;
+        CBenchResult best = {0, 0, 0, 0};
+        int r;
+        for (r = 0; r < repeats; r++)
+        {
+            CBenchResult res;
+            if (!RunListing(src, way > 0 ? &arena : NULL, way > 0 ? &cols : NULL, way >= 2 ? &Rules : NULL,
+                            way == 3 ? threads : 1, &items[0], r == 0 ? (way == 0 ? &heapOrder : &order) : NULL, &res))
+            {
+                fprintf(stderr, "low memory\n");
+                return 1;
+            }
+            if (r == 0 || res.Build + res.Sort + res.Free < best.Build + best.Sort + best.Free)
+                best = res;
+        }
+        printf("%s,%d,%lld,%.1f,%.1f,%.1f,%.1f,%s\n", ways[way], count, best.Allocs,
+               best.Build, best.Sort, best.Free, best.Build + best.Sort + best.Free,
+               way == 0 ? "-" : (heapOrder == order ? "yes" : "NO"));
+    }
+    return 0;
+}
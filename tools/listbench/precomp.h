@@ -0,0 +1,47 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/liststore.cpp outside of Salamander; the
+// listing storage needs only a few Windows types and FILE_ATTRIBUTE_XXX constants, so on
+// other systems they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else // _WIN32
+
+#include <stdint.h>
+
+typedef int BOOL;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef uintptr_t DWORD_PTR;
+#define __int64 long long
+#define TRUE 1
+#define FALSE 0
+
+#define FILE_ATTRIBUTE_READONLY 0x00000001
+#define FILE_ATTRIBUTE_HIDDEN 0x00000002
+#define FILE_ATTRIBUTE_SYSTEM 0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE 0x00000020
+#define FILE_ATTRIBUTE_TEMPORARY 0x00000100
+#define FILE_ATTRIBUTE_COMPRESSED 0x00000800
+#define FILE_ATTRIBUTE_ENCRYPTED 0x00004000
+
+#endif // _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the storage reports only low memory through TRACE_E
+#define TRACE_E(str) fprintf(stderr, "error: %s\n", str)
@@ -0,0 +1,66 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/devsched.cpp outside of Salamander; the
+// scheduler needs only a few Windows types, so on other systems they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else // _WIN32
+
+#include <stdint.h>
+#include <string.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef uintptr_t DWORD_PTR;
+#define TRUE 1
+#define FALSE 0
+
+inline char* lstrcpyn(char* dst, const char* src, int max)
+{
+    if (max > 0)
+    {
+        strncpy(dst, src, max - 1);
+        dst[max - 1] = 0;
+    }
+    return dst;
+}
+
+#endif // _WIN32
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <ostream>
+#include <sstream>
+
+// the scheduler reports only unexpected situations through TRACE, print them to stderr
+// (an expression, TRACE_C is used inside expressions)
+#define QUEUEBENCH_TRACE(kind, msg) \
+    ([&]() \
+     { \
+         std::ostringstream _s; \
+         _s << msg; \
+         fprintf(stderr, "%s: %s\n", kind, _s.str().c_str()); \
+     }())
+
+#define TRACE_I(str) QUEUEBENCH_TRACE("info", str)
+#define TRACE_E(str) QUEUEBENCH_TRACE("error", str)
+#define TRACE_C(str) (QUEUEBENCH_TRACE("fatal", str), abort())
+
+#include "array.h"
@@ -0,0 +1,387 @@
+﻿/*
+    Simulation of the queue of disk Copy/Move operations in Salamander
+    (COperationsQueue in src/worker.cpp, the scheduling itself is CDeviceScheduler
+    from src/common/devsched.cpp). Random jobs copy data between simulated
+    devices and the time needed to finish them all is compared for three ways of
+    running the queue:
+
+      • "all"      - every job starts when it is added (Salamander without the
+                     queue, or with the scheduler switched off).
+
+      • "serial"   - one job at a time in the order of the queue (every job
+                     with "start on idle").
+
+      • "devsched" - CDeviceScheduler with the device limits used by Salamander
+                     (DEVSCHED_LIMIT_* in src/common/devsched.h).
+
+    Simulated devices (the time is simulated too, so the result does not depend
+    on the machine and the tool builds on Linux as well):
+
+      hdd1, hdd2  rotating disks, 150 MB/s; every further concurrent stream costs
+                  35% of the throughput (seeking between the streams)
+      ssd         500 MB/s, one stream gets at most half of it
+      nas         network server, 110 MB/s; every further stream costs 15%
+
+    A job reads from its source and writes to its target device; a copy within
+    one device uses it for both, so it counts as two streams there. All streams
+    of a device share its throughput equally, a job runs at the speed of its
+    slowest stream.
+
+    Usage:
+      queuebench [options]
+        -j <n>   jobs in one run (default 12)
+        -r <n>   runs with different random jobs, the results are summed (default 50)
+        -a <s>   mean time between adding the jobs in seconds (default 0 = all at once)
+        -s <n>   seed of the random generator (default 1)
+        -v       print every run
+
+    Output:
+      For every policy the summed makespan (time until all jobs of a run are
+      finished), the throughput (copied data / makespan) and the mean time from
+      adding a job to its end.
+*/
+
+#include "precomp.h"
+
+#include "devsched.h"
+
+#define SIM_KIND_HDD 0
+#define SIM_KIND_SSD 1
+#define SIM_KIND_NET 2
+
+struct CSimDevice
+{
+    const char* Key;
+    int Kind;
+    double Bandwidth; // in MB/s
+    int Streams;      // streams of the running jobs (computed in UpdateRates())
+};
+
+static CSimDevice SimDevices[] = {
+    {"hdd1", SIM_KIND_HDD, 150, 0},
+    {"hdd2", SIM_KIND_HDD, 150, 0},
+    {"ssd", SIM_KIND_SSD, 500, 0},
+    {"nas", SIM_KIND_NET, 110, 0},
+};
+#define SIM_DEVICES (int)(sizeof(SimDevices) / sizeof(SimDevices[0]))
+
+// throughput of one of 'streams' concurrent streams of the device (in MB/s)
+static double GetStreamRate(const CSimDevice* dev, int streams)
+{
+    switch (dev->Kind)
+    {
+    case SIM_KIND_HDD:
+        return dev->Bandwidth / (1 + 0.35 * (streams - 1)) / streams;
+    case SIM_KIND_SSD:
+    {
+        double rate = dev->Bandwidth / streams;
+        return rate < dev->Bandwidth / 2 ? rate : dev->Bandwidth / 2;
+    }
+    default:
+        return dev->Bandwidth / (1 + 0.15 * (streams - 1)) / streams;
+    }
+}
+
+static int GetDeviceLimit(const CSimDevice* dev)
+{
+    switch (dev->Kind)
+    {
+    case SIM_KIND_HDD:
+        return DEVSCHED_LIMIT_HDD;
+    case SIM_KIND_SSD:
+        return DEVSCHED_LIMIT_SSD;
+    default:
+        return DEVSCHED_LIMIT_NETWORK;
+    }
+}
+
+enum CSimJobState
+{
+    sjsNotAdded,
+    sjsQueued,
+    sjsRunning,
+    sjsDone,
+};
+
+struct CSimJob
+{
+    double Added;     // the job is added to the queue at this time (in s)
+    int Source;       // index to SimDevices
+    int Target;       // index to SimDevices
+    double Size;      // in MB
+    double Remaining; // in MB
+    double Rate;      // current speed (in MB/s)
+    double End;
+    CSimJobState State;
+};
+
+enum CSimPolicy
+{
+    spAll,
+    spSerial,
+    spDevSched,
+};
+
+static const char* PolicyNames[] = {"all", "serial", "devsched"};
+
+// deterministic on all platforms (rand() is not)
+static DWORD RandSeed = 1;
+
+static double RandUniform()
+{
+    RandSeed = RandSeed * 1103515245 + 12345;
+    return ((RandSeed >> 8) & 0xFFFFFF) / (double)0x1000000;
+}
+
+static void GenerateJobs(CSimJob* jobs, int count, double meanGap)
+{
+    double time = 0;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        CSimJob* job = &jobs[i];
+        job->Added = time;
+        if (meanGap > 0)
+            time += -meanGap * log(1 - RandUniform());
+        job->Source = (int)(RandUniform() * SIM_DEVICES);
+        if (RandUniform() < 0.2) // copy within one device
+            job->Target = job->Source;
+        else
+            job->Target = (job->Source + 1 + (int)(RandUniform() * (SIM_DEVICES - 1))) % SIM_DEVICES;
+        job->Size = 500 + RandUniform() * 7500;
+    }
+}
+
+static void UpdateRates(CSimJob* jobs, int count)
+{
+    int i;
+    for (i = 0; i < SIM_DEVICES; i++)
+        SimDevices[i].Streams = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (jobs[i].State == sjsRunning)
+        {
+            SimDevices[jobs[i].Source].Streams++;
+            SimDevices[jobs[i].Target].Streams++;
+        }
+    }
+    for (i = 0; i < count; i++)
+    {
+        CSimJob* job = &jobs[i];
+        if (job->State == sjsRunning)
+        {
+            double src = GetStreamRate(&SimDevices[job->Source], SimDevices[job->Source].Streams);
+            double tgt = GetStreamRate(&SimDevices[job->Target], SimDevices[job->Target].Streams);
+            job->Rate = src < tgt ? src : tgt;
+        }
+    }
+}
+
+// starts the queued jobs allowed by 'policy'
+static void StartJobs(CSimPolicy policy, CSimJob* jobs, int count, CDeviceScheduler* scheduler,
+                      TDirectArray<DWORD_PTR>* started)
+{
+    int i;
+    switch (policy)
+    {
+    case spAll:
+    {
+        for (i = 0; i < count; i++)
+            if (jobs[i].State == sjsQueued)
+                jobs[i].State = sjsRunning;
+        break;
+    }
+
+    case spSerial:
+    {
+        for (i = 0; i < count; i++)
+            if (jobs[i].State == sjsRunning)
+                return;
+        for (i = 0; i < count; i++)
+        {
+            if (jobs[i].State == sjsQueued)
+            {
+                jobs[i].State = sjsRunning;
+                break;
+            }
+        }
+        break;
+    }
+
+    case spDevSched:
+    {
+        started->DestroyMembers();
+        scheduler->Schedule(started);
+        for (i = 0; i < started->Count; i++)
+            jobs[started->At(i)].State = sjsRunning;
+        break;
+    }
+    }
+}
+
+// simulates one run, returns the makespan (in s), adds the times from adding to the end
+// of the jobs to 'turnaround'
+static double Simulate(CSimPolicy policy, CSimJob* jobs, int count, double* turnaround)
+{
+    CDeviceScheduler scheduler;
+    TDirectArray<DWORD_PTR> started(10, 10);
+    int devices[SIM_DEVICES];
+    int i;
+    for (i = 0; i < SIM_DEVICES; i++)
+        devices[i] = scheduler.GetDevice(SimDevices[i].Key, GetDeviceLimit(&SimDevices[i]));
+
+    for (i = 0; i < count; i++)
+    {
+        jobs[i].State = sjsNotAdded;
+        jobs[i].Remaining = jobs[i].Size;
+        jobs[i].Rate = 0;
+    }
+
+    double time = 0;
+    int done = 0;
+    while (done < count)
+    {
+        // jobs added now
+        BOOL changed = FALSE;
+        for (i = 0; i < count; i++)
+        {
+            CSimJob* job = &jobs[i];
+            if (job->State == sjsNotAdded && job->Added <= time)
+            {
+                job->State = sjsQueued;
+                if (policy == spDevSched)
+                {
+                    int jobDevices[2] = {devices[job->Source], devices[job->Target]};
+                    scheduler.AddJob(i, jobDevices, 2, FALSE);
+                }
+                changed = TRUE;
+            }
+        }
+        if (changed)
+            StartJobs(policy, jobs, count, &scheduler, &started);
+        UpdateRates(jobs, count);
+
+        // the next event: a job ends or is added
+        double next = -1;
+        for (i = 0; i < count; i++)
+        {
+            CSimJob* job = &jobs[i];
+            double t = -1;
+            if (job->State == sjsRunning)
+                t = time + job->Remaining / job->Rate;
+            if (job->State == sjsNotAdded)
+                t = job->Added;
+            if (t >= 0 && (next < 0 || t < next))
+                next = t;
+        }
+        if (next < 0)
+        {
+            TRACE_E("Simulate(): nothing runs, the queue is stuck!");
+            return -1;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            CSimJob* job = &jobs[i];
+            if (job->State == sjsRunning)
+                job->Remaining -= (next - time) * job->Rate;
+        }
+        time = next;
+
+        changed = FALSE;
+        for (i = 0; i < count; i++)
+        {
+            CSimJob* job = &jobs[i];
+            if (job->State == sjsRunning && job->Remaining <= 1e-6)
+            {
+                job->State = sjsDone;
+                job->End = time;
+                *turnaround += job->End - job->Added;
+                if (policy == spDevSched)
+                    scheduler.RemoveJob(i);
+                done++;
+                changed = TRUE;
+            }
+        }
+        if (changed)
+            StartJobs(policy, jobs, count, &scheduler, &started);
+    }
+    return time;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "usage: queuebench [-j <jobs>] [-r <runs>] [-a <mean gap s>] [-s <seed>] [-v]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int jobsCount = 12;
+    int runs = 50;
+    double meanGap = 0;
+    BOOL verbose = FALSE;
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+            verbose = TRUE;
+        else if (i + 1 < argc && strcmp(argv[i], "-j") == 0)
+            jobsCount = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-r") == 0)
+            runs = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-a") == 0)
+            meanGap = atof(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            RandSeed = (DWORD)atoi(argv[++i]);
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+    if (jobsCount <= 0 || runs <= 0 || meanGap < 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    CSimJob* jobs = (CSimJob*)malloc(jobsCount * sizeof(CSimJob));
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    double makespan[3] = {0, 0, 0};
+    double turnaround[3] = {0, 0, 0};
+    double totalSize = 0;
+    int run;
+    for (run = 0; run < runs; run++)
+    {
+        GenerateJobs(jobs, jobsCount, meanGap);
+        for (i = 0; i < jobsCount; i++)
+            totalSize += jobs[i].Size;
+        int p;
+        for (p = spAll; p <= spDevSched; p++)
+        {
+            double m = Simulate((CSimPolicy)p, jobs, jobsCount, &turnaround[p]);
+            if (m < 0)
+            {
+                free(jobs);
+                return 1;
+            }
+            makespan[p] += m;
+            if (verbose)
+                printf("run %d: %-8s makespan %8.1f s\n", run + 1, PolicyNames[p], m);
+        }
+    }
+    free(jobs);
+
+    printf("policy,makespan_s,mb_per_s,mean_turnaround_s\n");
+    int p;
+    for (p = spAll; p <= spDevSched; p++)
+    {
+        printf("%s,%.1f,%.1f,%.1f\n", PolicyNames[p], makespan[p], totalSize / makespan[p],
+               turnaround[p] / ((double)runs * jobsCount));
+    }
+    return 0;
+}
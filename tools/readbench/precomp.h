@@ -0,0 +1,72 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/listread.cpp outside of Salamander; the
+// reader needs only a few Windows types, Interlocked functions and GetTickCount, so on
+// other systems they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else // _WIN32
+
+#include <stdint.h>
+#include <time.h>
+
+typedef int BOOL;
+typedef int32_t LONG;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+#define __int64 long long
+#define TRUE 1
+#define FALSE 0
+
+#define NO_ERROR 0
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE 0x00000020
+
+inline LONG InterlockedIncrement(volatile LONG* value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* value)
+{
+    return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG* target, LONG exchange, LONG comparand)
+{
+    __atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+inline DWORD GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+#endif // _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the reader reports only low memory through TRACE_E
+#define LOW_MEMORY "Low memory"
+#define TRACE_E(str) fprintf(stderr, "error: %s\n", str)
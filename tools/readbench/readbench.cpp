@@ -0,0 +1,407 @@
+﻿/*
+    Benchmark of the progressive directory listing of Salamander (CFilesWindow::
+    ReadDirectory in src/fileswn3.cpp, the batches of items are CListingReader from
+    src/common/listread.cpp). Every directory of a tree is listed in these ways:
+
+      "sync"        - the directory is read and sorted in the thread of the panel,
+                      nothing is shown until the whole listing is read (how Salamander
+                      did it before).
+
+      "progressive" - a reader thread reads the directory and publishes batches of
+                      items, the thread of the panel takes them when it is notified,
+                      sorts the new items and merges them into the sorted listing and
+                      then walks the whole listing (like RefreshListBox measuring the
+                      names); between two takings it pauses for a multiple of the time
+                      of the last taking.
+
+    "first_ms" is the time until the panel shows the first items (the whole listing
+    for "sync"), "stall_ms" is the longest time the thread of the panel was busy at
+    once (the panel does not respond to the user meanwhile).
+
+    Usage:
+      readbench <directory> [options]
+        -s         list also all subdirectories (the whole tree)
+        -m <mode>  sync or progressive (default both)
+        -r <n>     repetitions of every measurement, the fastest is reported (default 3)
+        -l <us>    simulated latency of reading one item in microseconds (default 0)
+
+    Output:
+      One CSV line per way: way,dirs,items,first_ms,total_ms,takes,stall_ms
+      (the times are the sums over all directories, stall_ms is the maximum).
+
+    Notes:
+      The tree is listed once before the measurement (to find the subdirectories),
+      so the file system cache is warm; put the tree on a network share or use -l
+      to see the effect of latency.
+*/
+
+#include "precomp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define READBENCH_SEP '\\'
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define READBENCH_SEP '/'
+#define _stricmp strcasecmp
+#endif
+
+#include "listread.h"
+
+struct CBenchItem
+{
+    std::string Name;
+    unsigned __int64 Size;
+    DWORD Attr;
+    unsigned __int64 LastWrite; // FILETIME as a number
+};
+
+// the order of a panel sorted by name: case-insensitively, then case-sensitively
+static bool LessItem(const CBenchItem& a, const CBenchItem& b)
+{
+    int res = _stricmp(a.Name.c_str(), b.Name.c_str());
+    if (res == 0)
+        res = strcmp(a.Name.c_str(), b.Name.c_str());
+    return res < 0;
+}
+
+static int Latency = 0; // -l: simulated latency of reading one item in microseconds
+
+typedef void (*CAddItemFunc)(void* param, const char* name, int len, DWORD attr, unsigned __int64 size,
+                             DWORD lastWriteLow, DWORD lastWriteHigh);
+
+// lists directory 'dir' (without "." and "..") and passes every item to 'add'; 'stop' can
+// stop the listing; returns FALSE if the directory cannot be opened
+static BOOL ListDirectory(const std::string& dir, CAddItemFunc add, void* param, BOOL (*stop)(void* param))
+{
+    int items = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATA data;
+    HANDLE find = FindFirstFile((dir + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return FALSE;
+    do
+    {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0)
+            continue;
+        if (Latency > 0 && ++items % 100 == 0) // a network share returns the items in larger pieces
+            std::this_thread::sleep_for(std::chrono::microseconds(100 * Latency));
+        add(param, data.cFileName, (int)strlen(data.cFileName), data.dwFileAttributes,
+            ((unsigned __int64)data.nFileSizeHigh << 32) | data.nFileSizeLow,
+            data.ftLastWriteTime.dwLowDateTime, data.ftLastWriteTime.dwHighDateTime);
+    } while ((stop == NULL || !stop(param)) && FindNextFile(find, &data));
+    FindClose(find);
+#else
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL)
+        return FALSE;
+    struct dirent* e;
+    while ((stop == NULL || !stop(param)) && (e = readdir(d)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        if (Latency > 0 && ++items % 100 == 0) // a network share returns the items in larger pieces
+            std::this_thread::sleep_for(std::chrono::microseconds(100 * Latency));
+        // the same data as FindNextFile returns
+        struct stat st;
+        if (fstatat(dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            memset(&st, 0, sizeof(st));
+        unsigned __int64 time = (unsigned __int64)st.st_mtime * 10000000 + 116444736000000000ULL;
+        add(param, e->d_name, (int)strlen(e->d_name),
+            S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE,
+            S_ISDIR(st.st_mode) ? 0 : (unsigned __int64)st.st_size, (DWORD)time, (DWORD)(time >> 32));
+    }
+    closedir(d);
+#endif
+    return TRUE;
+}
+
+static void AddToVector(void* param, const char* name, int len, DWORD attr, unsigned __int64 size,
+                        DWORD lastWriteLow, DWORD lastWriteHigh)
+{
+    CBenchItem item;
+    item.Name.assign(name, len);
+    item.Size = size;
+    item.Attr = attr;
+    item.LastWrite = ((unsigned __int64)lastWriteHigh << 32) | lastWriteLow; // the listing keeps it too
+    ((std::vector<CBenchItem>*)param)->push_back(item);
+}
+
+// walks the whole listing like RefreshListBox measuring the names
+static size_t MeasureListing(const std::vector<CBenchItem>& items)
+{
+    size_t width = 0;
+    size_t i;
+    for (i = 0; i < items.size(); i++)
+        width = std::max(width, items[i].Name.length());
+    return width;
+}
+
+static double Ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+struct CBenchResult
+{
+    size_t Items;
+    double FirstMs;
+    double TotalMs;
+    int Takes;
+    double StallMs;
+};
+
+static volatile size_t Measured = 0; // keeps MeasureListing() from being optimized out
+
+static CBenchResult ReadSync(const std::string& dir)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<CBenchItem> items;
+    ListDirectory(dir, AddToVector, &items, NULL);
+    std::sort(items.begin(), items.end(), LessItem);
+    Measured += MeasureListing(items);
+    CBenchResult res;
+    res.Items = items.size();
+    res.TotalMs = Ms(start, std::chrono::steady_clock::now());
+    res.FirstMs = res.TotalMs;
+    res.Takes = 1;
+    res.StallMs = res.TotalMs;
+    return res;
+}
+
+// the panel side: the notification of the reader sets an event (a posted message in Salamander)
+struct CBenchConsumer
+{
+    std::mutex Lock;
+    std::condition_variable Notified;
+    bool Signaled;
+};
+
+static void NotifyConsumer(void* param)
+{
+    CBenchConsumer* consumer = (CBenchConsumer*)param;
+    std::lock_guard<std::mutex> lock(consumer->Lock);
+    consumer->Signaled = true;
+    consumer->Notified.notify_one();
+}
+
+static void AddToReader(void* param, const char* name, int len, DWORD attr, unsigned __int64 size,
+                        DWORD lastWriteLow, DWORD lastWriteHigh)
+{
+    CListingReader* reader = (CListingReader*)param;
+    if (!reader->Add(name, len, NULL, 0, attr, size, lastWriteLow, lastWriteHigh, 0))
+        reader->Cancel();
+}
+
+static BOOL ReaderCancelled(void* param)
+{
+    return ((CListingReader*)param)->IsCancelled();
+}
+
+static void ReaderThread(std::string dir, CListingReader* reader)
+{
+    BOOL opened = ListDirectory(dir, AddToReader, reader, ReaderCancelled);
+    reader->Finish(NO_ERROR, !opened);
+    reader->Release();
+}
+
+static CBenchResult ReadProgressive(const std::string& dir)
+{
+    auto start = std::chrono::steady_clock::now();
+    CBenchResult res;
+    res.FirstMs = 0;
+    res.Takes = 0;
+    res.StallMs = 0;
+    CBenchConsumer consumer;
+    consumer.Signaled = false;
+    CListingReader* reader = new CListingReader(NotifyConsumer, &consumer);
+    reader->AddRef(); // for the reader thread
+    std::thread thread(ReaderThread, dir, reader);
+    std::vector<CBenchItem> items;
+    std::vector<CBenchItem> pending;
+    BOOL shown = FALSE; // FALSE = the listing is being read like before (the whole one is shown if it is read in time)
+    DWORD firstTakeEnd = GetTickCount() + LISTREAD_FIRST_TAKE_PERIOD;
+    while (1)
+    {
+        DWORD wait;
+        if (shown && !reader->BeginTake(GetTickCount(), &wait))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(wait)); // a timer in Salamander
+            continue;
+        }
+        auto takeStart = std::chrono::steady_clock::now();
+        const CListingReadItem* item;
+        while ((item = reader->GetNext()) != NULL)
+        {
+            CBenchItem i;
+            i.Name.assign(item->GetName(), item->NameLen);
+            i.Size = item->Size;
+            i.Attr = item->Attr;
+            pending.push_back(i);
+        }
+        DWORD error;
+        BOOL openFailed;
+        BOOL finished = reader->IsFinished(&error, &openFailed);
+        if (!shown && !finished && (int)(firstTakeEnd - GetTickCount()) > 0)
+        {
+            // the thread of the panel waits for the items (ReadDirectory polls the reader)
+            reader->BeginTake(GetTickCount(), &wait);
+            std::unique_lock<std::mutex> lock(consumer.Lock);
+            if (!consumer.Signaled)
+                consumer.Notified.wait_for(lock, std::chrono::milliseconds(firstTakeEnd - GetTickCount()));
+            consumer.Signaled = false;
+            continue;
+        }
+        if (!pending.empty())
+        {
+            // the new items are sorted and merged into the sorted listing from its end
+            std::sort(pending.begin(), pending.end(), LessItem);
+            size_t count = items.size();
+            items.resize(count + pending.size());
+            size_t out = items.size();
+            size_t i = count;
+            size_t j = pending.size();
+            while (j > 0)
+            {
+                if (i > 0 && LessItem(pending[j - 1], items[i - 1]))
+                    items[--out] = std::move(items[--i]);
+                else
+                    items[--out] = std::move(pending[--j]);
+            }
+            pending.clear();
+            Measured += MeasureListing(items);
+        }
+        auto takeEnd = std::chrono::steady_clock::now();
+        res.Takes++;
+        if (!shown) // the panel was blocked since the start
+        {
+            res.FirstMs = Ms(start, takeEnd);
+            res.StallMs = res.FirstMs;
+            shown = TRUE;
+        }
+        else
+            res.StallMs = std::max(res.StallMs, Ms(takeStart, takeEnd));
+        if (finished)
+            break;
+        reader->EndTake(GetTickCount(), (DWORD)Ms(takeStart, takeEnd));
+        std::unique_lock<std::mutex> lock(consumer.Lock);
+        while (!consumer.Signaled)
+            consumer.Notified.wait(lock);
+        consumer.Signaled = false;
+    }
+    thread.join();
+    reader->Release();
+    res.Items = items.size();
+    res.TotalMs = Ms(start, std::chrono::steady_clock::now());
+    return res;
+}
+
+// adds 'dir' and with 'recursive' all its subdirectories to 'dirs'
+static void FindDirectories(const std::string& dir, BOOL recursive, std::vector<std::string>* dirs)
+{
+    dirs->push_back(dir);
+    if (!recursive)
+        return;
+    std::vector<CBenchItem> items;
+    ListDirectory(dir, AddToVector, &items, NULL);
+    size_t i;
+    for (i = 0; i < items.size(); i++)
+    {
+        if (items[i].Attr & FILE_ATTRIBUTE_DIRECTORY)
+            FindDirectories(dir + READBENCH_SEP + items[i].Name, recursive, dirs);
+    }
+}
+
+static void Measure(const char* way, const std::vector<std::string>& dirs, int repeats,
+                    CBenchResult (*read)(const std::string& dir))
+{
+    CBenchResult best;
+    int r;
+    for (r = 0; r < repeats; r++)
+    {
+        CBenchResult sum;
+        sum.Items = 0;
+        sum.FirstMs = 0;
+        sum.TotalMs = 0;
+        sum.Takes = 0;
+        sum.StallMs = 0;
+        size_t i;
+        for (i = 0; i < dirs.size(); i++)
+        {
+            CBenchResult res = read(dirs[i]);
+            sum.Items += res.Items;
+            sum.FirstMs += res.FirstMs;
+            sum.TotalMs += res.TotalMs;
+            sum.Takes += res.Takes;
+            sum.StallMs = std::max(sum.StallMs, res.StallMs);
+        }
+        if (r == 0 || sum.TotalMs < best.TotalMs)
+            best = sum;
+    }
+    printf("%s,%d,%llu,%.1f,%.1f,%d,%.1f\n", way, (int)dirs.size(), (unsigned long long)best.Items,
+           best.FirstMs, best.TotalMs, best.Takes, best.StallMs);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        fprintf(stderr, "usage: readbench <directory> [-s] [-m sync|progressive] [-r <n>] [-l <us>]\n");
+        return 1;
+    }
+    std::string root = argv[1];
+    BOOL recursive = FALSE;
+    const char* mode = NULL;
+    int repeats = 3;
+    int i;
+    for (i = 2; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "-s") == 0)
+            recursive = TRUE;
+        else if (value == NULL)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return 1;
+        }
+        else
+        {
+            if (strcmp(arg, "-m") == 0)
+                mode = value;
+            else if (strcmp(arg, "-r") == 0)
+                repeats = atoi(value);
+            else if (strcmp(arg, "-l") == 0)
+                Latency = atoi(value);
+            else
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return 1;
+            }
+            i++;
+        }
+    }
+    if (repeats < 1)
+        repeats = 1;
+
+    std::vector<std::string> dirs;
+    FindDirectories(root, recursive, &dirs);
+
+    printf("way,dirs,items,first_ms,total_ms,takes,stall_ms\n");
+    if (mode == NULL || strcmp(mode, "sync") == 0)
+        Measure("sync", dirs, repeats, ReadSync);
+    if (mode == NULL || strcmp(mode, "progressive") == 0)
+        Measure("progressive", dirs, repeats, ReadProgressive);
+    return 0;
+}
@@ -0,0 +1,33 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/litsrch.cpp outside of Salamander; the
+// search needs only a few Windows types, so on other systems they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else // _WIN32
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+#define TRUE 1
+#define FALSE 0
+
+#endif // _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the search reports only low memory through TRACE_E
+#define LOW_MEMORY "Low memory"
+#define TRACE_E(str) fprintf(stderr, "error: %s\n", str)
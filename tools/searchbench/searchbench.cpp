@@ -0,0 +1,352 @@
+﻿/*
+    Benchmark of the literal search of Salamander (CSearchData in src/common/moore.h
+    used by Find, the internal viewer and plugins, the vectorized engine and the
+    multi-pattern search are in src/common/litsrch.cpp). All occurrences of the
+    patterns are searched in a large text or binary buffer in these ways:
+
+      • "bytes" - every position is compared with every pattern byte by byte (the
+                  reference, the other ways must find the same positions).
+
+      • "sse2"  - LiteralSearchSSE2 (how CSearchData::SearchForward searches), one
+                  pass over the buffer for every pattern.
+
+      • "multi" - CMultiLiteralSearch, one pass over the buffer for all patterns.
+
+    The text corpus consists of random words of mixed case, the binary corpus of
+    random bytes; the patterns are put into them at random positions (in random
+    case for the text), so every run finds a known number of occurrences.
+
+    Usage:
+      searchbench [options]
+        -c <s>   corpus: text or binary (default text)
+        -f <f>   search in file <f> instead of a generated corpus
+        -m <n>   size of the generated corpus in MB (default 64)
+        -p <s>   pattern (can be given more times; default a few words, see
+                 DefaultPatterns)
+        -n <n>   use only the first <n> default patterns (default all)
+        -i       case-insensitive search
+        -r <n>   repetitions of every measurement, the fastest is reported (default 3)
+        -s <n>   seed of the random generator (default 1)
+
+    Output:
+      One CSV line per way: way,corpus,mb,patterns,matches,ms,mb_per_s,same_result
+      ("sse2" is missing if the processor does not support SSE2 or the ends of some
+      pattern have more than two forms in the text).
+*/
+
+#include "precomp.h"
+
+#include <ctype.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "litsrch.h"
+
+static const char* DefaultPatterns[] = {"Salamander", "directory", "archive", "Boyer", "panel", "thumbnail",
+                                        "network", "plugin"};
+
+static unsigned int Seed = 1;
+
+static unsigned int Random()
+{
+    Seed = Seed * 1103515245 + 12345;
+    return (Seed >> 8) & 0xFFFFFF;
+}
+
+static BYTE LowerCase[256]; // stand-in for LowerCase from src/common/str.cpp
+
+static void CreateText(std::vector<char>* buf, size_t size)
+{
+    static const char* words[] = {"the", "of", "file", "Data", "copy", "and", "to", "in", "Search",
+                                  "window", "is", "that", "for", "on", "Disk", "with", "as", "size",
+                                  "list", "view", "name", "it", "by", "path", "be", "time"};
+    buf->reserve(size + 20);
+    while (buf->size() < size)
+    {
+        const char* w = words[Random() % 26];
+        buf->insert(buf->end(), w, w + strlen(w));
+        buf->push_back(Random() % 12 == 0 ? '\n' : ' ');
+    }
+    buf->resize(size);
+}
+
+static void CreateBinary(std::vector<char>* buf, size_t size)
+{
+    buf->resize(size);
+    size_t i;
+    for (i = 0; i < size; i++)
+        (*buf)[i] = (char)(Random() >> 4);
+}
+
+// puts every pattern about 'count' times at random positions of 'buf'
+static void PlantPatterns(std::vector<char>* buf, const std::vector<std::string>& patterns, int count, BOOL mixCase)
+{
+    size_t p;
+    for (p = 0; p < patterns.size(); p++)
+    {
+        const std::string& pat = patterns[p];
+        if (pat.size() >= buf->size())
+            continue;
+        int k;
+        for (k = 0; k < count; k++)
+        {
+            size_t pos = ((size_t)Random() * 4096 + Random() % 4096) % (buf->size() - pat.size());
+            size_t j;
+            for (j = 0; j < pat.size(); j++)
+            {
+                char c = pat[j];
+                if (mixCase && Random() % 2 == 0)
+                    c = (char)(isupper((unsigned char)c) ? tolower((unsigned char)c) : toupper((unsigned char)c));
+                (*buf)[pos + j] = c;
+            }
+        }
+    }
+}
+
+static BOOL LoadFile(const char* name, std::vector<char>* buf)
+{
+    FILE* f = fopen(name, "rb");
+    if (f == NULL)
+        return FALSE;
+    char block[65536];
+    size_t read;
+    while ((read = fread(block, 1, sizeof(block), f)) > 0)
+        buf->insert(buf->end(), block, block + read);
+    fclose(f);
+    return TRUE;
+}
+
+// "bytes": positions where some pattern starts
+static void SearchBytes(const std::vector<char>& buf, const std::vector<std::string>& patterns,
+                        const BYTE* lowerCase, std::vector<int>* found)
+{
+    const BYTE* t = (const BYTE*)&buf[0];
+    int length = (int)buf.size();
+    int i;
+    for (i = 0; i < length; i++)
+    {
+        size_t p;
+        for (p = 0; p < patterns.size(); p++)
+        {
+            const BYTE* pat = (const BYTE*)patterns[p].c_str();
+            int len = (int)patterns[p].size();
+            if (i + len > length)
+                continue;
+            int j = 0;
+            if (lowerCase == NULL)
+            {
+                while (j < len && t[i + j] == pat[j])
+                    j++;
+            }
+            else
+            {
+                while (j < len && lowerCase[t[i + j]] == lowerCase[pat[j]])
+                    j++;
+            }
+            if (j == len)
+            {
+                found->push_back(i);
+                break;
+            }
+        }
+    }
+}
+
+// "sse2": one pass for every pattern, the positions are merged; returns FALSE if some
+// pattern cannot be searched this way
+static BOOL SearchSSE2(const std::vector<char>& buf, const std::vector<std::string>& patterns,
+                       const BYTE* lowerCase, std::vector<int>* found)
+{
+    int length = (int)buf.size();
+    size_t p;
+    for (p = 0; p < patterns.size(); p++)
+    {
+        std::string pat = patterns[p];
+        size_t j;
+        if (lowerCase != NULL) // the pattern in the form given by LowerCase (like CSearchData::SetFlags)
+        {
+            for (j = 0; j < pat.size(); j++)
+                pat[j] = (char)lowerCase[(BYTE)pat[j]];
+        }
+        int len = (int)pat.size();
+        BYTE firstBytes[2];
+        BYTE lastBytes[2];
+        if (!GetLiteralMatchingBytes((BYTE)pat[0], lowerCase, firstBytes) ||
+            !GetLiteralMatchingBytes((BYTE)pat[len - 1], lowerCase, lastBytes))
+        {
+            return FALSE;
+        }
+        int pos = 0;
+        while ((pos = LiteralSearchSSE2(&buf[0], length, pos, pat.c_str(), len, lowerCase,
+                                        firstBytes, lastBytes)) != -1)
+        {
+            found->push_back(pos);
+            pos++;
+        }
+    }
+    std::sort(found->begin(), found->end());
+    found->erase(std::unique(found->begin(), found->end()), found->end());
+    return TRUE;
+}
+
+// "multi": one pass for all patterns
+static BOOL SearchMulti(const std::vector<char>& buf, const std::vector<std::string>& patterns,
+                        const BYTE* lowerCase, std::vector<int>* found)
+{
+    CMultiLiteralSearch search;
+    size_t p;
+    for (p = 0; p < patterns.size(); p++)
+    {
+        if (!search.Add(patterns[p].c_str(), (int)patterns[p].size()))
+            return FALSE;
+    }
+    if (!search.Prepare(lowerCase))
+        return FALSE;
+    int length = (int)buf.size();
+    int pos = 0;
+    while ((pos = search.SearchForward(&buf[0], length, pos, NULL)) != -1)
+    {
+        found->push_back(pos);
+        pos++;
+    }
+    return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+    BOOL binary = FALSE;
+    const char* fileName = NULL;
+    int megabytes = 64;
+    int defaultCount = (int)(sizeof(DefaultPatterns) / sizeof(DefaultPatterns[0]));
+    BOOL ignoreCase = FALSE;
+    int repeats = 3;
+    std::vector<std::string> patterns;
+    int i;
+    for (i = 0; i < 256; i++)
+        LowerCase[i] = (BYTE)tolower(i);
+    for (i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "-i") == 0)
+            ignoreCase = TRUE;
+        else if (value == NULL)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return 1;
+        }
+        else
+        {
+            if (strcmp(arg, "-c") == 0)
+            {
+                if (strcmp(value, "text") == 0)
+                    binary = FALSE;
+                else if (strcmp(value, "binary") == 0)
+                    binary = TRUE;
+                else
+                {
+                    fprintf(stderr, "unknown corpus %s\n", value);
+                    return 1;
+                }
+            }
+            else if (strcmp(arg, "-f") == 0)
+                fileName = value;
+            else if (strcmp(arg, "-m") == 0)
+                megabytes = atoi(value);
+            else if (strcmp(arg, "-p") == 0)
+            {
+                if (*value != 0)
+                    patterns.push_back(value);
+            }
+            else if (strcmp(arg, "-n") == 0)
+                defaultCount = std::min(atoi(value), defaultCount);
+            else if (strcmp(arg, "-r") == 0)
+                repeats = atoi(value);
+            else if (strcmp(arg, "-s") == 0)
+                Seed = (unsigned int)atoi(value);
+            else
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return 1;
+            }
+            i++;
+        }
+    }
+    if (patterns.empty())
+    {
+        for (i = 0; i < defaultCount; i++)
+            patterns.push_back(DefaultPatterns[i]);
+    }
+    if (megabytes < 1 || repeats < 1 || patterns.empty() || (int)patterns.size() > MULTISEARCH_MAX_PATTERNS)
+    {
+        fprintf(stderr, "invalid options\n");
+        return 1;
+    }
+
+    std::vector<char> buf;
+    const char* corpus;
+    if (fileName != NULL)
+    {
+        if (!LoadFile(fileName, &buf) || buf.empty())
+        {
+            fprintf(stderr, "cannot read %s\n", fileName);
+            return 1;
+        }
+        corpus = "file";
+    }
+    else
+    {
+        size_t size = (size_t)megabytes * 1024 * 1024;
+        if (binary)
+            CreateBinary(&buf, size);
+        else
+            CreateText(&buf, size);
+        PlantPatterns(&buf, patterns, 100 * megabytes, !binary && ignoreCase);
+        corpus = binary ? "binary" : "text";
+    }
+    const BYTE* lowerCase = ignoreCase ? LowerCase : NULL;
+    double mb = (double)buf.size() / (1024 * 1024);
+
+    static const char* ways[] = {"bytes", "sse2", "multi"};
+    std::vector<int> reference;
+    printf("way,corpus,mb,patterns,matches,ms,mb_per_s,same_result\n");
+    int way;
+    for (way = 0; way < 3; way++)
+    {
+        if (way == 1 && !IsSSE2Present())
+            continue;
+        double best = 0;
+        std::vector<int> found;
+        BOOL ok = TRUE;
+        int r;
+        for (r = 0; r < repeats && ok; r++)
+        {
+            found.clear();
+            auto start = std::chrono::steady_clock::now();
+            switch (way)
+            {
+            case 0:
+                SearchBytes(buf, patterns, lowerCase, &found);
+                break;
+            case 1:
+                ok = SearchSSE2(buf, patterns, lowerCase, &found);
+                break;
+            default:
+                ok = SearchMulti(buf, patterns, lowerCase, &found);
+                break;
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (r == 0 || ms < best)
+                best = ms;
+        }
+        if (!ok)
+            continue;
+        if (way == 0)
+            reference = found;
+        printf("%s,%s,%.1f,%d,%d,%.1f,%.0f,%s\n", ways[way], corpus, mb, (int)patterns.size(), (int)found.size(),
+               best, best > 0 ? mb * 1000 / best : 0.0, way == 0 ? "-" : (found == reference ? "yes" : "NO"));
+    }
+    return 0;
+}
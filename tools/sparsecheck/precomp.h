@@ -0,0 +1,112 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/copyeng.cpp outside of Salamander; the engine
+// needs only Windows types, error codes and GetTickCount (the files are accessed by its
+// backends), so on other systems they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <commctrl.h>
+
+#else // _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef uintptr_t DWORD_PTR;
+#define __int64 long long
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+
+#define MAX_PATH 260
+
+#define NO_ERROR 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_ACCESS_DENIED 5
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_GEN_FAILURE 31
+#define ERROR_HANDLE_EOF 38
+#define ERROR_DISK_FULL 112
+#define ERROR_OPERATION_ABORTED 995
+#define ERROR_CANCELLED 1223
+
+// types used only in declarations of spl_com.h (the benchmark needs CQuadWord from it)
+typedef void* HWND;
+typedef void* HICON;
+typedef void* HIMAGELIST;
+
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+
+struct SYSTEMTIME
+{
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+};
+
+inline DWORD GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// CQuadWord (spl_com.h) has a copy constructor but the implicit assignment, g++ warns about
+// every assignment
+#pragma GCC diagnostic ignored "-Wdeprecated-copy"
+
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+#define sprintf_s(buffer, ...) snprintf(buffer, sizeof(buffer), __VA_ARGS__)
+#define sscanf_s sscanf
+
+#endif // _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ostream>
+#include <sstream>
+
+#include "spl_com.h"
+
+// the engine reports only unexpected situations through TRACE, print them to stderr
+// (an expression, TRACE_C is used inside expressions)
+#define SPARSECHECK_TRACE(kind, msg) \
+    ([&]() \
+     { \
+         std::ostringstream _s; \
+         _s << msg; \
+         fprintf(stderr, "%s: %s\n", kind, _s.str().c_str()); \
+     }())
+
+#define TRACE_I(str) SPARSECHECK_TRACE("info", str)
+#define TRACE_E(str) SPARSECHECK_TRACE("error", str)
+#define TRACE_C(str) (SPARSECHECK_TRACE("fatal", str), abort())
@@ -0,0 +1,492 @@
+﻿/*
+    Check of the copy to a sparse file (DoCopyFileLoopSparse in src/worker.cpp, used
+    with Configuration.CopySparseFiles) outside of Salamander. The file is copied by
+    the same pieces of the engine (src/common/copyeng.cpp): only the allocated ranges
+    of the source are read (CCopyRanges: FSCTL_QUERY_ALLOCATED_RANGES on Windows,
+    SEEK_DATA/SEEK_HOLE on Linux), runs of zero blocks are not written
+    (CopyFindDataRun) and the blocks are read and written by CCopyIoPositional, with
+    the block sizes of Salamander (SPARSECOPY_BUF_SIZE, SPARSECOPY_ZERO_BLOCK).
+
+    After the copy the target is compared with the source: the content must be the
+    same and the target must not have data where the source has a hole (every
+    allocated range of the target lies inside an allocated range of the source);
+    the allocated zeros of the test files must become holes.
+
+    Usage:
+      sparsecheck <directory>
+        creates test files in <directory> (holes at the start, in the middle and
+        at the end, allocated zeros, a file without data, a dense file, many small
+        ranges), copies and checks them and deletes them
+      sparsecheck <source file> <target file>
+        copies <source file> to <target file> (overwritten, left on the disk) and
+        checks it
+
+    Output:
+      One CSV line per file
+      (file,size_kb,source_alloc_kb,target_alloc_kb,source_ranges,target_ranges,written_kb,result),
+      result is "ok" or the first difference found. Exit code 1 if any check failed.
+
+    Notes:
+      The volume of the target must support sparse files (NTFS/ReFS on Windows; ext4,
+      XFS, btrfs, tmpfs on Linux), otherwise the holes are filled and the check fails.
+      Linux: builds with g++ -O2 -I. -I../../src/common -I../../src/plugins/shared
+      sparsecheck.cpp ../../src/common/copyeng.cpp
+*/
+
+#include "precomp.h"
+
+#include <vector>
+
+#include "copyeng.h"
+
+#define SPARSECOPY_BUF_SIZE (1024 * 1024) // like in src/worker.cpp
+#define SPARSECOPY_ZERO_BLOCK (64 * 1024) // like in src/worker.cpp
+
+#ifdef _WIN32
+typedef HANDLE CFileHandle;
+#define INVALID_FILE INVALID_HANDLE_VALUE
+#else  // _WIN32
+typedef int CFileHandle;
+#define INVALID_FILE -1
+#endif // _WIN32
+
+struct CRange
+{
+    CQuadWord Start;
+    CQuadWord End;
+};
+
+// data of a test file: 'Count' runs of 'Length' bytes ('Step' bytes apart) from 'Offset'
+struct CTestRun
+{
+    unsigned __int64 Offset;
+    DWORD Length;
+    BOOL Zeros; // TRUE = allocated zeros (written, the copy turns them into a hole)
+    int Count;
+    DWORD Step;
+};
+
+struct CTestFile
+{
+    const char* Name;
+    unsigned __int64 Size;
+    CTestRun Runs[3];
+    int RunsCount;
+};
+
+#define KB (1024)
+#define MB (1024 * 1024)
+
+static const CTestFile TestFiles[] = {
+    // data, a hole, data not aligned to blocks, a hole up to the end
+    {"holes", 32 * MB, {{0, 1 * MB, FALSE, 1, 0}, {9 * MB, 300 * KB + 123, FALSE, 1, 0}}, 2},
+    // a hole at the start
+    {"leading-hole", 4 * MB + 64 * KB, {{4 * MB, 64 * KB, FALSE, 1, 0}}, 1},
+    // allocated zeros between data
+    {"zero-run", 6 * MB, {{0, 1 * MB, FALSE, 1, 0}, {1 * MB, 2 * MB, TRUE, 1, 0}, {3 * MB, 3 * MB, FALSE, 1, 0}}, 3},
+    // only a hole
+    {"no-data", 16 * MB, {}, 0},
+    // no hole
+    {"dense", 3 * MB + 123, {{0, 3 * MB + 123, FALSE, 1, 0}}, 1},
+    // more ranges than one query of the allocated ranges returns (COPYRANGES_QUERY)
+    {"many-ranges", 200 * 256 * KB, {{0, 4 * KB, FALSE, 200, 256 * KB}}, 1},
+};
+
+static void PrintLastError(const char* what, const char* name)
+{
+#ifdef _WIN32
+    fprintf(stderr, "%s %s: error %u\n", what, name, GetLastError());
+#else  // _WIN32
+    fprintf(stderr, "%s %s: %s\n", what, name, strerror(errno));
+#endif // _WIN32
+}
+
+// opens file 'name' for reading or creates it (overwrites it) for writing; a created file
+// is marked sparse on Windows (like PrepareSparseTgt in src/worker.cpp); INVALID_FILE = error
+// (reported)
+static CFileHandle OpenFile(const char* name, BOOL create)
+{
+#ifdef _WIN32
+    HANDLE file = create ? CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL)
+                         : CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    DWORD returned;
+    if (file != INVALID_HANDLE_VALUE && create &&
+        !DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL))
+    {
+        PrintLastError("Unable to make sparse", name);
+        CloseHandle(file);
+        return INVALID_HANDLE_VALUE;
+    }
+#else  // _WIN32
+    int file = create ? open(name, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(name, O_RDONLY);
+#endif // _WIN32
+    if (file == INVALID_FILE)
+        PrintLastError(create ? "Unable to create" : "Unable to open", name);
+    return file;
+}
+
+static void CloseFile(CFileHandle file)
+{
+#ifdef _WIN32
+    CloseHandle(file);
+#else  // _WIN32
+    close(file);
+#endif // _WIN32
+}
+
+static void DeleteTestFile(const char* name)
+{
+#ifdef _WIN32
+    DeleteFileA(name);
+#else  // _WIN32
+    unlink(name);
+#endif // _WIN32
+}
+
+static BOOL GetSize(CFileHandle file, CQuadWord* size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER s;
+    if (!GetFileSizeEx(file, &s))
+        return FALSE;
+    size->SetUI64(s.QuadPart);
+#else  // _WIN32
+    struct stat st;
+    if (fstat(file, &st) != 0)
+        return FALSE;
+    size->SetUI64((unsigned __int64)st.st_size);
+#endif // _WIN32
+    return TRUE;
+}
+
+static BOOL SetSize(CFileHandle file, const CQuadWord& size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER pos;
+    pos.QuadPart = size.Value;
+    return SetFilePointerEx(file, pos, NULL, FILE_BEGIN) && SetEndOfFile(file);
+#else  // _WIN32
+    return ftruncate(file, (off_t)size.Value) == 0;
+#endif // _WIN32
+}
+
+// returns the space allocated by file 'name' in bytes
+static unsigned __int64 GetAllocatedSize(const char* name)
+{
+#ifdef _WIN32
+    DWORD high;
+    DWORD low = GetCompressedFileSizeA(name, &high);
+    if (low == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+        return 0;
+    return ((unsigned __int64)high << 32) | low;
+#else  // _WIN32
+    struct stat st;
+    return stat(name, &st) == 0 ? (unsigned __int64)st.st_blocks * 512 : 0;
+#endif // _WIN32
+}
+
+// reads the allocated ranges of 'file' to 'ranges'; FALSE = not available
+static BOOL GetRanges(CFileHandle file, const CQuadWord& size, std::vector<CRange>& ranges)
+{
+#ifdef _WIN32
+    CCopyRangesAllocated query(&file, NULL);
+#else  // _WIN32
+    CCopyRangesSeek query(&file);
+#endif // _WIN32
+    ranges.clear();
+    CRange range;
+    range.End.Set(0, 0);
+    DWORD err;
+    while (query.GetNextRange(range.End, size, &range.Start, &range.End, &err))
+        ranges.push_back(range);
+    return err == NO_ERROR;
+}
+
+// fills 'buf' with data containing no zero byte (the 'offset' of the data in the file makes
+// every block different)
+static void FillData(char* buf, DWORD size, unsigned __int64 offset)
+{
+    for (DWORD i = 0; i < size; i++)
+        buf[i] = (char)((((offset + i) * 2654435761u) >> 13) | 1);
+}
+
+// creates test file 'name' described by 'test'; FALSE = error (reported)
+static BOOL CreateTestFile(const char* name, const CTestFile* test, char* buf)
+{
+    CFileHandle file = OpenFile(name, TRUE);
+    if (file == INVALID_FILE)
+        return FALSE;
+    CCopyIoPositional io(&file, &file);
+    BOOL ok = TRUE;
+    for (int r = 0; ok && r < test->RunsCount; r++)
+    {
+        const CTestRun* run = &test->Runs[r];
+        for (int i = 0; ok && i < run->Count; i++)
+        {
+            CQuadWord offset;
+            offset.SetUI64(run->Offset + (unsigned __int64)i * run->Step);
+            for (DWORD done = 0; ok && done < run->Length;)
+            {
+                DWORD size = run->Length - done < SPARSECOPY_BUF_SIZE ? run->Length - done : SPARSECOPY_BUF_SIZE;
+                if (run->Zeros)
+                    memset(buf, 0, size);
+                else
+                    FillData(buf, size, offset.Value + done);
+                DWORD written, err;
+                ok = io.StartWrite(0, buf, size, offset + CQuadWord(done, 0), &err) && io.GetResult(0, &written, &err) &&
+                     written == size;
+                done += size;
+            }
+        }
+    }
+    CQuadWord size;
+    size.SetUI64(test->Size);
+    if (ok)
+        ok = SetSize(file, size);
+    if (!ok)
+        PrintLastError("Unable to write", name);
+    CloseFile(file);
+    return ok;
+}
+
+// copies 'source' to 'target' like DoCopyFileLoopSparse in src/worker.cpp: only the allocated
+// ranges of the source are read, runs of zero blocks are not written, the size of the target
+// is set at the end; returns the written bytes in 'written'; FALSE = error (reported)
+static BOOL CopySparse(const char* source, const char* target, char* buf, CQuadWord* written)
+{
+    CFileHandle in = OpenFile(source, FALSE);
+    if (in == INVALID_FILE)
+        return FALSE;
+    CFileHandle out = OpenFile(target, TRUE);
+    if (out == INVALID_FILE)
+    {
+        CloseFile(in);
+        return FALSE;
+    }
+    CQuadWord fileSize;
+    BOOL ok = GetSize(in, &fileSize);
+
+    CCopyIoPositional io(&in, &out);
+#ifdef _WIN32
+    CCopyRangesAllocated ranges(&in, NULL);
+#else  // _WIN32
+    CCopyRangesSeek ranges(&in);
+#endif // _WIN32
+    BOOL allocatedOnly = TRUE;          // FALSE = the source does not return its allocated ranges, it is read whole
+    CQuadWord dataEnd(0, 0);            // end of the allocated range being copied
+    CQuadWord operationDone(0, 0);      // offset of the next read
+    written->Set(0, 0);
+    while (ok)
+    {
+        if (allocatedOnly && operationDone >= dataEnd)
+        { // find the next allocated range of the source
+            CQuadWord dataStart;
+            DWORD err;
+            if (!ranges.GetNextRange(operationDone, fileSize, &dataStart, &dataEnd, &err))
+            {
+                if (err != NO_ERROR)
+                {
+                    fprintf(stderr, "Unable to get allocated ranges of %s (error %u), reading it whole.\n", source, err);
+                    allocatedOnly = FALSE;
+                    continue;
+                }
+                // a hole behind the last allocated range up to the end of the file
+                dataStart = fileSize > operationDone ? fileSize : operationDone;
+                allocatedOnly = FALSE;
+            }
+            if (dataStart > operationDone) // skip the hole, it stays a hole in the target
+                operationDone = dataStart;
+            continue;
+        }
+
+        DWORD size = SPARSECOPY_BUF_SIZE;
+        if (allocatedOnly && dataEnd - operationDone < CQuadWord(size, 0))
+            size = (dataEnd - operationDone).LoDWord;
+        DWORD read, err;
+        if (!io.StartRead(0, buf, size, operationDone, &err) || !io.GetResult(0, &read, &err))
+        {
+            if (err == ERROR_HANDLE_EOF)
+                break;
+            fprintf(stderr, "Unable to read %s: error %u\n", source, err);
+            ok = FALSE;
+            break;
+        }
+        if (read == 0)
+            break; // EOF
+
+        // write the non-zero runs (neighbouring non-zero blocks at once)
+        DWORD pos = 0;
+        while (ok && pos < read)
+        {
+            DWORD start, end;
+            CopyFindDataRun(buf, read, pos, SPARSECOPY_ZERO_BLOCK, &start, &end);
+            if (start < end)
+            {
+                DWORD done;
+                if (!io.StartWrite(0, buf + start, end - start, operationDone + CQuadWord(start, 0), &err) ||
+                    !io.GetResult(0, &done, &err) || done != end - start)
+                {
+                    fprintf(stderr, "Unable to write %s: error %u\n", target, err);
+                    ok = FALSE;
+                }
+                *written += CQuadWord(end - start, 0);
+            }
+            pos = end;
+        }
+        operationDone += CQuadWord(read, 0);
+    }
+    if (ok && !SetSize(out, operationDone))
+    {
+        PrintLastError("Unable to set size of", target);
+        ok = FALSE;
+    }
+    CloseFile(in);
+    CloseFile(out);
+    return ok;
+}
+
+// returns TRUE if range 'range' lies inside one of 'ranges'
+static BOOL IsInsideRanges(const CRange& range, const std::vector<CRange>& ranges)
+{
+    for (const CRange& r : ranges)
+    {
+        if (r.Start <= range.Start && range.End <= r.End)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// returns TRUE if range 'range' overlaps one of 'ranges'
+static BOOL OverlapsRanges(const CRange& range, const std::vector<CRange>& ranges)
+{
+    for (const CRange& r : ranges)
+    {
+        if (r.Start < range.End && range.Start < r.End)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// copies 'source' to 'target', checks the copy and prints its line; 'test' (NULL = an existing
+// file) gives the allocated zeros which must become holes; FALSE = the check failed
+static BOOL CheckFile(const char* label, const char* source, const char* target, const CTestFile* test,
+                      char* buf, char* buf2)
+{
+    CQuadWord written;
+    if (!CopySparse(source, target, buf, &written))
+        return FALSE;
+
+    CFileHandle in = OpenFile(source, FALSE);
+    CFileHandle out = in != INVALID_FILE ? OpenFile(target, FALSE) : INVALID_FILE;
+    if (out == INVALID_FILE)
+    {
+        if (in != INVALID_FILE)
+            CloseFile(in);
+        return FALSE;
+    }
+    const char* result = "ok";
+    CQuadWord sourceSize, targetSize;
+    std::vector<CRange> sourceRanges, targetRanges;
+    BOOL rangesKnown = FALSE;
+    if (!GetSize(in, &sourceSize) || !GetSize(out, &targetSize) || sourceSize != targetSize)
+        result = "size differs";
+    else
+    {
+        CCopyIoPositional ioIn(&in, &in);
+        CCopyIoPositional ioOut(&out, &out);
+        CQuadWord offset(0, 0);
+        while (offset < sourceSize)
+        {
+            DWORD size = sourceSize - offset < CQuadWord(SPARSECOPY_BUF_SIZE, 0) ? (sourceSize - offset).LoDWord : SPARSECOPY_BUF_SIZE;
+            DWORD read, read2, err;
+            if (!ioIn.StartRead(0, buf, size, offset, &err) || !ioIn.GetResult(0, &read, &err) ||
+                !ioOut.StartRead(0, buf2, size, offset, &err) || !ioOut.GetResult(0, &read2, &err) ||
+                read != size || read2 != size)
+            {
+                result = "read error";
+                break;
+            }
+            if (memcmp(buf, buf2, size) != 0)
+            {
+                result = "content differs";
+                break;
+            }
+            offset += CQuadWord(size, 0);
+        }
+
+        rangesKnown = GetRanges(in, sourceSize, sourceRanges) && GetRanges(out, targetSize, targetRanges);
+        if (!rangesKnown)
+            result = strcmp(result, "ok") == 0 ? "allocated ranges not available" : result;
+        for (size_t i = 0; rangesKnown && i < targetRanges.size() && strcmp(result, "ok") == 0; i++)
+        {
+            if (!IsInsideRanges(targetRanges[i], sourceRanges))
+                result = "data in a hole of the source";
+        }
+        for (int r = 0; rangesKnown && test != NULL && r < test->RunsCount && strcmp(result, "ok") == 0; r++)
+        {
+            CRange zeros;
+            zeros.Start.SetUI64(test->Runs[r].Offset);
+            zeros.End.SetUI64(test->Runs[r].Offset + test->Runs[r].Length);
+            if (test->Runs[r].Zeros && OverlapsRanges(zeros, targetRanges))
+                result = "zeros not turned into a hole";
+        }
+    }
+    CloseFile(in);
+    CloseFile(out);
+
+    printf("%s,%llu,%llu,%llu,%d,%d,%llu,%s\n", label, sourceSize.Value / 1024, GetAllocatedSize(source) / 1024,
+           GetAllocatedSize(target) / 1024, rangesKnown ? (int)sourceRanges.size() : -1,
+           rangesKnown ? (int)targetRanges.size() : -1, written.Value / 1024, result);
+    fflush(stdout);
+    return strcmp(result, "ok") == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: sparsecheck <directory>\n"
+                        "       sparsecheck <source file> <target file>\n");
+        return 2;
+    }
+    char* buf = (char*)malloc(SPARSECOPY_BUF_SIZE);
+    char* buf2 = (char*)malloc(SPARSECOPY_BUF_SIZE);
+    if (buf == NULL || buf2 == NULL)
+    {
+        fprintf(stderr, "Low memory.\n");
+        return 1;
+    }
+
+    printf("file,size_kb,source_alloc_kb,target_alloc_kb,source_ranges,target_ranges,written_kb,result\n");
+    int exitCode = 0;
+    if (argc == 3)
+    {
+        if (!CheckFile(argv[1], argv[1], argv[2], NULL, buf, buf2))
+            exitCode = 1;
+    }
+    else
+    {
+#ifdef _WIN32
+        const char* separator = "\\";
+#else  // _WIN32
+        const char* separator = "/";
+#endif // _WIN32
+        const char* dir = argv[1];
+        if (dir[0] == 0 || dir[strlen(dir) - 1] == separator[0])
+            separator = "";
+        for (size_t i = 0; i < _countof(TestFiles); i++)
+        {
+            char source[MAX_PATH];
+            char target[MAX_PATH];
+            sprintf_s(source, "%s%ssparsecheck-%s.bin", dir, separator, TestFiles[i].Name);
+            sprintf_s(target, "%s%ssparsecheck-%s.copy", dir, separator, TestFiles[i].Name);
+            if (!CreateTestFile(source, &TestFiles[i], buf) || !CheckFile(TestFiles[i].Name, source, target, &TestFiles[i], buf, buf2))
+                exitCode = 1;
+            DeleteTestFile(source);
+            DeleteTestFile(target);
+        }
+    }
+    free(buf);
+    free(buf2);
+    return exitCode;
+}
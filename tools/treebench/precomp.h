@@ -0,0 +1,43 @@
+﻿// SPDX-FileCopyrightText: 2023 Open Salamander Authors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+// minimal environment for building src/common/treebatch.cpp outside of Salamander; the
+// batch needs only a few Windows types and Interlocked functions, so on other systems
+// they are defined here
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else // _WIN32
+
+#include <stdint.h>
+
+typedef int BOOL;
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+#define TRUE 1
+#define FALSE 0
+
+inline LONG InterlockedIncrement(volatile LONG* value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+#endif // _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
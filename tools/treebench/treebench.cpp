@@ -0,0 +1,344 @@
+﻿/*
+    Benchmark of the concurrent Delete and Change Attributes of Salamander
+    (CTreeOpsProcessor in src/worker.cpp, the ordering of a batch is CTreeBatch
+    from src/common/treebatch.cpp). A synthetic directory tree is created, listed
+    in the order of a Salamander script (the content of a directory before the
+    directory itself) and processed the same way as in the worker: batches of
+    items are handed over to helper threads, a directory is deleted only after
+    all items inside it, and the main thread walks the batch in order (it would
+    report progress and take over the failed items).
+
+    Every run creates the tree again and measures only its processing. The line
+    with one thread is the serial baseline (no helper threads, one item after
+    another as the worker did before).
+
+    Usage:
+      treebench <directory> [options]
+        -w <n>     subdirectories in every directory (default 4)
+        -d <n>     depth of the tree (default 4)
+        -f <n>     files in every directory (default 50)
+        -t <list>  numbers of threads, comma separated (default 1,2,4,8,16)
+        -b <n>     max. items in a batch (default 1024, TREEOPS_MAX_BATCH)
+        -r <n>     repetitions of every measurement, the fastest is reported (default 3)
+        -a         change attributes instead of deleting (read-only on and off)
+
+    Output:
+      One CSV line per number of threads: threads,items,ms,items_per_s.
+
+    Notes:
+      The tree "treebench.tmp" is created in the given directory. Put it on
+      a network share to see the effect on latency bound file systems; on a local
+      disk the result depends a lot on the file system cache.
+*/
+
+#include "precomp.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define TREEBENCH_SEP '\\'
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define TREEBENCH_SEP '/'
+#endif
+
+#include "treebatch.h"
+
+struct CBenchItem
+{
+    std::string Name;
+    BOOL IsDir;
+};
+
+static BOOL ChangeAttrs = FALSE; // -a: change attributes instead of deleting
+static BOOL ReadOnly = FALSE;    // -a: the attribute set in the current run
+
+static BOOL MakeDir(const char* name)
+{
+#ifdef _WIN32
+    return CreateDirectory(name, NULL) != 0;
+#else
+    return mkdir(name, 0755) == 0;
+#endif
+}
+
+static BOOL MakeFile(const char* name)
+{
+    FILE* f = fopen(name, "wb");
+    if (f == NULL)
+        return FALSE;
+    fclose(f);
+    return TRUE;
+}
+
+// processes one item (deletes it or changes its attributes); returns FALSE on error
+static BOOL ProcessItem(const CBenchItem* item)
+{
+#ifdef _WIN32
+    if (ChangeAttrs)
+    {
+        DWORD attrs = (item->IsDir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE) |
+                      (ReadOnly ? FILE_ATTRIBUTE_READONLY : 0);
+        return SetFileAttributes(item->Name.c_str(), attrs) != 0;
+    }
+    if (item->IsDir)
+        return RemoveDirectory(item->Name.c_str()) != 0;
+    return DeleteFile(item->Name.c_str()) != 0;
+#else
+    if (ChangeAttrs)
+        return chmod(item->Name.c_str(), item->IsDir ? (ReadOnly ? 0555 : 0755) : (ReadOnly ? 0444 : 0644)) == 0;
+    if (item->IsDir)
+        return rmdir(item->Name.c_str()) == 0;
+    return unlink(item->Name.c_str()) == 0;
+#endif
+}
+
+// creates directory 'dir' with its content and lists it in the order of the script
+static BOOL CreateTree(const std::string& dir, int width, int depth, int files,
+                       std::vector<CBenchItem>* items)
+{
+    if (!MakeDir(dir.c_str()))
+    {
+        fprintf(stderr, "unable to create directory %s\n", dir.c_str());
+        return FALSE;
+    }
+    char name[50];
+    int i;
+    for (i = 0; i < files; i++)
+    {
+        sprintf(name, "%cfile%04d.txt", TREEBENCH_SEP, i);
+        CBenchItem item = {dir + name, FALSE};
+        if (!MakeFile(item.Name.c_str()))
+        {
+            fprintf(stderr, "unable to create file %s\n", item.Name.c_str());
+            return FALSE;
+        }
+        items->push_back(item);
+    }
+    if (depth > 0)
+    {
+        for (i = 0; i < width; i++)
+        {
+            sprintf(name, "%cdir%02d", TREEBENCH_SEP, i);
+            if (!CreateTree(dir + name, width, depth - 1, files, items))
+                return FALSE;
+        }
+    }
+    CBenchItem item = {dir, TRUE};
+    items->push_back(item);
+    return TRUE;
+}
+
+// state of one batch shared with the helper threads
+struct CBenchBatch
+{
+    CTreeBatch Batch;
+    const CBenchItem* Items; // the first item of the batch
+    std::mutex Lock;
+    std::condition_variable ItemFinished;
+};
+
+static void HelperBody(CBenchBatch* batch)
+{
+    int index;
+    while ((index = batch->Batch.TakeNext()) != -1)
+    {
+        BOOL fallback = FALSE;
+        if (batch->Batch.GetItem(index)->IsDir)
+        {
+            // the same wait as in CTreeOpsProcessor::HelperBody() (an event with a timeout there)
+            std::unique_lock<std::mutex> lock(batch->Lock);
+            while (!batch->Batch.AreChildrenFinished(index, &fallback))
+                batch->ItemFinished.wait_for(lock, std::chrono::milliseconds(5));
+        }
+        BOOL done = !fallback && ProcessItem(&batch->Items[index]);
+        batch->Batch.Finish(index, done);
+        {
+            std::lock_guard<std::mutex> lock(batch->Lock);
+        }
+        batch->ItemFinished.notify_all();
+    }
+}
+
+// processes 'items' in batches with 'threads' helper threads (1 = serially in this thread);
+// returns the time in milliseconds or -1 on error
+static double ProcessTree(const std::vector<CBenchItem>& items, int threads, int maxBatch)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (threads <= 1)
+    {
+        size_t i;
+        for (i = 0; i < items.size(); i++)
+        {
+            if (!ProcessItem(&items[i]))
+            {
+                fprintf(stderr, "unable to process %s\n", items[i].Name.c_str());
+                return -1;
+            }
+        }
+    }
+    else
+    {
+        CBenchBatch batch;
+        if (!batch.Batch.Init(maxBatch))
+        {
+            fprintf(stderr, "low memory\n");
+            return -1;
+        }
+        size_t first = 0;
+        while (first < items.size())
+        {
+            batch.Batch.Reset();
+            batch.Items = &items[first];
+            size_t i;
+            for (i = first; i < items.size() && batch.Batch.Add(items[i].Name.c_str(), items[i].IsDir); i++)
+                ;
+            std::vector<std::thread> helpers;
+            int t;
+            for (t = 0; t < threads && t < batch.Batch.GetCount(); t++)
+                helpers.push_back(std::thread(HelperBody, &batch));
+
+            // the worker walks the batch in order: it waits for every item and takes over
+            // the items left to it
+            int index;
+            for (index = 0; index < batch.Batch.GetCount(); index++)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(batch.Lock);
+                    while (!batch.Batch.IsFinished(index))
+                        batch.ItemFinished.wait_for(lock, std::chrono::milliseconds(5));
+                }
+                if (batch.Batch.GetItem(index)->State != tbsDone && !ProcessItem(&batch.Items[index]))
+                {
+                    fprintf(stderr, "unable to process %s\n", batch.Items[index].Name.c_str());
+                    for (t = 0; t < (int)helpers.size(); t++)
+                        helpers[t].join();
+                    return -1;
+                }
+            }
+            for (t = 0; t < (int)helpers.size(); t++)
+                helpers[t].join();
+            first = i;
+        }
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        fprintf(stderr, "usage: treebench <directory> [-w <n>] [-d <n>] [-f <n>] [-t <list>] [-b <n>] [-r <n>] [-a]\n");
+        return 1;
+    }
+    std::string root = argv[1];
+    if (!root.empty() && root[root.size() - 1] != TREEBENCH_SEP)
+        root += TREEBENCH_SEP;
+    root += "treebench.tmp";
+
+    int width = 4;
+    int depth = 4;
+    int files = 50;
+    int maxBatch = 1024;
+    int repeats = 3;
+    std::vector<int> threads = {1, 2, 4, 8, 16};
+    int i;
+    for (i = 2; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "-a") == 0)
+            ChangeAttrs = TRUE;
+        else if (value == NULL)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return 1;
+        }
+        else
+        {
+            if (strcmp(arg, "-w") == 0)
+                width = atoi(value);
+            else if (strcmp(arg, "-d") == 0)
+                depth = atoi(value);
+            else if (strcmp(arg, "-f") == 0)
+                files = atoi(value);
+            else if (strcmp(arg, "-b") == 0)
+                maxBatch = atoi(value);
+            else if (strcmp(arg, "-r") == 0)
+                repeats = atoi(value);
+            else if (strcmp(arg, "-t") == 0)
+            {
+                threads.clear();
+                const char* s = value;
+                while (*s != 0)
+                {
+                    threads.push_back(atoi(s));
+                    while (*s != 0 && *s != ',')
+                        s++;
+                    if (*s == ',')
+                        s++;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "unknown option %s\n", arg);
+                return 1;
+            }
+            i++;
+        }
+    }
+    if (width < 0 || depth < 0 || files < 0 || maxBatch < 1 || repeats < 1 || threads.empty())
+    {
+        fprintf(stderr, "invalid options\n");
+        return 1;
+    }
+
+    // with -a the tree is created once and its attributes are switched in every run
+    std::vector<CBenchItem> items;
+    if (ChangeAttrs && !CreateTree(root, width, depth, files, &items))
+        return 1;
+
+    printf("threads,items,ms,items_per_s\n");
+    size_t t;
+    for (t = 0; t < threads.size(); t++)
+    {
+        double best = -1;
+        int r;
+        for (r = 0; r < repeats; r++)
+        {
+            if (!ChangeAttrs)
+            {
+                items.clear();
+                if (!CreateTree(root, width, depth, files, &items))
+                    return 1;
+            }
+            else
+                ReadOnly = !ReadOnly;
+            double ms = ProcessTree(items, threads[t], maxBatch);
+            if (ms < 0)
+                return 1;
+            if (best < 0 || ms < best)
+                best = ms;
+        }
+        printf("%d,%d,%.1f,%.0f\n", threads[t], (int)items.size(), best,
+               best > 0 ? items.size() * 1000.0 / best : 0.0);
+    }
+
+    if (ChangeAttrs)
+    {
+        // the tree must be writable again before it can be deleted
+        ReadOnly = FALSE;
+        if (ProcessTree(items, 1, maxBatch) < 0)
+            return 1;
+        ChangeAttrs = FALSE;
+        if (ProcessTree(items, 1, maxBatch) < 0)
+            return 1;
+    }
+    return 0;
+}